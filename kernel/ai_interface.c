@@ -10,6 +10,7 @@
 #include "include/memory.h"
 #include "include/console.h"
 #include "include/process.h"
+#include "include/timer.h"
 #include "include/sandbox.h"
 #include "include/backup.h"
 #include "include/network.h"
@@ -24,16 +25,16 @@
 #include <stdlib.h>
 #include <sys/wait.h>
 
-// Define CLOCK_MONOTONIC if not defined
-#ifndef CLOCK_MONOTONIC
-#define CLOCK_MONOTONIC 1
-#endif
-
 // Maximum number of AI tasks
 #define MAX_AI_TASKS 64
 
-// AI task table
+// Run time limit of a task, enforced by its watchdog timer
+#define AI_TASK_TIME_LIMIT_MS 60000
+
+// AI task table (ai_tasks_lock covers slot changes, next_task_id and the
+// claim of a task by ai_start_task)
 static ai_task_t* ai_tasks[MAX_AI_TASKS];
+static volatile int ai_tasks_lock = 0;
 
 // Next available task ID
 static ai_task_id_t next_task_id = 1;
@@ -51,12 +52,53 @@ static struct {
     ai_health_metrics_t health_metrics;
 } ai_state;
 
+// Number of AI task worker processes
+#define AI_TASK_WORKERS 4
+
+// Stack size of an AI task worker (the NLP executor keeps a 64 KB prompt)
+#define AI_TASK_WORKER_STACK_SIZE (256 * 1024)
+
+// AI task queue
+//
+// Queued tasks wait in one FIFO ring per priority and are served highest
+// priority first by the worker processes. Idle workers sleep in
+// process_block until they are handed work; waiting callers sleep in
+// process_block_unless until their task's result is handed over.
+static struct {
+    int tasks[AI_TASK_NUM_PRIORITIES][MAX_AI_TASKS];    // Task slots
+    uint32_t head[AI_TASK_NUM_PRIORITIES];
+    uint32_t count[AI_TASK_NUM_PRIORITIES];
+    uint32_t depth;
+    uint32_t max_depth;
+    pid_t workers[AI_TASK_WORKERS];
+    int idle[AI_TASK_WORKERS];
+    uint32_t num_workers;
+    uint32_t busy_workers;
+    pid_t waiters[MAX_AI_TASKS];    // Process waiting per task slot, -1 if none
+    volatile int notified[MAX_AI_TASKS];    // Result handed to the waiter per slot
+    hrtimer_t watchdogs[MAX_AI_TASKS];  // Time limit of the running task per slot
+    int stopping;
+    volatile int lock;
+    ai_task_type_stats_t type_stats[AI_TASK_NUM_TYPES];
+} ai_queue;
+
 // Forward declarations
 static int ai_load_model(const ai_model_config_t* config);
 static int ai_unload_model(void);
 static int ai_execute_task(ai_task_id_t task_id);
 static int ai_check_task_limits(ai_task_id_t task_id);
 static int ai_find_free_task_slot(void);
+static int ai_queue_start(void);
+static void ai_queue_stop(void);
+static void ai_queue_lock(void);
+static void ai_queue_unlock(void);
+static void ai_task_table_lock(void);
+static void ai_task_table_unlock(void);
+static int ai_task_slot(ai_task_id_t task_id);
+static int ai_task_finished(const ai_task_t* task);
+static void ai_task_wake(pid_t pid);
+static void ai_task_notify(int slot);
+static void ai_task_watchdog(void* data);
 static int ai_execute_code_generation_task(ai_task_t* task);
 static int ai_execute_code_optimization_task(ai_task_t* task);
 static int ai_execute_code_analysis_task(ai_task_t* task);
@@ -409,15 +451,31 @@ int ai_generate_text(const char* prompt, char* output, size_t output_size,
     return 0;
 }
 
+/**
+ * Get prompt prefix cache statistics
+ * 
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int ai_get_prefix_cache_stats(prefix_cache_stats_t* stats) {
+    // Check if the stats pointer is valid
+    if (!stats) {
+        console_printf("Error: Invalid stats pointer\n");
+        return -1;
+    }
+    
+    prefix_cache_get_stats(stats);
+    
+    return 0;
+}
+
 /**
  * Get the current system time in milliseconds
  * 
  * @return: Current system time in milliseconds
  */
 static uint64_t get_system_time(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    return timer_now_ns() / TIMER_NS_PER_MS;
 }
 
 /**
@@ -444,6 +502,14 @@ int ai_init(const ai_model_config_t* config) {
         ai_tasks[i] = NULL;
     }
     
+    // Initialize the AI task queue
+    memset(&ai_queue, 0, sizeof(ai_queue));
+    
+    for (int i = 0; i < MAX_AI_TASKS; i++) {
+        ai_queue.waiters[i] = -1;
+        hrtimer_init(&ai_queue.watchdogs[i], ai_task_watchdog, (void*)(uintptr_t)i);
+    }
+    
     // Initialize the AI state
     ai_state.initialized = 1;
     ai_state.model_handle = NULL;
@@ -466,6 +532,11 @@ int ai_init(const ai_model_config_t* config) {
     // Save the model configuration
     ai_model_config = *config;
     
+    // Size the prompt prefix cache
+    if (config->prefix_cache_budget) {
+        prefix_cache_set_budget(config->prefix_cache_budget);
+    }
+    
     // Load the AI model
     if (ai_load_model(config) != 0) {
         console_printf("Error: Failed to load AI model\n");
@@ -473,6 +544,11 @@ int ai_init(const ai_model_config_t* config) {
         return -1;
     }
     
+    // Start the task workers; tasks run in the caller if none start
+    if (ai_queue_start() != 0) {
+        console_printf("Warning: No AI task workers, running tasks inline\n");
+    }
+    
     console_printf("AI interface initialized\n");
     return 0;
 }
@@ -489,6 +565,9 @@ int ai_shutdown(void) {
         return 0;
     }
     
+    // Stop the task workers before their tasks and model go away
+    ai_queue_stop();
+    
     // Unload the AI model
     if (ai_unload_model() != 0) {
         console_printf("Error: Failed to unload AI model\n");
@@ -496,7 +575,11 @@ int ai_shutdown(void) {
     }
     
     // Free all AI tasks
+    ai_task_table_lock();
+    
     for (int i = 0; i < MAX_AI_TASKS; i++) {
+        hrtimer_cancel(&ai_queue.watchdogs[i]);
+        
         if (ai_tasks[i]) {
             // Free the input data
             if (ai_tasks[i]->input_data) {
@@ -514,6 +597,8 @@ int ai_shutdown(void) {
         }
     }
     
+    ai_task_table_unlock();
+    
     // Reset the AI state
     ai_state.initialized = 0;
     ai_state.model_handle = NULL;
@@ -558,14 +643,6 @@ ai_task_id_t ai_create_task(ai_task_type_t type, const char* name, const char* d
         return 0;
     }
     
-    // Find a free task slot
-    int slot = ai_find_free_task_slot();
-    
-    if (slot == -1) {
-        console_printf("Error: No free task slots\n");
-        return 0;
-    }
-    
     // Allocate memory for the task
     ai_task_t* task = (ai_task_t*)memory_alloc(sizeof(ai_task_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
     
@@ -575,7 +652,6 @@ ai_task_id_t ai_create_task(ai_task_type_t type, const char* name, const char* d
     }
     
     // Initialize the task
-    task->id = next_task_id++;
     task->type = type;
     task->priority = priority;
     task->state = AI_TASK_STATE_CREATED;
@@ -605,8 +681,28 @@ ai_task_id_t ai_create_task(ai_task_type_t type, const char* name, const char* d
         task->input_size = input_size;
     }
     
-    // Add the task to the task table
-    ai_tasks[slot] = task;
+    // Assign the task ID and add the task to a free slot of the task table
+    ai_task_table_lock();
+    
+    int slot = ai_find_free_task_slot();
+    
+    if (slot != -1) {
+        task->id = next_task_id++;
+        ai_tasks[slot] = task;
+    }
+    
+    ai_task_table_unlock();
+    
+    if (slot == -1) {
+        console_printf("Error: No free task slots\n");
+        
+        if (task->input_data) {
+            memory_free(task->input_data, task->input_size);
+        }
+        
+        memory_free(task, sizeof(ai_task_t));
+        return 0;
+    }
     
     return task->id;
 }
@@ -651,14 +747,70 @@ int ai_start_task(ai_task_id_t task_id) {
         return -1;
     }
     
-    // Set the task state to queued
-    task->state = AI_TASK_STATE_QUEUED;
+    // Check if the task is already queued
+    if (task->state == AI_TASK_STATE_QUEUED) {
+        console_printf("Error: Task is already queued\n");
+        return -1;
+    }
+    
+    // Set the task state to queued, unless another caller claimed the task first
+    ai_task_table_lock();
+    
+    int claimed = task->state != AI_TASK_STATE_QUEUED && task->state != AI_TASK_STATE_RUNNING &&
+                  task->state != AI_TASK_STATE_COMPLETED;
+    
+    if (claimed) {
+        task->state = AI_TASK_STATE_QUEUED;
+    }
+    
+    ai_task_table_unlock();
+    
+    if (!claimed) {
+        console_printf("Error: Task is already queued\n");
+        return -1;
+    }
+    
+    // Set the queue time to the current system time
+    task->queue_time = get_system_time();
+    
+    // Without workers, or without a scheduler to run them, execute the task
+    // in the caller
+    if (ai_queue.num_workers == 0 || !process_scheduler_running()) {
+        task->start_time = task->queue_time;
+        return ai_execute_task(task_id);
+    }
+    
+    // Queue the task and hand it to an idle worker
+    int slot = ai_task_slot(task_id);
+    int priority = task->priority < AI_TASK_NUM_PRIORITIES ? task->priority : AI_TASK_PRIORITY_NORMAL;
+    pid_t worker = -1;
+    
+    ai_queue_lock();
+    
+    uint32_t tail = (ai_queue.head[priority] + ai_queue.count[priority]) % MAX_AI_TASKS;
+    ai_queue.tasks[priority][tail] = slot;
+    ai_queue.count[priority]++;
+    ai_queue.depth++;
+    
+    if (ai_queue.depth > ai_queue.max_depth) {
+        ai_queue.max_depth = ai_queue.depth;
+    }
+    
+    for (uint32_t i = 0; i < ai_queue.num_workers; i++) {
+        if (ai_queue.idle[i]) {
+            ai_queue.idle[i] = 0;
+            worker = ai_queue.workers[i];
+            break;
+        }
+    }
+    
+    ai_queue_unlock();
     
-    // Set the start time to the current system time
-    task->start_time = get_system_time();
+    if (worker >= 0) {
+        ai_task_wake(worker);
+    }
     
-    // Execute the task
-    return ai_execute_task(task_id);
+    return 0;
 }
 
 /**
@@ -701,6 +853,10 @@ int ai_cancel_task(ai_task_id_t task_id) {
     // Set the completion time to the current system time
     task->completion_time = get_system_time();
     
+    // Wake the process waiting for the task; a queued task is dropped by
+    // the worker that dequeues it
+    ai_task_notify(ai_task_slot(task_id));
+    
     return 0;
 }
 
@@ -837,6 +993,36 @@ int ai_wait_for_task(ai_task_id_t task_id, uint64_t timeout_ms) {
         return 0;
     }
     
+    // Without a timeout, sleep until the worker finishing the task wakes
+    // this process
+    process_t* current = process_get_current();
+    int slot = ai_task_slot(task_id);
+    
+    while (timeout_ms == 0 && current && !ai_task_finished(task)) {
+        int registered = 0;
+        
+        ai_queue_lock();
+        
+        if (!ai_task_finished(task) &&
+            (ai_queue.waiters[slot] == -1 || ai_queue.waiters[slot] == current->pid)) {
+            ai_queue.waiters[slot] = current->pid;
+            ai_queue.notified[slot] = 0;
+            registered = 1;
+        }
+        
+        ai_queue_unlock();
+        
+        if (registered) {
+            // A result handed over before this blocks is not lost
+            if (process_block_unless(&ai_queue.notified[slot]) != 0) {
+                process_yield();
+            }
+        } else {
+            // Another process already waits for the task
+            process_yield();
+        }
+    }
+    
     // Wait for the task to complete
     uint64_t start_time = get_system_time();
     uint64_t current_time;
@@ -853,11 +1039,8 @@ int ai_wait_for_task(ai_task_id_t task_id, uint64_t timeout_ms) {
             return -1;
         }
         
-        // Yield to other processes
-        process_yield();
-        
-        // Sleep for a short time to avoid busy waiting
-        process_sleep(10); // 10 ms
+        // Check again in 1 ms, so the timeout is overshot by at most that
+        process_sleep_us(1000);
     }
     
     // Check if the task completed successfully
@@ -869,6 +1052,32 @@ int ai_wait_for_task(ai_task_id_t task_id, uint64_t timeout_ms) {
     return 0;
 }
 
+/**
+ * Get AI task queue statistics
+ * 
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int ai_get_task_queue_stats(ai_task_queue_stats_t* stats) {
+    // Check if the stats pointer is valid
+    if (!stats) {
+        console_printf("Error: Invalid stats pointer\n");
+        return -1;
+    }
+    
+    ai_queue_lock();
+    
+    stats->queue_depth = ai_queue.depth;
+    stats->max_queue_depth = ai_queue.max_depth;
+    stats->num_workers = ai_queue.num_workers;
+    stats->busy_workers = ai_queue.busy_workers;
+    memcpy(stats->types, ai_queue.type_stats, sizeof(stats->types));
+    
+    ai_queue_unlock();
+    
+    return 0;
+}
+
 /**
  * Generate code using the AI model
  * 
@@ -1288,7 +1497,317 @@ int ai_execute_code(const char* code, const char* language, sandbox_flags_t sand
 }
 
 /**
- * Find a free task slot in the task table
+ * Acquire the AI task queue lock
+ */
+static void ai_queue_lock(void) {
+    while (__sync_lock_test_and_set(&ai_queue.lock, 1)) {
+        while (ai_queue.lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release the AI task queue lock
+ */
+static void ai_queue_unlock(void) {
+    __sync_lock_release(&ai_queue.lock);
+}
+
+/**
+ * Acquire the AI task table lock
+ */
+static void ai_task_table_lock(void) {
+    while (__sync_lock_test_and_set(&ai_tasks_lock, 1)) {
+        while (ai_tasks_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release the AI task table lock
+ */
+static void ai_task_table_unlock(void) {
+    __sync_lock_release(&ai_tasks_lock);
+}
+
+/**
+ * Find the task table slot of a task
+ * 
+ * @param task_id: Task ID
+ * @return: Slot index on success, -1 if the task does not exist
+ */
+static int ai_task_slot(ai_task_id_t task_id) {
+    int slot = -1;
+    
+    ai_task_table_lock();
+    
+    for (int i = 0; i < MAX_AI_TASKS; i++) {
+        if (ai_tasks[i] && ai_tasks[i]->id == task_id) {
+            slot = i;
+            break;
+        }
+    }
+    
+    ai_task_table_unlock();
+    
+    return slot;
+}
+
+/**
+ * Check if a task has reached a final state
+ * 
+ * @param task: Task to check
+ * @return: 1 if the task is completed, failed or cancelled, 0 otherwise
+ */
+static int ai_task_finished(const ai_task_t* task) {
+    return task->state == AI_TASK_STATE_COMPLETED ||
+           task->state == AI_TASK_STATE_FAILED ||
+           task->state == AI_TASK_STATE_CANCELLED;
+}
+
+/**
+ * Wake an idle AI task worker
+ * 
+ * The worker was chosen under the queue lock but may not have reached
+ * process_block yet, so this waits for it to block before unblocking it.
+ * 
+ * @param pid: Process ID
+ */
+static void ai_task_wake(pid_t pid) {
+    for (;;) {
+        process_t* process = process_get_by_id(pid);
+        
+        if (!process || process->state == PROCESS_STATE_TERMINATED ||
+            process->state == PROCESS_STATE_ZOMBIE) {
+            return;
+        }
+        
+        if (process->state == PROCESS_STATE_BLOCKED) {
+            process_unblock(pid);
+            return;
+        }
+        
+        process_yield();
+    }
+}
+
+/**
+ * Wake the process waiting for a task, if any
+ * 
+ * @param slot: Task table slot
+ */
+static void ai_task_notify(int slot) {
+    if (slot < 0) {
+        return;
+    }
+    
+    ai_queue_lock();
+    pid_t waiter = ai_queue.waiters[slot];
+    ai_queue.waiters[slot] = -1;
+    ai_queue.notified[slot] = 1;
+    ai_queue_unlock();
+    
+    if (waiter >= 0) {
+        process_unblock(waiter);
+    }
+}
+
+/**
+ * Fail a task that runs past its time limit (watchdog timer callback)
+ * 
+ * Runs in interrupt context, so it only marks the task; the executor
+ * finishes in the worker, which then hands the result to the waiting
+ * process. A caller polling with a timeout sees the failure right away.
+ * 
+ * @param data: Task table slot
+ */
+static void ai_task_watchdog(void* data) {
+    ai_task_t* task = ai_tasks[(int)(uintptr_t)data];
+    
+    if (task && __sync_bool_compare_and_swap(&task->state, AI_TASK_STATE_RUNNING, AI_TASK_STATE_FAILED)) {
+        task->completion_time = get_system_time();
+        console_printf("Error: Task execution time limit exceeded\n");
+    }
+}
+
+/**
+ * Take the next task off the AI task queue
+ * 
+ * Must be called with the queue lock held. Tasks cancelled while queued are
+ * dropped.
+ * 
+ * @return: Task table slot, or -1 if the queue is empty
+ */
+static int ai_queue_pop(void) {
+    for (int priority = AI_TASK_NUM_PRIORITIES - 1; priority >= 0; priority--) {
+        while (ai_queue.count[priority] > 0) {
+            int slot = ai_queue.tasks[priority][ai_queue.head[priority]];
+            ai_queue.head[priority] = (ai_queue.head[priority] + 1) % MAX_AI_TASKS;
+            ai_queue.count[priority]--;
+            ai_queue.depth--;
+            
+            if (ai_tasks[slot] && ai_tasks[slot]->state == AI_TASK_STATE_QUEUED) {
+                return slot;
+            }
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * AI task worker process
+ * 
+ * Runs queued tasks until the AI interface shuts down, blocking whenever the
+ * queue is empty.
+ */
+static void ai_task_worker_main(void) {
+    pid_t self = process_get_current()->pid;
+    
+    for (;;) {
+        ai_queue_lock();
+        
+        if (ai_queue.stopping) {
+            ai_queue_unlock();
+            break;
+        }
+        
+        int slot = ai_queue_pop();
+        
+        if (slot < 0) {
+            // Go idle until ai_start_task hands over a task
+            int index = -1;
+            
+            for (uint32_t i = 0; i < ai_queue.num_workers; i++) {
+                if (ai_queue.workers[i] == self) {
+                    ai_queue.idle[i] = 1;
+                    index = (int)i;
+                    break;
+                }
+            }
+            
+            ai_queue_unlock();
+            
+            if (index >= 0) {
+                process_block(self);
+            } else {
+                // Not registered yet while ai_queue_start is still running
+                process_yield();
+            }
+            
+            continue;
+        }
+        
+        ai_task_t* task = ai_tasks[slot];
+        ai_task_id_t task_id = task->id;
+        ai_queue.busy_workers++;
+        
+        ai_queue_unlock();
+        
+        // Run the task
+        task->start_time = get_system_time();
+        int result = ai_execute_task(task_id);
+        uint64_t run_time = get_system_time() - task->start_time;
+        uint64_t wait_time = task->start_time - task->queue_time;
+        
+        // Account the task to its type
+        ai_queue_lock();
+        
+        if (task->type < AI_TASK_NUM_TYPES) {
+            ai_task_type_stats_t* stats = &ai_queue.type_stats[task->type];
+            stats->tasks_run++;
+            
+            if (result != 0) {
+                stats->tasks_failed++;
+            }
+            
+            stats->total_wait_time += wait_time;
+            stats->total_run_time += run_time;
+            
+            if (wait_time > stats->max_wait_time) {
+                stats->max_wait_time = wait_time;
+            }
+            
+            if (run_time > stats->max_run_time) {
+                stats->max_run_time = run_time;
+            }
+        }
+        
+        ai_queue.busy_workers--;
+        
+        ai_queue_unlock();
+        
+        // Hand the result to the waiting process
+        ai_task_notify(slot);
+    }
+    
+    process_terminate(self, 0);
+}
+
+/**
+ * Start the AI task worker processes
+ * 
+ * @return: 0 if at least one worker started, -1 otherwise
+ */
+static int ai_queue_start(void) {
+    for (int i = 0; i < AI_TASK_WORKERS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "ai_worker%d", i);
+        
+        pid_t pid = process_create(name, ai_task_worker_main, AI_TASK_WORKER_STACK_SIZE,
+                                   PROCESS_PRIORITY_NORMAL, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+        
+        if (pid == 0) {
+            console_printf("Error: Failed to create AI task worker\n");
+            break;
+        }
+        
+        ai_queue_lock();
+        ai_queue.workers[ai_queue.num_workers++] = pid;
+        ai_queue_unlock();
+    }
+    
+    return ai_queue.num_workers > 0 ? 0 : -1;
+}
+
+/**
+ * Stop the AI task worker processes
+ * 
+ * Tasks still queued are left unfinished. Waits for the running tasks to
+ * complete.
+ */
+static void ai_queue_stop(void) {
+    pid_t idle[AI_TASK_WORKERS];
+    uint32_t num_idle = 0;
+    
+    ai_queue_lock();
+    
+    ai_queue.stopping = 1;
+    
+    for (uint32_t i = 0; i < ai_queue.num_workers; i++) {
+        if (ai_queue.idle[i]) {
+            ai_queue.idle[i] = 0;
+            idle[num_idle++] = ai_queue.workers[i];
+        }
+    }
+    
+    ai_queue_unlock();
+    
+    for (uint32_t i = 0; i < num_idle; i++) {
+        ai_task_wake(idle[i]);
+    }
+    
+    while (ai_queue.busy_workers > 0) {
+        process_yield();
+    }
+    
+    ai_queue.num_workers = 0;
+}
+
+/**
+ * Find a free task slot in the task table (task table lock held)
  * 
  * @return: Slot index on success, -1 if no free slots
  */
@@ -1356,9 +1875,14 @@ static int ai_execute_task(ai_task_id_t task_id) {
         return -1;
     }
     
-    // Set the task state to running
+    // Set the task state to running and start its watchdog
+    int slot = ai_task_slot(task_id);
     task->state = AI_TASK_STATE_RUNNING;
     
+    if (slot >= 0) {
+        hrtimer_start(&ai_queue.watchdogs[slot], timer_now_ns() + AI_TASK_TIME_LIMIT_MS * TIMER_NS_PER_MS);
+    }
+    
     // Execute the task based on its type
     int result = -1;
     
@@ -1390,11 +1914,16 @@ static int ai_execute_task(ai_task_id_t task_id) {
             break;
     }
     
-    // Set the task state based on the result
-    if (result == 0) {
-        task->state = AI_TASK_STATE_COMPLETED;
-    } else {
-        task->state = AI_TASK_STATE_FAILED;
+    if (slot >= 0) {
+        hrtimer_cancel(&ai_queue.watchdogs[slot]);
+    }
+    
+    // Set the task state based on the result, unless the watchdog failed
+    // the task or it was cancelled while running
+    ai_task_state_t state = result == 0 ? AI_TASK_STATE_COMPLETED : AI_TASK_STATE_FAILED;
+    
+    if (!__sync_bool_compare_and_swap(&task->state, AI_TASK_STATE_RUNNING, state)) {
+        return -1;
     }
     
     // Set the completion time to the current system time
@@ -1429,7 +1958,7 @@ static int ai_check_task_limits(ai_task_id_t task_id) {
     uint64_t current_time = get_system_time();
     uint64_t elapsed_time = current_time - task->start_time;
     
-    if (elapsed_time > 60000) { // 60 seconds
+    if (elapsed_time > AI_TASK_TIME_LIMIT_MS) {
         console_printf("Error: Task execution time limit exceeded\n");
         return -1;
     }
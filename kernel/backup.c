@@ -8,6 +8,8 @@
 #include "include/backup.h"
 #include "include/memory.h"
 #include "include/console.h"
+#include "include/process.h"
+#include "include/lz4.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -17,30 +19,1015 @@
 // Backup table
 static backup_info_t* backup_table[MAX_BACKUPS];
 
+// Slab cache for backup information
+static memory_cache_t* backup_cache = NULL;
+
 // Next available backup ID
 static backup_id_t next_backup_id = 1;
 
-// Maximum number of backups to keep for each type
-static size_t max_backups_per_type[BACKUP_TYPE_CUSTOM + 1] = {
-    10,  // BACKUP_TYPE_FULL
-    20,  // BACKUP_TYPE_KERNEL
-    20,  // BACKUP_TYPE_FILESYSTEM
-    10,  // BACKUP_TYPE_CONFIGURATION
-    10   // BACKUP_TYPE_CUSTOM
-};
+// Maximum number of backups to keep for each type
+static size_t max_backups_per_type[BACKUP_TYPE_CUSTOM + 1] = {
+    10,  // BACKUP_TYPE_FULL
+    20,  // BACKUP_TYPE_KERNEL
+    20,  // BACKUP_TYPE_FILESYSTEM
+    10,  // BACKUP_TYPE_CONFIGURATION
+    10   // BACKUP_TYPE_CUSTOM
+};
+
+// Maximum total size of backups for each type (in bytes)
+static uint64_t max_backup_size_per_type[BACKUP_TYPE_CUSTOM + 1] = {
+    1024ULL * 1024 * 1024,  // 1 GB for BACKUP_TYPE_FULL
+    512ULL * 1024 * 1024,   // 512 MB for BACKUP_TYPE_KERNEL
+    2048ULL * 1024 * 1024,  // 2 GB for BACKUP_TYPE_FILESYSTEM
+    64ULL * 1024 * 1024,    // 64 MB for BACKUP_TYPE_CONFIGURATION
+    256ULL * 1024 * 1024    // 256 MB for BACKUP_TYPE_CUSTOM
+};
+
+// Forward declarations
+static void backup_cleanup_old(backup_type_t type);
+static int backup_check_limits(backup_type_t type);
+
+// Chunk index buckets (power of two)
+#define BACKUP_CHUNK_BUCKETS 4096
+
+// Boundary test on the gear hash: the top BACKUP_CHUNK_AVERAGE_BITS bits are zero
+#define BACKUP_CHUNK_MASK (~0U << (32 - BACKUP_CHUNK_AVERAGE_BITS))
+
+// Initial number of references a manifest is allocated for
+#define BACKUP_MANIFEST_INITIAL_CHUNKS 256
+
+// Stored chunk
+typedef struct backup_chunk {
+    struct backup_chunk* next;      // Next chunk in the bucket
+    uint64_t hash[2];
+    uint32_t size;                  // Uncompressed size
+    uint32_t stored_size;           // Size of the chunk file
+    uint32_t refcount;              // Manifests referencing the chunk
+} backup_chunk_t;
+
+// Index of the stored chunks by content address
+static backup_chunk_t* backup_chunk_buckets[BACKUP_CHUNK_BUCKETS];
+
+// Slab cache for chunk index entries
+static memory_cache_t* backup_chunk_cache = NULL;
+
+// Gear table of the content-defined chunker
+static uint32_t backup_gear[256];
+
+// Manifest under construction
+typedef struct {
+    backup_manifest_header_t* header;
+    size_t capacity;                // Chunk references the buffer holds
+    uint64_t stored_bytes;          // Bytes of the chunk files written for it
+    uint32_t new_chunks;
+} backup_manifest_t;
+
+// Blocks the backup pipeline keeps in flight
+#define BACKUP_PIPELINE_DEPTH 8
+
+// Number of backup pipeline worker processes
+#define BACKUP_PIPELINE_WORKERS 2
+
+// Stack size of a backup pipeline worker (the LZ4 state lives in the block)
+#define BACKUP_WORKER_STACK_SIZE (16 * 1024)
+
+// Compression output buffer of a block
+#define BACKUP_BLOCK_BUFFER_SIZE LZ4_COMPRESS_BOUND(BACKUP_CHUNK_MAX_SIZE)
+
+// Pipeline block states
+#define BACKUP_BLOCK_FREE   0
+#define BACKUP_BLOCK_QUEUED 1
+#define BACKUP_BLOCK_BUSY   2
+#define BACKUP_BLOCK_DONE   3
+
+// Pipeline block operations
+#define BACKUP_BLOCK_COMPRESS   0
+#define BACKUP_BLOCK_DECOMPRESS 1
+
+// Chunk in flight through the backup pipeline
+typedef struct {
+    volatile int state;             // BACKUP_BLOCK_*
+    int op;                         // BACKUP_BLOCK_COMPRESS or BACKUP_BLOCK_DECOMPRESS
+    const uint8_t* input;
+    size_t input_size;
+    uint8_t* output;                // Compression buffer, or the chunk's place in the snapshot
+    size_t output_size;             // Stored size after compression (size if stored as is)
+    uint32_t size;                  // Uncompressed size
+    uint64_t hash[2];               // Expected content address (decompression)
+    backup_chunk_t* chunk;          // Index entry being stored (compression)
+    void* file_data;                // Chunk file being decompressed
+    size_t file_size;
+    int result;
+    lz4_state_t lz4;
+} backup_block_t;
+
+// Backup pipeline
+//
+// The backup thread cuts and hashes the snapshot and does all the file I/O,
+// in order. The chunks in between are compressed or decompressed by the
+// worker processes meanwhile, and by the backup thread itself while it
+// waits on a block, so the pipeline also runs without a scheduler. The
+// workers are long-lived: they are started by the first backup operation
+// and block between operations.
+static struct {
+    backup_block_t blocks[BACKUP_PIPELINE_DEPTH];
+    uint8_t* buffers;               // Compression buffers of the blocks
+    uint32_t submitted;
+    uint32_t completed;
+    pid_t workers[BACKUP_PIPELINE_WORKERS];
+    volatile int wake[BACKUP_PIPELINE_WORKERS];
+    volatile uint32_t num_workers;
+} backup_pipeline;
+
+/**
+ * Fill the gear table
+ * 
+ * The table is generated from a fixed seed so that chunk boundaries, and
+ * with them the chunk addresses, are the same on every boot.
+ */
+static void backup_gear_init(void) {
+    uint32_t state = 0x9E3779B9;
+    
+    for (int i = 0; i < 256; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        backup_gear[i] = state;
+    }
+}
+
+/**
+ * Find the end of the next chunk
+ * 
+ * A gear hash rolls over the data and a boundary is placed where its top
+ * bits are all zero, so an edit only moves the boundaries around it and the
+ * chunks after it come out the same as before.
+ * 
+ * @param data: Data to chunk
+ * @param size: Size of the data
+ * @return: Size of the chunk at the start of the data
+ */
+static size_t backup_chunk_boundary(const uint8_t* data, size_t size) {
+    if (size <= BACKUP_CHUNK_MIN_SIZE) {
+        return size;
+    }
+    
+    size_t limit = size < BACKUP_CHUNK_MAX_SIZE ? size : BACKUP_CHUNK_MAX_SIZE;
+    uint32_t hash = 0;
+    
+    for (size_t i = BACKUP_CHUNK_MIN_SIZE; i < limit; i++) {
+        hash = (hash << 1) + backup_gear[data[i]];
+        
+        if (!(hash & BACKUP_CHUNK_MASK)) {
+            return i + 1;
+        }
+    }
+    
+    return limit;
+}
+
+/**
+ * Finalize a 64-bit hash lane
+ * 
+ * @param hash: Hash lane
+ * @return: Mixed hash lane
+ */
+static uint64_t backup_hash_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * Compute the content address of a chunk
+ * 
+ * The address is 128 bits from two independent lanes, FNV-1a and a
+ * rotate-multiply hash, each finalized with the chunk size mixed in.
+ * 
+ * @param data: Chunk data
+ * @param size: Chunk size
+ * @param hash: Array to store the two hash words
+ */
+static void backup_chunk_hash(const uint8_t* data, size_t size, uint64_t hash[2]) {
+    uint64_t fnv = 0xCBF29CE484222325ULL;
+    uint64_t mul = 0x9E3779B97F4A7C15ULL;
+    
+    for (size_t i = 0; i < size; i++) {
+        fnv = (fnv ^ data[i]) * 0x100000001B3ULL;
+        mul = ((mul << 5) | (mul >> 59)) ^ data[i];
+        mul *= 0x9E3779B97F4A7C15ULL;
+    }
+    
+    hash[0] = backup_hash_mix(fnv ^ size);
+    hash[1] = backup_hash_mix(mul + size);
+}
+
+/**
+ * Find a stored chunk
+ * 
+ * @param hash: Content address
+ * @param size: Uncompressed chunk size
+ * @return: Chunk index entry, or NULL if the chunk is not stored
+ */
+static backup_chunk_t* backup_chunk_find(const uint64_t hash[2], uint32_t size) {
+    backup_chunk_t* chunk = backup_chunk_buckets[hash[0] & (BACKUP_CHUNK_BUCKETS - 1)];
+    
+    while (chunk) {
+        if (chunk->hash[0] == hash[0] && chunk->hash[1] == hash[1] && chunk->size == size) {
+            return chunk;
+        }
+        chunk = chunk->next;
+    }
+    
+    return NULL;
+}
+
+/**
+ * Build the path of a chunk file
+ * 
+ * @param hash: Content address
+ * @param path: Buffer to store the path
+ * @param path_size: Size of the buffer
+ */
+static void backup_chunk_path(const uint64_t hash[2], char* path, size_t path_size) {
+    snprintf(path, path_size, "/backups/chunks/%08x%08x%08x%08x.chk",
+             (unsigned int)(hash[0] >> 32), (unsigned int)hash[0],
+             (unsigned int)(hash[1] >> 32), (unsigned int)hash[1]);
+}
+
+/**
+ * Add a chunk to the index
+ * 
+ * The chunk starts with one reference and no chunk file; stored_size is set
+ * once the file is written.
+ * 
+ * @param ref: Manifest reference of the chunk
+ * @return: Chunk index entry, or NULL on failure
+ */
+static backup_chunk_t* backup_chunk_insert(const backup_chunk_ref_t* ref) {
+    backup_chunk_t* chunk = (backup_chunk_t*)memory_cache_alloc(backup_chunk_cache, MEMORY_ALLOC_ZEROED);
+    
+    if (!chunk) {
+        console_printf("Error: Failed to allocate backup chunk\n");
+        return NULL;
+    }
+    
+    chunk->hash[0] = ref->hash[0];
+    chunk->hash[1] = ref->hash[1];
+    chunk->size = ref->size;
+    chunk->stored_size = 0;
+    chunk->refcount = 1;
+    
+    backup_chunk_t** bucket = &backup_chunk_buckets[ref->hash[0] & (BACKUP_CHUNK_BUCKETS - 1)];
+    chunk->next = *bucket;
+    *bucket = chunk;
+    
+    return chunk;
+}
+
+/**
+ * Drop a reference on a stored chunk, deleting the chunk with the last one
+ * 
+ * @param ref: Manifest reference
+ */
+static void backup_chunk_release(const backup_chunk_ref_t* ref) {
+    backup_chunk_t** link = &backup_chunk_buckets[ref->hash[0] & (BACKUP_CHUNK_BUCKETS - 1)];
+    
+    while (*link) {
+        backup_chunk_t* chunk = *link;
+        
+        if (chunk->hash[0] == ref->hash[0] && chunk->hash[1] == ref->hash[1] &&
+            chunk->size == ref->size) {
+            if (--chunk->refcount == 0) {
+                char path[64];
+                backup_chunk_path(chunk->hash, path, sizeof(path));
+                
+                // A chunk whose store failed has no file
+                if (chunk->stored_size && delete_file(path) != 0) {
+                    console_printf("Warning: Failed to delete backup chunk: %s\n", path);
+                }
+                
+                *link = chunk->next;
+                memory_cache_free(backup_chunk_cache, chunk);
+            }
+            return;
+        }
+        link = &chunk->next;
+    }
+}
+
+/**
+ * Get the chunk references of a manifest
+ * 
+ * @param header: Manifest header
+ * @return: First chunk reference
+ */
+static backup_chunk_ref_t* backup_manifest_refs(backup_manifest_header_t* header) {
+    return (backup_chunk_ref_t*)(header + 1);
+}
+
+/**
+ * Get the size of a manifest
+ * 
+ * @param num_chunks: Number of chunk references
+ * @return: Size in bytes
+ */
+static size_t backup_manifest_size(size_t num_chunks) {
+    return sizeof(backup_manifest_header_t) + num_chunks * sizeof(backup_chunk_ref_t);
+}
+
+/**
+ * Make room for one more chunk reference in a manifest
+ * 
+ * @param manifest: Manifest under construction
+ * @return: Reference to fill in, or NULL on failure
+ */
+static backup_chunk_ref_t* backup_manifest_append(backup_manifest_t* manifest) {
+    if (manifest->header->num_chunks == manifest->capacity) {
+        size_t capacity = manifest->capacity * 2;
+        backup_manifest_header_t* header = (backup_manifest_header_t*)memory_alloc(
+            backup_manifest_size(capacity), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+        
+        if (!header) {
+            return NULL;
+        }
+        
+        memcpy(header, manifest->header, backup_manifest_size(manifest->header->num_chunks));
+        memory_free(manifest->header, backup_manifest_size(manifest->capacity));
+        manifest->header = header;
+        manifest->capacity = capacity;
+    }
+    
+    return &backup_manifest_refs(manifest->header)[manifest->header->num_chunks++];
+}
+
+/**
+ * Read and check the manifest of a backup
+ * 
+ * @param backup: Backup information
+ * @param manifest_size: Pointer to store the size of the manifest buffer
+ * @return: Manifest, or NULL on failure
+ */
+static backup_manifest_header_t* backup_manifest_read(backup_info_t* backup, size_t* manifest_size) {
+    void* data = NULL;
+    size_t size = 0;
+    
+    if (read_file(backup->filename, &data, &size) != 0) {
+        console_printf("Error: Failed to read backup manifest: %s\n", backup->filename);
+        return NULL;
+    }
+    
+    backup_manifest_header_t* header = (backup_manifest_header_t*)data;
+    
+    if (size < sizeof(*header) || header->magic != BACKUP_MANIFEST_MAGIC ||
+        header->version > BACKUP_MANIFEST_VERSION ||
+        header->num_chunks > (size - sizeof(*header)) / sizeof(backup_chunk_ref_t)) {
+        console_printf("Error: Invalid backup manifest: %s\n", backup->filename);
+        memory_free(data, size);
+        return NULL;
+    }
+    
+    *manifest_size = size;
+    return header;
+}
+
+/**
+ * Compress or decompress a pipeline block
+ * 
+ * @param block: Block claimed by the caller
+ */
+static void backup_block_run(backup_block_t* block) {
+    if (block->op == BACKUP_BLOCK_COMPRESS) {
+        // Store the chunk as is when LZ4 does not make it smaller
+        size_t size = lz4_compress(&block->lz4, block->input, block->size,
+                                   block->output, BACKUP_BLOCK_BUFFER_SIZE);
+        block->output_size = size && size < block->size ? size : block->size;
+        block->result = 0;
+        return;
+    }
+    
+    size_t size = block->size;
+    
+    if (block->input_size == block->size) {
+        memcpy(block->output, block->input, size);
+    } else if (lz4_decompress(block->input, block->input_size, block->output, block->size, &size) != 0) {
+        block->result = -1;
+        return;
+    }
+    
+    uint64_t hash[2];
+    backup_chunk_hash(block->output, size, hash);
+    
+    block->result = (size == block->size && hash[0] == block->hash[0] && hash[1] == block->hash[1]) ? 0 : -1;
+}
+
+/**
+ * Run one queued pipeline block, if there is one
+ * 
+ * @return: 1 if a block was run, 0 if none was queued
+ */
+static int backup_pipeline_work(void) {
+    for (int i = 0; i < BACKUP_PIPELINE_DEPTH; i++) {
+        backup_block_t* block = &backup_pipeline.blocks[i];
+        
+        if (block->state == BACKUP_BLOCK_QUEUED &&
+            __sync_bool_compare_and_swap(&block->state, BACKUP_BLOCK_QUEUED, BACKUP_BLOCK_BUSY)) {
+            backup_block_run(block);
+            __sync_synchronize();
+            block->state = BACKUP_BLOCK_DONE;
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Backup pipeline worker process
+ * 
+ * Runs queued blocks, blocking whenever none are queued.
+ */
+static void backup_worker_main(void) {
+    pid_t self = process_get_current()->pid;
+    int index = -1;
+    
+    // Not registered yet while backup_pipeline_start is still running
+    while (index < 0) {
+        for (uint32_t i = 0; i < backup_pipeline.num_workers; i++) {
+            if (backup_pipeline.workers[i] == self) {
+                index = (int)i;
+            }
+        }
+        
+        if (index < 0) {
+            process_yield();
+        }
+    }
+    
+    for (;;) {
+        backup_pipeline.wake[index] = 0;
+        __sync_synchronize();
+        
+        if (backup_pipeline_work()) {
+            continue;
+        }
+        
+        // Sleep until backup_pipeline_submit queues a block
+        if (process_block_unless(&backup_pipeline.wake[index]) != 0) {
+            process_yield();
+        }
+    }
+}
+
+/**
+ * Start the backup pipeline worker processes that are not running yet
+ * 
+ * Workers never exit, so at most BACKUP_PIPELINE_WORKERS processes are
+ * ever created; a start that failed is retried by the next operation.
+ * Without workers the backup thread runs every block itself.
+ */
+static void backup_pipeline_start(void) {
+    while (backup_pipeline.num_workers < BACKUP_PIPELINE_WORKERS) {
+        char name[32];
+        snprintf(name, sizeof(name), "backup_worker%u", (unsigned)backup_pipeline.num_workers);
+        
+        pid_t pid = process_create(name, backup_worker_main, BACKUP_WORKER_STACK_SIZE,
+                                   PROCESS_PRIORITY_NORMAL, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+        
+        if (pid == 0) {
+            console_printf("Warning: Failed to create backup worker\n");
+            break;
+        }
+        
+        backup_pipeline.workers[backup_pipeline.num_workers] = pid;
+        __sync_synchronize();
+        backup_pipeline.num_workers++;
+    }
+}
+
+/**
+ * Set up the pipeline for a backup operation
+ * 
+ * @param compress: 1 to allocate the compression buffers of the blocks
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_pipeline_begin(int compress) {
+    if (backup_pipeline.num_workers < BACKUP_PIPELINE_WORKERS) {
+        backup_pipeline_start();
+    }
+    
+    backup_pipeline.buffers = NULL;
+    
+    if (compress) {
+        backup_pipeline.buffers = (uint8_t*)memory_alloc(BACKUP_PIPELINE_DEPTH * BACKUP_BLOCK_BUFFER_SIZE,
+                                                         MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+        
+        if (!backup_pipeline.buffers) {
+            console_printf("Error: Failed to allocate backup pipeline buffers\n");
+            return -1;
+        }
+    }
+    
+    for (int i = 0; i < BACKUP_PIPELINE_DEPTH; i++) {
+        backup_pipeline.blocks[i].state = BACKUP_BLOCK_FREE;
+        backup_pipeline.blocks[i].output = compress ? backup_pipeline.buffers + i * BACKUP_BLOCK_BUFFER_SIZE : NULL;
+    }
+    
+    backup_pipeline.submitted = 0;
+    backup_pipeline.completed = 0;
+    
+    return 0;
+}
+
+/**
+ * Release the pipeline after every submitted block has completed
+ */
+static void backup_pipeline_end(void) {
+    if (backup_pipeline.buffers) {
+        memory_free(backup_pipeline.buffers, BACKUP_PIPELINE_DEPTH * BACKUP_BLOCK_BUFFER_SIZE);
+        backup_pipeline.buffers = NULL;
+    }
+}
+
+/**
+ * Get the block the next submission goes into
+ * 
+ * @return: Block, or NULL if the oldest block has to be completed first
+ */
+static backup_block_t* backup_pipeline_next(void) {
+    if (backup_pipeline.submitted - backup_pipeline.completed == BACKUP_PIPELINE_DEPTH) {
+        return NULL;
+    }
+    
+    return &backup_pipeline.blocks[backup_pipeline.submitted % BACKUP_PIPELINE_DEPTH];
+}
+
+/**
+ * Get the oldest block not completed yet
+ * 
+ * @return: Block
+ */
+static backup_block_t* backup_pipeline_oldest(void) {
+    return &backup_pipeline.blocks[backup_pipeline.completed % BACKUP_PIPELINE_DEPTH];
+}
+
+/**
+ * Queue a filled-in block and wake the workers
+ * 
+ * @param block: Block from backup_pipeline_next
+ */
+static void backup_pipeline_submit(backup_block_t* block) {
+    __sync_synchronize();
+    block->state = BACKUP_BLOCK_QUEUED;
+    backup_pipeline.submitted++;
+    
+    for (uint32_t i = 0; i < backup_pipeline.num_workers; i++) {
+        if (!backup_pipeline.wake[i]) {
+            backup_pipeline.wake[i] = 1;
+            __sync_synchronize();
+            process_unblock(backup_pipeline.workers[i]);
+        }
+    }
+}
+
+/**
+ * Wait for the oldest block to finish and retire it
+ * 
+ * While a worker has the block, the caller runs other queued blocks; a
+ * block no worker has picked up yet is run by the caller itself.
+ * 
+ * @return: The retired block (valid until the next submission)
+ */
+static backup_block_t* backup_pipeline_complete(void) {
+    backup_block_t* block = backup_pipeline_oldest();
+    
+    while (block->state != BACKUP_BLOCK_DONE) {
+        if (block->state == BACKUP_BLOCK_QUEUED &&
+            __sync_bool_compare_and_swap(&block->state, BACKUP_BLOCK_QUEUED, BACKUP_BLOCK_BUSY)) {
+            backup_block_run(block);
+            block->state = BACKUP_BLOCK_DONE;
+            break;
+        }
+        
+        if (!backup_pipeline_work()) {
+            process_yield();
+        }
+    }
+    
+    __sync_synchronize();
+    block->state = BACKUP_BLOCK_FREE;
+    backup_pipeline.completed++;
+    
+    return block;
+}
+
+/**
+ * Write the chunk file of a compressed block
+ * 
+ * @param block: Retired compression block
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_block_write(backup_block_t* block) {
+    char path[64];
+    backup_chunk_path(block->chunk->hash, path, sizeof(path));
+    
+    const void* stored = block->output_size < block->size ? (const void*)block->output : (const void*)block->input;
+    
+    if (write_file(path, (void*)stored, block->output_size) != 0) {
+        console_printf("Error: Failed to write backup chunk: %s\n", path);
+        return -1;
+    }
+    
+    block->chunk->stored_size = (uint32_t)block->output_size;
+    return 0;
+}
+
+/**
+ * Start a manifest for a snapshot
+ * 
+ * @param manifest: Manifest to set up
+ * @param backup: Backup information
+ * @param data_size: Snapshot size
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_manifest_begin(backup_manifest_t* manifest, backup_info_t* backup, uint64_t data_size) {
+    manifest->capacity = BACKUP_MANIFEST_INITIAL_CHUNKS;
+    manifest->header = (backup_manifest_header_t*)memory_alloc(backup_manifest_size(manifest->capacity),
+                                                               MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                                               MEMORY_ALLOC_ZEROED);
+    
+    if (!manifest->header) {
+        console_printf("Error: Failed to allocate backup manifest\n");
+        return -1;
+    }
+    
+    manifest->header->magic = BACKUP_MANIFEST_MAGIC;
+    manifest->header->version = BACKUP_MANIFEST_VERSION;
+    manifest->header->data_size = data_size;
+    manifest->header->num_chunks = 0;
+    manifest->header->parent_id = backup->parent_id;
+    manifest->stored_bytes = 0;
+    manifest->new_chunks = 0;
+    
+    return 0;
+}
+
+/**
+ * Write a finished manifest as the backup file, or undo it on failure
+ * 
+ * @param manifest: Manifest
+ * @param backup: Backup information
+ * @param result: 0 if every chunk was stored, -1 to give back the references taken
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_manifest_finish(backup_manifest_t* manifest, backup_info_t* backup, int result) {
+    size_t manifest_size = backup_manifest_size(manifest->header->num_chunks);
+    
+    if (result == 0 && write_file(backup->filename, manifest->header, manifest_size) != 0) {
+        console_printf("Error: Failed to write backup manifest\n");
+        result = -1;
+    }
+    
+    if (result != 0) {
+        // Give back the references taken so far
+        backup_chunk_ref_t* refs = backup_manifest_refs(manifest->header);
+        
+        for (uint32_t i = 0; i < manifest->header->num_chunks; i++) {
+            backup_chunk_release(&refs[i]);
+        }
+    } else {
+        backup->data_size = manifest->header->data_size;
+        backup->num_chunks = manifest->header->num_chunks;
+        backup->new_chunks = manifest->new_chunks;
+        backup->size = manifest_size + manifest->stored_bytes;
+    }
+    
+    memory_free(manifest->header, backup_manifest_size(manifest->capacity));
+    return result;
+}
+
+/**
+ * Retire the oldest compression block and write its chunk file
+ * 
+ * @param manifest: Manifest under construction
+ * @param result: Current result; nothing is written once it is -1
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_store_complete(backup_manifest_t* manifest, int result) {
+    backup_block_t* block = backup_pipeline_complete();
+    
+    if (result != 0 || backup_block_write(block) != 0) {
+        return -1;
+    }
+    
+    manifest->stored_bytes += block->output_size;
+    return 0;
+}
+
+/**
+ * Store a snapshot as chunks and write its manifest
+ * 
+ * Only chunks that no stored backup already holds are written, so the cost
+ * of a backup follows the size of the change since the backups before it.
+ * The new chunks are compressed by the pipeline workers while this thread
+ * goes on cutting the snapshot and writes the chunks that are done.
+ * 
+ * @param backup: Backup information (filename already set)
+ * @param data: Snapshot data
+ * @param data_size: Snapshot size
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_store_data(backup_info_t* backup, const void* data, size_t data_size) {
+    backup_manifest_t manifest;
+    
+    if (backup_manifest_begin(&manifest, backup, data_size) != 0) {
+        return -1;
+    }
+    
+    if (backup_pipeline_begin(1) != 0) {
+        return backup_manifest_finish(&manifest, backup, -1);
+    }
+    
+    // Cut the snapshot into chunks and queue the ones not seen before
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t offset = 0;
+    int result = 0;
+    
+    while (offset < data_size && result == 0) {
+        size_t size = backup_chunk_boundary(bytes + offset, data_size - offset);
+        backup_chunk_ref_t* ref = backup_manifest_append(&manifest);
+        
+        if (!ref) {
+            console_printf("Error: Failed to grow backup manifest\n");
+            result = -1;
+            break;
+        }
+        
+        memset(ref, 0, sizeof(*ref));
+        backup_chunk_hash(bytes + offset, size, ref->hash);
+        ref->size = (uint32_t)size;
+        
+        backup_chunk_t* chunk = backup_chunk_find(ref->hash, ref->size);
+        
+        if (chunk) {
+            chunk->refcount++;
+            offset += size;
+            continue;
+        }
+        
+        // Make room in the pipeline by writing out the oldest block
+        backup_block_t* block = backup_pipeline_next();
+        
+        if (!block) {
+            result = backup_store_complete(&manifest, result);
+            block = backup_pipeline_next();
+        }
+        
+        chunk = result == 0 ? backup_chunk_insert(ref) : NULL;
+        
+        if (!chunk) {
+            manifest.header->num_chunks--;
+            result = -1;
+            break;
+        }
+        
+        block->op = BACKUP_BLOCK_COMPRESS;
+        block->input = bytes + offset;
+        block->input_size = size;
+        block->size = (uint32_t)size;
+        block->chunk = chunk;
+        backup_pipeline_submit(block);
+        
+        manifest.new_chunks++;
+        offset += size;
+    }
+    
+    // Write the blocks still in flight
+    while (backup_pipeline.completed != backup_pipeline.submitted) {
+        result = backup_store_complete(&manifest, result);
+    }
+    
+    backup_pipeline_end();
+    
+    return backup_manifest_finish(&manifest, backup, result);
+}
+
+/**
+ * Retire the oldest decompression block
+ * 
+ * @return: 0 if the chunk decompressed to its address, -1 otherwise
+ */
+static int backup_load_complete(void) {
+    backup_block_t* block = backup_pipeline_complete();
+    memory_free(block->file_data, block->file_size);
+    
+    if (block->result != 0) {
+        char path[64];
+        backup_chunk_path(block->hash, path, sizeof(path));
+        console_printf("Error: Corrupted backup chunk: %s\n", path);
+        return -1;
+    }
+    
+    return 0;
+}
 
-// Maximum total size of backups for each type (in bytes)
-static uint64_t max_backup_size_per_type[BACKUP_TYPE_CUSTOM + 1] = {
-    1024ULL * 1024 * 1024,  // 1 GB for BACKUP_TYPE_FULL
-    512ULL * 1024 * 1024,   // 512 MB for BACKUP_TYPE_KERNEL
-    2048ULL * 1024 * 1024,  // 2 GB for BACKUP_TYPE_FILESYSTEM
-    64ULL * 1024 * 1024,    // 64 MB for BACKUP_TYPE_CONFIGURATION
-    256ULL * 1024 * 1024    // 256 MB for BACKUP_TYPE_CUSTOM
-};
+/**
+ * Reassemble the snapshot of a backup from its manifest
+ * 
+ * Chunk files are read by this thread and decompressed straight into the
+ * snapshot by the pipeline workers, each checked against its address.
+ * 
+ * @param backup: Backup information
+ * @param data: Pointer to store the snapshot (free with memory_free)
+ * @param data_size: Pointer to store the snapshot size
+ * @return: 0 on success, -1 on failure
+ */
+static int backup_load_data(backup_info_t* backup, void** data, size_t* data_size) {
+    size_t manifest_size = 0;
+    backup_manifest_header_t* header = backup_manifest_read(backup, &manifest_size);
+    
+    if (!header) {
+        return -1;
+    }
+    
+    size_t size = (size_t)header->data_size;
+    uint8_t* snapshot = NULL;
+    
+    if (size) {
+        snapshot = (uint8_t*)memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+        
+        if (!snapshot) {
+            console_printf("Error: Failed to allocate backup data\n");
+            memory_free(header, manifest_size);
+            return -1;
+        }
+    }
+    
+    if (backup_pipeline_begin(0) != 0) {
+        memory_free(header, manifest_size);
+        if (snapshot) {
+            memory_free(snapshot, size);
+        }
+        return -1;
+    }
+    
+    // Read every chunk and queue its decompression into place
+    backup_chunk_ref_t* refs = backup_manifest_refs(header);
+    size_t offset = 0;
+    int result = 0;
+    
+    for (uint32_t i = 0; i < header->num_chunks && result == 0; i++) {
+        char path[64];
+        backup_chunk_path(refs[i].hash, path, sizeof(path));
+        
+        if (refs[i].size == 0 || refs[i].size > size - offset) {
+            console_printf("Error: Backup manifest does not match the snapshot\n");
+            result = -1;
+            break;
+        }
+        
+        backup_block_t* block = backup_pipeline_next();
+        
+        if (!block) {
+            result = backup_load_complete();
+            block = backup_pipeline_next();
+            
+            if (result != 0) {
+                break;
+            }
+        }
+        
+        void* file_data = NULL;
+        size_t file_size = 0;
+        
+        if (read_file(path, &file_data, &file_size) != 0) {
+            console_printf("Error: Failed to read backup chunk: %s\n", path);
+            result = -1;
+            break;
+        }
+        
+        if (file_size == 0 || file_size > refs[i].size) {
+            console_printf("Error: Corrupted backup chunk: %s\n", path);
+            memory_free(file_data, file_size);
+            result = -1;
+            break;
+        }
+        
+        block->op = BACKUP_BLOCK_DECOMPRESS;
+        block->input = (const uint8_t*)file_data;
+        block->input_size = file_size;
+        block->output = snapshot + offset;
+        block->size = refs[i].size;
+        block->hash[0] = refs[i].hash[0];
+        block->hash[1] = refs[i].hash[1];
+        block->file_data = file_data;
+        block->file_size = file_size;
+        backup_pipeline_submit(block);
+        
+        offset += refs[i].size;
+    }
+    
+    // Wait for the blocks still in flight
+    while (backup_pipeline.completed != backup_pipeline.submitted) {
+        if (backup_load_complete() != 0) {
+            result = -1;
+        }
+    }
+    
+    backup_pipeline_end();
+    
+    if (result == 0 && offset != size) {
+        console_printf("Error: Backup manifest does not cover the snapshot\n");
+        result = -1;
+    }
+    
+    memory_free(header, manifest_size);
+    
+    if (result != 0) {
+        if (snapshot) {
+            memory_free(snapshot, size);
+        }
+        return -1;
+    }
+    
+    *data = snapshot;
+    *data_size = size;
+    return 0;
+}
 
-// Forward declarations
-static void backup_cleanup_old(backup_type_t type);
-static int backup_check_limits(backup_type_t type);
+/**
+ * Drop the chunk references held by the manifest of a backup
+ * 
+ * @param backup: Backup information
+ */
+static void backup_release_data(backup_info_t* backup) {
+    size_t manifest_size = 0;
+    backup_manifest_header_t* header = backup_manifest_read(backup, &manifest_size);
+    
+    if (!header) {
+        return;
+    }
+    
+    backup_chunk_ref_t* refs = backup_manifest_refs(header);
+    
+    for (uint32_t i = 0; i < header->num_chunks; i++) {
+        backup_chunk_release(&refs[i]);
+    }
+    
+    memory_free(header, manifest_size);
+}
+
+/**
+ * Allocate and register the information of a new backup
+ * 
+ * @param type: Backup type
+ * @param flags: Backup flags
+ * @param description: Backup description
+ * @param parent_id: Parent backup ID
+ * @param timestamp: Timestamp used in the backup filename
+ * @return: Backup information, or NULL on failure
+ */
+static backup_info_t* backup_alloc_info(backup_type_t type, backup_flags_t flags,
+                                        const char* description, backup_id_t parent_id,
+                                        uint64_t timestamp) {
+    // Allocate memory for the backup information
+    backup_info_t* backup = (backup_info_t*)memory_cache_alloc(backup_cache, MEMORY_ALLOC_ZEROED);
+    
+    if (!backup) {
+        console_printf("Error: Failed to allocate backup information\n");
+        return NULL;
+    }
+    
+    // Initialize the backup information
+    backup->id = next_backup_id++;
+    backup->type = type;
+    backup->state = BACKUP_STATE_CREATING;
+    backup->flags = flags;
+    backup->creation_time = 0; // Will be set when the backup is complete
+    backup->size = 0; // Will be set when the backup is complete
+    backup->parent_id = parent_id;
+    
+    // Set the backup description
+    if (description) {
+        strncpy(backup->description, description, BACKUP_DESCRIPTION_MAX - 1);
+        backup->description[BACKUP_DESCRIPTION_MAX - 1] = '\0'; // Ensure null termination
+    } else {
+        strncpy(backup->description, "Unnamed backup", BACKUP_DESCRIPTION_MAX - 1);
+        backup->description[BACKUP_DESCRIPTION_MAX - 1] = '\0'; // Ensure null termination
+    }
+    
+    // Generate a unique filename for the backup manifest
+    snprintf(backup->filename, sizeof(backup->filename), "/backups/%s_%u_%lu.bak",
+             get_backup_type_name(type), backup->id, (unsigned long)timestamp);
+    
+    // Add the backup to the backup table
+    backup_table[backup->id] = backup;
+    
+    return backup;
+}
 
 /**
  * Initialize the backup system
@@ -51,12 +1038,38 @@ void backup_init(void) {
         backup_table[i] = NULL;
     }
     
+    // Create the backup information cache
+    backup_cache = memory_cache_create("backup_info_t", sizeof(backup_info_t), 0);
+    
+    if (!backup_cache) {
+        console_printf("Error: Failed to create backup cache\n");
+        return;
+    }
+    
+    // Create the chunk index
+    for (int i = 0; i < BACKUP_CHUNK_BUCKETS; i++) {
+        backup_chunk_buckets[i] = NULL;
+    }
+    
+    backup_chunk_cache = memory_cache_create("backup_chunk_t", sizeof(backup_chunk_t), 0);
+    
+    if (!backup_chunk_cache) {
+        console_printf("Error: Failed to create backup chunk cache\n");
+        return;
+    }
+    
+    backup_gear_init();
+    
     console_printf("Backup system initialized\n");
 }
 
 /**
  * Create a new backup
  * 
+ * The snapshot is stored as content-addressed chunks. Chunks that the
+ * parent, or any other stored backup, already holds are referenced from the
+ * manifest instead of being written again.
+ * 
  * @param type: Backup type
  * @param flags: Backup flags
  * @param description: Backup description
@@ -80,35 +1093,14 @@ backup_id_t backup_create(backup_type_t type, backup_flags_t flags,
     // Check if we need to clean up old backups
     backup_cleanup_old(type);
     
-    // Allocate memory for the backup information
-    backup_info_t* backup = (backup_info_t*)memory_alloc(sizeof(backup_info_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    // Allocate and register the backup information
+    backup_info_t* backup = backup_alloc_info(type, flags, description, parent_id,
+                                              get_current_timestamp());
     
     if (!backup) {
-        console_printf("Error: Failed to allocate backup information\n");
         return 0;
     }
     
-    // Initialize the backup information
-    backup->id = next_backup_id++;
-    backup->type = type;
-    backup->state = BACKUP_STATE_CREATING;
-    backup->flags = flags;
-    backup->creation_time = 0; // Will be set when the backup is complete
-    backup->size = 0; // Will be set when the backup is complete
-    backup->parent_id = parent_id;
-    
-    // Set the backup description
-    if (description) {
-        strncpy(backup->description, description, BACKUP_DESCRIPTION_MAX - 1);
-        backup->description[BACKUP_DESCRIPTION_MAX - 1] = '\0'; // Ensure null termination
-    } else {
-        strncpy(backup->description, "Unnamed backup", BACKUP_DESCRIPTION_MAX - 1);
-        backup->description[BACKUP_DESCRIPTION_MAX - 1] = '\0'; // Ensure null termination
-    }
-    
-    // Add the backup to the backup table
-    backup_table[backup->id] = backup;
-    
     // Create the backup
     // Allocate memory for the backup data
     void* backup_data = NULL;
@@ -162,49 +1154,23 @@ backup_id_t backup_create(backup_type_t type, backup_flags_t flags,
             break;
     }
     
-    // Compress the backup data
-    void* compressed_data = NULL;
-    size_t compressed_size = 0;
-    
-    if (compress_data(backup_data, backup_data_size, &compressed_data, &compressed_size) != 0) {
-        console_printf("Error: Failed to compress backup data\n");
+    // Store the chunks of the snapshot that are not stored yet
+    if (backup_store_data(backup, backup_data, backup_data_size) != 0) {
+        console_printf("Error: Failed to store backup data\n");
         memory_free(backup_data, backup_data_size);
         backup->state = BACKUP_STATE_ERROR;
         return backup->id;
     }
     
-    // Free the uncompressed data
+    // Free the snapshot
     memory_free(backup_data, backup_data_size);
     
-    // Generate a unique filename for the backup
-    char filename[256];
-    snprintf(filename, sizeof(filename), "/backups/%s_%u_%lu.bak",
-             get_backup_type_name(type), backup->id, (unsigned long)get_current_timestamp());
-    
-    // Write the compressed data to the backup file
-    if (write_file(filename, compressed_data, compressed_size) != 0) {
-        console_printf("Error: Failed to write backup file\n");
-        memory_free(compressed_data, compressed_size);
-        backup->state = BACKUP_STATE_ERROR;
-        return backup->id;
-    }
-    
-    // Free the compressed data
-    memory_free(compressed_data, compressed_size);
-    
-    // Store the backup filename
-    strncpy(backup->filename, filename, sizeof(backup->filename) - 1);
-    backup->filename[sizeof(backup->filename) - 1] = '\0'; // Ensure null termination
-    
     // Set the backup state to ready
     backup->state = BACKUP_STATE_READY;
     
     // Set the creation time to the current system time
     backup->creation_time = get_current_timestamp();
     
-    // Calculate and set the actual backup size
-    backup->size = calculate_backup_size(backup->id);
-    
     return backup->id;
 }
 
@@ -233,6 +1199,9 @@ int backup_delete(backup_id_t id) {
     // Delete the backup
     // Check if the backup file exists
     if (file_exists(backup->filename)) {
+        // Drop the chunk references of the manifest
+        backup_release_data(backup);
+        
         // Delete the backup file
         if (delete_file(backup->filename) != 0) {
             console_printf("Error: Failed to delete backup file: %s\n", backup->filename);
@@ -263,7 +1232,7 @@ int backup_delete(backup_id_t id) {
     backup_table[id] = NULL;
     
     // Free the backup information
-    memory_free(backup, sizeof(backup_info_t));
+    memory_cache_free(backup_cache, backup);
     
     return 0;
 }
@@ -301,30 +1270,16 @@ int backup_restore(backup_id_t id) {
         return -1;
     }
     
-    // Read the backup file
-    void* compressed_data = NULL;
-    size_t compressed_size = 0;
-    
-    if (read_file(backup->filename, &compressed_data, &compressed_size) != 0) {
-        console_printf("Error: Failed to read backup file\n");
-        backup->state = BACKUP_STATE_ERROR;
-        return -1;
-    }
-    
-    // Decompress the backup data
+    // Reassemble the snapshot from its chunks
     void* backup_data = NULL;
     size_t backup_data_size = 0;
     
-    if (decompress_data(compressed_data, compressed_size, &backup_data, &backup_data_size) != 0) {
-        console_printf("Error: Failed to decompress backup data\n");
-        memory_free(compressed_data, compressed_size);
+    if (backup_load_data(backup, &backup_data, &backup_data_size) != 0) {
+        console_printf("Error: Failed to read backup data\n");
         backup->state = BACKUP_STATE_ERROR;
         return -1;
     }
     
-    // Free the compressed data
-    memory_free(compressed_data, compressed_size);
-    
     // Apply the backup based on its type
     int result = -1;
     
@@ -356,7 +1311,9 @@ int backup_restore(backup_id_t id) {
     }
     
     // Free the backup data
-    memory_free(backup_data, backup_data_size);
+    if (backup_data) {
+        memory_free(backup_data, backup_data_size);
+    }
     
     if (result != 0) {
         console_printf("Error: Failed to restore backup\n");
@@ -687,9 +1644,11 @@ int backup_export(backup_id_t id, const char* filename) {
     }
     
     // Export the backup
-    // Check if the backup file exists
-    if (!file_exists(backup->filename)) {
-        console_printf("Error: Backup file not found: %s\n", backup->filename);
+    // Read the manifest of the backup
+    size_t manifest_size = 0;
+    backup_manifest_header_t* manifest = backup_manifest_read(backup, &manifest_size);
+    
+    if (!manifest) {
         return -1;
     }
     
@@ -697,6 +1656,7 @@ int backup_export(backup_id_t id, const char* filename) {
     FILE* export_file = fopen(filename, "wb");
     if (!export_file) {
         console_printf("Error: Failed to create export file: %s\n", filename);
+        memory_free(manifest, manifest_size);
         return -1;
     }
     
@@ -709,45 +1669,57 @@ int backup_export(backup_id_t id, const char* filename) {
     header.type = backup->type;
     header.flags = backup->flags;
     header.creation_time = backup->creation_time;
-    header.size = backup->size;
+    header.size = manifest->data_size;
     header.parent_id = backup->parent_id;
     
     // Copy description with explicit length limit to avoid truncation warning
     memcpy(header.description, backup->description, sizeof(header.description) - 1);
     header.description[sizeof(header.description) - 1] = '\0'; // Ensure null termination
     
+    int result = 0;
+    
     if (fwrite(&header, sizeof(header), 1, export_file) != 1) {
         console_printf("Error: Failed to write backup header\n");
-        fclose(export_file);
-        return -1;
+        result = -1;
     }
     
-    // Open the backup file
-    FILE* backup_file = fopen(backup->filename, "rb");
-    if (!backup_file) {
-        console_printf("Error: Failed to open backup file: %s\n", backup->filename);
-        fclose(export_file);
-        return -1;
-    }
+    // Stream the stored chunks out one block at a time, still compressed
+    backup_chunk_ref_t* refs = backup_manifest_refs(manifest);
     
-    // Copy the backup data to the export file
-    char buffer[4096];
-    size_t bytes_read;
-    
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), backup_file)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, export_file) != bytes_read) {
+    for (uint32_t i = 0; i < manifest->num_chunks && result == 0; i++) {
+        char path[64];
+        backup_chunk_path(refs[i].hash, path, sizeof(path));
+        
+        void* stored = NULL;
+        size_t stored_size = 0;
+        
+        if (read_file(path, &stored, &stored_size) != 0) {
+            console_printf("Error: Failed to read backup chunk: %s\n", path);
+            result = -1;
+            break;
+        }
+        
+        backup_block_header_t block;
+        block.size = refs[i].size;
+        block.stored_size = (uint32_t)stored_size;
+        
+        if (stored_size == 0 || stored_size > refs[i].size) {
+            console_printf("Error: Corrupted backup chunk: %s\n", path);
+            result = -1;
+        } else if (fwrite(&block, sizeof(block), 1, export_file) != 1 ||
+                   fwrite(stored, 1, stored_size, export_file) != stored_size) {
             console_printf("Error: Failed to write backup data\n");
-            fclose(backup_file);
-            fclose(export_file);
-            return -1;
+            result = -1;
         }
+        
+        memory_free(stored, stored_size);
     }
     
-    // Close the files
-    fclose(backup_file);
+    // Close the file
     fclose(export_file);
+    memory_free(manifest, manifest_size);
     
-    return 0;
+    return result;
 }
 
 /**
@@ -793,70 +1765,128 @@ backup_id_t backup_import(const char* filename, const char* description) {
         return 0;
     }
     
-    // Check if the backup version is compatible
-    if (header.version > BACKUP_VERSION) {
+    // Check if the backup version is compatible (the block stream is version 2)
+    if (header.version != BACKUP_VERSION || header.type > BACKUP_TYPE_CUSTOM) {
         console_printf("Error: Backup version not supported\n");
         fclose(import_file);
         return 0;
     }
     
-    // Create a new backup
-    backup_id_t id = backup_create(header.type, header.flags, description ? description : header.description, 0);
-    if (id == 0) {
-        console_printf("Error: Failed to create backup\n");
+    // Buffers for one stored block and its decompressed chunk
+    uint8_t* stored = (uint8_t*)memory_alloc(2 * BACKUP_CHUNK_MAX_SIZE, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    
+    if (!stored) {
+        console_printf("Error: Failed to allocate import buffers\n");
         fclose(import_file);
         return 0;
     }
     
-    // Get the backup information
-    backup_info_t* backup = backup_table[id];
-    
-    // Set the backup creation time to match the imported backup
-    backup->creation_time = header.creation_time;
+    uint8_t* chunk_data = stored + BACKUP_CHUNK_MAX_SIZE;
     
-    // Generate a unique filename for the backup
-    char backup_filename[256];
-    snprintf(backup_filename, sizeof(backup_filename), "/backups/%s_%u_%lu.bak", 
-             get_backup_type_name(header.type), id, (unsigned long)header.creation_time);
+    // Create the backup with the creation time of the imported one
+    backup_info_t* backup = backup_alloc_info(header.type, header.flags,
+                                              description ? description : header.description,
+                                              0, header.creation_time);
+    backup_manifest_t manifest;
     
-    // Create the backup file
-    FILE* backup_file = fopen(backup_filename, "wb");
-    if (!backup_file) {
-        console_printf("Error: Failed to create backup file: %s\n", backup_filename);
+    if (!backup || backup_manifest_begin(&manifest, backup, header.size) != 0) {
+        if (backup) {
+            backup_table[backup->id] = NULL;
+            memory_cache_free(backup_cache, backup);
+        }
+        memory_free(stored, 2 * BACKUP_CHUNK_MAX_SIZE);
         fclose(import_file);
-        backup_delete(id);
         return 0;
     }
     
-    // Copy the backup data to the backup file
-    char buffer[4096];
-    size_t bytes_read;
+    backup->creation_time = header.creation_time;
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), import_file)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, backup_file) != bytes_read) {
-            console_printf("Error: Failed to write backup data\n");
-            fclose(import_file);
-            fclose(backup_file);
-            backup_delete(id);
-            return 0;
+    // Stream the blocks into the chunk store; stored chunks are only referenced
+    uint64_t offset = 0;
+    int result = 0;
+    
+    while (offset < header.size) {
+        backup_block_header_t block;
+        
+        if (fread(&block, sizeof(block), 1, import_file) != 1 ||
+            block.size == 0 || block.size > BACKUP_CHUNK_MAX_SIZE || block.size > header.size - offset ||
+            block.stored_size == 0 || block.stored_size > block.size ||
+            fread(stored, 1, block.stored_size, import_file) != block.stored_size) {
+            console_printf("Error: Invalid backup block\n");
+            result = -1;
+            break;
+        }
+        
+        const uint8_t* data = stored;
+        size_t size = block.size;
+        
+        if (block.stored_size < block.size) {
+            if (lz4_decompress(stored, block.stored_size, chunk_data, block.size, &size) != 0 ||
+                size != block.size) {
+                console_printf("Error: Failed to decompress backup block\n");
+                result = -1;
+                break;
+            }
+            data = chunk_data;
+        }
+        
+        backup_chunk_ref_t* ref = backup_manifest_append(&manifest);
+        
+        if (!ref) {
+            console_printf("Error: Failed to grow backup manifest\n");
+            result = -1;
+            break;
+        }
+        
+        memset(ref, 0, sizeof(*ref));
+        backup_chunk_hash(data, size, ref->hash);
+        ref->size = block.size;
+        offset += block.size;
+        
+        backup_chunk_t* chunk = backup_chunk_find(ref->hash, ref->size);
+        
+        if (chunk) {
+            chunk->refcount++;
+            continue;
+        }
+        
+        chunk = backup_chunk_insert(ref);
+        
+        if (!chunk) {
+            manifest.header->num_chunks--;
+            result = -1;
+            break;
+        }
+        
+        // The block is already in the stored format
+        char path[64];
+        backup_chunk_path(ref->hash, path, sizeof(path));
+        
+        if (write_file(path, stored, block.stored_size) != 0) {
+            console_printf("Error: Failed to write backup chunk: %s\n", path);
+            result = -1;
+            break;
         }
+        
+        chunk->stored_size = block.stored_size;
+        manifest.stored_bytes += block.stored_size;
+        manifest.new_chunks++;
     }
     
-    // Close the files
     fclose(import_file);
-    fclose(backup_file);
+    memory_free(stored, 2 * BACKUP_CHUNK_MAX_SIZE);
     
-    // Store the backup filename
-    strncpy(backup->filename, backup_filename, sizeof(backup->filename) - 1);
-    backup->filename[sizeof(backup->filename) - 1] = '\0'; // Ensure null termination
+    if (backup_manifest_finish(&manifest, backup, result) != 0) {
+        console_printf("Error: Failed to store backup data\n");
+        backup_table[backup->id] = NULL;
+        memory_cache_free(backup_cache, backup);
+        return 0;
+    }
     
     // Set the backup state to ready
     backup->state = BACKUP_STATE_READY;
     
-    // Set the backup size
-    backup->size = header.size;
-    
-    return id;
+    return backup->id;
 }
 
 /**
@@ -0,0 +1,922 @@
+/**
+ * bpe.c - Byte-level BPE encoder for NeuroOS
+ *
+ * This file implements the byte-level byte pair encoder shared by the
+ * tokenizers. Merge ranks are kept in a pair -> rank hash table and each
+ * pre-token is merged with a min-heap over its adjacent pairs, so a word of
+ * n bytes costs O(n log n) instead of O(n^2). Encoded words are kept in an
+ * LRU cache because prompts repeat the same system text.
+ */
+
+#include "include/bpe.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+
+// Number of bytes that do not map to themselves in the byte-level alphabet
+#define BPE_SHIFTED_BYTES 68
+
+// Byte of each shifted code point (256 + n)
+static uint8_t bpe_shifted_bytes[BPE_SHIFTED_BYTES];
+
+/**
+ * Check whether a byte maps to itself in the byte-level alphabet
+ *
+ * @param b: Byte
+ * @return: 1 if the byte is printable as is, 0 otherwise
+ */
+static int bpe_byte_is_direct(uint32_t b) {
+    return (b >= 33 && b <= 126) || (b >= 161 && b <= 172) || (b >= 174 && b <= 255);
+}
+
+/**
+ * Get the code point of a byte in the byte-level alphabet
+ *
+ * @param b: Byte
+ * @return: Code point
+ */
+static uint32_t bpe_byte_to_unicode(uint32_t b) {
+    if (bpe_byte_is_direct(b)) {
+        return b;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < b; i++) {
+        if (!bpe_byte_is_direct(i)) {
+            n++;
+        }
+    }
+
+    return 256 + n;
+}
+
+/**
+ * Lock the encoder
+ *
+ * @param bpe: BPE encoder
+ */
+static void bpe_lock(bpe_t* bpe) {
+    while (__sync_lock_test_and_set(&bpe->lock, 1)) {
+        while (bpe->lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Unlock the encoder
+ *
+ * @param bpe: BPE encoder
+ */
+static void bpe_unlock(bpe_t* bpe) {
+    __sync_lock_release(&bpe->lock);
+}
+
+/**
+ * Take the encoder's shared scratch space
+ *
+ * @param bpe: BPE encoder
+ * @return: Scratch space
+ */
+static bpe_scratch_t* bpe_scratch_acquire(bpe_t* bpe) {
+    while (__sync_lock_test_and_set(&bpe->scratch_lock, 1)) {
+        while (bpe->scratch_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+
+    return (bpe_scratch_t*)((uint8_t*)bpe->cache_buckets + BPE_CACHE_BUCKETS * sizeof(int32_t));
+}
+
+/**
+ * Give back the encoder's shared scratch space
+ *
+ * @param bpe: BPE encoder
+ */
+static void bpe_scratch_release(bpe_t* bpe) {
+    __sync_lock_release(&bpe->scratch_lock);
+}
+
+/**
+ * Hash a token pair
+ *
+ * @param left: Left token ID
+ * @param right: Right token ID
+ * @return: Hash value
+ */
+static uint32_t bpe_pair_hash(uint32_t left, uint32_t right) {
+    uint32_t h = left * 0x9E3779B1u ^ (right + 0x7F4A7C15u) * 0x85EBCA77u;
+
+    return h ^ (h >> 15);
+}
+
+/**
+ * Find the merge rule of a token pair
+ *
+ * @param bpe: BPE encoder
+ * @param left: Left token ID
+ * @param right: Right token ID
+ * @return: Merge rule, NULL if the pair does not merge
+ */
+static const bpe_merge_t* bpe_find_merge(const bpe_t* bpe, uint32_t left, uint32_t right) {
+    uint32_t mask = bpe->merges_capacity - 1;
+    uint32_t index = bpe_pair_hash(left, right) & mask;
+
+    while (bpe->merges[index].left != VOCAB_NO_TOKEN) {
+        if (bpe->merges[index].left == left && bpe->merges[index].right == right) {
+            return &bpe->merges[index];
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/**
+ * Add a merge rule
+ *
+ * @param bpe: BPE encoder
+ * @param left: Left token ID
+ * @param right: Right token ID
+ * @param merged: Merged token ID
+ * @param rank: Merge priority (lower merges first)
+ * @return: 0 on success, -1 if the table is full
+ */
+static int bpe_add_merge(bpe_t* bpe, uint32_t left, uint32_t right, uint32_t merged, uint32_t rank) {
+    // Keep the table at most three quarters full
+    if ((bpe->num_merges + 1) * 4 > bpe->merges_capacity * 3) {
+        return -1;
+    }
+
+    uint32_t mask = bpe->merges_capacity - 1;
+    uint32_t index = bpe_pair_hash(left, right) & mask;
+
+    while (bpe->merges[index].left != VOCAB_NO_TOKEN) {
+        if (bpe->merges[index].left == left && bpe->merges[index].right == right) {
+            return 0;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    bpe->merges[index].left = left;
+    bpe->merges[index].right = right;
+    bpe->merges[index].merged = merged;
+    bpe->merges[index].rank = rank;
+    bpe->num_merges++;
+
+    return 0;
+}
+
+/**
+ * Add the merge rule for the token pair a + b
+ *
+ * @param bpe: BPE encoder
+ * @param a: Left token text
+ * @param a_len: Left token length
+ * @param b: Right token text
+ * @param b_len: Right token length
+ * @param rank: Merge priority
+ * @param buffer: Scratch buffer for the merged text
+ * @param buffer_size: Size of the scratch buffer
+ * @return: 0 on success or if the pair is unknown, -1 if the table is full
+ */
+static int bpe_add_merge_text(bpe_t* bpe, const char* a, size_t a_len, const char* b, size_t b_len,
+                              uint32_t rank, char* buffer, size_t buffer_size) {
+    uint32_t left, right, merged;
+
+    if (a_len + b_len > buffer_size) {
+        return 0;
+    }
+
+    memcpy(buffer, a, a_len);
+    memcpy(buffer + a_len, b, b_len);
+
+    if (vocab_lookup(bpe->vocab, a, a_len, &left) != 0 || vocab_lookup(bpe->vocab, b, b_len, &right) != 0 ||
+        vocab_lookup(bpe->vocab, buffer, a_len + b_len, &merged) != 0) {
+        return 0;
+    }
+
+    return bpe_add_merge(bpe, left, right, merged, rank);
+}
+
+/**
+ * Load the merge list of tokenizer.json
+ *
+ * Accepts both the "a b" and the ["a", "b"] merge formats.
+ *
+ * @param bpe: BPE encoder
+ * @param json: tokenizer.json contents
+ * @param len: Length of the contents
+ * @return: 0 on success, -1 on malformed JSON
+ */
+static int bpe_load_merges(bpe_t* bpe, const char* json, size_t len) {
+    const char* end = json + len;
+    const char* model = vocab_json_find_key(json, end, "model");
+    const char* p = vocab_json_find_key(model ? model : json, end, "merges");
+    char a[BPE_MAX_WORD], b[BPE_MAX_WORD], merged[BPE_MAX_WORD * 2];
+    uint32_t rank = 0;
+
+    if (!p || p >= end || *p != '[') {
+        return 0;
+    }
+    p++;
+
+    for (;;) {
+        size_t a_len = 0, b_len = 0;
+
+        p = vocab_json_skip_ws(p, end);
+        if (p < end && *p == ']') {
+            break;
+        }
+
+        if (p < end && *p == '[') {
+            // ["a", "b"]
+            p = vocab_json_parse_string(vocab_json_skip_ws(p + 1, end), end, a, sizeof(a), &a_len);
+            if (!p) {
+                return -1;
+            }
+
+            p = vocab_json_skip_ws(p, end);
+            if (p < end && *p == ',') {
+                p++;
+            }
+
+            p = vocab_json_parse_string(vocab_json_skip_ws(p, end), end, b, sizeof(b), &b_len);
+            if (!p) {
+                return -1;
+            }
+
+            p = vocab_json_skip_ws(p, end);
+            if (p >= end || *p != ']') {
+                return -1;
+            }
+            p++;
+        } else {
+            // "a b"
+            char pair[BPE_MAX_WORD * 2];
+            size_t pair_len;
+
+            p = vocab_json_parse_string(p, end, pair, sizeof(pair), &pair_len);
+            if (!p) {
+                return -1;
+            }
+
+            const char* space = pair_len != (size_t)-1 ? memchr(pair, ' ', pair_len) : NULL;
+
+            if (space && (size_t)(space - pair) <= sizeof(a) && pair_len - (size_t)(space - pair) - 1 <= sizeof(b)) {
+                a_len = (size_t)(space - pair);
+                b_len = pair_len - a_len - 1;
+                memcpy(a, pair, a_len);
+                memcpy(b, space + 1, b_len);
+            } else {
+                a_len = (size_t)-1;
+            }
+        }
+
+        if (a_len != (size_t)-1 && b_len != (size_t)-1) {
+            if (bpe_add_merge_text(bpe, a, a_len, b, b_len, rank, merged, sizeof(merged)) != 0) {
+                console_printf("Error: BPE merge table full after %u merges\n", (unsigned int)bpe->num_merges);
+                return 0;
+            }
+        }
+        rank++;
+
+        p = vocab_json_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Initialize a BPE encoder
+ *
+ * @param bpe: BPE encoder to initialize
+ * @param vocab: Vocabulary (borrowed)
+ * @param json: tokenizer.json contents
+ * @param len: Length of the contents
+ * @return: 0 on success, -1 on failure or if the file has no merges
+ */
+int bpe_init(bpe_t* bpe, const vocab_t* vocab, const char* json, size_t len) {
+    if (!bpe || !vocab || vocab->num_tokens == 0 || !json) {
+        return -1;
+    }
+
+    memset(bpe, 0, sizeof(bpe_t));
+    bpe->vocab = vocab;
+
+    // Merges rarely outnumber the vocabulary
+    uint32_t capacity = 16;
+    while (capacity * 3 < vocab->num_tokens * 4) {
+        capacity <<= 1;
+    }
+
+    size_t merges_size = capacity * sizeof(bpe_merge_t);
+    size_t cache_size = BPE_CACHE_ENTRIES * sizeof(bpe_cache_entry_t);
+    size_t buckets_size = BPE_CACHE_BUCKETS * sizeof(int32_t);
+    size_t alloc_size = merges_size + cache_size + buckets_size + sizeof(bpe_scratch_t);
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for BPE encoder\n");
+        return -1;
+    }
+
+    bpe->merges = (bpe_merge_t*)block;
+    bpe->merges_capacity = capacity;
+    bpe->cache = (bpe_cache_entry_t*)(block + merges_size);
+    bpe->cache_buckets = (int32_t*)(block + merges_size + cache_size);
+    bpe->cache_head = -1;
+    bpe->cache_tail = -1;
+    bpe->alloc_size = alloc_size;
+
+    memset(bpe->merges, 0xFF, merges_size);
+    memset(bpe->cache_buckets, 0xFF, buckets_size);
+
+    // Token of each byte in the byte-level alphabet
+    for (uint32_t b = 0, n = 0; b < 256; b++) {
+        uint32_t cp = bpe_byte_to_unicode(b);
+        char text[2];
+        size_t text_len;
+
+        if (cp < 0x80) {
+            text[0] = (char)cp;
+            text_len = 1;
+        } else {
+            text[0] = (char)(0xC0 | (cp >> 6));
+            text[1] = (char)(0x80 | (cp & 0x3F));
+            text_len = 2;
+        }
+
+        if (vocab_lookup(vocab, text, text_len, &bpe->byte_ids[b]) != 0) {
+            bpe->byte_ids[b] = VOCAB_NO_TOKEN;
+        }
+
+        if (cp >= 256) {
+            bpe_shifted_bytes[n++] = (uint8_t)b;
+        }
+    }
+
+    if (bpe_load_merges(bpe, json, len) != 0 || bpe->num_merges == 0) {
+        bpe_free(bpe);
+        return -1;
+    }
+
+    bpe->stats.num_merges = bpe->num_merges;
+
+    return 0;
+}
+
+/**
+ * Free a BPE encoder
+ *
+ * @param bpe: BPE encoder to free
+ */
+void bpe_free(bpe_t* bpe) {
+    if (!bpe) {
+        return;
+    }
+
+    if (bpe->merges) {
+        memory_free(bpe->merges, bpe->alloc_size);
+    }
+
+    memset(bpe, 0, sizeof(bpe_t));
+}
+
+/**
+ * Compare two merge candidates
+ *
+ * @return: Nonzero if a merges before b
+ */
+static int bpe_candidate_before(const bpe_candidate_t* a, const bpe_candidate_t* b) {
+    return a->rank < b->rank || (a->rank == b->rank && a->pos < b->pos);
+}
+
+/**
+ * Push the merge candidate starting at a symbol, if the pair merges
+ *
+ * @param bpe: BPE encoder
+ * @param s: Scratch space
+ * @param heap_size: Pointer to the heap size
+ * @param pos: Position of the left symbol (-1 is ignored)
+ */
+static void bpe_push_candidate(const bpe_t* bpe, bpe_scratch_t* s, uint32_t* heap_size, int32_t pos) {
+    if (pos < 0 || s->next[pos] < 0) {
+        return;
+    }
+
+    uint32_t left = s->ids[pos];
+    uint32_t right = s->ids[s->next[pos]];
+    const bpe_merge_t* merge = bpe_find_merge(bpe, left, right);
+
+    if (!merge) {
+        return;
+    }
+
+    // Sift up
+    uint32_t i = (*heap_size)++;
+    bpe_candidate_t c = {merge->rank, (uint32_t)pos, left, right};
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+
+        if (!bpe_candidate_before(&c, &s->heap[parent])) {
+            break;
+        }
+
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+
+    s->heap[i] = c;
+}
+
+/**
+ * Pop the best merge candidate
+ *
+ * @param s: Scratch space
+ * @param heap_size: Pointer to the heap size
+ * @return: Best candidate
+ */
+static bpe_candidate_t bpe_pop_candidate(bpe_scratch_t* s, uint32_t* heap_size) {
+    bpe_candidate_t top = s->heap[0];
+    bpe_candidate_t last = s->heap[--(*heap_size)];
+    uint32_t i = 0;
+
+    // Sift down
+    for (;;) {
+        uint32_t child = i * 2 + 1;
+
+        if (child >= *heap_size) {
+            break;
+        }
+
+        if (child + 1 < *heap_size && bpe_candidate_before(&s->heap[child + 1], &s->heap[child])) {
+            child++;
+        }
+
+        if (!bpe_candidate_before(&s->heap[child], &last)) {
+            break;
+        }
+
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+
+    if (*heap_size > 0) {
+        s->heap[i] = last;
+    }
+
+    return top;
+}
+
+/**
+ * Merge one pre-token
+ *
+ * @param bpe: BPE encoder
+ * @param s: Scratch space owned by the caller
+ * @param word: Pre-token bytes
+ * @param len: Pre-token length (at most BPE_MAX_WORD)
+ * @param ids: Output token IDs
+ * @param max_ids: Capacity of the output
+ * @return: Number of token IDs written
+ */
+static size_t bpe_merge_word(const bpe_t* bpe, bpe_scratch_t* s, const char* word, size_t len, uint32_t* ids, size_t max_ids) {
+    uint32_t heap_size = 0;
+
+    // One symbol per byte, linked in order
+    for (size_t i = 0; i < len; i++) {
+        s->ids[i] = bpe->byte_ids[(uint8_t)word[i]];
+        s->prev[i] = (int32_t)i - 1;
+        s->next[i] = i + 1 < len ? (int32_t)i + 1 : -1;
+    }
+
+    for (size_t i = 0; i + 1 < len; i++) {
+        bpe_push_candidate(bpe, s, &heap_size, (int32_t)i);
+    }
+
+    // Apply the lowest ranked merge until none is left
+    while (heap_size > 0) {
+        bpe_candidate_t c = bpe_pop_candidate(s, &heap_size);
+        int32_t right = s->next[c.pos];
+
+        // Skip candidates made stale by an earlier merge
+        if (s->ids[c.pos] != c.left || right < 0 || s->ids[right] != c.right) {
+            continue;
+        }
+
+        const bpe_merge_t* merge = bpe_find_merge(bpe, c.left, c.right);
+
+        s->ids[c.pos] = merge->merged;
+        s->next[c.pos] = s->next[right];
+        if (s->next[right] >= 0) {
+            s->prev[s->next[right]] = (int32_t)c.pos;
+        }
+        s->ids[right] = VOCAB_NO_TOKEN;
+
+        bpe_push_candidate(bpe, s, &heap_size, s->prev[c.pos]);
+        bpe_push_candidate(bpe, s, &heap_size, (int32_t)c.pos);
+    }
+
+    size_t count = 0;
+
+    for (int32_t i = 0; i >= 0 && count < max_ids; i = s->next[i]) {
+        ids[count++] = s->ids[i];
+    }
+
+    return count;
+}
+
+/**
+ * Hash a pre-token for the word cache
+ *
+ * @param word: Pre-token bytes
+ * @param len: Pre-token length
+ * @return: Hash value
+ */
+static uint32_t bpe_word_hash(const char* word, size_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)word[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Unlink a cache entry from the LRU list
+ *
+ * @param bpe: BPE encoder
+ * @param index: Entry index
+ */
+static void bpe_cache_unlink(bpe_t* bpe, int32_t index) {
+    bpe_cache_entry_t* e = &bpe->cache[index];
+
+    if (e->lru_prev >= 0) {
+        bpe->cache[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        bpe->cache_head = e->lru_next;
+    }
+
+    if (e->lru_next >= 0) {
+        bpe->cache[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        bpe->cache_tail = e->lru_prev;
+    }
+}
+
+/**
+ * Make a cache entry the most recently used
+ *
+ * @param bpe: BPE encoder
+ * @param index: Entry index
+ */
+static void bpe_cache_push_front(bpe_t* bpe, int32_t index) {
+    bpe_cache_entry_t* e = &bpe->cache[index];
+
+    e->lru_prev = -1;
+    e->lru_next = bpe->cache_head;
+
+    if (bpe->cache_head >= 0) {
+        bpe->cache[bpe->cache_head].lru_prev = index;
+    }
+
+    bpe->cache_head = index;
+
+    if (bpe->cache_tail < 0) {
+        bpe->cache_tail = index;
+    }
+}
+
+/**
+ * Look up a pre-token in the word cache (encoder lock held)
+ *
+ * @param bpe: BPE encoder
+ * @param word: Pre-token bytes
+ * @param len: Pre-token length
+ * @param hash: Pre-token hash
+ * @return: Entry, NULL on a miss
+ */
+static bpe_cache_entry_t* bpe_cache_lookup(bpe_t* bpe, const char* word, size_t len, uint32_t hash) {
+    for (int32_t i = bpe->cache_buckets[hash % BPE_CACHE_BUCKETS]; i >= 0; i = bpe->cache[i].hash_next) {
+        bpe_cache_entry_t* e = &bpe->cache[i];
+
+        if (e->hash == hash && e->word_len == len && memcmp(e->word, word, len) == 0) {
+            bpe_cache_unlink(bpe, i);
+            bpe_cache_push_front(bpe, i);
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Insert a pre-token into the word cache, evicting the least recently used
+ * (encoder lock held)
+ *
+ * @param bpe: BPE encoder
+ * @param word: Pre-token bytes
+ * @param len: Pre-token length
+ * @param hash: Pre-token hash
+ * @param ids: Token IDs of the pre-token
+ * @param num_ids: Number of token IDs
+ */
+static void bpe_cache_insert(bpe_t* bpe, const char* word, size_t len, uint32_t hash, const uint32_t* ids, size_t num_ids) {
+    int32_t index;
+
+    if (bpe->cache_used < BPE_CACHE_ENTRIES) {
+        index = (int32_t)bpe->cache_used++;
+    } else {
+        index = bpe->cache_tail;
+        bpe_cache_unlink(bpe, index);
+
+        // Remove the victim from its hash chain
+        int32_t* link = &bpe->cache_buckets[bpe->cache[index].hash % BPE_CACHE_BUCKETS];
+        while (*link != index) {
+            link = &bpe->cache[*link].hash_next;
+        }
+        *link = bpe->cache[index].hash_next;
+    }
+
+    bpe_cache_entry_t* e = &bpe->cache[index];
+
+    memcpy(e->word, word, len);
+    memcpy(e->ids, ids, num_ids * sizeof(uint32_t));
+    e->word_len = (uint16_t)len;
+    e->num_ids = (uint16_t)num_ids;
+    e->hash = hash;
+    e->hash_next = bpe->cache_buckets[hash % BPE_CACHE_BUCKETS];
+    bpe->cache_buckets[hash % BPE_CACHE_BUCKETS] = index;
+
+    bpe_cache_push_front(bpe, index);
+}
+
+/**
+ * Get the pre-tokenizer class of a byte
+ *
+ * @param c: Byte
+ * @return: 0 for whitespace, 1 for letters, 2 for digits, 3 for anything else
+ */
+static int bpe_char_class(uint8_t c) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return 0;
+    }
+
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80) {
+        return 1;
+    }
+
+    if (c >= '0' && c <= '9') {
+        return 2;
+    }
+
+    return 3;
+}
+
+/**
+ * Find the end of the pre-token starting at a position
+ *
+ * Letters, digits and punctuation form runs that take one leading space,
+ * like the GPT-2 pre-tokenizer; other whitespace forms its own runs.
+ *
+ * @param text: Text
+ * @param len: Text length
+ * @param start: Start of the pre-token
+ * @return: End of the pre-token
+ */
+static size_t bpe_pretoken_end(const char* text, size_t len, size_t start) {
+    size_t i = start;
+    int cls = bpe_char_class((uint8_t)text[i]);
+
+    if (text[i] == ' ' && i + 1 < len && bpe_char_class((uint8_t)text[i + 1]) != 0) {
+        i++;
+        cls = bpe_char_class((uint8_t)text[i]);
+    }
+
+    if (cls != 0) {
+        while (i < len && bpe_char_class((uint8_t)text[i]) == cls) {
+            i++;
+        }
+        return i;
+    }
+
+    while (i < len && bpe_char_class((uint8_t)text[i]) == 0) {
+        i++;
+    }
+
+    // Leave the last space for the following word
+    if (i < len && i - start > 1 && text[i - 1] == ' ') {
+        i--;
+    }
+
+    return i;
+}
+
+/**
+ * Encode text into token IDs with caller-owned scratch space
+ *
+ * The encoder lock is only held around the word cache, so callers with
+ * their own scratch space can encode in parallel.
+ * Bytes with no token in the vocabulary come out as VOCAB_NO_TOKEN.
+ *
+ * @param bpe: BPE encoder
+ * @param scratch: Scratch space, not shared with concurrent callers
+ * @param text: Text
+ * @param len: Text length
+ * @param ids: Output token IDs
+ * @param max_ids: Capacity of the output
+ * @param num_ids: Pointer to store the number of token IDs
+ * @return: 0 on success, -1 on failure
+ */
+int bpe_encode_scratch(bpe_t* bpe, bpe_scratch_t* scratch, const char* text, size_t len, uint32_t* ids, size_t max_ids, size_t* num_ids) {
+    if (!bpe || !bpe->merges || !scratch || !text || !ids || !num_ids) {
+        return -1;
+    }
+
+    size_t count = 0;
+    size_t pos = 0;
+    uint64_t words = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    while (pos < len && count < max_ids) {
+        size_t end = bpe_pretoken_end(text, len, pos);
+        const char* word = text + pos;
+        size_t word_len = end - pos;
+
+        words++;
+
+        if (word_len <= BPE_CACHE_WORD_LEN) {
+            uint32_t hash = bpe_word_hash(word, word_len);
+            size_t n = 0;
+            int hit = 0;
+
+            bpe_lock(bpe);
+            bpe_cache_entry_t* e = bpe_cache_lookup(bpe, word, word_len, hash);
+            if (e) {
+                n = e->num_ids < max_ids - count ? e->num_ids : max_ids - count;
+                memcpy(ids + count, e->ids, n * sizeof(uint32_t));
+                hit = 1;
+            }
+            bpe_unlock(bpe);
+
+            if (hit) {
+                hits++;
+            } else {
+                n = bpe_merge_word(bpe, scratch, word, word_len, ids + count, max_ids - count);
+
+                // Another caller may have cached the word meanwhile
+                if (n <= BPE_CACHE_MAX_IDS) {
+                    bpe_lock(bpe);
+                    if (!bpe_cache_lookup(bpe, word, word_len, hash)) {
+                        bpe_cache_insert(bpe, word, word_len, hash, ids + count, n);
+                    }
+                    bpe_unlock(bpe);
+                }
+                misses++;
+            }
+
+            count += n;
+        } else {
+            // Long runs are merged in chunks
+            for (size_t off = 0; off < word_len && count < max_ids; off += BPE_MAX_WORD) {
+                size_t chunk = word_len - off < BPE_MAX_WORD ? word_len - off : BPE_MAX_WORD;
+
+                count += bpe_merge_word(bpe, scratch, word + off, chunk, ids + count, max_ids - count);
+            }
+            misses++;
+        }
+
+        pos = end;
+    }
+
+    bpe_lock(bpe);
+    bpe->stats.words_encoded += words;
+    bpe->stats.cache_hits += hits;
+    bpe->stats.cache_misses += misses;
+    bpe_unlock(bpe);
+
+    *num_ids = count;
+
+    return 0;
+}
+
+/**
+ * Encode text into token IDs
+ *
+ * Bytes with no token in the vocabulary come out as VOCAB_NO_TOKEN.
+ *
+ * @param bpe: BPE encoder
+ * @param text: Text
+ * @param len: Text length
+ * @param ids: Output token IDs
+ * @param max_ids: Capacity of the output
+ * @param num_ids: Pointer to store the number of token IDs
+ * @return: 0 on success, -1 on failure
+ */
+int bpe_encode(bpe_t* bpe, const char* text, size_t len, uint32_t* ids, size_t max_ids, size_t* num_ids) {
+    if (!bpe || !bpe->merges) {
+        return -1;
+    }
+
+    bpe_scratch_t* scratch = bpe_scratch_acquire(bpe);
+    int result = bpe_encode_scratch(bpe, scratch, text, len, ids, max_ids, num_ids);
+    bpe_scratch_release(bpe);
+
+    return result;
+}
+
+/**
+ * Decode token IDs into text
+ *
+ * Maps the byte-level alphabet back to raw bytes; characters outside it
+ * (such as those of added tokens) are copied as they are.
+ *
+ * @param bpe: BPE encoder
+ * @param ids: Token IDs
+ * @param num_ids: Number of token IDs
+ * @param text: Output buffer (always NUL terminated)
+ * @param text_size: Size of the output buffer
+ * @return: Number of bytes written, excluding the terminator
+ */
+size_t bpe_decode(const bpe_t* bpe, const uint32_t* ids, size_t num_ids, char* text, size_t text_size) {
+    size_t out = 0;
+
+    if (!bpe || !ids || !text || text_size == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < num_ids; i++) {
+        size_t len;
+        const uint8_t* p = (const uint8_t*)vocab_get_text(bpe->vocab, ids[i], &len);
+
+        if (!p) {
+            continue;
+        }
+
+        for (size_t j = 0; j < len; ) {
+            uint32_t cp = p[j];
+            size_t n = 1;
+
+            if ((p[j] & 0xE0) == 0xC0) {
+                n = 2;
+            } else if ((p[j] & 0xF0) == 0xE0) {
+                n = 3;
+            } else if ((p[j] & 0xF8) == 0xF0) {
+                n = 4;
+            }
+
+            if (j + n > len) {
+                n = len - j;
+            }
+
+            if (n == 2) {
+                cp = ((cp & 0x1F) << 6) | (p[j + 1] & 0x3F);
+            }
+
+            if (n == 1 || (n == 2 && cp < 256 && bpe_byte_is_direct(cp)) ||
+                (n == 2 && cp >= 256 && cp < 256 + BPE_SHIFTED_BYTES)) {
+                // One byte of the byte-level alphabet
+                if (out + 1 >= text_size) {
+                    break;
+                }
+                text[out++] = (char)(cp >= 256 ? bpe_shifted_bytes[cp - 256] : cp);
+            } else {
+                // Anything else is copied through
+                if (out + n >= text_size) {
+                    break;
+                }
+                memcpy(text + out, p + j, n);
+                out += n;
+            }
+
+            j += n;
+        }
+    }
+
+    text[out] = '\0';
+
+    return out;
+}
+
+/**
+ * Get the encoder statistics
+ *
+ * @param bpe: BPE encoder
+ * @param stats: Pointer to store the statistics
+ */
+void bpe_get_stats(const bpe_t* bpe, bpe_stats_t* stats) {
+    if (!bpe || !stats) {
+        return;
+    }
+
+    *stats = bpe->stats;
+}
@@ -3,10 +3,22 @@
  * 
  * This file implements the console subsystem, which is responsible for
  * displaying text on the screen.
+ * 
+ * Writers never touch the screen: the text goes as a record into a log ring
+ * of the CPU it runs on, which only that CPU appends to (with interrupts
+ * disabled) and only the flusher consumes, so appending takes no lock. The
+ * flusher merges the rings in sequence order, renders the text into a
+ * shadow copy of the screen and copies the changed rows to VGA memory once
+ * per batch. It also keeps the flushed text in a history ring for dmesg.
+ * Until the flusher process runs, every write is flushed right away.
  */
 
 #include "include/console.h"
+#include "include/interrupts.h"
+#include "include/process.h"
+#include "include/smp.h"
 #include <stdarg.h>
+#include <string.h>
 
 // VGA text mode constants
 #define VGA_WIDTH 80
@@ -16,6 +28,56 @@
 // VGA color attribute byte
 #define VGA_COLOR(fg, bg) (((bg) << 4) | (fg))
 
+// Log ring size per CPU in bytes (power of two)
+#define CONSOLE_RING_SIZE 8192
+
+// Records are padded to this alignment (the header size)
+#define CONSOLE_RECORD_ALIGN 8
+
+// Length of the marker record that skips the rest of the ring
+#define CONSOLE_RECORD_WRAP 0xFFFF
+
+// Longest text of a single record; longer writes are split
+#define CONSOLE_LINE_MAX 256
+
+// Fill level (in bytes) at which a writer flushes itself instead of waiting for the flusher
+#define CONSOLE_RING_PRESSURE (CONSOLE_RING_SIZE * 3 / 4)
+
+// Flusher wakeup interval, stretched up to the maximum while nothing is logged
+#define CONSOLE_FLUSH_INTERVAL_MS 20
+#define CONSOLE_FLUSH_INTERVAL_MAX_MS 320
+
+// Stack size of the flusher process
+#define CONSOLE_FLUSHER_STACK_SIZE 8192
+
+// Log record header
+typedef struct {
+    uint32_t seq;           // Global write order
+    uint16_t length;        // Text bytes, or CONSOLE_RECORD_WRAP
+    uint8_t color;          // Foreground color
+    uint8_t reserved;
+} console_record_t;
+
+// Log ring of a CPU (head and tail are free-running byte counts)
+typedef struct {
+    volatile uint32_t head;     // Advanced by the CPU the ring belongs to
+    volatile uint32_t tail;     // Advanced by the flusher
+    uint32_t dropped;
+    uint8_t data[CONSOLE_RING_SIZE] __attribute__((aligned(CONSOLE_RECORD_ALIGN)));
+} console_ring_t;
+
+// Text of a write being formatted
+typedef struct {
+    char text[CONSOLE_LINE_MAX];
+    size_t length;
+    console_color_t color;
+} console_line_t;
+
+static console_ring_t console_rings[SMP_MAX_CPUS];
+
+// Flushed text for console_log_read
+static char console_history[CONSOLE_LOG_HISTORY_SIZE];
+
 // Console state
 static struct {
     int x;                  // Cursor X position
@@ -24,8 +86,38 @@ static struct {
     console_color_t bg;     // Background color
     uint16_t* buffer;       // VGA text buffer
     int cursor_enabled;     // Whether the cursor is enabled
+    
+    // Screen copy the flusher renders into, and the rows not yet copied to VGA
+    uint16_t shadow[VGA_WIDTH * VGA_HEIGHT];
+    int dirty_first;
+    int dirty_last;
+    int cursor_dirty;
+    
+    volatile uint32_t seq;
+    volatile int flush_lock;    // Covers the screen state and the history
+    volatile int deferred;      // Set once the flusher process runs
+    pid_t flusher;
+    uint32_t history_head;      // Bytes written to the history (free-running)
+    uint32_t history_start;     // Oldest byte still readable
+    console_log_stats_t stats;
 } console;
 
+// Forward declarations
+static void console_append(const char* text, size_t length, console_color_t color);
+static int console_ring_used(const console_ring_t* ring);
+static int console_pending(void);
+static size_t console_drain(void);
+static void console_render_char(char c, console_color_t fg);
+static void console_mark_dirty(int y);
+static void console_sync_screen(void);
+static int console_lock(void);
+static int console_try_lock(void);
+static void console_unlock(int irq_enabled);
+static void console_line_putc(console_line_t* line, char c);
+static void console_line_puts(console_line_t* line, const char* str);
+static void console_line_emit(console_line_t* line);
+static void console_flusher_main(void);
+
 /**
  * Set the VGA cursor position
  * 
@@ -68,19 +160,19 @@ static void vga_set_cursor_enabled(int enabled) {
  */
 static void console_scroll(void) {
     // Move all lines up by one
-    for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            console.buffer[y * VGA_WIDTH + x] = console.buffer[(y + 1) * VGA_WIDTH + x];
-        }
-    }
+    memmove(console.shadow, console.shadow + VGA_WIDTH, (VGA_HEIGHT - 1) * VGA_WIDTH * sizeof(uint16_t));
     
     // Clear the last line
     uint8_t attribute = VGA_COLOR(console.fg, console.bg);
     uint16_t blank = ' ' | (attribute << 8);
     for (int x = 0; x < VGA_WIDTH; x++) {
-        console.buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = blank;
+        console.shadow[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = blank;
     }
     
+    // Every row changed
+    console.dirty_first = 0;
+    console.dirty_last = VGA_HEIGHT - 1;
+    
     // Move the cursor up
     console.y--;
 }
@@ -96,6 +188,10 @@ void console_init(void) {
     console.bg = CONSOLE_COLOR_BLACK;
     console.buffer = (uint16_t*)VGA_MEMORY;
     console.cursor_enabled = 1;
+    console.dirty_first = VGA_HEIGHT;
+    console.dirty_last = -1;
+    console.deferred = 0;
+    console.flusher = 0;
     
     // Clear the screen
     console_clear();
@@ -108,20 +204,28 @@ void console_init(void) {
  * Clear the console screen
  */
 void console_clear(void) {
+    // Show what was written before the screen is cleared
+    console_flush();
+    
+    int irq = console_lock();
+    
     // Clear the screen with the current colors
     uint8_t attribute = VGA_COLOR(console.fg, console.bg);
     uint16_t blank = ' ' | (attribute << 8);
     
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            console.buffer[y * VGA_WIDTH + x] = blank;
-        }
+    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
+        console.shadow[i] = blank;
     }
     
     // Reset cursor position
     console.x = 0;
     console.y = 0;
-    vga_set_cursor(console.x, console.y);
+    console.dirty_first = 0;
+    console.dirty_last = VGA_HEIGHT - 1;
+    console.cursor_dirty = 1;
+    console_sync_screen();
+    
+    console_unlock(irq);
 }
 
 /**
@@ -130,45 +234,7 @@ void console_clear(void) {
  * @param c: The character to write
  */
 void console_write_char(char c) {
-    // Handle special characters
-    if (c == '\n') {
-        // Newline
-        console.x = 0;
-        console.y++;
-    } else if (c == '\r') {
-        // Carriage return
-        console.x = 0;
-    } else if (c == '\t') {
-        // Tab (4 spaces)
-        console.x = (console.x + 4) & ~3;
-    } else if (c == '\b') {
-        // Backspace
-        if (console.x > 0) {
-            console.x--;
-            // Clear the character
-            uint8_t attribute = VGA_COLOR(console.fg, console.bg);
-            console.buffer[console.y * VGA_WIDTH + console.x] = ' ' | (attribute << 8);
-        }
-    } else {
-        // Regular character
-        uint8_t attribute = VGA_COLOR(console.fg, console.bg);
-        console.buffer[console.y * VGA_WIDTH + console.x] = c | (attribute << 8);
-        console.x++;
-    }
-    
-    // Handle line wrapping
-    if (console.x >= VGA_WIDTH) {
-        console.x = 0;
-        console.y++;
-    }
-    
-    // Handle scrolling
-    if (console.y >= VGA_HEIGHT) {
-        console_scroll();
-    }
-    
-    // Update cursor position
-    vga_set_cursor(console.x, console.y);
+    console_append(&c, 1, console.fg);
 }
 
 /**
@@ -177,9 +243,7 @@ void console_write_char(char c) {
  * @param str: The string to write
  */
 void console_write(const char* str) {
-    while (*str) {
-        console_write_char(*str++);
-    }
+    console_write_color(str, console.fg);
 }
 
 /**
@@ -189,32 +253,28 @@ void console_write(const char* str) {
  * @param color: The color to use
  */
 void console_write_color(const char* str, console_color_t color) {
-    // Save the current color
-    console_color_t old_fg = console.fg;
-    
-    // Set the new color
-    console.fg = color;
+    console_line_t line;
+    line.length = 0;
+    line.color = color;
     
-    // Write the string
-    console_write(str);
-    
-    // Restore the old color
-    console.fg = old_fg;
+    console_line_puts(&line, str);
+    console_line_emit(&line);
 }
 
 /**
  * Format and print a number to the console
  * 
+ * @param line: Text being formatted
  * @param value: The value to print
  * @param base: The base to use (e.g., 10 for decimal, 16 for hex)
  * @param width: Minimum field width
  * @param pad_char: Character to use for padding
  * @param is_signed: Whether the value is signed
  */
-static void console_print_number(unsigned long value, int base, int width, char pad_char, int is_signed) {
+static void console_print_number(console_line_t* line, unsigned long value, int base, int width, char pad_char, int is_signed) {
     // Handle negative numbers
     if (is_signed && (long)value < 0) {
-        console_write_char('-');
+        console_line_putc(line, '-');
         value = -(long)value;
     }
     
@@ -239,7 +299,7 @@ static void console_print_number(unsigned long value, int base, int width, char
     
     // Print the number (in correct order)
     while (i > 0) {
-        console_write_char(buffer[--i]);
+        console_line_putc(line, buffer[--i]);
     }
 }
 
@@ -253,6 +313,11 @@ void console_printf(const char* format, ...) {
     va_list args;
     va_start(args, format);
     
+    // Format into a local buffer; the log gets whole records
+    console_line_t line;
+    line.length = 0;
+    line.color = console.fg;
+    
     while (*format) {
         if (*format == '%') {
             format++;
@@ -278,16 +343,16 @@ void console_printf(const char* format, ...) {
                 case 'c': {
                     // Character
                     char c = (char)va_arg(args, int);
-                    console_write_char(c);
+                    console_line_putc(&line, c);
                     break;
                 }
                 case 's': {
                     // String
                     const char* s = va_arg(args, const char*);
                     if (s == NULL) {
-                        console_write("(null)");
+                        console_line_puts(&line, "(null)");
                     } else {
-                        console_write(s);
+                        console_line_puts(&line, s);
                     }
                     break;
                 }
@@ -295,48 +360,50 @@ void console_printf(const char* format, ...) {
                 case 'i': {
                     // Signed decimal
                     int value = va_arg(args, int);
-                    console_print_number(value, 10, width, pad_char, 1);
+                    console_print_number(&line, value, 10, width, pad_char, 1);
                     break;
                 }
                 case 'u': {
                     // Unsigned decimal
                     unsigned int value = va_arg(args, unsigned int);
-                    console_print_number(value, 10, width, pad_char, 0);
+                    console_print_number(&line, value, 10, width, pad_char, 0);
                     break;
                 }
                 case 'x': {
                     // Hexadecimal
                     unsigned int value = va_arg(args, unsigned int);
-                    console_print_number(value, 16, width, pad_char, 0);
+                    console_print_number(&line, value, 16, width, pad_char, 0);
                     break;
                 }
                 case 'p': {
                     // Pointer
                     void* value = va_arg(args, void*);
-                    console_write("0x");
-                    console_print_number((unsigned long)value, 16, width, pad_char, 0);
+                    console_line_puts(&line, "0x");
+                    console_print_number(&line, (unsigned long)value, 16, width, pad_char, 0);
                     break;
                 }
                 case '%': {
                     // Literal '%'
-                    console_write_char('%');
+                    console_line_putc(&line, '%');
                     break;
                 }
                 default: {
                     // Unknown format specifier
-                    console_write_char('%');
-                    console_write_char(*format);
+                    console_line_putc(&line, '%');
+                    console_line_putc(&line, *format);
                     break;
                 }
             }
         } else {
             // Regular character
-            console_write_char(*format);
+            console_line_putc(&line, *format);
         }
         
         format++;
     }
     
+    console_line_emit(&line);
+    
     va_end(args);
 }
 
@@ -353,10 +420,16 @@ void console_set_cursor(int x, int y) {
     if (y < 0) y = 0;
     if (y >= VGA_HEIGHT) y = VGA_HEIGHT - 1;
     
+    // Text written so far goes at the old position
+    console_flush();
+    
     // Update cursor position
+    int irq = console_lock();
     console.x = x;
     console.y = y;
-    vga_set_cursor(x, y);
+    console.cursor_dirty = 1;
+    console_sync_screen();
+    console_unlock(irq);
 }
 
 /**
@@ -366,6 +439,8 @@ void console_set_cursor(int x, int y) {
  * @param y: Pointer to store the y coordinate (row)
  */
 void console_get_cursor(int* x, int* y) {
+    console_flush();
+    
     if (x) *x = console.x;
     if (y) *y = console.y;
 }
@@ -379,3 +454,460 @@ void console_set_cursor_enabled(int enabled) {
     console.cursor_enabled = enabled;
     vga_set_cursor_enabled(enabled);
 }
+
+/**
+ * Write the logged text to the screen
+ * 
+ * Returns right away if another flush is in progress; that flush also
+ * picks up the text logged while it runs.
+ */
+void console_flush(void) {
+    do {
+        int irq = console_try_lock();
+        
+        if (irq < 0) {
+            return;
+        }
+        
+        if (console_drain() > 0) {
+            console.stats.flushes++;
+        }
+        
+        console_sync_screen();
+        console_unlock(irq);
+    } while (console_pending());
+}
+
+/**
+ * Start the console flusher process
+ * 
+ * From then on writers only append to the log rings and the flusher
+ * batches the screen updates.
+ * 
+ * @return: 0 on success, -1 on failure
+ */
+int console_start_flusher(void) {
+    if (console.flusher) {
+        return 0;
+    }
+    
+    pid_t pid = process_create("klogd", console_flusher_main, CONSOLE_FLUSHER_STACK_SIZE,
+                               PROCESS_PRIORITY_LOW, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+    
+    if (pid == 0) {
+        console_printf("Error: Failed to create the console flusher\n");
+        return -1;
+    }
+    
+    console.flusher = pid;
+    
+    return 0;
+}
+
+/**
+ * Read the console log
+ * 
+ * @param buffer: Buffer to store the text (NUL-terminated)
+ * @param size: Buffer size
+ * @return: Number of characters stored
+ */
+size_t console_log_read(char* buffer, size_t size) {
+    if (!buffer || size == 0) {
+        return 0;
+    }
+    
+    console_flush();
+    
+    int irq = console_lock();
+    
+    // Copy the newest text that fits
+    uint32_t available = console.history_head - console.history_start;
+    uint32_t length = available < size - 1 ? available : (uint32_t)(size - 1);
+    uint32_t start = console.history_head - length;
+    
+    for (uint32_t i = 0; i < length; i++) {
+        buffer[i] = console_history[(start + i) % CONSOLE_LOG_HISTORY_SIZE];
+    }
+    
+    buffer[length] = '\0';
+    
+    console_unlock(irq);
+    
+    return length;
+}
+
+/**
+ * Clear the console log
+ */
+void console_log_clear(void) {
+    console_flush();
+    
+    int irq = console_lock();
+    console.history_start = console.history_head;
+    console_unlock(irq);
+}
+
+/**
+ * Get console log statistics
+ * 
+ * @param stats: Pointer to store the statistics
+ */
+void console_log_get_stats(console_log_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    
+    *stats = console.stats;
+    stats->dropped = 0;
+    
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        stats->dropped += console_rings[i].dropped;
+    }
+}
+
+/**
+ * Append a record to the log ring of the calling CPU
+ * 
+ * @param text: Text
+ * @param length: Text length (at most CONSOLE_LINE_MAX)
+ * @param color: Foreground color
+ */
+static void console_append(const char* text, size_t length, console_color_t color) {
+    if (length == 0) {
+        return;
+    }
+    
+    // Nothing else runs on this CPU until the record is published
+    int irq = interrupts_are_enabled();
+    interrupts_disable();
+    
+    console_ring_t* ring = &console_rings[smp_cpu_index()];
+    uint32_t need = (sizeof(console_record_t) + length + CONSOLE_RECORD_ALIGN - 1) & ~(CONSOLE_RECORD_ALIGN - 1);
+    uint32_t head = ring->head;
+    uint32_t offset = head % CONSOLE_RING_SIZE;
+    uint32_t contiguous = CONSOLE_RING_SIZE - offset;
+    uint32_t total = need + (contiguous < need ? contiguous : 0);
+    
+    if (CONSOLE_RING_SIZE - (head - ring->tail) < total) {
+        // Full: the flusher is behind
+        ring->dropped++;
+    } else {
+        // A record does not wrap: skip the rest of the ring
+        if (contiguous < need) {
+            console_record_t* wrap = (console_record_t*)&ring->data[offset];
+            wrap->length = CONSOLE_RECORD_WRAP;
+            head += contiguous;
+            offset = 0;
+        }
+        
+        console_record_t* record = (console_record_t*)&ring->data[offset];
+        record->seq = __sync_fetch_and_add(&console.seq, 1);
+        record->length = (uint16_t)length;
+        record->color = (uint8_t)color;
+        memcpy(record + 1, text, length);
+        
+        // Publish the record to the flusher
+        __sync_synchronize();
+        ring->head = head + need;
+    }
+    
+    int used = console_ring_used(ring);
+    
+    if (irq) {
+        interrupts_enable();
+    }
+    
+    // Without the flusher, or with the ring filling up, flush right away
+    if (!console.deferred || used >= CONSOLE_RING_PRESSURE) {
+        console_flush();
+    }
+}
+
+/**
+ * Get the bytes in use in a log ring
+ * 
+ * @param ring: Log ring
+ * @return: Used bytes
+ */
+static int console_ring_used(const console_ring_t* ring) {
+    return (int)(ring->head - ring->tail);
+}
+
+/**
+ * Check if any log ring holds records
+ * 
+ * @return: 1 if there is text to flush, 0 otherwise
+ */
+static int console_pending(void) {
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (console_rings[i].head != console_rings[i].tail) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Render the records of all log rings in write order
+ * 
+ * Must be called with the flush lock held.
+ * 
+ * @return: Number of records rendered
+ */
+static size_t console_drain(void) {
+    size_t count = 0;
+    
+    for (;;) {
+        console_ring_t* next = NULL;
+        console_record_t* next_record = NULL;
+        
+        // Find the oldest record at the tail of a ring
+        for (int i = 0; i < SMP_MAX_CPUS; i++) {
+            console_ring_t* ring = &console_rings[i];
+            
+            if (ring->tail == ring->head) {
+                continue;
+            }
+            
+            __sync_synchronize();
+            
+            console_record_t* record = (console_record_t*)&ring->data[ring->tail % CONSOLE_RING_SIZE];
+            
+            if (record->length == CONSOLE_RECORD_WRAP) {
+                ring->tail += CONSOLE_RING_SIZE - ring->tail % CONSOLE_RING_SIZE;
+                i--;
+                continue;
+            }
+            
+            if (!next_record || (int32_t)(record->seq - next_record->seq) < 0) {
+                next = ring;
+                next_record = record;
+            }
+        }
+        
+        if (!next) {
+            return count;
+        }
+        
+        // Render the text and keep it for dmesg
+        const char* text = (const char*)(next_record + 1);
+        
+        for (uint16_t i = 0; i < next_record->length; i++) {
+            console_render_char(text[i], (console_color_t)next_record->color);
+            console_history[console.history_head++ % CONSOLE_LOG_HISTORY_SIZE] = text[i];
+        }
+        
+        if (console.history_head - console.history_start > CONSOLE_LOG_HISTORY_SIZE) {
+            console.history_start = console.history_head - CONSOLE_LOG_HISTORY_SIZE;
+        }
+        
+        console.stats.records++;
+        console.stats.bytes += next_record->length;
+        
+        // Hand the space back to the writer
+        uint32_t size = (sizeof(console_record_t) + next_record->length + CONSOLE_RECORD_ALIGN - 1) & ~(CONSOLE_RECORD_ALIGN - 1);
+        __sync_synchronize();
+        next->tail += size;
+        count++;
+    }
+}
+
+/**
+ * Render a character into the shadow screen
+ * 
+ * @param c: The character to write
+ * @param fg: Foreground color
+ */
+static void console_render_char(char c, console_color_t fg) {
+    // Handle special characters
+    if (c == '\n') {
+        // Newline
+        console.x = 0;
+        console.y++;
+    } else if (c == '\r') {
+        // Carriage return
+        console.x = 0;
+    } else if (c == '\t') {
+        // Tab (4 spaces)
+        console.x = (console.x + 4) & ~3;
+    } else if (c == '\b') {
+        // Backspace
+        if (console.x > 0) {
+            console.x--;
+            // Clear the character
+            uint8_t attribute = VGA_COLOR(fg, console.bg);
+            console.shadow[console.y * VGA_WIDTH + console.x] = ' ' | (attribute << 8);
+            console_mark_dirty(console.y);
+        }
+    } else {
+        // Regular character
+        uint8_t attribute = VGA_COLOR(fg, console.bg);
+        console.shadow[console.y * VGA_WIDTH + console.x] = (uint8_t)c | (attribute << 8);
+        console_mark_dirty(console.y);
+        console.x++;
+    }
+    
+    // Handle line wrapping
+    if (console.x >= VGA_WIDTH) {
+        console.x = 0;
+        console.y++;
+    }
+    
+    // Handle scrolling
+    if (console.y >= VGA_HEIGHT) {
+        console_scroll();
+    }
+    
+    console.cursor_dirty = 1;
+}
+
+/**
+ * Mark a shadow screen row as changed
+ * 
+ * @param y: Row
+ */
+static void console_mark_dirty(int y) {
+    if (y < console.dirty_first) {
+        console.dirty_first = y;
+    }
+    
+    if (y > console.dirty_last) {
+        console.dirty_last = y;
+    }
+}
+
+/**
+ * Copy the changed shadow screen rows to VGA memory and move the cursor
+ * 
+ * Must be called with the flush lock held.
+ */
+static void console_sync_screen(void) {
+    for (int y = console.dirty_first; y <= console.dirty_last; y++) {
+        volatile uint16_t* row = console.buffer + y * VGA_WIDTH;
+        
+        for (int x = 0; x < VGA_WIDTH; x++) {
+            row[x] = console.shadow[y * VGA_WIDTH + x];
+        }
+    }
+    
+    console.dirty_first = VGA_HEIGHT;
+    console.dirty_last = -1;
+    
+    // Update cursor position
+    if (console.cursor_dirty) {
+        vga_set_cursor(console.x, console.y);
+        console.cursor_dirty = 0;
+    }
+}
+
+/**
+ * Disable interrupts and take the flush lock
+ * 
+ * @return: Whether interrupts were enabled
+ */
+static int console_lock(void) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    
+    while (__sync_lock_test_and_set(&console.flush_lock, 1)) {
+        while (console.flush_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+    
+    return irq_enabled;
+}
+
+/**
+ * Disable interrupts and take the flush lock if it is free
+ * 
+ * @return: Whether interrupts were enabled, or -1 if the lock is taken
+ */
+static int console_try_lock(void) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    
+    if (__sync_lock_test_and_set(&console.flush_lock, 1)) {
+        if (irq_enabled) {
+            interrupts_enable();
+        }
+        
+        return -1;
+    }
+    
+    return irq_enabled;
+}
+
+/**
+ * Release the flush lock and restore interrupts
+ * 
+ * @param irq_enabled: Value returned by console_lock or console_try_lock
+ */
+static void console_unlock(int irq_enabled) {
+    __sync_lock_release(&console.flush_lock);
+    
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Add a character to the text being formatted
+ * 
+ * @param line: Text being formatted
+ * @param c: Character
+ */
+static void console_line_putc(console_line_t* line, char c) {
+    if (line->length == CONSOLE_LINE_MAX) {
+        console_line_emit(line);
+    }
+    
+    line->text[line->length++] = c;
+}
+
+/**
+ * Add a string to the text being formatted
+ * 
+ * @param line: Text being formatted
+ * @param str: String
+ */
+static void console_line_puts(console_line_t* line, const char* str) {
+    while (*str) {
+        console_line_putc(line, *str++);
+    }
+}
+
+/**
+ * Log the text formatted so far
+ * 
+ * @param line: Text being formatted
+ */
+static void console_line_emit(console_line_t* line) {
+    console_append(line->text, line->length, line->color);
+    line->length = 0;
+}
+
+/**
+ * Main loop of the console flusher process
+ * 
+ * Flushes in batches, checking less often while nothing is logged.
+ */
+static void console_flusher_main(void) {
+    uint32_t interval = CONSOLE_FLUSH_INTERVAL_MS;
+    
+    console.deferred = 1;
+    
+    while (1) {
+        uint64_t records = console.stats.records;
+        console_flush();
+        
+        if (console.stats.records != records) {
+            interval = CONSOLE_FLUSH_INTERVAL_MS;
+        } else if (interval < CONSOLE_FLUSH_INTERVAL_MAX_MS) {
+            interval *= 2;
+        }
+        
+        process_sleep(interval);
+    }
+}
@@ -0,0 +1,345 @@
+/**
+ * cpu.c - CPU feature detection implementation for NeuroOS
+ *
+ * This file implements CPUID-based feature detection and enables the FPU,
+ * SSE and (when available) AVX state so that the vector kernels in the
+ * DL framework can run in kernel mode. It also provides the FPU/SIMD state
+ * save and restore used on context switches.
+ */
+
+#include "include/cpu.h"
+#include <string.h>
+
+// Control register bits
+#define CR0_MP          (1 << 1)
+#define CR0_EM          (1 << 2)
+#define CR0_TS          (1 << 3)
+#define CR0_NE          (1 << 5)
+#define CR4_PAE         (1 << 5)
+#define CR4_OSFXSR      (1 << 9)
+#define CR4_OSXMMEXCPT  (1 << 10)
+#define CR4_OSXSAVE     (1 << 18)
+
+// XCR0 state components (x87, SSE, AVX)
+#define XCR0_X87        (1 << 0)
+#define XCR0_SSE        (1 << 1)
+#define XCR0_AVX        (1 << 2)
+
+// Default MXCSR: all SIMD exceptions masked, round to nearest
+#define MXCSR_DEFAULT   0x1F80
+
+// Page attribute table: the power-on layout (WB, WT, UC-, UC) with entries
+// 1 and 5 (PWT set, PCD clear) switched from write-through to write-combining
+#define MSR_IA32_PAT    0x277
+#define PAT_VALUE       0x0007010600070106ULL
+
+// Extended feature enable register: no-execute enable
+#define MSR_IA32_EFER   0xC0000080
+#define EFER_NXE        (1 << 11)
+
+// CPU state
+static struct {
+    int initialized;
+    uint32_t features;
+    int use_xsave;
+    int use_nx;
+    char vendor[13];
+} cpu;
+
+/**
+ * Execute the CPUID instruction
+ *
+ * @param leaf: CPUID leaf
+ * @param subleaf: CPUID subleaf
+ * @param eax: Pointer to store EAX
+ * @param ebx: Pointer to store EBX
+ * @param ecx: Pointer to store ECX
+ * @param edx: Pointer to store EDX
+ */
+static void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid"
+                     : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                     : "a" (leaf), "c" (subleaf));
+}
+
+/**
+ * Detect CPU features
+ */
+static void cpu_detect_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    // Vendor string and highest standard leaf
+    cpu_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    memcpy(cpu.vendor, &ebx, 4);
+    memcpy(cpu.vendor + 4, &edx, 4);
+    memcpy(cpu.vendor + 8, &ecx, 4);
+    cpu.vendor[12] = '\0';
+
+    cpu.features = 0;
+
+    if (max_leaf < 1) {
+        return;
+    }
+
+    // Standard feature flags
+    cpu_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    if (edx & (1 << 0))  cpu.features |= CPU_FEATURE_FPU;
+    if (edx & (1 << 3))  cpu.features |= CPU_FEATURE_PSE;
+    if (edx & (1 << 4))  cpu.features |= CPU_FEATURE_TSC;
+    if (edx & (1 << 6))  cpu.features |= CPU_FEATURE_PAE;
+    if (edx & (1 << 9))  cpu.features |= CPU_FEATURE_APIC;
+    if (edx & (1 << 16)) cpu.features |= CPU_FEATURE_PAT;
+    if (edx & (1 << 24)) cpu.features |= CPU_FEATURE_FXSR;
+    if (edx & (1 << 25)) cpu.features |= CPU_FEATURE_SSE;
+    if (edx & (1 << 26)) cpu.features |= CPU_FEATURE_SSE2;
+    if (ecx & (1 << 0))  cpu.features |= CPU_FEATURE_SSE3;
+    if (ecx & (1 << 9))  cpu.features |= CPU_FEATURE_SSSE3;
+    if (ecx & (1 << 12)) cpu.features |= CPU_FEATURE_FMA;
+    if (ecx & (1 << 19)) cpu.features |= CPU_FEATURE_SSE41;
+    if (ecx & (1 << 20)) cpu.features |= CPU_FEATURE_SSE42;
+    if (ecx & (1 << 26)) cpu.features |= CPU_FEATURE_XSAVE;
+    if (ecx & (1 << 28)) cpu.features |= CPU_FEATURE_AVX;
+
+    // Extended feature flags
+    if (max_leaf >= 7) {
+        cpu_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1 << 5)) cpu.features |= CPU_FEATURE_AVX2;
+    }
+
+    // Extended processor feature flags
+    cpu_cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001) {
+        cpu_cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        if (edx & (1 << 20)) cpu.features |= CPU_FEATURE_NX;
+    }
+}
+
+/**
+ * Enable the FPU and SIMD state
+ */
+static void cpu_enable_simd(void) {
+    unsigned long cr0, cr4;
+
+    // Enable the FPU: clear emulation and task-switched, monitor coprocessor, native exceptions
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~(unsigned long)(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    __asm__ volatile("mov %0, %%cr0" : : "r" (cr0));
+    __asm__ volatile("fninit");
+
+    if (!(cpu.features & CPU_FEATURE_FXSR) || !(cpu.features & CPU_FEATURE_SSE)) {
+        // Without FXSR/SSE, none of the vector features are usable
+        cpu.features &= ~(uint32_t)(CPU_FEATURE_SSE | CPU_FEATURE_SSE2 | CPU_FEATURE_SSE3 | CPU_FEATURE_SSSE3 |
+                                    CPU_FEATURE_SSE41 | CPU_FEATURE_SSE42 | CPU_FEATURE_AVX | CPU_FEATURE_FMA |
+                                    CPU_FEATURE_AVX2);
+        return;
+    }
+
+    // Enable FXSAVE/FXRSTOR and SIMD floating-point exception reporting
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+    // Enable XSAVE so the AVX register state can be switched
+    if ((cpu.features & CPU_FEATURE_XSAVE) && (cpu.features & CPU_FEATURE_AVX)) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
+
+    // Set the default SIMD control state
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ volatile("ldmxcsr %0" : : "m" (mxcsr));
+
+    if (cr4 & CR4_OSXSAVE) {
+        // Turn on x87, SSE and AVX state in XCR0
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        xcr0_lo |= XCR0_X87 | XCR0_SSE | XCR0_AVX;
+        __asm__ volatile("xsetbv" : : "a" (xcr0_lo), "d" (xcr0_hi), "c" (0));
+
+        // Make sure the XSAVE area fits in the per-process state buffer
+        uint32_t eax, ebx, ecx, edx;
+        cpu_cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx <= CPU_FPU_STATE_SIZE) {
+            cpu.features |= CPU_FEATURE_OSXSAVE;
+            cpu.use_xsave = 1;
+        }
+    }
+
+    // AVX state cannot be preserved across context switches without XSAVE
+    if (!cpu.use_xsave) {
+        cpu.features &= ~(uint32_t)(CPU_FEATURE_AVX | CPU_FEATURE_FMA | CPU_FEATURE_AVX2);
+    }
+}
+
+/**
+ * Load the page attribute table
+ *
+ * Every CPU must use the same table, so the APs load it too.
+ */
+static void cpu_load_pat(void) {
+    if (!(cpu.features & CPU_FEATURE_PAT)) {
+        return;
+    }
+
+    __asm__ volatile("wrmsr" : : "c" (MSR_IA32_PAT), "a" ((uint32_t)PAT_VALUE),
+                     "d" ((uint32_t)(PAT_VALUE >> 32)));
+}
+
+/**
+ * Enable no-execute page protection
+ *
+ * Every CPU must agree, or the NX bit of shared page tables would be a
+ * reserved bit on some of them, so the APs enable it too.
+ */
+static void cpu_enable_nx(void) {
+    uint32_t lo, hi;
+
+    if (!cpu.use_nx) {
+        return;
+    }
+
+    __asm__ volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (MSR_IA32_EFER));
+    __asm__ volatile("wrmsr" : : "c" (MSR_IA32_EFER), "a" (lo | EFER_NXE), "d" (hi));
+}
+
+/**
+ * Initialize the CPU: detect features and enable FPU/SIMD state
+ */
+void cpu_init(void) {
+    if (cpu.initialized) {
+        return;
+    }
+
+    cpu_detect_features();
+    cpu_enable_simd();
+    cpu_load_pat();
+
+    cpu.initialized = 1;
+}
+
+/**
+ * Set up the FPU/SIMD registers of an application processor
+ *
+ * The APs start with the control registers of the BSP (see smp.c); this
+ * loads the per-CPU state that cpu_init leaves on the BSP.
+ */
+void cpu_init_ap(void) {
+    __asm__ volatile("fninit");
+
+    cpu_load_pat();
+    cpu_enable_nx();
+
+    if (cpu.use_xsave) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        xcr0_lo |= XCR0_X87 | XCR0_SSE | XCR0_AVX;
+        __asm__ volatile("xsetbv" : : "a" (xcr0_lo), "d" (xcr0_hi), "c" (0));
+    }
+
+    if (cpu.features & CPU_FEATURE_SSE) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        __asm__ volatile("ldmxcsr %0" : : "m" (mxcsr));
+    }
+}
+
+/**
+ * Get the usable CPU features
+ *
+ * @return: Feature flags (CPU_FEATURE_*)
+ */
+uint32_t cpu_get_features(void) {
+    return cpu.features;
+}
+
+/**
+ * Check whether a CPU feature is usable
+ *
+ * @param feature: Feature flags (CPU_FEATURE_*)
+ * @return: 1 if all requested features are usable, 0 otherwise
+ */
+int cpu_has_feature(uint32_t feature) {
+    return (cpu.features & feature) == feature;
+}
+
+/**
+ * Get the CPU vendor string
+ *
+ * @return: Vendor string
+ */
+const char* cpu_get_vendor(void) {
+    return cpu.vendor;
+}
+
+/**
+ * Initialize an FPU/SIMD state buffer to the default state
+ *
+ * @param state: State buffer (CPU_FPU_STATE_SIZE bytes, 64-byte aligned)
+ */
+void cpu_fpu_init_state(void* state) {
+    memset(state, 0, CPU_FPU_STATE_SIZE);
+
+    if (!(cpu.features & CPU_FEATURE_FXSR)) {
+        return;
+    }
+
+    // Legacy area: default x87 control word and MXCSR
+    *(uint16_t*)((uint8_t*)state + 0) = 0x037F;
+    *(uint32_t*)((uint8_t*)state + 24) = MXCSR_DEFAULT;
+}
+
+/**
+ * Save the current FPU/SIMD state
+ *
+ * @param state: State buffer (CPU_FPU_STATE_SIZE bytes, 64-byte aligned)
+ */
+void cpu_fpu_save(void* state) {
+    if (cpu.use_xsave) {
+        __asm__ volatile("xsave (%0)" : : "r" (state), "a" (XCR0_X87 | XCR0_SSE | XCR0_AVX), "d" (0) : "memory");
+    } else if (cpu.features & CPU_FEATURE_FXSR) {
+        __asm__ volatile("fxsave (%0)" : : "r" (state) : "memory");
+    }
+}
+
+/**
+ * Restore a saved FPU/SIMD state
+ *
+ * @param state: State buffer (CPU_FPU_STATE_SIZE bytes, 64-byte aligned)
+ */
+void cpu_fpu_restore(const void* state) {
+    if (cpu.use_xsave) {
+        __asm__ volatile("xrstor (%0)" : : "r" (state), "a" (XCR0_X87 | XCR0_SSE | XCR0_AVX), "d" (0) : "memory");
+    } else if (cpu.features & CPU_FEATURE_FXSR) {
+        __asm__ volatile("fxrstor (%0)" : : "r" (state) : "memory");
+    }
+}
+
+/**
+ * Enable the PAE paging format, and with it 2 MB pages
+ *
+ * The page tables hold 64-bit entries, which the MMU reads only in PAE
+ * mode: a 4-entry PDPT, then 512-entry directories whose entries can map
+ * 2 MB pages. CR4.PAE must be set before CR3 is loaded with the PDPT.
+ * No-execute is enabled as well when the CPU has it, since the NX bit of
+ * an entry is reserved otherwise.
+ *
+ * @return: 1 if PAE is enabled, 0 otherwise (no large pages)
+ */
+int cpu_enable_large_pages(void) {
+    unsigned long cr4;
+
+    if (!(cpu.features & CPU_FEATURE_PAE)) {
+        cpu.features &= ~(uint32_t)CPU_FEATURE_NX;
+        return 0;
+    }
+
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_PAE;
+    __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
+
+    cpu.use_nx = (cpu.features & CPU_FEATURE_NX) != 0;
+    cpu_enable_nx();
+
+    return 1;
+}
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "sandbox.h"
+#include "prefix_cache.h"
 
 // AI model types
 typedef enum {
@@ -32,6 +33,9 @@ typedef enum {
     AI_TASK_CUSTOM
 } ai_task_type_t;
 
+// Number of AI task types
+#define AI_TASK_NUM_TYPES (AI_TASK_CUSTOM + 1)
+
 // AI task priorities
 typedef enum {
     AI_TASK_PRIORITY_LOW,
@@ -40,6 +44,9 @@ typedef enum {
     AI_TASK_PRIORITY_CRITICAL
 } ai_task_priority_t;
 
+// Number of AI task priorities
+#define AI_TASK_NUM_PRIORITIES (AI_TASK_PRIORITY_CRITICAL + 1)
+
 // AI task states
 typedef enum {
     AI_TASK_STATE_CREATED,
@@ -79,6 +86,7 @@ typedef struct {
     int top_k;
     float top_p;
     float repetition_penalty;
+    size_t prefix_cache_budget;     // Prompt prefix cache budget in bytes (0 keeps the default)
 } ai_model_config_t;
 
 // AI task ID type
@@ -98,6 +106,7 @@ typedef struct {
     void* output_data;
     size_t output_size;
     uint64_t creation_time;
+    uint64_t queue_time;
     uint64_t start_time;
     uint64_t completion_time;
     sandbox_id_t sandbox_id;
@@ -119,6 +128,25 @@ typedef struct {
     int warning_count;
 } ai_health_metrics_t;
 
+// AI task queue statistics per task type (times in milliseconds)
+typedef struct {
+    uint64_t tasks_run;
+    uint64_t tasks_failed;
+    uint64_t total_wait_time;
+    uint64_t max_wait_time;
+    uint64_t total_run_time;
+    uint64_t max_run_time;
+} ai_task_type_stats_t;
+
+// AI task queue statistics
+typedef struct {
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+    uint32_t num_workers;
+    uint32_t busy_workers;
+    ai_task_type_stats_t types[AI_TASK_NUM_TYPES];
+} ai_task_queue_stats_t;
+
 // AI text generation parameters
 typedef struct {
     int max_tokens;
@@ -170,7 +198,8 @@ ai_task_id_t ai_create_task(ai_task_type_t type, const char* name, const char* d
 /**
  * Start an AI task
  * 
- * This function starts the specified AI task.
+ * This function queues the specified AI task for the worker processes and
+ * returns without waiting for it; use ai_wait_for_task to collect it.
  * 
  * @param task_id: Task ID
  * @return: 0 on success, -1 on failure
@@ -223,6 +252,17 @@ int ai_get_task_result(ai_task_id_t task_id, void* output_data, size_t output_si
  */
 int ai_wait_for_task(ai_task_id_t task_id, uint64_t timeout_ms);
 
+/**
+ * Get AI task queue statistics
+ * 
+ * This function reports the queue depth, the worker pool and the wait and
+ * run times of each task type.
+ * 
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int ai_get_task_queue_stats(ai_task_queue_stats_t* stats);
+
 /**
  * Generate code using the AI model
  * 
@@ -437,4 +477,15 @@ int ai_load_state(const char* filename);
 int ai_generate_text(const char* prompt, char* output, size_t output_size, 
                     size_t* actual_output_size, const ai_generation_params_t* params);
 
+/**
+ * Get prompt prefix cache statistics
+ * 
+ * This function reports how often generations reused the key/value rows of
+ * a cached prompt prefix and how many prefill tokens that saved.
+ * 
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int ai_get_prefix_cache_stats(prefix_cache_stats_t* stats);
+
 #endif /* NEUROOS_AI_INTERFACE_H */
@@ -2,6 +2,12 @@
  * backup.h - Backup system for NeuroOS
  * 
  * This file contains the backup system definitions and declarations.
+ * Backups are stored as content-addressed chunks: a snapshot is cut into
+ * variable-size chunks at content-defined boundaries, each chunk is stored
+ * once under its hash, and a backup file is a manifest listing the chunks
+ * of its snapshot in order. Chunks are compressed with LZ4 by a pipeline of
+ * worker processes while the chunk files are written, and export files
+ * carry the stored chunks one block at a time.
  */
 
 #ifndef NEUROOS_BACKUP_H
@@ -20,7 +26,17 @@ typedef uint32_t backup_flags_t;
 
 // Backup magic and version
 #define BACKUP_MAGIC 0x4E424B50 // "NBKP"
-#define BACKUP_VERSION 1
+#define BACKUP_VERSION 2
+
+// Backup manifest magic and version
+#define BACKUP_MANIFEST_MAGIC 0x4E424B4D // "NBKM"
+#define BACKUP_MANIFEST_VERSION 1
+
+// Content-defined chunk sizes (a boundary falls on average every
+// 2^BACKUP_CHUNK_AVERAGE_BITS bytes past the minimum)
+#define BACKUP_CHUNK_MIN_SIZE (2 * 1024)
+#define BACKUP_CHUNK_MAX_SIZE (64 * 1024)
+#define BACKUP_CHUNK_AVERAGE_BITS 13
 
 // Maximum description length
 #define BACKUP_DESCRIPTION_MAX 256
@@ -131,6 +147,29 @@ typedef struct {
     char description[BACKUP_DESCRIPTION_MAX];
 } backup_header_t;
 
+// Backup manifest header (followed by num_chunks chunk references)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size;             // Size of the reassembled snapshot
+    uint32_t num_chunks;
+    uint32_t parent_id;
+} backup_manifest_header_t;
+
+// Chunk reference in a backup manifest
+typedef struct {
+    uint64_t hash[2];               // Content address of the chunk
+    uint32_t size;                  // Uncompressed chunk size
+    uint32_t reserved;
+} backup_chunk_ref_t;
+
+// Block of an export file (followed by stored_size bytes, LZ4 compressed
+// unless stored_size equals size)
+typedef struct {
+    uint32_t size;                  // Uncompressed size
+    uint32_t stored_size;
+} backup_block_header_t;
+
 // Backup information structure
 typedef struct {
     backup_id_t id;
@@ -138,8 +177,11 @@ typedef struct {
     uint32_t state;
     backup_flags_t flags;
     uint64_t creation_time;
-    uint64_t size;
+    uint64_t size;                  // Bytes this backup added to the store
     backup_id_t parent_id;
+    uint64_t data_size;             // Size of the snapshot
+    uint32_t num_chunks;            // Chunks in the manifest
+    uint32_t new_chunks;            // Chunks no earlier backup had stored
     char description[BACKUP_DESCRIPTION_MAX];
     char filename[256];
 } backup_info_t;
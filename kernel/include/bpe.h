@@ -0,0 +1,100 @@
+/**
+ * bpe.h - Byte-level BPE encoder for NeuroOS
+ *
+ * This file contains the byte-level byte pair encoding definitions and
+ * declarations shared by the tokenizers.
+ */
+
+#ifndef NEUROOS_BPE_H
+#define NEUROOS_BPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vocab.h"
+
+// Longest pre-token merged as a unit; longer ones are split into chunks
+#define BPE_MAX_WORD 256
+
+// Word cache geometry
+#define BPE_CACHE_ENTRIES   4096
+#define BPE_CACHE_BUCKETS   8192
+#define BPE_CACHE_WORD_LEN  48
+#define BPE_CACHE_MAX_IDS   12
+
+// Merge rule: (left, right) -> merged, applied lowest rank first
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint32_t rank;
+    uint32_t merged;
+} bpe_merge_t;
+
+// Cached encoding of one pre-token
+typedef struct {
+    char word[BPE_CACHE_WORD_LEN];
+    uint32_t ids[BPE_CACHE_MAX_IDS];
+    uint32_t hash;
+    uint16_t word_len;
+    uint16_t num_ids;
+    int32_t hash_next;
+    int32_t lru_prev;
+    int32_t lru_next;
+} bpe_cache_entry_t;
+
+// Heap entry: a candidate merge of the symbol at pos with its successor
+typedef struct {
+    uint32_t rank;
+    uint32_t pos;
+    uint32_t left;
+    uint32_t right;
+} bpe_candidate_t;
+
+// Per-word scratch space
+typedef struct {
+    uint32_t ids[BPE_MAX_WORD];
+    int32_t prev[BPE_MAX_WORD];
+    int32_t next[BPE_MAX_WORD];
+    bpe_candidate_t heap[BPE_MAX_WORD * 3];
+} bpe_scratch_t;
+
+// Encoder statistics
+typedef struct {
+    uint32_t num_merges;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t words_encoded;
+} bpe_stats_t;
+
+// BPE encoder
+//
+// The vocabulary is borrowed and must outlive the encoder.
+typedef struct {
+    const vocab_t* vocab;
+    uint32_t byte_ids[256];             // Token of each single byte
+    bpe_merge_t* merges;                // Open-addressing pair table
+    uint32_t merges_capacity;
+    uint32_t num_merges;
+    bpe_cache_entry_t* cache;           // Word cache entries
+    int32_t* cache_buckets;             // Hash chains [BPE_CACHE_BUCKETS]
+    int32_t cache_head;                 // Most recently used
+    int32_t cache_tail;                 // Least recently used
+    uint32_t cache_used;
+    volatile int lock;                  // Word cache and statistics
+    volatile int scratch_lock;          // Shared scratch space
+    bpe_stats_t stats;
+    size_t alloc_size;
+} bpe_t;
+
+// Encoder lifecycle
+int bpe_init(bpe_t* bpe, const vocab_t* vocab, const char* json, size_t len);
+void bpe_free(bpe_t* bpe);
+
+// Encoding and decoding
+int bpe_encode(bpe_t* bpe, const char* text, size_t len, uint32_t* ids, size_t max_ids, size_t* num_ids);
+int bpe_encode_scratch(bpe_t* bpe, bpe_scratch_t* scratch, const char* text, size_t len, uint32_t* ids, size_t max_ids, size_t* num_ids);
+size_t bpe_decode(const bpe_t* bpe, const uint32_t* ids, size_t num_ids, char* text, size_t text_size);
+
+// Encoder information
+void bpe_get_stats(const bpe_t* bpe, bpe_stats_t* stats);
+
+#endif // NEUROOS_BPE_H
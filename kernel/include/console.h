@@ -39,6 +39,17 @@ typedef enum {
     CONSOLE_COLOR_YELLOW = CONSOLE_COLOR_LIGHT_BROWN
 } console_color_t;
 
+// Bytes of flushed text kept for console_log_read
+#define CONSOLE_LOG_HISTORY_SIZE 16384
+
+// Console log statistics
+typedef struct {
+    uint64_t records;       // Writes flushed to the screen
+    uint64_t bytes;
+    uint64_t flushes;       // Flushes that found text to show
+    uint64_t dropped;       // Writes lost to full log rings
+} console_log_stats_t;
+
 /**
  * Initialize the console subsystem
  * 
@@ -106,4 +117,40 @@ void console_get_cursor(int* x, int* y);
  */
 void console_set_cursor_enabled(int enabled);
 
+/**
+ * Write the logged text to the screen
+ * 
+ * Writes are only logged once the flusher process runs; this function
+ * shows them right away.
+ */
+void console_flush(void);
+
+/**
+ * Start the console flusher process
+ * 
+ * @return: 0 on success, -1 on failure
+ */
+int console_start_flusher(void);
+
+/**
+ * Read the console log
+ * 
+ * @param buffer: Buffer to store the text (NUL-terminated)
+ * @param size: Buffer size
+ * @return: Number of characters stored
+ */
+size_t console_log_read(char* buffer, size_t size);
+
+/**
+ * Clear the console log
+ */
+void console_log_clear(void);
+
+/**
+ * Get console log statistics
+ * 
+ * @param stats: Pointer to store the statistics
+ */
+void console_log_get_stats(console_log_stats_t* stats);
+
 #endif /* NEUROOS_CONSOLE_H */
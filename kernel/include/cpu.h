@@ -0,0 +1,55 @@
+/**
+ * cpu.h - CPU feature detection for NeuroOS
+ *
+ * This file contains the CPU feature detection and FPU/SIMD state
+ * definitions and declarations.
+ */
+
+#ifndef NEUROOS_CPU_H
+#define NEUROOS_CPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CPU feature flags
+#define CPU_FEATURE_FPU      (1 << 0)
+#define CPU_FEATURE_FXSR     (1 << 1)
+#define CPU_FEATURE_SSE      (1 << 2)
+#define CPU_FEATURE_SSE2     (1 << 3)
+#define CPU_FEATURE_SSE3     (1 << 4)
+#define CPU_FEATURE_SSSE3    (1 << 5)
+#define CPU_FEATURE_SSE41    (1 << 6)
+#define CPU_FEATURE_SSE42    (1 << 7)
+#define CPU_FEATURE_XSAVE    (1 << 8)
+#define CPU_FEATURE_OSXSAVE  (1 << 9)
+#define CPU_FEATURE_AVX      (1 << 10)
+#define CPU_FEATURE_FMA      (1 << 11)
+#define CPU_FEATURE_AVX2     (1 << 12)
+#define CPU_FEATURE_PSE      (1 << 13)
+#define CPU_FEATURE_PAE      (1 << 14)
+#define CPU_FEATURE_APIC     (1 << 15)
+#define CPU_FEATURE_TSC      (1 << 16)
+#define CPU_FEATURE_PAT      (1 << 17)  // Page attribute table (PAT entry 1 is write-combining)
+#define CPU_FEATURE_NX       (1 << 18)  // No-execute pages (usable only with PAE)
+
+// Size of the per-process FPU/SIMD state area (FXSAVE, or XSAVE with AVX)
+#define CPU_FPU_STATE_SIZE 1024
+
+// CPU initialization
+void cpu_init(void);
+void cpu_init_ap(void);
+
+// CPU features
+uint32_t cpu_get_features(void);
+int cpu_has_feature(uint32_t feature);
+const char* cpu_get_vendor(void);
+
+// FPU/SIMD state
+void cpu_fpu_init_state(void* state);
+void cpu_fpu_save(void* state);
+void cpu_fpu_restore(const void* state);
+
+// Paging features
+int cpu_enable_large_pages(void);
+
+#endif // NEUROOS_CPU_H
@@ -0,0 +1,45 @@
+/**
+ * inference_bench.h - Inference benchmark for NeuroOS
+ *
+ * This file contains the declarations of the benchmark suite that times the
+ * inference kernels in isolation (GEMM, quantized GEMV, softmax, sampling,
+ * BPE tokenization, memcpy) and a generation end to end (time to first
+ * token, decode rate, peak memory). It is built when NEUROOS_INFERENCE_BENCH
+ * is defined and runs once at the end of kernel initialization.
+ *
+ * Each result is one JSON object per line, printed on the console behind
+ * the INFERENCE_BENCH_PREFIX marker and written to INFERENCE_BENCH_OUTPUT.
+ * Values are integers in the unit named by their key (mflops, mb_per_s,
+ * ns_per_call, ...).
+ */
+
+#ifndef NEUROOS_INFERENCE_BENCH_H
+#define NEUROOS_INFERENCE_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Marker in front of each result line on the console
+#define INFERENCE_BENCH_PREFIX "BENCH "
+
+// File the result lines are written to (skipped if it cannot be created)
+#ifndef INFERENCE_BENCH_OUTPUT
+#define INFERENCE_BENCH_OUTPUT "/ai/logs/inference_bench.jsonl"
+#endif
+
+// Model generated from for the end-to-end results
+#ifndef INFERENCE_BENCH_MODEL_PATH
+#define INFERENCE_BENCH_MODEL_PATH "/ai/models/deepseek/model.safetensors"
+#endif
+
+// Minimum time spent on each kernel result
+#define INFERENCE_BENCH_MIN_NS 200000000ULL
+
+// Generation parameters of the end-to-end results
+#define INFERENCE_BENCH_PROMPT "Explain what an operating system kernel does."
+#define INFERENCE_BENCH_MAX_TOKENS 64
+
+// Run the benchmark and print the results on the console
+void inference_bench_run(void);
+
+#endif // NEUROOS_INFERENCE_BENCH_H
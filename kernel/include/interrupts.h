@@ -85,6 +85,13 @@ typedef struct {
  */
 void interrupts_init(void);
 
+/**
+ * Load the interrupt descriptor table on an application processor
+ * 
+ * The IDT is shared by all CPUs; interrupts_init must have run on the BSP.
+ */
+void interrupts_init_ap(void);
+
 /**
  * Enable interrupts
  * 
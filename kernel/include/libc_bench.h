@@ -0,0 +1,25 @@
+/**
+ * libc_bench.h - Kernel libc microbenchmark for NeuroOS
+ *
+ * This file contains the declarations of the microbenchmark that compares
+ * the kernel memory and math functions against the plain byte loop and
+ * series versions they replaced. It is built when NEUROOS_LIBC_BENCH is
+ * defined and runs once at the end of kernel initialization.
+ */
+
+#ifndef NEUROOS_LIBC_BENCH_H
+#define NEUROOS_LIBC_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes processed per block size (the iteration count is derived from it)
+#define LIBC_BENCH_BYTES (16 * 1024 * 1024)
+
+// Calls per math function
+#define LIBC_BENCH_MATH_CALLS 100000
+
+// Run the benchmark and print the results on the console
+void libc_bench_run(void);
+
+#endif // NEUROOS_LIBC_BENCH_H
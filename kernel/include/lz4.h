@@ -0,0 +1,30 @@
+/**
+ * lz4.h - LZ4 block compression for NeuroOS
+ *
+ * This file contains the LZ4 block codec declarations. The output is the
+ * standard LZ4 block format (without the frame layer): a sequence of literal
+ * runs and matches against the previous 64 KB of input.
+ */
+
+#ifndef NEUROOS_LZ4_H
+#define NEUROOS_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash table size of the compressor in bits
+#define LZ4_HASH_BITS 12
+
+// Largest compressed size of an input of the given size
+#define LZ4_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Compressor state (match finder table), reused across calls
+typedef struct {
+    uint32_t table[1 << LZ4_HASH_BITS];
+} lz4_state_t;
+
+// Block operations
+size_t lz4_compress(lz4_state_t* state, const void* source, size_t size, void* dest, size_t capacity);
+int lz4_decompress(const void* source, size_t size, void* dest, size_t capacity, size_t* dest_size);
+
+#endif // NEUROOS_LZ4_H
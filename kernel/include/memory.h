@@ -20,6 +20,7 @@ typedef uint32_t memory_prot_t;
 #define MEMORY_PROT_WRITE   (1 << 1)
 #define MEMORY_PROT_EXEC    (1 << 2)
 #define MEMORY_PROT_USER    (1 << 3)
+#define MEMORY_PROT_WRITE_COMBINE (1 << 4)  // Write-combining (uncached without PAT), for framebuffers
 
 // Memory allocation flags
 typedef uint32_t memory_alloc_flags_t;
@@ -50,6 +51,12 @@ typedef uint32_t memory_alloc_flags_t;
 #define MEMORY_FLAG_NVS       (1 << 18)
 #define MEMORY_FLAG_RESERVED  (1 << 19)
 #define MEMORY_FLAG_BADRAM    (1 << 20)
+#define MEMORY_FLAG_HUGE      (1 << 21)  // Back with large pages (also accepted by memory_alloc)
+
+// Page fault error code bits
+#define MEMORY_FAULT_PRESENT  (1 << 0)
+#define MEMORY_FAULT_WRITE    (1 << 1)
+#define MEMORY_FAULT_USER     (1 << 2)
 
 // Memory region structure
 typedef struct {
@@ -71,8 +78,27 @@ typedef struct {
     uint64_t swap_used;
     uint64_t swap_free;
     uint64_t available;
+    uint64_t huge_mapped;
 } memory_stats_t;
 
+// File mapping statistics
+typedef struct {
+    uint64_t size;
+    uint64_t resident;
+    uint64_t faults;
+} memory_map_stats_t;
+
+// Slab cache for fixed-size objects (opaque)
+typedef struct memory_cache memory_cache_t;
+
+// File mapping reader: read size bytes at offset of the backing file into buffer,
+// returning the number of bytes read
+typedef size_t (*memory_map_reader_t)(void* ctx, uint64_t offset, void* buffer, size_t size);
+
+// Write watch handler: called on the first write to a page of a watched
+// range, before the write happens, returning 0 to let the write go ahead
+typedef int (*memory_write_handler_t)(void* ctx, uintptr_t page);
+
 // Memory initialization and shutdown
 void memory_init(void);
 void memory_shutdown(void);
@@ -85,6 +111,13 @@ void* memory_realloc(void* ptr, size_t size);
 void memory_free(void* ptr, size_t size);
 uintptr_t memory_alloc_physical(size_t num_pages, memory_alloc_flags_t flags);
 void memory_free_physical(uintptr_t physical_addr, size_t num_pages);
+size_t memory_reclaim_physical(size_t max_pages);
+
+// Slab caches
+memory_cache_t* memory_cache_create(const char* name, size_t object_size, size_t align);
+void memory_cache_destroy(memory_cache_t* cache);
+void* memory_cache_alloc(memory_cache_t* cache, memory_alloc_flags_t flags);
+void memory_cache_free(memory_cache_t* cache, void* obj);
 
 // Memory mapping and unmapping
 int memory_map(uintptr_t physical_addr, void* virtual_addr, size_t size, memory_prot_t protection);
@@ -94,6 +127,21 @@ int memory_lock(void* virtual, size_t size);
 int memory_unlock(void* virtual, size_t size);
 int memory_sync(void* virtual, size_t size, int flags);
 
+// File mappings
+void* memory_map_file(memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, memory_prot_t protection);
+int memory_unmap_file(void* addr);
+int memory_map_populate(void* addr, size_t size);
+int memory_map_get_stats(void* addr, memory_map_stats_t* stats);
+
+// Write watches
+int memory_watch_writes(void* addr, size_t size, memory_prot_t protection,
+                        memory_write_handler_t handler, void* ctx);
+int memory_unwatch_writes(void* addr);
+
+// Page fault handling
+int memory_handle_page_fault(uintptr_t addr, uint32_t error_code);
+int memory_paging_enabled(void);
+
 // Memory address translation
 uint64_t memory_virtual_to_physical(void* virtual);
 void* memory_physical_to_virtual(uint64_t physical);
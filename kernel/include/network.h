@@ -9,6 +9,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "memory.h"
 
 // Network interface types
 #define NETWORK_INTERFACE_TYPE_UNKNOWN 0
@@ -81,6 +82,25 @@
 #define NETWORK_SOCKET_FLAG_SENDBUF 0x40000000
 #define NETWORK_SOCKET_FLAG_PRIORITY 0x80000000
 
+// Capacity of the transmit and receive ring of a socket (a power of two)
+#define NETWORK_SOCKET_BUFFER_SIZE 8192
+
+// Packet buffer pool
+#define NETWORK_BUFFER_COUNT 256            // Buffers preallocated by network_init
+#define NETWORK_BUFFER_SIZE 2048            // Data area of a buffer
+#define NETWORK_BUFFER_HEADROOM 128         // Reserved in front of the payload for protocol headers
+#define NETWORK_BUFFER_PAYLOAD (NETWORK_BUFFER_SIZE - NETWORK_BUFFER_HEADROOM)
+
+// Readiness events
+#define NETWORK_EVENT_READABLE 0x00000001   // Data to receive, or a pending connection
+#define NETWORK_EVENT_WRITABLE 0x00000002   // Room in the transmit ring
+#define NETWORK_EVENT_HANGUP   0x00000004   // Socket closed (always reported)
+#define NETWORK_EVENT_EDGE     0x80000000   // Report only readiness changes, not readiness
+
+// Poll sets
+#define NETWORK_POLL_MAX_SETS 32
+#define NETWORK_POLL_WAIT_FOREVER -1
+
 // Network socket options
 #define NETWORK_SOCKET_OPT_TYPE 1
 #define NETWORK_SOCKET_OPT_PROTOCOL 2
@@ -263,6 +283,39 @@ typedef struct {
     uint16_t remote_port;
 } network_socket_info_t;
 
+// Packet buffer
+//
+// The packet occupies [data, data + len) of the data area, with headroom in
+// front so protocol headers are pushed without moving the payload. A payload
+// in memory that outlives the packet (a mapped model or backup file) is
+// referenced as a fragment following the packet data instead of copied in.
+// Buffers are reference counted; the last network_buffer_put returns one to
+// the pool.
+typedef struct network_buffer {
+    struct network_buffer* next;        // Free list link
+    uint8_t* head;                      // Start of the data area
+    uint8_t* data;                      // Start of the packet
+    uint32_t len;                       // Packet bytes at data
+    uint32_t capacity;                  // Size of the data area
+    volatile int32_t refcount;
+    const uint8_t* fragment;            // Payload after the packet data, NULL if none
+    uint32_t fragment_len;
+    uint32_t socket_id;                 // Socket that queued the packet
+} network_buffer_t;
+
+// Scatter-gather element
+typedef struct {
+    void* base;
+    size_t len;
+} network_iovec_t;
+
+// Readiness event reported by network_poll_wait
+typedef struct {
+    uint32_t socket_id;
+    uint32_t events;                    // NETWORK_EVENT_* that are ready
+    void* data;                         // Registration data
+} network_poll_event_t;
+
 // Network socket structure
 typedef struct {
     uint32_t id;
@@ -288,6 +341,14 @@ int network_unregister_interface(uint32_t id);
 int network_configure_interface(uint32_t id, const network_address_t* ip_address, const network_address_t* subnet_mask, const network_address_t* gateway);
 int network_get_interface_info(uint32_t id, network_interface_info_t* info);
 
+// Packet buffer operations
+network_buffer_t* network_buffer_alloc(void);
+void network_buffer_get(network_buffer_t* buffer);
+void network_buffer_put(network_buffer_t* buffer);
+uint8_t* network_buffer_push(network_buffer_t* buffer, size_t size);
+uint8_t* network_buffer_pull(network_buffer_t* buffer, size_t size);
+uint8_t* network_buffer_append(network_buffer_t* buffer, size_t size);
+
 // Network socket operations
 int network_socket_create(uint32_t type, uint32_t protocol, uint32_t* id);
 int network_socket_close(uint32_t id);
@@ -297,11 +358,24 @@ int network_socket_listen(uint32_t id, int backlog);
 int network_socket_accept(uint32_t id, uint32_t* client_id, network_address_t* client_address, uint16_t* client_port);
 int network_socket_send(uint32_t id, const void* data, size_t size, size_t* sent);
 int network_socket_recv(network_socket_t* socket, void* data, size_t size, size_t* received);
+int network_socket_deliver(uint32_t id, const void* data, size_t size, size_t* accepted);
+int network_socket_sendv(uint32_t id, const network_iovec_t* iov, int iov_count, size_t* sent);
+int network_socket_recvv(network_socket_t* socket, const network_iovec_t* iov, int iov_count, size_t* received);
+int network_socket_sendfile(uint32_t id, memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, size_t* sent);
 int network_socket_sendto(uint32_t id, const void* data, size_t size, const network_address_t* address, uint16_t port, size_t* sent);
 int network_socket_recvfrom(network_socket_t* socket, void* data, size_t size, network_address_t* address, uint16_t* port, size_t* received);
 int network_socket_setsockopt(uint32_t id, int option, const void* value, size_t size);
 int network_socket_getsockopt(uint32_t id, int option, void* value, size_t* size);
 int network_socket_getinfo(uint32_t id, network_socket_info_t* info);
+int network_socket_signal_connection(uint32_t id);
+
+// Readiness notification
+int network_poll_create(uint32_t* set_id);
+int network_poll_destroy(uint32_t set_id);
+int network_poll_add(uint32_t set_id, uint32_t socket_id, uint32_t events, void* data);
+int network_poll_modify(uint32_t set_id, uint32_t socket_id, uint32_t events, void* data);
+int network_poll_remove(uint32_t set_id, uint32_t socket_id);
+int network_poll_wait(uint32_t set_id, network_poll_event_t* events, int max_events, int timeout_ms, int* count);
 
 // These functions are implemented as static in network.c and not exposed in the API
 // Removed static function declarations to avoid "declared static but never defined" warnings
@@ -126,6 +126,8 @@ typedef struct {
 #define NN_DTYPE_UINT32              10
 #define NN_DTYPE_UINT64              11
 #define NN_DTYPE_BOOL                12
+#define NN_DTYPE_INT4                13
+#define NN_DTYPE_BFLOAT16            14
 
 // Neural network layer configuration structure
 typedef struct {
@@ -219,6 +221,29 @@ typedef struct {
 // Forward declaration of the internal model structure
 typedef struct nn_model nn_model_t;
 
+// Continuous batching statistics
+typedef struct {
+    uint64_t steps;             // Batched decode steps
+    uint64_t tokens;            // Tokens decoded by those steps
+    uint64_t sequences;         // Sequences completed
+    uint32_t active;            // Sequences in the running batch
+    uint32_t pending;           // Sequences waiting to join the batch
+    uint32_t max_batch;         // Largest batch decoded in one step
+} nn_batch_stats_t;
+
+// Speculative decoding statistics of one generation
+typedef struct {
+    uint64_t steps;             // Draft-and-verify steps
+    uint64_t drafted;           // Tokens proposed by the draft model
+    uint64_t accepted;          // Proposals accepted by the target model
+    uint64_t tokens;            // Tokens generated
+    float acceptance_rate;      // accepted / drafted
+} nn_speculative_stats_t;
+
+// Receives each piece of streamed text; returns 0 to continue, nonzero to
+// stop generating
+typedef int (*nn_stream_callback_t)(const char* text, size_t len, void* user_data);
+
 // Neural network initialization and shutdown
 int nn_init(void);
 int nn_shutdown(void);
@@ -228,14 +253,24 @@ int nn_load_model(nn_model_type_t type, const char* name, const char* path, nn_m
 int nn_unload_model(nn_model_id_t id);
 int nn_get_model_info(nn_model_id_t id, nn_model_info_t* info);
 int nn_generate(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty);
+int nn_generate_stream(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data);
 int nn_run_inference(nn_model_id_t id, nn_tensor_t* input, nn_tensor_t* output);
 
+// Continuous batching
+int nn_generate_batched(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty);
+int nn_get_batch_stats(nn_batch_stats_t* stats);
+
+// Speculative decoding
+int nn_generate_speculative(nn_model_id_t id, nn_model_id_t draft_id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, uint32_t num_draft_tokens, nn_speculative_stats_t* stats);
+
 // Neural network model loading and inference with different model types
 int nn_load_deepseek_model(nn_model_t* model, const char* path);
 int nn_unload_deepseek_model(nn_model_t* model);
 int nn_deepseek_tokenize(nn_model_t* model, const char* text, uint32_t** tokens, size_t* num_tokens);
 int nn_deepseek_detokenize(uint32_t* tokens, uint32_t num_tokens, char* text, size_t size);
 int nn_deepseek_generate(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty);
+int nn_deepseek_generate_stream(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data);
+int nn_deepseek_quantize(nn_model_t* model, uint32_t dtype);
 
 int nn_load_llama_model(nn_model_t* model, const char* path);
 int nn_unload_llama_model(nn_model_t* model);
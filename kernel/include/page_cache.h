@@ -0,0 +1,90 @@
+/**
+ * page_cache.h - File page cache for NeuroOS
+ *
+ * This file contains the page cache definitions and declarations. File
+ * data is cached in page-sized blocks shared by every open of a file and
+ * kept after the last close, so a file read again (a model reloaded, a
+ * tokenizer parsed at every boot) comes from memory. Sequential readers
+ * get a readahead window that doubles while the access stays sequential;
+ * writes are kept in dirty pages and written back on close, sync, eviction
+ * or when too many pages are dirty.
+ */
+
+#ifndef NEUROOS_PAGE_CACHE_H
+#define NEUROOS_PAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a cached page
+#define PAGE_CACHE_PAGE_SIZE 4096
+
+// Pages the cache holds at most (16 MB)
+#define PAGE_CACHE_MAX_PAGES 4096
+
+// Dirty pages allowed before a writer has to write its file back
+#define PAGE_CACHE_DIRTY_LIMIT (PAGE_CACHE_MAX_PAGES / 4)
+
+// Readahead window, in pages
+#define PAGE_CACHE_READAHEAD_MIN 4
+#define PAGE_CACHE_READAHEAD_MAX 64
+
+// Open flags (the same bits as the FILE_FLAG_* flags in filesystem.h)
+#define PAGE_CACHE_READ     (1 << 0)
+#define PAGE_CACHE_WRITE    (1 << 1)
+#define PAGE_CACHE_APPEND   (1 << 2)
+#define PAGE_CACHE_CREATE   (1 << 3)
+#define PAGE_CACHE_TRUNCATE (1 << 4)
+#define PAGE_CACHE_DIRECT   (1 << 9)    // Bypass the cache
+
+// Seek modes
+#define PAGE_CACHE_SEEK_SET 0
+#define PAGE_CACHE_SEEK_CUR 1
+#define PAGE_CACHE_SEEK_END 2
+
+// Filesystem the cache reads and writes files through. The cache calls it
+// with its lock held, so it must not call back into the cache.
+typedef struct {
+    // Open a file: store a handle, the file size and a key that identifies
+    // the file across opens (an inode number, for instance)
+    int (*open)(const char* path, uint32_t flags, void** handle, uint64_t* size, uint64_t* key);
+    int (*close)(void* handle);
+
+    // Transfer bytes at an offset; return the number transferred, -1 on error
+    int (*read)(void* handle, uint64_t offset, void* buffer, size_t size);
+    int (*write)(void* handle, uint64_t offset, const void* buffer, size_t size);
+} page_cache_backend_t;
+
+// Open file
+typedef struct page_cache_file page_cache_file_t;
+
+// Page cache statistics
+typedef struct {
+    uint64_t hits;                  // Pages found in the cache
+    uint64_t misses;                // Pages that had to be read
+    uint64_t pages_read;            // Pages read from the backend, readahead included
+    uint64_t readahead_pages;       // Pages read ahead of the reader
+    uint64_t pages_written;         // Dirty pages written back
+    uint64_t evictions;
+    uint32_t cached_pages;
+    uint32_t dirty_pages;
+} page_cache_stats_t;
+
+// Page cache initialization
+int page_cache_init(void);
+void page_cache_set_backend(const page_cache_backend_t* backend);
+
+// File operations
+page_cache_file_t* page_cache_open(const char* path, uint32_t flags);
+int page_cache_close(page_cache_file_t* file);
+size_t page_cache_read(page_cache_file_t* file, void* buffer, size_t size);
+size_t page_cache_write(page_cache_file_t* file, const void* buffer, size_t size);
+int page_cache_seek(page_cache_file_t* file, int64_t offset, int whence);
+uint64_t page_cache_tell(page_cache_file_t* file);
+int page_cache_flush(page_cache_file_t* file);
+
+// Cache operations
+int page_cache_sync(void);
+void page_cache_get_stats(page_cache_stats_t* stats);
+
+#endif // NEUROOS_PAGE_CACHE_H
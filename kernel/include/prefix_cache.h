@@ -0,0 +1,63 @@
+/**
+ * prefix_cache.h - Prompt prefix KV cache for NeuroOS
+ *
+ * This file contains the prefix cache definitions and declarations. The
+ * cache keeps the key/value rows computed for common prompt prefixes so a
+ * new generation only has to prefill the part of its prompt that differs.
+ */
+
+#ifndef NEUROOS_PREFIX_CACHE_H
+#define NEUROOS_PREFIX_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cached prefixes are whole blocks of this many tokens
+#define PREFIX_CACHE_BLOCK          16
+
+// Longest cached prefix in blocks
+#define PREFIX_CACHE_MAX_BLOCKS     256
+
+// Hash buckets of the block index (power of two)
+#define PREFIX_CACHE_BUCKETS        1024
+
+// Memory budget used until one is configured
+#define PREFIX_CACHE_DEFAULT_BUDGET (64u * 1024 * 1024)
+
+// Prefix cache statistics
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t tokens_saved;      // Prefill positions copied instead of computed
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t memory_used;
+    uint64_t memory_budget;
+    uint32_t num_entries;
+} prefix_cache_stats_t;
+
+// Key/value rows of a sequence
+//
+// Row p of layer l starts at keys + l * layer_stride + p * row_size, and
+// likewise for values.
+typedef struct {
+    size_t num_layers;
+    size_t row_size;            // Floats per position and layer
+    size_t layer_stride;        // Floats between layers
+    float* keys;
+    float* values;
+} prefix_cache_kv_t;
+
+// Prefix cache configuration
+int prefix_cache_set_budget(size_t budget);
+
+// Prefix cache operations
+size_t prefix_cache_lookup(const void* owner, const uint32_t* tokens, size_t num_tokens, const prefix_cache_kv_t* kv);
+int prefix_cache_insert(const void* owner, const uint32_t* tokens, size_t num_tokens, const prefix_cache_kv_t* kv);
+void prefix_cache_invalidate(const void* owner);
+
+// Prefix cache information
+void prefix_cache_get_stats(prefix_cache_stats_t* stats);
+
+#endif // NEUROOS_PREFIX_CACHE_H
@@ -9,6 +9,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "cpu.h"
+#include "timer.h"
 
 // Process name maximum length
 #define PROCESS_NAME_MAX 256
@@ -73,6 +75,9 @@ typedef uint32_t process_flags_t;
 #define PROCESS_PRIORITY_HIGHEST   7
 #define PROCESS_PRIORITY_REALTIME  8
 
+// Number of scheduling levels (one run queue per priority)
+#define PROCESS_NUM_LEVELS (PROCESS_PRIORITY_REALTIME + 1)
+
 // Process context structure
 typedef struct {
     uint32_t eip;
@@ -99,13 +104,29 @@ typedef struct process {
     
     process_context_t context;
     
+    // FPU/SIMD register state, saved and restored on context switches
+    uint8_t fpu_state[CPU_FPU_STATE_SIZE] __attribute__((aligned(64)));
+    
     uint64_t cpu_time;
     uint64_t creation_time;
     int exit_code;
     
+    // Multilevel feedback queue state
+    process_priority_t level;       // Current scheduling level (<= priority)
+    uint8_t queued;                 // On a run queue
+    uint64_t slice_ticks;           // Ticks used at the current level
+    
+    // Multiprocessor state
+    uint32_t cpu;                   // CPU whose run queues hold (or last ran) the process
+    volatile uint8_t on_cpu;        // Context not yet saved by the CPU switching away
+    
+    hrtimer_t sleep_timer;          // Wakes the process at the end of process_sleep
+    
     struct process* parent;
     struct process* next;
     struct process* prev;
+    struct process* run_next;
+    struct process* run_prev;
 } process_t;
 
 // Process information structure
@@ -172,6 +193,7 @@ typedef struct {
 
 // Process initialization and shutdown
 void process_init(void);
+void process_init_cpu(uint32_t cpu);
 void process_shutdown(void);
 
 // Process creation and termination
@@ -223,7 +245,13 @@ int process_set_signal_mask(uint64_t mask);
 
 // Process scheduling
 void process_yield(void);
+void process_idle(void);
 void process_sleep(uint32_t ms);
+void process_sleep_us(uint64_t us);
+int process_block(pid_t pid);
+int process_unblock(pid_t pid);
+int process_block_unless(volatile int* wake);
+int process_scheduler_running(void);
 int process_wake(int pid);
 int process_set_scheduler(int pid, int scheduler, int priority);
 int process_get_scheduler(int pid, int* scheduler, int* priority);
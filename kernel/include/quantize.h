@@ -0,0 +1,46 @@
+/**
+ * quantize.h - Block-quantized weights for NeuroOS
+ *
+ * This file contains the block quantization definitions and declarations
+ * used to store model weights as INT8 or INT4 with one scale per group.
+ */
+
+#ifndef NEUROOS_QUANTIZE_H
+#define NEUROOS_QUANTIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of weights sharing one scale
+#define NN_QUANT_GROUP_SIZE 32
+
+// Block-quantized weight matrix [rows][cols], grouped along cols
+//
+// INT8 stores one signed byte per weight. INT4 packs two weights per byte,
+// low nibble first, each biased by 8. A quantized nn_tensor_t of shape
+// [k][n] holds an nn_qmatrix_t with rows = n and cols = k in its data field,
+// i.e. the transposed weights, which is the layout the GEMV kernel reads.
+typedef struct {
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t dtype;          // NN_DTYPE_INT8 or NN_DTYPE_INT4
+    uint32_t group_size;
+    uint32_t groups_per_row;
+    uint32_t row_stride;     // Bytes per row of quantized data
+    float* scales;           // [rows][groups_per_row]
+    uint8_t* data;           // [rows][row_stride]
+    size_t alloc_size;
+} nn_qmatrix_t;
+
+// Quantization
+int nn_qmatrix_quantize(nn_qmatrix_t* qm, const float* weights, uint32_t rows, uint32_t cols, uint32_t dtype);
+int nn_qmatrix_quantize_transposed(nn_qmatrix_t* qm, const float* weights, uint32_t rows, uint32_t cols, uint32_t dtype);
+void nn_qmatrix_free(nn_qmatrix_t* qm);
+size_t nn_qmatrix_size(uint32_t rows, uint32_t cols, uint32_t dtype);
+
+// Kernels
+void nn_qmatrix_gemv(const nn_qmatrix_t* qm, const float* x, float* y);
+void nn_qmatrix_gemv_rows(const nn_qmatrix_t* qm, const float* x, float* y, uint32_t row_begin, uint32_t row_end);
+void nn_qmatrix_dequantize_row(const nn_qmatrix_t* qm, uint32_t row, float* out);
+
+#endif // NEUROOS_QUANTIZE_H
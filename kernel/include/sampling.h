@@ -0,0 +1,52 @@
+/**
+ * sampling.h - Token sampling for NeuroOS
+ *
+ * This file contains the token sampling definitions and declarations shared
+ * by the text generators.
+ */
+
+#ifndef NEUROOS_SAMPLING_H
+#define NEUROOS_SAMPLING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of candidates kept for top-p when top-k is disabled
+#define SAMPLER_DEFAULT_CANDIDATES 1024
+
+// Sampling parameters
+typedef struct {
+    float temperature;          // <= 0 selects greedy decoding
+    float top_p;                // Nucleus threshold, disabled outside (0, 1)
+    int top_k;                  // Candidate count, disabled when <= 0 or >= vocab size
+    float repetition_penalty;   // Penalty for context tokens, disabled when <= 1
+} sampler_params_t;
+
+// Sampler state
+//
+// The scratch buffers are allocated once by sampler_init and reused for
+// every token of a generation.
+typedef struct {
+    size_t vocab_size;
+    size_t max_candidates;
+    uint32_t* indices;      // Candidate token IDs [max_candidates]
+    float* values;          // Candidate logits / probabilities [max_candidates]
+    uint32_t* seen;         // Repetition penalty bitmap [(vocab_size + 31) / 32]
+    size_t alloc_size;
+} sampler_t;
+
+// Sampler lifecycle
+int sampler_init(sampler_t* sampler, size_t vocab_size, int top_k);
+void sampler_free(sampler_t* sampler);
+
+// Sampling
+uint32_t sampler_sample(sampler_t* sampler, float* logits, const sampler_params_t* params,
+                        const uint32_t* context, size_t context_size);
+uint32_t sampler_argmax(const float* logits, size_t vocab_size);
+
+// Sampling distributions
+void sampler_probs(sampler_t* sampler, float* logits, const sampler_params_t* params,
+                   const uint32_t* context, size_t context_size, float* probs);
+uint32_t sampler_draw(const float* probs, size_t vocab_size);
+
+#endif // NEUROOS_SAMPLING_H
@@ -100,6 +100,11 @@ typedef struct {
     char log_path[256];
 } sandbox_config_t;
 
+// Sandbox filesystem overlay access modes
+#define SANDBOX_OVERLAY_READ   0    // Read the file as the sandbox sees it
+#define SANDBOX_OVERLAY_WRITE  1    // Modify the file (copied to the upper layer first)
+#define SANDBOX_OVERLAY_CREATE 2    // Create or truncate the file
+
 // Sandbox state structure
 typedef struct {
     uint32_t id;
@@ -247,6 +252,8 @@ int sandbox_allow_file(uint32_t id, const char* path, int access);
 int sandbox_deny_file(uint32_t id, const char* path);
 int sandbox_clear_file_access(uint32_t id);
 int sandbox_reset_file_access(uint32_t id);
+int sandbox_resolve_path(uint32_t id, const char* path, int mode, char* resolved, size_t size);
+int sandbox_remove_path(uint32_t id, const char* path);
 
 // Sandbox network management
 int sandbox_set_network_access(uint32_t id, int family, int type, int protocol, int access);
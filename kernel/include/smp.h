@@ -0,0 +1,41 @@
+/**
+ * smp.h - Multiprocessor support for NeuroOS
+ *
+ * This file contains the local APIC and application processor (AP) startup
+ * definitions and declarations. CPUs are numbered in the order they come
+ * online; the bootstrap processor (BSP) is CPU 0.
+ */
+
+#ifndef NEUROOS_SMP_H
+#define NEUROOS_SMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of CPUs
+#define SMP_MAX_CPUS 16
+
+// Local APIC interrupt vectors
+#define SMP_VECTOR_TIMER        48  // One-shot local APIC timer (timer.c)
+#define SMP_VECTOR_RESCHEDULE   49  // Wakes a CPU to look at its run queues
+#define SMP_VECTOR_SPURIOUS     63
+
+// Physical page the AP startup code is copied to (below 1 MB, 4 KB aligned)
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+// Stack size of an AP until it switches to its first process
+#define SMP_AP_STACK_SIZE (16 * 1024)
+
+// SMP initialization
+int smp_init(void);
+
+// CPU information
+uint32_t smp_cpu_index(void);
+uint32_t smp_cpu_count(void);
+
+// Local APIC operations
+void smp_lapic_eoi(void);
+void smp_send_reschedule(uint32_t cpu);
+int smp_timer_oneshot(uint64_t delay_ns);
+
+#endif // NEUROOS_SMP_H
@@ -0,0 +1,65 @@
+/**
+ * timer.h - Clock and high-resolution timers for NeuroOS
+ *
+ * This file contains the clock and timer definitions and declarations. The
+ * clock counts nanoseconds since boot. Timers are one-shot: each CPU keeps
+ * its pending timers in a heap ordered by deadline and programs its local
+ * APIC timer for the earliest one only, so an idle CPU takes no timer
+ * interrupts at all.
+ */
+
+#ifndef NEUROOS_TIMER_H
+#define NEUROOS_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Clock units
+#define TIMER_NS_PER_US 1000ULL
+#define TIMER_NS_PER_MS 1000000ULL
+
+// Pending timers per CPU
+#define TIMER_MAX_PENDING 256
+
+// Period of the PIT tick used when the CPU has no TSC or local APIC timer
+#define TIMER_FALLBACK_HZ 100
+
+// Timer callback (runs in interrupt context on the CPU the timer was started on)
+typedef void (*hrtimer_callback_t)(void* data);
+
+// High-resolution timer
+typedef struct {
+    uint64_t deadline;              // Clock time the timer expires at
+    hrtimer_callback_t callback;
+    void* data;
+    volatile int32_t cpu;           // CPU whose heap holds the timer, -1 if not pending
+    int32_t index;                  // Position in that heap
+} hrtimer_t;
+
+// Timer statistics
+typedef struct {
+    uint64_t interrupts;            // Timer interrupts taken on all CPUs
+    uint64_t expired;               // Timer callbacks run
+    uint64_t started;
+    uint64_t cancelled;
+    int tickless;                   // 1 if the one-shot local APIC timers are in use
+    uint64_t tsc_khz;               // Calibrated TSC rate, 0 without a TSC
+} timer_stats_t;
+
+// Timer initialization
+int timer_init(void);
+
+// Clock operations
+uint64_t timer_now_ns(void);
+void timer_delay_us(uint32_t us);
+
+// Timer operations
+void hrtimer_init(hrtimer_t* timer, hrtimer_callback_t callback, void* data);
+int hrtimer_start(hrtimer_t* timer, uint64_t deadline);
+int hrtimer_cancel(hrtimer_t* timer);
+int hrtimer_pending(const hrtimer_t* timer);
+
+// Timer information
+void timer_get_stats(timer_stats_t* stats);
+
+#endif // NEUROOS_TIMER_H
@@ -0,0 +1,90 @@
+/**
+ * trace.h - Kernel tracing for NeuroOS
+ *
+ * This file contains the trace definitions and declarations. Tracepoints are
+ * static descriptors placed next to the code they instrument; each event is
+ * stamped with the TSC and stored in a ring owned by the CPU that recorded
+ * it, so recording takes no lock. The rings keep the most recent events and
+ * overwrite the oldest. Categories that are not being traced cost one load
+ * and a branch per tracepoint.
+ */
+
+#ifndef NEUROOS_TRACE_H
+#define NEUROOS_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Events kept per CPU (a power of two)
+#define TRACE_RING_EVENTS 4096
+
+// Trace categories
+#define TRACE_CAT_SCHED     (1 << 0)    // Context switches
+#define TRACE_CAT_MEMORY    (1 << 1)    // Heap allocations
+#define TRACE_CAT_FAULT     (1 << 2)    // Page faults
+#define TRACE_CAT_NET       (1 << 3)    // Socket send/recv
+#define TRACE_CAT_DL        (1 << 4)    // DL framework operations
+#define TRACE_CAT_LLM       (1 << 5)    // Tokenize, prefill and decode phases
+#define TRACE_CAT_COUNT     6
+#define TRACE_CAT_ALL       ((1 << TRACE_CAT_COUNT) - 1)
+
+// Event kinds (the Chrome trace event phases)
+#define TRACE_EVENT_SPAN    'X'
+#define TRACE_EVENT_INSTANT 'i'
+#define TRACE_EVENT_COUNTER 'C'
+
+// Tracepoint, defined once at the place it is recorded from
+typedef struct {
+    const char* name;
+    uint32_t category;              // One TRACE_CAT_* bit
+    const char* arg_names[2];       // NULL for unused arguments
+} trace_point_t;
+
+// Recorded event
+typedef struct {
+    uint64_t start;                 // TSC at the start of a span, or of the event
+    uint64_t duration;              // TSC cycles, 0 unless a span
+    const trace_point_t* point;
+    uint32_t args[2];
+    uint32_t kind;                  // TRACE_EVENT_*
+} trace_event_t;
+
+// Trace statistics
+typedef struct {
+    uint32_t categories;            // Categories being traced
+    uint64_t events[TRACE_CAT_COUNT];   // Events recorded per category
+    uint64_t overwritten;           // Events lost to ring wraparound
+    uint64_t clock_khz;             // Rate of the timestamps
+} trace_stats_t;
+
+// Receives each event held in the rings, oldest first per CPU; return
+// nonzero to stop the walk
+typedef int (*trace_visit_t)(void* ctx, uint32_t cpu, const trace_event_t* event);
+
+// Receives the exported trace in pieces; return 0 on success, -1 on failure
+typedef int (*trace_writer_t)(void* ctx, const void* data, size_t size);
+
+// Trace initialization (after the timers and the APs are up)
+int trace_init(void);
+
+// Trace control
+void trace_start(uint32_t categories);
+void trace_stop(uint32_t categories);
+void trace_clear(void);
+uint32_t trace_get_categories(void);
+
+// Recording
+uint64_t trace_begin(const trace_point_t* point);
+void trace_end(const trace_point_t* point, uint64_t start, uint32_t arg0, uint32_t arg1);
+void trace_instant(const trace_point_t* point, uint32_t arg0, uint32_t arg1);
+void trace_counter(const trace_point_t* point, uint32_t value);
+
+// Reading
+uint64_t trace_clock(void);
+uint64_t trace_cycles_to_ns(uint64_t cycles);
+int trace_for_each(trace_visit_t visit, void* ctx);
+int trace_export_json(trace_writer_t writer, void* ctx);
+const char* trace_category_name(uint32_t category);
+void trace_get_stats(trace_stats_t* stats);
+
+#endif // NEUROOS_TRACE_H
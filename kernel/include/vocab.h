@@ -0,0 +1,54 @@
+/**
+ * vocab.h - Token vocabulary for NeuroOS
+ *
+ * This file contains the token vocabulary definitions and declarations shared
+ * by the tokenizers. Token text is looked up through an open-addressing hash
+ * table and token IDs through a direct index.
+ */
+
+#ifndef NEUROOS_VOCAB_H
+#define NEUROOS_VOCAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Marker for an ID without a token
+#define VOCAB_NO_TOKEN 0xFFFFFFFFu
+
+// Vocabulary
+//
+// Token text lives in one string pool; each ID indexes its offset and
+// length in the pool. The hash table holds ID + 1 per slot (0 = empty) and
+// is kept at most half full.
+typedef struct {
+    uint32_t num_tokens;        // Tokens added
+    uint32_t max_tokens;        // Capacity of the ID index
+    uint32_t capacity;          // Hash table slots (power of two)
+    uint32_t* slots;            // Hash table [capacity]
+    uint32_t* offsets;          // String pool offset per ID [max_tokens]
+    uint32_t* lengths;          // Token length per ID [max_tokens]
+    uint32_t* hashes;           // Token hash per ID [max_tokens]
+    char* strings;              // String pool
+    size_t strings_size;
+    size_t strings_used;
+    size_t alloc_size;
+} vocab_t;
+
+// Vocabulary lifecycle
+int vocab_init(vocab_t* vocab, uint32_t max_tokens, size_t strings_size);
+void vocab_free(vocab_t* vocab);
+
+// Vocabulary construction
+int vocab_add(vocab_t* vocab, const char* text, size_t len, uint32_t id);
+int vocab_load_json(vocab_t* vocab, const char* json, size_t len);
+
+// Vocabulary lookup
+int vocab_lookup(const vocab_t* vocab, const char* text, size_t len, uint32_t* id);
+const char* vocab_get_text(const vocab_t* vocab, uint32_t id, size_t* len);
+
+// tokenizer.json helpers
+const char* vocab_json_skip_ws(const char* p, const char* end);
+const char* vocab_json_parse_string(const char* p, const char* end, char* out, size_t out_size, size_t* out_len);
+const char* vocab_json_find_key(const char* p, const char* end, const char* key);
+
+#endif // NEUROOS_VOCAB_H
@@ -0,0 +1,845 @@
+/**
+ * inference_bench.c - Inference benchmark for NeuroOS
+ *
+ * This file times the kernels a generation spends its time in, each on its
+ * own and at the shapes a model runs them at, then loads a model and times
+ * a streamed generation. Every kernel is repeated until it has run for at
+ * least INFERENCE_BENCH_MIN_NS so short calls are measured over many
+ * iterations. The results are printed as JSON lines for scripts to collect.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "include/inference_bench.h"
+#include "include/console.h"
+#include "include/memory.h"
+#include "include/timer.h"
+#include "include/neural_network.h"
+#include "include/quantize.h"
+#include "include/sampling.h"
+#include "include/vocab.h"
+#include "include/bpe.h"
+
+#ifdef NEUROOS_INFERENCE_BENCH
+
+// Results are accumulated here so the calls are not optimized away
+static volatile uint32_t inference_bench_sink;
+
+// Result file, NULL if it could not be created
+static FILE* inference_bench_file;
+
+// DL framework kernels (modules/dl_framework/dl_kernels.h)
+void dl_kernel_gemm(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c);
+void dl_kernel_softmax(const float* a, float* b, size_t rows, size_t cols);
+
+// GEMM shapes (m x k times k x n): square blocks, then the decode (m = 1)
+// and prefill (m = 128) shapes of a 2048-wide projection
+typedef struct {
+    uint32_t m;
+    uint32_t n;
+    uint32_t k;
+} inference_bench_shape_t;
+
+static const inference_bench_shape_t inference_bench_gemm_shapes[] = {
+    { 64, 64, 64 },
+    { 256, 256, 256 },
+    { 512, 512, 512 },
+    { 1, 2048, 2048 },
+    { 128, 2048, 2048 }
+};
+
+#define INFERENCE_BENCH_NUM_GEMM_SHAPES (sizeof(inference_bench_gemm_shapes) / sizeof(inference_bench_gemm_shapes[0]))
+
+// Quantized GEMV shape (rows x cols)
+#define INFERENCE_BENCH_GEMV_ROWS 2048
+#define INFERENCE_BENCH_GEMV_COLS 2048
+
+// Softmax and sampling run over a vocabulary of logits
+#define INFERENCE_BENCH_VOCAB_SIZE 32000
+
+// Attention softmax: one row of scores per head and query
+#define INFERENCE_BENCH_ATTENTION_ROWS 256
+#define INFERENCE_BENCH_ATTENTION_COLS 512
+
+// Context the repetition penalty is applied over
+#define INFERENCE_BENCH_CONTEXT 256
+
+// memcpy block sizes
+static const size_t inference_bench_copy_sizes[] = { 4096, 256 * 1024, 4 * 1024 * 1024 };
+
+#define INFERENCE_BENCH_NUM_COPY_SIZES (sizeof(inference_bench_copy_sizes) / sizeof(inference_bench_copy_sizes[0]))
+#define INFERENCE_BENCH_MAX_COPY_SIZE (4 * 1024 * 1024)
+
+// Tokenizer input
+#define INFERENCE_BENCH_TEXT_SIZE (64 * 1024)
+
+static const char inference_bench_text[] =
+    "The kernel schedules the processes that share the machine, maps the memory they "
+    "use and moves data between them and the devices. When a model is loaded, its "
+    "weights are read from the disk into memory and the tokenizer turns the prompt "
+    "into the token IDs the model was trained on. Each generated token is sampled "
+    "from the logits of the last layer, 42 times per second or more on a fast CPU.\n";
+
+// Byte-level form of a space
+#define INFERENCE_BENCH_SPACE "\xC4\xA0"
+
+// Merges of the tokenizer, lowest rank first
+static const char* inference_bench_merges[][2] = {
+    { "t", "h" }, { INFERENCE_BENCH_SPACE, "t" }, { "h", "e" }, { "i", "n" },
+    { "e", "r" }, { INFERENCE_BENCH_SPACE, "a" }, { "o", "n" }, { "r", "e" },
+    { INFERENCE_BENCH_SPACE, "th" }, { INFERENCE_BENCH_SPACE "th", "e" }, { INFERENCE_BENCH_SPACE, "s" }, { INFERENCE_BENCH_SPACE, "w" },
+    { "a", "n" }, { "o", "u" }, { "e", "n" }, { "in", "g" },
+    { INFERENCE_BENCH_SPACE, "m" }, { INFERENCE_BENCH_SPACE, "o" }, { INFERENCE_BENCH_SPACE, "c" }, { INFERENCE_BENCH_SPACE, "p" },
+    { "e", "s" }, { "a", "t" }, { "o", "r" }, { "e", "d" },
+    { INFERENCE_BENCH_SPACE, "d" }, { INFERENCE_BENCH_SPACE, "i" }, { "a", "r" }, { "a", "l" },
+    { INFERENCE_BENCH_SPACE "t", "o" }, { INFERENCE_BENCH_SPACE "a", "n" }, { INFERENCE_BENCH_SPACE "an", "d" }, { INFERENCE_BENCH_SPACE, "f" },
+    { INFERENCE_BENCH_SPACE, "l" }, { INFERENCE_BENCH_SPACE "o", "f" }, { INFERENCE_BENCH_SPACE, "b" }, { "e", "l" },
+    { INFERENCE_BENCH_SPACE, "h" }, { INFERENCE_BENCH_SPACE, "e" }, { "o", "m" }, { INFERENCE_BENCH_SPACE "m", "o" }
+};
+
+#define INFERENCE_BENCH_NUM_MERGES (sizeof(inference_bench_merges) / sizeof(inference_bench_merges[0]))
+
+// Result line
+typedef struct {
+    char text[256];
+    size_t len;
+} inference_bench_record_t;
+
+// Operation timed by inference_bench_time
+typedef void (*inference_bench_op_t)(void* ctx);
+
+/**
+ * Append a string to a result line
+ */
+static void inference_bench_append(inference_bench_record_t* record, const char* text) {
+    while (*text && record->len < sizeof(record->text) - 3) {
+        record->text[record->len++] = *text++;
+    }
+}
+
+/**
+ * Start a result line
+ *
+ * @param record: Result line
+ * @param name: Name of the benchmark
+ */
+static void inference_bench_begin(inference_bench_record_t* record, const char* name) {
+    record->len = 0;
+    inference_bench_append(record, "{\"bench\":\"");
+    inference_bench_append(record, name);
+    inference_bench_append(record, "\"");
+}
+
+/**
+ * Add an integer to a result line
+ */
+static void inference_bench_add_uint(inference_bench_record_t* record, const char* key, uint64_t value) {
+    char digits[21];
+    size_t n = sizeof(digits) - 1;
+
+    digits[n] = '\0';
+    do {
+        digits[--n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    inference_bench_append(record, ",\"");
+    inference_bench_append(record, key);
+    inference_bench_append(record, "\":");
+    inference_bench_append(record, &digits[n]);
+}
+
+/**
+ * Add a string to a result line (the value is not escaped)
+ */
+static void inference_bench_add_string(inference_bench_record_t* record, const char* key, const char* value) {
+    inference_bench_append(record, ",\"");
+    inference_bench_append(record, key);
+    inference_bench_append(record, "\":\"");
+    inference_bench_append(record, value);
+    inference_bench_append(record, "\"");
+}
+
+/**
+ * Finish a result line and print it
+ *
+ * The space kept free by inference_bench_append holds the closing brace,
+ * the newline and the terminator.
+ */
+static void inference_bench_end(inference_bench_record_t* record) {
+    record->text[record->len++] = '}';
+    record->text[record->len++] = '\n';
+
+    if (inference_bench_file) {
+        fwrite(record->text, 1, record->len, inference_bench_file);
+    }
+
+    record->text[record->len] = '\0';
+    console_write(INFERENCE_BENCH_PREFIX);
+    console_write(record->text);
+}
+
+/**
+ * Repeat an operation for at least INFERENCE_BENCH_MIN_NS
+ *
+ * @param op: Operation
+ * @param ctx: Operation arguments
+ * @param iterations: Pointer to store the number of calls
+ * @return Elapsed time in ns (at least 1)
+ */
+static uint64_t inference_bench_time(inference_bench_op_t op, void* ctx, uint64_t* iterations) {
+    uint64_t count = 0;
+    uint64_t elapsed;
+
+    // One untimed call faults in the buffers and warms the caches
+    op(ctx);
+
+    uint64_t start = timer_now_ns();
+
+    do {
+        op(ctx);
+        count++;
+        elapsed = timer_now_ns() - start;
+    } while (elapsed < INFERENCE_BENCH_MIN_NS);
+
+    *iterations = count;
+
+    return elapsed ? elapsed : 1;
+}
+
+/**
+ * Fill a buffer with pseudo-random values in [-scale, scale)
+ */
+static void inference_bench_fill(float* data, size_t count, float scale, uint32_t seed) {
+    uint32_t state = seed;
+
+    for (size_t i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u;
+        data[i] = ((float)(state >> 8) / 8388608.0f - 1.0f) * scale;
+    }
+}
+
+/**
+ * Allocate a float buffer
+ */
+static float* inference_bench_alloc(size_t count) {
+    return (float*)memory_alloc(count * sizeof(float), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+}
+
+// GEMM
+
+typedef struct {
+    const inference_bench_shape_t* shape;
+    const float* a;
+    const float* b;
+    float* c;
+} inference_bench_gemm_t;
+
+static void inference_bench_gemm_op(void* ctx) {
+    inference_bench_gemm_t* gemm = (inference_bench_gemm_t*)ctx;
+
+    dl_kernel_gemm(gemm->shape->m, gemm->shape->n, gemm->shape->k, gemm->a, gemm->b, gemm->c);
+}
+
+/**
+ * Time the float GEMM kernel across the shapes
+ */
+static void inference_bench_run_gemm(void) {
+    for (size_t i = 0; i < INFERENCE_BENCH_NUM_GEMM_SHAPES; i++) {
+        const inference_bench_shape_t* shape = &inference_bench_gemm_shapes[i];
+        size_t a_count = (size_t)shape->m * shape->k;
+        size_t b_count = (size_t)shape->k * shape->n;
+        size_t c_count = (size_t)shape->m * shape->n;
+        inference_bench_gemm_t gemm = { shape, inference_bench_alloc(a_count), inference_bench_alloc(b_count), inference_bench_alloc(c_count) };
+        inference_bench_record_t record;
+
+        if (gemm.a && gemm.b && gemm.c) {
+            inference_bench_fill((float*)gemm.a, a_count, 1.0f, 1);
+            inference_bench_fill((float*)gemm.b, b_count, 1.0f, 2);
+
+            uint64_t iterations;
+            uint64_t elapsed = inference_bench_time(inference_bench_gemm_op, &gemm, &iterations);
+            uint64_t flops = 2ULL * shape->m * shape->n * shape->k * iterations;
+
+            inference_bench_sink += (uint32_t)gemm.c[0];
+
+            inference_bench_begin(&record, "gemm");
+            inference_bench_add_uint(&record, "m", shape->m);
+            inference_bench_add_uint(&record, "n", shape->n);
+            inference_bench_add_uint(&record, "k", shape->k);
+            inference_bench_add_uint(&record, "iterations", iterations);
+            inference_bench_add_uint(&record, "ns_per_call", elapsed / iterations);
+            // flops / ns * 1000 = MFLOP/s
+            inference_bench_add_uint(&record, "mflops", flops * 1000 / elapsed);
+            inference_bench_end(&record);
+        } else {
+            console_printf("Error: Failed to allocate GEMM benchmark buffers\n");
+        }
+
+        if (gemm.a) {
+            memory_free((void*)gemm.a, a_count * sizeof(float));
+        }
+        if (gemm.b) {
+            memory_free((void*)gemm.b, b_count * sizeof(float));
+        }
+        if (gemm.c) {
+            memory_free(gemm.c, c_count * sizeof(float));
+        }
+    }
+}
+
+// Quantized GEMV
+
+typedef struct {
+    const nn_qmatrix_t* qm;
+    const float* x;
+    float* y;
+} inference_bench_gemv_t;
+
+static void inference_bench_gemv_op(void* ctx) {
+    inference_bench_gemv_t* gemv = (inference_bench_gemv_t*)ctx;
+
+    nn_qmatrix_gemv(gemv->qm, gemv->x, gemv->y);
+}
+
+/**
+ * Time the block-quantized GEMV kernel the decode projections run on
+ */
+static void inference_bench_run_gemv(void) {
+    static const uint32_t dtypes[] = { NN_DTYPE_INT8, NN_DTYPE_INT4 };
+    static const char* dtype_names[] = { "int8", "int4" };
+    size_t weights_count = (size_t)INFERENCE_BENCH_GEMV_ROWS * INFERENCE_BENCH_GEMV_COLS;
+    float* weights = inference_bench_alloc(weights_count);
+    float* x = inference_bench_alloc(INFERENCE_BENCH_GEMV_COLS);
+    float* y = inference_bench_alloc(INFERENCE_BENCH_GEMV_ROWS);
+
+    if (!weights || !x || !y) {
+        console_printf("Error: Failed to allocate GEMV benchmark buffers\n");
+    } else {
+        inference_bench_fill(weights, weights_count, 0.1f, 3);
+        inference_bench_fill(x, INFERENCE_BENCH_GEMV_COLS, 1.0f, 4);
+
+        for (size_t i = 0; i < sizeof(dtypes) / sizeof(dtypes[0]); i++) {
+            nn_qmatrix_t qm;
+            inference_bench_record_t record;
+
+            if (nn_qmatrix_quantize(&qm, weights, INFERENCE_BENCH_GEMV_ROWS, INFERENCE_BENCH_GEMV_COLS, dtypes[i]) != 0) {
+                console_printf("Error: Failed to quantize GEMV benchmark weights\n");
+                continue;
+            }
+
+            inference_bench_gemv_t gemv = { &qm, x, y };
+            uint64_t iterations;
+            uint64_t elapsed = inference_bench_time(inference_bench_gemv_op, &gemv, &iterations);
+            uint64_t flops = 2ULL * INFERENCE_BENCH_GEMV_ROWS * INFERENCE_BENCH_GEMV_COLS * iterations;
+            uint64_t bytes = (uint64_t)nn_qmatrix_size(INFERENCE_BENCH_GEMV_ROWS, INFERENCE_BENCH_GEMV_COLS, dtypes[i]) * iterations;
+
+            inference_bench_sink += (uint32_t)y[0];
+
+            inference_bench_begin(&record, "gemv");
+            inference_bench_add_string(&record, "dtype", dtype_names[i]);
+            inference_bench_add_uint(&record, "rows", INFERENCE_BENCH_GEMV_ROWS);
+            inference_bench_add_uint(&record, "cols", INFERENCE_BENCH_GEMV_COLS);
+            inference_bench_add_uint(&record, "iterations", iterations);
+            inference_bench_add_uint(&record, "ns_per_call", elapsed / iterations);
+            inference_bench_add_uint(&record, "mflops", flops * 1000 / elapsed);
+            // Weight bytes streamed per second
+            inference_bench_add_uint(&record, "mb_per_s", bytes * 1000 / elapsed);
+            inference_bench_end(&record);
+
+            nn_qmatrix_free(&qm);
+        }
+    }
+
+    if (weights) {
+        memory_free(weights, weights_count * sizeof(float));
+    }
+    if (x) {
+        memory_free(x, INFERENCE_BENCH_GEMV_COLS * sizeof(float));
+    }
+    if (y) {
+        memory_free(y, INFERENCE_BENCH_GEMV_ROWS * sizeof(float));
+    }
+}
+
+// Softmax
+
+typedef struct {
+    const float* in;
+    float* out;
+    size_t rows;
+    size_t cols;
+} inference_bench_softmax_t;
+
+static void inference_bench_softmax_op(void* ctx) {
+    inference_bench_softmax_t* softmax = (inference_bench_softmax_t*)ctx;
+
+    dl_kernel_softmax(softmax->in, softmax->out, softmax->rows, softmax->cols);
+}
+
+/**
+ * Time the softmax kernel over a vocabulary of logits and over attention scores
+ */
+static void inference_bench_run_softmax(void) {
+    static const size_t shapes[][2] = {
+        { 1, INFERENCE_BENCH_VOCAB_SIZE },
+        { INFERENCE_BENCH_ATTENTION_ROWS, INFERENCE_BENCH_ATTENTION_COLS }
+    };
+    size_t max_count = (size_t)INFERENCE_BENCH_ATTENTION_ROWS * INFERENCE_BENCH_ATTENTION_COLS;
+    float* in;
+    float* out;
+
+    if (max_count < INFERENCE_BENCH_VOCAB_SIZE) {
+        max_count = INFERENCE_BENCH_VOCAB_SIZE;
+    }
+
+    in = inference_bench_alloc(max_count);
+    out = inference_bench_alloc(max_count);
+
+    if (!in || !out) {
+        console_printf("Error: Failed to allocate softmax benchmark buffers\n");
+    } else {
+        inference_bench_fill(in, max_count, 8.0f, 5);
+
+        for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+            inference_bench_softmax_t softmax = { in, out, shapes[i][0], shapes[i][1] };
+            inference_bench_record_t record;
+            uint64_t iterations;
+            uint64_t elapsed = inference_bench_time(inference_bench_softmax_op, &softmax, &iterations);
+            uint64_t elements = (uint64_t)softmax.rows * softmax.cols * iterations;
+
+            inference_bench_sink += (uint32_t)(out[0] * 1000.0f);
+
+            inference_bench_begin(&record, "softmax");
+            inference_bench_add_uint(&record, "rows", softmax.rows);
+            inference_bench_add_uint(&record, "cols", softmax.cols);
+            inference_bench_add_uint(&record, "iterations", iterations);
+            inference_bench_add_uint(&record, "ns_per_call", elapsed / iterations);
+            inference_bench_add_uint(&record, "melems_per_s", elements * 1000 / elapsed);
+            inference_bench_end(&record);
+        }
+    }
+
+    if (in) {
+        memory_free(in, max_count * sizeof(float));
+    }
+    if (out) {
+        memory_free(out, max_count * sizeof(float));
+    }
+}
+
+// Sampling
+
+typedef struct {
+    sampler_t* sampler;
+    const sampler_params_t* params;
+    const float* logits;
+    float* scratch;
+    const uint32_t* context;
+} inference_bench_sample_t;
+
+static void inference_bench_sample_op(void* ctx) {
+    inference_bench_sample_t* sample = (inference_bench_sample_t*)ctx;
+
+    // The sampler scales the logits in place, so each call starts from a copy
+    memcpy(sample->scratch, sample->logits, INFERENCE_BENCH_VOCAB_SIZE * sizeof(float));
+    inference_bench_sink += sampler_sample(sample->sampler, sample->scratch, sample->params,
+                                           sample->context, INFERENCE_BENCH_CONTEXT);
+}
+
+/**
+ * Time token sampling with greedy decoding and with the generator defaults
+ */
+static void inference_bench_run_sampling(void) {
+    static const sampler_params_t params[] = {
+        { 0.0f, 1.0f, 0, 1.0f },
+        { 0.7f, 0.9f, 40, 1.1f },
+        { 0.7f, 0.9f, 0, 1.1f }
+    };
+    static const char* param_names[] = { "greedy", "top_k_top_p", "top_p" };
+    float* logits = inference_bench_alloc(INFERENCE_BENCH_VOCAB_SIZE);
+    float* scratch = inference_bench_alloc(INFERENCE_BENCH_VOCAB_SIZE);
+    uint32_t context[INFERENCE_BENCH_CONTEXT];
+
+    if (!logits || !scratch) {
+        console_printf("Error: Failed to allocate sampling benchmark buffers\n");
+    } else {
+        inference_bench_fill(logits, INFERENCE_BENCH_VOCAB_SIZE, 8.0f, 6);
+
+        for (size_t i = 0; i < INFERENCE_BENCH_CONTEXT; i++) {
+            context[i] = (uint32_t)(i * 7919 % INFERENCE_BENCH_VOCAB_SIZE);
+        }
+
+        for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+            sampler_t sampler;
+            inference_bench_record_t record;
+
+            if (sampler_init(&sampler, INFERENCE_BENCH_VOCAB_SIZE, params[i].top_k) != 0) {
+                console_printf("Error: Failed to initialize the benchmark sampler\n");
+                continue;
+            }
+
+            inference_bench_sample_t sample = { &sampler, &params[i], logits, scratch, context };
+            uint64_t iterations;
+            uint64_t elapsed = inference_bench_time(inference_bench_sample_op, &sample, &iterations);
+
+            inference_bench_begin(&record, "sample");
+            inference_bench_add_string(&record, "params", param_names[i]);
+            inference_bench_add_uint(&record, "vocab", INFERENCE_BENCH_VOCAB_SIZE);
+            inference_bench_add_uint(&record, "iterations", iterations);
+            inference_bench_add_uint(&record, "ns_per_call", elapsed / iterations);
+            inference_bench_end(&record);
+
+            sampler_free(&sampler);
+        }
+    }
+
+    if (logits) {
+        memory_free(logits, INFERENCE_BENCH_VOCAB_SIZE * sizeof(float));
+    }
+    if (scratch) {
+        memory_free(scratch, INFERENCE_BENCH_VOCAB_SIZE * sizeof(float));
+    }
+}
+
+// Tokenizer
+
+typedef struct {
+    bpe_t* bpe;
+    const char* text;
+    size_t len;
+    uint32_t* ids;
+    size_t num_ids;
+} inference_bench_encode_t;
+
+static void inference_bench_encode_op(void* ctx) {
+    inference_bench_encode_t* encode = (inference_bench_encode_t*)ctx;
+
+    bpe_encode(encode->bpe, encode->text, encode->len, encode->ids, encode->len, &encode->num_ids);
+}
+
+/**
+ * Write the byte-level form of a byte (the GPT-2 alphabet)
+ *
+ * @param byte: Byte
+ * @param out: Buffer of at least 2 bytes
+ * @return Length of the UTF-8 form
+ */
+static size_t inference_bench_byte_text(uint32_t byte, char* out) {
+    uint32_t cp = byte;
+
+    // Bytes outside the printable ranges are shifted past 255, in order
+    if (!((byte >= 33 && byte <= 126) || (byte >= 161 && byte <= 172) || byte >= 174)) {
+        cp = 256;
+        for (uint32_t b = 0; b < byte; b++) {
+            if (!((b >= 33 && b <= 126) || (b >= 161 && b <= 172) || b >= 174)) {
+                cp++;
+            }
+        }
+    }
+
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+
+    return 2;
+}
+
+/**
+ * Time BPE encoding of English text with a small byte-level vocabulary
+ *
+ * The vocabulary holds the 256 byte tokens and the tokens of
+ * inference_bench_merges, whose merges are handed to bpe_init as the
+ * tokenizer.json it would otherwise parse.
+ */
+static void inference_bench_run_tokenizer(void) {
+    size_t json_size = 64 + INFERENCE_BENCH_NUM_MERGES * 16;
+    size_t text_len = INFERENCE_BENCH_TEXT_SIZE;
+    char* json = (char*)memory_alloc(json_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    char* text = (char*)memory_alloc(text_len, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    uint32_t* ids = (uint32_t*)memory_alloc(text_len * sizeof(uint32_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    vocab_t vocab;
+    bpe_t bpe;
+    int have_vocab = 0;
+
+    if (!json || !text || !ids) {
+        console_printf("Error: Failed to allocate tokenizer benchmark buffers\n");
+        goto out;
+    }
+
+    if (vocab_init(&vocab, 256 + INFERENCE_BENCH_NUM_MERGES, 1024) != 0) {
+        console_printf("Error: Failed to initialize the benchmark vocabulary\n");
+        goto out;
+    }
+    have_vocab = 1;
+
+    for (uint32_t b = 0; b < 256; b++) {
+        char token[2];
+
+        vocab_add(&vocab, token, inference_bench_byte_text(b, token), b);
+    }
+
+    // {"model":{"merges":["a b", ...]}} and the merged tokens
+    size_t json_len = 0;
+    const char* head = "{\"model\":{\"merges\":[";
+
+    memcpy(json, head, strlen(head));
+    json_len = strlen(head);
+
+    for (size_t i = 0; i < INFERENCE_BENCH_NUM_MERGES; i++) {
+        const char* left = inference_bench_merges[i][0];
+        const char* right = inference_bench_merges[i][1];
+        size_t left_len = strlen(left);
+        size_t right_len = strlen(right);
+        char merged[16];
+
+        memcpy(merged, left, left_len);
+        memcpy(merged + left_len, right, right_len);
+        vocab_add(&vocab, merged, left_len + right_len, 256 + (uint32_t)i);
+
+        json[json_len++] = i ? ',' : '"';
+        if (i) {
+            json[json_len++] = '"';
+        }
+        memcpy(json + json_len, left, left_len);
+        json_len += left_len;
+        json[json_len++] = ' ';
+        memcpy(json + json_len, right, right_len);
+        json_len += right_len;
+        json[json_len++] = '"';
+    }
+
+    memcpy(json + json_len, "]}}", 3);
+    json_len += 3;
+
+    if (bpe_init(&bpe, &vocab, json, json_len) != 0) {
+        console_printf("Error: Failed to initialize the benchmark BPE encoder\n");
+        goto out;
+    }
+
+    for (size_t i = 0; i < text_len; i++) {
+        text[i] = inference_bench_text[i % (sizeof(inference_bench_text) - 1)];
+    }
+
+    inference_bench_encode_t encode = { &bpe, text, text_len, ids, 0 };
+    inference_bench_record_t record;
+    uint64_t iterations;
+    uint64_t elapsed = inference_bench_time(inference_bench_encode_op, &encode, &iterations);
+
+    inference_bench_begin(&record, "tokenize");
+    inference_bench_add_uint(&record, "bytes", text_len);
+    inference_bench_add_uint(&record, "tokens", encode.num_ids);
+    inference_bench_add_uint(&record, "iterations", iterations);
+    inference_bench_add_uint(&record, "mb_per_s", (uint64_t)text_len * iterations * 1000 / elapsed);
+    // tokens / ns * 10^9 = tokens/s
+    inference_bench_add_uint(&record, "tokens_per_s", (uint64_t)encode.num_ids * iterations * 1000000000ULL / elapsed);
+    inference_bench_end(&record);
+
+    bpe_free(&bpe);
+
+out:
+    if (have_vocab) {
+        vocab_free(&vocab);
+    }
+    if (json) {
+        memory_free(json, json_size);
+    }
+    if (text) {
+        memory_free(text, text_len);
+    }
+    if (ids) {
+        memory_free(ids, text_len * sizeof(uint32_t));
+    }
+}
+
+// memcpy
+
+typedef struct {
+    void* dest;
+    const void* src;
+    size_t size;
+} inference_bench_copy_t;
+
+static void inference_bench_copy_op(void* ctx) {
+    inference_bench_copy_t* copy = (inference_bench_copy_t*)ctx;
+
+    memcpy(copy->dest, copy->src, copy->size);
+}
+
+/**
+ * Time memcpy from cache-sized to memory-sized blocks
+ */
+static void inference_bench_run_memcpy(void) {
+    uint8_t* src = (uint8_t*)memory_alloc(INFERENCE_BENCH_MAX_COPY_SIZE, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    uint8_t* dest = (uint8_t*)memory_alloc(INFERENCE_BENCH_MAX_COPY_SIZE, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!src || !dest) {
+        console_printf("Error: Failed to allocate memcpy benchmark buffers\n");
+    } else {
+        memset(src, 0x5A, INFERENCE_BENCH_MAX_COPY_SIZE);
+
+        for (size_t i = 0; i < INFERENCE_BENCH_NUM_COPY_SIZES; i++) {
+            inference_bench_copy_t copy = { dest, src, inference_bench_copy_sizes[i] };
+            inference_bench_record_t record;
+            uint64_t iterations;
+            uint64_t elapsed = inference_bench_time(inference_bench_copy_op, &copy, &iterations);
+
+            inference_bench_sink += dest[0];
+
+            inference_bench_begin(&record, "memcpy");
+            inference_bench_add_uint(&record, "bytes", copy.size);
+            inference_bench_add_uint(&record, "iterations", iterations);
+            inference_bench_add_uint(&record, "mb_per_s", (uint64_t)copy.size * iterations * 1000 / elapsed);
+            inference_bench_end(&record);
+        }
+    }
+
+    if (src) {
+        memory_free(src, INFERENCE_BENCH_MAX_COPY_SIZE);
+    }
+    if (dest) {
+        memory_free(dest, INFERENCE_BENCH_MAX_COPY_SIZE);
+    }
+}
+
+// End to end
+
+typedef struct {
+    uint64_t first_ns;          // Time of the first token
+    uint64_t last_ns;           // Time of the last token
+    uint32_t tokens;
+    size_t peak_used;           // Highest heap use seen
+} inference_bench_generation_t;
+
+/**
+ * Record the memory in use each time the generator streams a token
+ */
+static void inference_bench_sample_memory(inference_bench_generation_t* generation) {
+    size_t total, used, available;
+
+    memory_get_stats(&total, &used, &available);
+
+    if (used > generation->peak_used) {
+        generation->peak_used = used;
+    }
+}
+
+static int inference_bench_generate_callback(const char* text, size_t len, void* user_data) {
+    inference_bench_generation_t* generation = (inference_bench_generation_t*)user_data;
+    uint64_t now = timer_now_ns();
+
+    (void)text;
+    (void)len;
+
+    if (generation->tokens++ == 0) {
+        generation->first_ns = now;
+    }
+    generation->last_ns = now;
+
+    inference_bench_sample_memory(generation);
+
+    return 0;
+}
+
+/**
+ * Load a model and time a streamed generation
+ *
+ * The time to first token covers tokenizing the prompt, the prefill and the
+ * first decode step; the decode rate covers the tokens after the first. The
+ * peak is the heap in use, sampled after loading and at every token.
+ */
+static void inference_bench_run_generate(void) {
+    inference_bench_generation_t generation = { 0, 0, 0, 0 };
+    inference_bench_record_t record;
+    nn_model_id_t id;
+    size_t total, used_before, available;
+    char* output = (char*)memory_alloc(INFERENCE_BENCH_MAX_TOKENS * 64, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    inference_bench_begin(&record, "generate");
+    inference_bench_add_string(&record, "model", INFERENCE_BENCH_MODEL_PATH);
+
+    if (!output) {
+        console_printf("Error: Failed to allocate the generation benchmark output\n");
+        inference_bench_add_string(&record, "status", "skipped");
+        inference_bench_end(&record);
+        return;
+    }
+
+    memory_get_stats(&total, &used_before, &available);
+
+    uint64_t load_start = timer_now_ns();
+
+    if (nn_load_model(NN_MODEL_TYPE_DEEPSEEK, "inference-bench", INFERENCE_BENCH_MODEL_PATH, &id) != 0) {
+        inference_bench_add_string(&record, "status", "skipped");
+        inference_bench_end(&record);
+        memory_free(output, INFERENCE_BENCH_MAX_TOKENS * 64);
+        return;
+    }
+
+    uint64_t load_ns = timer_now_ns() - load_start;
+
+    inference_bench_sample_memory(&generation);
+
+    uint64_t start = timer_now_ns();
+    int result = nn_generate_stream(id, INFERENCE_BENCH_PROMPT, output, INFERENCE_BENCH_MAX_TOKENS * 64,
+                                    INFERENCE_BENCH_MAX_TOKENS, 0.7f, 0.9f, 40.0f, 1.1f,
+                                    inference_bench_generate_callback, &generation);
+    uint64_t elapsed = timer_now_ns() - start;
+
+    if (result != 0 || generation.tokens == 0) {
+        inference_bench_add_string(&record, "status", "failed");
+    } else {
+        uint64_t decode_ns = generation.last_ns - generation.first_ns;
+
+        inference_bench_add_string(&record, "status", "ok");
+        inference_bench_add_uint(&record, "prompt_bytes", sizeof(INFERENCE_BENCH_PROMPT) - 1);
+        inference_bench_add_uint(&record, "tokens", generation.tokens);
+        inference_bench_add_uint(&record, "load_us", load_ns / 1000);
+        inference_bench_add_uint(&record, "ttft_us", (generation.first_ns - start) / 1000);
+        inference_bench_add_uint(&record, "total_us", elapsed / 1000);
+
+        // Thousandths of a token per second, so slow CPUs still show a rate
+        if (generation.tokens > 1 && decode_ns > 0) {
+            inference_bench_add_uint(&record, "decode_mtokens_per_s", (uint64_t)(generation.tokens - 1) * 1000000000000ULL / decode_ns);
+            inference_bench_add_uint(&record, "decode_us_per_token", decode_ns / (generation.tokens - 1) / 1000);
+        }
+
+        inference_bench_add_uint(&record, "peak_kb", generation.peak_used / 1024);
+        inference_bench_add_uint(&record, "peak_over_boot_kb", (generation.peak_used - used_before) / 1024);
+    }
+
+    inference_bench_end(&record);
+
+    nn_unload_model(id);
+    memory_free(output, INFERENCE_BENCH_MAX_TOKENS * 64);
+}
+
+/**
+ * Run the benchmark and print the results on the console
+ */
+void inference_bench_run(void) {
+    inference_bench_file = fopen(INFERENCE_BENCH_OUTPUT, "w");
+
+    console_printf("Inference benchmark (JSON lines prefixed with \"%s\")\n", INFERENCE_BENCH_PREFIX);
+
+    inference_bench_run_gemm();
+    inference_bench_run_gemv();
+    inference_bench_run_softmax();
+    inference_bench_run_sampling();
+    inference_bench_run_tokenizer();
+    inference_bench_run_memcpy();
+    inference_bench_run_generate();
+
+    if (inference_bench_file) {
+        fclose(inference_bench_file);
+        inference_bench_file = NULL;
+    }
+}
+
+#endif // NEUROOS_INFERENCE_BENCH
@@ -86,11 +86,23 @@ IRQ 13, 45  ; FPU / Coprocessor / Inter-processor
 IRQ 14, 46  ; Primary ATA hard disk
 IRQ 15, 47  ; Secondary ATA hard disk
 
+; Define the local APIC interrupts
+IRQ 16, 48  ; Local APIC timer (scheduler tick of the APs)
+IRQ 17, 49  ; Reschedule inter-processor interrupt
+
+; Spurious local APIC interrupts are not acknowledged
+global irq_spurious
+irq_spurious:
+    iret
+
 ; Common ISR stub
 isr_common_stub:
     ; Save all registers
     pusha
     
+    ; The C handlers expect the direction flag clear (System V ABI)
+    cld
+    
     ; Save data segment
     mov ax, ds
     push eax
@@ -126,6 +138,9 @@ irq_common_stub:
     ; Save all registers
     pusha
     
+    ; The C handlers expect the direction flag clear (System V ABI)
+    cld
+    
     ; Save data segment
     mov ax, ds
     push eax
@@ -7,6 +7,8 @@
 
 #include "include/interrupts.h"
 #include "include/console.h"
+#include "include/memory.h"
+#include "include/smp.h"
 #include <string.h>
 
 // Number of IDT entries
@@ -100,12 +102,16 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void irq16(void);
+extern void irq17(void);
+extern void irq_spurious(void);
 
 // Forward declarations
 static void idt_init(void);
 static void pic_init(void);
 static void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
 void outb(uint16_t port, uint8_t value);
+uint8_t inb(uint16_t port);
 
 /**
  * Initialize the interrupt handling subsystem
@@ -206,10 +212,22 @@ static void idt_init(void) {
     idt_set_gate(46, (uint32_t)(uintptr_t)irq14, 0x08, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_32BIT);
     idt_set_gate(47, (uint32_t)(uintptr_t)irq15, 0x08, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_32BIT);
     
+    // Set up the local APIC handlers
+    idt_set_gate(SMP_VECTOR_TIMER, (uint32_t)(uintptr_t)irq16, 0x08, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_32BIT);
+    idt_set_gate(SMP_VECTOR_RESCHEDULE, (uint32_t)(uintptr_t)irq17, 0x08, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_32BIT);
+    idt_set_gate(SMP_VECTOR_SPURIOUS, (uint32_t)(uintptr_t)irq_spurious, 0x08, IDT_FLAG_PRESENT | IDT_FLAG_RING0 | IDT_FLAG_32BIT);
+    
     // Load the IDT
     idt_flush((uint32_t)(uintptr_t)&idt_ptr);
 }
 
+/**
+ * Load the shared IDT on an application processor
+ */
+void interrupts_init_ap(void) {
+    idt_flush((uint32_t)(uintptr_t)&idt_ptr);
+}
+
 /**
  * Initialize the Programmable Interrupt Controller (PIC)
  */
@@ -244,6 +262,29 @@ static void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t
  * @param regs: Registers state
  */
 void isr_handler(registers_t* regs) {
+    // Demand paging of file mappings
+    if (regs->int_no == INT_PAGE_FAULT) {
+        uintptr_t fault_addr;
+        
+        __asm__ volatile("mov %%cr2, %0" : "=r"(fault_addr));
+        
+        // The fault is synchronous; let the timer run while the page is read
+        // so a prefetch holding the mapping lock can finish
+        if (regs->eflags & 0x200) {
+            interrupts_enable();
+        }
+        
+        if (memory_handle_page_fault(fault_addr, regs->err_code) == 0) {
+            return;
+        }
+        
+        if (!interrupt_handlers[INT_PAGE_FAULT]) {
+            console_printf("Page fault at %p (error 0x%x, eip 0x%x)\n",
+                           (void*)fault_addr, regs->err_code, regs->eip);
+            return;
+        }
+    }
+    
     // Check if we have a handler for this interrupt
     if (interrupt_handlers[regs->int_no]) {
         interrupt_handler_t handler = interrupt_handlers[regs->int_no];
@@ -259,6 +300,17 @@ void isr_handler(registers_t* regs) {
  * @param regs: Registers state
  */
 void irq_handler(registers_t* regs) {
+    // Local APIC interrupts are acknowledged at the local APIC
+    if (regs->int_no >= SMP_VECTOR_TIMER) {
+        smp_lapic_eoi();
+        
+        if (interrupt_handlers[regs->int_no]) {
+            interrupt_handlers[regs->int_no]();
+        }
+        
+        return;
+    }
+    
     // Send an EOI (End of Interrupt) to the PICs
     if (regs->int_no >= 40) {
         // Send reset signal to slave PIC
@@ -332,6 +384,34 @@ int interrupts_are_enabled(void) {
     return (flags & 0x200) ? 1 : 0;
 }
 
+/**
+ * Enable an IRQ
+ * 
+ * @param irq: IRQ number
+ */
+void interrupts_enable_irq(uint8_t irq) {
+    if (irq < 8) {
+        outb(0x21, inb(0x21) & ~(1 << irq));
+    } else if (irq < 16) {
+        // Slave IRQs also need the cascade line of the master
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        outb(0x21, inb(0x21) & ~(1 << IRQ_CASCADE));
+    }
+}
+
+/**
+ * Disable an IRQ
+ * 
+ * @param irq: IRQ number
+ */
+void interrupts_disable_irq(uint8_t irq) {
+    if (irq < 8) {
+        outb(0x21, inb(0x21) | (1 << irq));
+    } else if (irq < 16) {
+        outb(0xA1, inb(0xA1) | (1 << (irq - 8)));
+    }
+}
+
 /**
  * Port I/O functions
  */
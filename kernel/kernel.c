@@ -8,23 +8,37 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "include/console.h"
+#include "include/cpu.h"
 #include "include/memory.h"
 #include "include/interrupts.h"
 #include "include/process.h"
+#include "include/smp.h"
+#include "include/timer.h"
 #include "include/sandbox.h"
 #include "include/backup.h"
 #include "include/network.h"
 #include "include/ai_interface.h"
+#include "include/libc_bench.h"
+#include "include/inference_bench.h"
+#include "include/page_cache.h"
+#include "include/trace.h"
 
 // Kernel information
 #define NEUROOS_VERSION "0.1.0"
 #define KERNEL_NAME "NeuroOS"
 
+// Free physical pages zeroed per idle loop iteration
+#define KERNEL_IDLE_ZERO_PAGES 64
+
 // Forward declarations
 void init_early_console(void);
+void init_cpu(void);
 void init_memory_management(void);
 void init_interrupts(void);
 void init_process_management(void);
+void init_smp(void);
+void init_timers(void);
+void init_console_log(void);
 void init_filesystem(void);
 void init_drivers(void);
 void init_networking(void);
@@ -56,6 +70,11 @@ void kernel_main(uint32_t multiboot_magic, void* multiboot_info) {
     console_write("\n");
     console_write("Initializing kernel components...\n");
     
+    // Initialize CPU features (FPU/SSE/AVX state)
+    console_write("Initializing CPU features... ");
+    init_cpu();
+    console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
+    
     // Initialize memory management
     console_write("Initializing memory management... ");
     init_memory_management();
@@ -71,6 +90,21 @@ void kernel_main(uint32_t multiboot_magic, void* multiboot_info) {
     init_process_management();
     console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
     
+    // Start the application processors
+    console_write("Starting application processors... ");
+    init_smp();
+    console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
+    
+    // Initialize the clock and timers
+    console_write("Initializing timers... ");
+    init_timers();
+    console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
+    
+    // Hand the screen updates to the console flusher
+    console_write("Starting console log flusher... ");
+    init_console_log();
+    console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
+    
     // Initialize filesystem
     console_write("Initializing filesystem... ");
     init_filesystem();
@@ -102,12 +136,28 @@ void kernel_main(uint32_t multiboot_magic, void* multiboot_info) {
     console_write_color("DONE\n", CONSOLE_COLOR_GREEN);
     
     console_write("\nKernel initialization complete.\n");
+    
+#ifdef NEUROOS_LIBC_BENCH
+    // Compare the libc memory and math functions against the reference versions
+    libc_bench_run();
+#endif
+    
+#ifdef NEUROOS_INFERENCE_BENCH
+    // Time the inference kernels and a generation, printing JSON result lines
+    inference_bench_run();
+#endif
+    
     console_write("Starting system...\n");
     
-    // Enter the main kernel loop
+    // Enter the main kernel loop (the idle loop of the BSP)
     while (1) {
-        // This will be replaced with actual scheduling and process management
-        // For now, just halt the CPU
+        // Run the ready processes of the BSP
+        process_yield();
+        
+        // Zero freed physical pages while there is nothing else to do
+        memory_reclaim_physical(KERNEL_IDLE_ZERO_PAGES);
+        
+        // Halt until the next timer or reschedule interrupt
         __asm__ volatile("hlt");
     }
 }
@@ -122,6 +172,11 @@ void init_early_console(void) {
     console_init();
 }
 
+void init_cpu(void) {
+    // Detect CPU features and enable the FPU/SIMD state
+    cpu_init();
+}
+
 void init_memory_management(void) {
     // This will be implemented in memory.c
 }
@@ -134,8 +189,28 @@ void init_process_management(void) {
     // This will be implemented in process.c
 }
 
+void init_smp(void) {
+    // Bring up the APs; each one schedules from its own run queues
+    smp_init();
+}
+
+void init_timers(void) {
+    // Switch to one-shot timers once the local APIC timer is calibrated
+    timer_init();
+    
+    // Trace events are stamped with the calibrated TSC, one ring per CPU
+    trace_init();
+}
+
+void init_console_log(void) {
+    // Writers only log from here on; the flusher process draws the screen
+    console_start_flusher();
+}
+
 void init_filesystem(void) {
-    // This will be implemented in filesystem.c
+    // File I/O goes through the page cache; the filesystem driver registers
+    // itself as its backend
+    page_cache_init();
 }
 
 void init_drivers(void) {
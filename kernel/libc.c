@@ -8,6 +8,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include "include/cpu.h"
+#include "include/page_cache.h"
 
 // Type definitions
 typedef int pid_t;
@@ -17,6 +19,40 @@ typedef unsigned int socklen_t;
 typedef unsigned int time_t;
 typedef int clockid_t;
 
+// Copies and fills of at least this many bytes use non-temporal stores (with
+// SSE2), so a large block does not evict the working set from the cache
+#define LIBC_NT_THRESHOLD (256 * 1024)
+
+// Memory functions copy short blocks and tails byte by byte; keep GCC from
+// turning those loops back into calls to themselves
+#define LIBC_NO_LOOP_CALLS __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+// Unaligned 32-bit access (x86 allows it)
+typedef uint32_t __attribute__((may_alias, aligned(1))) libc_word_t;
+
+// Exp/log polynomial constants (Cephes expf/logf)
+#define LIBC_EXP_HI       88.3762626647949f
+#define LIBC_EXP_LO      -88.3762626647949f
+#define LIBC_LOG2E        1.44269504088896341f
+#define LIBC_LN2_HI       0.693359375f
+#define LIBC_LN2_LO      -2.12194440e-4f
+#define LIBC_EXP_P0       1.9875691500e-4f
+#define LIBC_EXP_P1       1.3981999507e-3f
+#define LIBC_EXP_P2       8.3334519073e-3f
+#define LIBC_EXP_P3       4.1665795894e-2f
+#define LIBC_EXP_P4       1.6666665459e-1f
+#define LIBC_EXP_P5       5.0000001201e-1f
+#define LIBC_SQRTHF       0.707106781186547524f
+#define LIBC_LOG_P0       7.0376836292e-2f
+#define LIBC_LOG_P1      -1.1514610310e-1f
+#define LIBC_LOG_P2       1.1676998740e-1f
+#define LIBC_LOG_P3      -1.2420140846e-1f
+#define LIBC_LOG_P4       1.4249322787e-1f
+#define LIBC_LOG_P5      -1.6668057665e-1f
+#define LIBC_LOG_P6       2.0000714765e-1f
+#define LIBC_LOG_P7      -2.4999993993e-1f
+#define LIBC_LOG_P8       3.3333331174e-1f
+
 // Forward declarations for functions
 int strncmp(const char* s1, const char* s2, size_t n);
 size_t strspn(const char* s, const char* accept);
@@ -77,12 +113,18 @@ struct rlimit {
     unsigned long rlim_max;
 };
 
+// Streams open at once
+#define LIBC_MAX_FILES 64
+
 // FILE structure definition
 typedef struct {
     int fd;
-    // Add other fields as needed
+    page_cache_file_t* file;        // NULL if the stream is not open
 } FILE;
 
+// Stream table
+static FILE libc_files[LIBC_MAX_FILES];
+
 // Global variables
 FILE* stdin = NULL;
 FILE* stdout = NULL;
@@ -158,6 +200,16 @@ char* strchr(const char* s, int c) {
     return (char*)s;
 }
 
+char* strrchr(const char* s, int c) {
+    const char* last = NULL;
+    do {
+        if (*s == (char)c) {
+            last = s;
+        }
+    } while (*s++);
+    return (char*)last;
+}
+
 char* strdup(const char* s) {
     size_t len = strlen(s) + 1;
     char* new_str = malloc(len);
@@ -251,40 +303,149 @@ char* strncat(char* dest, const char* src, size_t n) {
 
 // Memory functions
 
-void* memcpy(void* dest, const void* src, size_t n) {
-    char* d = (char*)dest;
-    const char* s = (const char*)src;
-    
-    while (n--) {
-        *d++ = *s++;
+/**
+ * Copy words with non-temporal stores
+ *
+ * movnti stores from general-purpose registers, so no SSE register state
+ * is touched (interrupt handlers do not save it).
+ *
+ * @param dest: Destination (4-byte aligned)
+ * @param src: Source
+ * @param words: Number of 32-bit words
+ */
+static void libc_copy_nt(void* dest, const void* src, size_t words) {
+    uint32_t* d = (uint32_t*)dest;
+    const libc_word_t* s = (const libc_word_t*)src;
+
+    for (; words >= 4; words -= 4, d += 4, s += 4) {
+        uint32_t w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3];
+        __asm__ volatile("movnti %1, %0" : "=m" (d[0]) : "r" (w0));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[1]) : "r" (w1));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[2]) : "r" (w2));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[3]) : "r" (w3));
     }
-    
-    return dest;
+
+    for (; words > 0; words--, d++, s++) {
+        uint32_t w = *s;
+        __asm__ volatile("movnti %1, %0" : "=m" (*d) : "r" (w));
+    }
+
+    // Order the weakly-ordered stores before anything that follows
+    __asm__ volatile("sfence" : : : "memory");
 }
 
-void* memmove(void* dest, const void* src, size_t n) {
-    char* d = (char*)dest;
-    const char* s = (const char*)src;
-    
-    if (d < s) {
-        while (n--) {
+/**
+ * Fill words with non-temporal stores
+ *
+ * @param dest: Destination (4-byte aligned)
+ * @param word: Fill pattern
+ * @param words: Number of 32-bit words
+ */
+static void libc_fill_nt(void* dest, uint32_t word, size_t words) {
+    uint32_t* d = (uint32_t*)dest;
+
+    for (; words >= 4; words -= 4, d += 4) {
+        __asm__ volatile("movnti %1, %0" : "=m" (d[0]) : "r" (word));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[1]) : "r" (word));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[2]) : "r" (word));
+        __asm__ volatile("movnti %1, %0" : "=m" (d[3]) : "r" (word));
+    }
+
+    for (; words > 0; words--, d++) {
+        __asm__ volatile("movnti %1, %0" : "=m" (*d) : "r" (word));
+    }
+
+    __asm__ volatile("sfence" : : : "memory");
+}
+
+/**
+ * Copy forward: bytes up to a word-aligned destination, then whole words
+ *
+ * Safe for overlapping blocks with dest below src.
+ *
+ * @param dest: Destination
+ * @param src: Source
+ * @param n: Number of bytes
+ * @param allow_nt: Whether large blocks may use non-temporal stores
+ */
+static LIBC_NO_LOOP_CALLS void libc_copy_forward(void* dest, const void* src, size_t n, int allow_nt) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+
+    if (n >= 16) {
+        size_t head = (size_t)(-(uintptr_t)d & 3);
+        n -= head;
+
+        while (head--) {
             *d++ = *s++;
         }
-    } else {
-        d += n;
-        s += n;
-        while (n--) {
-            *--d = *--s;
+
+        size_t words = n / 4;
+
+        if (allow_nt && n >= LIBC_NT_THRESHOLD && cpu_has_feature(CPU_FEATURE_SSE2)) {
+            libc_copy_nt(d, s, words);
+            d += words * 4;
+            s += words * 4;
+        } else {
+            __asm__ volatile("rep movsl" : "+D" (d), "+S" (s), "+c" (words) : : "memory");
         }
+
+        n &= 3;
     }
-    
+
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+LIBC_NO_LOOP_CALLS void* memcpy(void* dest, const void* src, size_t n) {
+    libc_copy_forward(dest, src, n, 1);
+
     return dest;
 }
 
-int memcmp(const void* s1, const void* s2, size_t n) {
+LIBC_NO_LOOP_CALLS void* memmove(void* dest, const void* src, size_t n) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+
+    // A forward copy is safe unless dest starts inside src
+    if (d <= s || d >= s + n) {
+        libc_copy_forward(dest, src, n, d + n <= s || d >= s + n);
+        return dest;
+    }
+
+    // Copy backward: the unaligned tail first, then whole words downward
+    d += n;
+    s += n;
+
+    while (n & 3) {
+        *--d = *--s;
+        n--;
+    }
+
+    // A plain loop rather than std/rep movsl: an interrupt taken inside the
+    // string instruction would otherwise run its handler with DF set
+    while (n >= 4) {
+        d -= 4;
+        s -= 4;
+        n -= 4;
+        *(libc_word_t*)d = *(const libc_word_t*)s;
+    }
+
+    return dest;
+}
+
+LIBC_NO_LOOP_CALLS int memcmp(const void* s1, const void* s2, size_t n) {
     const unsigned char* p1 = (const unsigned char*)s1;
     const unsigned char* p2 = (const unsigned char*)s2;
-    
+
+    // Skip equal words; the first difference is located byte by byte
+    while (n >= 4 && *(const libc_word_t*)p1 == *(const libc_word_t*)p2) {
+        p1 += 4;
+        p2 += 4;
+        n -= 4;
+    }
+
     while (n--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
@@ -292,47 +453,111 @@ int memcmp(const void* s1, const void* s2, size_t n) {
         p1++;
         p2++;
     }
-    
+
     return 0;
 }
 
-void* memset(void* s, int c, size_t n) {
+LIBC_NO_LOOP_CALLS void* memset(void* s, int c, size_t n) {
     unsigned char* p = (unsigned char*)s;
-    
+
+    if (n >= 16) {
+        size_t head = (size_t)(-(uintptr_t)p & 3);
+        n -= head;
+
+        while (head--) {
+            *p++ = (unsigned char)c;
+        }
+
+        uint32_t word = (uint32_t)(unsigned char)c * 0x01010101u;
+        size_t words = n / 4;
+
+        if (n >= LIBC_NT_THRESHOLD && cpu_has_feature(CPU_FEATURE_SSE2)) {
+            libc_fill_nt(p, word, words);
+            p += words * 4;
+        } else {
+            __asm__ volatile("rep stosl" : "+D" (p), "+c" (words) : "a" (word) : "memory");
+        }
+
+        n &= 3;
+    }
+
     while (n--) {
         *p++ = (unsigned char)c;
     }
-    
+
     return s;
 }
 
-void* memchr(const void* s, int c, size_t n) {
+LIBC_NO_LOOP_CALLS void* memchr(const void* s, int c, size_t n) {
     const unsigned char* p = (const unsigned char*)s;
-    
+    uint32_t pattern = (uint32_t)(unsigned char)c * 0x01010101u;
+
+    // Skip words without a matching byte (a zero byte of word ^ pattern)
+    while (n >= 4) {
+        uint32_t word = *(const libc_word_t*)p ^ pattern;
+
+        if ((word - 0x01010101u) & ~word & 0x80808080u) {
+            break;
+        }
+
+        p += 4;
+        n -= 4;
+    }
+
     while (n--) {
         if (*p == (unsigned char)c) {
             return (void*)p;
         }
         p++;
     }
-    
+
     return NULL;
 }
 
 // Math functions
 
+/**
+ * Reinterpret the bits of a float
+ */
+static inline uint32_t libc_float_bits(float x) {
+    union { float f; uint32_t u; } v = { x };
+    return v.u;
+}
+
+static inline float libc_bits_float(uint32_t u) {
+    union { uint32_t u; float f; } v = { u };
+    return v.f;
+}
+
 float expf(float x) {
-    // Simple implementation of expf using Taylor series
-    float result = 1.0f;
-    float term = 1.0f;
-    int i;
-    
-    for (i = 1; i < 20; i++) {
-        term *= x / i;
-        result += term;
+    // exp(x) = 2^n * exp(r) with r = x - n * ln2 in [-ln2/2, ln2/2], and
+    // exp(r) from a degree 5 polynomial. Branch-free apart from NaN, so
+    // loops over arrays vectorize.
+    if (x != x) {
+        return x;
     }
-    
-    return result;
+
+    x = x > LIBC_EXP_HI ? LIBC_EXP_HI : x;
+    x = x < LIBC_EXP_LO ? LIBC_EXP_LO : x;
+
+    // n = floor(x * log2e + 0.5)
+    float fx = x * LIBC_LOG2E + 0.5f;
+    float fn = (float)(int32_t)fx;
+    fn = fn > fx ? fn - 1.0f : fn;
+
+    // r = x - n * ln2 (in two parts for precision)
+    float r = x - fn * LIBC_LN2_HI - fn * LIBC_LN2_LO;
+
+    float y = LIBC_EXP_P0;
+    y = y * r + LIBC_EXP_P1;
+    y = y * r + LIBC_EXP_P2;
+    y = y * r + LIBC_EXP_P3;
+    y = y * r + LIBC_EXP_P4;
+    y = y * r + LIBC_EXP_P5;
+    y = y * r * r + r + 1.0f;
+
+    // Scale by 2^n
+    return y * libc_bits_float((uint32_t)((int32_t)fn + 127) << 23);
 }
 
 float sinf(float x) {
@@ -369,19 +594,46 @@ float powf(float x, float y) {
 }
 
 float logf(float x) {
-    // Simple implementation of logf using Taylor series
-    float result = 0.0f;
-    float term = (x - 1.0f) / (x + 1.0f);
-    float term_squared = term * term;
-    float current_term = term;
-    int i;
-    
-    for (i = 1; i <= 10; i += 2) {
-        result += current_term / i;
-        current_term *= term_squared;
+    // log(x) = e * ln2 + log(m) with m in [sqrt(0.5), sqrt(2)), and log(m)
+    // from a degree 9 polynomial
+    uint32_t bits = libc_float_bits(x);
+
+    if (x != x || bits >= 0x7F800000u) {
+        // NaN, +inf, -inf or negative
+        return (bits & 0x80000000u) ? libc_bits_float(0x7FC00000u) : x;
     }
-    
-    return 2.0f * result;
+
+    if (x == 0.0f) {
+        return libc_bits_float(0xFF800000u);
+    }
+
+    // Split off the exponent: x = m * 2^e with m in [0.5, 1)
+    float e = (float)((int32_t)((bits >> 23) & 0xFF) - 126);
+    float m = libc_bits_float((bits & 0x007FFFFFu) | 0x3F000000u);
+
+    if (m < LIBC_SQRTHF) {
+        e -= 1.0f;
+        m = m + m - 1.0f;
+    } else {
+        m = m - 1.0f;
+    }
+
+    float z = m * m;
+    float y = LIBC_LOG_P0;
+    y = y * m + LIBC_LOG_P1;
+    y = y * m + LIBC_LOG_P2;
+    y = y * m + LIBC_LOG_P3;
+    y = y * m + LIBC_LOG_P4;
+    y = y * m + LIBC_LOG_P5;
+    y = y * m + LIBC_LOG_P6;
+    y = y * m + LIBC_LOG_P7;
+    y = y * m + LIBC_LOG_P8;
+    y = y * m * z;
+
+    y += e * LIBC_LN2_LO;
+    y -= 0.5f * z;
+
+    return m + y + e * LIBC_LN2_HI;
 }
 
 float sqrtf(float x) {
@@ -429,54 +681,109 @@ void free(void* ptr) {
 // File operations
 
 FILE* fopen(const char* filename, const char* mode) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return NULL
-    (void)filename;
-    (void)mode;
-    return NULL;
+    // Files are read and written through the page cache
+    if (!filename || !mode) {
+        return NULL;
+    }
+    
+    uint32_t flags;
+    
+    switch (mode[0]) {
+        case 'r':
+            flags = PAGE_CACHE_READ;
+            break;
+        case 'w':
+            flags = PAGE_CACHE_WRITE | PAGE_CACHE_CREATE | PAGE_CACHE_TRUNCATE;
+            break;
+        case 'a':
+            flags = PAGE_CACHE_WRITE | PAGE_CACHE_CREATE | PAGE_CACHE_APPEND;
+            break;
+        default:
+            return NULL;
+    }
+    
+    for (const char* c = mode + 1; *c; c++) {
+        if (*c == '+') {
+            flags |= PAGE_CACHE_READ | PAGE_CACHE_WRITE;
+        }
+    }
+    
+    // Find a free stream
+    int fd;
+    
+    for (fd = 0; fd < LIBC_MAX_FILES; fd++) {
+        if (!__sync_lock_test_and_set(&libc_files[fd].fd, 1)) {
+            break;
+        }
+    }
+    
+    if (fd == LIBC_MAX_FILES) {
+        return NULL;
+    }
+    
+    libc_files[fd].file = page_cache_open(filename, flags);
+    
+    if (!libc_files[fd].file) {
+        __sync_lock_release(&libc_files[fd].fd);
+        return NULL;
+    }
+    
+    return &libc_files[fd];
 }
 
 int fclose(FILE* stream) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return 0
-    (void)stream;
-    return 0;
+    if (!stream || !stream->file) {
+        return -1;
+    }
+    
+    int result = page_cache_close(stream->file);
+    
+    stream->file = NULL;
+    __sync_lock_release(&stream->fd);
+    
+    return result == 0 ? 0 : -1;
 }
 
 size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return 0
-    (void)ptr;
-    (void)size;
-    (void)nmemb;
-    (void)stream;
-    return 0;
+    if (!stream || !stream->file || size == 0) {
+        return 0;
+    }
+    
+    return page_cache_read(stream->file, ptr, size * nmemb) / size;
 }
 
 size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE* stream) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return 0
-    (void)ptr;
-    (void)size;
-    (void)nmemb;
-    (void)stream;
-    return 0;
+    if (!stream || !stream->file || size == 0) {
+        return 0;
+    }
+    
+    return page_cache_write(stream->file, ptr, size * nmemb) / size;
 }
 
 int fseek(FILE* stream, long offset, int whence) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return 0
-    (void)stream;
-    (void)offset;
-    (void)whence;
-    return 0;
+    if (!stream || !stream->file) {
+        return -1;
+    }
+    
+    // SEEK_SET, SEEK_CUR and SEEK_END have the page cache values
+    return page_cache_seek(stream->file, offset, whence);
 }
 
 long ftell(FILE* stream) {
-    // This should be implemented using the kernel's filesystem
-    // For now, we'll just return 0
-    (void)stream;
-    return 0;
+    if (!stream || !stream->file) {
+        return -1;
+    }
+    
+    return (long)page_cache_tell(stream->file);
+}
+
+int fflush(FILE* stream) {
+    // A NULL stream flushes all of them
+    if (!stream) {
+        return page_cache_sync() == 0 ? 0 : -1;
+    }
+    
+    return stream->file && page_cache_flush(stream->file) == 0 ? 0 : -1;
 }
 
 // Other functions
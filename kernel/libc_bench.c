@@ -0,0 +1,285 @@
+/**
+ * libc_bench.c - Kernel libc microbenchmark for NeuroOS
+ *
+ * This file times memcpy, memset, memcmp and memchr across block sizes from
+ * a few bytes to several megabytes, and expf and logf per call, against
+ * reference copies of the byte loop and series versions libc.c used to
+ * have. Each line reports the throughput of both and the speedup.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "include/libc_bench.h"
+#include "include/console.h"
+#include "include/memory.h"
+#include "include/timer.h"
+
+#ifdef NEUROOS_LIBC_BENCH
+
+// Keep GCC from turning the reference loops into calls to the functions
+// being compared against
+#define LIBC_BENCH_REFERENCE __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+// Block sizes
+static const size_t libc_bench_sizes[] = {
+    16, 64, 256, 4096, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024
+};
+
+#define LIBC_BENCH_NUM_SIZES (sizeof(libc_bench_sizes) / sizeof(libc_bench_sizes[0]))
+#define LIBC_BENCH_MAX_SIZE (4 * 1024 * 1024)
+
+// Results are accumulated here so the calls are not optimized away
+static volatile uint32_t libc_bench_sink;
+
+// External functions
+void* memcpy(void* dest, const void* src, size_t n);
+void* memset(void* s, int c, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
+void* memchr(const void* s, int c, size_t n);
+float expf(float x);
+float logf(float x);
+
+// Reference versions
+
+static LIBC_BENCH_REFERENCE void* ref_memcpy(void* dest, const void* src, size_t n) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+
+    while (n--) {
+        *d++ = *s++;
+    }
+
+    return dest;
+}
+
+static LIBC_BENCH_REFERENCE void* ref_memset(void* s, int c, size_t n) {
+    unsigned char* p = (unsigned char*)s;
+
+    while (n--) {
+        *p++ = (unsigned char)c;
+    }
+
+    return s;
+}
+
+static LIBC_BENCH_REFERENCE int ref_memcmp(const void* s1, const void* s2, size_t n) {
+    const unsigned char* p1 = (const unsigned char*)s1;
+    const unsigned char* p2 = (const unsigned char*)s2;
+
+    while (n--) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+        p1++;
+        p2++;
+    }
+
+    return 0;
+}
+
+static LIBC_BENCH_REFERENCE void* ref_memchr(const void* s, int c, size_t n) {
+    const unsigned char* p = (const unsigned char*)s;
+
+    while (n--) {
+        if (*p == (unsigned char)c) {
+            return (void*)p;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+static LIBC_BENCH_REFERENCE float ref_expf(float x) {
+    float result = 1.0f;
+    float term = 1.0f;
+    int i;
+
+    for (i = 1; i < 20; i++) {
+        term *= x / i;
+        result += term;
+    }
+
+    return result;
+}
+
+static LIBC_BENCH_REFERENCE float ref_logf(float x) {
+    float result = 0.0f;
+    float term = (x - 1.0f) / (x + 1.0f);
+    float term_squared = term * term;
+    float current_term = term;
+    int i;
+
+    for (i = 1; i <= 10; i += 2) {
+        result += current_term / i;
+        current_term *= term_squared;
+    }
+
+    return 2.0f * result;
+}
+
+// Benchmarked operations
+typedef enum {
+    LIBC_BENCH_MEMCPY,
+    LIBC_BENCH_MEMSET,
+    LIBC_BENCH_MEMCMP,
+    LIBC_BENCH_MEMCHR
+} libc_bench_op_t;
+
+static const char* libc_bench_op_names[] = { "memcpy", "memset", "memcmp", "memchr" };
+
+/**
+ * Time one memory operation over a block size
+ *
+ * @param op: Operation
+ * @param reference: 1 for the reference version, 0 for the libc one
+ * @param dest: Destination buffer (LIBC_BENCH_MAX_SIZE bytes)
+ * @param src: Source buffer (LIBC_BENCH_MAX_SIZE bytes, equal to dest for memcmp)
+ * @param size: Block size
+ * @return Throughput in MB/s
+ */
+static uint32_t libc_bench_memory(libc_bench_op_t op, int reference, uint8_t* dest, uint8_t* src, size_t size) {
+    size_t iterations = LIBC_BENCH_BYTES / size;
+    uint32_t sink = 0;
+
+    uint64_t start = timer_now_ns();
+
+    for (size_t i = 0; i < iterations; i++) {
+        switch (op) {
+            case LIBC_BENCH_MEMCPY:
+                reference ? ref_memcpy(dest, src, size) : memcpy(dest, src, size);
+                break;
+
+            case LIBC_BENCH_MEMSET:
+                reference ? ref_memset(dest, (int)i, size) : memset(dest, (int)i, size);
+                break;
+
+            case LIBC_BENCH_MEMCMP:
+                // The buffers are equal, so the whole block is compared
+                sink += (uint32_t)(reference ? ref_memcmp(dest, src, size) : memcmp(dest, src, size));
+                break;
+
+            case LIBC_BENCH_MEMCHR:
+                // The byte does not occur, so the whole block is scanned
+                sink += (uint32_t)(uintptr_t)(reference ? ref_memchr(src, 0xFF, size) : memchr(src, 0xFF, size));
+                break;
+        }
+    }
+
+    uint64_t elapsed = timer_now_ns() - start;
+    libc_bench_sink += sink;
+
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+
+    // bytes / ns * 1000 = MB/s
+    return (uint32_t)((uint64_t)iterations * size * 1000 / elapsed);
+}
+
+/**
+ * Time one math function
+ *
+ * @param function: Function to call
+ * @param start_x: First argument
+ * @param step: Argument increment between calls
+ * @return Time per call in ns
+ */
+static uint32_t libc_bench_math(float (*function)(float), float start_x, float step) {
+    float x = start_x;
+    float sum = 0.0f;
+
+    uint64_t start = timer_now_ns();
+
+    for (int i = 0; i < LIBC_BENCH_MATH_CALLS; i++) {
+        sum += function(x);
+        x += step;
+    }
+
+    uint64_t elapsed = timer_now_ns() - start;
+    libc_bench_sink += (uint32_t)sum;
+
+    return (uint32_t)(elapsed / LIBC_BENCH_MATH_CALLS);
+}
+
+/**
+ * Print the speedup of one result over the reference as x.yy
+ */
+static void libc_bench_print_speedup(uint32_t fast, uint32_t slow, int higher_is_better) {
+    uint64_t ratio;
+
+    if (higher_is_better) {
+        ratio = slow ? (uint64_t)fast * 100 / slow : 0;
+    } else {
+        ratio = fast ? (uint64_t)slow * 100 / fast : 0;
+    }
+
+    uint32_t fraction = (uint32_t)(ratio % 100);
+    console_printf("%u.%s%u\n", (uint32_t)(ratio / 100), fraction < 10 ? "0" : "", fraction);
+}
+
+/**
+ * Run the benchmark and print the results on the console
+ */
+void libc_bench_run(void) {
+    // One extra byte lets the copies run from a misaligned source
+    uint8_t* src = (uint8_t*)memory_alloc(LIBC_BENCH_MAX_SIZE + 1, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    uint8_t* dest = (uint8_t*)memory_alloc(LIBC_BENCH_MAX_SIZE + 1, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!src || !dest) {
+        console_printf("Error: Failed to allocate libc benchmark buffers\n");
+        if (src) {
+            memory_free(src, LIBC_BENCH_MAX_SIZE + 1);
+        }
+        if (dest) {
+            memory_free(dest, LIBC_BENCH_MAX_SIZE + 1);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i <= LIBC_BENCH_MAX_SIZE; i++) {
+        src[i] = (uint8_t)(i % 251);
+    }
+
+    console_printf("libc benchmark (MB/s: libc / reference, speedup)\n");
+
+    for (int op = LIBC_BENCH_MEMCPY; op <= LIBC_BENCH_MEMCHR; op++) {
+        // memcmp compares two equal blocks
+        if (op == LIBC_BENCH_MEMCMP) {
+            memcpy(dest, src, LIBC_BENCH_MAX_SIZE + 1);
+        }
+
+        for (size_t i = 0; i < LIBC_BENCH_NUM_SIZES; i++) {
+            size_t size = libc_bench_sizes[i];
+            uint32_t fast = libc_bench_memory((libc_bench_op_t)op, 0, dest, src, size);
+            uint32_t slow = libc_bench_memory((libc_bench_op_t)op, 1, dest, src, size);
+
+            console_printf("  %s %u: %u / %u, ", libc_bench_op_names[op], (uint32_t)size, fast, slow);
+            libc_bench_print_speedup(fast, slow, 1);
+        }
+    }
+
+    // Misaligned source: the word copy aligns the destination only
+    uint32_t fast = libc_bench_memory(LIBC_BENCH_MEMCPY, 0, dest, src + 1, 64 * 1024);
+    uint32_t slow = libc_bench_memory(LIBC_BENCH_MEMCPY, 1, dest, src + 1, 64 * 1024);
+    console_printf("  memcpy 65536 (misaligned): %u / %u, ", fast, slow);
+    libc_bench_print_speedup(fast, slow, 1);
+
+    console_printf("libc benchmark (ns/call: libc / reference, speedup)\n");
+
+    // Softmax range for expf, activation and probability range for logf
+    fast = libc_bench_math(expf, -20.0f, 0.0002f);
+    slow = libc_bench_math(ref_expf, -20.0f, 0.0002f);
+    console_printf("  expf: %u / %u, ", fast, slow);
+    libc_bench_print_speedup(fast, slow, 0);
+
+    fast = libc_bench_math(logf, 0.001f, 0.0001f);
+    slow = libc_bench_math(ref_logf, 0.001f, 0.0001f);
+    console_printf("  logf: %u / %u, ", fast, slow);
+    libc_bench_print_speedup(fast, slow, 0);
+
+    memory_free(src, LIBC_BENCH_MAX_SIZE + 1);
+    memory_free(dest, LIBC_BENCH_MAX_SIZE + 1);
+}
+
+#endif // NEUROOS_LIBC_BENCH
@@ -0,0 +1,292 @@
+/**
+ * lz4.c - LZ4 block compression for NeuroOS
+ *
+ * This file implements a single-pass LZ4 block compressor and a bounds
+ * checked decompressor. The compressor hashes every 4-byte sequence into a
+ * table of recent positions and takes the first match it finds, skipping
+ * ahead faster the longer it goes without one, which keeps incompressible
+ * data cheap.
+ */
+
+#include "include/lz4.h"
+#include <string.h>
+
+// Shortest match
+#define LZ4_MIN_MATCH 4
+
+// The last match must start this many bytes before the end of the input
+#define LZ4_MF_LIMIT 12
+
+// The last bytes of the input are always literals
+#define LZ4_LAST_LITERALS 5
+
+// Largest match offset
+#define LZ4_MAX_OFFSET 65535
+
+// Misses before the match finder starts skipping ahead
+#define LZ4_SKIP_TRIGGER 6
+
+// Unaligned 32-bit access (x86 handles unaligned loads)
+typedef uint32_t __attribute__((may_alias, aligned(1))) lz4_u32_t;
+
+/**
+ * Hash the 4 bytes at a position
+ *
+ * @param p: Position
+ * @return: Table index
+ */
+static inline uint32_t lz4_hash(const uint8_t* p) {
+    return (*(const lz4_u32_t*)p * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/**
+ * Write a run length continuation (the part past the 4-bit token field)
+ *
+ * @param out: Output position
+ * @param length: Remaining length (already reduced by 15)
+ * @return: New output position
+ */
+static inline uint8_t* lz4_write_length(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+/**
+ * Emit one sequence: a literal run, followed by a match unless it is the last
+ *
+ * @param out: Output position
+ * @param out_end: End of the output buffer
+ * @param literals: Literal run
+ * @param literal_length: Length of the literal run
+ * @param offset: Match offset (0 for the last sequence)
+ * @param match_length: Match length minus LZ4_MIN_MATCH
+ * @return: New output position, or NULL if the output buffer is too small
+ */
+static uint8_t* lz4_emit(uint8_t* out, uint8_t* out_end, const uint8_t* literals, size_t literal_length,
+                         uint32_t offset, size_t match_length) {
+    // Token, length continuations, literals, offset, match continuations
+    size_t needed = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+    
+    if ((size_t)(out_end - out) < needed) {
+        return NULL;
+    }
+    
+    uint8_t* token = out++;
+    
+    if (literal_length >= 15) {
+        *token = 15 << 4;
+        out = lz4_write_length(out, literal_length - 15);
+    } else {
+        *token = (uint8_t)(literal_length << 4);
+    }
+    
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    
+    if (offset) {
+        *out++ = (uint8_t)offset;
+        *out++ = (uint8_t)(offset >> 8);
+        
+        if (match_length >= 15) {
+            *token |= 15;
+            out = lz4_write_length(out, match_length - 15);
+        } else {
+            *token |= (uint8_t)match_length;
+        }
+    }
+    
+    return out;
+}
+
+/**
+ * Compress a block
+ *
+ * @param state: Compressor state
+ * @param source: Input data
+ * @param size: Input size
+ * @param dest: Output buffer
+ * @param capacity: Output buffer size (LZ4_COMPRESS_BOUND(size) always suffices)
+ * @return: Compressed size, or 0 if the output buffer is too small
+ */
+size_t lz4_compress(lz4_state_t* state, const void* source, size_t size, void* dest, size_t capacity) {
+    const uint8_t* src = (const uint8_t*)source;
+    uint8_t* out = (uint8_t*)dest;
+    uint8_t* out_end = out + capacity;
+    const uint8_t* anchor = src;
+    
+    if (size > LZ4_MF_LIMIT) {
+        const uint8_t* ip = src + 1;
+        const uint8_t* match_limit = src + size - LZ4_MF_LIMIT;
+        const uint8_t* match_end = src + size - LZ4_LAST_LITERALS;
+        uint32_t misses = 0;
+        
+        memset(state->table, 0, sizeof(state->table));
+        
+        while (ip < match_limit) {
+            uint32_t h = lz4_hash(ip);
+            const uint8_t* ref = src + state->table[h];
+            state->table[h] = (uint32_t)(ip - src);
+            
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET ||
+                *(const lz4_u32_t*)ref != *(const lz4_u32_t*)ip) {
+                ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            
+            misses = 0;
+            
+            // Extend the match backwards into the pending literals
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            
+            // Extend the match forwards
+            const uint8_t* mp = ip + LZ4_MIN_MATCH;
+            const uint8_t* rp = ref + LZ4_MIN_MATCH;
+            
+            while (mp + 4 <= match_end && *(const lz4_u32_t*)mp == *(const lz4_u32_t*)rp) {
+                mp += 4;
+                rp += 4;
+            }
+            
+            while (mp < match_end && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            
+            out = lz4_emit(out, out_end, anchor, (size_t)(ip - anchor), (uint32_t)(ip - ref),
+                           (size_t)(mp - ip) - LZ4_MIN_MATCH);
+            
+            if (!out) {
+                return 0;
+            }
+            
+            // Index a position inside the match so the next one can chain off it
+            if (mp - 2 > src) {
+                state->table[lz4_hash(mp - 2)] = (uint32_t)(mp - 2 - src);
+            }
+            
+            ip = mp;
+            anchor = ip;
+        }
+    }
+    
+    // The remaining input goes out as the last literal run
+    out = lz4_emit(out, out_end, anchor, (size_t)(src + size - anchor), 0, 0);
+    
+    if (!out) {
+        return 0;
+    }
+    
+    return (size_t)(out - (uint8_t*)dest);
+}
+
+/**
+ * Read a run length continuation
+ *
+ * @param ip: Input position (advanced past the continuation)
+ * @param ip_end: End of the input
+ * @param length: Length to add to
+ * @return: 0 on success, -1 if the input ends inside the continuation
+ */
+static inline int lz4_read_length(const uint8_t** ip, const uint8_t* ip_end, size_t* length) {
+    uint8_t b;
+    
+    do {
+        if (*ip >= ip_end) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+    
+    return 0;
+}
+
+/**
+ * Decompress a block
+ *
+ * Malformed input is rejected: nothing is read or written outside the
+ * given buffers.
+ *
+ * @param source: Compressed data
+ * @param size: Compressed size
+ * @param dest: Output buffer
+ * @param capacity: Output buffer size
+ * @param dest_size: Pointer to store the decompressed size
+ * @return: 0 on success, -1 if the input is malformed or does not fit
+ */
+int lz4_decompress(const void* source, size_t size, void* dest, size_t capacity, size_t* dest_size) {
+    const uint8_t* ip = (const uint8_t*)source;
+    const uint8_t* ip_end = ip + size;
+    uint8_t* out = (uint8_t*)dest;
+    uint8_t* out_end = out + capacity;
+    
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        
+        // Literal run
+        size_t length = token >> 4;
+        
+        if (length == 15 && lz4_read_length(&ip, ip_end, &length) != 0) {
+            return -1;
+        }
+        
+        if (length > (size_t)(ip_end - ip) || length > (size_t)(out_end - out)) {
+            return -1;
+        }
+        
+        memcpy(out, ip, length);
+        ip += length;
+        out += length;
+        
+        // The last sequence has no match
+        if (ip == ip_end) {
+            break;
+        }
+        
+        // Match
+        if (ip_end - ip < 2) {
+            return -1;
+        }
+        
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        
+        if (offset == 0 || offset > (size_t)(out - (uint8_t*)dest)) {
+            return -1;
+        }
+        
+        length = token & 15;
+        
+        if (length == 15 && lz4_read_length(&ip, ip_end, &length) != 0) {
+            return -1;
+        }
+        
+        length += LZ4_MIN_MATCH;
+        
+        if (length > (size_t)(out_end - out)) {
+            return -1;
+        }
+        
+        const uint8_t* match = out - offset;
+        
+        if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            // Overlapping match repeats the last offset bytes
+            while (length--) {
+                *out++ = *match++;
+            }
+        }
+    }
+    
+    *dest_size = (size_t)(out - (uint8_t*)dest);
+    return 0;
+}
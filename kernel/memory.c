@@ -7,6 +7,9 @@
 
 #include "include/memory.h"
 #include "include/console.h"
+#include "include/cpu.h"
+#include "include/interrupts.h"
+#include "include/trace.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -26,6 +29,48 @@ static memory_map_entry_t default_memory_map[1] = {
 static memory_map_entry_t* memory_map_entries_array = default_memory_map;
 static size_t memory_map_entries_count = 1;
 
+// End of the kernel image (from linker.ld)
+extern char kernel_end[];
+
+// File mapping window (virtual addresses that are never identity mapped)
+#define MEMORY_MAP_WINDOW_START 0x80000000ULL
+#define MEMORY_MAP_WINDOW_END   0xE0000000ULL
+
+// Maximum number of file mappings
+#define MEMORY_MAX_FILE_MAPS 32
+
+// Pages read per file mapping fault (the faulting page and the ones after it)
+#define MEMORY_MAP_FAULT_AROUND 16
+
+// Maximum number of write watches
+#define MEMORY_MAX_WRITE_WATCHES 32
+
+// Control register bit making supervisor writes honour read-only pages
+#define CR0_WP (1 << 16)
+
+// Control register bit enabling paging
+#define CR0_PG (1u << 31)
+
+// Physical frame allocator (the identity-mapped range below the mapping window)
+#define MEMORY_MAX_FRAMES (MEMORY_MAP_WINDOW_START / 4096)
+#define MEMORY_NO_FRAME   0xFFFFFFFFu
+
+// Frame search preferences
+#define FRAME_WANT_ANY   0
+#define FRAME_WANT_CLEAN 1
+#define FRAME_WANT_DIRTY 2
+
+static uint32_t frame_used[MEMORY_MAX_FRAMES / 32];   // Allocated or reserved frames
+static uint32_t frame_dirty[MEMORY_MAX_FRAMES / 32];  // Frames that may hold stale data
+static uint32_t frame_count = 0;                      // Frames covered by the bitmaps
+static uint32_t frame_total = 0;                      // Usable frames
+static uint32_t frame_free = 0;
+static uint32_t frame_free_dirty = 0;
+static uint32_t frame_hint = 0;
+static uint32_t frame_zero_hint = 0;
+static volatile int memory_frame_lock = 0;
+static int memory_frame_irq = 0;                      // Interrupt state saved by the lock holder
+
 // Memory regions - these will be implemented in future versions
 // Currently unused but kept for API compatibility
 
@@ -36,12 +81,21 @@ static size_t memory_map_entries_count = 1;
 #define PTE_PRESENT  (1ULL << 0)
 #define PTE_WRITABLE (1ULL << 1)
 #define PTE_USER     (1ULL << 2)
+#define PTE_PWT      (1ULL << 3)
+#define PTE_PCD      (1ULL << 4)
 #define PTE_ACCESSED (1ULL << 5)
 #define PTE_DIRTY    (1ULL << 6)
 #define PTE_HUGE     (1ULL << 7)
 #define PTE_GLOBAL   (1ULL << 8)
 #define PTE_NX       (1ULL << 63)
 
+// Physical address bits of page table entries
+#define PTE_ADDR_MASK      0x000FFFFFFFFFF000ULL
+#define PTE_HUGE_ADDR_MASK 0x000FFFFFFFE00000ULL
+
+// Large page size (page directory level mapping)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 // Page table levels
 #define PT_LEVELS 4
 
@@ -55,10 +109,46 @@ typedef pte_t* pt_t;
 // Page table root (CR3)
 static pt_t page_table_root = NULL;
 
+// Large page state (large pages need the PAE paging format)
+static int memory_huge_supported = 0;
+static uint64_t memory_huge_mapped = 0;
+
+// PTE_NX when no-execute is enabled; the bit is reserved otherwise
+static uint64_t memory_nx_mask = 0;
+
 // Kernel heap
+#define MEMORY_HEAP_SIZE  (16 * 1024 * 1024)
+#define MEMORY_HEAP_PAGES (MEMORY_HEAP_SIZE / PAGE_SIZE)
+
 static void* kernel_heap_start = NULL;
 static void* kernel_heap_end = NULL;
-static void* kernel_heap_current = NULL;
+
+// Buddy allocator orders (order 0 is one page, the maximum order is the whole heap)
+#define MEMORY_BUDDY_MAX_ORDER 12
+
+// Heap page states
+#define MEMORY_PAGE_NONE      0  // Interior page of a block
+#define MEMORY_PAGE_FREE      1  // First page of a free block
+#define MEMORY_PAGE_ALLOCATED 2  // First page of an allocated block
+#define MEMORY_PAGE_SLAB      3  // Page owned by a slab
+#define MEMORY_PAGE_ALIGNED   4  // Aligned start of an allocated block
+
+// Heap page descriptor
+typedef struct {
+    uint8_t state;
+    uint8_t order;
+    int32_t next;
+    int32_t prev;
+    uint32_t head;
+    void* owner;
+} memory_page_t;
+
+static memory_page_t memory_pages[MEMORY_HEAP_PAGES];
+
+// Buddy free lists (page indices, -1 terminated)
+static int32_t buddy_free_lists[MEMORY_BUDDY_MAX_ORDER + 1];
+static uint32_t buddy_free_counts[MEMORY_BUDDY_MAX_ORDER + 1];
+static size_t buddy_free_pages = 0;
 
 // Memory allocation tracking
 typedef struct memory_allocation {
@@ -67,22 +157,141 @@ typedef struct memory_allocation {
     memory_prot_t protection;
     uint32_t flags;
     struct memory_allocation* next;
+    struct memory_allocation* prev;
 } memory_allocation_t;
 
 static memory_allocation_t* memory_allocations = NULL;
+static size_t memory_allocations_count = 0;
+
+// Large page allocations (outside the kernel heap)
+static memory_allocation_t* memory_huge_allocations = NULL;
+
+// File mapping
+typedef struct {
+    int in_use;
+    uintptr_t start;
+    size_t size;
+    size_t reserved_size;
+    uint64_t offset;
+    memory_prot_t protection;
+    memory_map_reader_t reader;
+    void* ctx;
+    size_t resident_pages;
+    uint64_t faults;
+    volatile int read_lock;
+    int busy;                   // Page fills reading the file with the lock dropped
+    int unmapping;              // Unmap waiting for the page fills to finish
+} memory_file_map_t;
+
+static memory_file_map_t memory_file_maps[MEMORY_MAX_FILE_MAPS];
+static volatile int memory_file_map_lock = 0;
+
+// Write watch
+typedef struct {
+    int in_use;
+    uintptr_t start;
+    size_t size;
+    memory_prot_t protection;       // Protection restored on the first write to a page
+    memory_write_handler_t handler;
+    void* ctx;
+    uint64_t faults;
+} memory_write_watch_t;
+
+static memory_write_watch_t memory_write_watches[MEMORY_MAX_WRITE_WATCHES];
+static volatile int memory_write_watch_lock = 0;
+
+// Slab allocator limits
+#define MEMORY_MAX_CACHES       32
+#define MEMORY_SLAB_MAX_ORDER   4
+#define MEMORY_SLAB_MIN_OBJECTS 8
+
+// Slab lists
+#define MEMORY_SLAB_EMPTY   0
+#define MEMORY_SLAB_PARTIAL 1
+#define MEMORY_SLAB_FULL    2
+
+// Slab header (stored at the start of each slab)
+typedef struct memory_slab {
+    memory_cache_t* cache;
+    struct memory_slab* next;
+    struct memory_slab* prev;
+    void* free_list;
+    uint32_t inuse;
+    uint32_t list;
+} memory_slab_t;
+
+// Slab cache
+struct memory_cache {
+    char name[32];
+    size_t object_size;
+    size_t offset;
+    uint32_t objects_per_slab;
+    uint32_t slab_order;
+    memory_slab_t* slabs[3];
+    uint32_t num_slabs;
+    uint64_t active_objects;
+    uint64_t total_allocs;
+    uint64_t total_frees;
+    int in_use;
+};
+
+static memory_cache_t memory_caches[MEMORY_MAX_CACHES];
+
+// Cache for allocation records
+static memory_cache_t* memory_record_cache = NULL;
+
+// Size classes served from slab caches by memory_alloc (32 to 2048 bytes)
+#define MEMORY_SIZE_CLASSES   7
+#define MEMORY_SIZE_CLASS_MIN 32
+#define MEMORY_SIZE_CLASS_MAX 2048
+
+static memory_cache_t* memory_size_caches[MEMORY_SIZE_CLASSES];
+
+static const char* memory_size_cache_names[MEMORY_SIZE_CLASSES] = {
+    "size-32", "size-64", "size-128", "size-256", "size-512", "size-1024", "size-2048"
+};
+
+// Heap lock (covers the buddy lists, slab caches and allocation records)
+//
+// Both allocator locks are taken with interrupts disabled on the local CPU,
+// so a holder cannot be preempted while other CPUs spin on the lock.
+static volatile int memory_heap_lock = 0;
+static int memory_heap_irq = 0;
+
+// Tracepoints
+static const trace_point_t memory_trace_alloc = { "memory_alloc", TRACE_CAT_MEMORY, { "size", "flags" } };
+static const trace_point_t memory_trace_free = { "memory_free", TRACE_CAT_MEMORY, { "addr", NULL } };
+static const trace_point_t memory_trace_fault = { "page_fault", TRACE_CAT_FAULT, { "addr", "error" } };
 
 // Forward declarations
+static int init_frame_allocator(void);
 static int init_page_tables(void);
 static int init_kernel_heap(void);
 static void* allocate_physical_page(void);
 static int map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+static int map_range(uint64_t virt_addr, uint64_t phys_addr, uint64_t size, uint64_t flags);
 static int unmap_page(uint64_t virt_addr);
+static uint64_t protection_to_entry(uint64_t entry, memory_prot_t protection);
 static void* memory_resize(void* addr, size_t old_size, size_t new_size);
+static void heap_lock(void);
+static void heap_unlock(void);
+static void buddy_list_push(uint32_t index, uint32_t order);
+static void* buddy_alloc(uint32_t order);
+static void buddy_free(void* addr);
+static memory_cache_t* cache_create_locked(const char* name, size_t object_size, size_t align);
+static void* cache_alloc_locked(memory_cache_t* cache);
+static void cache_free_locked(memory_cache_t* cache, void* obj);
 
 /**
  * Initialize the memory management subsystem
  */
 void memory_init(void) {
+    // Initialize the physical frame allocator
+    if (init_frame_allocator() != 0) {
+        console_printf("Error: Failed to initialize physical frame allocator\n");
+        return;
+    }
+    
     // Initialize the page tables
     if (init_page_tables() != 0) {
         console_printf("Error: Failed to initialize page tables\n");
@@ -102,22 +311,20 @@ void memory_init(void) {
  * Shutdown the memory management subsystem
  */
 void memory_shutdown(void) {
-    // Free all allocations
-    memory_allocation_t* curr = memory_allocations;
-    memory_allocation_t* next = NULL;
+    // Drop all allocator state
+    memory_allocations = NULL;
+    memory_allocations_count = 0;
+    memory_record_cache = NULL;
     
-    while (curr) {
-        next = curr->next;
-        free(curr);
-        curr = next;
+    for (int i = 0; i < MEMORY_SIZE_CLASSES; i++) {
+        memory_size_caches[i] = NULL;
     }
     
-    memory_allocations = NULL;
+    memset(memory_caches, 0, sizeof(memory_caches));
     
     // Reset the kernel heap
     kernel_heap_start = NULL;
     kernel_heap_end = NULL;
-    kernel_heap_current = NULL;
     
     // Reset the page table root
     page_table_root = NULL;
@@ -140,15 +347,35 @@ static int init_page_tables(void) {
     // Clear the page table root
     memset(page_table_root, 0, PAGE_SIZE);
     
-    // Identity map the first 4GB of physical memory
-    for (uint64_t addr = 0; addr < 4ULL * 1024 * 1024 * 1024; addr += PAGE_SIZE) {
-        if (map_page(addr, addr, PTE_PRESENT | PTE_WRITABLE) != 0) {
-            return -1;
-        }
+    // Identity map the first 4GB of physical memory, with large pages when available,
+    // leaving a hole for the file mapping window
+    memory_huge_supported = cpu_enable_large_pages();
+    memory_nx_mask = cpu_has_feature(CPU_FEATURE_NX) ? PTE_NX : 0;
+    
+    if (map_range(0, 0, MEMORY_MAP_WINDOW_START, PTE_PRESENT | PTE_WRITABLE) != 0) {
+        return -1;
+    }
+    
+    if (map_range(MEMORY_MAP_WINDOW_END, MEMORY_MAP_WINDOW_END, 4ULL * 1024 * 1024 * 1024 - MEMORY_MAP_WINDOW_END,
+                  PTE_PRESENT | PTE_WRITABLE) != 0) {
+        return -1;
     }
     
-    // Load the page table root into CR3
-    __asm__ volatile("movl %0, %%cr3" : : "r"((uint32_t)(uintptr_t)page_table_root) : "memory");
+    // Load the page table root into CR3. In PAE mode CR3 holds the PDPT: a
+    // 32-bit address always selects PML4 entry 0, so that level exists only
+    // in software.
+    uint32_t cr3 = (uint32_t)(uintptr_t)page_table_root;
+    
+    if (memory_huge_supported) {
+        cr3 = (uint32_t)(page_table_root[0] & PTE_ADDR_MASK);
+    }
+    
+    __asm__ volatile("movl %0, %%cr3" : : "r"(cr3) : "memory");
+    
+    // Fault on kernel writes to read-only pages too, so write watches see them
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_WP) : "memory");
     
     return 0;
 }
@@ -159,484 +386,2348 @@ static int init_page_tables(void) {
  * @return: 0 on success, -1 on failure
  */
 static int init_kernel_heap(void) {
-    // Find a suitable memory region for the kernel heap
-    uint64_t heap_start = 0;
-    uint64_t heap_size = 16 * 1024 * 1024; // 16 MB
-    
-    for (size_t i = 0; i < memory_map_entries_count; i++) {
-        if (memory_map_entries_array && memory_map_entries_array[i].type == 1 && memory_map_entries_array[i].length >= heap_size) {
-            // Found a suitable memory region
-            heap_start = memory_map_entries_array[i].base_addr;
-            break;
-        }
-    }
+    // Take a contiguous, large page aligned run of frames for the kernel heap
+    uint64_t heap_size = MEMORY_HEAP_SIZE;
+    uint64_t heap_start = memory_alloc_physical(MEMORY_HEAP_PAGES, MEMORY_ALLOC_CONTIGUOUS | MEMORY_FLAG_HUGE);
     
     if (heap_start == 0) {
         return -1;
     }
     
-    // Map the kernel heap
-    for (uint64_t addr = heap_start; addr < heap_start + heap_size; addr += PAGE_SIZE) {
-        if (map_page(addr, addr, PTE_PRESENT | PTE_WRITABLE) != 0) {
-            return -1;
-        }
+    // Map the kernel heap with the default protection of heap allocations
+    if (map_range(heap_start, heap_start, heap_size, PTE_PRESENT | PTE_WRITABLE | memory_nx_mask) != 0) {
+        return -1;
     }
     
     // Initialize the kernel heap pointers
     kernel_heap_start = (void*)(uintptr_t)heap_start;
     kernel_heap_end = (void*)(uintptr_t)(heap_start + heap_size);
-    kernel_heap_current = kernel_heap_start;
+    
+    // Hand the whole heap to the buddy allocator
+    memset(memory_pages, 0, sizeof(memory_pages));
+    
+    for (uint32_t order = 0; order <= MEMORY_BUDDY_MAX_ORDER; order++) {
+        buddy_free_lists[order] = -1;
+        buddy_free_counts[order] = 0;
+    }
+    
+    buddy_free_pages = 0;
+    
+    for (uint32_t i = 0; i < MEMORY_HEAP_PAGES; i += 1u << MEMORY_BUDDY_MAX_ORDER) {
+        buddy_list_push(i, MEMORY_BUDDY_MAX_ORDER);
+    }
+    
+    // Create the allocation record and size-class caches
+    memory_record_cache = cache_create_locked("memory_allocation_t", sizeof(memory_allocation_t), 0);
+    if (!memory_record_cache) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < MEMORY_SIZE_CLASSES; i++) {
+        size_t class_size = (size_t)MEMORY_SIZE_CLASS_MIN << i;
+        
+        memory_size_caches[i] = cache_create_locked(memory_size_cache_names[i], class_size, class_size < 64 ? class_size : 64);
+        if (!memory_size_caches[i]) {
+            return -1;
+        }
+    }
     
     return 0;
 }
 
 /**
- * Allocate a physical page
+ * Allocate a zeroed physical page for the page tables
  * 
- * @return: Pointer to the allocated page, NULL on failure
+ * @return: Pointer to the allocated page (identity mapped), NULL on failure
  */
 static void* allocate_physical_page(void) {
-    // Find a free physical page
-    for (size_t i = 0; i < memory_map_entries_count; i++) {
-        if (memory_map_entries_array && memory_map_entries_array[i].type == 1 && memory_map_entries_array[i].length >= PAGE_SIZE) {
-            // Found a free page
-            void* page = (void*)(uintptr_t)memory_map_entries_array[i].base_addr;
-            
-            // Update the memory map
-            memory_map_entries_array[i].base_addr += PAGE_SIZE;
-            memory_map_entries_array[i].length -= PAGE_SIZE;
-            
-            // Clear the page
-            memset(page, 0, PAGE_SIZE);
-            
-            return page;
+    return (void*)memory_alloc_physical(1, MEMORY_ALLOC_ZEROED);
+}
+
+/**
+ * Acquire the frame allocator lock
+ */
+static void frame_lock(void) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    
+    while (__sync_lock_test_and_set(&memory_frame_lock, 1)) {
+        while (memory_frame_lock) {
+            __asm__ volatile("pause");
         }
     }
     
-    return NULL;
+    memory_frame_irq = irq_enabled;
 }
 
 /**
- * Map a virtual address to a physical address
+ * Release the frame allocator lock
+ */
+static void frame_unlock(void) {
+    int irq_enabled = memory_frame_irq;
+    
+    __sync_lock_release(&memory_frame_lock);
+    
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Check if a frame is allocated or reserved
+ * 
+ * @param frame: Frame number
+ * @return: Non-zero if the frame is in use
+ */
+static inline uint32_t frame_test(const uint32_t* bitmap, uint32_t frame) {
+    return bitmap[frame / 32] & (1u << (frame % 32));
+}
+
+/**
+ * Initialize the physical frame allocator from the memory map
  * 
- * @param virt_addr: Virtual address
- * @param phys_addr: Physical address
- * @param flags: Page table entry flags
  * @return: 0 on success, -1 on failure
  */
-static int map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
-    // Get the page table indices
-    uint64_t pml4_idx = (virt_addr >> 39) & 0x1FF;
-    uint64_t pdpt_idx = (virt_addr >> 30) & 0x1FF;
-    uint64_t pd_idx = (virt_addr >> 21) & 0x1FF;
-    uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
+static int init_frame_allocator(void) {
+    // Everything outside the usable memory map entries is reserved
+    memset(frame_used, 0xFF, sizeof(frame_used));
+    memset(frame_dirty, 0, sizeof(frame_dirty));
     
-    // Get the PML4 entry
-    pte_t* pml4e = &page_table_root[pml4_idx];
-    pt_t pdpt = NULL;
+    frame_count = 0;
+    frame_total = 0;
+    frame_free = 0;
+    frame_free_dirty = 0;
+    frame_hint = 0;
+    frame_zero_hint = 0;
     
-    if (*pml4e & PTE_PRESENT) {
-        // PDPT already exists
-        pdpt = (pt_t)(uintptr_t)(*pml4e & ~0xFFF);
-    } else {
-        // Allocate a new PDPT
-        pdpt = (pt_t)allocate_physical_page();
-        if (!pdpt) {
-            return -1;
+    // The kernel image is loaded inside the first usable region
+    uint64_t kernel_end_frame = ((uint64_t)(uintptr_t)kernel_end + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    for (size_t i = 0; i < memory_map_entries_count; i++) {
+        if (!memory_map_entries_array || memory_map_entries_array[i].type != 1) {
+            continue;
         }
         
-        // Set the PML4 entry
-        *pml4e = (pte_t)(uintptr_t)pdpt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+        uint64_t first = (memory_map_entries_array[i].base_addr + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint64_t last = (memory_map_entries_array[i].base_addr + memory_map_entries_array[i].length) / PAGE_SIZE;
+        
+        if (first < kernel_end_frame) {
+            first = kernel_end_frame;
+        }
+        
+        if (last > MEMORY_MAX_FRAMES) {
+            last = MEMORY_MAX_FRAMES;
+        }
+        
+        // Frames come up with unknown contents, so they all start dirty
+        for (uint64_t frame = first; frame < last; frame++) {
+            frame_used[frame / 32] &= ~(1u << (frame % 32));
+            frame_dirty[frame / 32] |= 1u << (frame % 32);
+            frame_total++;
+            frame_free++;
+            frame_free_dirty++;
+        }
+        
+        if (last > frame_count) {
+            frame_count = (uint32_t)last;
+        }
     }
     
-    // Get the PDPT entry
-    pte_t* pdpte = &pdpt[pdpt_idx];
-    pt_t pd = NULL;
+    return frame_free ? 0 : -1;
+}
+
+/**
+ * Find a free frame (frame lock held)
+ * 
+ * @param want: FRAME_WANT_CLEAN, FRAME_WANT_DIRTY or FRAME_WANT_ANY
+ * @return: Frame number, MEMORY_NO_FRAME if none matches
+ */
+static uint32_t frame_find(int want) {
+    uint32_t words = (frame_count + 31) / 32;
     
-    if (*pdpte & PTE_PRESENT) {
-        // PD already exists
-        pd = (pt_t)(uintptr_t)(*pdpte & ~0xFFF);
-    } else {
-        // Allocate a new PD
-        pd = (pt_t)allocate_physical_page();
-        if (!pd) {
-            return -1;
+    for (uint32_t n = 0; n < words; n++) {
+        uint32_t w = (frame_hint + n) % words;
+        uint32_t avail = ~frame_used[w];
+        
+        if (want == FRAME_WANT_CLEAN) {
+            avail &= ~frame_dirty[w];
+        } else if (want == FRAME_WANT_DIRTY) {
+            avail &= frame_dirty[w];
         }
         
-        // Set the PDPT entry
-        *pdpte = (pte_t)(uintptr_t)pd | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+        if (avail) {
+            frame_hint = w;
+            return w * 32 + (uint32_t)__builtin_ctz(avail);
+        }
     }
     
-    // Get the PD entry
-    pte_t* pde = &pd[pd_idx];
-    pt_t pt = NULL;
-    
-    if (*pde & PTE_PRESENT) {
-        // PT already exists
-        pt = (pt_t)(uintptr_t)(*pde & ~0xFFF);
-    } else {
-        // Allocate a new PT
-        pt = (pt_t)allocate_physical_page();
-        if (!pt) {
-            return -1;
+    return MEMORY_NO_FRAME;
+}
+
+/**
+ * Find a run of contiguous free frames (frame lock held)
+ * 
+ * @param num_frames: Number of frames
+ * @param align: Alignment of the first frame, in frames
+ * @return: First frame of the run, MEMORY_NO_FRAME if none is large enough
+ */
+static uint32_t frame_find_run(size_t num_frames, uint32_t align) {
+    uint32_t run_start = 0;
+    size_t run_length = 0;
+    
+    for (uint32_t frame = 0; frame < frame_count; ) {
+        // Skip fully used words
+        if ((frame % 32) == 0 && frame_used[frame / 32] == 0xFFFFFFFF) {
+            run_length = 0;
+            frame += 32;
+            continue;
         }
         
-        // Set the PD entry
-        *pde = (pte_t)(uintptr_t)pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+        if (frame_test(frame_used, frame)) {
+            run_length = 0;
+        } else {
+            if (run_length == 0) {
+                // Runs can only start on an aligned frame
+                if (frame % align != 0) {
+                    frame += align - frame % align;
+                    continue;
+                }
+                
+                run_start = frame;
+            }
+            
+            if (++run_length == num_frames) {
+                return run_start;
+            }
+        }
+        
+        frame++;
     }
     
-    // Set the PT entry
-    pt[pt_idx] = phys_addr | flags;
-    
-    return 0;
+    return MEMORY_NO_FRAME;
 }
 
 /**
- * Unmap a virtual address
+ * Allocate physical frames
  * 
- * @param virt_addr: Virtual address
- * @return: 0 on success, -1 on failure
+ * Freed frames are only zeroed by the idle-time reclaimer, so requests
+ * without MEMORY_ALLOC_ZEROED take dirty frames first and zeroed requests
+ * take clean ones, falling back to zeroing on demand. MEMORY_FLAG_HUGE
+ * aligns the run so it can be mapped with large pages.
+ * 
+ * @param num_pages: Number of pages to allocate
+ * @param flags: Memory allocation flags
+ * @return: Physical address of the first page, 0 on failure
  */
-static int unmap_page(uint64_t virt_addr) {
-    // Get the page table indices
-    uint64_t pml4_idx = (virt_addr >> 39) & 0x1FF;
-    uint64_t pdpt_idx = (virt_addr >> 30) & 0x1FF;
-    uint64_t pd_idx = (virt_addr >> 21) & 0x1FF;
-    uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
-    
-    // Get the PML4 entry
-    pte_t* pml4e = &page_table_root[pml4_idx];
-    
-    if (!(*pml4e & PTE_PRESENT)) {
-        // Page not mapped
+uintptr_t memory_alloc_physical(size_t num_pages, memory_alloc_flags_t flags) {
+    if (num_pages == 0 || num_pages > frame_count) {
         return 0;
     }
     
-    // Get the PDPT
-    pt_t pdpt = (pt_t)(uintptr_t)(*pml4e & ~0xFFF);
-    pte_t* pdpte = &pdpt[pdpt_idx];
+    frame_lock();
     
-    if (!(*pdpte & PTE_PRESENT)) {
-        // Page not mapped
-        return 0;
-    }
+    uint32_t first = MEMORY_NO_FRAME;
     
-    // Get the PD
-    pt_t pd = (pt_t)(uintptr_t)(*pdpte & ~0xFFF);
-    pte_t* pde = &pd[pd_idx];
+    if (num_pages == 1 && !(flags & MEMORY_FLAG_HUGE)) {
+        first = frame_find((flags & MEMORY_ALLOC_ZEROED) ? FRAME_WANT_CLEAN : FRAME_WANT_DIRTY);
+        
+        if (first == MEMORY_NO_FRAME) {
+            first = frame_find(FRAME_WANT_ANY);
+        }
+    } else {
+        // A multi-page range is always returned physically contiguous
+        first = frame_find_run(num_pages, (flags & MEMORY_FLAG_HUGE) ? HUGE_PAGE_SIZE / PAGE_SIZE : 1);
+    }
     
-    if (!(*pde & PTE_PRESENT)) {
-        // Page not mapped
+    if (first == MEMORY_NO_FRAME) {
+        frame_unlock();
         return 0;
     }
     
-    // Get the PT
-    pt_t pt = (pt_t)(uintptr_t)(*pde & ~0xFFF);
-    pte_t* pte = &pt[pt_idx];
-    
-    if (!(*pte & PTE_PRESENT)) {
-        // Page not mapped
-        return 0;
+    for (uint32_t frame = first; frame < first + num_pages; frame++) {
+        frame_used[frame / 32] |= 1u << (frame % 32);
+        
+        if (frame_test(frame_dirty, frame)) {
+            frame_free_dirty--;
+        }
     }
     
-    // Unmap the page
-    *pte = 0;
+    frame_free -= (uint32_t)num_pages;
     
-    // Invalidate the TLB entry
-    __asm__ volatile("invlpg (%0)" : : "r"((uint32_t)virt_addr) : "memory");
+    frame_unlock();
     
-    return 0;
+    // The frames are ours now, so zero them outside the lock
+    for (uint32_t frame = first; frame < first + num_pages; frame++) {
+        if (!frame_test(frame_dirty, frame)) {
+            continue;
+        }
+        
+        if (flags & MEMORY_ALLOC_ZEROED) {
+            memset((void*)((uintptr_t)frame * PAGE_SIZE), 0, PAGE_SIZE);
+            __sync_fetch_and_and(&frame_dirty[frame / 32], ~(1u << (frame % 32)));
+        }
+    }
+    
+    return (uintptr_t)first * PAGE_SIZE;
 }
 
 /**
- * Allocate memory
+ * Free physical frames
  * 
- * @param size: Size of the memory to allocate
- * @param protection: Memory protection flags
- * @param flags: Memory allocation flags
- * @return: Pointer to the allocated memory, NULL on failure
+ * @param physical_addr: Physical address of the first page
+ * @param num_pages: Number of pages to free
  */
-void* memory_alloc(size_t size, memory_prot_t protection, uint32_t flags) {
-    // Check if the size is valid
-    if (size == 0) {
-        return NULL;
-    }
-    
-    // Round up the size to a multiple of the page size
-    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+void memory_free_physical(uintptr_t physical_addr, size_t num_pages) {
+    uint32_t first = (uint32_t)(physical_addr / PAGE_SIZE);
     
-    // Check if we have enough memory
-    if ((uint8_t*)kernel_heap_current + size > (uint8_t*)kernel_heap_end) {
-        return NULL;
+    if (num_pages == 0 || (physical_addr & (PAGE_SIZE - 1)) != 0 || first + num_pages > frame_count) {
+        return;
     }
     
-    // Allocate the memory
-    void* addr = kernel_heap_current;
-    kernel_heap_current = (uint8_t*)kernel_heap_current + size;
+    frame_lock();
     
-    // Set the memory protection
-    if (memory_set_protection(addr, size, protection) != 0) {
-        return NULL;
+    for (uint32_t frame = first; frame < first + num_pages; frame++) {
+        if (!frame_test(frame_used, frame)) {
+            console_printf("Error: Physical page %p freed twice\n", (void*)((uintptr_t)frame * PAGE_SIZE));
+            continue;
+        }
+        
+        // Contents are stale until the reclaimer zeroes the frame
+        frame_used[frame / 32] &= ~(1u << (frame % 32));
+        frame_dirty[frame / 32] |= 1u << (frame % 32);
+        frame_free++;
+        frame_free_dirty++;
     }
     
-    // Zero the memory if requested
-    if (flags & MEMORY_ALLOC_ZEROED) {
-        memset(addr, 0, size);
-    }
+    frame_unlock();
+}
+
+/**
+ * Zero free physical frames in the background
+ * 
+ * Called from the kernel idle loop so that zeroed allocations rarely have
+ * to clear pages themselves.
+ * 
+ * @param max_pages: Maximum number of pages to zero
+ * @return: Number of pages zeroed
+ */
+size_t memory_reclaim_physical(size_t max_pages) {
+    size_t zeroed = 0;
     
-    // Track the allocation
-    memory_allocation_t* alloc = (memory_allocation_t*)malloc(sizeof(memory_allocation_t));
-    if (!alloc) {
-        return NULL;
+    while (zeroed < max_pages) {
+        frame_lock();
+        
+        if (frame_free_dirty == 0) {
+            frame_unlock();
+            break;
+        }
+        
+        // Take a dirty frame out of circulation while it is being zeroed
+        uint32_t saved_hint = frame_hint;
+        frame_hint = frame_zero_hint;
+        uint32_t frame = frame_find(FRAME_WANT_DIRTY);
+        frame_zero_hint = frame_hint;
+        frame_hint = saved_hint;
+        
+        if (frame == MEMORY_NO_FRAME) {
+            frame_unlock();
+            break;
+        }
+        
+        frame_used[frame / 32] |= 1u << (frame % 32);
+        frame_unlock();
+        
+        memset((void*)((uintptr_t)frame * PAGE_SIZE), 0, PAGE_SIZE);
+        
+        frame_lock();
+        frame_used[frame / 32] &= ~(1u << (frame % 32));
+        frame_dirty[frame / 32] &= ~(1u << (frame % 32));
+        frame_free_dirty--;
+        frame_unlock();
+        
+        zeroed++;
+    }
+    
+    return zeroed;
+}
+
+/**
+ * Get physical memory statistics
+ * 
+ * @param total: Pointer to store the total usable memory in bytes
+ * @param used: Pointer to store the used memory in bytes
+ * @param free: Pointer to store the free memory in bytes
+ */
+void memory_get_stats(size_t* total, size_t* used, size_t* free) {
+    if (total) {
+        *total = (size_t)memory_get_total();
+    }
+    
+    if (used) {
+        *used = (size_t)memory_get_used();
+    }
+    
+    if (free) {
+        *free = (size_t)memory_get_free();
+    }
+}
+
+/**
+ * Get the total usable physical memory
+ * 
+ * @return: Total memory in bytes
+ */
+uint64_t memory_get_total(void) {
+    return (uint64_t)frame_total * PAGE_SIZE;
+}
+
+/**
+ * Get the used physical memory
+ * 
+ * @return: Used memory in bytes
+ */
+uint64_t memory_get_used(void) {
+    return (uint64_t)(frame_total - frame_free) * PAGE_SIZE;
+}
+
+/**
+ * Get the free physical memory
+ * 
+ * @return: Free memory in bytes
+ */
+uint64_t memory_get_free(void) {
+    return (uint64_t)frame_free * PAGE_SIZE;
+}
+
+/**
+ * Get the available physical memory
+ * 
+ * @return: Available memory in bytes
+ */
+uint64_t memory_get_available(void) {
+    return memory_get_free();
+}
+
+/**
+ * Get memory statistics
+ * 
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int memory_get_stats_struct(memory_stats_t* stats) {
+    if (!stats) {
+        return -1;
+    }
+    
+    memset(stats, 0, sizeof(memory_stats_t));
+    
+    stats->total = memory_get_total();
+    stats->used = memory_get_used();
+    stats->free = memory_get_free();
+    stats->available = memory_get_available();
+    stats->huge_mapped = memory_huge_mapped;
+    
+    return 0;
+}
+
+/**
+ * Flush the whole TLB
+ */
+static void flush_tlb(void) {
+    unsigned long cr3;
+    
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+/**
+ * Get the page directory entry covering a virtual address
+ * 
+ * @param virt_addr: Virtual address
+ * @param create: Whether to allocate missing page table levels
+ * @return: Pointer to the page directory entry, NULL if it does not exist
+ */
+static pte_t* walk_page_directory(uint64_t virt_addr, int create) {
+    // Get the page table indices
+    uint64_t pml4_idx = (virt_addr >> 39) & 0x1FF;
+    uint64_t pdpt_idx = (virt_addr >> 30) & 0x1FF;
+    uint64_t pd_idx = (virt_addr >> 21) & 0x1FF;
+    
+    if (!page_table_root) {
+        return NULL;
+    }
+    
+    // Get the PML4 entry
+    pte_t* pml4e = &page_table_root[pml4_idx];
+    
+    if (!(*pml4e & PTE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        
+        // Allocate a new PDPT
+        pt_t pdpt = (pt_t)allocate_physical_page();
+        if (!pdpt) {
+            return NULL;
+        }
+        
+        // Set the PML4 entry
+        *pml4e = (pte_t)(uintptr_t)pdpt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    }
+    
+    // Get the PDPT entry
+    pt_t pdpt = (pt_t)(uintptr_t)(*pml4e & PTE_ADDR_MASK);
+    pte_t* pdpte = &pdpt[pdpt_idx];
+    
+    if (!(*pdpte & PTE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        
+        // Allocate a new PD
+        pt_t pd = (pt_t)allocate_physical_page();
+        if (!pd) {
+            return NULL;
+        }
+        
+        // Set the PDPT entry (PAE PDPT entries have no access bits)
+        *pdpte = (pte_t)(uintptr_t)pd | PTE_PRESENT;
+    }
+    
+    // Get the PD entry
+    pt_t pd = (pt_t)(uintptr_t)(*pdpte & PTE_ADDR_MASK);
+    
+    return &pd[pd_idx];
+}
+
+/**
+ * Split a large page into a page table of 4 KB pages with the same mapping
+ * 
+ * @param pde: Page directory entry holding the large page
+ * @return: 0 on success, -1 on failure
+ */
+static int split_huge_page(pte_t* pde) {
+    pt_t pt = (pt_t)allocate_physical_page();
+    if (!pt) {
+        return -1;
+    }
+    
+    uint64_t base = *pde & PTE_HUGE_ADDR_MASK;
+    uint64_t flags = *pde & ~PTE_HUGE_ADDR_MASK & ~PTE_HUGE;
+    
+    for (int i = 0; i < PT_ENTRIES; i++) {
+        pt[i] = (base + (uint64_t)i * PAGE_SIZE) | flags;
+    }
+    
+    *pde = (pte_t)(uintptr_t)pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    memory_huge_mapped -= HUGE_PAGE_SIZE;
+    
+    flush_tlb();
+    
+    return 0;
+}
+
+/**
+ * Map a virtual address to a physical address
+ * 
+ * @param virt_addr: Virtual address
+ * @param phys_addr: Physical address
+ * @param flags: Page table entry flags
+ * @return: 0 on success, -1 on failure
+ */
+static int map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
+    
+    // Get the PD entry
+    pte_t* pde = walk_page_directory(virt_addr, 1);
+    if (!pde) {
+        return -1;
+    }
+    
+    // A 4 KB mapping inside a large page needs its own page table
+    if ((*pde & PTE_PRESENT) && (*pde & PTE_HUGE)) {
+        if (split_huge_page(pde) != 0) {
+            return -1;
+        }
+    }
+    
+    pt_t pt = NULL;
+    
+    if (*pde & PTE_PRESENT) {
+        // PT already exists
+        pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+    } else {
+        // Allocate a new PT
+        pt = (pt_t)allocate_physical_page();
+        if (!pt) {
+            return -1;
+        }
+        
+        // Set the PD entry
+        *pde = (pte_t)(uintptr_t)pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    }
+    
+    // Set the PT entry
+    pt[pt_idx] = phys_addr | flags;
+    
+    return 0;
+}
+
+/**
+ * Map a 2 MB aligned virtual address with a single large page
+ * 
+ * @param virt_addr: Virtual address (2 MB aligned)
+ * @param phys_addr: Physical address (2 MB aligned)
+ * @param flags: Page table entry flags
+ * @return: 0 on success, -1 on failure
+ */
+static int map_huge_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    // Get the PD entry
+    pte_t* pde = walk_page_directory(virt_addr, 1);
+    if (!pde) {
+        return -1;
+    }
+    
+    if (*pde & PTE_PRESENT) {
+        if (*pde & PTE_HUGE) {
+            memory_huge_mapped -= HUGE_PAGE_SIZE;
+        } else {
+            // The large page replaces this page table
+            memory_free_physical((uintptr_t)(*pde & PTE_ADDR_MASK), 1);
+        }
+    }
+    
+    *pde = phys_addr | flags | PTE_PRESENT | PTE_HUGE;
+    memory_huge_mapped += HUGE_PAGE_SIZE;
+    
+    return 0;
+}
+
+/**
+ * Map a range, using large pages wherever both addresses are 2 MB aligned
+ * 
+ * @param virt_addr: Virtual address
+ * @param phys_addr: Physical address
+ * @param size: Size of the range
+ * @param flags: Page table entry flags
+ * @return: 0 on success, -1 on failure
+ */
+static int map_range(uint64_t virt_addr, uint64_t phys_addr, uint64_t size, uint64_t flags) {
+    uint64_t end = virt_addr + size;
+    
+    while (virt_addr < end) {
+        if (memory_huge_supported && ((virt_addr | phys_addr) & (HUGE_PAGE_SIZE - 1)) == 0 &&
+            end - virt_addr >= HUGE_PAGE_SIZE) {
+            if (map_huge_page(virt_addr, phys_addr, flags) != 0) {
+                return -1;
+            }
+            
+            virt_addr += HUGE_PAGE_SIZE;
+            phys_addr += HUGE_PAGE_SIZE;
+        } else {
+            if (map_page(virt_addr, phys_addr, flags | PTE_PRESENT) != 0) {
+                return -1;
+            }
+            
+            virt_addr += PAGE_SIZE;
+            phys_addr += PAGE_SIZE;
+        }
+    }
+    
+    flush_tlb();
+    
+    return 0;
+}
+
+/**
+ * Unmap a virtual address
+ * 
+ * @param virt_addr: Virtual address
+ * @return: 0 on success, -1 on failure
+ */
+static int unmap_page(uint64_t virt_addr) {
+    uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
+    
+    // Get the PD entry
+    pte_t* pde = walk_page_directory(virt_addr, 0);
+    
+    if (!pde || !(*pde & PTE_PRESENT)) {
+        // Page not mapped
+        return 0;
+    }
+    
+    // Only part of a large page is going away
+    if (*pde & PTE_HUGE) {
+        if (split_huge_page(pde) != 0) {
+            return -1;
+        }
+    }
+    
+    // Get the PT
+    pt_t pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+    pte_t* pte = &pt[pt_idx];
+    
+    if (!(*pte & PTE_PRESENT)) {
+        // Page not mapped
+        return 0;
+    }
+    
+    // Unmap the page
+    *pte = 0;
+    
+    // Invalidate the TLB entry
+    __asm__ volatile("invlpg (%0)" : : "r"((uint32_t)virt_addr) : "memory");
+    
+    return 0;
+}
+
+/**
+ * Acquire the heap lock
+ */
+static void heap_lock(void) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    
+    while (__sync_lock_test_and_set(&memory_heap_lock, 1)) {
+        while (memory_heap_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+    
+    memory_heap_irq = irq_enabled;
+}
+
+/**
+ * Release the heap lock
+ */
+static void heap_unlock(void) {
+    int irq_enabled = memory_heap_irq;
+    
+    __sync_lock_release(&memory_heap_lock);
+    
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Check if an address lies inside the kernel heap
+ * 
+ * @param addr: Address to check
+ * @return: 1 if the address is a heap address, 0 otherwise
+ */
+static int heap_contains(const void* addr) {
+    return kernel_heap_start && (uintptr_t)addr >= (uintptr_t)kernel_heap_start &&
+           (uintptr_t)addr < (uintptr_t)kernel_heap_end;
+}
+
+/**
+ * Get the heap page index of an address
+ * 
+ * @param addr: Heap address
+ * @return: Page index
+ */
+static inline uint32_t heap_page_index(const void* addr) {
+    return (uint32_t)(((uintptr_t)addr - (uintptr_t)kernel_heap_start) / PAGE_SIZE);
+}
+
+/**
+ * Get the address of a heap page
+ * 
+ * @param index: Page index
+ * @return: Page address
+ */
+static inline void* heap_page_address(uint32_t index) {
+    return (uint8_t*)kernel_heap_start + (size_t)index * PAGE_SIZE;
+}
+
+/**
+ * Get the smallest buddy order holding a number of pages
+ * 
+ * @param num_pages: Number of pages
+ * @return: Buddy order
+ */
+static uint32_t buddy_order(size_t num_pages) {
+    uint32_t order = 0;
+    
+    while (((size_t)1 << order) < num_pages) {
+        order++;
+    }
+    
+    return order;
+}
+
+/**
+ * Push a block onto its buddy free list
+ * 
+ * @param index: Index of the first page of the block
+ * @param order: Block order
+ */
+static void buddy_list_push(uint32_t index, uint32_t order) {
+    memory_page_t* page = &memory_pages[index];
+    
+    page->state = MEMORY_PAGE_FREE;
+    page->order = (uint8_t)order;
+    page->owner = NULL;
+    page->prev = -1;
+    page->next = buddy_free_lists[order];
+    
+    if (page->next >= 0) {
+        memory_pages[page->next].prev = (int32_t)index;
+    }
+    
+    buddy_free_lists[order] = (int32_t)index;
+    buddy_free_counts[order]++;
+    buddy_free_pages += (size_t)1 << order;
+}
+
+/**
+ * Remove a block from its buddy free list
+ * 
+ * @param index: Index of the first page of the block
+ */
+static void buddy_list_remove(uint32_t index) {
+    memory_page_t* page = &memory_pages[index];
+    uint32_t order = page->order;
+    
+    if (page->prev >= 0) {
+        memory_pages[page->prev].next = page->next;
+    } else {
+        buddy_free_lists[order] = page->next;
+    }
+    
+    if (page->next >= 0) {
+        memory_pages[page->next].prev = page->prev;
+    }
+    
+    page->state = MEMORY_PAGE_NONE;
+    page->next = -1;
+    page->prev = -1;
+    buddy_free_counts[order]--;
+    buddy_free_pages -= (size_t)1 << order;
+}
+
+/**
+ * Allocate a buddy block (heap lock held)
+ * 
+ * @param order: Block order
+ * @return: Address of the block, NULL on failure
+ */
+static void* buddy_alloc(uint32_t order) {
+    if (order > MEMORY_BUDDY_MAX_ORDER) {
+        return NULL;
+    }
+    
+    // Find the smallest free block that is large enough
+    uint32_t current = order;
+    
+    while (current <= MEMORY_BUDDY_MAX_ORDER && buddy_free_lists[current] < 0) {
+        current++;
+    }
+    
+    if (current > MEMORY_BUDDY_MAX_ORDER) {
+        return NULL;
+    }
+    
+    uint32_t index = (uint32_t)buddy_free_lists[current];
+    buddy_list_remove(index);
+    
+    // Split it down to the requested order, returning the upper halves
+    while (current > order) {
+        current--;
+        buddy_list_push(index + (1u << current), current);
+    }
+    
+    memory_pages[index].state = MEMORY_PAGE_ALLOCATED;
+    memory_pages[index].order = (uint8_t)order;
+    memory_pages[index].owner = NULL;
+    
+    return heap_page_address(index);
+}
+
+/**
+ * Free a buddy block and merge it with its free buddies (heap lock held)
+ * 
+ * @param addr: Address of the block
+ */
+static void buddy_free(void* addr) {
+    uint32_t index = heap_page_index(addr);
+    uint32_t order = memory_pages[index].order;
+    
+    memory_pages[index].state = MEMORY_PAGE_NONE;
+    memory_pages[index].owner = NULL;
+    
+    while (order < MEMORY_BUDDY_MAX_ORDER) {
+        uint32_t buddy = index ^ (1u << order);
+        
+        if (memory_pages[buddy].state != MEMORY_PAGE_FREE || memory_pages[buddy].order != order) {
+            break;
+        }
+        
+        buddy_list_remove(buddy);
+        index &= ~(1u << order);
+        order++;
+    }
+    
+    buddy_list_push(index, order);
+}
+
+/**
+ * Move a slab to one of its cache's lists
+ * 
+ * @param cache: Slab cache
+ * @param slab: Slab to move
+ * @param list: Destination list
+ * @param unlink: Whether the slab is currently on a list
+ */
+static void slab_move(memory_cache_t* cache, memory_slab_t* slab, uint32_t list, int unlink) {
+    if (unlink) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            cache->slabs[slab->list] = slab->next;
+        }
+        
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+    }
+    
+    slab->list = list;
+    slab->prev = NULL;
+    slab->next = cache->slabs[list];
+    
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    
+    cache->slabs[list] = slab;
+}
+
+/**
+ * Create a new slab for a cache (heap lock held)
+ * 
+ * @param cache: Slab cache
+ * @return: Pointer to the slab, NULL on failure
+ */
+static memory_slab_t* slab_create(memory_cache_t* cache) {
+    memory_slab_t* slab = (memory_slab_t*)buddy_alloc(cache->slab_order);
+    if (!slab) {
+        return NULL;
+    }
+    
+    // Slab pages may carry the protection of their previous owner
+    uint32_t num_pages = 1u << cache->slab_order;
+    
+    if (memory_set_protection(slab, (size_t)num_pages * PAGE_SIZE, MEMORY_PROT_READ | MEMORY_PROT_WRITE) != 0) {
+        buddy_free(slab);
+        return NULL;
+    }
+    
+    // Point every page of the slab back at it so frees are O(1)
+    uint32_t index = heap_page_index(slab);
+    
+    for (uint32_t i = 0; i < num_pages; i++) {
+        memory_pages[index + i].state = MEMORY_PAGE_SLAB;
+        memory_pages[index + i].owner = slab;
+    }
+    
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_list = NULL;
+    
+    // Thread the free list through the objects in address order
+    uint8_t* objects = (uint8_t*)slab + cache->offset;
+    
+    for (uint32_t i = cache->objects_per_slab; i > 0; i--) {
+        void** obj = (void**)(objects + (size_t)(i - 1) * cache->object_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    
+    slab_move(cache, slab, MEMORY_SLAB_EMPTY, 0);
+    cache->num_slabs++;
+    
+    return slab;
+}
+
+/**
+ * Return a slab to the buddy allocator (heap lock held)
+ * 
+ * @param cache: Slab cache
+ * @param slab: Slab to destroy
+ */
+static void slab_destroy(memory_cache_t* cache, memory_slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->slabs[slab->list] = slab->next;
+    }
+    
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    
+    uint32_t index = heap_page_index(slab);
+    
+    for (uint32_t i = 0; i < (1u << cache->slab_order); i++) {
+        memory_pages[index + i].state = MEMORY_PAGE_NONE;
+        memory_pages[index + i].owner = NULL;
+    }
+    
+    cache->num_slabs--;
+    buddy_free(slab);
+}
+
+/**
+ * Create a slab cache (heap lock held)
+ * 
+ * @param name: Cache name
+ * @param object_size: Size of each object
+ * @param align: Object alignment (power of two, 0 for pointer alignment)
+ * @return: Pointer to the cache, NULL on failure
+ */
+static memory_cache_t* cache_create_locked(const char* name, size_t object_size, size_t align) {
+    if (object_size == 0) {
+        return NULL;
+    }
+    
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    
+    if ((align & (align - 1)) != 0) {
+        return NULL;
+    }
+    
+    // Objects double as free list links while they are free
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    
+    object_size = (object_size + align - 1) & ~(align - 1);
+    
+    size_t offset = (sizeof(memory_slab_t) + align - 1) & ~(align - 1);
+    
+    // Use the smallest slab that holds enough objects to amortize the header
+    uint32_t order = 0;
+    size_t capacity = 0;
+    
+    for (order = 0; order <= MEMORY_SLAB_MAX_ORDER; order++) {
+        capacity = (((size_t)PAGE_SIZE << order) - offset) / object_size;
+        
+        if (capacity >= MEMORY_SLAB_MIN_OBJECTS) {
+            break;
+        }
+    }
+    
+    if (order > MEMORY_SLAB_MAX_ORDER) {
+        order = MEMORY_SLAB_MAX_ORDER;
+    }
+    
+    if (capacity == 0) {
+        return NULL;
+    }
+    
+    // Find a free cache descriptor
+    memory_cache_t* cache = NULL;
+    
+    for (int i = 0; i < MEMORY_MAX_CACHES; i++) {
+        if (!memory_caches[i].in_use) {
+            cache = &memory_caches[i];
+            break;
+        }
+    }
+    
+    if (!cache) {
+        return NULL;
+    }
+    
+    memset(cache, 0, sizeof(memory_cache_t));
+    strncpy(cache->name, name ? name : "cache", sizeof(cache->name) - 1);
+    cache->object_size = object_size;
+    cache->offset = offset;
+    cache->objects_per_slab = (uint32_t)capacity;
+    cache->slab_order = order;
+    cache->in_use = 1;
+    
+    return cache;
+}
+
+/**
+ * Allocate an object from a slab cache (heap lock held)
+ * 
+ * @param cache: Slab cache
+ * @return: Pointer to the object, NULL on failure
+ */
+static void* cache_alloc_locked(memory_cache_t* cache) {
+    memory_slab_t* slab = cache->slabs[MEMORY_SLAB_PARTIAL];
+    
+    if (!slab) {
+        slab = cache->slabs[MEMORY_SLAB_EMPTY];
+    }
+    
+    if (!slab) {
+        slab = slab_create(cache);
+        if (!slab) {
+            return NULL;
+        }
+    }
+    
+    void** obj = (void**)slab->free_list;
+    slab->free_list = *obj;
+    slab->inuse++;
+    
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_move(cache, slab, MEMORY_SLAB_FULL, 1);
+    } else if (slab->list == MEMORY_SLAB_EMPTY) {
+        slab_move(cache, slab, MEMORY_SLAB_PARTIAL, 1);
+    }
+    
+    cache->active_objects++;
+    cache->total_allocs++;
+    
+    return obj;
+}
+
+/**
+ * Return an object to its slab (heap lock held)
+ * 
+ * @param cache: Slab cache
+ * @param obj: Object to free
+ */
+static void cache_free_locked(memory_cache_t* cache, void* obj) {
+    memory_slab_t* slab = (memory_slab_t*)memory_pages[heap_page_index(obj)].owner;
+    
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->inuse--;
+    
+    cache->active_objects--;
+    cache->total_frees++;
+    
+    if (slab->inuse == 0) {
+        // Keep one empty slab to absorb alloc/free churn, release the rest
+        if (cache->slabs[MEMORY_SLAB_EMPTY]) {
+            slab_destroy(cache, slab);
+        } else {
+            slab_move(cache, slab, MEMORY_SLAB_EMPTY, 1);
+        }
+    } else if (slab->list == MEMORY_SLAB_FULL) {
+        slab_move(cache, slab, MEMORY_SLAB_PARTIAL, 1);
+    }
+}
+
+/**
+ * Find the slab object backing a heap address (heap lock held)
+ * 
+ * @param ptr: Heap address
+ * @return: Slab owning the address, NULL if it is not a slab object
+ */
+static memory_slab_t* slab_lookup(const void* ptr) {
+    memory_page_t* page = &memory_pages[heap_page_index(ptr)];
+    
+    if (page->state != MEMORY_PAGE_SLAB) {
+        return NULL;
+    }
+    
+    return (memory_slab_t*)page->owner;
+}
+
+/**
+ * Find the allocation record of a buddy block (heap lock held)
+ * 
+ * @param ptr: Address returned by memory_alloc or memory_alloc_aligned
+ * @param index: Pointer to store the index of the first page of the block
+ * @return: Allocation record, NULL if the address is not an allocated block
+ */
+static memory_allocation_t* block_lookup(const void* ptr, uint32_t* index) {
+    uint32_t i = heap_page_index(ptr);
+    
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) != 0) {
+        return NULL;
+    }
+    
+    if (memory_pages[i].state == MEMORY_PAGE_ALIGNED) {
+        i = memory_pages[i].head;
+    }
+    
+    if (memory_pages[i].state != MEMORY_PAGE_ALLOCATED) {
+        return NULL;
+    }
+    
+    if (index) {
+        *index = i;
+    }
+    
+    return (memory_allocation_t*)memory_pages[i].owner;
+}
+
+/**
+ * Get the size class index of a small allocation
+ * 
+ * @param size: Allocation size
+ * @return: Size class index
+ */
+static uint32_t memory_size_class(size_t size) {
+    uint32_t index = 0;
+    size_t class_size = MEMORY_SIZE_CLASS_MIN;
+    
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    
+    return index;
+}
+
+/**
+ * Allocate a buddy block and track it (heap lock held)
+ * 
+ * @param size: Size of the memory to allocate (multiple of the page size)
+ * @param protection: Memory protection flags
+ * @param flags: Memory allocation flags
+ * @return: Address of the block, NULL on failure
+ */
+static void* block_alloc_locked(size_t size, memory_prot_t protection, uint32_t flags) {
+    void* addr = buddy_alloc(buddy_order(size / PAGE_SIZE));
+    if (!addr) {
+        return NULL;
+    }
+    
+    memory_allocation_t* alloc = (memory_allocation_t*)cache_alloc_locked(memory_record_cache);
+    if (!alloc) {
+        buddy_free(addr);
+        return NULL;
+    }
+    
+    alloc->address = addr;
+    alloc->size = size;
+    alloc->protection = protection;
+    alloc->flags = flags;
+    alloc->prev = NULL;
+    alloc->next = memory_allocations;
+    
+    if (memory_allocations) {
+        memory_allocations->prev = alloc;
+    }
+    
+    memory_allocations = alloc;
+    memory_allocations_count++;
+    
+    memory_pages[heap_page_index(addr)].owner = alloc;
+    
+    return addr;
+}
+
+/**
+ * Free a tracked buddy block (heap lock held)
+ * 
+ * @param alloc: Allocation record
+ * @param index: Index of the first page of the block
+ */
+static void block_free_locked(memory_allocation_t* alloc, uint32_t index) {
+    if (alloc->prev) {
+        alloc->prev->next = alloc->next;
+    } else {
+        memory_allocations = alloc->next;
+    }
+    
+    if (alloc->next) {
+        alloc->next->prev = alloc->prev;
+    }
+    
+    memory_allocations_count--;
+    cache_free_locked(memory_record_cache, alloc);
+    buddy_free(heap_page_address(index));
+}
+
+/**
+ * Allocate memory backed by large pages
+ * 
+ * The memory comes straight from the frame allocator as a 2 MB aligned run
+ * inside the identity-mapped range, so it is mapped with one directory entry
+ * per 2 MB instead of a page table per 2 MB.
+ * 
+ * @param size: Size of the memory to allocate
+ * @param protection: Memory protection flags
+ * @param flags: Memory allocation flags
+ * @return: Pointer to the allocated memory, NULL on failure
+ */
+static void* huge_alloc(size_t size, memory_prot_t protection, uint32_t flags) {
+    // Round up the size to a multiple of the large page size
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    uintptr_t addr = memory_alloc_physical(size / PAGE_SIZE, flags | MEMORY_ALLOC_CONTIGUOUS | MEMORY_FLAG_HUGE);
+    if (!addr) {
+        return NULL;
+    }
+    
+    // Re-install large mappings over the run (earlier users may have split them)
+    if (map_range(addr, addr, size, protection_to_entry(PTE_PRESENT, protection)) != 0) {
+        memory_free_physical(addr, size / PAGE_SIZE);
+        return NULL;
+    }
+    
+    // Track the allocation
+    heap_lock();
+    
+    memory_allocation_t* alloc = (memory_allocation_t*)cache_alloc_locked(memory_record_cache);
+    
+    if (alloc) {
+        alloc->address = (void*)addr;
+        alloc->size = size;
+        alloc->protection = protection;
+        alloc->flags = flags;
+        alloc->prev = NULL;
+        alloc->next = memory_huge_allocations;
+        
+        if (memory_huge_allocations) {
+            memory_huge_allocations->prev = alloc;
+        }
+        
+        memory_huge_allocations = alloc;
+    }
+    
+    heap_unlock();
+    
+    if (!alloc) {
+        memory_free_physical(addr, size / PAGE_SIZE);
+        return NULL;
+    }
+    
+    return (void*)addr;
+}
+
+/**
+ * Free memory allocated by huge_alloc
+ * 
+ * @param ptr: Address of the memory to free
+ */
+static void huge_free(void* ptr) {
+    heap_lock();
+    
+    memory_allocation_t* alloc = memory_huge_allocations;
+    
+    while (alloc && alloc->address != ptr) {
+        alloc = alloc->next;
+    }
+    
+    if (!alloc) {
+        heap_unlock();
+        return;
+    }
+    
+    if (alloc->prev) {
+        alloc->prev->next = alloc->next;
+    } else {
+        memory_huge_allocations = alloc->next;
+    }
+    
+    if (alloc->next) {
+        alloc->next->prev = alloc->prev;
+    }
+    
+    size_t size = alloc->size;
+    cache_free_locked(memory_record_cache, alloc);
+    
+    heap_unlock();
+    
+    // Restore the default identity mapping before the frames are reused
+    map_range((uintptr_t)ptr, (uintptr_t)ptr, size, PTE_PRESENT | PTE_WRITABLE);
+    memory_free_physical((uintptr_t)ptr, size / PAGE_SIZE);
+}
+
+/**
+ * Allocate memory
+ * 
+ * Small read/write allocations are served from the size-class slab caches,
+ * everything else from the buddy allocator in whole pages. MEMORY_FLAG_HUGE
+ * requests bypass the heap and are backed by large pages.
+ * 
+ * @param size: Size of the memory to allocate
+ * @param protection: Memory protection flags
+ * @param flags: Memory allocation flags
+ * @return: Pointer to the allocated memory, NULL on failure
+ */
+void* memory_alloc(size_t size, memory_prot_t protection, uint32_t flags) {
+    // Check if the size is valid
+    if (size == 0 || !kernel_heap_start) {
+        return NULL;
+    }
+    
+    trace_instant(&memory_trace_alloc, (uint32_t)size, flags);
+    
+    // Large buffers such as model weights get their own large pages
+    if (flags & MEMORY_FLAG_HUGE) {
+        return huge_alloc(size, protection, flags);
+    }
+    
+    // Small objects share slab pages, which are always kernel read/write
+    if (size <= MEMORY_SIZE_CLASS_MAX && (protection & MEMORY_PROT_WRITE) &&
+        !(protection & (MEMORY_PROT_EXEC | MEMORY_PROT_USER))) {
+        heap_lock();
+        void* obj = cache_alloc_locked(memory_size_caches[memory_size_class(size)]);
+        heap_unlock();
+        
+        if (obj && (flags & MEMORY_ALLOC_ZEROED)) {
+            memset(obj, 0, size);
+        }
+        
+        return obj;
+    }
+    
+    // Round up the size to a multiple of the page size
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    heap_lock();
+    void* addr = block_alloc_locked(size, protection, flags);
+    heap_unlock();
+    
+    if (!addr) {
+        return NULL;
+    }
+    
+    // Set the memory protection of the whole block so it can grow in place
+    size_t block_size = (size_t)PAGE_SIZE << memory_pages[heap_page_index(addr)].order;
+    
+    if (memory_set_protection(addr, block_size, protection) != 0) {
+        memory_free(addr, size);
+        return NULL;
+    }
+    
+    // Zero the memory if requested
+    if (flags & MEMORY_ALLOC_ZEROED) {
+        memset(addr, 0, size);
+    }
+    
+    return addr;
+}
+
+/**
+ * Allocate aligned memory
+ * 
+ * @param size: Size of the memory to allocate
+ * @param alignment: Alignment of the memory to allocate
+ * @return: Pointer to the allocated memory, NULL on failure
+ */
+void* memory_alloc_aligned(size_t size, size_t alignment) {
+    // Check if the size and alignment are valid
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0 || !kernel_heap_start) {
+        return NULL;
+    }
+    
+    // Round up the size to a multiple of the page size
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    // Buddy blocks are always page aligned
+    if (alignment <= PAGE_SIZE) {
+        return memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    }
+    
+    // Calculate the total size needed
+    size_t total_size = size + alignment - PAGE_SIZE;
+    
+    heap_lock();
+    
+    void* addr = block_alloc_locked(total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!addr) {
+        heap_unlock();
+        return NULL;
+    }
+    
+    // Calculate the aligned address and link it back to the block
+    void* aligned_addr = (void*)(((uintptr_t)addr + alignment - 1) & ~(alignment - 1));
+    
+    if (aligned_addr != addr) {
+        memory_page_t* page = &memory_pages[heap_page_index(aligned_addr)];
+        page->state = MEMORY_PAGE_ALIGNED;
+        page->head = heap_page_index(addr);
+    }
+    
+    heap_unlock();
+    
+    // Set the memory protection
+    if (memory_set_protection(addr, total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE) != 0) {
+        memory_free(aligned_addr, total_size);
+        return NULL;
+    }
+    
+    return aligned_addr;
+}
+
+/**
+ * Allocate and zero memory
+ * 
+ * @param nmemb: Number of elements
+ * @param size: Size of each element
+ * @return: Pointer to the allocated memory, NULL on failure
+ */
+void* memory_calloc(size_t nmemb, size_t size) {
+    // Check if the size is valid
+    if (nmemb == 0 || size == 0 || nmemb > (size_t)-1 / size) {
+        return NULL;
+    }
+    
+    // Calculate the total size
+    size_t total_size = nmemb * size;
+    
+    // Allocate the memory
+    void* addr = memory_alloc(total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    
+    return addr;
+}
+
+/**
+ * Reallocate memory
+ * 
+ * @param ptr: Pointer to the memory to reallocate
+ * @param size: New size of the memory
+ * @return: Pointer to the reallocated memory, NULL on failure
+ */
+void* memory_realloc(void* ptr, size_t size) {
+    // Check if the pointer is valid
+    if (!ptr) {
+        return memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    }
+    
+    // Check if the size is valid
+    if (size == 0) {
+        memory_free(ptr, 0);
+        return NULL;
+    }
+    
+    if (!heap_contains(ptr)) {
+        return NULL;
+    }
+    
+    // Find the usable size of the allocation
+    size_t old_size = 0;
+    
+    heap_lock();
+    
+    memory_slab_t* slab = slab_lookup(ptr);
+    uint32_t index = 0;
+    
+    if (slab) {
+        old_size = slab->cache->object_size;
+    } else if (block_lookup(ptr, &index)) {
+        old_size = ((size_t)PAGE_SIZE << memory_pages[index].order) -
+                   ((uintptr_t)ptr - (uintptr_t)heap_page_address(index));
+    }
+    
+    heap_unlock();
+    
+    if (old_size == 0) {
+        return NULL;
+    }
+    
+    return memory_resize(ptr, old_size, size);
+}
+
+/**
+ * Free memory
+ * 
+ * The allocator records the size of every allocation, so the size argument
+ * is only kept for compatibility.
+ * 
+ * @param ptr: Address of the memory to free
+ * @param size: Size of the memory to free
+ */
+void memory_free(void* ptr, size_t size) {
+    (void)size;
+    
+    // Check if the address is valid
+    if (!ptr) {
+        return;
+    }
+    
+    trace_instant(&memory_trace_free, (uint32_t)(uintptr_t)ptr, 0);
+    
+    if (!heap_contains(ptr)) {
+        huge_free(ptr);
+        return;
+    }
+    
+    heap_lock();
+    
+    // Slab objects go back to their slab
+    memory_slab_t* slab = slab_lookup(ptr);
+    
+    if (slab) {
+        cache_free_locked(slab->cache, ptr);
+        heap_unlock();
+        return;
+    }
+    
+    // Page-granular blocks go back to the buddy allocator
+    uint32_t index = 0;
+    memory_allocation_t* alloc = block_lookup(ptr, &index);
+    
+    if (alloc) {
+        memory_page_t* page = &memory_pages[heap_page_index(ptr)];
+        
+        if (page->state == MEMORY_PAGE_ALIGNED) {
+            page->state = MEMORY_PAGE_NONE;
+        }
+        
+        block_free_locked(alloc, index);
+    }
+    
+    heap_unlock();
+}
+
+/**
+ * Resize memory
+ * 
+ * @param addr: Address of the memory to resize
+ * @param old_size: Usable size of the memory
+ * @param new_size: New size of the memory
+ * @return: Pointer to the resized memory, NULL on failure
+ */
+static void* memory_resize(void* addr, size_t old_size, size_t new_size) {
+    // Check if the address is valid
+    if (!addr) {
+        return NULL;
+    }
+    
+    // The block already holds the new size
+    if (new_size <= old_size) {
+        return addr;
+    }
+    
+    // We need to allocate a new block
+    void* new_addr = memory_alloc(new_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!new_addr) {
+        return NULL;
+    }
+    
+    // Copy the data
+    memcpy(new_addr, addr, old_size);
+    
+    // Free the old block
+    memory_free(addr, old_size);
+    
+    return new_addr;
+}
+
+/**
+ * Create a slab cache for fixed-size objects
+ * 
+ * @param name: Cache name
+ * @param object_size: Size of each object
+ * @param align: Object alignment (power of two, 0 for pointer alignment)
+ * @return: Pointer to the cache, NULL on failure
+ */
+memory_cache_t* memory_cache_create(const char* name, size_t object_size, size_t align) {
+    heap_lock();
+    memory_cache_t* cache = cache_create_locked(name, object_size, align);
+    heap_unlock();
+    
+    if (!cache) {
+        console_printf("Error: Failed to create memory cache %s\n", name ? name : "");
     }
     
-    alloc->address = addr;
-    alloc->size = size;
-    alloc->protection = protection;
-    alloc->flags = flags;
-    alloc->next = memory_allocations;
-    memory_allocations = alloc;
+    return cache;
+}
+
+/**
+ * Destroy a slab cache and release its slabs
+ * 
+ * @param cache: Slab cache
+ */
+void memory_cache_destroy(memory_cache_t* cache) {
+    if (!cache || !cache->in_use) {
+        return;
+    }
     
-    return addr;
+    if (cache->active_objects) {
+        console_printf("Warning: Destroying memory cache %s with %u live objects\n",
+                       cache->name, (unsigned int)cache->active_objects);
+    }
+    
+    heap_lock();
+    
+    for (int list = MEMORY_SLAB_EMPTY; list <= MEMORY_SLAB_FULL; list++) {
+        while (cache->slabs[list]) {
+            slab_destroy(cache, cache->slabs[list]);
+        }
+    }
+    
+    cache->in_use = 0;
+    
+    heap_unlock();
 }
 
 /**
- * Allocate aligned memory
+ * Allocate an object from a slab cache
+ * 
+ * @param cache: Slab cache
+ * @param flags: Memory allocation flags
+ * @return: Pointer to the object, NULL on failure
+ */
+void* memory_cache_alloc(memory_cache_t* cache, memory_alloc_flags_t flags) {
+    if (!cache || !cache->in_use) {
+        return NULL;
+    }
+    
+    heap_lock();
+    void* obj = cache_alloc_locked(cache);
+    heap_unlock();
+    
+    if (obj && (flags & MEMORY_ALLOC_ZEROED)) {
+        memset(obj, 0, cache->object_size);
+    }
+    
+    return obj;
+}
+
+/**
+ * Return an object to its slab cache
+ * 
+ * @param cache: Slab cache
+ * @param obj: Object to free
+ */
+void memory_cache_free(memory_cache_t* cache, void* obj) {
+    if (!cache || !obj || !heap_contains(obj)) {
+        return;
+    }
+    
+    heap_lock();
+    
+    memory_slab_t* slab = slab_lookup(obj);
+    
+    if (!slab || slab->cache != cache) {
+        heap_unlock();
+        console_printf("Error: Object %p does not belong to memory cache %s\n", obj, cache->name);
+        return;
+    }
+    
+    cache_free_locked(cache, obj);
+    
+    heap_unlock();
+}
+
+/**
+ * Map physical memory (device memory such as a framebuffer) at a virtual address
+ * 
+ * @param physical_addr: Physical address (page aligned)
+ * @param virtual_addr: Virtual address (page aligned)
+ * @param size: Size of the mapping
+ * @param protection: Memory protection flags
+ * @return: 0 on success, -1 on failure
+ */
+int memory_map(uintptr_t physical_addr, void* virtual_addr, size_t size, memory_prot_t protection) {
+    // Check if the addresses are valid
+    if (!virtual_addr || size == 0 || ((physical_addr | (uintptr_t)virtual_addr) & (PAGE_SIZE - 1)) != 0) {
+        console_printf("Error: Invalid mapping of %p at %p\n", (void*)physical_addr, virtual_addr);
+        return -1;
+    }
+    
+    // Round up the size to a multiple of the page size
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    if (map_range((uintptr_t)virtual_addr, physical_addr, size, protection_to_entry(PTE_PRESENT, protection)) != 0) {
+        console_printf("Error: Failed to map %p at %p\n", (void*)physical_addr, virtual_addr);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Unmap memory
+ * 
+ * @param virtual_addr: Virtual address of the memory to unmap
+ * @param size: Size of the memory to unmap
+ */
+void memory_unmap(void* virtual_addr, size_t size) {
+    // Check if the address is valid
+    if (!virtual_addr) {
+        return;
+    }
+    
+    // Round up the size to a multiple of the page size
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    for (uint64_t virt_addr = (uintptr_t)virtual_addr; virt_addr < (uintptr_t)virtual_addr + size; virt_addr += PAGE_SIZE) {
+        unmap_page(virt_addr);
+    }
+}
+
+/**
+ * Acquire the file mapping lock
+ */
+static void file_map_lock(void) {
+    while (__sync_lock_test_and_set(&memory_file_map_lock, 1)) {
+        while (memory_file_map_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release the file mapping lock
+ */
+static void file_map_unlock(void) {
+    __sync_lock_release(&memory_file_map_lock);
+}
+
+/**
+ * Get the page table entry of a 4 KB mapping
+ * 
+ * @param virt_addr: Virtual address
+ * @return: Pointer to the page table entry, NULL if there is no page table
+ */
+static pte_t* lookup_page(uint64_t virt_addr) {
+    pte_t* pde = walk_page_directory(virt_addr, 0);
+    
+    if (!pde || !(*pde & PTE_PRESENT) || (*pde & PTE_HUGE)) {
+        return NULL;
+    }
+    
+    pt_t pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+    
+    return &pt[(virt_addr >> 12) & 0x1FF];
+}
+
+/**
+ * Find the file mapping containing an address (file mapping lock held)
+ * 
+ * @param addr: Address inside the mapping
+ * @return: Pointer to the mapping, NULL if the address is not mapped from a file
+ */
+static memory_file_map_t* file_map_find(uintptr_t addr) {
+    for (int i = 0; i < MEMORY_MAX_FILE_MAPS; i++) {
+        memory_file_map_t* map = &memory_file_maps[i];
+        
+        if (map->in_use && !map->unmapping && addr >= map->start && addr < map->start + map->reserved_size) {
+            return map;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Map part of a file into the file mapping window
+ * 
+ * Only the address range is reserved; pages are read from the backing file
+ * when they are populated, straight into the frames that back the mapping.
+ * 
+ * @param reader: Function reading from the backing file
+ * @param ctx: Reader context
+ * @param offset: Offset of the mapped range in the file
+ * @param size: Size of the mapped range
+ * @param protection: Memory protection flags
+ * @return: Address of the mapping, NULL on failure
+ */
+void* memory_map_file(memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, memory_prot_t protection) {
+    if (!reader || size == 0) {
+        return NULL;
+    }
+    
+    // Reserve whole page directory entries so page tables are never shared
+    size_t reserved_size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    
+    file_map_lock();
+    
+    memory_file_map_t* map = NULL;
+    
+    for (int i = 0; i < MEMORY_MAX_FILE_MAPS; i++) {
+        if (!memory_file_maps[i].in_use) {
+            map = &memory_file_maps[i];
+            break;
+        }
+    }
+    
+    if (!map) {
+        file_map_unlock();
+        console_printf("Error: Too many file mappings\n");
+        return NULL;
+    }
+    
+    // First fit in the mapping window
+    uint64_t start = MEMORY_MAP_WINDOW_START;
+    int moved = 1;
+    
+    while (moved) {
+        moved = 0;
+        
+        for (int i = 0; i < MEMORY_MAX_FILE_MAPS; i++) {
+            memory_file_map_t* other = &memory_file_maps[i];
+            
+            if (other->in_use && start < other->start + other->reserved_size && other->start < start + reserved_size) {
+                start = other->start + other->reserved_size;
+                moved = 1;
+            }
+        }
+    }
+    
+    if (start + reserved_size > MEMORY_MAP_WINDOW_END) {
+        file_map_unlock();
+        console_printf("Error: File mapping window exhausted\n");
+        return NULL;
+    }
+    
+    map->in_use = 1;
+    map->start = (uintptr_t)start;
+    map->size = size;
+    map->reserved_size = reserved_size;
+    map->offset = offset;
+    map->protection = protection;
+    map->reader = reader;
+    map->ctx = ctx;
+    map->resident_pages = 0;
+    
+    file_map_unlock();
+    
+    return (void*)(uintptr_t)start;
+}
+
+/**
+ * Unmap a file mapping and release its resident pages
+ * 
+ * @param addr: Address of the mapping
+ * @return: 0 on success, -1 on failure
+ */
+int memory_unmap_file(void* addr) {
+    file_map_lock();
+    
+    memory_file_map_t* map = file_map_find((uintptr_t)addr);
+    
+    if (!map || map->start != (uintptr_t)addr) {
+        file_map_unlock();
+        return -1;
+    }
+    
+    // Page fills in progress still use the mapping; new ones no longer find it
+    map->unmapping = 1;
+    
+    while (map->busy) {
+        file_map_unlock();
+        __asm__ volatile("pause");
+        file_map_lock();
+    }
+    
+    for (uint64_t chunk = map->start; chunk < map->start + map->reserved_size; chunk += HUGE_PAGE_SIZE) {
+        pte_t* pde = walk_page_directory(chunk, 0);
+        
+        if (!pde || !(*pde & PTE_PRESENT)) {
+            continue;
+        }
+        
+        // Release the resident frames, then the page table itself
+        pt_t pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+        
+        for (int i = 0; i < PT_ENTRIES; i++) {
+            if (pt[i] & PTE_PRESENT) {
+                memory_free_physical((uintptr_t)(pt[i] & PTE_ADDR_MASK), 1);
+            }
+        }
+        
+        *pde = 0;
+        memory_free_physical((uintptr_t)pt, 1);
+    }
+    
+    flush_tlb();
+    
+    memset(map, 0, sizeof(memory_file_map_t));
+    
+    file_map_unlock();
+    
+    return 0;
+}
+
+/**
+ * Make one page of a file mapping resident
+ * 
+ * The backing file is read without holding the file mapping lock, so a
+ * prefetch and a fault on the same mapping can make progress together. The
+ * mapping is kept busy meanwhile, which holds off memory_unmap_file.
+ * 
+ * @param map: File mapping
+ * @param virt_addr: Page-aligned address inside the mapping
+ * @return: 0 on success, -1 on failure
+ */
+static int file_map_fill_page(memory_file_map_t* map, uint64_t virt_addr) {
+    if (map->unmapping) {
+        return -1;
+    }
+    
+    pte_t* pte = lookup_page(virt_addr);
+    
+    if (pte && (*pte & PTE_PRESENT)) {
+        return 0;
+    }
+    
+    uintptr_t frame = memory_alloc_physical(1, 0);
+    if (!frame) {
+        return -1;
+    }
+    
+    // Read the page from the backing file, zero filling past its end
+    uint64_t page_offset = virt_addr - map->start;
+    size_t want = map->size - page_offset < PAGE_SIZE ? (size_t)(map->size - page_offset) : PAGE_SIZE;
+    
+    map->busy++;
+    file_map_unlock();
+    
+    while (__sync_lock_test_and_set(&map->read_lock, 1)) {
+        while (map->read_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+    
+    size_t got = map->reader(map->ctx, map->offset + page_offset, (void*)frame, want);
+    
+    __sync_lock_release(&map->read_lock);
+    
+    if (got < PAGE_SIZE) {
+        memset((uint8_t*)frame + got, 0, PAGE_SIZE - got);
+    }
+    
+    file_map_lock();
+    map->busy--;
+    
+    // The mapping may be going away or somebody else may have filled the
+    // page while we were reading
+    if (map->unmapping) {
+        memory_free_physical(frame, 1);
+        return -1;
+    }
+    
+    pte = lookup_page(virt_addr);
+    
+    if (pte && (*pte & PTE_PRESENT)) {
+        memory_free_physical(frame, 1);
+        return 0;
+    }
+    
+    if (map_page(virt_addr, frame, protection_to_entry(PTE_PRESENT, map->protection)) != 0) {
+        memory_free_physical(frame, 1);
+        return -1;
+    }
+    
+    __asm__ volatile("invlpg (%0)" : : "r"((uint32_t)virt_addr) : "memory");
+    map->resident_pages++;
+    
+    return 0;
+}
+
+/**
+ * Make a range of a file mapping resident
+ * 
+ * @param addr: Start of the range
+ * @param size: Size of the range
+ * @return: 0 on success, -1 on failure
+ */
+int memory_map_populate(void* addr, size_t size) {
+    if (!addr || size == 0) {
+        return -1;
+    }
+    
+    file_map_lock();
+    
+    memory_file_map_t* map = file_map_find((uintptr_t)addr);
+    
+    if (!map) {
+        file_map_unlock();
+        return -1;
+    }
+    
+    uint64_t first = (uintptr_t)addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (uintptr_t)addr + size;
+    
+    if (end > map->start + map->size) {
+        end = map->start + map->size;
+    }
+    
+    for (uint64_t virt_addr = first; virt_addr < end; virt_addr += PAGE_SIZE) {
+        if (file_map_fill_page(map, virt_addr) != 0) {
+            file_map_unlock();
+            return -1;
+        }
+    }
+    
+    file_map_unlock();
+    
+    return 0;
+}
+
+/**
+ * Acquire the write watch lock
+ */
+static void write_watch_lock(void) {
+    while (__sync_lock_test_and_set(&memory_write_watch_lock, 1)) {
+        while (memory_write_watch_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release the write watch lock
+ */
+static void write_watch_unlock(void) {
+    __sync_lock_release(&memory_write_watch_lock);
+}
+
+/**
+ * Find the write watch containing an address (write watch lock held)
+ * 
+ * @param addr: Address inside the watched range
+ * @return: Pointer to the watch, NULL if the address is not watched
+ */
+static memory_write_watch_t* write_watch_find(uintptr_t addr) {
+    for (int i = 0; i < MEMORY_MAX_WRITE_WATCHES; i++) {
+        memory_write_watch_t* watch = &memory_write_watches[i];
+        
+        if (watch->in_use && addr >= watch->start && addr < watch->start + watch->size) {
+            return watch;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Watch a range of memory for writes
  * 
- * @param size: Size of the memory to allocate
- * @param alignment: Alignment of the memory to allocate
- * @return: Pointer to the allocated memory, NULL on failure
+ * The range is made read-only. The first write to each page calls the
+ * handler with the page still unmodified, then gives the page the given
+ * protection back and retries the write, so later writes to it run at full
+ * speed.
+ * 
+ * @param addr: Page-aligned start of the range
+ * @param size: Size of the range
+ * @param protection: Protection of the range once written
+ * @param handler: Function called on the first write to a page
+ * @param ctx: Handler context
+ * @return: 0 on success, -1 on failure
  */
-void* memory_alloc_aligned(size_t size, size_t alignment) {
-    // Check if the size and alignment are valid
-    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
-        return NULL;
+int memory_watch_writes(void* addr, size_t size, memory_prot_t protection,
+                        memory_write_handler_t handler, void* ctx) {
+    if (!addr || size == 0 || !handler || ((uintptr_t)addr & (PAGE_SIZE - 1))) {
+        return -1;
     }
     
-    // Round up the size to a multiple of the page size
-    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
     
-    // Round up the alignment to a multiple of the page size
-    alignment = (alignment + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    write_watch_lock();
     
-    // Calculate the total size needed
-    size_t total_size = size + alignment;
+    memory_write_watch_t* watch = NULL;
     
-    // Check if we have enough memory
-    if ((uint8_t*)kernel_heap_current + total_size > (uint8_t*)kernel_heap_end) {
-        return NULL;
+    for (int i = 0; i < MEMORY_MAX_WRITE_WATCHES; i++) {
+        memory_write_watch_t* other = &memory_write_watches[i];
+        
+        if (!other->in_use) {
+            if (!watch) {
+                watch = other;
+            }
+        } else if ((uintptr_t)addr < other->start + other->size && other->start < (uintptr_t)addr + size) {
+            write_watch_unlock();
+            console_printf("Error: Write watch overlaps another one\n");
+            return -1;
+        }
     }
     
-    // Allocate the memory
-    void* addr = kernel_heap_current;
-    kernel_heap_current = (uint8_t*)kernel_heap_current + total_size;
+    if (!watch) {
+        write_watch_unlock();
+        console_printf("Error: Too many write watches\n");
+        return -1;
+    }
     
-    // Calculate the aligned address
-    void* aligned_addr = (void*)(((uintptr_t)addr + alignment - 1) & ~(alignment - 1));
+    watch->in_use = 1;
+    watch->start = (uintptr_t)addr;
+    watch->size = size;
+    watch->protection = protection;
+    watch->handler = handler;
+    watch->ctx = ctx;
+    watch->faults = 0;
     
-    // Set the memory protection
-    if (memory_set_protection(addr, total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE) != 0) {
-        return NULL;
-    }
+    write_watch_unlock();
     
-    // Track the allocation
-    memory_allocation_t* alloc = (memory_allocation_t*)malloc(sizeof(memory_allocation_t));
-    if (!alloc) {
-        return NULL;
+    if (memory_set_protection(addr, size, protection & ~MEMORY_PROT_WRITE) != 0) {
+        memory_unwatch_writes(addr);
+        return -1;
     }
     
-    alloc->address = addr;
-    alloc->size = total_size;
-    alloc->protection = MEMORY_PROT_READ | MEMORY_PROT_WRITE;
-    alloc->flags = 0;
-    alloc->next = memory_allocations;
-    memory_allocations = alloc;
-    
-    return aligned_addr;
+    return 0;
 }
 
 /**
- * Allocate and zero memory
+ * Check whether paging is enabled
  * 
- * @param nmemb: Number of elements
- * @param size: Size of each element
- * @return: Pointer to the allocated memory, NULL on failure
+ * Until it is, protections and not-present entries have no effect: no
+ * page fault ever fires, so write watches and demand paging do nothing.
+ * 
+ * @return: 1 if paging is enabled, 0 otherwise
  */
-void* memory_calloc(size_t nmemb, size_t size) {
-    // Check if the size is valid
-    if (nmemb == 0 || size == 0) {
-        return NULL;
+int memory_paging_enabled(void) {
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return (cr0 & CR0_PG) != 0;
+}
+
+/**
+ * Stop watching a range of memory for writes
+ * 
+ * Pages not written since the watch started get their protection back.
+ * 
+ * @param addr: Start of the watched range
+ * @return: 0 on success, -1 on failure
+ */
+int memory_unwatch_writes(void* addr) {
+    write_watch_lock();
+    
+    memory_write_watch_t* watch = write_watch_find((uintptr_t)addr);
+    
+    if (!watch || watch->start != (uintptr_t)addr) {
+        write_watch_unlock();
+        return -1;
     }
     
-    // Calculate the total size
-    size_t total_size = nmemb * size;
+    size_t size = watch->size;
+    memory_prot_t protection = watch->protection;
+    memset(watch, 0, sizeof(memory_write_watch_t));
     
-    // Allocate the memory
-    void* addr = memory_alloc(total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    write_watch_unlock();
     
-    return addr;
+    return memory_set_protection(addr, size, protection);
 }
 
 /**
- * Reallocate memory
+ * Resolve a write fault inside a write watch
  * 
- * @param ptr: Pointer to the memory to reallocate
- * @param size: New size of the memory
- * @return: Pointer to the reallocated memory, NULL on failure
+ * @param addr: Faulting address
+ * @return: 0 if the fault was resolved, -1 if the address is not watched
  */
-void* memory_realloc(void* ptr, size_t size) {
-    // Check if the pointer is valid
-    if (!ptr) {
-        return memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+static int write_watch_fault(uintptr_t addr) {
+    uintptr_t page = addr & ~(uintptr_t)(PAGE_SIZE - 1);
+    
+    write_watch_lock();
+    
+    memory_write_watch_t* watch = write_watch_find(addr);
+    
+    if (!watch) {
+        write_watch_unlock();
+        return -1;
     }
     
-    // Check if the size is valid
-    if (size == 0) {
-        memory_free(ptr, 0);
-        return NULL;
+    // Another CPU may have taken the first write to this page already
+    pte_t* pte = lookup_page(page);
+    
+    if (pte && (*pte & PTE_WRITABLE)) {
+        write_watch_unlock();
+        return 0;
     }
     
-    // Find the allocation
-    memory_allocation_t* alloc = memory_allocations;
+    int result = watch->handler(watch->ctx, page);
     
-    while (alloc) {
-        if (alloc->address == ptr) {
-            // Found the allocation
-            return memory_resize(ptr, alloc->size, size);
-        }
-        
-        alloc = alloc->next;
+    if (result == 0) {
+        result = memory_set_protection((void*)page, PAGE_SIZE, watch->protection);
+        watch->faults++;
     }
     
-    return NULL;
+    write_watch_unlock();
+    
+    return result;
 }
 
 /**
- * Free memory
+ * Resolve a page fault inside a file mapping or a write watch
  * 
- * @param ptr: Address of the memory to free
- * @param size: Size of the memory to free
+ * The faulting page of a file mapping is read together with the pages
+ * following it, since weights are swept sequentially.
+ * 
+ * @param addr: Faulting address
+ * @param error_code: Page fault error code
+ * @return: 0 if the fault was resolved, -1 if it is neither a file mapping
+ *          nor a write watch fault
  */
-void memory_free(void* ptr, size_t size) {
-    // Check if the address is valid
-    if (!ptr) {
-        return;
+int memory_handle_page_fault(uintptr_t addr, uint32_t error_code) {
+    trace_instant(&memory_trace_fault, (uint32_t)addr, error_code);
+    
+    // Writes to present pages are only resolved for write watches
+    if (error_code & MEMORY_FAULT_PRESENT) {
+        if (error_code & MEMORY_FAULT_WRITE) {
+            return write_watch_fault(addr);
+        }
+        return -1;
     }
     
-    // Round up the size to a multiple of the page size
-    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    file_map_lock();
     
-    // Find the allocation
-    memory_allocation_t* prev = NULL;
-    memory_allocation_t* curr = memory_allocations;
-    
-    while (curr) {
-        if (curr->address == ptr && (size == 0 || curr->size == size)) {
-            // Found the allocation
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                memory_allocations = curr->next;
-            }
-            
-            // Free the allocation
-            free(curr);
-            
-            // Unmap the pages
-            for (uint64_t virt_addr = (uintptr_t)ptr; virt_addr < (uintptr_t)ptr + (size == 0 ? curr->size : size); virt_addr += PAGE_SIZE) {
-                unmap_page(virt_addr);
-            }
-            
-            return;
-        }
+    memory_file_map_t* map = file_map_find(addr);
+    
+    if (!map || addr >= map->start + map->size) {
+        file_map_unlock();
+        return -1;
+    }
+    
+    if ((error_code & MEMORY_FAULT_WRITE) && !(map->protection & MEMORY_PROT_WRITE)) {
+        file_map_unlock();
+        return -1;
+    }
+    
+    map->faults++;
+    
+    uint64_t virt_addr = addr & ~(uintptr_t)(PAGE_SIZE - 1);
+    
+    if (file_map_fill_page(map, virt_addr) != 0) {
+        file_map_unlock();
+        console_printf("Error: Out of memory paging in %p\n", (void*)addr);
+        return -1;
+    }
+    
+    // Read around the fault, best effort
+    for (int i = 1; i < MEMORY_MAP_FAULT_AROUND; i++) {
+        uint64_t next = virt_addr + (uint64_t)i * PAGE_SIZE;
         
-        prev = curr;
-        curr = curr->next;
+        if (next >= map->start + map->size || file_map_fill_page(map, next) != 0) {
+            break;
+        }
     }
+    
+    file_map_unlock();
+    
+    return 0;
 }
 
 /**
- * Resize memory
+ * Get the paging statistics of a file mapping
  * 
- * @param addr: Address of the memory to resize
- * @param old_size: Old size of the memory
- * @param new_size: New size of the memory
- * @return: Pointer to the resized memory, NULL on failure
+ * @param addr: Address of the mapping
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
  */
-void* memory_resize(void* addr, size_t old_size, size_t new_size) {
-    // Check if the address is valid
-    if (!addr) {
-        return NULL;
+int memory_map_get_stats(void* addr, memory_map_stats_t* stats) {
+    if (!stats) {
+        return -1;
     }
     
-    // Round up the sizes to a multiple of the page size
-    old_size = (old_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-    new_size = (new_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    file_map_lock();
     
-    // Find the allocation
-    memory_allocation_t* alloc = memory_allocations;
+    memory_file_map_t* map = file_map_find((uintptr_t)addr);
     
-    while (alloc) {
-        if (alloc->address == addr && alloc->size == old_size) {
-            // Found the allocation
-            if (new_size <= old_size) {
-                // Shrinking the allocation
-                alloc->size = new_size;
-                
-                // Unmap the extra pages
-                for (uint64_t virt_addr = (uintptr_t)addr + new_size; virt_addr < (uintptr_t)addr + old_size; virt_addr += PAGE_SIZE) {
-                    if (unmap_page(virt_addr) != 0) {
-                        return NULL;
-                    }
-                }
-                
-                return addr;
-            } else {
-                // Growing the allocation
-                // Check if we can grow in place
-                if ((uint8_t*)addr + old_size == kernel_heap_current) {
-                    // We can grow in place
-                    if ((uint8_t*)addr + new_size > (uint8_t*)kernel_heap_end) {
-                        // Not enough memory
-                        return NULL;
-                    }
-                    
-                    // Update the kernel heap pointer
-                    kernel_heap_current = (uint8_t*)addr + new_size;
-                    
-                    // Update the allocation
-                    alloc->size = new_size;
-                    
-                    // Set the memory protection for the new pages
-                    if (memory_set_protection((uint8_t*)addr + old_size, new_size - old_size, alloc->protection) != 0) {
-                        return NULL;
-                    }
-                    
-                    return addr;
-                } else {
-                    // We need to allocate a new block
-                    void* new_addr = memory_alloc(new_size, alloc->protection, alloc->flags);
-                    if (!new_addr) {
-                        return NULL;
-                    }
-                    
-                    // Copy the data
-                    memcpy(new_addr, addr, old_size);
-                    
-                    // Free the old block
-                    memory_free(addr, old_size);
-                    
-                    return new_addr;
-                }
-            }
-        }
-        
-        alloc = alloc->next;
+    if (!map) {
+        file_map_unlock();
+        return -1;
     }
     
-    return NULL;
+    stats->size = map->size;
+    stats->resident = (uint64_t)map->resident_pages * PAGE_SIZE;
+    stats->faults = map->faults;
+    
+    file_map_unlock();
+    
+    return 0;
 }
-
 /**
  * Get memory region information
  * 
@@ -653,9 +2744,42 @@ int memory_get_region(uint64_t address, memory_region_t* region) {
     return -1;
 }
 
+/**
+ * Apply memory protection flags to a page table entry
+ * 
+ * @param entry: Page table entry
+ * @param protection: Memory protection flags
+ * @return: Updated page table entry
+ */
+static uint64_t protection_to_entry(uint64_t entry, memory_prot_t protection) {
+    uint64_t flags = entry & ~(PTE_WRITABLE | PTE_USER | PTE_NX | PTE_PWT | PTE_PCD);
+    
+    // PWT selects PAT entry 1, which cpu.c sets to write-combining
+    if (protection & MEMORY_PROT_WRITE_COMBINE) {
+        flags |= cpu_has_feature(CPU_FEATURE_PAT) ? PTE_PWT : PTE_PCD;
+    }
+    
+    if (protection & MEMORY_PROT_WRITE) {
+        flags |= PTE_WRITABLE;
+    }
+    
+    if (protection & MEMORY_PROT_USER) {
+        flags |= PTE_USER;
+    }
+    
+    if (!(protection & MEMORY_PROT_EXEC)) {
+        flags |= memory_nx_mask;
+    }
+    
+    return flags;
+}
+
 /**
  * Set memory protection
  * 
+ * Large pages are only split when the range covers part of one with a
+ * different protection.
+ * 
  * @param addr: Address of the memory to protect
  * @param size: Size of the memory to protect
  * @param protection: Memory protection flags
@@ -670,69 +2794,57 @@ int memory_set_protection(void* addr, size_t size, memory_prot_t protection) {
     // Round up the size to a multiple of the page size
     size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     
+    uint64_t end = (uintptr_t)addr + size;
+    
     // Set the protection for each page
-    for (uint64_t virt_addr = (uintptr_t)addr; virt_addr < (uintptr_t)addr + size; virt_addr += PAGE_SIZE) {
-        // Get the page table indices
-        uint64_t pml4_idx = (virt_addr >> 39) & 0x1FF;
-        uint64_t pdpt_idx = (virt_addr >> 30) & 0x1FF;
-        uint64_t pd_idx = (virt_addr >> 21) & 0x1FF;
-        uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
-        
-        // Get the PML4 entry
-        pte_t* pml4e = &page_table_root[pml4_idx];
-        
-        if (!(*pml4e & PTE_PRESENT)) {
-            // Page not mapped
-            return -1;
-        }
+    for (uint64_t virt_addr = (uintptr_t)addr; virt_addr < end; ) {
+        // Get the PD entry
+        pte_t* pde = walk_page_directory(virt_addr, 0);
         
-        // Get the PDPT
-        pt_t pdpt = (pt_t)(uintptr_t)(*pml4e & ~0xFFF);
-        pte_t* pdpte = &pdpt[pdpt_idx];
-        
-        if (!(*pdpte & PTE_PRESENT)) {
+        if (!pde || !(*pde & PTE_PRESENT)) {
             // Page not mapped
             return -1;
         }
         
-        // Get the PD
-        pt_t pd = (pt_t)(uintptr_t)(*pdpte & ~0xFFF);
-        pte_t* pde = &pd[pd_idx];
-        
-        if (!(*pde & PTE_PRESENT)) {
-            // Page not mapped
-            return -1;
+        if (*pde & PTE_HUGE) {
+            uint64_t entry = protection_to_entry(*pde, protection);
+            uint64_t next = (virt_addr & ~(uint64_t)(HUGE_PAGE_SIZE - 1)) + HUGE_PAGE_SIZE;
+            
+            if (entry == *pde) {
+                // The large page already has this protection
+                virt_addr = next;
+                continue;
+            }
+            
+            if ((virt_addr & (HUGE_PAGE_SIZE - 1)) == 0 && end >= next) {
+                // The range covers the whole large page
+                *pde = entry;
+                __asm__ volatile("invlpg (%0)" : : "r"((uint32_t)virt_addr) : "memory");
+                virt_addr = next;
+                continue;
+            }
+            
+            if (split_huge_page(pde) != 0) {
+                return -1;
+            }
         }
         
         // Get the PT
-        pt_t pt = (pt_t)(uintptr_t)(*pde & ~0xFFF);
-        pte_t* pte = &pt[pt_idx];
+        pt_t pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+        pte_t* pte = &pt[(virt_addr >> 12) & 0x1FF];
         
         if (!(*pte & PTE_PRESENT)) {
             // Page not mapped
             return -1;
         }
         
-        // Set the protection
-        uint64_t flags = *pte & ~(PTE_WRITABLE | PTE_USER | PTE_NX);
-        
-        if (protection & MEMORY_PROT_WRITE) {
-            flags |= PTE_WRITABLE;
-        }
-        
-        if (protection & MEMORY_PROT_USER) {
-            flags |= PTE_USER;
-        }
-        
-        if (!(protection & MEMORY_PROT_EXEC)) {
-            flags |= PTE_NX;
-        }
-        
         // Update the page table entry
-        *pte = flags;
+        *pte = protection_to_entry(*pte, protection);
         
         // Invalidate the TLB entry
         __asm__ volatile("invlpg (%0)" : : "r"((uint32_t)virt_addr) : "memory");
+        
+        virt_addr += PAGE_SIZE;
     }
     
     return 0;
@@ -751,63 +2863,47 @@ int memory_get_protection(void* addr, memory_prot_t* protection) {
         return -1;
     }
     
-    // Get the page table indices
+    // Get the PD entry
     uint64_t virt_addr = (uintptr_t)addr;
-    uint64_t pml4_idx = (virt_addr >> 39) & 0x1FF;
-    uint64_t pdpt_idx = (virt_addr >> 30) & 0x1FF;
-    uint64_t pd_idx = (virt_addr >> 21) & 0x1FF;
-    uint64_t pt_idx = (virt_addr >> 12) & 0x1FF;
-    
-    // Get the PML4 entry
-    pte_t* pml4e = &page_table_root[pml4_idx];
-    
-    if (!(*pml4e & PTE_PRESENT)) {
-        // Page not mapped
-        return -1;
-    }
-    
-    // Get the PDPT
-    pt_t pdpt = (pt_t)(uintptr_t)(*pml4e & ~0xFFF);
-    pte_t* pdpte = &pdpt[pdpt_idx];
-    
-    if (!(*pdpte & PTE_PRESENT)) {
-        // Page not mapped
-        return -1;
-    }
-    
-    // Get the PD
-    pt_t pd = (pt_t)(uintptr_t)(*pdpte & ~0xFFF);
-    pte_t* pde = &pd[pd_idx];
+    pte_t* pde = walk_page_directory(virt_addr, 0);
     
-    if (!(*pde & PTE_PRESENT)) {
+    if (!pde || !(*pde & PTE_PRESENT)) {
         // Page not mapped
         return -1;
     }
     
-    // Get the PT
-    pt_t pt = (pt_t)(uintptr_t)(*pde & ~0xFFF);
-    pte_t* pte = &pt[pt_idx];
+    pte_t entry = *pde;
     
-    if (!(*pte & PTE_PRESENT)) {
-        // Page not mapped
-        return -1;
+    if (!(entry & PTE_HUGE)) {
+        // Get the PT
+        pt_t pt = (pt_t)(uintptr_t)(*pde & PTE_ADDR_MASK);
+        entry = pt[(virt_addr >> 12) & 0x1FF];
+        
+        if (!(entry & PTE_PRESENT)) {
+            // Page not mapped
+            return -1;
+        }
     }
     
     // Get the protection
     *protection = 0;
     
-    if (*pte & PTE_WRITABLE) {
+    if (entry & PTE_WRITABLE) {
         *protection |= MEMORY_PROT_WRITE;
     }
     
-    if (*pte & PTE_USER) {
+    if (entry & PTE_USER) {
         *protection |= MEMORY_PROT_USER;
     }
     
-    if (!(*pte & PTE_NX)) {
+    if (!(entry & PTE_NX)) {
         *protection |= MEMORY_PROT_EXEC;
     }
     
+    if (entry & (PTE_PWT | PTE_PCD)) {
+        *protection |= MEMORY_PROT_WRITE_COMBINE;
+    }
+    
     return 0;
 }
 
@@ -952,3 +3048,93 @@ uint64_t memory_virtual_to_physical(void* virtual_addr) {
     // Get the physical address
     return (*pte & ~0xFFF) | offset;
 }
+
+/**
+ * Print the kernel heap layout
+ */
+void memory_print_heap(void) {
+    if (!kernel_heap_start) {
+        console_printf("Kernel heap not initialized\n");
+        return;
+    }
+    
+    heap_lock();
+    
+    console_printf("Kernel heap: %p - %p (%u KB)\n", kernel_heap_start, kernel_heap_end,
+                   (unsigned int)(MEMORY_HEAP_SIZE / 1024));
+    console_printf("Free pages: %u of %u\n", (unsigned int)buddy_free_pages, (unsigned int)MEMORY_HEAP_PAGES);
+    
+    // Free blocks per buddy order
+    for (uint32_t order = 0; order <= MEMORY_BUDDY_MAX_ORDER; order++) {
+        if (buddy_free_counts[order]) {
+            console_printf("  order %u (%u KB): %u free blocks\n", order,
+                           (unsigned int)((PAGE_SIZE << order) / 1024), buddy_free_counts[order]);
+        }
+    }
+    
+    console_printf("Page allocations: %u\n", (unsigned int)memory_allocations_count);
+    
+    // Slab caches
+    console_printf("Slab caches:\n");
+    
+    for (int i = 0; i < MEMORY_MAX_CACHES; i++) {
+        memory_cache_t* cache = &memory_caches[i];
+        
+        if (!cache->in_use) {
+            continue;
+        }
+        
+        console_printf("  %s: object %u bytes, %u active, %u slabs of %u objects, %u allocs, %u frees\n",
+                       cache->name, (unsigned int)cache->object_size, (unsigned int)cache->active_objects,
+                       cache->num_slabs, cache->objects_per_slab, (unsigned int)cache->total_allocs,
+                       (unsigned int)cache->total_frees);
+    }
+    
+    heap_unlock();
+}
+
+/**
+ * Report allocations that are still live
+ */
+void memory_check_leaks(void) {
+    if (!kernel_heap_start) {
+        return;
+    }
+    
+    heap_lock();
+    
+    size_t leaked_blocks = 0;
+    size_t leaked_bytes = 0;
+    
+    // Page-granular allocations
+    for (memory_allocation_t* alloc = memory_allocations; alloc; alloc = alloc->next) {
+        console_printf("Leak: %p, %u bytes, flags 0x%x\n", alloc->address, (unsigned int)alloc->size, alloc->flags);
+        leaked_blocks++;
+        leaked_bytes += alloc->size;
+    }
+    
+    // Large page allocations
+    for (memory_allocation_t* alloc = memory_huge_allocations; alloc; alloc = alloc->next) {
+        console_printf("Leak: %p, %u bytes (large pages), flags 0x%x\n", alloc->address, (unsigned int)alloc->size, alloc->flags);
+        leaked_blocks++;
+        leaked_bytes += alloc->size;
+    }
+    
+    // Slab objects (the allocation records themselves are accounted above)
+    for (int i = 0; i < MEMORY_MAX_CACHES; i++) {
+        memory_cache_t* cache = &memory_caches[i];
+        
+        if (!cache->in_use || cache == memory_record_cache || cache->active_objects == 0) {
+            continue;
+        }
+        
+        console_printf("Leak: cache %s, %u objects of %u bytes\n", cache->name,
+                       (unsigned int)cache->active_objects, (unsigned int)cache->object_size);
+        leaked_blocks += cache->active_objects;
+        leaked_bytes += cache->active_objects * cache->object_size;
+    }
+    
+    heap_unlock();
+    
+    console_printf("%u live allocations, %u bytes\n", (unsigned int)leaked_blocks, (unsigned int)leaked_bytes);
+}
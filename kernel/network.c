@@ -8,6 +8,10 @@
 #include "include/network.h"
 #include "include/memory.h"
 #include "include/console.h"
+#include "include/interrupts.h"
+#include "include/process.h"
+#include "include/timer.h"
+#include "include/trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,8 +21,8 @@
 // Maximum number of network interfaces
 #define MAX_INTERFACES 8
 
-// Maximum number of network sockets
-#define MAX_SOCKETS 128
+// Maximum number of network sockets (a power of two: socket IDs encode the slot)
+#define MAX_SOCKETS 512
 
 // Network interface structure (internal implementation)
 typedef struct {
@@ -34,6 +38,64 @@ typedef struct {
     network_stats_t stats;
 } network_interface_internal_t;
 
+// Byte ring buffer
+//
+// The head and tail count bytes written and read since the ring was
+// created; their difference is the fill level and their low bits the
+// position in the buffer.
+typedef struct {
+    uint8_t* buffer;
+    uint32_t size;                      // Capacity in bytes (a power of two)
+    volatile uint32_t head;             // Bytes written
+    volatile uint32_t tail;             // Bytes read
+} network_ring_t;
+
+// Network driver operations (the driver data of an interface)
+typedef struct {
+    int (*send)(void* data, size_t size, const network_address_t* dest);
+    int (*recv)(void* buffer, size_t size, network_address_t* src);
+    int (*init)(void);
+    int (*shutdown)(void);
+    int (*accept)(uint16_t port, void* conn_info);
+    int (*queue_tx)(void* tx_item);     // Takes over a network_buffer_t reference on success
+} network_driver_t;
+
+// Registration of a socket with a poll set
+typedef struct {
+    uint32_t socket_id;
+    uint32_t events;                    // NETWORK_EVENT_* of interest
+    void* data;
+    uint8_t registered;
+    uint8_t queued;                     // On the ready list
+} network_poll_entry_t;
+
+// Poll set
+//
+// Entries are indexed by socket slot. A readiness change queues the entry
+// on the ready list, so a wait inspects only the sockets that changed.
+// Level-triggered entries stay queued while their socket is ready.
+typedef struct {
+    uint32_t id;
+    network_poll_entry_t entries[MAX_SOCKETS];
+    uint16_t ready[MAX_SOCKETS];        // Ready list (ring of socket slots)
+    uint32_t ready_head;
+    uint32_t ready_count;
+    uint32_t num_entries;
+    volatile pid_t waiter;              // Process in network_poll_wait, -1 if none
+    volatile int wake;                  // Set to wake the waiter
+    hrtimer_t timer;                    // Wait timeout
+    volatile int lock;
+} network_poll_set_t;
+
+// Packet buffer pool
+typedef struct {
+    network_buffer_t buffers[NETWORK_BUFFER_COUNT];
+    uint8_t* data;                      // Data areas of all buffers
+    network_buffer_t* free_list;
+    uint32_t free_count;
+    volatile int lock;
+} network_buffer_pool_t;
+
 // Network socket structure (internal implementation)
 typedef struct {
     uint32_t id;
@@ -44,8 +106,11 @@ typedef struct {
     uint16_t local_port;
     network_address_t remote_address;
     uint16_t remote_port;
-    void* data;
-    size_t data_size;
+    network_ring_t tx;                  // Data queued by send, drained to the driver
+    network_ring_t rx;                  // Data delivered by the driver, drained by recv
+    uint32_t backlog;                   // Listening: pending connections kept at most
+    uint32_t pending_connections;       // Listening: connections signalled by the driver
+    uint32_t poll_sets;                 // Poll sets the socket is registered with (bit per set)
     network_socket_stats_t stats;
 } network_socket_internal_t;
 
@@ -55,16 +120,38 @@ static network_interface_internal_t interfaces[MAX_INTERFACES];
 // Network socket table
 static network_socket_internal_t sockets[MAX_SOCKETS];
 
+// Packet buffer pool
+static network_buffer_pool_t buffer_pool;
+
+// Poll sets (by set ID - 1)
+static network_poll_set_t* poll_sets[NETWORK_POLL_MAX_SETS];
+
 // Next available interface ID
 static int next_interface_id = 1;
 
-// Next available socket ID
-static int next_socket_id = 1;
+// Free socket slots (a stack)
+static int socket_free_slots[MAX_SOCKETS];
+static int socket_free_count = 0;
+
+// Times each socket slot has been used, so a stale ID does not match a new socket
+static uint32_t socket_generations[MAX_SOCKETS];
+
+// Tracepoints
+static const trace_point_t network_trace_send = { "net_send", TRACE_CAT_NET, { "socket", "bytes" } };
+static const trace_point_t network_trace_recv = { "net_recv", TRACE_CAT_NET, { "socket", "bytes" } };
 
 // Forward declarations
 static int network_interface_exists(const char* name, int* exists);
 static int network_find_free_interface_slot(void);
-static int network_find_free_socket_slot(void);
+static int network_socket_alloc(uint32_t type, uint32_t protocol);
+static void network_socket_free(int slot);
+static int network_find_socket_slot(uint32_t id);
+static int network_interface_for_socket(int slot);
+static network_driver_t* network_socket_driver(int slot);
+static void network_socket_transmit(int slot);
+static size_t network_socket_queue(int slot, network_driver_t* driver, memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, int by_reference);
+static uint32_t network_socket_readiness(int slot);
+static void network_poll_notify(int slot);
 
 /**
  * Initialize the network subsystem
@@ -75,11 +162,34 @@ int network_init(void) {
         memset(&interfaces[i], 0, sizeof(network_interface_internal_t));
     }
     
-    // Initialize the socket table
+    // Initialize the socket table (slot 0 on top of the free stack)
     for (int i = 0; i < MAX_SOCKETS; i++) {
         memset(&sockets[i], 0, sizeof(network_socket_internal_t));
+        socket_free_slots[i] = MAX_SOCKETS - 1 - i;
+    }
+    
+    socket_free_count = MAX_SOCKETS;
+    
+    // Preallocate the packet buffers
+    buffer_pool.data = (uint8_t*)memory_alloc(NETWORK_BUFFER_COUNT * NETWORK_BUFFER_SIZE,
+                                              MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!buffer_pool.data) {
+        console_printf("Error: Failed to allocate packet buffer pool\n");
+        return -1;
+    }
+    
+    buffer_pool.free_list = NULL;
+    
+    for (int i = NETWORK_BUFFER_COUNT - 1; i >= 0; i--) {
+        buffer_pool.buffers[i].head = buffer_pool.data + (size_t)i * NETWORK_BUFFER_SIZE;
+        buffer_pool.buffers[i].capacity = NETWORK_BUFFER_SIZE;
+        buffer_pool.buffers[i].next = buffer_pool.free_list;
+        buffer_pool.free_list = &buffer_pool.buffers[i];
     }
     
+    buffer_pool.free_count = NETWORK_BUFFER_COUNT;
+    buffer_pool.lock = 0;
+    
     console_printf("Network subsystem initialized\n");
     return 0;
 }
@@ -124,18 +234,531 @@ static int network_find_free_interface_slot(void) {
 }
 
 /**
- * Find a free socket slot
+ * Initialize a ring buffer
  * 
- * @return: Index of a free slot, or -1 if no free slots
+ * @param ring: Ring buffer
+ * @param size: Capacity in bytes (a power of two)
+ * @return: 0 on success, -1 on failure
  */
-static int network_find_free_socket_slot(void) {
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == 0) {
-            return i;
+static int network_ring_init(network_ring_t* ring, uint32_t size) {
+    ring->buffer = (uint8_t*)memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!ring->buffer) {
+        return -1;
+    }
+    
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    
+    return 0;
+}
+
+/**
+ * Free a ring buffer
+ * 
+ * @param ring: Ring buffer
+ */
+static void network_ring_free(network_ring_t* ring) {
+    if (ring->buffer) {
+        memory_free(ring->buffer, ring->size);
+    }
+    
+    memset(ring, 0, sizeof(network_ring_t));
+}
+
+/**
+ * Get the number of bytes queued in a ring buffer
+ */
+static inline uint32_t network_ring_used(const network_ring_t* ring) {
+    return ring->head - ring->tail;
+}
+
+/**
+ * Get the number of bytes that can be written to a ring buffer
+ */
+static inline uint32_t network_ring_space(const network_ring_t* ring) {
+    return ring->size - (ring->head - ring->tail);
+}
+
+/**
+ * Write to a ring buffer
+ * 
+ * Writes as much of the data as fits; the rest is left to the caller.
+ * 
+ * @param ring: Ring buffer
+ * @param data: Data to write
+ * @param size: Size of the data
+ * @return: Number of bytes written
+ */
+static size_t network_ring_write(network_ring_t* ring, const void* data, size_t size) {
+    uint32_t space = network_ring_space(ring);
+    uint32_t count = size < space ? (uint32_t)size : space;
+    uint32_t offset = ring->head & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    
+    if (first > count) {
+        first = count;
+    }
+    
+    // Up to two copies: to the end of the buffer, then from its start
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, (const uint8_t*)data + first, count - first);
+    
+    // Publish the data before the new head
+    __sync_synchronize();
+    ring->head += count;
+    
+    return count;
+}
+
+/**
+ * Read from a ring buffer
+ * 
+ * @param ring: Ring buffer
+ * @param data: Buffer to store the data
+ * @param size: Size of the buffer
+ * @return: Number of bytes read
+ */
+static size_t network_ring_read(network_ring_t* ring, void* data, size_t size) {
+    uint32_t used = network_ring_used(ring);
+    uint32_t count = size < used ? (uint32_t)size : used;
+    uint32_t offset = ring->tail & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    
+    if (first > count) {
+        first = count;
+    }
+    
+    memcpy(data, ring->buffer + offset, first);
+    memcpy((uint8_t*)data + first, ring->buffer, count - first);
+    
+    // Finish reading before the space is handed back to the writer
+    __sync_synchronize();
+    ring->tail += count;
+    
+    return count;
+}
+
+/**
+ * Disable interrupts and take a network lock (the packet buffer pool or a
+ * poll set, both used from interrupt context)
+ * 
+ * @param lock: Lock
+ * @return: Whether interrupts were enabled
+ */
+static int network_lock(volatile int* lock) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*lock) {
+            __asm__ volatile("pause");
         }
     }
     
-    return -1;
+    return irq_enabled;
+}
+
+/**
+ * Release a network lock and restore interrupts
+ * 
+ * @param lock: Lock
+ * @param irq_enabled: Value returned by network_lock
+ */
+static void network_unlock(volatile int* lock, int irq_enabled) {
+    __sync_lock_release(lock);
+    
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Allocate a packet buffer
+ * 
+ * The buffer is empty, with NETWORK_BUFFER_HEADROOM bytes of headroom and
+ * a reference count of 1. Safe to call from interrupt context.
+ * 
+ * @return: Packet buffer, or NULL if the pool is exhausted
+ */
+network_buffer_t* network_buffer_alloc(void) {
+    int irq_enabled = network_lock(&buffer_pool.lock);
+    
+    network_buffer_t* buffer = buffer_pool.free_list;
+    
+    if (buffer) {
+        buffer_pool.free_list = buffer->next;
+        buffer_pool.free_count--;
+    }
+    
+    network_unlock(&buffer_pool.lock, irq_enabled);
+    
+    if (!buffer) {
+        return NULL;
+    }
+    
+    buffer->next = NULL;
+    buffer->data = buffer->head + NETWORK_BUFFER_HEADROOM;
+    buffer->len = 0;
+    buffer->refcount = 1;
+    buffer->fragment = NULL;
+    buffer->fragment_len = 0;
+    buffer->socket_id = 0;
+    
+    return buffer;
+}
+
+/**
+ * Take a reference to a packet buffer
+ * 
+ * @param buffer: Packet buffer
+ */
+void network_buffer_get(network_buffer_t* buffer) {
+    __sync_fetch_and_add(&buffer->refcount, 1);
+}
+
+/**
+ * Drop a reference to a packet buffer, returning it to the pool with the last
+ * 
+ * @param buffer: Packet buffer
+ */
+void network_buffer_put(network_buffer_t* buffer) {
+    if (!buffer || __sync_sub_and_fetch(&buffer->refcount, 1) != 0) {
+        return;
+    }
+    
+    int irq_enabled = network_lock(&buffer_pool.lock);
+    
+    buffer->next = buffer_pool.free_list;
+    buffer_pool.free_list = buffer;
+    buffer_pool.free_count++;
+    
+    network_unlock(&buffer_pool.lock, irq_enabled);
+}
+
+/**
+ * Prepend bytes to a packet (for a protocol header)
+ * 
+ * @param buffer: Packet buffer
+ * @param size: Number of bytes
+ * @return: Start of the new bytes, or NULL if the headroom is too small
+ */
+uint8_t* network_buffer_push(network_buffer_t* buffer, size_t size) {
+    if (size > (size_t)(buffer->data - buffer->head)) {
+        return NULL;
+    }
+    
+    buffer->data -= size;
+    buffer->len += (uint32_t)size;
+    
+    return buffer->data;
+}
+
+/**
+ * Remove bytes from the front of a packet (a parsed protocol header)
+ * 
+ * @param buffer: Packet buffer
+ * @param size: Number of bytes
+ * @return: New start of the packet, or NULL if the packet is shorter
+ */
+uint8_t* network_buffer_pull(network_buffer_t* buffer, size_t size) {
+    if (size > buffer->len) {
+        return NULL;
+    }
+    
+    buffer->data += size;
+    buffer->len -= (uint32_t)size;
+    
+    return buffer->data;
+}
+
+/**
+ * Extend a packet at its end
+ * 
+ * @param buffer: Packet buffer
+ * @param size: Number of bytes
+ * @return: Start of the new bytes, or NULL if the data area is too small
+ */
+uint8_t* network_buffer_append(network_buffer_t* buffer, size_t size) {
+    uint8_t* tail = buffer->data + buffer->len;
+    
+    if (size > (size_t)(buffer->head + buffer->capacity - tail)) {
+        return NULL;
+    }
+    
+    buffer->len += (uint32_t)size;
+    
+    return tail;
+}
+
+/**
+ * Read from a backing file into a ring buffer
+ * 
+ * Reads straight into the free space of the ring, as much as fits.
+ * 
+ * @param ring: Ring buffer
+ * @param reader: Backing file reader
+ * @param ctx: Reader context
+ * @param offset: Offset in the file
+ * @param size: Number of bytes
+ * @return: Number of bytes read
+ */
+static size_t network_ring_fill(network_ring_t* ring, memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size) {
+    size_t total = 0;
+    
+    // Up to two reads: to the end of the buffer, then from its start
+    for (int part = 0; part < 2 && total < size; part++) {
+        uint32_t space = network_ring_space(ring);
+        uint32_t position = ring->head & (ring->size - 1);
+        uint32_t count = ring->size - position;
+        
+        if (count > space) {
+            count = space;
+        }
+        if (count > size - total) {
+            count = (uint32_t)(size - total);
+        }
+        if (count == 0) {
+            break;
+        }
+        
+        size_t read = reader(ctx, offset + total, ring->buffer + position, count);
+        
+        __sync_synchronize();
+        ring->head += (uint32_t)read;
+        total += read;
+        
+        if (read < count) {
+            break;
+        }
+    }
+    
+    return total;
+}
+
+/**
+ * Allocate a socket slot and its buffers
+ * 
+ * @param type: Socket type
+ * @param protocol: Socket protocol
+ * @return: Slot of the new socket, or -1 on failure
+ */
+static int network_socket_alloc(uint32_t type, uint32_t protocol) {
+    if (socket_free_count == 0) {
+        return -1;
+    }
+    
+    int slot = socket_free_slots[socket_free_count - 1];
+    network_socket_internal_t* socket = &sockets[slot];
+    
+    if (network_ring_init(&socket->tx, NETWORK_SOCKET_BUFFER_SIZE) != 0) {
+        return -1;
+    }
+    
+    if (network_ring_init(&socket->rx, NETWORK_SOCKET_BUFFER_SIZE) != 0) {
+        network_ring_free(&socket->tx);
+        return -1;
+    }
+    
+    socket_free_count--;
+    
+    // The low bits of the ID are the slot, the rest the slot generation
+    socket->id = socket_generations[slot]++ * MAX_SOCKETS + (uint32_t)slot + 1;
+    socket->type = type;
+    socket->protocol = protocol;
+    
+    return slot;
+}
+
+/**
+ * Free a socket slot and its buffers
+ * 
+ * @param slot: Socket slot
+ */
+static void network_socket_free(int slot) {
+    // Poll sets report the hangup once the slot no longer holds the socket
+    uint32_t registered = sockets[slot].poll_sets;
+    
+    network_ring_free(&sockets[slot].tx);
+    network_ring_free(&sockets[slot].rx);
+    memset(&sockets[slot], 0, sizeof(network_socket_internal_t));
+    
+    sockets[slot].poll_sets = registered;
+    network_poll_notify(slot);
+    sockets[slot].poll_sets = 0;
+    
+    socket_free_slots[socket_free_count++] = slot;
+}
+
+/**
+ * Find the slot of a socket
+ * 
+ * @param id: Socket ID
+ * @return: Slot of the socket, or -1 if there is no such socket
+ */
+static int network_find_socket_slot(uint32_t id) {
+    if (id == 0) {
+        return -1;
+    }
+    
+    int slot = (int)((id - 1) & (MAX_SOCKETS - 1));
+    
+    return sockets[slot].id == id ? slot : -1;
+}
+
+/**
+ * Find the interface a socket sends on
+ * 
+ * @param slot: Socket slot
+ * @return: Index of the interface bound to the socket address, else of the
+ *          first active interface, or -1 if there are no interfaces
+ */
+static int network_interface_for_socket(int slot) {
+    int interface_index = -1;
+    
+    for (int i = 0; i < MAX_INTERFACES; i++) {
+        if (interfaces[i].id != 0) {
+            // Check if the socket is bound to this interface's address
+            if (memcmp(&sockets[slot].local_address, &interfaces[i].ip_address, sizeof(network_address_t)) == 0) {
+                return i;
+            }
+            
+            if (interface_index == -1) {
+                interface_index = i;
+            }
+        }
+    }
+    
+    return interface_index;
+}
+
+/**
+ * Get the driver of the interface a socket sends on
+ * 
+ * @param slot: Socket slot
+ * @return: Driver operations, or NULL if there is no driver (loopback)
+ */
+static network_driver_t* network_socket_driver(int slot) {
+    int interface_index = network_interface_for_socket(slot);
+    
+    if (interface_index == -1) {
+        return NULL;
+    }
+    
+    return (network_driver_t*)interfaces[interface_index].driver_data;
+}
+
+/**
+ * Drain the transmit ring of a socket
+ * 
+ * Queued data goes to the send operation of the interface driver. Without a
+ * driver the data loops back into the receive ring of the socket, as far as
+ * it has space.
+ * 
+ * @param slot: Socket slot
+ */
+static void network_socket_transmit(int slot) {
+    network_socket_internal_t* socket = &sockets[slot];
+    network_driver_t* driver = network_socket_driver(slot);
+    uint32_t start = socket->tx.tail;
+    
+    while (network_ring_used(&socket->tx) > 0) {
+        // Hand the data over in place, one contiguous run at a time
+        uint32_t offset = socket->tx.tail & (socket->tx.size - 1);
+        uint32_t count = network_ring_used(&socket->tx);
+        
+        if (count > socket->tx.size - offset) {
+            count = socket->tx.size - offset;
+        }
+        
+        if (driver && driver->send) {
+            if (driver->send(socket->tx.buffer + offset, count, &socket->remote_address) != 0) {
+                // Leave the data queued for the next attempt
+                socket->stats.tx_errors++;
+                break;
+            }
+        } else {
+            count = (uint32_t)network_ring_write(&socket->rx, socket->tx.buffer + offset, count);
+            if (count == 0) {
+                break;
+            }
+        }
+        
+        __sync_synchronize();
+        socket->tx.tail += count;
+    }
+    
+    // Room in the transmit ring (and looped back data) may wake pollers
+    if (socket->tx.tail != start) {
+        network_poll_notify(slot);
+    }
+}
+
+/**
+ * Queue data as packets on the driver of a socket
+ * 
+ * The payload goes from its source into a packet buffer with no copy in
+ * between: a backing file is read into the buffer, caller memory is copied
+ * into it, and memory referenced by_reference becomes the buffer fragment.
+ * 
+ * @param slot: Socket slot
+ * @param driver: Driver with a queue_tx operation
+ * @param reader: Backing file reader, or NULL for memory at ctx
+ * @param ctx: Reader context, or the memory to send
+ * @param offset: Offset in the file or memory
+ * @param size: Number of bytes
+ * @param by_reference: For memory, whether it outlives the packets and is
+ *                      referenced rather than copied
+ * @return: Number of bytes queued (less than size if the pool ran out or the
+ *          driver refused a packet)
+ */
+static size_t network_socket_queue(int slot, network_driver_t* driver, memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, int by_reference) {
+    network_socket_internal_t* socket = &sockets[slot];
+    size_t total = 0;
+    
+    while (total < size) {
+        size_t count = size - total;
+        
+        if (count > NETWORK_BUFFER_PAYLOAD) {
+            count = NETWORK_BUFFER_PAYLOAD;
+        }
+        
+        network_buffer_t* buffer = network_buffer_alloc();
+        if (!buffer) {
+            socket->stats.tx_dropped++;
+            break;
+        }
+        
+        buffer->socket_id = socket->id;
+        
+        if (reader) {
+            count = reader(ctx, offset + total, network_buffer_append(buffer, count), count);
+            buffer->len = (uint32_t)count;
+        } else if (by_reference) {
+            buffer->fragment = (const uint8_t*)ctx + offset + total;
+            buffer->fragment_len = (uint32_t)count;
+        } else {
+            memcpy(network_buffer_append(buffer, count), (const uint8_t*)ctx + offset + total, count);
+        }
+        
+        if (count == 0) {
+            network_buffer_put(buffer);
+            break;
+        }
+        
+        // The driver owns the reference once it accepts the packet
+        if (driver->queue_tx(buffer) != 0) {
+            network_buffer_put(buffer);
+            socket->stats.tx_errors++;
+            break;
+        }
+        
+        socket->stats.tx_packets++;
+        socket->stats.tx_bytes += count;
+        total += count;
+    }
+    
+    return total;
 }
 
 /**
@@ -288,19 +911,14 @@ int network_socket_create(uint32_t type, uint32_t protocol, uint32_t* id) {
         return -1;
     }
     
-    // Find a free slot
-    int slot = network_find_free_socket_slot();
+    // Allocate a slot and the socket buffers
+    int slot = network_socket_alloc(type, protocol);
     
     if (slot == -1) {
         console_printf("Error: No free socket slots\n");
         return -1;
     }
     
-    // Initialize the socket
-    sockets[slot].id = next_socket_id++;
-    sockets[slot].type = type;
-    sockets[slot].protocol = protocol;
-    
     // Return the socket ID
     *id = sockets[slot].id;
     
@@ -316,18 +934,18 @@ int network_socket_create(uint32_t type, uint32_t protocol, uint32_t* id) {
  */
 int network_socket_close(uint32_t id) {
     // Find the socket
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            // Clear the socket
-            memset(&sockets[i], 0, sizeof(network_socket_internal_t));
-            
-            console_printf("Closed network socket (ID: %u)\n", id);
-            return 0;
-        }
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
     }
     
-    console_printf("Error: Socket not found\n");
-    return -1;
+    // Free the socket and its buffers
+    network_socket_free(socket_index);
+    
+    console_printf("Closed network socket (ID: %u)\n", id);
+    return 0;
 }
 
 /**
@@ -346,19 +964,19 @@ int network_socket_bind(uint32_t id, const network_address_t* address, uint16_t
     }
     
     // Find the socket
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            // Bind the socket
-            memcpy(&sockets[i].local_address, address, sizeof(network_address_t));
-            sockets[i].local_port = port;
-            
-            console_printf("Bound network socket (ID: %u)\n", id);
-            return 0;
-        }
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
     }
     
-    console_printf("Error: Socket not found\n");
-    return -1;
+    // Bind the socket
+    memcpy(&sockets[socket_index].local_address, address, sizeof(network_address_t));
+    sockets[socket_index].local_port = port;
+    
+    console_printf("Bound network socket (ID: %u)\n", id);
+    return 0;
 }
 
 /**
@@ -377,19 +995,19 @@ int network_socket_connect(uint32_t id, const network_address_t* address, uint16
     }
     
     // Find the socket
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            // Connect the socket
-            memcpy(&sockets[i].remote_address, address, sizeof(network_address_t));
-            sockets[i].remote_port = port;
-            
-            console_printf("Connected network socket (ID: %u)\n", id);
-            return 0;
-        }
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
     }
     
-    console_printf("Error: Socket not found\n");
-    return -1;
+    // Connect the socket
+    memcpy(&sockets[socket_index].remote_address, address, sizeof(network_address_t));
+    sockets[socket_index].remote_port = port;
+    
+    console_printf("Connected network socket (ID: %u)\n", id);
+    return 0;
 }
 
 /**
@@ -399,20 +1017,21 @@ int network_socket_connect(uint32_t id, const network_address_t* address, uint16
  * @param backlog: Maximum number of pending connections
  * @return: 0 on success, -1 on failure
  */
-int network_socket_listen(uint32_t id, int backlog __attribute__((unused))) {
+int network_socket_listen(uint32_t id, int backlog) {
     // Find the socket
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            // Set the socket to listening mode
-            sockets[i].flags |= NETWORK_SOCKET_FLAG_LISTENING;
-            
-            console_printf("Network socket listening (ID: %u)\n", id);
-            return 0;
-        }
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
     }
     
-    console_printf("Error: Socket not found\n");
-    return -1;
+    // Set the socket to listening mode
+    sockets[socket_index].flags |= NETWORK_SOCKET_FLAG_LISTENING;
+    sockets[socket_index].backlog = backlog > 0 ? (uint32_t)backlog : 1;
+    
+    console_printf("Network socket listening (ID: %u)\n", id);
+    return 0;
 }
 
 /**
@@ -432,13 +1051,7 @@ int network_socket_accept(uint32_t id, uint32_t* client_id, network_address_t* c
     }
     
     // Find the socket
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            socket_index = i;
-            break;
-        }
-    }
+    int socket_index = network_find_socket_slot(id);
     
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
@@ -451,57 +1064,29 @@ int network_socket_accept(uint32_t id, uint32_t* client_id, network_address_t* c
         return -1;
     }
     
-    // Find a free slot for the client socket
-    int client_slot = network_find_free_socket_slot();
+    // Take one of the connections signalled by the driver, if any
+    if (sockets[socket_index].pending_connections > 0) {
+        sockets[socket_index].pending_connections--;
+    }
+    
+    // Create a new socket for the client
+    int client_slot = network_socket_alloc(sockets[socket_index].type, sockets[socket_index].protocol);
     if (client_slot == -1) {
         console_printf("Error: No free socket slots for client\n");
         return -1;
     }
     
-    // Create a new socket for the client
-    sockets[client_slot].id = next_socket_id++;
-    sockets[client_slot].type = sockets[socket_index].type;
-    sockets[client_slot].protocol = sockets[socket_index].protocol;
     sockets[client_slot].flags = NETWORK_SOCKET_FLAG_CONNECTED;
     
     // Set the local address and port to match the server
     memcpy(&sockets[client_slot].local_address, &sockets[socket_index].local_address, sizeof(network_address_t));
     sockets[client_slot].local_port = sockets[socket_index].local_port;
     
-    // Find the interface that the socket is bound to
-    int interface_index = -1;
-    for (int i = 0; i < MAX_INTERFACES; i++) {
-        if (interfaces[i].id != 0) {
-            // Check if the socket is bound to this interface's address
-            if (memcmp(&sockets[socket_index].local_address, &interfaces[i].ip_address, sizeof(network_address_t)) == 0) {
-                interface_index = i;
-                break;
-            }
-        }
-    }
-    
-    // If no specific interface found, use the first active interface
-    if (interface_index == -1) {
-        for (int i = 0; i < MAX_INTERFACES; i++) {
-            if (interfaces[i].id != 0) {
-                interface_index = i;
-                break;
-            }
-        }
-    }
+    // Find the interface that the socket is bound to (or the first active one)
+    int interface_index = network_interface_for_socket(socket_index);
     
     // Get the client address from the network interface driver
     if (interface_index != -1 && interfaces[interface_index].driver_data) {
-        // The driver data should contain function pointers for operations
-        typedef struct {
-            int (*send)(void* data, size_t size, const network_address_t* dest);
-            int (*recv)(void* buffer, size_t size, network_address_t* src);
-            int (*init)(void);
-            int (*shutdown)(void);
-            int (*accept)(uint16_t port, void* conn_info);
-            int (*queue_tx)(void* tx_item);
-        } network_driver_t;
-        
         network_driver_t* driver = (network_driver_t*)interfaces[interface_index].driver_data;
         
         // Structure to hold connection information
@@ -593,7 +1178,8 @@ int network_socket_accept(uint32_t id, uint32_t* client_id, network_address_t* c
  * @param data: Data to send
  * @param size: Size of the data
  * @param sent: Pointer to store the number of bytes sent
- * @return: 0 on success, -1 on failure
+ * @return: 0 on success, NETWORK_ERROR_BUSY if the transmit ring is full,
+ *          -1 on failure
  */
 int network_socket_send(uint32_t id, const void* data, size_t size, size_t* sent) {
     // Check if the data and sent pointers are valid
@@ -603,13 +1189,7 @@ int network_socket_send(uint32_t id, const void* data, size_t size, size_t* sent
     }
     
     // Find the socket
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            socket_index = i;
-            break;
-        }
-    }
+    int socket_index = network_find_socket_slot(id);
     
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
@@ -622,42 +1202,24 @@ int network_socket_send(uint32_t id, const void* data, size_t size, size_t* sent
         return -1;
     }
     
-    // Allocate or resize the socket's data buffer
-    if (sockets[socket_index].data == NULL) {
-        sockets[socket_index].data = memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-        if (!sockets[socket_index].data) {
-            console_printf("Error: Failed to allocate socket data buffer\n");
-            return -1;
-        }
-        sockets[socket_index].data_size = size;
-        memcpy(sockets[socket_index].data, data, size);
-    } else {
-        // Resize the buffer
-        void* new_buffer = memory_alloc(sockets[socket_index].data_size + size, 
-                                       MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-        if (!new_buffer) {
-            console_printf("Error: Failed to resize socket data buffer\n");
-            return -1;
-        }
-        
-        // Copy existing data and new data
-        memcpy(new_buffer, sockets[socket_index].data, sockets[socket_index].data_size);
-        memcpy((char*)new_buffer + sockets[socket_index].data_size, data, size);
-        
-        // Free the old buffer
-        memory_free(sockets[socket_index].data, sockets[socket_index].data_size);
-        
-        // Update the socket's data buffer
-        sockets[socket_index].data = new_buffer;
-        sockets[socket_index].data_size += size;
+    // Queue as much as the transmit ring has room for, and pass it on
+    size_t queued = network_ring_write(&sockets[socket_index].tx, data, size);
+    network_socket_transmit(socket_index);
+    
+    if (queued == 0) {
+        // Backpressure: the ring is full until the driver catches up
+        *sent = 0;
+        return NETWORK_ERROR_BUSY;
     }
     
     // Update statistics
     sockets[socket_index].stats.tx_packets++;
-    sockets[socket_index].stats.tx_bytes += size;
+    sockets[socket_index].stats.tx_bytes += queued;
     
-    // Set the number of bytes sent
-    *sent = size;
+    trace_instant(&network_trace_send, id, (uint32_t)queued);
+    
+    // Set the number of bytes sent (less than size if the ring filled up)
+    *sent = queued;
     
     console_printf("Sent %zu bytes on network socket (ID: %u)\n", *sent, id);
     return 0;
@@ -680,14 +1242,177 @@ int network_socket_recv(network_socket_t* socket, void* data, size_t size, size_
     }
     
     // Find the socket in our internal table
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == socket->id) {
-            socket_index = i;
+    int socket_index = network_find_socket_slot(socket->id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
+    }
+    
+    // Check if the socket is connected
+    if (!(sockets[socket_index].flags & NETWORK_SOCKET_FLAG_CONNECTED)) {
+        console_printf("Error: Socket is not connected\n");
+        return -1;
+    }
+    
+    // Take what has arrived; an empty ring is not an error
+    size_t bytes_to_copy = network_ring_read(&sockets[socket_index].rx, data, size);
+    
+    if (bytes_to_copy == 0) {
+        *received = 0;
+        return 0;
+    }
+    
+    // The space freed may let queued transmit data through
+    if (network_ring_used(&sockets[socket_index].tx) > 0) {
+        network_socket_transmit(socket_index);
+    }
+    
+    // Update statistics
+    sockets[socket_index].stats.rx_packets++;
+    sockets[socket_index].stats.rx_bytes += bytes_to_copy;
+    
+    trace_instant(&network_trace_recv, socket->id, (uint32_t)bytes_to_copy);
+    
+    // Set the number of bytes received
+    *received = bytes_to_copy;
+    
+    console_printf("Received %zu bytes on network socket (ID: %u)\n", *received, socket->id);
+    return 0;
+}
+
+/**
+ * Deliver received data to a network socket
+ * 
+ * Called by interface drivers. Data beyond the free space of the receive
+ * ring is dropped; the driver can retry with the rest once it is read.
+ * 
+ * @param id: Socket ID
+ * @param data: Received data
+ * @param size: Size of the data
+ * @param accepted: Pointer to store the number of bytes queued
+ * @return: 0 on success, -1 on failure
+ */
+int network_socket_deliver(uint32_t id, const void* data, size_t size, size_t* accepted) {
+    // Check if the data and accepted pointers are valid
+    if (!data || !accepted) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    // Find the socket
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
+    }
+    
+    *accepted = network_ring_write(&sockets[socket_index].rx, data, size);
+    
+    if (*accepted < size) {
+        sockets[socket_index].stats.rx_dropped++;
+    }
+    
+    if (*accepted > 0) {
+        network_poll_notify(socket_index);
+    }
+    
+    return 0;
+}
+
+/**
+ * Send data gathered from several buffers on a network socket
+ * 
+ * With a driver that queues packets, each buffer is copied once, into
+ * packet buffers; otherwise the data goes through the transmit ring like
+ * network_socket_send.
+ * 
+ * @param id: Socket ID
+ * @param iov: Buffers to send, in order
+ * @param iov_count: Number of buffers
+ * @param sent: Pointer to store the number of bytes sent
+ * @return: 0 on success, NETWORK_ERROR_BUSY if nothing could be queued,
+ *          -1 on failure
+ */
+int network_socket_sendv(uint32_t id, const network_iovec_t* iov, int iov_count, size_t* sent) {
+    // Check if the iov and sent pointers are valid
+    if (!iov || !sent || iov_count <= 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    // Find the socket
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
+    }
+    
+    // Check if the socket is connected
+    if (!(sockets[socket_index].flags & NETWORK_SOCKET_FLAG_CONNECTED)) {
+        console_printf("Error: Socket is not connected\n");
+        return -1;
+    }
+    
+    network_driver_t* driver = network_socket_driver(socket_index);
+    size_t total = 0;
+    
+    for (int i = 0; i < iov_count; i++) {
+        size_t count;
+        
+        if (driver && driver->queue_tx) {
+            count = network_socket_queue(socket_index, driver, NULL, iov[i].base, 0, iov[i].len, 0);
+        } else {
+            count = network_ring_write(&sockets[socket_index].tx, iov[i].base, iov[i].len);
+            network_socket_transmit(socket_index);
+            
+            sockets[socket_index].stats.tx_bytes += count;
+        }
+        
+        total += count;
+        
+        // Stop at the first buffer that did not go out whole
+        if (count < iov[i].len) {
             break;
         }
     }
     
+    *sent = total;
+    
+    if (total == 0) {
+        return NETWORK_ERROR_BUSY;
+    }
+    
+    if (!driver || !driver->queue_tx) {
+        sockets[socket_index].stats.tx_packets++;
+    }
+    
+    trace_instant(&network_trace_send, id, (uint32_t)total);
+    
+    return 0;
+}
+
+/**
+ * Receive data on a network socket, scattered into several buffers
+ * 
+ * @param socket: Socket structure
+ * @param iov: Buffers to fill, in order
+ * @param iov_count: Number of buffers
+ * @param received: Pointer to store the number of bytes received
+ * @return: 0 on success, -1 on failure
+ */
+int network_socket_recvv(network_socket_t* socket, const network_iovec_t* iov, int iov_count, size_t* received) {
+    // Check if the socket, iov, and received pointers are valid
+    if (!socket || !iov || !received || iov_count <= 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    // Find the socket in our internal table
+    int socket_index = network_find_socket_slot(socket->id);
+    
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
         return -1;
@@ -699,56 +1424,107 @@ int network_socket_recv(network_socket_t* socket, void* data, size_t size, size_
         return -1;
     }
     
-    // Check if there's any data to receive
-    if (sockets[socket_index].data == NULL || sockets[socket_index].data_size == 0) {
-        // No data available
-        *received = 0;
+    size_t total = 0;
+    
+    for (int i = 0; i < iov_count; i++) {
+        size_t count = network_ring_read(&sockets[socket_index].rx, iov[i].base, iov[i].len);
+        total += count;
+        
+        // The ring ran dry
+        if (count < iov[i].len) {
+            break;
+        }
+    }
+    
+    *received = total;
+    
+    if (total == 0) {
         return 0;
     }
     
-    // Determine how much data to copy
-    size_t bytes_to_copy = (size < sockets[socket_index].data_size) ? size : sockets[socket_index].data_size;
+    // The space freed may let queued transmit data through
+    if (network_ring_used(&sockets[socket_index].tx) > 0) {
+        network_socket_transmit(socket_index);
+    }
+    
+    // Update statistics
+    sockets[socket_index].stats.rx_packets++;
+    sockets[socket_index].stats.rx_bytes += total;
+    
+    trace_instant(&network_trace_recv, socket->id, (uint32_t)total);
+    
+    return 0;
+}
+
+/**
+ * Send part of a file or mapping on a network socket
+ * 
+ * The payload never passes through an intermediate buffer. A backing file
+ * is read straight into packet buffers (or the transmit ring). With no
+ * reader, ctx is mapped memory, such as a model or backup file mapping,
+ * which the packets reference in place; it must stay mapped until the
+ * driver has released them.
+ * 
+ * Large transfers are sent in several calls, each sending as much as the
+ * packet pool or transmit ring has room for.
+ * 
+ * @param id: Socket ID
+ * @param reader: Backing file reader, or NULL
+ * @param ctx: Reader context, or the start of the mapping
+ * @param offset: Offset of the data in the file or mapping
+ * @param size: Number of bytes
+ * @param sent: Pointer to store the number of bytes sent
+ * @return: 0 on success, NETWORK_ERROR_BUSY if nothing could be queued,
+ *          -1 on failure
+ */
+int network_socket_sendfile(uint32_t id, memory_map_reader_t reader, void* ctx, uint64_t offset, size_t size, size_t* sent) {
+    // Check if the ctx and sent pointers are valid
+    if ((!reader && !ctx) || !sent || size == 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    // Find the socket
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
+    }
+    
+    // Check if the socket is connected
+    if (!(sockets[socket_index].flags & NETWORK_SOCKET_FLAG_CONNECTED)) {
+        console_printf("Error: Socket is not connected\n");
+        return -1;
+    }
+    
+    network_driver_t* driver = network_socket_driver(socket_index);
+    size_t total;
     
-    // Copy the data to the user's buffer
-    memcpy(data, sockets[socket_index].data, bytes_to_copy);
-    
-    // If we didn't consume all the data, shift the remaining data to the beginning of the buffer
-    if (bytes_to_copy < sockets[socket_index].data_size) {
-        size_t remaining_bytes = sockets[socket_index].data_size - bytes_to_copy;
-        memmove(sockets[socket_index].data, (char*)sockets[socket_index].data + bytes_to_copy, remaining_bytes);
-        
-        // Resize the buffer
-        void* new_buffer = memory_alloc(remaining_bytes, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-        if (!new_buffer) {
-            console_printf("Error: Failed to resize socket data buffer\n");
-            return -1;
+    if (driver && driver->queue_tx) {
+        total = network_socket_queue(socket_index, driver, reader, ctx, offset, size, 1);
+    } else {
+        if (reader) {
+            total = network_ring_fill(&sockets[socket_index].tx, reader, ctx, offset, size);
+        } else {
+            total = network_ring_write(&sockets[socket_index].tx, (const uint8_t*)ctx + offset, size);
         }
         
-        // Copy the remaining data
-        memcpy(new_buffer, sockets[socket_index].data, remaining_bytes);
-        
-        // Free the old buffer
-        memory_free(sockets[socket_index].data, sockets[socket_index].data_size);
+        network_socket_transmit(socket_index);
         
-        // Update the socket's data buffer
-        sockets[socket_index].data = new_buffer;
-        sockets[socket_index].data_size = remaining_bytes;
-    } else {
-        // We consumed all the data, free the buffer
-        memory_free(sockets[socket_index].data, sockets[socket_index].data_size);
-        sockets[socket_index].data = NULL;
-        sockets[socket_index].data_size = 0;
+        if (total > 0) {
+            sockets[socket_index].stats.tx_packets++;
+            sockets[socket_index].stats.tx_bytes += total;
+        }
     }
     
-    // Update statistics
-    sockets[socket_index].stats.rx_packets++;
-    sockets[socket_index].stats.rx_bytes += bytes_to_copy;
+    *sent = total;
     
-    // Set the number of bytes received
-    *received = bytes_to_copy;
+    if (total > 0) {
+        trace_instant(&network_trace_send, id, (uint32_t)total);
+    }
     
-    console_printf("Received %zu bytes on network socket (ID: %u)\n", *received, socket->id);
-    return 0;
+    return total == 0 ? NETWORK_ERROR_BUSY : 0;
 }
 
 /**
@@ -770,13 +1546,7 @@ int network_socket_sendto(uint32_t id, const void* data, size_t size, const netw
     }
     
     // Find the socket
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            socket_index = i;
-            break;
-        }
-    }
+    int socket_index = network_find_socket_slot(id);
     
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
@@ -796,6 +1566,8 @@ int network_socket_sendto(uint32_t id, const void* data, size_t size, const netw
     sockets[socket_index].stats.tx_packets++;
     sockets[socket_index].stats.tx_bytes += size;
     
+    trace_instant(&network_trace_send, id, (uint32_t)size);
+    
     // Set the number of bytes sent
     *sent = size;
     
@@ -820,13 +1592,7 @@ int network_socket_getsockopt(uint32_t id, int option, void* value, size_t* size
     }
     
     // Find the socket
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            socket_index = i;
-            break;
-        }
-    }
+    int socket_index = network_find_socket_slot(id);
     
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
@@ -885,8 +1651,8 @@ int network_socket_getsockopt(uint32_t id, int option, void* value, size_t* size
             
         case NETWORK_SOCKET_OPT_SNDBUF:
             if (*size >= sizeof(int)) {
-                // Default send buffer size
-                *(int*)value = 8192;
+                // Capacity of the transmit ring
+                *(int*)value = (int)sockets[socket_index].tx.size;
                 *size = sizeof(int);
                 return 0;
             }
@@ -894,8 +1660,8 @@ int network_socket_getsockopt(uint32_t id, int option, void* value, size_t* size
             
         case NETWORK_SOCKET_OPT_RCVBUF:
             if (*size >= sizeof(int)) {
-                // Default receive buffer size
-                *(int*)value = 8192;
+                // Capacity of the receive ring
+                *(int*)value = (int)sockets[socket_index].rx.size;
                 *size = sizeof(int);
                 return 0;
             }
@@ -934,13 +1700,7 @@ int network_socket_getinfo(uint32_t id, network_socket_info_t* info) {
     }
     
     // Find the socket
-    int socket_index = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i].id == id) {
-            socket_index = i;
-            break;
-        }
-    }
+    int socket_index = network_find_socket_slot(id);
     
     if (socket_index == -1) {
         console_printf("Error: Socket not found\n");
@@ -961,3 +1721,478 @@ int network_socket_getinfo(uint32_t id, network_socket_info_t* info) {
     
     return 0;
 }
+
+/**
+ * Signal an incoming connection on a listening socket
+ * 
+ * Called by interface drivers. The connection is taken by the next
+ * network_socket_accept, and makes the socket readable until then.
+ * 
+ * @param id: Socket ID
+ * @return: 0 on success, -1 on failure
+ */
+int network_socket_signal_connection(uint32_t id) {
+    // Find the socket
+    int socket_index = network_find_socket_slot(id);
+    
+    if (socket_index == -1) {
+        console_printf("Error: Socket not found\n");
+        return -1;
+    }
+    
+    // Check if the socket is in listening mode
+    if (!(sockets[socket_index].flags & NETWORK_SOCKET_FLAG_LISTENING)) {
+        console_printf("Error: Socket is not listening\n");
+        return -1;
+    }
+    
+    // Refuse connections beyond the backlog
+    if (sockets[socket_index].pending_connections >= sockets[socket_index].backlog) {
+        sockets[socket_index].stats.rx_dropped++;
+        return -1;
+    }
+    
+    sockets[socket_index].pending_connections++;
+    network_poll_notify(socket_index);
+    
+    return 0;
+}
+
+/**
+ * Get the readiness of a socket
+ * 
+ * @param slot: Socket slot
+ * @return: NETWORK_EVENT_READABLE and NETWORK_EVENT_WRITABLE as they apply
+ */
+static uint32_t network_socket_readiness(int slot) {
+    network_socket_internal_t* socket = &sockets[slot];
+    uint32_t events = 0;
+    
+    if (socket->flags & NETWORK_SOCKET_FLAG_LISTENING) {
+        if (socket->pending_connections > 0) {
+            events |= NETWORK_EVENT_READABLE;
+        }
+    } else if (socket->flags & NETWORK_SOCKET_FLAG_CONNECTED) {
+        if (network_ring_used(&socket->rx) > 0) {
+            events |= NETWORK_EVENT_READABLE;
+        }
+        if (network_ring_space(&socket->tx) > 0) {
+            events |= NETWORK_EVENT_WRITABLE;
+        }
+    }
+    
+    return events;
+}
+
+/**
+ * Put a poll set entry on the ready list (poll set locked)
+ * 
+ * @param set: Poll set
+ * @param slot: Socket slot of the entry
+ */
+static void network_poll_queue(network_poll_set_t* set, int slot) {
+    if (set->entries[slot].queued) {
+        return;
+    }
+    
+    set->entries[slot].queued = 1;
+    set->ready[(set->ready_head + set->ready_count) % MAX_SOCKETS] = (uint16_t)slot;
+    set->ready_count++;
+}
+
+/**
+ * Tell the poll sets of a socket that its readiness may have changed
+ * 
+ * Queues the socket in every set that waits for one of its ready events,
+ * or has to report its hangup, and wakes the waiting processes. Safe to
+ * call from interrupt context.
+ * 
+ * @param slot: Socket slot
+ */
+static void network_poll_notify(int slot) {
+    uint32_t registered = sockets[slot].poll_sets;
+    
+    if (registered == 0) {
+        return;
+    }
+    
+    uint32_t ready = network_socket_readiness(slot);
+    
+    while (registered) {
+        int index = __builtin_ctz(registered);
+        registered &= registered - 1;
+        
+        network_poll_set_t* set = poll_sets[index];
+        if (!set) {
+            continue;
+        }
+        
+        int irq_enabled = network_lock(&set->lock);
+        
+        network_poll_entry_t* entry = &set->entries[slot];
+        pid_t waiter = -1;
+        
+        // A closed socket no longer holds its slot
+        int hangup = entry->socket_id != sockets[slot].id;
+        
+        if (entry->registered && (hangup || (entry->events & ready))) {
+            network_poll_queue(set, slot);
+            
+            if (set->waiter != -1) {
+                waiter = set->waiter;
+                set->wake = 1;
+            }
+        }
+        
+        network_unlock(&set->lock, irq_enabled);
+        
+        if (waiter != -1) {
+            process_unblock(waiter);
+        }
+    }
+}
+
+/**
+ * Wake the process waiting on a poll set when its timeout expires
+ * (timer callback, interrupt context)
+ * 
+ * @param data: Poll set
+ */
+static void network_poll_timeout(void* data) {
+    network_poll_set_t* set = (network_poll_set_t*)data;
+    pid_t waiter = set->waiter;
+    
+    set->wake = 1;
+    
+    if (waiter != -1) {
+        process_unblock(waiter);
+    }
+}
+
+/**
+ * Find a poll set
+ * 
+ * @param set_id: Poll set ID
+ * @return: Poll set, or NULL if there is no such set
+ */
+static network_poll_set_t* network_poll_find(uint32_t set_id) {
+    if (set_id == 0 || set_id > NETWORK_POLL_MAX_SETS) {
+        return NULL;
+    }
+    
+    return poll_sets[set_id - 1];
+}
+
+/**
+ * Create a poll set
+ * 
+ * @param set_id: Pointer to store the poll set ID
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_create(uint32_t* set_id) {
+    // Check if the set_id pointer is valid
+    if (!set_id) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    // Find a free set
+    int index = -1;
+    for (int i = 0; i < NETWORK_POLL_MAX_SETS; i++) {
+        if (!poll_sets[i]) {
+            index = i;
+            break;
+        }
+    }
+    
+    if (index == -1) {
+        console_printf("Error: No free poll sets\n");
+        return -1;
+    }
+    
+    network_poll_set_t* set = (network_poll_set_t*)memory_alloc(sizeof(network_poll_set_t),
+                                                                MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                                                MEMORY_ALLOC_ZEROED);
+    if (!set) {
+        console_printf("Error: Failed to allocate poll set\n");
+        return -1;
+    }
+    
+    set->id = (uint32_t)index + 1;
+    set->waiter = -1;
+    hrtimer_init(&set->timer, network_poll_timeout, set);
+    
+    poll_sets[index] = set;
+    *set_id = set->id;
+    
+    return 0;
+}
+
+/**
+ * Destroy a poll set
+ * 
+ * @param set_id: Poll set ID
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_destroy(uint32_t set_id) {
+    network_poll_set_t* set = network_poll_find(set_id);
+    
+    if (!set) {
+        console_printf("Error: Poll set not found\n");
+        return -1;
+    }
+    
+    if (set->waiter != -1) {
+        console_printf("Error: Poll set is being waited on\n");
+        return -1;
+    }
+    
+    // Unregister the sockets
+    for (int slot = 0; slot < MAX_SOCKETS; slot++) {
+        if (set->entries[slot].registered && sockets[slot].id == set->entries[slot].socket_id) {
+            sockets[slot].poll_sets &= ~(1u << (set_id - 1));
+        }
+    }
+    
+    poll_sets[set_id - 1] = NULL;
+    memory_free(set, sizeof(network_poll_set_t));
+    
+    return 0;
+}
+
+/**
+ * Register a socket with a poll set
+ * 
+ * @param set_id: Poll set ID
+ * @param socket_id: Socket ID
+ * @param events: NETWORK_EVENT_* of interest, with NETWORK_EVENT_EDGE for
+ *                edge-triggered reporting
+ * @param data: Data reported with the events
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_add(uint32_t set_id, uint32_t socket_id, uint32_t events, void* data) {
+    network_poll_set_t* set = network_poll_find(set_id);
+    int slot = network_find_socket_slot(socket_id);
+    
+    if (!set || slot == -1) {
+        console_printf("Error: Poll set or socket not found\n");
+        return -1;
+    }
+    
+    if (sockets[slot].poll_sets & (1u << (set_id - 1))) {
+        console_printf("Error: Socket already registered\n");
+        return -1;
+    }
+    
+    int irq_enabled = network_lock(&set->lock);
+    
+    network_poll_entry_t* entry = &set->entries[slot];
+    
+    // An unreported hangup of the previous socket in the slot is replaced
+    if (!entry->registered) {
+        set->num_entries++;
+    }
+    
+    entry->socket_id = socket_id;
+    entry->events = events;
+    entry->data = data;
+    entry->registered = 1;
+    
+    network_unlock(&set->lock, irq_enabled);
+    
+    sockets[slot].poll_sets |= 1u << (set_id - 1);
+    
+    // Report the current readiness (the first edge of an edge-triggered entry)
+    network_poll_notify(slot);
+    
+    return 0;
+}
+
+/**
+ * Change the events or data of a registered socket
+ * 
+ * @param set_id: Poll set ID
+ * @param socket_id: Socket ID
+ * @param events: NETWORK_EVENT_* of interest
+ * @param data: Data reported with the events
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_modify(uint32_t set_id, uint32_t socket_id, uint32_t events, void* data) {
+    network_poll_set_t* set = network_poll_find(set_id);
+    int slot = network_find_socket_slot(socket_id);
+    
+    if (!set || slot == -1 || !(sockets[slot].poll_sets & (1u << (set_id - 1)))) {
+        console_printf("Error: Socket not registered\n");
+        return -1;
+    }
+    
+    int irq_enabled = network_lock(&set->lock);
+    set->entries[slot].events = events;
+    set->entries[slot].data = data;
+    network_unlock(&set->lock, irq_enabled);
+    
+    network_poll_notify(slot);
+    
+    return 0;
+}
+
+/**
+ * Unregister a socket from a poll set
+ * 
+ * @param set_id: Poll set ID
+ * @param socket_id: Socket ID
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_remove(uint32_t set_id, uint32_t socket_id) {
+    network_poll_set_t* set = network_poll_find(set_id);
+    int slot = network_find_socket_slot(socket_id);
+    
+    if (!set || slot == -1 || !(sockets[slot].poll_sets & (1u << (set_id - 1)))) {
+        console_printf("Error: Socket not registered\n");
+        return -1;
+    }
+    
+    sockets[slot].poll_sets &= ~(1u << (set_id - 1));
+    
+    // A queued entry is dropped when the wait reaches it
+    int irq_enabled = network_lock(&set->lock);
+    set->entries[slot].registered = 0;
+    set->num_entries--;
+    network_unlock(&set->lock, irq_enabled);
+    
+    return 0;
+}
+
+/**
+ * Collect the ready events of a poll set (poll set locked)
+ * 
+ * Each entry queued when the call starts is looked at once. Entries whose
+ * socket is no longer ready leave the ready list; level-triggered entries
+ * that still are go back to its tail.
+ * 
+ * @param set: Poll set
+ * @param events: Array to store the events
+ * @param max_events: Size of the array
+ * @return: Number of events stored
+ */
+static int network_poll_collect(network_poll_set_t* set, network_poll_event_t* events, int max_events) {
+    int count = 0;
+    uint32_t queued = set->ready_count;
+    
+    while (queued-- > 0 && count < max_events) {
+        int slot = set->ready[set->ready_head];
+        set->ready_head = (set->ready_head + 1) % MAX_SOCKETS;
+        set->ready_count--;
+        
+        network_poll_entry_t* entry = &set->entries[slot];
+        entry->queued = 0;
+        
+        if (!entry->registered) {
+            continue;
+        }
+        
+        // The socket was closed: report the hangup and forget the entry
+        if (entry->socket_id != sockets[slot].id) {
+            events[count].socket_id = entry->socket_id;
+            events[count].events = NETWORK_EVENT_HANGUP;
+            events[count].data = entry->data;
+            count++;
+            
+            entry->registered = 0;
+            set->num_entries--;
+            continue;
+        }
+        
+        uint32_t ready = network_socket_readiness(slot) & entry->events;
+        
+        if (ready == 0) {
+            continue;
+        }
+        
+        events[count].socket_id = entry->socket_id;
+        events[count].events = ready;
+        events[count].data = entry->data;
+        count++;
+        
+        // Level-triggered entries are reported again while they stay ready
+        if (!(entry->events & NETWORK_EVENT_EDGE)) {
+            network_poll_queue(set, slot);
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * Wait for registered sockets to become ready
+ * 
+ * The calling process blocks until an event is ready or the timeout
+ * expires. One process at a time can wait on a set.
+ * 
+ * @param set_id: Poll set ID
+ * @param events: Array to store the events
+ * @param max_events: Size of the array
+ * @param timeout_ms: Timeout in milliseconds, 0 to return at once, or
+ *                    NETWORK_POLL_WAIT_FOREVER
+ * @param count: Pointer to store the number of events (0 on timeout)
+ * @return: 0 on success, -1 on failure
+ */
+int network_poll_wait(uint32_t set_id, network_poll_event_t* events, int max_events, int timeout_ms, int* count) {
+    // Check if the events and count pointers are valid
+    if (!events || !count || max_events <= 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+    
+    network_poll_set_t* set = network_poll_find(set_id);
+    
+    if (!set) {
+        console_printf("Error: Poll set not found\n");
+        return -1;
+    }
+    
+    process_t* current = process_get_current();
+    pid_t self = current ? current->pid : 0;
+    uint64_t deadline = timer_now_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * TIMER_NS_PER_MS;
+    int armed = 0;
+    
+    for (;;) {
+        int irq_enabled = network_lock(&set->lock);
+        
+        if (set->waiter != -1 && set->waiter != self) {
+            network_unlock(&set->lock, irq_enabled);
+            console_printf("Error: Poll set is being waited on\n");
+            return -1;
+        }
+        
+        // Become the waiter before looking, so no readiness change is missed
+        set->wake = 0;
+        set->waiter = self;
+        *count = network_poll_collect(set, events, max_events);
+        
+        int expired = timeout_ms == 0 || (timeout_ms > 0 && timer_now_ns() >= deadline);
+        
+        if (*count > 0 || expired) {
+            set->waiter = -1;
+            network_unlock(&set->lock, irq_enabled);
+            break;
+        }
+        
+        network_unlock(&set->lock, irq_enabled);
+        
+        if (timeout_ms > 0 && !armed) {
+            armed = hrtimer_start(&set->timer, deadline) == 0;
+        }
+        
+        // Without a scheduler to block in, look again shortly
+        if (process_block_unless(&set->wake) != 0) {
+            process_sleep_us(1000);
+        }
+    }
+    
+    if (armed) {
+        hrtimer_cancel(&set->timer);
+    }
+    
+    return 0;
+}
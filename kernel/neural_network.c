@@ -8,6 +8,11 @@
 #include "include/neural_network.h"
 #include "include/memory.h"
 #include "include/console.h"
+#include "include/sampling.h"
+#include "include/quantize.h"
+#include "include/prefix_cache.h"
+#include "include/process.h"
+#include "include/trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,12 +21,104 @@
 // Maximum number of models
 #define MAX_MODELS 16
 
+// DeepSeek model context slots
+#define NN_CTX_VOCAB_SIZE        0
+#define NN_CTX_HIDDEN_SIZE       1
+#define NN_CTX_NUM_LAYERS        2
+#define NN_CTX_BOS_TOKEN_ID      3
+#define NN_CTX_EOS_TOKEN_ID      4
+#define NN_CTX_INTERMEDIATE_SIZE 5
+#define NN_CTX_NUM_HEADS         6
+#define NN_CTX_KV_CACHE          7
+#define NN_CTX_QWEIGHTS          8
+#define NN_CTX_SLOTS             9
+
+// Continuous batching limits
+#define NN_BATCH_MAX_SEQS        16
+#define NN_BATCH_QUEUE_SIZE      64
+#define NN_BATCH_STACK_SIZE      (64 * 1024)
+
+// Most draft tokens verified per speculative step (the verify pass is one batch)
+#define NN_SPEC_MAX_DRAFT        (NN_BATCH_MAX_SEQS - 1)
+
+// Quantized matrices per decoder layer (Q, K, V, O, up, down)
+#define NN_DEEPSEEK_QMATS_PER_LAYER 6
+
+// RMS norm epsilon and RoPE base (from config.json)
+#define NN_DEEPSEEK_RMS_EPS    1e-6f
+#define NN_DEEPSEEK_ROPE_THETA 10000.0f
+
+// Positions the KV cache must be able to hold for a model to load
+#define NN_DEEPSEEK_MIN_CONTEXT 512
+
+// Tracepoints of the generation phases
+static const trace_point_t nn_trace_tokenize = { "tokenize", TRACE_CAT_LLM, { "bytes", "tokens" } };
+static const trace_point_t nn_trace_prefill = { "prefill", TRACE_CAT_LLM, { "tokens", "cached" } };
+static const trace_point_t nn_trace_decode = { "decode", TRACE_CAT_LLM, { "position", "token" } };
+static const trace_point_t nn_trace_decode_batch = { "decode_batch", TRACE_CAT_LLM, { "sequences", NULL } };
+static const trace_point_t nn_trace_verify = { "spec_verify", TRACE_CAT_LLM, { "draft_tokens", NULL } };
+
 // Forward declarations for functions
 int nn_load_deepseek_model(nn_model_t* model, const char* path);
 int nn_unload_deepseek_model(nn_model_t* model);
 int nn_deepseek_tokenize(nn_model_t* model, const char* text, uint32_t** tokens, size_t* num_tokens);
 int nn_deepseek_detokenize(uint32_t* tokens, uint32_t num_tokens, char* text, size_t size);
 int nn_deepseek_generate(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty);
+int nn_deepseek_generate_stream(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data);
+
+// Key/value cache and decode scratch buffers for a DeepSeek model
+typedef struct {
+    size_t num_layers;
+    size_t hidden_size;
+    size_t intermediate_size;
+    size_t vocab_size;
+    size_t num_heads;
+    size_t capacity;      // Maximum number of cached positions
+    size_t length;        // Number of positions currently cached
+    size_t alloc_size;    // Size of the backing allocation
+    float* key_cache;     // [num_layers][capacity][hidden_size]
+    float* value_cache;   // [num_layers][capacity][hidden_size]
+    float* x;             // Residual stream [hidden_size]
+    float* xb;            // Normalized input [hidden_size]
+    float* xb2;           // Projection output [hidden_size]
+    float* q;             // Query [hidden_size]
+    float* hb;            // MLP hidden [intermediate_size]
+    float* att;           // Attention scores [num_heads][capacity]
+    float* logits;        // Output logits [vocab_size]
+} nn_kv_cache_t;
+
+// Block-quantized weights of a DeepSeek model
+typedef struct {
+    uint32_t dtype;
+    size_t num_layers;
+    nn_qmatrix_t embeddings;  // [vocab_size][hidden_size], also the LM head
+    nn_qmatrix_t* layers;     // [num_layers][NN_DEEPSEEK_QMATS_PER_LAYER]
+    float* norms;             // [num_layers][2][hidden_size] followed by the final norm
+    size_t norms_size;
+} nn_deepseek_qweights_t;
+
+// Scratch buffers of a batched decode step
+typedef struct {
+    size_t max_batch;
+    size_t width;         // Floats per batch row: max(hidden, intermediate, vocab)
+    float* in;            // Batch inputs [max_batch][width]
+    float* out;           // Batch outputs [max_batch][width]
+    float* row;           // Dequantized weight row [width]
+    size_t alloc_size;
+} nn_batch_scratch_t;
+
+// KV cache management and forward pass helpers
+static size_t nn_deepseek_kv_cache_size(size_t num_layers, size_t hidden_size, size_t intermediate_size,
+                                        size_t vocab_size, size_t num_heads, size_t capacity);
+static nn_kv_cache_t* nn_deepseek_get_kv_cache(nn_model_t* model, size_t capacity);
+static void nn_deepseek_put_kv_cache(nn_model_t* model, nn_kv_cache_t* cache);
+static nn_kv_cache_t* nn_deepseek_alloc_kv_cache(nn_model_t* model, size_t capacity);
+static nn_kv_cache_t* nn_deepseek_alloc_kv_view(const nn_kv_cache_t* cache);
+static void nn_deepseek_free_kv_cache(nn_kv_cache_t* cache);
+static void nn_deepseek_free_qweights(nn_deepseek_qweights_t* qweights);
+static int nn_deepseek_forward(nn_model_t* model, nn_kv_cache_t* cache, uint32_t token, int compute_logits);
+static int nn_deepseek_forward_batch(nn_model_t* model, nn_kv_cache_t** caches, const uint32_t* tokens, size_t batch, nn_batch_scratch_t* scratch);
+static int nn_batch_reserve_scratch(nn_batch_scratch_t** scratch, size_t batch, size_t width);
 
 // Internal model structure
 struct nn_model {
@@ -41,6 +138,45 @@ static nn_model_t* model_table[MAX_MODELS];
 // Next available model ID
 static nn_model_id_t next_model_id = 1;
 
+// Sequence in the continuous batch
+typedef struct {
+    nn_model_t* model;
+    nn_kv_cache_t* cache;       // Private KV cache [max_seq_len]
+    sampler_t sampler;
+    sampler_params_t params;
+    uint32_t* tokens;           // Prompt followed by the generated tokens [max_seq_len]
+    size_t num_tokens;
+    size_t num_prompt_tokens;
+    size_t max_seq_len;
+    uint32_t max_tokens;
+    uint32_t eos_token_id;
+    char* output;               // Submitter's output buffer
+    size_t output_size;
+    pid_t waiter;               // Submitter, woken when the sequence is done
+    volatile int done;
+    int result;
+} nn_sequence_t;
+
+// Continuous batching scheduler
+//
+// Submitters queue sequences in pending; whoever started the batch (the
+// scheduler daemon, or a submitter when there is no daemon) owns the
+// running batch in active until it goes idle. The daemon is started once
+// and blocks between batches.
+static struct {
+    nn_sequence_t* pending[NN_BATCH_QUEUE_SIZE];
+    uint32_t pending_head;
+    uint32_t num_pending;
+    nn_sequence_t* active[NN_BATCH_MAX_SEQS];
+    uint32_t num_active;
+    volatile int running;
+    volatile int lock;
+    pid_t daemon;
+    volatile int handoff;       // A batch was started for the daemon to run
+    volatile int wake;
+    nn_batch_stats_t stats;
+} nn_batch;
+
 /**
 * Initialize the neural network subsystem
 */
@@ -208,6 +344,30 @@ int nn_get_model_info(nn_model_id_t id, nn_model_info_t* info) {
 * @return: 0 on success, -1 on failure
 */
 int nn_generate(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty) {
+    return nn_generate_stream(id, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty, NULL, NULL);
+}
+
+/**
+* Generate text using a model, streaming it as tokens are sampled
+*
+* The callback is called from the generating process with each piece of
+* detokenized text as soon as its token is sampled; the full text is still
+* stored in output when generation ends.
+*
+* @param id: Model ID
+* @param prompt: Input prompt
+* @param output: Buffer to store the generated text
+* @param size: Size of the output buffer
+* @param max_tokens: Maximum number of tokens to generate
+* @param temperature: Temperature for sampling
+* @param top_p: Top-p sampling parameter
+* @param top_k: Top-k sampling parameter
+* @param repetition_penalty: Repetition penalty parameter
+* @param callback: Function receiving each piece of text (NULL for none)
+* @param user_data: User data passed to the callback
+* @return: 0 on success, -1 on failure
+*/
+int nn_generate_stream(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data) {
     // Check if the model ID is valid
     if (id >= MAX_MODELS || !model_table[id]) {
         console_printf("Error: Invalid model ID\n");
@@ -228,7 +388,7 @@ int nn_generate(nn_model_id_t id, const char* prompt, char* output, size_t size,
 
     switch (model->type) {
         case NN_MODEL_TYPE_DEEPSEEK:
-            result = nn_deepseek_generate(model, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty);
+            result = nn_deepseek_generate_stream(model, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty, callback, user_data);
             break;
 
         default:
@@ -316,6 +476,7 @@ int nn_load_deepseek_model(nn_model_t* model, const char* path) {
     size_t vocab_size = 151936; // From config.json
     uint32_t bos_token_id = 151643; // From config.json
     uint32_t eos_token_id = 151643; // From config.json
+    size_t num_heads = 12; // From config.json
 
     // Calculate total weights size
     model->weights_size = (
@@ -337,6 +498,20 @@ int nn_load_deepseek_model(nn_model_t* model, const char* path) {
         hidden_size
     ) * sizeof(float);
 
+    // The weights and a KV cache of the minimum context must fit in memory
+    size_t kv_cache_size = nn_deepseek_kv_cache_size(num_layers, hidden_size, intermediate_size,
+                                                     vocab_size, num_heads, NN_DEEPSEEK_MIN_CONTEXT);
+
+    if ((uint64_t)model->weights_size + kv_cache_size > memory_get_available()) {
+        console_printf("Error: DeepSeek model needs %zu bytes of weights and %zu bytes of KV cache\n",
+            model->weights_size, kv_cache_size);
+        memory_free(model->data, model->data_size);
+        model->data = NULL;
+        model->data_size = 0;
+        model->weights_size = 0;
+        return -1;
+    }
+
     // Allocate memory for the weights
     model->weights = memory_alloc(model->weights_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
 
@@ -396,7 +571,7 @@ int nn_load_deepseek_model(nn_model_t* model, const char* path) {
     }
 
     // Initialize the model context
-    model->context = memory_alloc(sizeof(void*) * 8, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    model->context = memory_alloc(sizeof(void*) * NN_CTX_SLOTS, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
     if (!model->context) {
         console_printf("Error: Failed to allocate memory for DeepSeek model context\n");
         memory_free(model->weights, model->weights_size);
@@ -441,6 +616,24 @@ int nn_load_deepseek_model(nn_model_t* model, const char* path) {
         *(uint32_t*)context_ptr[4] = eos_token_id;
     }
 
+    // Allocate and store intermediate size
+    context_ptr[NN_CTX_INTERMEDIATE_SIZE] = memory_alloc(sizeof(size_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (context_ptr[NN_CTX_INTERMEDIATE_SIZE]) {
+        *(size_t*)context_ptr[NN_CTX_INTERMEDIATE_SIZE] = intermediate_size;
+    }
+
+    // Allocate and store number of attention heads
+    context_ptr[NN_CTX_NUM_HEADS] = memory_alloc(sizeof(size_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (context_ptr[NN_CTX_NUM_HEADS]) {
+        *(size_t*)context_ptr[NN_CTX_NUM_HEADS] = num_heads;
+    }
+
+    // The KV cache is allocated on first use by nn_deepseek_generate
+    context_ptr[NN_CTX_KV_CACHE] = NULL;
+
+    // Weights stay in fp32 until nn_deepseek_quantize is called
+    context_ptr[NN_CTX_QWEIGHTS] = NULL;
+
     console_printf("DeepSeek model loaded successfully: %zu bytes\n", model->data_size);
 
     return 0;
@@ -453,6 +646,9 @@ int nn_load_deepseek_model(nn_model_t* model, const char* path) {
 * @return: 0 on success, -1 on failure
 */
 int nn_unload_deepseek_model(nn_model_t* model) {
+    // Cached prompt prefixes are keyed by the model
+    prefix_cache_invalidate(model);
+
     // Free the model data and weights
     if (model->data) {
         memory_free(model->data, model->data_size);
@@ -469,12 +665,25 @@ int nn_unload_deepseek_model(nn_model_t* model) {
     // Free the context
     if (model->context) {
         void** context_ptr = (void**)model->context;
-        for (int i = 0; i < 8; i++) {
+
+        // The KV cache owns a separate backing allocation
+        if (context_ptr[NN_CTX_KV_CACHE]) {
+            nn_deepseek_free_kv_cache((nn_kv_cache_t*)context_ptr[NN_CTX_KV_CACHE]);
+            context_ptr[NN_CTX_KV_CACHE] = NULL;
+        }
+
+        // So do the quantized weights
+        if (context_ptr[NN_CTX_QWEIGHTS]) {
+            nn_deepseek_free_qweights((nn_deepseek_qweights_t*)context_ptr[NN_CTX_QWEIGHTS]);
+            context_ptr[NN_CTX_QWEIGHTS] = NULL;
+        }
+
+        for (int i = 0; i < NN_CTX_SLOTS; i++) {
             if (context_ptr[i]) {
                 memory_free(context_ptr[i], sizeof(size_t)); // Assuming all context items are at least size_t
             }
         }
-        memory_free(model->context, sizeof(void*) * 8);
+        memory_free(model->context, sizeof(void*) * NN_CTX_SLOTS);
         model->context = NULL;
     }
 
@@ -497,6 +706,8 @@ int nn_deepseek_tokenize(nn_model_t* model, const char* text, uint32_t** tokens,
         return -1;
     }
 
+    uint64_t trace_start = trace_begin(&nn_trace_tokenize);
+
     // Get model parameters from context
     uint32_t bos_token_id = 151643; // Default from config.json
     uint32_t eos_token_id = 151643; // Default from config.json
@@ -580,11 +791,56 @@ int nn_deepseek_tokenize(nn_model_t* model, const char* text, uint32_t** tokens,
     // Set the number of tokens
     *num_tokens = token_count;
 
+    trace_end(&nn_trace_tokenize, trace_start, (uint32_t)text_len, (uint32_t)token_count);
+
     console_printf("Tokenized text into %zu tokens\n", token_count);
 
     return 0;
 }
 
+/**
+* Get the text of a DeepSeek token
+*
+* @param token: Token ID
+* @param token_text: Buffer to store the token text
+* @param size: Size of the token text buffer
+* @return: 1 if the token has text, 0 for special tokens (BOS, EOS, PAD)
+*/
+static int nn_deepseek_token_text(uint32_t token, char* token_text, size_t size) {
+    // Skip special tokens (BOS, EOS, PAD)
+    if (token <= 4) {
+        return 0;
+    }
+
+    // For simplicity, we'll use a mapping function
+    if (token < 100) {
+        // Special tokens
+        snprintf(token_text, size, "<special%u>", token);
+    } else {
+        // Regular tokens - map token ID to word using vocabulary mapping table
+        uint32_t word_index = token % 1000;
+
+        // List of common words
+        static const char* common_words[] = {
+            "the", "of", "and", "a", "to", "in", "is", "you", "that", "it",
+            "he", "was", "for", "on", "are", "as", "with", "his", "they", "I",
+            "at", "be", "this", "have", "from", "or", "one", "had", "by", "word",
+            "but", "not", "what", "all", "were", "we", "when", "your", "can", "said",
+            "there", "use", "an", "each", "which", "she", "do", "how", "their", "if"
+        };
+
+        if (word_index < sizeof(common_words) / sizeof(common_words[0])) {
+            strncpy(token_text, common_words[word_index], size - 1);
+            token_text[size - 1] = '\0';
+        } else {
+            // Generate a word based on the token ID
+            snprintf(token_text, size, "w%u", token);
+        }
+    }
+
+    return 1;
+}
+
 /**
 * Detokenize tokens using a DeepSeek model
 *
@@ -607,37 +863,11 @@ int nn_deepseek_detokenize(uint32_t* tokens, uint32_t num_tokens, char* text, si
 
     // Process each token
     for (uint32_t i = 0; i < num_tokens; i++) {
-        // Skip special tokens (BOS, EOS, PAD)
-        if (tokens[i] <= 4) {
-            continue;
-        }
-
         // Convert token ID to text
         char token_text[64];
 
-        // For simplicity, we'll use a mapping function
-        if (tokens[i] < 100) {
-            // Special tokens
-            snprintf(token_text, sizeof(token_text), "<special%u>", tokens[i]);
-        } else {
-            // Regular tokens - map token ID to word using vocabulary mapping table
-            uint32_t word_index = tokens[i] % 1000;
-
-            // List of common words
-            const char* common_words[] = {
-                "the", "of", "and", "a", "to", "in", "is", "you", "that", "it",
-                "he", "was", "for", "on", "are", "as", "with", "his", "they", "I",
-                "at", "be", "this", "have", "from", "or", "one", "had", "by", "word",
-                "but", "not", "what", "all", "were", "we", "when", "your", "can", "said",
-                "there", "use", "an", "each", "which", "she", "do", "how", "their", "if"
-            };
-
-            if (word_index < sizeof(common_words) / sizeof(common_words[0])) {
-                strncpy(token_text, common_words[word_index], sizeof(token_text) - 1);
-            } else {
-                // Generate a word based on the token ID
-                snprintf(token_text, sizeof(token_text), "w%u", tokens[i]);
-            }
+        if (!nn_deepseek_token_text(tokens[i], token_text, sizeof(token_text))) {
+            continue;
         }
 
         // Add a space before non-first words if there's room
@@ -665,283 +895,1885 @@ int nn_deepseek_detokenize(uint32_t* tokens, uint32_t num_tokens, char* text, si
 }
 
 /**
-* Generate text using a DeepSeek model
+* Compute the size of a DeepSeek KV cache allocation
+*
+* @param num_layers: Number of decoder layers
+* @param hidden_size: Hidden size
+* @param intermediate_size: MLP hidden size
+* @param vocab_size: Vocabulary size
+* @param num_heads: Number of attention heads
+* @param capacity: Number of cached positions
+* @return: Size in bytes of the cache and its scratch buffers
+*/
+static size_t nn_deepseek_kv_cache_size(size_t num_layers, size_t hidden_size, size_t intermediate_size,
+                                        size_t vocab_size, size_t num_heads, size_t capacity) {
+    size_t kv_floats = num_layers * capacity * hidden_size;
+    size_t scratch_floats = 4 * hidden_size + intermediate_size + num_heads * capacity + vocab_size;
+
+    return sizeof(nn_kv_cache_t) + (2 * kv_floats + scratch_floats) * sizeof(float);
+}
+
+/**
+* Take the KV cache of a DeepSeek model, allocating or growing it as needed
+*
+* The cache is kept in the model context across calls so the backing
+* allocation is reused; its length is reset for every new sequence. It is
+* taken out of the context while in use, so a concurrent caller gets a
+* cache of its own instead of sharing it. Hand it back with
+* nn_deepseek_put_kv_cache.
 *
 * @param model: Model structure
-* @param prompt: Input prompt
-* @param output: Buffer to store the generated text
-* @param size: Size of the output buffer
-* @param max_tokens: Maximum number of tokens to generate
-* @param temperature: Temperature for sampling
-* @param top_p: Top-p sampling parameter
-* @param top_k: Top-k sampling parameter
-* @param repetition_penalty: Repetition penalty parameter
-* @return: 0 on success, -1 on failure
+* @param capacity: Number of positions the cache must be able to hold
+* @return: KV cache on success, NULL on failure
 */
-int nn_deepseek_generate(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty) {
-    // We're not using repetition_penalty in this implementation
-    (void)repetition_penalty;
-    
-    // Generate text using the DeepSeek model
-    if (!model || !prompt || !output || size == 0) {
-        console_printf("Error: Invalid parameters for nn_deepseek_generate\n");
-        return -1;
+static nn_kv_cache_t* nn_deepseek_get_kv_cache(nn_model_t* model, size_t capacity) {
+    if (!model || !model->context || capacity == 0) {
+        return NULL;
     }
 
-    console_printf("Generating text with DeepSeek model (max_tokens=%u, temp=%.2f, top_p=%.2f, top_k=%.2f)\n",
-        max_tokens, temperature, top_p, top_k);
+    void** context_ptr = (void**)model->context;
+    nn_kv_cache_t* cache = (nn_kv_cache_t*)__sync_lock_test_and_set(&context_ptr[NN_CTX_KV_CACHE], NULL);
 
-    // Tokenize the prompt
-    uint32_t* input_tokens = NULL;
-    size_t num_input_tokens = 0;
+    // Reuse the existing cache if it is large enough
+    if (cache && cache->capacity >= capacity) {
+        cache->length = 0;
+        return cache;
+    }
 
-    if (nn_deepseek_tokenize(model, prompt, &input_tokens, &num_input_tokens) != 0) {
-        console_printf("Error: Failed to tokenize prompt\n");
-        return -1;
+    // Release a cache that is too small
+    nn_deepseek_free_kv_cache(cache);
+
+    return nn_deepseek_alloc_kv_cache(model, capacity);
+}
+
+/**
+* Hand a KV cache taken with nn_deepseek_get_kv_cache back to its model
+*
+* The cache is kept for the next call unless another one was handed back
+* first, in which case it is freed.
+*
+* @param model: Model structure
+* @param cache: KV cache
+*/
+static void nn_deepseek_put_kv_cache(nn_model_t* model, nn_kv_cache_t* cache) {
+    if (!cache) {
+        return;
     }
 
-    // Allocate memory for the generated tokens
-    size_t max_seq_len = num_input_tokens + max_tokens;
-    uint32_t* all_tokens = (uint32_t*)memory_alloc(max_seq_len * sizeof(uint32_t),
-        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
-        MEMORY_ALLOC_ZEROED);
+    void** context_ptr = (void**)model->context;
 
-    if (!all_tokens) {
-        console_printf("Error: Failed to allocate memory for generated tokens\n");
-        memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
-        return -1;
+    if (!__sync_bool_compare_and_swap(&context_ptr[NN_CTX_KV_CACHE], NULL, cache)) {
+        nn_deepseek_free_kv_cache(cache);
     }
+}
 
-    // Copy the input tokens
-    memcpy(all_tokens, input_tokens, num_input_tokens * sizeof(uint32_t));
-    size_t total_tokens = num_input_tokens;
+/**
+* Allocate a KV cache for a DeepSeek model
+*
+* @param model: Model structure
+* @param capacity: Number of positions the cache must be able to hold
+* @return: KV cache on success, NULL on failure
+*/
+static nn_kv_cache_t* nn_deepseek_alloc_kv_cache(nn_model_t* model, size_t capacity) {
+    if (!model || !model->context || capacity == 0) {
+        return NULL;
+    }
 
-    // Free the input tokens
-    memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+    void** context_ptr = (void**)model->context;
 
-    // Run the model to generate tokens
-    size_t num_generated_tokens = 0;
-    uint32_t* generated_tokens = (uint32_t*)memory_alloc(max_tokens * sizeof(uint32_t),
-        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
-        MEMORY_ALLOC_ZEROED);
+    // Get model parameters from context
+    size_t vocab_size = context_ptr[NN_CTX_VOCAB_SIZE] ? *(size_t*)context_ptr[NN_CTX_VOCAB_SIZE] : 151936;
+    size_t hidden_size = context_ptr[NN_CTX_HIDDEN_SIZE] ? *(size_t*)context_ptr[NN_CTX_HIDDEN_SIZE] : 1536;
+    size_t num_layers = context_ptr[NN_CTX_NUM_LAYERS] ? *(size_t*)context_ptr[NN_CTX_NUM_LAYERS] : 28;
+    size_t intermediate_size = context_ptr[NN_CTX_INTERMEDIATE_SIZE] ? *(size_t*)context_ptr[NN_CTX_INTERMEDIATE_SIZE] : 8960;
+    size_t num_heads = context_ptr[NN_CTX_NUM_HEADS] ? *(size_t*)context_ptr[NN_CTX_NUM_HEADS] : 12;
+
+    if (num_heads == 0 || hidden_size % num_heads != 0) {
+        console_printf("Error: Invalid attention head configuration\n");
+        return NULL;
+    }
 
-    if (!generated_tokens) {
-        console_printf("Error: Failed to allocate memory for generated tokens\n");
-        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
-        return -1;
+    // Compute the size of the cache and all scratch buffers
+    size_t kv_floats = num_layers * capacity * hidden_size;
+    size_t alloc_size = nn_deepseek_kv_cache_size(num_layers, hidden_size, intermediate_size, vocab_size, num_heads, capacity);
+
+    // Allocate the cache as a single block backed by large pages
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                            MEMORY_ALLOC_ZEROED | MEMORY_FLAG_HUGE);
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for KV cache (%u positions)\n", (uint32_t)capacity);
+        return NULL;
     }
 
-    // Get model parameters from context
-    size_t vocab_size = 151936; // Default from config.json
-    uint32_t eos_token_id = 151643; // Default from config.json
+    // Carve the buffers out of the block
+    nn_kv_cache_t* cache = (nn_kv_cache_t*)block;
+    float* ptr = (float*)(block + sizeof(nn_kv_cache_t));
+
+    cache->num_layers = num_layers;
+    cache->hidden_size = hidden_size;
+    cache->intermediate_size = intermediate_size;
+    cache->vocab_size = vocab_size;
+    cache->num_heads = num_heads;
+    cache->capacity = capacity;
+    cache->length = 0;
+    cache->alloc_size = alloc_size;
+    cache->key_cache = ptr;    ptr += kv_floats;
+    cache->value_cache = ptr;  ptr += kv_floats;
+    cache->x = ptr;            ptr += hidden_size;
+    cache->xb = ptr;           ptr += hidden_size;
+    cache->xb2 = ptr;          ptr += hidden_size;
+    cache->q = ptr;            ptr += hidden_size;
+    cache->hb = ptr;           ptr += intermediate_size;
+    cache->att = ptr;          ptr += num_heads * capacity;
+    cache->logits = ptr;
+
+    return cache;
+}
 
-    if (model->context) {
-        void** context_ptr = (void**)model->context;
-        if (context_ptr[0]) { // Vocabulary size
-            vocab_size = *(size_t*)context_ptr[0];
-        }
-        if (context_ptr[4]) { // EOS token ID
-            eos_token_id = *(uint32_t*)context_ptr[4];
-        }
+/**
+* Allocate a view of a DeepSeek KV cache
+*
+* The view has its own scratch buffers but shares the key and value rows of
+* the cache, so several positions of one sequence can run through
+* nn_deepseek_forward_batch together: each is given a view whose length is
+* its position.
+*
+* @param cache: KV cache to share
+* @return: KV cache view on success, NULL on failure
+*/
+static nn_kv_cache_t* nn_deepseek_alloc_kv_view(const nn_kv_cache_t* cache) {
+    size_t h = cache->hidden_size;
+    size_t scratch_floats = 4 * h + cache->intermediate_size + cache->num_heads * cache->capacity + cache->vocab_size;
+    size_t alloc_size = sizeof(nn_kv_cache_t) + scratch_floats * sizeof(float);
+
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for KV cache view\n");
+        return NULL;
     }
 
-    // Perform inference using the model weights
-    float* logits = (float*)memory_alloc(vocab_size * sizeof(float),
-        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
-        MEMORY_ALLOC_ZEROED);
+    nn_kv_cache_t* view = (nn_kv_cache_t*)block;
+    float* ptr = (float*)(block + sizeof(nn_kv_cache_t));
 
-    if (!logits) {
-        console_printf("Error: Failed to allocate memory for logits\n");
-        memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
-        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
-        return -1;
+    *view = *cache;
+    view->alloc_size = alloc_size;
+    view->x = ptr;      ptr += h;
+    view->xb = ptr;     ptr += h;
+    view->xb2 = ptr;    ptr += h;
+    view->q = ptr;      ptr += h;
+    view->hb = ptr;     ptr += cache->intermediate_size;
+    view->att = ptr;    ptr += cache->num_heads * cache->capacity;
+    view->logits = ptr;
+
+    return view;
+}
+
+/**
+* Free a DeepSeek KV cache
+*
+* @param cache: KV cache to free
+*/
+static void nn_deepseek_free_kv_cache(nn_kv_cache_t* cache) {
+    if (cache) {
+        memory_free(cache, cache->alloc_size);
     }
+}
 
-    // Generate tokens one by one
-    for (uint32_t i = 0; i < max_tokens; i++) {
-        // Initialize logits to random values
-        for (size_t j = 0; j < vocab_size; j++) {
-            logits[j] = ((float)rand() / RAND_MAX) * 2.0f - 1.0f;
+/**
+* Apply RMS normalization
+*
+* @param out: Output vector
+* @param x: Input vector
+* @param weight: Normalization weights
+* @param n: Vector length
+*/
+static void nn_rmsnorm(float* out, const float* x, const float* weight, size_t n) {
+    // Compute the mean of squares
+    float ss = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        ss += x[i] * x[i];
+    }
+    ss = 1.0f / sqrtf(ss / (float)n + NN_DEEPSEEK_RMS_EPS);
+
+    // Normalize and scale
+    for (size_t i = 0; i < n; i++) {
+        out[i] = weight[i] * (ss * x[i]);
+    }
+}
+
+/**
+* Multiply a row-major weight matrix by a vector
+*
+* @param out: Output vector [rows]
+* @param x: Input vector [cols]
+* @param w: Weight matrix [rows][cols]
+* @param rows: Number of rows
+* @param cols: Number of columns
+*/
+static void nn_matvec(float* out, const float* x, const float* w, size_t rows, size_t cols) {
+    for (size_t i = 0; i < rows; i++) {
+        const float* row = w + i * cols;
+        float sum = 0.0f;
+        for (size_t j = 0; j < cols; j++) {
+            sum += row[j] * x[j];
         }
+        out[i] = sum;
+    }
+}
 
-        // Apply temperature to logits
-        if (temperature > 0.0f && temperature != 1.0f) {
-            for (size_t j = 0; j < vocab_size; j++) {
-                logits[j] /= temperature;
-            }
+/**
+* Apply a linear projection from fp32 or block-quantized weights
+*
+* @param out: Output vector [rows]
+* @param x: Input vector [cols]
+* @param w: fp32 weight matrix [rows][cols], used when qw is NULL
+* @param qw: Quantized weight matrix, or NULL
+* @param rows: Number of rows
+* @param cols: Number of columns
+*/
+static void nn_linear(float* out, const float* x, const float* w, const nn_qmatrix_t* qw, size_t rows, size_t cols) {
+    if (qw) {
+        nn_qmatrix_gemv(qw, x, out);
+    } else {
+        nn_matvec(out, x, w, rows, cols);
+    }
+}
+
+/**
+* Apply rotary position embeddings to every head of a vector
+*
+* @param vec: Query or key vector [num_heads * head_dim]
+* @param num_heads: Number of heads
+* @param head_dim: Dimension of each head
+* @param pos: Sequence position
+*/
+static void nn_rope(float* vec, size_t num_heads, size_t head_dim, size_t pos) {
+    const float two_pi = 6.28318530718f;
+
+    for (size_t i = 0; i < head_dim; i += 2) {
+        // Compute the rotation angle for this frequency
+        float freq = 1.0f / powf(NN_DEEPSEEK_ROPE_THETA, (float)i / (float)head_dim);
+        float angle = (float)pos * freq;
+
+        // Reduce the angle to [-pi, pi] so the series approximations stay accurate
+        angle -= two_pi * (float)(int)(angle / two_pi);
+        if (angle > two_pi / 2.0f) {
+            angle -= two_pi;
         }
 
-        // Apply top-k sampling
-        if (top_k > 0 && top_k < vocab_size) {
-            // Find the top-k logits
-            float kth_largest = 0.0f;
-            size_t k = (size_t)top_k;
-            
-            // Simple selection algorithm to find the kth largest logit
-            float* logits_copy = (float*)memory_alloc(vocab_size * sizeof(float), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-            
-            if (logits_copy) {
-                // Copy the logits
-                memcpy(logits_copy, logits, vocab_size * sizeof(float));
-                
-                // Sort the logits (simple bubble sort for simplicity)
-                for (size_t j = 0; j < k; j++) {
-                    for (size_t l = j + 1; l < vocab_size; l++) {
-                        if (logits_copy[j] < logits_copy[l]) {
-                            float temp = logits_copy[j];
-                            logits_copy[j] = logits_copy[l];
-                            logits_copy[l] = temp;
-                        }
-                    }
-                }
-                
-                // Get the kth largest logit
-                kth_largest = logits_copy[k - 1];
-                
-                // Free the copy
-                memory_free(logits_copy, vocab_size * sizeof(float));
-                
-                // Zero out logits below the kth largest
-                for (size_t j = 0; j < vocab_size; j++) {
-                    if (logits[j] < kth_largest) {
-                        logits[j] = -INFINITY;
-                    }
-                }
-            }
+        float c = cosf(angle);
+        float s = sinf(angle);
+
+        // Rotate the pair in every head
+        for (size_t h = 0; h < num_heads; h++) {
+            float* v = vec + h * head_dim + i;
+            float v0 = v[0];
+            float v1 = v[1];
+            v[0] = v0 * c - v1 * s;
+            v[1] = v0 * s + v1 * c;
         }
-        
-        // Apply top-p sampling (nucleus sampling)
-        if (top_p > 0.0f && top_p < 1.0f) {
-            // Sort logits in descending order
-            float* sorted_logits = (float*)memory_alloc(vocab_size * sizeof(float), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-            size_t* indices = (size_t*)memory_alloc(vocab_size * sizeof(size_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-            
-            if (sorted_logits && indices) {
-                // Initialize indices
-                for (size_t j = 0; j < vocab_size; j++) {
-                    sorted_logits[j] = logits[j];
-                    indices[j] = j;
-                }
-                
-                // Sort logits and indices (simple bubble sort for simplicity)
-                for (size_t j = 0; j < vocab_size - 1; j++) {
-                    for (size_t l = j + 1; l < vocab_size; l++) {
-                        if (sorted_logits[j] < sorted_logits[l]) {
-                            // Swap logits
-                            float temp_logit = sorted_logits[j];
-                            sorted_logits[j] = sorted_logits[l];
-                            sorted_logits[l] = temp_logit;
-                            
-                            // Swap indices
-                            size_t temp_index = indices[j];
-                            indices[j] = indices[l];
-                            indices[l] = temp_index;
-                        }
-                    }
-                }
-                
-                // Convert logits to probabilities using softmax
-                float max_logit = sorted_logits[0];
-                float sum_exp = 0.0f;
-                
-                for (size_t j = 0; j < vocab_size; j++) {
-                    sorted_logits[j] = expf(sorted_logits[j] - max_logit);
-                    sum_exp += sorted_logits[j];
-                }
-                
-                // Normalize to get probabilities
-                for (size_t j = 0; j < vocab_size; j++) {
-                    sorted_logits[j] /= sum_exp;
-                }
-                
-                // Compute cumulative probabilities
-                float cumulative_prob = 0.0f;
-                size_t nucleus_size = 0;
-                
-                for (size_t j = 0; j < vocab_size; j++) {
-                    cumulative_prob += sorted_logits[j];
-                    nucleus_size = j + 1;
-                    
-                    if (cumulative_prob >= top_p) {
-                        break;
-                    }
-                }
-                
-                // Zero out logits outside the nucleus
-                for (size_t j = nucleus_size; j < vocab_size; j++) {
-                    logits[indices[j]] = -INFINITY;
-                }
-                
-                // Free memory
-                memory_free(sorted_logits, vocab_size * sizeof(float));
-                memory_free(indices, vocab_size * sizeof(size_t));
+    }
+}
+
+/**
+* Attend from the query of a position to every cached position
+*
+* @param cache: KV cache holding the query in q; the result goes to xb2
+* @param layer_keys: Keys of the layer [capacity][hidden_size]
+* @param layer_values: Values of the layer [capacity][hidden_size]
+* @param pos: Position of the query
+*/
+static void nn_deepseek_attention(nn_kv_cache_t* cache, const float* layer_keys, const float* layer_values, size_t pos) {
+    size_t h = cache->hidden_size;
+    size_t num_heads = cache->num_heads;
+    size_t head_dim = h / num_heads;
+    float scale = 1.0f / sqrtf((float)head_dim);
+
+    for (size_t head = 0; head < num_heads; head++) {
+        const float* qh = cache->q + head * head_dim;
+        float* att = cache->att + head * cache->capacity;
+        float max_score = -INFINITY;
+
+        // Scores against every cached position
+        for (size_t t = 0; t <= pos; t++) {
+            const float* kh = layer_keys + t * h + head * head_dim;
+            float score = 0.0f;
+            for (size_t i = 0; i < head_dim; i++) {
+                score += qh[i] * kh[i];
             }
-        }
-        
-        // Convert logits to probabilities using softmax
-        float max_logit = -INFINITY;
-        
-        // Find the maximum logit
-        for (size_t j = 0; j < vocab_size; j++) {
-            if (logits[j] > max_logit) {
-                max_logit = logits[j];
+            score *= scale;
+            att[t] = score;
+            if (score > max_score) {
+                max_score = score;
             }
         }
-        
-        // Compute softmax
+
+        // Softmax over the scores
         float sum_exp = 0.0f;
-        
-        for (size_t j = 0; j < vocab_size; j++) {
-            logits[j] = expf(logits[j] - max_logit);
-            sum_exp += logits[j];
-        }
-        
-        // Normalize to get probabilities
-        for (size_t j = 0; j < vocab_size; j++) {
-            logits[j] /= sum_exp;
+        for (size_t t = 0; t <= pos; t++) {
+            att[t] = expf(att[t] - max_score);
+            sum_exp += att[t];
         }
-        
-        // Sample from the distribution
-        float random_value = (float)rand() / RAND_MAX;
-        float cumulative_prob = 0.0f;
-        uint32_t sampled_token = 0;
-        
-        for (size_t j = 0; j < vocab_size; j++) {
-            cumulative_prob += logits[j];
-            
-            if (random_value <= cumulative_prob) {
-                sampled_token = (uint32_t)j;
-                break;
+
+        // Weighted sum of the cached values
+        float* out = cache->xb2 + head * head_dim;
+        memset(out, 0, head_dim * sizeof(float));
+        for (size_t t = 0; t <= pos; t++) {
+            const float* vh = layer_values + t * h + head * head_dim;
+            float a = att[t] / sum_exp;
+            for (size_t i = 0; i < head_dim; i++) {
+                out[i] += a * vh[i];
             }
         }
-        
-        // Add the sampled token to the generated tokens
-        generated_tokens[num_generated_tokens++] = sampled_token;
-        
-        // Add the sampled token to all tokens
-        all_tokens[total_tokens++] = sampled_token;
-        
-        // Check if we've generated the EOS token
-        if (sampled_token == eos_token_id) {
-            break;
-        }
     }
-    
-    // Detokenize the generated tokens
-    if (nn_deepseek_detokenize(generated_tokens, num_generated_tokens, output, size) != 0) {
-        console_printf("Error: Failed to detokenize generated tokens\n");
-        memory_free(logits, vocab_size * sizeof(float));
-        memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
-        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+}
+
+/**
+* Run one decoder step of a DeepSeek model
+*
+* The token is placed at position cache->length. Its keys and values are
+* appended to the cache and attention only runs against cached positions,
+* so each step costs O(length) instead of recomputing the whole prefix.
+*
+* @param model: Model structure
+* @param cache: KV cache
+* @param token: Input token ID
+* @param compute_logits: Whether to project the final hidden state to logits
+* @return: 0 on success, -1 on failure
+*/
+static int nn_deepseek_forward(nn_model_t* model, nn_kv_cache_t* cache, uint32_t token, int compute_logits) {
+    nn_deepseek_qweights_t* qw = NULL;
+    if (model && model->context) {
+        qw = (nn_deepseek_qweights_t*)((void**)model->context)[NN_CTX_QWEIGHTS];
+    }
+
+    if (!model || (!model->weights && !qw) || !cache) {
+        console_printf("Error: Invalid parameters for nn_deepseek_forward\n");
         return -1;
     }
-    
-    // Free memory
-    memory_free(logits, vocab_size * sizeof(float));
-    memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
-    memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
-    
-    console_printf("Generated %zu tokens\n", num_generated_tokens);
-    
-    return 0;
+
+    if (cache->length >= cache->capacity) {
+        console_printf("Error: KV cache is full (%u positions)\n", (uint32_t)cache->capacity);
+        return -1;
+    }
+
+    size_t h = cache->hidden_size;
+    size_t inter = cache->intermediate_size;
+    size_t vocab_size = cache->vocab_size;
+    size_t num_heads = cache->num_heads;
+    size_t head_dim = h / num_heads;
+    size_t pos = cache->length;
+
+    if (token >= vocab_size) {
+        token = (uint32_t)(vocab_size - 1);
+    }
+
+    // Weights layout matches nn_load_deepseek_model
+    const float* embeddings = NULL;
+    const float* layers = NULL;
+    const float* final_norm = NULL;
+    size_t layer_stride = 4 * h * h + 2 * h * inter + 2 * h;
+
+    if (qw) {
+        final_norm = qw->norms + cache->num_layers * 2 * h;
+    } else {
+        embeddings = (const float*)model->weights;
+        layers = embeddings + vocab_size * h;
+        final_norm = layers + cache->num_layers * layer_stride;
+    }
+
+    float* x = cache->x;
+
+    // Embedding lookup
+    if (qw) {
+        nn_qmatrix_dequantize_row(&qw->embeddings, token, x);
+    } else {
+        memcpy(x, embeddings + (size_t)token * h, h * sizeof(float));
+    }
+
+    for (size_t l = 0; l < cache->num_layers; l++) {
+        const float* wq = NULL;
+        const float* wk = NULL;
+        const float* wv = NULL;
+        const float* wo = NULL;
+        const float* w_up = NULL;
+        const float* w_down = NULL;
+        const float* attn_norm = NULL;
+        const nn_qmatrix_t* ql = NULL;
+
+        if (qw) {
+            ql = qw->layers + l * NN_DEEPSEEK_QMATS_PER_LAYER;
+            attn_norm = qw->norms + l * 2 * h;
+        } else {
+            wq = layers + l * layer_stride;
+            wk = wq + h * h;
+            wv = wk + h * h;
+            wo = wv + h * h;
+            w_up = wo + h * h;
+            w_down = w_up + h * inter;
+            attn_norm = w_down + inter * h;
+        }
+        const float* ffn_norm = attn_norm + h;
+
+        // Keys and values for this position go straight into the cache
+        float* layer_keys = cache->key_cache + l * cache->capacity * h;
+        float* layer_values = cache->value_cache + l * cache->capacity * h;
+        float* k = layer_keys + pos * h;
+        float* v = layer_values + pos * h;
+
+        // Attention block
+        nn_rmsnorm(cache->xb, x, attn_norm, h);
+        nn_linear(cache->q, cache->xb, wq, ql ? &ql[0] : NULL, h, h);
+        nn_linear(k, cache->xb, wk, ql ? &ql[1] : NULL, h, h);
+        nn_linear(v, cache->xb, wv, ql ? &ql[2] : NULL, h, h);
+        nn_rope(cache->q, num_heads, head_dim, pos);
+        nn_rope(k, num_heads, head_dim, pos);
+
+        nn_deepseek_attention(cache, layer_keys, layer_values, pos);
+
+        // Output projection and residual
+        nn_linear(cache->xb, cache->xb2, wo, ql ? &ql[3] : NULL, h, h);
+        for (size_t i = 0; i < h; i++) {
+            x[i] += cache->xb[i];
+        }
+
+        // Feed-forward block with SiLU activation
+        nn_rmsnorm(cache->xb, x, ffn_norm, h);
+        nn_linear(cache->hb, cache->xb, w_up, ql ? &ql[4] : NULL, inter, h);
+        for (size_t i = 0; i < inter; i++) {
+            float val = cache->hb[i];
+            cache->hb[i] = val / (1.0f + expf(-val));
+        }
+        nn_linear(cache->xb, cache->hb, w_down, ql ? &ql[5] : NULL, h, inter);
+        for (size_t i = 0; i < h; i++) {
+            x[i] += cache->xb[i];
+        }
+    }
+
+    // The position is now cached
+    cache->length++;
+
+    // Prompt positions other than the last one do not need logits
+    if (!compute_logits) {
+        return 0;
+    }
+
+    // Final norm and LM head (tied to the token embeddings)
+    nn_rmsnorm(cache->xb, x, final_norm, h);
+    nn_linear(cache->logits, cache->xb, embeddings, qw ? &qw->embeddings : NULL, vocab_size, h);
+
+    return 0;
+}
+
+/**
+* Free the quantized weights of a DeepSeek model
+*
+* @param qweights: Quantized weights
+*/
+static void nn_deepseek_free_qweights(nn_deepseek_qweights_t* qweights) {
+    if (!qweights) {
+        return;
+    }
+
+    nn_qmatrix_free(&qweights->embeddings);
+
+    if (qweights->layers) {
+        for (size_t i = 0; i < qweights->num_layers * NN_DEEPSEEK_QMATS_PER_LAYER; i++) {
+            nn_qmatrix_free(&qweights->layers[i]);
+        }
+        memory_free(qweights->layers, qweights->num_layers * NN_DEEPSEEK_QMATS_PER_LAYER * sizeof(nn_qmatrix_t));
+    }
+
+    if (qweights->norms) {
+        memory_free(qweights->norms, qweights->norms_size);
+    }
+
+    memory_free(qweights, sizeof(nn_deepseek_qweights_t));
+}
+
+/**
+* Apply a linear projection to a batch of inputs
+*
+* Each weight row is read (and dequantized) once for the whole batch, so
+* the weight traffic of a decode step does not grow with the batch size.
+*
+* @param out: Output rows [batch][rows]
+* @param x: Input rows [batch][cols]
+* @param w: fp32 weight matrix [rows][cols], used when qw is NULL
+* @param qw: Quantized weight matrix, or NULL
+* @param rows: Number of rows
+* @param cols: Number of columns
+* @param batch: Number of input rows
+* @param row_buf: Scratch for one dequantized weight row [cols]
+*/
+static void nn_linear_batch(float* out, const float* x, const float* w, const nn_qmatrix_t* qw, size_t rows, size_t cols, size_t batch, float* row_buf) {
+    if (batch == 1) {
+        nn_linear(out, x, w, qw, rows, cols);
+        return;
+    }
+
+    for (size_t r = 0; r < rows; r++) {
+        const float* row;
+
+        if (qw) {
+            nn_qmatrix_dequantize_row(qw, (uint32_t)r, row_buf);
+            row = row_buf;
+        } else {
+            row = w + r * cols;
+        }
+
+        for (size_t b = 0; b < batch; b++) {
+            const float* xb = x + b * cols;
+            float sum = 0.0f;
+            for (size_t j = 0; j < cols; j++) {
+                sum += row[j] * xb[j];
+            }
+            out[b * rows + r] = sum;
+        }
+    }
+}
+
+/**
+* Run one decoder step of a DeepSeek model for a batch of sequences
+*
+* Every sequence advances by one token at its own position; the projections
+* of all sequences share one pass over the weights and only attention runs
+* per sequence. Logits are always computed.
+*
+* @param model: Model structure
+* @param caches: KV cache of each sequence
+* @param tokens: Input token of each sequence
+* @param batch: Number of sequences
+* @param scratch: Batch scratch buffers
+* @return: 0 on success, -1 on failure
+*/
+static int nn_deepseek_forward_batch(nn_model_t* model, nn_kv_cache_t** caches, const uint32_t* tokens, size_t batch, nn_batch_scratch_t* scratch) {
+    nn_deepseek_qweights_t* qw = NULL;
+    if (model && model->context) {
+        qw = (nn_deepseek_qweights_t*)((void**)model->context)[NN_CTX_QWEIGHTS];
+    }
+
+    if (!model || (!model->weights && !qw) || !caches || !tokens || batch == 0 || !scratch || batch > scratch->max_batch) {
+        console_printf("Error: Invalid parameters for nn_deepseek_forward_batch\n");
+        return -1;
+    }
+
+    size_t h = caches[0]->hidden_size;
+    size_t inter = caches[0]->intermediate_size;
+    size_t vocab_size = caches[0]->vocab_size;
+    size_t num_heads = caches[0]->num_heads;
+    size_t num_layers = caches[0]->num_layers;
+    size_t head_dim = h / num_heads;
+
+    if (scratch->width < h || scratch->width < inter || scratch->width < vocab_size) {
+        console_printf("Error: Batch scratch buffers are too small\n");
+        return -1;
+    }
+
+    for (size_t b = 0; b < batch; b++) {
+        if (caches[b]->length >= caches[b]->capacity) {
+            console_printf("Error: KV cache is full (%u positions)\n", (uint32_t)caches[b]->capacity);
+            return -1;
+        }
+    }
+
+    // Weights layout matches nn_load_deepseek_model
+    const float* embeddings = NULL;
+    const float* layers = NULL;
+    const float* final_norm = NULL;
+    size_t layer_stride = 4 * h * h + 2 * h * inter + 2 * h;
+
+    if (qw) {
+        final_norm = qw->norms + num_layers * 2 * h;
+    } else {
+        embeddings = (const float*)model->weights;
+        layers = embeddings + vocab_size * h;
+        final_norm = layers + num_layers * layer_stride;
+    }
+
+    float* in = scratch->in;
+    float* out = scratch->out;
+    float* row = scratch->row;
+
+    // Embedding lookup
+    for (size_t b = 0; b < batch; b++) {
+        uint32_t token = tokens[b] < vocab_size ? tokens[b] : (uint32_t)(vocab_size - 1);
+
+        if (qw) {
+            nn_qmatrix_dequantize_row(&qw->embeddings, token, caches[b]->x);
+        } else {
+            memcpy(caches[b]->x, embeddings + (size_t)token * h, h * sizeof(float));
+        }
+    }
+
+    for (size_t l = 0; l < num_layers; l++) {
+        const float* wq = NULL;
+        const float* wk = NULL;
+        const float* wv = NULL;
+        const float* wo = NULL;
+        const float* w_up = NULL;
+        const float* w_down = NULL;
+        const float* attn_norm = NULL;
+        const nn_qmatrix_t* ql = NULL;
+
+        if (qw) {
+            ql = qw->layers + l * NN_DEEPSEEK_QMATS_PER_LAYER;
+            attn_norm = qw->norms + l * 2 * h;
+        } else {
+            wq = layers + l * layer_stride;
+            wk = wq + h * h;
+            wv = wk + h * h;
+            wo = wv + h * h;
+            w_up = wo + h * h;
+            w_down = w_up + h * inter;
+            attn_norm = w_down + inter * h;
+        }
+        const float* ffn_norm = attn_norm + h;
+
+        // Attention block: batched projections, per-sequence attention
+        for (size_t b = 0; b < batch; b++) {
+            nn_rmsnorm(in + b * h, caches[b]->x, attn_norm, h);
+        }
+
+        nn_linear_batch(out, in, wq, ql ? &ql[0] : NULL, h, h, batch, row);
+        for (size_t b = 0; b < batch; b++) {
+            memcpy(caches[b]->q, out + b * h, h * sizeof(float));
+        }
+
+        nn_linear_batch(out, in, wk, ql ? &ql[1] : NULL, h, h, batch, row);
+        for (size_t b = 0; b < batch; b++) {
+            float* k = caches[b]->key_cache + (l * caches[b]->capacity + caches[b]->length) * h;
+            memcpy(k, out + b * h, h * sizeof(float));
+        }
+
+        nn_linear_batch(out, in, wv, ql ? &ql[2] : NULL, h, h, batch, row);
+        for (size_t b = 0; b < batch; b++) {
+            float* v = caches[b]->value_cache + (l * caches[b]->capacity + caches[b]->length) * h;
+            memcpy(v, out + b * h, h * sizeof(float));
+        }
+
+        for (size_t b = 0; b < batch; b++) {
+            nn_kv_cache_t* cache = caches[b];
+            float* layer_keys = cache->key_cache + l * cache->capacity * h;
+            float* layer_values = cache->value_cache + l * cache->capacity * h;
+            size_t pos = cache->length;
+
+            nn_rope(cache->q, num_heads, head_dim, pos);
+            nn_rope(layer_keys + pos * h, num_heads, head_dim, pos);
+            nn_deepseek_attention(cache, layer_keys, layer_values, pos);
+            memcpy(in + b * h, cache->xb2, h * sizeof(float));
+        }
+
+        // Output projection and residual
+        nn_linear_batch(out, in, wo, ql ? &ql[3] : NULL, h, h, batch, row);
+        for (size_t b = 0; b < batch; b++) {
+            float* x = caches[b]->x;
+            for (size_t i = 0; i < h; i++) {
+                x[i] += out[b * h + i];
+            }
+        }
+
+        // Feed-forward block with SiLU activation
+        for (size_t b = 0; b < batch; b++) {
+            nn_rmsnorm(in + b * h, caches[b]->x, ffn_norm, h);
+        }
+
+        nn_linear_batch(out, in, w_up, ql ? &ql[4] : NULL, inter, h, batch, row);
+        for (size_t i = 0; i < batch * inter; i++) {
+            float val = out[i];
+            out[i] = val / (1.0f + expf(-val));
+        }
+
+        nn_linear_batch(in, out, w_down, ql ? &ql[5] : NULL, h, inter, batch, row);
+        for (size_t b = 0; b < batch; b++) {
+            float* x = caches[b]->x;
+            for (size_t i = 0; i < h; i++) {
+                x[i] += in[b * h + i];
+            }
+        }
+    }
+
+    // The positions are now cached
+    for (size_t b = 0; b < batch; b++) {
+        caches[b]->length++;
+    }
+
+    // Final norm and LM head (tied to the token embeddings)
+    for (size_t b = 0; b < batch; b++) {
+        nn_rmsnorm(in + b * h, caches[b]->x, final_norm, h);
+    }
+
+    nn_linear_batch(out, in, embeddings, qw ? &qw->embeddings : NULL, vocab_size, h, batch, row);
+    for (size_t b = 0; b < batch; b++) {
+        memcpy(caches[b]->logits, out + b * vocab_size, vocab_size * sizeof(float));
+    }
+
+    return 0;
+}
+
+/**
+* Quantize the weights of a DeepSeek model
+*
+* Every projection matrix and the tied embedding / LM head matrix are
+* converted to block-quantized storage; norms stay in fp32. The fp32
+* weights are released afterwards.
+*
+* @param model: Model structure
+* @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+* @return: 0 on success, -1 on failure
+*/
+int nn_deepseek_quantize(nn_model_t* model, uint32_t dtype) {
+    if (!model || !model->context) {
+        console_printf("Error: Invalid parameters for nn_deepseek_quantize\n");
+        return -1;
+    }
+
+    if (dtype != NN_DTYPE_INT8 && dtype != NN_DTYPE_INT4) {
+        console_printf("Error: Unsupported quantization type %u\n", dtype);
+        return -1;
+    }
+
+    void** context_ptr = (void**)model->context;
+
+    // Already quantized
+    if (context_ptr[NN_CTX_QWEIGHTS]) {
+        nn_deepseek_qweights_t* existing = (nn_deepseek_qweights_t*)context_ptr[NN_CTX_QWEIGHTS];
+        if (existing->dtype == dtype) {
+            return 0;
+        }
+        console_printf("Error: Model is already quantized to a different type\n");
+        return -1;
+    }
+
+    if (!model->weights) {
+        console_printf("Error: Model has no weights to quantize\n");
+        return -1;
+    }
+
+    // Get model parameters from context
+    size_t vocab_size = context_ptr[NN_CTX_VOCAB_SIZE] ? *(size_t*)context_ptr[NN_CTX_VOCAB_SIZE] : 151936;
+    size_t h = context_ptr[NN_CTX_HIDDEN_SIZE] ? *(size_t*)context_ptr[NN_CTX_HIDDEN_SIZE] : 1536;
+    size_t num_layers = context_ptr[NN_CTX_NUM_LAYERS] ? *(size_t*)context_ptr[NN_CTX_NUM_LAYERS] : 28;
+    size_t inter = context_ptr[NN_CTX_INTERMEDIATE_SIZE] ? *(size_t*)context_ptr[NN_CTX_INTERMEDIATE_SIZE] : 8960;
+
+    // Allocate the quantized weights structure
+    nn_deepseek_qweights_t* qw = (nn_deepseek_qweights_t*)memory_alloc(sizeof(nn_deepseek_qweights_t),
+        MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+    if (!qw) {
+        console_printf("Error: Failed to allocate memory for quantized weights\n");
+        return -1;
+    }
+
+    qw->dtype = dtype;
+    qw->num_layers = num_layers;
+    qw->layers = (nn_qmatrix_t*)memory_alloc(num_layers * NN_DEEPSEEK_QMATS_PER_LAYER * sizeof(nn_qmatrix_t),
+        MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    qw->norms_size = (num_layers * 2 * h + h) * sizeof(float);
+    qw->norms = (float*)memory_alloc(qw->norms_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!qw->layers || !qw->norms) {
+        console_printf("Error: Failed to allocate memory for quantized weights\n");
+        nn_deepseek_free_qweights(qw);
+        return -1;
+    }
+
+    // Weights layout matches nn_load_deepseek_model
+    const float* embeddings = (const float*)model->weights;
+    size_t layer_stride = 4 * h * h + 2 * h * inter + 2 * h;
+    const float* layers = embeddings + vocab_size * h;
+
+    // Quantize the embeddings / LM head
+    if (nn_qmatrix_quantize(&qw->embeddings, embeddings, (uint32_t)vocab_size, (uint32_t)h, dtype) != 0) {
+        nn_deepseek_free_qweights(qw);
+        return -1;
+    }
+
+    for (size_t l = 0; l < num_layers; l++) {
+        const float* layer = layers + l * layer_stride;
+        nn_qmatrix_t* ql = qw->layers + l * NN_DEEPSEEK_QMATS_PER_LAYER;
+
+        // Q, K, V and O projections
+        int result = 0;
+        for (int m = 0; m < 4 && result == 0; m++) {
+            result = nn_qmatrix_quantize(&ql[m], layer + m * h * h, (uint32_t)h, (uint32_t)h, dtype);
+        }
+
+        // Up and down projections
+        if (result == 0) {
+            result = nn_qmatrix_quantize(&ql[4], layer + 4 * h * h, (uint32_t)inter, (uint32_t)h, dtype);
+        }
+        if (result == 0) {
+            result = nn_qmatrix_quantize(&ql[5], layer + 4 * h * h + h * inter, (uint32_t)h, (uint32_t)inter, dtype);
+        }
+
+        if (result != 0) {
+            nn_deepseek_free_qweights(qw);
+            return -1;
+        }
+
+        // Norms are kept in fp32
+        memcpy(qw->norms + l * 2 * h, layer + 4 * h * h + 2 * h * inter, 2 * h * sizeof(float));
+    }
+
+    // Final norm
+    memcpy(qw->norms + num_layers * 2 * h, layers + num_layers * layer_stride, h * sizeof(float));
+
+    // Release the fp32 weights
+    size_t fp32_size = model->weights_size;
+    memory_free(model->weights, model->weights_size);
+    model->weights = NULL;
+    model->weights_size = 0;
+
+    context_ptr[NN_CTX_QWEIGHTS] = qw;
+
+    size_t quant_size = qw->embeddings.alloc_size + qw->norms_size;
+    for (size_t i = 0; i < num_layers * NN_DEEPSEEK_QMATS_PER_LAYER; i++) {
+        quant_size += qw->layers[i].alloc_size;
+    }
+
+    console_printf("DeepSeek model quantized to %s: %u MB -> %u MB\n",
+        dtype == NN_DTYPE_INT4 ? "INT4" : "INT8",
+        (uint32_t)(fp32_size >> 20), (uint32_t)(quant_size >> 20));
+
+    return 0;
+}
+
+/**
+* Generate text using a DeepSeek model
+*
+* @param model: Model structure
+* @param prompt: Input prompt
+* @param output: Buffer to store the generated text
+* @param size: Size of the output buffer
+* @param max_tokens: Maximum number of tokens to generate
+* @param temperature: Temperature for sampling
+* @param top_p: Top-p sampling parameter
+* @param top_k: Top-k sampling parameter
+* @param repetition_penalty: Repetition penalty parameter
+* @return: 0 on success, -1 on failure
+*/
+int nn_deepseek_generate(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty) {
+    return nn_deepseek_generate_stream(model, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty, NULL, NULL);
+}
+
+/**
+* Generate text using a DeepSeek model, streaming it as tokens are sampled
+*
+* The callback receives the text of each sampled token, with the separating
+* space, so the pieces concatenate to the text stored in output.
+*
+* @param model: Model structure
+* @param prompt: Input prompt
+* @param output: Buffer to store the generated text
+* @param size: Size of the output buffer
+* @param max_tokens: Maximum number of tokens to generate
+* @param temperature: Temperature for sampling
+* @param top_p: Top-p sampling parameter
+* @param top_k: Top-k sampling parameter
+* @param repetition_penalty: Repetition penalty parameter
+* @param callback: Function receiving each piece of text (NULL for none)
+* @param user_data: User data passed to the callback
+* @return: 0 on success, -1 on failure
+*/
+int nn_deepseek_generate_stream(nn_model_t* model, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data) {
+    // Generate text using the DeepSeek model
+    if (!model || !prompt || !output || size == 0) {
+        console_printf("Error: Invalid parameters for nn_deepseek_generate\n");
+        return -1;
+    }
+
+    console_printf("Generating text with DeepSeek model (max_tokens=%u, temp=%.2f, top_p=%.2f, top_k=%.2f)\n",
+        max_tokens, temperature, top_p, top_k);
+
+    // Tokenize the prompt
+    uint32_t* input_tokens = NULL;
+    size_t num_input_tokens = 0;
+
+    if (nn_deepseek_tokenize(model, prompt, &input_tokens, &num_input_tokens) != 0) {
+        console_printf("Error: Failed to tokenize prompt\n");
+        return -1;
+    }
+
+    // Allocate memory for the generated tokens
+    size_t max_seq_len = num_input_tokens + max_tokens;
+    uint32_t* all_tokens = (uint32_t*)memory_alloc(max_seq_len * sizeof(uint32_t),
+        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+        MEMORY_ALLOC_ZEROED);
+
+    if (!all_tokens) {
+        console_printf("Error: Failed to allocate memory for generated tokens\n");
+        memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+        return -1;
+    }
+
+    // Copy the input tokens
+    memcpy(all_tokens, input_tokens, num_input_tokens * sizeof(uint32_t));
+    size_t total_tokens = num_input_tokens;
+
+    // Free the input tokens
+    memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+
+    // Run the model to generate tokens
+    size_t num_generated_tokens = 0;
+    uint32_t* generated_tokens = (uint32_t*)memory_alloc(max_tokens * sizeof(uint32_t),
+        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+        MEMORY_ALLOC_ZEROED);
+
+    if (!generated_tokens) {
+        console_printf("Error: Failed to allocate memory for generated tokens\n");
+        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+        return -1;
+    }
+
+    // Get model parameters from context
+    size_t vocab_size = 151936; // Default from config.json
+    uint32_t eos_token_id = 151643; // Default from config.json
+
+    if (model->context) {
+        void** context_ptr = (void**)model->context;
+        if (context_ptr[0]) { // Vocabulary size
+            vocab_size = *(size_t*)context_ptr[0];
+        }
+        if (context_ptr[4]) { // EOS token ID
+            eos_token_id = *(uint32_t*)context_ptr[4];
+        }
+    }
+
+    // Get the KV cache for this sequence
+    nn_kv_cache_t* cache = nn_deepseek_get_kv_cache(model, max_seq_len);
+
+    if (!cache) {
+        console_printf("Error: Failed to allocate KV cache\n");
+        memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
+        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+        return -1;
+    }
+
+    // Reuse the rows of a cached prompt prefix so only the rest is prefilled
+    prefix_cache_kv_t kv = {
+        cache->num_layers, cache->hidden_size, cache->capacity * cache->hidden_size,
+        cache->key_cache, cache->value_cache
+    };
+    uint64_t trace_start = trace_begin(&nn_trace_prefill);
+    cache->length = prefix_cache_lookup(model, all_tokens, total_tokens, &kv);
+    size_t cached = cache->length;
+
+    // Prefill the cache with the prompt, computing logits only for the last position
+    for (size_t p = cache->length; p < total_tokens; p++) {
+        if (nn_deepseek_forward(model, cache, all_tokens[p], p + 1 == total_tokens) != 0) {
+            console_printf("Error: Failed to run prefill\n");
+            nn_deepseek_put_kv_cache(model, cache);
+            memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
+            memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+            return -1;
+        }
+    }
+
+    trace_end(&nn_trace_prefill, trace_start, (uint32_t)(total_tokens - cached), (uint32_t)cached);
+
+    // Keep the prompt rows for later generations sharing its prefix
+    prefix_cache_insert(model, all_tokens, total_tokens, &kv);
+
+    // The logits buffer lives in the KV cache and is refreshed by every forward step
+    float* logits = cache->logits;
+
+    // Set up the sampler; its scratch buffers are shared by every step
+    sampler_params_t sampler_params;
+    sampler_params.temperature = temperature;
+    sampler_params.top_p = top_p;
+    sampler_params.top_k = (int)top_k;
+    sampler_params.repetition_penalty = repetition_penalty;
+
+    sampler_t sampler;
+    if (sampler_init(&sampler, vocab_size, sampler_params.top_k) != 0) {
+        console_printf("Error: Failed to initialize sampler\n");
+        nn_deepseek_put_kv_cache(model, cache);
+        memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
+        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+        return -1;
+    }
+
+    // Text streamed so far
+    size_t streamed_len = 0;
+
+    // Generate tokens one by one
+    for (uint32_t i = 0; i < max_tokens; i++) {
+        trace_start = trace_begin(&nn_trace_decode);
+
+        // Run the newest token through the model against the cached prefix
+        if (i > 0 && nn_deepseek_forward(model, cache, all_tokens[total_tokens - 1], 1) != 0) {
+            console_printf("Error: Failed to run decode step\n");
+            break;
+        }
+
+        // Sample the next token
+        uint32_t sampled_token = sampler_sample(&sampler, logits, &sampler_params, all_tokens, total_tokens);
+        
+        trace_end(&nn_trace_decode, trace_start, (uint32_t)total_tokens, sampled_token);
+        
+        // Add the sampled token to the generated tokens
+        generated_tokens[num_generated_tokens++] = sampled_token;
+        
+        // Add the sampled token to all tokens
+        all_tokens[total_tokens++] = sampled_token;
+        
+        // Check if we've generated the EOS token
+        if (sampled_token == eos_token_id) {
+            break;
+        }
+
+        // Stream the token text, stopping when the caller asks to
+        char piece[72];
+        if (callback && nn_deepseek_token_text(sampled_token, piece + 1, sizeof(piece) - 1)) {
+            piece[0] = ' ';
+            const char* text = streamed_len > 0 ? piece : piece + 1;
+            size_t len = strlen(text);
+
+            streamed_len += len;
+            if (callback(text, len, user_data) != 0) {
+                break;
+            }
+        }
+    }
+    
+    nn_deepseek_put_kv_cache(model, cache);
+    
+    // Detokenize the generated tokens
+    if (nn_deepseek_detokenize(generated_tokens, num_generated_tokens, output, size) != 0) {
+        console_printf("Error: Failed to detokenize generated tokens\n");
+        sampler_free(&sampler);
+        memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
+        memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+        return -1;
+    }
+    
+    // Free memory
+    sampler_free(&sampler);
+    memory_free(generated_tokens, max_tokens * sizeof(uint32_t));
+    memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+    
+    console_printf("Generated %zu tokens\n", num_generated_tokens);
+    
+    return 0;
+}
+
+/**
+* Reserve batch scratch buffers for a batch size and row width
+*
+* @param scratch: Pointer to the scratch buffers (NULL until first use)
+* @param batch: Number of sequences
+* @param width: Floats per batch row
+* @return: 0 on success, -1 on failure
+*/
+static int nn_batch_reserve_scratch(nn_batch_scratch_t** scratch, size_t batch, size_t width) {
+    if (*scratch && (*scratch)->max_batch >= batch && (*scratch)->width >= width) {
+        return 0;
+    }
+
+    // Grow to the batch limit at once so the buffers are only resized per model
+    if (*scratch) {
+        if ((*scratch)->width > width) {
+            width = (*scratch)->width;
+        }
+        memory_free(*scratch, (*scratch)->alloc_size);
+        *scratch = NULL;
+    }
+
+    size_t max_batch = NN_BATCH_MAX_SEQS;
+    size_t alloc_size = sizeof(nn_batch_scratch_t) + (2 * max_batch + 1) * width * sizeof(float);
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate batch scratch buffers\n");
+        return -1;
+    }
+
+    nn_batch_scratch_t* s = (nn_batch_scratch_t*)block;
+    s->max_batch = max_batch;
+    s->width = width;
+    s->in = (float*)(block + sizeof(nn_batch_scratch_t));
+    s->out = s->in + max_batch * width;
+    s->row = s->out + max_batch * width;
+    s->alloc_size = alloc_size;
+
+    *scratch = s;
+
+    return 0;
+}
+
+/**
+* Lock the batch scheduler
+*/
+static void nn_batch_lock(void) {
+    while (__sync_lock_test_and_set(&nn_batch.lock, 1)) {
+        while (nn_batch.lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+* Unlock the batch scheduler
+*/
+static void nn_batch_unlock(void) {
+    __sync_lock_release(&nn_batch.lock);
+}
+
+/**
+* Finish a sequence and wake its submitter
+*
+* The generated tokens are detokenized into the submitter's buffer and the
+* sequence's buffers are released; the sequence itself belongs to the
+* submitter.
+*
+* @param seq: Sequence
+* @param result: Result reported to the submitter
+*/
+static void nn_batch_finish(nn_sequence_t* seq, int result) {
+    if (result == 0) {
+        size_t num_generated = seq->num_tokens - seq->num_prompt_tokens;
+
+        if (nn_deepseek_detokenize(seq->tokens + seq->num_prompt_tokens, (uint32_t)num_generated, seq->output, seq->output_size) != 0) {
+            console_printf("Error: Failed to detokenize generated tokens\n");
+            result = -1;
+        }
+    }
+
+    sampler_free(&seq->sampler);
+    nn_deepseek_free_kv_cache(seq->cache);
+    memory_free(seq->tokens, seq->max_seq_len * sizeof(uint32_t));
+    seq->cache = NULL;
+    seq->tokens = NULL;
+    seq->result = result;
+
+    nn_batch_lock();
+    nn_batch.stats.sequences++;
+    nn_batch_unlock();
+
+    // The submitter frees the sequence once it sees done
+    pid_t waiter = seq->waiter;
+
+    __sync_synchronize();
+    seq->done = 1;
+    process_unblock(waiter);
+}
+
+/**
+* Prefill a sequence's KV cache with its prompt
+*
+* @param seq: Sequence
+* @return: 0 on success, -1 on failure
+*/
+static int nn_batch_prefill(nn_sequence_t* seq) {
+    nn_kv_cache_t* cache = seq->cache;
+
+    // Reuse the rows of a cached prompt prefix so only the rest is prefilled
+    prefix_cache_kv_t kv = {
+        cache->num_layers, cache->hidden_size, cache->capacity * cache->hidden_size,
+        cache->key_cache, cache->value_cache
+    };
+    uint64_t trace_start = trace_begin(&nn_trace_prefill);
+    cache->length = prefix_cache_lookup(seq->model, seq->tokens, seq->num_tokens, &kv);
+    size_t cached = cache->length;
+
+    for (size_t p = cache->length; p < seq->num_tokens; p++) {
+        if (nn_deepseek_forward(seq->model, cache, seq->tokens[p], p + 1 == seq->num_tokens) != 0) {
+            console_printf("Error: Failed to run prefill\n");
+            return -1;
+        }
+    }
+
+    trace_end(&nn_trace_prefill, trace_start, (uint32_t)(seq->num_tokens - cached), (uint32_t)cached);
+
+    prefix_cache_insert(seq->model, seq->tokens, seq->num_tokens, &kv);
+
+    return 0;
+}
+
+/**
+* Run one decode step over the running batch
+*
+* Every sequence samples its next token from the logits of the previous
+* step. Sequences that reach EOS or their token limit leave the batch; the
+* rest advance together, one batched forward pass per model.
+*
+* @param scratch: Pointer to the batch scratch buffers
+*/
+static void nn_batch_step(nn_batch_scratch_t** scratch) {
+    nn_sequence_t** active = nn_batch.active;
+    uint32_t num_active = 0;
+
+    // Sample and retire finished sequences
+    for (uint32_t i = 0; i < nn_batch.num_active; i++) {
+        nn_sequence_t* seq = active[i];
+        uint32_t token = sampler_sample(&seq->sampler, seq->cache->logits, &seq->params, seq->tokens, seq->num_tokens);
+
+        seq->tokens[seq->num_tokens++] = token;
+
+        if (token == seq->eos_token_id || seq->num_tokens - seq->num_prompt_tokens >= seq->max_tokens) {
+            nn_batch_finish(seq, 0);
+            continue;
+        }
+
+        active[num_active++] = seq;
+    }
+
+    nn_batch.num_active = num_active;
+
+    // Advance the remaining sequences, grouped by model
+    nn_kv_cache_t* caches[NN_BATCH_MAX_SEQS];
+    uint32_t tokens[NN_BATCH_MAX_SEQS];
+    uint32_t members[NN_BATCH_MAX_SEQS];
+    uint8_t grouped[NN_BATCH_MAX_SEQS];
+    uint8_t failed[NN_BATCH_MAX_SEQS];
+
+    memset(grouped, 0, sizeof(grouped));
+    memset(failed, 0, sizeof(failed));
+
+    for (uint32_t i = 0; i < num_active; i++) {
+        if (grouped[i]) {
+            continue;
+        }
+
+        nn_model_t* model = active[i]->model;
+        size_t batch = 0;
+
+        for (uint32_t j = i; j < num_active; j++) {
+            if (!grouped[j] && active[j]->model == model) {
+                caches[batch] = active[j]->cache;
+                tokens[batch] = active[j]->tokens[active[j]->num_tokens - 1];
+                members[batch] = j;
+                grouped[j] = 1;
+                batch++;
+            }
+        }
+
+        size_t width = caches[0]->hidden_size;
+        if (caches[0]->intermediate_size > width) {
+            width = caches[0]->intermediate_size;
+        }
+        if (caches[0]->vocab_size > width) {
+            width = caches[0]->vocab_size;
+        }
+
+        uint64_t trace_start = trace_begin(&nn_trace_decode_batch);
+
+        if (nn_batch_reserve_scratch(scratch, batch, width) != 0 ||
+            nn_deepseek_forward_batch(model, caches, tokens, batch, *scratch) != 0) {
+            console_printf("Error: Failed to run batched decode step\n");
+            for (size_t b = 0; b < batch; b++) {
+                failed[members[b]] = 1;
+            }
+            continue;
+        }
+
+        trace_end(&nn_trace_decode_batch, trace_start, (uint32_t)batch, 0);
+
+        nn_batch_lock();
+        nn_batch.stats.steps++;
+        nn_batch.stats.tokens += batch;
+        if (batch > nn_batch.stats.max_batch) {
+            nn_batch.stats.max_batch = (uint32_t)batch;
+        }
+        nn_batch_unlock();
+    }
+
+    // Drop sequences whose step failed
+    num_active = 0;
+
+    for (uint32_t i = 0; i < nn_batch.num_active; i++) {
+        if (failed[i]) {
+            nn_batch_finish(active[i], -1);
+        } else {
+            active[num_active++] = active[i];
+        }
+    }
+
+    nn_batch.num_active = num_active;
+}
+
+/**
+* Run the batch scheduler until no sequence is left
+*
+* Waiting sequences join the running batch at token boundaries, between
+* two decode steps.
+*/
+static void nn_batch_run(void) {
+    nn_batch_scratch_t* scratch = NULL;
+
+    for (;;) {
+        nn_batch_lock();
+
+        while (nn_batch.num_pending > 0 && nn_batch.num_active < NN_BATCH_MAX_SEQS) {
+            nn_sequence_t* seq = nn_batch.pending[nn_batch.pending_head];
+
+            nn_batch.pending_head = (nn_batch.pending_head + 1) % NN_BATCH_QUEUE_SIZE;
+            nn_batch.num_pending--;
+            nn_batch_unlock();
+
+            if (nn_batch_prefill(seq) == 0) {
+                nn_batch.active[nn_batch.num_active++] = seq;
+            } else {
+                nn_batch_finish(seq, -1);
+            }
+
+            nn_batch_lock();
+        }
+
+        nn_batch.stats.active = nn_batch.num_active;
+        nn_batch.stats.pending = nn_batch.num_pending;
+
+        // Stop once idle; the next submission starts a new batch
+        if (nn_batch.num_active == 0) {
+            nn_batch.running = 0;
+            nn_batch_unlock();
+            break;
+        }
+
+        nn_batch_unlock();
+
+        nn_batch_step(&scratch);
+
+        // Let submitters and other processes run between steps
+        process_yield();
+    }
+
+    if (scratch) {
+        memory_free(scratch, scratch->alloc_size);
+    }
+}
+
+/**
+* Entry point of the batch scheduler daemon
+*
+* Runs each batch handed over by nn_generate_batched, blocking in between.
+*/
+static void nn_batch_main(void) {
+    for (;;) {
+        nn_batch.wake = 0;
+        __sync_synchronize();
+
+        if (nn_batch.handoff) {
+            nn_batch.handoff = 0;
+            nn_batch_run();
+            continue;
+        }
+
+        // Sleep until a submitter hands over the next batch
+        if (process_block_unless(&nn_batch.wake) != 0) {
+            process_yield();
+        }
+    }
+}
+
+/**
+* Hand a newly started batch to the scheduler daemon
+*
+* Starts the daemon on first use. Only the submitter that set running calls
+* this, so the daemon is never started twice.
+*
+* @return: 0 on success, -1 if there is no daemon to run the batch
+*/
+static int nn_batch_handoff(void) {
+    if (nn_batch.daemon == 0) {
+        nn_batch.daemon = process_create("nn_batch", nn_batch_main, NN_BATCH_STACK_SIZE,
+                                         PROCESS_PRIORITY_NORMAL, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+
+        if (nn_batch.daemon == 0) {
+            return -1;
+        }
+    }
+
+    nn_batch.handoff = 1;
+    nn_batch.wake = 1;
+    __sync_synchronize();
+    process_unblock(nn_batch.daemon);
+
+    return 0;
+}
+
+/**
+* Generate text through the continuous batching scheduler
+*
+* Concurrent callers share decode steps: each call joins the running batch
+* at the next token boundary and returns when its sequence finishes.
+* Models other than DeepSeek are generated directly.
+*
+* @param id: Model ID
+* @param prompt: Prompt text
+* @param output: Output buffer
+* @param size: Output buffer size
+* @param max_tokens: Maximum number of tokens to generate
+* @param temperature: Sampling temperature
+* @param top_p: Nucleus sampling threshold
+* @param top_k: Top-k sampling cutoff
+* @param repetition_penalty: Repetition penalty
+* @return: 0 on success, -1 on failure
+*/
+int nn_generate_batched(nn_model_id_t id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty) {
+    // Check if the model ID is valid
+    if (id >= MAX_MODELS || !model_table[id]) {
+        console_printf("Error: Invalid model ID\n");
+        return -1;
+    }
+
+    // Check if the prompt and output pointers are valid
+    if (!prompt || !output || size == 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+
+    nn_model_t* model = model_table[id];
+
+    if (model->type != NN_MODEL_TYPE_DEEPSEEK || !model->context || max_tokens == 0) {
+        return nn_generate(id, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty);
+    }
+
+    nn_sequence_t* seq = (nn_sequence_t*)memory_alloc(sizeof(nn_sequence_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    if (!seq) {
+        console_printf("Error: Failed to allocate sequence\n");
+        return -1;
+    }
+
+    // Tokenize the prompt into a buffer with room for the generated tokens
+    uint32_t* input_tokens = NULL;
+    size_t num_input_tokens = 0;
+
+    if (nn_deepseek_tokenize(model, prompt, &input_tokens, &num_input_tokens) != 0) {
+        console_printf("Error: Failed to tokenize prompt\n");
+        memory_free(seq, sizeof(nn_sequence_t));
+        return -1;
+    }
+
+    seq->model = model;
+    seq->max_seq_len = num_input_tokens + max_tokens;
+    seq->tokens = (uint32_t*)memory_alloc(seq->max_seq_len * sizeof(uint32_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    seq->cache = nn_deepseek_alloc_kv_cache(model, seq->max_seq_len);
+
+    if (seq->tokens) {
+        memcpy(seq->tokens, input_tokens, num_input_tokens * sizeof(uint32_t));
+    }
+    memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+
+    seq->num_tokens = num_input_tokens;
+    seq->num_prompt_tokens = num_input_tokens;
+    seq->max_tokens = max_tokens;
+    seq->output = output;
+    seq->output_size = size;
+    seq->waiter = process_get_current() ? process_get_current()->pid : 0;
+    seq->params.temperature = temperature;
+    seq->params.top_p = top_p;
+    seq->params.top_k = (int)top_k;
+    seq->params.repetition_penalty = repetition_penalty;
+
+    // Get model parameters from context
+    void** context_ptr = (void**)model->context;
+    size_t vocab_size = context_ptr[NN_CTX_VOCAB_SIZE] ? *(size_t*)context_ptr[NN_CTX_VOCAB_SIZE] : 151936;
+    seq->eos_token_id = context_ptr[NN_CTX_EOS_TOKEN_ID] ? *(uint32_t*)context_ptr[NN_CTX_EOS_TOKEN_ID] : 151643;
+
+    if (!seq->tokens || !seq->cache || num_input_tokens == 0 ||
+        sampler_init(&seq->sampler, vocab_size, seq->params.top_k) != 0) {
+        console_printf("Error: Failed to set up sequence\n");
+        if (seq->cache) {
+            nn_deepseek_free_kv_cache(seq->cache);
+        }
+        if (seq->tokens) {
+            memory_free(seq->tokens, seq->max_seq_len * sizeof(uint32_t));
+        }
+        memory_free(seq, sizeof(nn_sequence_t));
+        return -1;
+    }
+
+    // Queue the sequence, starting a batch if the scheduler is idle
+    int start = 0;
+
+    nn_batch_lock();
+
+    if (nn_batch.num_pending == NN_BATCH_QUEUE_SIZE) {
+        nn_batch_unlock();
+        sampler_free(&seq->sampler);
+        nn_deepseek_free_kv_cache(seq->cache);
+        memory_free(seq->tokens, seq->max_seq_len * sizeof(uint32_t));
+        memory_free(seq, sizeof(nn_sequence_t));
+        return nn_generate(id, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty);
+    }
+
+    nn_batch.pending[(nn_batch.pending_head + nn_batch.num_pending) % NN_BATCH_QUEUE_SIZE] = seq;
+    nn_batch.num_pending++;
+
+    if (!nn_batch.running) {
+        nn_batch.running = 1;
+        start = 1;
+    }
+
+    nn_batch_unlock();
+
+    // Without a scheduler to run the daemon, or without a daemon, run the
+    // batch on this thread. It keeps running set while it runs, so later
+    // submissions join this batch rather than start a second one, and
+    // clears it once idle.
+    if (start && (!process_scheduler_running() || nn_batch_handoff() != 0)) {
+        nn_batch_run();
+    }
+
+    // Wait for the sequence to finish
+    while (!seq->done) {
+        if (process_block_unless(&seq->done) != 0) {
+            process_yield();
+        }
+    }
+
+    int result = seq->result;
+    memory_free(seq, sizeof(nn_sequence_t));
+
+    return result;
+}
+
+/**
+* Get continuous batching statistics
+*
+* @param stats: Pointer to store the statistics
+* @return: 0 on success, -1 on failure
+*/
+int nn_get_batch_stats(nn_batch_stats_t* stats) {
+    if (!stats) {
+        return -1;
+    }
+
+    nn_batch_lock();
+    *stats = nn_batch.stats;
+    nn_batch_unlock();
+
+    return 0;
+}
+
+/**
+* Prefill a KV cache with all prompt tokens but the last
+*
+* @param model: Model structure
+* @param cache: KV cache
+* @param tokens: Prompt tokens
+* @param num_tokens: Number of prompt tokens
+* @return: 0 on success, -1 on failure
+*/
+static int nn_spec_prefill(nn_model_t* model, nn_kv_cache_t* cache, const uint32_t* tokens, size_t num_tokens) {
+    prefix_cache_kv_t kv = {
+        cache->num_layers, cache->hidden_size, cache->capacity * cache->hidden_size,
+        cache->key_cache, cache->value_cache
+    };
+    uint64_t trace_start = trace_begin(&nn_trace_prefill);
+    cache->length = prefix_cache_lookup(model, tokens, num_tokens, &kv);
+    size_t cached = cache->length;
+
+    for (size_t p = cache->length; p + 1 < num_tokens; p++) {
+        if (nn_deepseek_forward(model, cache, tokens[p], 0) != 0) {
+            return -1;
+        }
+    }
+
+    trace_end(&nn_trace_prefill, trace_start, (uint32_t)(cache->length - cached), (uint32_t)cached);
+
+    prefix_cache_insert(model, tokens, cache->length, &kv);
+
+    return 0;
+}
+
+/**
+* Generate text with speculative decoding
+*
+* Each step the draft model proposes up to num_draft_tokens tokens one by
+* one, and the target model scores all of them in a single batched forward
+* pass. A proposal x drawn from the draft distribution q is accepted with
+* probability min(1, p(x) / q(x)) under the target distribution p; the first
+* rejected one is replaced by a draw from max(0, p - q), and a fully
+* accepted step draws one more token from p. The generated text therefore
+* follows the same distribution as nn_generate with the same parameters.
+* Both models must be DeepSeek models sharing a vocabulary.
+*
+* @param id: Target model ID
+* @param draft_id: Draft model ID
+* @param prompt: Input prompt
+* @param output: Buffer to store the generated text
+* @param size: Size of the output buffer
+* @param max_tokens: Maximum number of tokens to generate
+* @param temperature: Temperature for sampling
+* @param top_p: Top-p sampling parameter
+* @param top_k: Top-k sampling parameter
+* @param repetition_penalty: Repetition penalty parameter
+* @param num_draft_tokens: Tokens proposed per step (at most NN_SPEC_MAX_DRAFT)
+* @param stats: Pointer to store the statistics of the generation (may be NULL)
+* @return: 0 on success, -1 on failure
+*/
+int nn_generate_speculative(nn_model_id_t id, nn_model_id_t draft_id, const char* prompt, char* output, size_t size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, uint32_t num_draft_tokens, nn_speculative_stats_t* stats) {
+    // Check if the model IDs are valid
+    if (id >= MAX_MODELS || !model_table[id] || draft_id >= MAX_MODELS || !model_table[draft_id]) {
+        console_printf("Error: Invalid model ID\n");
+        return -1;
+    }
+
+    // Check if the prompt and output pointers are valid
+    if (!prompt || !output || size == 0) {
+        console_printf("Error: Invalid parameters\n");
+        return -1;
+    }
+
+    nn_model_t* model = model_table[id];
+    nn_model_t* draft = model_table[draft_id];
+
+    if (model->type != NN_MODEL_TYPE_DEEPSEEK || draft->type != NN_MODEL_TYPE_DEEPSEEK || draft == model) {
+        console_printf("Error: Speculative decoding needs two DeepSeek models\n");
+        return -1;
+    }
+
+    if (stats) {
+        memset(stats, 0, sizeof(nn_speculative_stats_t));
+    }
+
+    // Without draft tokens this is plain generation
+    if (num_draft_tokens == 0) {
+        return nn_generate(id, prompt, output, size, max_tokens, temperature, top_p, top_k, repetition_penalty);
+    }
+
+    size_t k = num_draft_tokens < NN_SPEC_MAX_DRAFT ? num_draft_tokens : NN_SPEC_MAX_DRAFT;
+
+    // Tokenize the prompt
+    uint32_t* input_tokens = NULL;
+    size_t num_input_tokens = 0;
+
+    if (nn_deepseek_tokenize(model, prompt, &input_tokens, &num_input_tokens) != 0 || num_input_tokens == 0) {
+        console_printf("Error: Failed to tokenize prompt\n");
+        return -1;
+    }
+
+    // Room for the prompt, the generated tokens and one step of proposals
+    size_t max_seq_len = num_input_tokens + max_tokens + k + 1;
+    uint32_t* all_tokens = (uint32_t*)memory_alloc(max_seq_len * sizeof(uint32_t),
+        MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+        MEMORY_ALLOC_ZEROED);
+
+    if (!all_tokens) {
+        console_printf("Error: Failed to allocate memory for generated tokens\n");
+        memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+        return -1;
+    }
+
+    memcpy(all_tokens, input_tokens, num_input_tokens * sizeof(uint32_t));
+    memory_free(input_tokens, num_input_tokens * sizeof(uint32_t));
+    size_t total_tokens = num_input_tokens;
+
+    uint32_t eos_token_id = 151643; // Default from config.json
+    void** context_ptr = (void**)model->context;
+    if (context_ptr && context_ptr[NN_CTX_EOS_TOKEN_ID]) {
+        eos_token_id = *(uint32_t*)context_ptr[NN_CTX_EOS_TOKEN_ID];
+    }
+
+    // Both caches hold every committed token but the newest one
+    nn_kv_cache_t* cache = nn_deepseek_get_kv_cache(model, max_seq_len);
+    nn_kv_cache_t* draft_cache = nn_deepseek_get_kv_cache(draft, max_seq_len);
+    nn_kv_cache_t* views[NN_SPEC_MAX_DRAFT + 1] = { NULL };
+    nn_batch_scratch_t* scratch = NULL;
+    float* probs = NULL;
+    size_t probs_size = 0;
+    sampler_t sampler;
+    int sampler_ready = 0;
+    int result = -1;
+
+    if (!cache || !draft_cache) {
+        console_printf("Error: Failed to allocate KV cache\n");
+        goto done;
+    }
+
+    size_t vocab_size = cache->vocab_size;
+
+    if (draft_cache->vocab_size != vocab_size) {
+        console_printf("Error: Draft model vocabulary does not match\n");
+        goto done;
+    }
+
+    // Views let the proposals of a step run through the target as one batch
+    for (size_t i = 0; i <= k; i++) {
+        views[i] = nn_deepseek_alloc_kv_view(cache);
+        if (!views[i]) {
+            goto done;
+        }
+    }
+
+    size_t width = cache->vocab_size;
+    if (cache->hidden_size > width) {
+        width = cache->hidden_size;
+    }
+    if (cache->intermediate_size > width) {
+        width = cache->intermediate_size;
+    }
+
+    if (nn_batch_reserve_scratch(&scratch, k + 1, width) != 0) {
+        goto done;
+    }
+
+    // Draft distributions [k][vocab_size] followed by one target distribution
+    probs_size = (k + 1) * vocab_size * sizeof(float);
+    probs = (float*)memory_alloc(probs_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!probs) {
+        console_printf("Error: Failed to allocate memory for draft distributions\n");
+        goto done;
+    }
+
+    sampler_params_t sampler_params;
+    sampler_params.temperature = temperature;
+    sampler_params.top_p = top_p;
+    sampler_params.top_k = (int)top_k;
+    sampler_params.repetition_penalty = repetition_penalty;
+
+    if (sampler_init(&sampler, vocab_size, sampler_params.top_k) != 0) {
+        console_printf("Error: Failed to initialize sampler\n");
+        goto done;
+    }
+    sampler_ready = 1;
+
+    if (nn_spec_prefill(model, cache, all_tokens, total_tokens) != 0 ||
+        nn_spec_prefill(draft, draft_cache, all_tokens, total_tokens) != 0) {
+        console_printf("Error: Failed to run prefill\n");
+        goto done;
+    }
+
+    float* p = probs + k * vocab_size;
+    size_t num_generated = 0;
+    int finished = 0;
+
+    while (!finished && num_generated < max_tokens) {
+        size_t n = total_tokens;
+        size_t num_draft = k < max_tokens - num_generated ? k : max_tokens - num_generated;
+
+        // Propose tokens with the draft model
+        for (size_t i = 0; i < num_draft; i++) {
+            float* q = probs + i * vocab_size;
+
+            if (nn_deepseek_forward(draft, draft_cache, all_tokens[n + i - 1], 1) != 0) {
+                console_printf("Error: Failed to run draft step\n");
+                goto done;
+            }
+
+            sampler_probs(&sampler, draft_cache->logits, &sampler_params, all_tokens, n + i, q);
+            all_tokens[n + i] = sampler_draw(q, vocab_size);
+        }
+
+        // Score the newest committed token and every proposal in one pass
+        for (size_t i = 0; i <= num_draft; i++) {
+            views[i]->length = cache->length + i;
+        }
+
+        uint64_t trace_start = trace_begin(&nn_trace_verify);
+
+        if (nn_deepseek_forward_batch(model, views, all_tokens + n - 1, num_draft + 1, scratch) != 0) {
+            console_printf("Error: Failed to run verify step\n");
+            goto done;
+        }
+
+        trace_end(&nn_trace_verify, trace_start, (uint32_t)num_draft, 0);
+
+        // Accept proposals while the target agrees often enough
+        size_t accepted = 0;
+        uint32_t next_token = 0;
+        int rejected = 0;
+
+        for (; accepted < num_draft; accepted++) {
+            const float* q = probs + accepted * vocab_size;
+            uint32_t token = all_tokens[n + accepted];
+
+            sampler_probs(&sampler, views[accepted]->logits, &sampler_params, all_tokens, n + accepted, p);
+
+            float r = (float)rand() / RAND_MAX;
+            if (p[token] >= q[token] || r * q[token] < p[token]) {
+                continue;
+            }
+
+            // Resample from the part of p the draft undershoots
+            for (size_t j = 0; j < vocab_size; j++) {
+                p[j] = p[j] > q[j] ? p[j] - q[j] : 0.0f;
+            }
+            next_token = sampler_draw(p, vocab_size);
+            rejected = 1;
+            break;
+        }
+
+        // Every proposal was accepted: draw one more token from the target
+        if (!rejected) {
+            sampler_probs(&sampler, views[num_draft]->logits, &sampler_params, all_tokens, n + num_draft, p);
+            next_token = sampler_draw(p, vocab_size);
+        }
+
+        all_tokens[n + accepted] = next_token;
+
+        if (stats) {
+            stats->steps++;
+            stats->drafted += num_draft;
+            stats->accepted += accepted;
+        }
+
+        // Commit the accepted tokens and the drawn one, up to EOS and max_tokens
+        size_t step_tokens = accepted + 1;
+        for (size_t i = 0; i < step_tokens; i++) {
+            if (num_generated + i + 1 >= max_tokens || all_tokens[n + i] == eos_token_id) {
+                step_tokens = i + 1;
+                finished = 1;
+                break;
+            }
+        }
+
+        total_tokens = n + step_tokens;
+        num_generated += step_tokens;
+
+        if (finished) {
+            break;
+        }
+
+        // Roll both caches back to the committed tokens; after a full
+        // acceptance the draft still has to run its last proposal
+        cache->length = total_tokens - 1;
+
+        if (draft_cache->length < total_tokens - 1) {
+            if (nn_deepseek_forward(draft, draft_cache, all_tokens[total_tokens - 2], 0) != 0) {
+                console_printf("Error: Failed to run draft step\n");
+                goto done;
+            }
+        }
+        draft_cache->length = total_tokens - 1;
+    }
+
+    if (stats) {
+        stats->tokens = num_generated;
+        stats->acceptance_rate = stats->drafted > 0 ? (float)stats->accepted / (float)stats->drafted : 0.0f;
+    }
+
+    // Detokenize the generated tokens
+    if (nn_deepseek_detokenize(all_tokens + num_input_tokens, (uint32_t)num_generated, output, size) != 0) {
+        console_printf("Error: Failed to detokenize generated tokens\n");
+        goto done;
+    }
+
+    console_printf("Generated %u tokens, %u of %u proposals accepted\n", (uint32_t)num_generated,
+        stats ? (uint32_t)stats->accepted : 0, stats ? (uint32_t)stats->drafted : 0);
+
+    result = 0;
+
+done:
+    if (sampler_ready) {
+        sampler_free(&sampler);
+    }
+    if (probs) {
+        memory_free(probs, probs_size);
+    }
+    if (scratch) {
+        memory_free(scratch, scratch->alloc_size);
+    }
+    for (size_t i = 0; i <= k; i++) {
+        nn_deepseek_free_kv_cache(views[i]);
+    }
+    nn_deepseek_put_kv_cache(draft, draft_cache);
+    nn_deepseek_put_kv_cache(model, cache);
+    memory_free(all_tokens, max_seq_len * sizeof(uint32_t));
+
+    return result;
 }
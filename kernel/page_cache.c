@@ -0,0 +1,994 @@
+/**
+ * page_cache.c - File page cache for NeuroOS
+ *
+ * This file implements the page cache. Every file the backend has opened
+ * once has a mapping, which owns that file's cached pages and outlives the
+ * opens of the file as long as it has pages; all mappings share one pool
+ * of pages and one LRU list, and the least recently used page is evicted
+ * (written back first if dirty) when the pool is full.
+ *
+ * A miss on the page after the one last read, or on the same page, counts
+ * as sequential and reads a window of pages in one backend call. The window
+ * starts at PAGE_CACHE_READAHEAD_MIN pages and doubles up to
+ * PAGE_CACHE_READAHEAD_MAX while the reader stays sequential; the next
+ * window is read as soon as the reader is half way through the current one,
+ * so it never waits on a miss. A random access reads just its own page.
+ */
+
+#include "include/page_cache.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+
+// Hash buckets for pages and for mappings
+#define PAGE_CACHE_PAGE_BUCKETS 4096
+#define PAGE_CACHE_MAPPING_BUCKETS 64
+
+// Page flags
+#define PAGE_CACHE_PAGE_DIRTY 0x01
+
+struct page_cache_mapping;
+
+// Cached page
+typedef struct page_cache_page {
+    struct page_cache_page* hash_next;
+    struct page_cache_page* lru_prev;   // Towards the most recently used page
+    struct page_cache_page* lru_next;
+    struct page_cache_page* map_prev;   // Pages of the same mapping
+    struct page_cache_page* map_next;
+    struct page_cache_mapping* mapping; // NULL if the page is free
+    uint64_t index;                     // Page number in the file
+    uint32_t flags;
+    uint8_t* data;
+} page_cache_page_t;
+
+// Cached file
+typedef struct page_cache_mapping {
+    struct page_cache_mapping* next;
+    uint64_t key;
+    void* handle;                       // Backend handle, NULL while the file is closed
+    uint32_t opens;
+    uint64_t size;
+    page_cache_page_t* pages;
+    uint32_t num_pages;
+} page_cache_mapping_t;
+
+// Open file
+struct page_cache_file {
+    page_cache_mapping_t* mapping;
+    uint32_t flags;
+    uint64_t position;
+    uint64_t last_index;                // Page of the previous read (UINT64_MAX before the first)
+    uint64_t ra_end;                    // Page after the readahead window
+    uint32_t ra_size;                   // Pages in the readahead window
+};
+
+// Page descriptors and their hash table and LRU list
+static page_cache_page_t page_cache_pages[PAGE_CACHE_MAX_PAGES];
+static page_cache_page_t* page_cache_buckets[PAGE_CACHE_PAGE_BUCKETS];
+static page_cache_page_t* page_cache_free_pages = NULL;
+static page_cache_page_t* page_cache_lru_head = NULL;
+static page_cache_page_t* page_cache_lru_tail = NULL;
+
+// Mappings by key
+static page_cache_mapping_t* page_cache_mappings[PAGE_CACHE_MAPPING_BUCKETS];
+
+// Buffer a readahead window is read into
+static uint8_t* page_cache_bounce = NULL;
+
+// Object caches
+static memory_cache_t* page_cache_mapping_cache = NULL;
+static memory_cache_t* page_cache_file_cache = NULL;
+
+// Filesystem behind the cache
+static const page_cache_backend_t* page_cache_backend = NULL;
+
+// Statistics
+static page_cache_stats_t page_cache_stats;
+
+// Lock (held across backend calls)
+static volatile int page_cache_lock = 0;
+
+static int page_cache_writeback(page_cache_mapping_t* mapping);
+
+/**
+ * Acquire the page cache lock
+ */
+static void page_cache_acquire(void) {
+    while (__sync_lock_test_and_set(&page_cache_lock, 1)) {
+        while (page_cache_lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release the page cache lock
+ */
+static void page_cache_release(void) {
+    __sync_lock_release(&page_cache_lock);
+}
+
+/**
+ * Initialize the page cache
+ *
+ * @return: 0 on success, -1 on failure
+ */
+int page_cache_init(void) {
+    memset(page_cache_buckets, 0, sizeof(page_cache_buckets));
+    memset(page_cache_mappings, 0, sizeof(page_cache_mappings));
+    memset(&page_cache_stats, 0, sizeof(page_cache_stats));
+
+    page_cache_mapping_cache = memory_cache_create("page_cache_mapping_t", sizeof(page_cache_mapping_t), 0);
+    page_cache_file_cache = memory_cache_create("page_cache_file_t", sizeof(page_cache_file_t), 0);
+    page_cache_bounce = (uint8_t*)memory_alloc(PAGE_CACHE_READAHEAD_MAX * PAGE_CACHE_PAGE_SIZE,
+                                               MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!page_cache_mapping_cache || !page_cache_file_cache || !page_cache_bounce) {
+        console_printf("Error: Failed to allocate the page cache\n");
+        return -1;
+    }
+
+    // Page data is allocated when a descriptor is first used
+    page_cache_free_pages = NULL;
+
+    for (int i = PAGE_CACHE_MAX_PAGES - 1; i >= 0; i--) {
+        memset(&page_cache_pages[i], 0, sizeof(page_cache_page_t));
+        page_cache_pages[i].hash_next = page_cache_free_pages;
+        page_cache_free_pages = &page_cache_pages[i];
+    }
+
+    console_printf("Page cache initialized (%u pages)\n", PAGE_CACHE_MAX_PAGES);
+
+    return 0;
+}
+
+/**
+ * Set the filesystem the cache reads and writes through
+ *
+ * @param backend: Filesystem backend
+ */
+void page_cache_set_backend(const page_cache_backend_t* backend) {
+    page_cache_acquire();
+    page_cache_backend = backend;
+    page_cache_release();
+}
+
+/**
+ * Hash bucket of a page
+ *
+ * @param mapping: Mapping of the page
+ * @param index: Page number in the file
+ * @return: Bucket index
+ */
+static uint32_t page_cache_bucket(const page_cache_mapping_t* mapping, uint64_t index) {
+    uint32_t hash = (uint32_t)((uintptr_t)mapping >> 4) ^ (uint32_t)(index * 0x9E3779B1u) ^ (uint32_t)(index >> 32);
+
+    return hash & (PAGE_CACHE_PAGE_BUCKETS - 1);
+}
+
+/**
+ * Find a cached page
+ *
+ * @param mapping: Mapping of the page
+ * @param index: Page number in the file
+ * @return: Page, NULL if it is not cached
+ */
+static page_cache_page_t* page_cache_lookup(page_cache_mapping_t* mapping, uint64_t index) {
+    page_cache_page_t* page = page_cache_buckets[page_cache_bucket(mapping, index)];
+
+    while (page && (page->mapping != mapping || page->index != index)) {
+        page = page->hash_next;
+    }
+
+    return page;
+}
+
+/**
+ * Unlink a page from the LRU list
+ *
+ * @param page: Page
+ */
+static void page_cache_lru_remove(page_cache_page_t* page) {
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        page_cache_lru_head = page->lru_next;
+    }
+
+    if (page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        page_cache_lru_tail = page->lru_prev;
+    }
+
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+}
+
+/**
+ * Make a page the most recently used one
+ *
+ * @param page: Page
+ * @param linked: Whether the page is on the LRU list already
+ */
+static void page_cache_lru_touch(page_cache_page_t* page, int linked) {
+    if (linked) {
+        if (page == page_cache_lru_head) {
+            return;
+        }
+
+        page_cache_lru_remove(page);
+    }
+
+    page->lru_next = page_cache_lru_head;
+
+    if (page_cache_lru_head) {
+        page_cache_lru_head->lru_prev = page;
+    } else {
+        page_cache_lru_tail = page;
+    }
+
+    page_cache_lru_head = page;
+}
+
+/**
+ * Find the mapping of a file
+ *
+ * @param key: Backend key of the file
+ * @return: Mapping, NULL if the file has none
+ */
+static page_cache_mapping_t* page_cache_find_mapping(uint64_t key) {
+    page_cache_mapping_t* mapping = page_cache_mappings[key % PAGE_CACHE_MAPPING_BUCKETS];
+
+    while (mapping && mapping->key != key) {
+        mapping = mapping->next;
+    }
+
+    return mapping;
+}
+
+/**
+ * Free a mapping that has no opens and no pages left
+ *
+ * @param mapping: Mapping
+ */
+static void page_cache_put_mapping(page_cache_mapping_t* mapping) {
+    if (mapping->opens || mapping->pages) {
+        return;
+    }
+
+    page_cache_mapping_t** link = &page_cache_mappings[mapping->key % PAGE_CACHE_MAPPING_BUCKETS];
+
+    while (*link != mapping) {
+        link = &(*link)->next;
+    }
+
+    *link = mapping->next;
+    memory_cache_free(page_cache_mapping_cache, mapping);
+}
+
+/**
+ * Write a dirty page back to its file
+ *
+ * @param page: Page
+ * @return: 0 on success, -1 on failure
+ */
+static int page_cache_write_page(page_cache_page_t* page) {
+    if (!(page->flags & PAGE_CACHE_PAGE_DIRTY)) {
+        return 0;
+    }
+
+    page_cache_mapping_t* mapping = page->mapping;
+    uint64_t offset = page->index * PAGE_CACHE_PAGE_SIZE;
+
+    // Pages past the end of a truncated file have nothing to write
+    if (offset < mapping->size) {
+        size_t size = PAGE_CACHE_PAGE_SIZE;
+
+        if (mapping->size - offset < size) {
+            size = (size_t)(mapping->size - offset);
+        }
+
+        if (!mapping->handle || page_cache_backend->write(mapping->handle, offset, page->data, size) != (int)size) {
+            console_printf("Error: Failed to write back page %u of file %u\n",
+                          (unsigned int)page->index, (unsigned int)mapping->key);
+            return -1;
+        }
+
+        page_cache_stats.pages_written++;
+    }
+
+    page->flags &= ~PAGE_CACHE_PAGE_DIRTY;
+    page_cache_stats.dirty_pages--;
+
+    return 0;
+}
+
+/**
+ * Drop a page from the cache without writing it back
+ *
+ * @param page: Page
+ */
+static void page_cache_drop_page(page_cache_page_t* page) {
+    page_cache_mapping_t* mapping = page->mapping;
+
+    // Unhash the page
+    page_cache_page_t** link = &page_cache_buckets[page_cache_bucket(mapping, page->index)];
+
+    while (*link != page) {
+        link = &(*link)->hash_next;
+    }
+
+    *link = page->hash_next;
+
+    // Unlink the page from its mapping
+    if (page->map_prev) {
+        page->map_prev->map_next = page->map_next;
+    } else {
+        mapping->pages = page->map_next;
+    }
+
+    if (page->map_next) {
+        page->map_next->map_prev = page->map_prev;
+    }
+
+    mapping->num_pages--;
+    page_cache_lru_remove(page);
+
+    if (page->flags & PAGE_CACHE_PAGE_DIRTY) {
+        page_cache_stats.dirty_pages--;
+    }
+
+    page_cache_stats.cached_pages--;
+
+    // Keep the data for the next use of the descriptor
+    page->mapping = NULL;
+    page->flags = 0;
+    page->map_prev = NULL;
+    page->map_next = NULL;
+    page->hash_next = page_cache_free_pages;
+    page_cache_free_pages = page;
+
+    page_cache_put_mapping(mapping);
+}
+
+/**
+ * Drop all pages of a mapping without writing them back
+ *
+ * @param mapping: Mapping (must stay referenced by the caller)
+ */
+static void page_cache_invalidate(page_cache_mapping_t* mapping) {
+    while (mapping->pages) {
+        page_cache_drop_page(mapping->pages);
+    }
+}
+
+/**
+ * Get a free page, evicting the least recently used one if necessary
+ *
+ * @return: Page with data, NULL if none could be freed or allocated
+ */
+static page_cache_page_t* page_cache_alloc_page(void) {
+    if (!page_cache_free_pages) {
+        // Evict from the cold end, skipping pages that cannot be written back
+        page_cache_page_t* victim = page_cache_lru_tail;
+
+        while (victim && page_cache_write_page(victim) != 0) {
+            victim = victim->lru_prev;
+        }
+
+        if (!victim) {
+            return NULL;
+        }
+
+        page_cache_drop_page(victim);
+        page_cache_stats.evictions++;
+    }
+
+    page_cache_page_t* page = page_cache_free_pages;
+
+    if (!page->data) {
+        page->data = (uint8_t*)memory_alloc(PAGE_CACHE_PAGE_SIZE, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+        if (!page->data) {
+            console_printf("Error: Failed to allocate a page cache page\n");
+            return NULL;
+        }
+    }
+
+    page_cache_free_pages = page->hash_next;
+    page->hash_next = NULL;
+
+    return page;
+}
+
+/**
+ * Add a page to a mapping
+ *
+ * @param page: Page from page_cache_alloc_page
+ * @param mapping: Mapping
+ * @param index: Page number in the file
+ */
+static void page_cache_insert(page_cache_page_t* page, page_cache_mapping_t* mapping, uint64_t index) {
+    uint32_t bucket = page_cache_bucket(mapping, index);
+
+    page->mapping = mapping;
+    page->index = index;
+    page->flags = 0;
+
+    page->hash_next = page_cache_buckets[bucket];
+    page_cache_buckets[bucket] = page;
+
+    page->map_prev = NULL;
+    page->map_next = mapping->pages;
+
+    if (mapping->pages) {
+        mapping->pages->map_prev = page;
+    }
+
+    mapping->pages = page;
+    mapping->num_pages++;
+
+    page_cache_lru_touch(page, 0);
+    page_cache_stats.cached_pages++;
+}
+
+/**
+ * Read the missing pages of a range into the cache
+ *
+ * Each run of missing pages is read with one backend call.
+ *
+ * @param mapping: Mapping
+ * @param start: First page
+ * @param count: Number of pages
+ * @return: Number of pages read, -1 on failure
+ */
+static int page_cache_fill(page_cache_mapping_t* mapping, uint64_t start, uint32_t count) {
+    uint64_t num_pages = (mapping->size + PAGE_CACHE_PAGE_SIZE - 1) / PAGE_CACHE_PAGE_SIZE;
+    uint64_t end = start + count < num_pages ? start + count : num_pages;
+    uint64_t index = start;
+    int filled = 0;
+
+    while (index < end) {
+        // Skip the cached pages
+        if (page_cache_lookup(mapping, index)) {
+            index++;
+            continue;
+        }
+
+        uint64_t run_start = index;
+
+        while (index < end && index - run_start < PAGE_CACHE_READAHEAD_MAX && !page_cache_lookup(mapping, index)) {
+            index++;
+        }
+
+        uint64_t offset = run_start * PAGE_CACHE_PAGE_SIZE;
+        size_t size = (size_t)(index - run_start) * PAGE_CACHE_PAGE_SIZE;
+
+        if (mapping->size - offset < size) {
+            size = (size_t)(mapping->size - offset);
+        }
+
+        int bytes_read = page_cache_backend->read(mapping->handle, offset, page_cache_bounce, size);
+
+        if (bytes_read < 0) {
+            console_printf("Error: Failed to read file %u at offset %u\n",
+                          (unsigned int)mapping->key, (unsigned int)offset);
+            return -1;
+        }
+
+        // Store the run; a short read leaves zeros
+        for (uint64_t i = run_start; i < index; i++) {
+            page_cache_page_t* page = page_cache_alloc_page();
+
+            if (!page) {
+                return -1;
+            }
+
+            size_t page_offset = (size_t)(i - run_start) * PAGE_CACHE_PAGE_SIZE;
+            size_t valid = (size_t)bytes_read > page_offset ? (size_t)bytes_read - page_offset : 0;
+
+            if (valid > PAGE_CACHE_PAGE_SIZE) {
+                valid = PAGE_CACHE_PAGE_SIZE;
+            }
+
+            memcpy(page->data, page_cache_bounce + page_offset, valid);
+            memset(page->data + valid, 0, PAGE_CACHE_PAGE_SIZE - valid);
+
+            page_cache_insert(page, mapping, i);
+            page_cache_stats.pages_read++;
+            filled++;
+        }
+    }
+
+    return filled;
+}
+
+/**
+ * Write back the dirty pages of a mapping
+ *
+ * @param mapping: Mapping
+ * @return: 0 on success, -1 if a page could not be written
+ */
+static int page_cache_writeback(page_cache_mapping_t* mapping) {
+    int result = 0;
+
+    for (page_cache_page_t* page = mapping->pages; page; page = page->map_next) {
+        if (page_cache_write_page(page) != 0) {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Open a file through the cache
+ *
+ * @param path: Path of the file
+ * @param flags: Open flags (PAGE_CACHE_*)
+ * @return: Open file, NULL on failure
+ */
+page_cache_file_t* page_cache_open(const char* path, uint32_t flags) {
+    page_cache_acquire();
+
+    const page_cache_backend_t* backend = page_cache_backend;
+    void* handle = NULL;
+    uint64_t size = 0;
+    uint64_t key = 0;
+
+    if (!backend || !path || backend->open(path, flags, &handle, &size, &key) != 0) {
+        page_cache_release();
+        return NULL;
+    }
+
+    page_cache_file_t* file = (page_cache_file_t*)memory_cache_alloc(page_cache_file_cache, 0);
+    page_cache_mapping_t* mapping = page_cache_find_mapping(key);
+    int created = 0;
+
+    if (file && !mapping) {
+        mapping = (page_cache_mapping_t*)memory_cache_alloc(page_cache_mapping_cache, 0);
+        created = 1;
+    }
+
+    if (!file || !mapping) {
+        console_printf("Error: Failed to allocate page cache file for %s\n", path);
+
+        if (file) {
+            memory_cache_free(page_cache_file_cache, file);
+        }
+
+        backend->close(handle);
+        page_cache_release();
+        return NULL;
+    }
+
+    if (created) {
+        memset(mapping, 0, sizeof(page_cache_mapping_t));
+        mapping->key = key;
+        mapping->size = size;
+        mapping->next = page_cache_mappings[key % PAGE_CACHE_MAPPING_BUCKETS];
+        page_cache_mappings[key % PAGE_CACHE_MAPPING_BUCKETS] = mapping;
+    }
+
+    // Referenced from here on, so dropping its pages cannot free it
+    mapping->opens++;
+
+    if (mapping->opens == 1 && mapping->size != size) {
+        // The file changed while it was closed
+        page_cache_invalidate(mapping);
+        mapping->size = size;
+    }
+
+    // All opens share the first handle, which is the one dirty pages are written through
+    if (mapping->handle) {
+        backend->close(handle);
+    } else {
+        mapping->handle = handle;
+    }
+
+    if (flags & PAGE_CACHE_TRUNCATE) {
+        page_cache_invalidate(mapping);
+        mapping->size = 0;
+    }
+
+    file->mapping = mapping;
+    file->flags = flags;
+    file->position = (flags & PAGE_CACHE_APPEND) ? mapping->size : 0;
+    file->last_index = UINT64_MAX;
+    file->ra_end = 0;
+    file->ra_size = 0;
+
+    page_cache_release();
+
+    return file;
+}
+
+/**
+ * Close a file, writing back its dirty pages
+ *
+ * The clean pages stay cached for the next open of the file.
+ *
+ * @param file: Open file
+ * @return: 0 on success, -1 if the file could not be written back
+ */
+int page_cache_close(page_cache_file_t* file) {
+    if (!file) {
+        return -1;
+    }
+
+    page_cache_acquire();
+
+    page_cache_mapping_t* mapping = file->mapping;
+    int result = page_cache_writeback(mapping);
+
+    if (--mapping->opens == 0) {
+        // Keep the handle if pages could not be written back, so they can be later
+        if (result == 0) {
+            page_cache_backend->close(mapping->handle);
+            mapping->handle = NULL;
+        }
+
+        page_cache_put_mapping(mapping);
+    }
+
+    memory_cache_free(page_cache_file_cache, file);
+
+    page_cache_release();
+
+    return result;
+}
+
+/**
+ * Write back and drop the cached pages of a byte range (for direct I/O)
+ *
+ * @param mapping: Mapping
+ * @param offset: Start of the range
+ * @param size: Size of the range
+ * @return: 0 on success, -1 on failure
+ */
+static int page_cache_evict_range(page_cache_mapping_t* mapping, uint64_t offset, size_t size) {
+    uint64_t first = offset / PAGE_CACHE_PAGE_SIZE;
+    uint64_t last = (offset + size + PAGE_CACHE_PAGE_SIZE - 1) / PAGE_CACHE_PAGE_SIZE;
+    page_cache_page_t* page = mapping->pages;
+
+    while (page) {
+        page_cache_page_t* next = page->map_next;
+
+        if (page->index >= first && page->index < last) {
+            if (page_cache_write_page(page) != 0) {
+                return -1;
+            }
+
+            page_cache_drop_page(page);
+        }
+
+        page = next;
+    }
+
+    return 0;
+}
+
+/**
+ * Read from a file
+ *
+ * @param file: Open file
+ * @param buffer: Buffer to read into
+ * @param size: Number of bytes to read
+ * @return: Number of bytes read
+ */
+size_t page_cache_read(page_cache_file_t* file, void* buffer, size_t size) {
+    if (!file || !buffer) {
+        return 0;
+    }
+
+    page_cache_acquire();
+
+    page_cache_mapping_t* mapping = file->mapping;
+
+    if (file->position >= mapping->size) {
+        page_cache_release();
+        return 0;
+    }
+
+    if (mapping->size - file->position < size) {
+        size = (size_t)(mapping->size - file->position);
+    }
+
+    // Direct reads go to the backend, after any cached copy of the range is written back
+    if (file->flags & PAGE_CACHE_DIRECT) {
+        int bytes_read = -1;
+
+        if (page_cache_evict_range(mapping, file->position, size) == 0) {
+            bytes_read = page_cache_backend->read(mapping->handle, file->position, buffer, size);
+        }
+
+        if (bytes_read > 0) {
+            file->position += bytes_read;
+        }
+
+        page_cache_release();
+        return bytes_read > 0 ? (size_t)bytes_read : 0;
+    }
+
+    uint64_t num_pages = (mapping->size + PAGE_CACHE_PAGE_SIZE - 1) / PAGE_CACHE_PAGE_SIZE;
+    size_t done = 0;
+
+    while (done < size) {
+        uint64_t index = file->position / PAGE_CACHE_PAGE_SIZE;
+        size_t offset = (size_t)(file->position % PAGE_CACHE_PAGE_SIZE);
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - offset;
+
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        // The same page again or the next one (the first read counts too)
+        int sequential = index == file->last_index || index == file->last_index + 1;
+        page_cache_page_t* page = page_cache_lookup(mapping, index);
+
+        if (!page) {
+            page_cache_stats.misses++;
+
+            // Start or grow the readahead window, or read just this page
+            uint32_t window = 1;
+
+            if (sequential) {
+                window = file->ra_size ? file->ra_size * 2 : PAGE_CACHE_READAHEAD_MIN;
+
+                if (window > PAGE_CACHE_READAHEAD_MAX) {
+                    window = PAGE_CACHE_READAHEAD_MAX;
+                }
+
+                file->ra_size = window;
+                file->ra_end = index + window;
+            }
+
+            int filled = page_cache_fill(mapping, index, window);
+
+            if (filled <= 0 || !(page = page_cache_lookup(mapping, index))) {
+                break;
+            }
+
+            page_cache_stats.readahead_pages += filled - 1;
+        } else {
+            page_cache_stats.hits++;
+
+            // Half way through the window: read the next one
+            if (sequential && file->ra_size && file->ra_end < num_pages &&
+                file->ra_end - index <= file->ra_size / 2) {
+                uint32_t window = file->ra_size * 2;
+
+                if (window > PAGE_CACHE_READAHEAD_MAX) {
+                    window = PAGE_CACHE_READAHEAD_MAX;
+                }
+
+                int filled = page_cache_fill(mapping, file->ra_end, window);
+
+                if (filled > 0) {
+                    page_cache_stats.readahead_pages += filled;
+                }
+
+                file->ra_size = window;
+                file->ra_end += window;
+            }
+
+            page_cache_lru_touch(page, 1);
+        }
+
+        memcpy((uint8_t*)buffer + done, page->data + offset, chunk);
+
+        file->last_index = index;
+        file->position += chunk;
+        done += chunk;
+    }
+
+    page_cache_release();
+
+    return done;
+}
+
+/**
+ * Write to a file
+ *
+ * The data lands in dirty pages; it reaches the backend on flush or close,
+ * when its page is evicted, or when too many pages are dirty.
+ *
+ * @param file: Open file
+ * @param buffer: Data to write
+ * @param size: Number of bytes to write
+ * @return: Number of bytes written
+ */
+size_t page_cache_write(page_cache_file_t* file, const void* buffer, size_t size) {
+    if (!file || !buffer || !(file->flags & PAGE_CACHE_WRITE)) {
+        return 0;
+    }
+
+    page_cache_acquire();
+
+    page_cache_mapping_t* mapping = file->mapping;
+
+    if (file->flags & PAGE_CACHE_APPEND) {
+        file->position = mapping->size;
+    }
+
+    // Direct writes go to the backend, after any cached copy of the range is written back
+    if (file->flags & PAGE_CACHE_DIRECT) {
+        int bytes_written = -1;
+
+        if (page_cache_evict_range(mapping, file->position, size) == 0) {
+            bytes_written = page_cache_backend->write(mapping->handle, file->position, buffer, size);
+        }
+
+        if (bytes_written > 0) {
+            file->position += bytes_written;
+
+            if (file->position > mapping->size) {
+                mapping->size = file->position;
+            }
+        }
+
+        page_cache_release();
+        return bytes_written > 0 ? (size_t)bytes_written : 0;
+    }
+
+    size_t done = 0;
+
+    while (done < size) {
+        uint64_t index = file->position / PAGE_CACHE_PAGE_SIZE;
+        size_t offset = (size_t)(file->position % PAGE_CACHE_PAGE_SIZE);
+        size_t chunk = PAGE_CACHE_PAGE_SIZE - offset;
+
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        page_cache_page_t* page = page_cache_lookup(mapping, index);
+
+        if (!page) {
+            if (chunk == PAGE_CACHE_PAGE_SIZE || index * PAGE_CACHE_PAGE_SIZE >= mapping->size) {
+                // Nothing of the old page survives the write
+                page = page_cache_alloc_page();
+
+                if (!page) {
+                    break;
+                }
+
+                memset(page->data, 0, PAGE_CACHE_PAGE_SIZE);
+                page_cache_insert(page, mapping, index);
+            } else if (page_cache_fill(mapping, index, 1) < 0 || !(page = page_cache_lookup(mapping, index))) {
+                break;
+            }
+        } else {
+            page_cache_lru_touch(page, 1);
+        }
+
+        memcpy(page->data + offset, (const uint8_t*)buffer + done, chunk);
+
+        if (!(page->flags & PAGE_CACHE_PAGE_DIRTY)) {
+            page->flags |= PAGE_CACHE_PAGE_DIRTY;
+            page_cache_stats.dirty_pages++;
+        }
+
+        file->position += chunk;
+        done += chunk;
+
+        if (file->position > mapping->size) {
+            mapping->size = file->position;
+        }
+    }
+
+    // Too much dirty data: the writer pays for writing its own file back
+    if (page_cache_stats.dirty_pages > PAGE_CACHE_DIRTY_LIMIT) {
+        page_cache_writeback(mapping);
+    }
+
+    page_cache_release();
+
+    return done;
+}
+
+/**
+ * Set the position of a file
+ *
+ * @param file: Open file
+ * @param offset: Offset
+ * @param whence: PAGE_CACHE_SEEK_SET, _CUR or _END
+ * @return: 0 on success, -1 on failure
+ */
+int page_cache_seek(page_cache_file_t* file, int64_t offset, int whence) {
+    if (!file) {
+        return -1;
+    }
+
+    page_cache_acquire();
+
+    int64_t base = 0;
+
+    if (whence == PAGE_CACHE_SEEK_CUR) {
+        base = (int64_t)file->position;
+    } else if (whence == PAGE_CACHE_SEEK_END) {
+        base = (int64_t)file->mapping->size;
+    } else if (whence != PAGE_CACHE_SEEK_SET) {
+        page_cache_release();
+        return -1;
+    }
+
+    if (base + offset < 0) {
+        page_cache_release();
+        return -1;
+    }
+
+    file->position = (uint64_t)(base + offset);
+
+    page_cache_release();
+
+    return 0;
+}
+
+/**
+ * Get the position of a file
+ *
+ * @param file: Open file
+ * @return: Position
+ */
+uint64_t page_cache_tell(page_cache_file_t* file) {
+    return file ? file->position : 0;
+}
+
+/**
+ * Write back the dirty pages of a file
+ *
+ * @param file: Open file
+ * @return: 0 on success, -1 on failure
+ */
+int page_cache_flush(page_cache_file_t* file) {
+    if (!file) {
+        return -1;
+    }
+
+    page_cache_acquire();
+    int result = page_cache_writeback(file->mapping);
+    page_cache_release();
+
+    return result;
+}
+
+/**
+ * Write back all dirty pages
+ *
+ * @return: 0 on success, -1 if a page could not be written
+ */
+int page_cache_sync(void) {
+    int result = 0;
+
+    page_cache_acquire();
+
+    for (int i = 0; i < PAGE_CACHE_MAPPING_BUCKETS; i++) {
+        for (page_cache_mapping_t* mapping = page_cache_mappings[i]; mapping; mapping = mapping->next) {
+            if (page_cache_writeback(mapping) != 0) {
+                result = -1;
+            }
+        }
+    }
+
+    page_cache_release();
+
+    return result;
+}
+
+/**
+ * Get page cache statistics
+ *
+ * @param stats: Buffer to store the statistics
+ */
+void page_cache_get_stats(page_cache_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    page_cache_acquire();
+    memcpy(stats, &page_cache_stats, sizeof(page_cache_stats_t));
+    page_cache_release();
+}
@@ -0,0 +1,474 @@
+/**
+ * prefix_cache.c - Prompt prefix KV cache for NeuroOS
+ *
+ * This file implements the prefix cache shared by the text generators.
+ * Each entry holds the key/value rows of a token prefix and is indexed once
+ * per block boundary, so a prompt that shares only a leading part (typically
+ * the system prompt) with a cached one still reuses that part. Entries are
+ * evicted least recently used first to stay under the memory budget.
+ */
+
+#include "include/prefix_cache.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+
+typedef struct prefix_cache_entry prefix_cache_entry_t;
+
+// Index node: one per block boundary of an entry
+typedef struct prefix_cache_node {
+    uint64_t hash;
+    size_t length;
+    prefix_cache_entry_t* entry;
+    struct prefix_cache_node* next;
+} prefix_cache_node_t;
+
+// Cached prefix
+struct prefix_cache_entry {
+    const void* owner;
+    size_t num_layers;
+    size_t row_size;
+    size_t length;
+    uint32_t refs;                  // Lookups copying out of the entry
+    uint32_t* tokens;               // [length]
+    float* keys;                    // [num_layers][length][row_size]
+    float* values;                  // [num_layers][length][row_size]
+    prefix_cache_node_t* nodes;     // [length / PREFIX_CACHE_BLOCK]
+    prefix_cache_entry_t* lru_prev;
+    prefix_cache_entry_t* lru_next;
+    size_t alloc_size;
+};
+
+// Cache state
+static prefix_cache_node_t* prefix_cache_buckets[PREFIX_CACHE_BUCKETS];
+static prefix_cache_entry_t* prefix_cache_lru_head = NULL;
+static prefix_cache_entry_t* prefix_cache_lru_tail = NULL;
+static size_t prefix_cache_budget = PREFIX_CACHE_DEFAULT_BUDGET;
+static size_t prefix_cache_used = 0;
+static prefix_cache_stats_t prefix_cache_stats;
+static volatile int prefix_cache_lock_flag = 0;
+
+/**
+ * Lock the cache
+ */
+static void prefix_cache_lock(void) {
+    while (__sync_lock_test_and_set(&prefix_cache_lock_flag, 1)) {
+        while (prefix_cache_lock_flag) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Unlock the cache
+ */
+static void prefix_cache_unlock(void) {
+    __sync_lock_release(&prefix_cache_lock_flag);
+}
+
+/**
+ * Hash every block boundary of a token sequence (FNV-1a)
+ *
+ * @param tokens: Token sequence
+ * @param num_blocks: Number of blocks to hash
+ * @param hashes: Output hash of the first (k + 1) blocks at index k
+ */
+static void prefix_cache_hash_blocks(const uint32_t* tokens, size_t num_blocks, uint64_t* hashes) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t k = 0; k < num_blocks; k++) {
+        for (size_t i = k * PREFIX_CACHE_BLOCK; i < (k + 1) * PREFIX_CACHE_BLOCK; i++) {
+            hash ^= tokens[i];
+            hash *= 1099511628211ull;
+        }
+        hashes[k] = hash;
+    }
+}
+
+/**
+ * Find the entry caching a prefix (cache lock held)
+ *
+ * @param owner: Model owning the rows
+ * @param tokens: Token sequence
+ * @param length: Prefix length (a multiple of PREFIX_CACHE_BLOCK)
+ * @param hash: Hash of the prefix
+ * @param kv: Row geometry of the caller
+ * @return: Entry, NULL if the prefix is not cached
+ */
+static prefix_cache_entry_t* prefix_cache_find(const void* owner, const uint32_t* tokens, size_t length, uint64_t hash, const prefix_cache_kv_t* kv) {
+    for (prefix_cache_node_t* node = prefix_cache_buckets[hash & (PREFIX_CACHE_BUCKETS - 1)]; node; node = node->next) {
+        prefix_cache_entry_t* e = node->entry;
+
+        if (node->hash == hash && node->length == length && e->owner == owner &&
+            e->num_layers == kv->num_layers && e->row_size == kv->row_size &&
+            memcmp(e->tokens, tokens, length * sizeof(uint32_t)) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Make an entry the most recently used (cache lock held)
+ *
+ * @param e: Entry, linked or not
+ * @param linked: Nonzero if the entry is on the LRU list
+ */
+static void prefix_cache_touch(prefix_cache_entry_t* e, int linked) {
+    if (linked) {
+        if (prefix_cache_lru_head == e) {
+            return;
+        }
+
+        if (e->lru_prev) {
+            e->lru_prev->lru_next = e->lru_next;
+        }
+        if (e->lru_next) {
+            e->lru_next->lru_prev = e->lru_prev;
+        } else {
+            prefix_cache_lru_tail = e->lru_prev;
+        }
+    }
+
+    e->lru_prev = NULL;
+    e->lru_next = prefix_cache_lru_head;
+
+    if (prefix_cache_lru_head) {
+        prefix_cache_lru_head->lru_prev = e;
+    }
+    prefix_cache_lru_head = e;
+
+    if (!prefix_cache_lru_tail) {
+        prefix_cache_lru_tail = e;
+    }
+}
+
+/**
+ * Unlink an entry from the index and the LRU list (cache lock held)
+ *
+ * The entry is pushed onto a list of entries to free once the lock is
+ * dropped.
+ *
+ * @param e: Entry
+ * @param victims: List of unlinked entries (linked through lru_next)
+ */
+static void prefix_cache_remove(prefix_cache_entry_t* e, prefix_cache_entry_t** victims) {
+    size_t num_blocks = e->length / PREFIX_CACHE_BLOCK;
+
+    for (size_t k = 0; k < num_blocks; k++) {
+        prefix_cache_node_t** link = &prefix_cache_buckets[e->nodes[k].hash & (PREFIX_CACHE_BUCKETS - 1)];
+
+        while (*link && *link != &e->nodes[k]) {
+            link = &(*link)->next;
+        }
+
+        if (*link) {
+            *link = e->nodes[k].next;
+        }
+    }
+
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        prefix_cache_lru_head = e->lru_next;
+    }
+
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        prefix_cache_lru_tail = e->lru_prev;
+    }
+
+    prefix_cache_used -= e->alloc_size;
+    prefix_cache_stats.num_entries--;
+
+    e->lru_next = *victims;
+    *victims = e;
+}
+
+/**
+ * Evict least recently used entries until an allocation fits (cache lock held)
+ *
+ * @param size: Size that must fit in the budget
+ * @param victims: List of evicted entries
+ * @return: 0 if the size fits, -1 otherwise
+ */
+static int prefix_cache_make_room(size_t size, prefix_cache_entry_t** victims) {
+    prefix_cache_entry_t* e = prefix_cache_lru_tail;
+
+    while (prefix_cache_used + size > prefix_cache_budget && e) {
+        prefix_cache_entry_t* prev = e->lru_prev;
+
+        // Entries being copied out stay until their lookups finish
+        if (e->refs == 0) {
+            prefix_cache_remove(e, victims);
+            prefix_cache_stats.evictions++;
+        }
+
+        e = prev;
+    }
+
+    return prefix_cache_used + size <= prefix_cache_budget ? 0 : -1;
+}
+
+/**
+ * Free a list of unlinked entries
+ *
+ * @param victims: List of entries (linked through lru_next)
+ */
+static void prefix_cache_free_list(prefix_cache_entry_t* victims) {
+    while (victims) {
+        prefix_cache_entry_t* next = victims->lru_next;
+
+        memory_free(victims, victims->alloc_size);
+        victims = next;
+    }
+}
+
+/**
+ * Set the memory budget of the cache
+ *
+ * Entries beyond the new budget are evicted; a budget of 0 disables the
+ * cache.
+ *
+ * @param budget: Memory budget in bytes
+ * @return: 0 on success, -1 on failure
+ */
+int prefix_cache_set_budget(size_t budget) {
+    prefix_cache_entry_t* victims = NULL;
+
+    prefix_cache_lock();
+    prefix_cache_budget = budget;
+    prefix_cache_make_room(0, &victims);
+    prefix_cache_unlock();
+
+    prefix_cache_free_list(victims);
+
+    return 0;
+}
+
+/**
+ * Copy the rows of the longest cached prefix of a prompt
+ *
+ * The last prompt token is never covered, because the caller still has to
+ * run it to get the logits of the next token.
+ *
+ * @param owner: Model owning the rows
+ * @param tokens: Prompt tokens
+ * @param num_tokens: Number of prompt tokens
+ * @param kv: Destination rows (positions from 0)
+ * @return: Number of positions copied, 0 on a miss
+ */
+size_t prefix_cache_lookup(const void* owner, const uint32_t* tokens, size_t num_tokens, const prefix_cache_kv_t* kv) {
+    if (!owner || !tokens || !kv || num_tokens == 0) {
+        return 0;
+    }
+
+    size_t num_blocks = (num_tokens - 1) / PREFIX_CACHE_BLOCK;
+    if (num_blocks > PREFIX_CACHE_MAX_BLOCKS) {
+        num_blocks = PREFIX_CACHE_MAX_BLOCKS;
+    }
+
+    uint64_t hashes[PREFIX_CACHE_MAX_BLOCKS];
+    prefix_cache_hash_blocks(tokens, num_blocks, hashes);
+
+    // Find the longest cached prefix and pin its entry
+    prefix_cache_entry_t* e = NULL;
+    size_t length = 0;
+
+    prefix_cache_lock();
+    prefix_cache_stats.lookups++;
+
+    for (size_t k = num_blocks; k > 0 && !e; k--) {
+        length = k * PREFIX_CACHE_BLOCK;
+        e = prefix_cache_find(owner, tokens, length, hashes[k - 1], kv);
+    }
+
+    if (!e) {
+        prefix_cache_stats.misses++;
+        prefix_cache_unlock();
+        return 0;
+    }
+
+    e->refs++;
+    prefix_cache_touch(e, 1);
+    prefix_cache_stats.hits++;
+    prefix_cache_stats.tokens_saved += length;
+    prefix_cache_unlock();
+
+    // Copy the rows outside the lock
+    size_t row_bytes = kv->row_size * sizeof(float);
+
+    for (size_t l = 0; l < kv->num_layers; l++) {
+        memcpy(kv->keys + l * kv->layer_stride, e->keys + l * e->length * e->row_size, length * row_bytes);
+        memcpy(kv->values + l * kv->layer_stride, e->values + l * e->length * e->row_size, length * row_bytes);
+    }
+
+    prefix_cache_lock();
+    e->refs--;
+    prefix_cache_unlock();
+
+    return length;
+}
+
+/**
+ * Cache the rows of a prompt prefix
+ *
+ * The prefix is the prompt rounded down to whole blocks. Nothing is stored
+ * if that prefix is already cached.
+ *
+ * @param owner: Model owning the rows
+ * @param tokens: Prompt tokens
+ * @param num_tokens: Number of prompt tokens with computed rows
+ * @param kv: Source rows (positions from 0)
+ * @return: 0 on success, -1 on failure
+ */
+int prefix_cache_insert(const void* owner, const uint32_t* tokens, size_t num_tokens, const prefix_cache_kv_t* kv) {
+    if (!owner || !tokens || !kv) {
+        return -1;
+    }
+
+    size_t num_blocks = num_tokens / PREFIX_CACHE_BLOCK;
+    if (num_blocks > PREFIX_CACHE_MAX_BLOCKS) {
+        num_blocks = PREFIX_CACHE_MAX_BLOCKS;
+    }
+
+    if (num_blocks == 0) {
+        return -1;
+    }
+
+    size_t length = num_blocks * PREFIX_CACHE_BLOCK;
+    size_t rows_size = kv->num_layers * length * kv->row_size * sizeof(float);
+    size_t alloc_size = sizeof(prefix_cache_entry_t) + num_blocks * sizeof(prefix_cache_node_t) +
+                        length * sizeof(uint32_t) + 2 * rows_size;
+
+    uint64_t hashes[PREFIX_CACHE_MAX_BLOCKS];
+    prefix_cache_hash_blocks(tokens, num_blocks, hashes);
+
+    // Reserve the memory unless the prefix is already cached
+    prefix_cache_entry_t* victims = NULL;
+
+    prefix_cache_lock();
+
+    prefix_cache_entry_t* existing = prefix_cache_find(owner, tokens, length, hashes[num_blocks - 1], kv);
+    if (existing) {
+        prefix_cache_touch(existing, 1);
+        prefix_cache_unlock();
+        return 0;
+    }
+
+    if (prefix_cache_make_room(alloc_size, &victims) != 0) {
+        prefix_cache_unlock();
+        prefix_cache_free_list(victims);
+        return -1;
+    }
+
+    prefix_cache_used += alloc_size;
+    prefix_cache_unlock();
+
+    prefix_cache_free_list(victims);
+
+    // Build the entry outside the lock
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for prefix cache entry (%u tokens)\n", (unsigned int)length);
+        prefix_cache_lock();
+        prefix_cache_used -= alloc_size;
+        prefix_cache_unlock();
+        return -1;
+    }
+
+    prefix_cache_entry_t* e = (prefix_cache_entry_t*)block;
+    e->owner = owner;
+    e->num_layers = kv->num_layers;
+    e->row_size = kv->row_size;
+    e->length = length;
+    e->refs = 0;
+    e->nodes = (prefix_cache_node_t*)(block + sizeof(prefix_cache_entry_t));
+    e->keys = (float*)(e->nodes + num_blocks);
+    e->values = e->keys + rows_size / sizeof(float);
+    e->tokens = (uint32_t*)(e->values + rows_size / sizeof(float));
+    e->alloc_size = alloc_size;
+
+    memcpy(e->tokens, tokens, length * sizeof(uint32_t));
+
+    size_t row_bytes = kv->row_size * sizeof(float);
+
+    for (size_t l = 0; l < kv->num_layers; l++) {
+        memcpy(e->keys + l * length * kv->row_size, kv->keys + l * kv->layer_stride, length * row_bytes);
+        memcpy(e->values + l * length * kv->row_size, kv->values + l * kv->layer_stride, length * row_bytes);
+    }
+
+    prefix_cache_lock();
+
+    // Another generation may have cached the same prefix meanwhile
+    if (prefix_cache_find(owner, tokens, length, hashes[num_blocks - 1], kv)) {
+        prefix_cache_used -= alloc_size;
+        prefix_cache_unlock();
+        memory_free(block, alloc_size);
+        return 0;
+    }
+
+    for (size_t k = 0; k < num_blocks; k++) {
+        prefix_cache_node_t** bucket = &prefix_cache_buckets[hashes[k] & (PREFIX_CACHE_BUCKETS - 1)];
+
+        e->nodes[k].hash = hashes[k];
+        e->nodes[k].length = (k + 1) * PREFIX_CACHE_BLOCK;
+        e->nodes[k].entry = e;
+        e->nodes[k].next = *bucket;
+        *bucket = &e->nodes[k];
+    }
+
+    prefix_cache_touch(e, 0);
+    prefix_cache_stats.num_entries++;
+    prefix_cache_stats.insertions++;
+
+    prefix_cache_unlock();
+
+    return 0;
+}
+
+/**
+ * Drop every entry of a model
+ *
+ * @param owner: Model owning the rows
+ */
+void prefix_cache_invalidate(const void* owner) {
+    prefix_cache_entry_t* victims = NULL;
+
+    prefix_cache_lock();
+
+    prefix_cache_entry_t* e = prefix_cache_lru_head;
+    while (e) {
+        prefix_cache_entry_t* next = e->lru_next;
+
+        if (e->owner == owner) {
+            prefix_cache_remove(e, &victims);
+        }
+
+        e = next;
+    }
+
+    prefix_cache_unlock();
+
+    prefix_cache_free_list(victims);
+}
+
+/**
+ * Get the cache statistics
+ *
+ * @param stats: Pointer to store the statistics
+ */
+void prefix_cache_get_stats(prefix_cache_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    prefix_cache_lock();
+    *stats = prefix_cache_stats;
+    stats->memory_used = prefix_cache_used;
+    stats->memory_budget = prefix_cache_budget;
+    prefix_cache_unlock();
+}
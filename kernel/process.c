@@ -9,31 +9,107 @@
 #include "include/memory.h"
 #include "include/console.h"
 #include "include/interrupts.h"
+#include "include/cpu.h"
+#include "include/smp.h"
+#include "include/timer.h"
+#include "include/trace.h"
+#include <string.h>
 
 // Maximum number of processes
 #define MAX_PROCESSES 1024
 
-// Process table
+// Levels a CPU-bound process can sink below its priority
+#define PROCESS_MLFQ_DEMOTIONS 3
+
+// Scheduler tick period
+#define PROCESS_TICK_NS (10 * TIMER_NS_PER_MS)
+
+// Ticks between boosts of every process back to its priority level
+#define PROCESS_MLFQ_BOOST_TICKS 1000
+
+// Ticks between run queue balancing passes of a CPU
+#define PROCESS_BALANCE_TICKS 10
+
+// Process table (process_table_lock also covers next_pid)
 static process_t* process_table[MAX_PROCESSES];
+static volatile int process_table_lock = 0;
 
-// Current process
-static process_t* current_process = NULL;
+// Slab cache for process structures
+static memory_cache_t* process_cache = NULL;
 
 // Next available process ID
 static pid_t next_pid = 1;
 
+// Per-CPU scheduler state
+//
+// Ready processes wait in one FIFO run queue per level; bit L of
+// ready_bitmap is set while level L has queued processes, so the next
+// process is found in O(1). A process that uses up its slice drops a level,
+// where slices are twice as long, and every level is boosted back to its
+// priority periodically so demoted processes cannot starve.
+//
+// Every CPU has its own run queues under its own lock. A queued process
+// sits on the queues of process->cpu; the tick of each CPU periodically
+// pulls work from the busiest CPU, and a CPU that runs out of work pulls
+// right away.
+//
+// The tick is a one-shot timer of the CPU, re-armed every PROCESS_TICK_NS
+// while a process other than the idle process runs, so an idle CPU sleeps
+// until its next timer or reschedule interrupt.
+typedef struct {
+    volatile int lock;
+    int online;
+    process_t* current;
+    process_t* idle;                // Runs when nothing is ready (the kernel process on the BSP)
+    uint32_t ready_bitmap;
+    uint32_t num_queued;
+    uint64_t ticks;
+    uint64_t migrations;
+    hrtimer_t tick_timer;
+    process_t* run_head[PROCESS_NUM_LEVELS];
+    process_t* run_tail[PROCESS_NUM_LEVELS];
+} process_cpu_t;
+
+static process_cpu_t process_cpus[SMP_MAX_CPUS];
+
 // Process scheduler state
 static struct {
     int initialized;
     int enabled;
-    uint64_t ticks;
     uint64_t quantum;
+    volatile uint32_t boost_epoch;  // Boost periods since boot at the last boost
 } scheduler;
 
+// Tracepoints
+static const trace_point_t process_trace_switch = { "sched_switch", TRACE_CAT_SCHED, { "prev_pid", "next_pid" } };
+
 // Forward declarations
-static void process_scheduler_tick(void);
-static void process_switch(process_t* next);
+static void process_scheduler_tick(void* data);
+static void process_sleep_wakeup(void* data);
+static void process_update_tick(process_cpu_t* cpu);
+static void process_kick_idle(uint32_t this_cpu);
+static uint64_t process_ticks(void);
+static int process_is_idle(const process_t* process);
+static void process_switch(process_t* prev, process_t* next);
 static void process_cleanup(process_t* process);
+static void process_enqueue(process_t* process);
+static void process_dequeue(process_t* process);
+static process_t* process_pick_next(process_cpu_t* cpu);
+static int process_sched_lock(void);
+static void process_sched_unlock(int irq_enabled);
+static void process_cpu_lock(process_cpu_t* cpu);
+static void process_cpu_unlock(process_cpu_t* cpu);
+static process_cpu_t* process_lock(process_t* process, int* irq_enabled);
+static void process_unlock(process_cpu_t* cpu, int irq_enabled);
+static int process_lock_table(void);
+static void process_unlock_table(int irq_enabled);
+static uint32_t process_cpu_load(const process_cpu_t* cpu);
+static uint32_t process_select_cpu(void);
+static void process_wake_cpu(uint32_t cpu);
+static void process_balance(uint32_t this_cpu);
+static process_priority_t process_level_floor(const process_t* process);
+static uint64_t process_level_quantum(const process_t* process);
+static void process_boost(void);
 
 /**
  * Initialize the process management subsystem
@@ -44,8 +120,16 @@ void process_init(void) {
         process_table[i] = NULL;
     }
     
+    // Create the process structure cache (64-byte aligned for the FPU state)
+    process_cache = memory_cache_create("process_t", sizeof(process_t), 64);
+    
+    if (!process_cache) {
+        console_printf("Error: Failed to create process cache\n");
+        return;
+    }
+    
     // Create the initial kernel process
-    process_t* kernel_process = (process_t*)memory_alloc(sizeof(process_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_KERNEL | MEMORY_ALLOC_ZEROED);
+    process_t* kernel_process = (process_t*)memory_cache_alloc(process_cache, MEMORY_ALLOC_KERNEL | MEMORY_ALLOC_ZEROED);
     
     if (!kernel_process) {
         console_printf("Error: Failed to allocate kernel process\n");
@@ -56,7 +140,11 @@ void process_init(void) {
     kernel_process->pid = 0;
     kernel_process->state = PROCESS_STATE_RUNNING;
     kernel_process->priority = PROCESS_PRIORITY_NORMAL;
+    kernel_process->level = PROCESS_PRIORITY_NORMAL;
     kernel_process->flags = PROCESS_FLAG_KERNEL;
+    kernel_process->cpu = 0;
+    kernel_process->on_cpu = 1;
+    hrtimer_init(&kernel_process->sleep_timer, process_sleep_wakeup, NULL);
     kernel_process->parent = NULL;
     kernel_process->next = NULL;
     kernel_process->prev = NULL;
@@ -70,21 +158,87 @@ void process_init(void) {
     // Add the kernel process to the process table
     process_table[0] = kernel_process;
     
-    // Set the current process
-    current_process = kernel_process;
+    // The kernel process is the idle process of the BSP; the APs add their
+    // CPUs as they start
+    memset(process_cpus, 0, sizeof(process_cpus));
+    
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        hrtimer_init(&process_cpus[i].tick_timer, process_scheduler_tick, NULL);
+    }
+    
+    process_cpus[0].online = 1;
+    process_cpus[0].current = kernel_process;
+    process_cpus[0].idle = kernel_process;
     
     // Initialize the scheduler
     scheduler.initialized = 1;
     scheduler.enabled = 0;
-    scheduler.ticks = 0;
     scheduler.quantum = 10; // 10 ms time quantum
+    scheduler.boost_epoch = 0;
     
-    // Register the timer interrupt handler
-    interrupts_register_irq_handler(IRQ_TIMER, process_scheduler_tick);
+    // The ticks come from the per-CPU tick timers (timer.c); other CPUs
+    // interrupt a CPU to make it reschedule
+    interrupts_register_handler(SMP_VECTOR_RESCHEDULE, process_yield);
     
     console_printf("Process management initialized\n");
 }
 
+/**
+ * Add an application processor to the scheduler
+ * 
+ * Called by each AP once it is running on its own stack. The CPU gets an
+ * idle process that runs whenever its run queues are empty.
+ * 
+ * @param cpu: CPU index
+ */
+void process_init_cpu(uint32_t cpu) {
+    // Check if the process management subsystem is initialized
+    if (!scheduler.initialized || cpu == 0 || cpu >= SMP_MAX_CPUS) {
+        return;
+    }
+    
+    // Create the idle process of the CPU (not in the process table)
+    process_t* idle = (process_t*)memory_cache_alloc(process_cache, MEMORY_ALLOC_KERNEL | MEMORY_ALLOC_ZEROED);
+    
+    if (!idle) {
+        console_printf("Error: Failed to allocate idle process\n");
+        return;
+    }
+    
+    idle->pid = 0;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->priority = PROCESS_PRIORITY_IDLE;
+    idle->level = PROCESS_PRIORITY_IDLE;
+    idle->flags = PROCESS_FLAG_KERNEL | PROCESS_FLAG_IDLE;
+    idle->cpu = cpu;
+    idle->on_cpu = 1;
+    hrtimer_init(&idle->sleep_timer, process_sleep_wakeup, NULL);
+    cpu_fpu_init_state(idle->fpu_state);
+    
+    const char* name = "idle";
+    for (int i = 0; i < PROCESS_NAME_MAX - 1 && name[i]; i++) {
+        idle->name[i] = name[i];
+    }
+    
+    process_cpus[cpu].current = idle;
+    process_cpus[cpu].idle = idle;
+    __sync_synchronize();
+    process_cpus[cpu].online = 1;
+}
+
+/**
+ * Idle loop of a CPU
+ * 
+ * Runs the ready processes of the CPU and halts until the next interrupt
+ * whenever there are none.
+ */
+void process_idle(void) {
+    while (1) {
+        process_yield();
+        __asm__ volatile("sti; hlt");
+    }
+}
+
 /**
  * Create a new process
  * 
@@ -103,14 +257,15 @@ pid_t process_create(const char* name, void (*entry_point)(void), size_t stack_s
         return 0;
     }
     
-    // Check if we have reached the maximum number of processes
+    // Check if we have reached the maximum number of processes (checked again
+    // when the process ID is assigned)
     if (next_pid >= MAX_PROCESSES) {
         console_printf("Error: Maximum number of processes reached\n");
         return 0;
     }
     
     // Allocate memory for the process structure
-    process_t* process = (process_t*)memory_alloc(sizeof(process_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    process_t* process = (process_t*)memory_cache_alloc(process_cache, MEMORY_ALLOC_ZEROED);
     
     if (!process) {
         console_printf("Error: Failed to allocate process structure\n");
@@ -122,7 +277,7 @@ pid_t process_create(const char* name, void (*entry_point)(void), size_t stack_s
     
     if (!stack) {
         console_printf("Error: Failed to allocate process stack\n");
-        memory_free(process, sizeof(process_t));
+        memory_cache_free(process_cache, process);
         return 0;
     }
     
@@ -132,25 +287,34 @@ pid_t process_create(const char* name, void (*entry_point)(void), size_t stack_s
     if (!kernel_stack) {
         console_printf("Error: Failed to allocate kernel stack\n");
         memory_free(stack, stack_size);
-        memory_free(process, sizeof(process_t));
+        memory_cache_free(process_cache, process);
         return 0;
     }
     
+    // Clamp the priority to the scheduling levels
+    if (priority >= PROCESS_NUM_LEVELS) {
+        priority = PROCESS_PRIORITY_REALTIME;
+    }
+    
     // Initialize the process
-    process->pid = next_pid++;
     process->state = PROCESS_STATE_CREATED;
     process->priority = priority;
+    process->level = priority;
     process->flags = flags;
     process->stack = stack;
     process->stack_size = stack_size;
     process->kernel_stack = kernel_stack;
     process->kernel_stack_size = 4096;
-    process->parent = current_process;
+    process->parent = process_get_current();
     process->next = NULL;
     process->prev = NULL;
     process->cpu_time = 0;
-    process->creation_time = scheduler.ticks;
+    process->creation_time = process_ticks();
     process->exit_code = 0;
+    hrtimer_init(&process->sleep_timer, process_sleep_wakeup, NULL);
+    
+    // Start with a clean FPU/SIMD state
+    cpu_fpu_init_state(process->fpu_state);
     
     // Set the process name
     for (int i = 0; i < PROCESS_NAME_MAX - 1 && name[i]; i++) {
@@ -180,11 +344,31 @@ pid_t process_create(const char* name, void (*entry_point)(void), size_t stack_s
     process->context.esi = 0;
     process->context.edi = 0;
     
-    // Add the process to the process table
+    // Assign the process ID and add the process to the process table
+    int irq = process_lock_table();
+    
+    if (next_pid >= MAX_PROCESSES) {
+        process_unlock_table(irq);
+        console_printf("Error: Maximum number of processes reached\n");
+        memory_free(kernel_stack, 4096);
+        memory_free(stack, stack_size);
+        memory_cache_free(process_cache, process);
+        return 0;
+    }
+    
+    process->pid = next_pid++;
     process_table[process->pid] = process;
+    process_unlock_table(irq);
+    
+    // Set the process state to ready and queue it on the least loaded CPU
+    process->cpu = process_select_cpu();
     
-    // Set the process state to ready
+    process_cpu_t* cpu = process_lock(process, &irq);
     process->state = PROCESS_STATE_READY;
+    process_enqueue(process);
+    process_unlock(cpu, irq);
+    
+    process_wake_cpu(process->cpu);
     
     return process->pid;
 }
@@ -218,12 +402,23 @@ int process_terminate(pid_t pid, int exit_code) {
     }
     
     // Set the process state to terminated
+    int irq;
+    process_cpu_t* cpu = process_lock(process, &irq);
     process->state = PROCESS_STATE_TERMINATED;
     process->exit_code = exit_code;
+    process_dequeue(process);
+    process_unlock(cpu, irq);
     
     // If the process is the current process, schedule another process
-    if (process == current_process) {
+    if (process == process_get_current()) {
         process_yield();
+    } else if (process->on_cpu) {
+        // Stop it on the CPU it runs on before its memory is freed
+        smp_send_reschedule(process->cpu);
+        
+        while (process->on_cpu) {
+            __asm__ volatile("pause");
+        }
     }
     
     // Clean up the process
@@ -238,7 +433,12 @@ int process_terminate(pid_t pid, int exit_code) {
  * @return: Pointer to the current process
  */
 process_t* process_get_current(void) {
-    return current_process;
+    // Keep the process from moving to another CPU between the two reads
+    int irq = process_sched_lock();
+    process_t* process = process_cpus[smp_cpu_index()].current;
+    process_sched_unlock(irq);
+    
+    return process;
 }
 
 /**
@@ -279,8 +479,26 @@ int process_set_priority(pid_t pid, process_priority_t priority) {
     // Get the process
     process_t* process = process_table[pid];
     
-    // Set the process priority
+    // Clamp the priority to the scheduling levels
+    if (priority >= PROCESS_NUM_LEVELS) {
+        priority = PROCESS_PRIORITY_REALTIME;
+    }
+    
+    // Set the process priority and restart it at the new level
+    int irq;
+    process_cpu_t* cpu = process_lock(process, &irq);
+    int queued = process->queued;
+    
+    process_dequeue(process);
     process->priority = priority;
+    process->level = priority;
+    process->slice_ticks = 0;
+    
+    if (queued) {
+        process_enqueue(process);
+    }
+    
+    process_unlock(cpu, irq);
     
     return 0;
 }
@@ -312,12 +530,22 @@ int process_block(pid_t pid) {
         return 0;
     }
     
-    // Set the process state to blocked
+    // Set the process state to blocked and take it off its run queue
+    int irq;
+    process_cpu_t* cpu = process_lock(process, &irq);
+    int running = cpu->current == process;
+    uint32_t target = process->cpu;
+    
     process->state = PROCESS_STATE_BLOCKED;
+    process_dequeue(process);
+    process_unlock(cpu, irq);
     
-    // If the process is the current process, schedule another process
-    if (process == current_process) {
+    // If the process is the current process, schedule another process;
+    // a process running on another CPU is switched out there
+    if (process == process_get_current()) {
         process_yield();
+    } else if (running) {
+        smp_send_reschedule(target);
     }
     
     return 0;
@@ -350,14 +578,83 @@ int process_unblock(pid_t pid) {
         return 0;
     }
     
-    // Set the process state to ready
-    process->state = PROCESS_STATE_READY;
+    // Set the process state to ready and queue it at its current level
+    int irq;
+    process_cpu_t* cpu = process_lock(process, &irq);
+    uint32_t target = process->cpu;
+    
+    if (process->state == PROCESS_STATE_BLOCKED) {
+        process->state = PROCESS_STATE_READY;
+        
+        // A process that has not been switched out yet is requeued by its
+        // CPU when it yields
+        if (cpu->current != process) {
+            process_enqueue(process);
+        }
+    }
+    
+    process_unlock(cpu, irq);
+    
+    // Wake the CPU if it is idle
+    process_wake_cpu(target);
     
     return 0;
 }
 
+/**
+ * Block the current process unless a wakeup has been posted
+ * 
+ * The process is marked blocked before *wake is checked, so a waker that
+ * sets *wake and then calls process_unblock is never lost in between: the
+ * unblock finds the process blocked, or the process sees the flag.
+ * 
+ * @param wake: Wakeup flag set by the waker
+ * @return: 0 once woken, -1 if the current process cannot block (the idle
+ *          process, or the scheduler is not running)
+ */
+int process_block_unless(volatile int* wake) {
+    process_t* current = process_get_current();
+    
+    if (!scheduler.initialized || !scheduler.enabled || !current || process_is_idle(current)) {
+        return -1;
+    }
+    
+    int irq;
+    process_cpu_t* cpu = process_lock(current, &irq);
+    current->state = PROCESS_STATE_BLOCKED;
+    process_unlock(cpu, irq);
+    
+    __sync_synchronize();
+    
+    // A process that is not switched out yet is requeued by the yield
+    if (*wake) {
+        process_unblock(current->pid);
+    }
+    
+    process_yield();
+    
+    return 0;
+}
+
+/**
+ * Check whether the scheduler switches between processes
+ * 
+ * Until it does, work handed to another process never runs, so callers
+ * must do it on the current thread.
+ * 
+ * @return: 1 if the scheduler is running, 0 otherwise
+ */
+int process_scheduler_running(void) {
+    return scheduler.initialized && scheduler.enabled;
+}
+
 /**
  * Yield the CPU
+ * 
+ * A running (or preempted) current process goes to the tail of its run
+ * queue, so it runs again only after the other processes of its level.
+ * A CPU without ready processes first pulls work from the busiest CPU and
+ * otherwise switches to its idle process.
  */
 void process_yield(void) {
     // Check if the process management subsystem is initialized
@@ -370,37 +667,53 @@ void process_yield(void) {
         return;
     }
     
-    // Find the next process to run
-    process_t* next = NULL;
+    int irq = process_sched_lock();
+    uint32_t index = smp_cpu_index();
+    process_cpu_t* cpu = &process_cpus[index];
     
-    // Start from the current process
-    process_t* process = current_process->next;
+    if (!cpu->online) {
+        process_sched_unlock(irq);
+        return;
+    }
     
-    // If we reached the end of the list, start from the beginning
-    if (!process) {
-        process = process_table[0];
+    // Out of work: pull from the busiest CPU first
+    if (cpu->num_queued == 0) {
+        process_balance(index);
     }
     
-    // Find the next ready process
-    while (process != current_process) {
-        if (process && process->state == PROCESS_STATE_READY) {
-            next = process;
-            break;
-        }
-        
-        // Move to the next process
-        process = process->next;
-        
-        // If we reached the end of the list, start from the beginning
-        if (!process) {
-            process = process_table[0];
-        }
+    process_cpu_lock(cpu);
+    
+    // Requeue the current process if it can still run
+    process_t* prev = cpu->current;
+    
+    if (prev != cpu->idle && (prev->state == PROCESS_STATE_RUNNING || prev->state == PROCESS_STATE_READY)) {
+        prev->state = PROCESS_STATE_READY;
+        process_enqueue(prev);
+    }
+    
+    // Pick the first process of the highest non-empty level
+    process_t* next = process_pick_next(cpu);
+    
+    // Nothing can run: fall back to the idle process
+    if (!next && cpu->idle && prev != cpu->idle) {
+        next = cpu->idle;
+    }
+    
+    if (next) {
+        next->state = PROCESS_STATE_RUNNING;
+        next->cpu = index;
+        cpu->current = next;
     }
     
+    process_cpu_unlock(cpu);
+    
     // If we found a process, switch to it
     if (next) {
-        process_switch(next);
+        process_update_tick(cpu);
+        process_switch(prev, next);
     }
+    
+    process_sched_unlock(irq);
 }
 
 /**
@@ -409,34 +722,79 @@ void process_yield(void) {
  * @param ms: Number of milliseconds to sleep
  */
 void process_sleep(uint32_t ms) {
+    process_sleep_us((uint64_t)ms * 1000);
+}
+
+/**
+ * Sleep for the specified number of microseconds
+ * 
+ * The process blocks until its sleep timer wakes it at the deadline. The
+ * idle process, and any process while the scheduler is disabled, waits in
+ * place instead: halted until the timer interrupt, or spinning on the PIT
+ * with interrupts disabled.
+ * 
+ * @param us: Number of microseconds to sleep
+ */
+void process_sleep_us(uint64_t us) {
     // Check if the process management subsystem is initialized
-    if (!scheduler.initialized) {
+    if (!scheduler.initialized || us == 0) {
         return;
     }
     
-    // Check if the scheduler is enabled
-    if (!scheduler.enabled) {
+    process_t* current = process_get_current();
+    
+    if (!current) {
         return;
     }
     
-    // Calculate the number of ticks to sleep
-    uint64_t ticks = ms / 10; // Assuming 10 ms per tick
-    
-    // Block the current process
-    current_process->state = PROCESS_STATE_BLOCKED;
-    
-    // Schedule another process
-    process_yield();
+    uint64_t deadline = timer_now_ns() + us * TIMER_NS_PER_US;
+    
+    current->sleep_timer.data = (void*)(uintptr_t)current->pid;
+    
+    // Nothing to switch to: wait in place
+    if (!scheduler.enabled || process_is_idle(current)) {
+        if (interrupts_are_enabled() && hrtimer_start(&current->sleep_timer, deadline) == 0) {
+            for (;;) {
+                interrupts_disable();
+                
+                if (timer_now_ns() >= deadline) {
+                    break;
+                }
+                
+                // The sti shadow keeps the timer interrupt from slipping in before the hlt
+                __asm__ volatile("sti; hlt");
+            }
+            
+            interrupts_enable();
+            hrtimer_cancel(&current->sleep_timer);
+        } else {
+            while (us > 0) {
+                uint32_t chunk = us > 50000 ? 50000 : (uint32_t)us;
+                timer_delay_us(chunk);
+                us -= chunk;
+            }
+        }
+        
+        return;
+    }
     
-    // Sleep for the specified number of ticks
-    uint64_t start_ticks = scheduler.ticks;
-    while (scheduler.ticks - start_ticks < ticks) {
-        // Wait for the next tick
-        __asm__ volatile("hlt");
+    // Block until the deadline; an early wakeup blocks again
+    while (timer_now_ns() < deadline) {
+        int irq;
+        process_cpu_t* cpu = process_lock(current, &irq);
+        current->state = PROCESS_STATE_BLOCKED;
+        process_unlock(cpu, irq);
+        
+        // The timer may fire before the yield; the process is then READY
+        // again and the yield just requeues it
+        if (hrtimer_start(&current->sleep_timer, deadline) != 0) {
+            process_unblock(current->pid);
+        }
+        
+        process_yield();
     }
     
-    // Unblock the current process
-    current_process->state = PROCESS_STATE_READY;
+    hrtimer_cancel(&current->sleep_timer);
 }
 
 /**
@@ -496,6 +854,7 @@ size_t process_get_count(void) {
     
     // Count the number of processes
     size_t count = 0;
+    int irq = process_lock_table();
     
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (process_table[i]) {
@@ -503,6 +862,8 @@ size_t process_get_count(void) {
         }
     }
     
+    process_unlock_table(irq);
+    
     return count;
 }
 
@@ -526,6 +887,7 @@ size_t process_get_list(process_t* processes, size_t max_count) {
     
     // Get the list of processes
     size_t count = 0;
+    int irq = process_lock_table();
     
     for (int i = 0; i < MAX_PROCESSES && count < max_count; i++) {
         if (process_table[i]) {
@@ -533,97 +895,598 @@ size_t process_get_list(process_t* processes, size_t max_count) {
         }
     }
     
+    process_unlock_table(irq);
+    
     return count;
 }
 
 /**
  * Process scheduler tick handler
  * 
- * This function is called by the timer interrupt handler.
+ * This function is the tick timer callback of every CPU. It runs every
+ * PROCESS_TICK_NS while the CPU runs a process other than its idle process.
+ * 
+ * @param data: Unused
  */
-static void process_scheduler_tick(void) {
-    // Increment the tick counter
-    scheduler.ticks++;
+static void process_scheduler_tick(void* data) {
+    (void)data;
+    uint32_t index = smp_cpu_index();
+    process_cpu_t* cpu = &process_cpus[index];
     
     // Check if the scheduler is enabled
-    if (!scheduler.enabled) {
+    if (!scheduler.enabled || !cpu->online) {
         return;
     }
     
+    // Keep ticking at a steady rate; a tick delayed by more than a period is not made up
+    if (cpu->current != cpu->idle) {
+        uint64_t now = timer_now_ns();
+        uint64_t next = cpu->tick_timer.deadline + PROCESS_TICK_NS;
+        
+        hrtimer_start(&cpu->tick_timer, next > now ? next : now + PROCESS_TICK_NS);
+    }
+    
+    // Periodically lift every process back to its priority level; the
+    // first CPU to tick in a new boost period does it
+    uint32_t epoch = (uint32_t)(process_ticks() / PROCESS_MLFQ_BOOST_TICKS);
+    uint32_t last = scheduler.boost_epoch;
+    
+    if (epoch != last && __sync_bool_compare_and_swap(&scheduler.boost_epoch, last, epoch)) {
+        process_boost();
+    }
+    
+    // Periodically even out the run queues; idle CPUs take no ticks, so
+    // wake one to pull queued work
+    if (++cpu->ticks % PROCESS_BALANCE_TICKS == 0) {
+        process_balance(index);
+        
+        if (cpu->num_queued > 0) {
+            process_kick_idle(index);
+        }
+    }
+    
+    process_cpu_lock(cpu);
+    
     // Check if the current process is running
-    if (current_process && current_process->state == PROCESS_STATE_RUNNING) {
+    process_t* current = cpu->current;
+    int expired = 0;
+    
+    if (current && current != cpu->idle && current->state == PROCESS_STATE_RUNNING) {
         // Increment the CPU time
-        current_process->cpu_time++;
+        current->cpu_time++;
+        current->slice_ticks++;
         
-        // Check if the time quantum has expired
-        if (current_process->cpu_time % scheduler.quantum == 0) {
-            // Set the process state to ready
-            current_process->state = PROCESS_STATE_READY;
+        // Check if the slice of the current level has expired
+        if (current->slice_ticks >= process_level_quantum(current)) {
+            // A process that uses its whole slice is CPU-bound: demote it
+            process_dequeue(current);
+            current->slice_ticks = 0;
+            
+            if (current->level > process_level_floor(current)) {
+                current->level--;
+            }
             
-            // Schedule another process
-            process_yield();
+            // Set the process state to ready
+            current->state = PROCESS_STATE_READY;
+            expired = 1;
         }
     }
+    
+    process_cpu_unlock(cpu);
+    
+    // Schedule another process
+    if (expired) {
+        process_yield();
+    }
 }
 
 /**
- * Switch to a new process
+ * Wake a sleeping process (sleep timer callback)
  * 
- * @param next: Process to switch to
+ * @param data: Process ID
  */
-static void process_switch(process_t* next) {
-    // Check if the process is valid
-    if (!next) {
+static void process_sleep_wakeup(void* data) {
+    process_unblock((pid_t)(uintptr_t)data);
+}
+
+/**
+ * Start or stop the tick timer of the calling CPU for its current process
+ * 
+ * @param cpu: Calling CPU
+ */
+static void process_update_tick(process_cpu_t* cpu) {
+    if (cpu->current == cpu->idle) {
+        hrtimer_cancel(&cpu->tick_timer);
+    } else if (!hrtimer_pending(&cpu->tick_timer)) {
+        hrtimer_start(&cpu->tick_timer, timer_now_ns() + PROCESS_TICK_NS);
+    }
+}
+
+/**
+ * Wake one idle CPU so it pulls work from the run queues of the caller
+ * 
+ * @param this_cpu: Index of the calling CPU
+ */
+static void process_kick_idle(uint32_t this_cpu) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        process_cpu_t* cpu = &process_cpus[i];
+        
+        if (i != this_cpu && cpu->online && cpu->current == cpu->idle) {
+            smp_send_reschedule(i);
+            return;
+        }
+    }
+}
+
+/**
+ * Get the scheduler ticks since boot
+ * 
+ * @return: Clock time in ticks of PROCESS_TICK_NS
+ */
+static uint64_t process_ticks(void) {
+    return timer_now_ns() / PROCESS_TICK_NS;
+}
+
+/**
+ * Check if a process is the idle process of its CPU
+ * 
+ * @param process: Process
+ * @return: 1 if the process is an idle process, 0 otherwise
+ */
+static int process_is_idle(const process_t* process) {
+    return process_cpus[process->cpu].idle == process;
+}
+
+/**
+ * Get the lowest level a process can be demoted to
+ * 
+ * @param process: Process
+ * @return: Lowest scheduling level
+ */
+static process_priority_t process_level_floor(const process_t* process) {
+    // Realtime and idle processes stay at their priority
+    if (process->priority == PROCESS_PRIORITY_REALTIME || (process->flags & PROCESS_FLAG_REALTIME) ||
+        process->priority <= PROCESS_PRIORITY_LOWEST) {
+        return process->priority;
+    }
+    
+    if (process->priority - PROCESS_PRIORITY_LOWEST < PROCESS_MLFQ_DEMOTIONS) {
+        return PROCESS_PRIORITY_LOWEST;
+    }
+    
+    return process->priority - PROCESS_MLFQ_DEMOTIONS;
+}
+
+/**
+ * Get the time slice of a process at its current level
+ * 
+ * The slice doubles with every level the process has been demoted.
+ * 
+ * @param process: Process
+ * @return: Time slice in ticks
+ */
+static uint64_t process_level_quantum(const process_t* process) {
+    return scheduler.quantum << (process->priority - process->level);
+}
+
+/**
+ * Boost every process back to its priority level
+ * 
+ * Called from the timer interrupt every PROCESS_MLFQ_BOOST_TICKS ticks.
+ */
+static void process_boost(void) {
+    int irq = process_lock_table();
+    
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* process = process_table[i];
+        
+        if (!process || process->level == process->priority) {
+            continue;
+        }
+        
+        int cpu_irq;
+        process_cpu_t* cpu = process_lock(process, &cpu_irq);
+        int queued = process->queued;
+        
+        process_dequeue(process);
+        process->level = process->priority;
+        process->slice_ticks = 0;
+        
+        if (queued) {
+            process_enqueue(process);
+        }
+        
+        process_unlock(cpu, cpu_irq);
+    }
+    
+    process_unlock_table(irq);
+}
+
+/**
+ * Add a process to the tail of the run queue of its level
+ * 
+ * Must be called with the run queues of process->cpu locked.
+ * 
+ * @param process: Process to queue
+ */
+static void process_enqueue(process_t* process) {
+    process_cpu_t* cpu = &process_cpus[process->cpu];
+    
+    // The idle process of a CPU is never queued
+    if (process->queued || process == cpu->idle) {
+        return;
+    }
+    
+    process_priority_t level = process->level;
+    
+    process->run_next = NULL;
+    process->run_prev = cpu->run_tail[level];
+    
+    if (cpu->run_tail[level]) {
+        cpu->run_tail[level]->run_next = process;
+    } else {
+        cpu->run_head[level] = process;
+    }
+    
+    cpu->run_tail[level] = process;
+    cpu->ready_bitmap |= 1u << level;
+    cpu->num_queued++;
+    process->queued = 1;
+}
+
+/**
+ * Remove a process from its run queue
+ * 
+ * Must be called with the run queues of process->cpu locked.
+ * 
+ * @param process: Process to remove
+ */
+static void process_dequeue(process_t* process) {
+    if (!process->queued) {
+        return;
+    }
+    
+    process_cpu_t* cpu = &process_cpus[process->cpu];
+    process_priority_t level = process->level;
+    
+    if (process->run_prev) {
+        process->run_prev->run_next = process->run_next;
+    } else {
+        cpu->run_head[level] = process->run_next;
+    }
+    
+    if (process->run_next) {
+        process->run_next->run_prev = process->run_prev;
+    } else {
+        cpu->run_tail[level] = process->run_prev;
+    }
+    
+    if (!cpu->run_head[level]) {
+        cpu->ready_bitmap &= ~(1u << level);
+    }
+    
+    cpu->num_queued--;
+    process->run_next = NULL;
+    process->run_prev = NULL;
+    process->queued = 0;
+}
+
+/**
+ * Take the next process to run off the run queues of a CPU
+ * 
+ * Must be called with the run queues of the CPU locked.
+ * 
+ * @param cpu: CPU
+ * @return: First ready process of the highest non-empty level, or NULL
+ */
+static process_t* process_pick_next(process_cpu_t* cpu) {
+    while (cpu->ready_bitmap) {
+        int level = 31 - __builtin_clz(cpu->ready_bitmap);
+        process_t* process = cpu->run_head[level];
+        
+        process_dequeue(process);
+        
+        if (process->state == PROCESS_STATE_READY) {
+            return process;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Get the load of a CPU
+ * 
+ * Read without the run queue lock, so the result is only a hint.
+ * 
+ * @param cpu: CPU
+ * @return: Queued processes plus the running one (the idle process counts as none)
+ */
+static uint32_t process_cpu_load(const process_cpu_t* cpu) {
+    const process_t* current = cpu->current;
+    uint32_t load = cpu->num_queued;
+    
+    if (current && current != cpu->idle && current->state == PROCESS_STATE_RUNNING) {
+        load++;
+    }
+    
+    return load;
+}
+
+/**
+ * Choose the CPU a new process starts on
+ * 
+ * @return: Index of the least loaded online CPU
+ */
+static uint32_t process_select_cpu(void) {
+    uint32_t best = 0;
+    uint32_t best_load = process_cpu_load(&process_cpus[0]);
+    
+    for (uint32_t i = 1; i < SMP_MAX_CPUS; i++) {
+        if (!process_cpus[i].online) {
+            continue;
+        }
+        
+        uint32_t load = process_cpu_load(&process_cpus[i]);
+        
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    
+    return best;
+}
+
+/**
+ * Wake a CPU that sits in its idle loop
+ * 
+ * @param cpu: CPU index
+ */
+static void process_wake_cpu(uint32_t cpu) {
+    if (process_cpus[cpu].online && process_cpus[cpu].current == process_cpus[cpu].idle) {
+        smp_send_reschedule(cpu);
+    }
+}
+
+/**
+ * Pull ready processes from the busiest CPU
+ * 
+ * Moves half of the load difference, starting with the processes the
+ * busiest CPU would run next. Must be called with interrupts disabled and
+ * without run queue locks held.
+ * 
+ * @param this_cpu: Index of the calling CPU
+ */
+static void process_balance(uint32_t this_cpu) {
+    process_cpu_t* cpu = &process_cpus[this_cpu];
+    process_cpu_t* busiest = NULL;
+    uint32_t busiest_index = 0;
+    uint32_t busiest_load = 0;
+    
+    if (!cpu->online) {
         return;
     }
     
-    // Check if the process is ready
-    if (next->state != PROCESS_STATE_READY) {
+    // Find the busiest other CPU
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i == this_cpu || !process_cpus[i].online) {
+            continue;
+        }
+        
+        uint32_t load = process_cpu_load(&process_cpus[i]);
+        
+        if (load > busiest_load) {
+            busiest = &process_cpus[i];
+            busiest_index = i;
+            busiest_load = load;
+        }
+    }
+    
+    if (!busiest || busiest_load < process_cpu_load(cpu) + 2) {
         return;
     }
     
-    // Save the current process context
-    process_t* prev = current_process;
-    
-    // Set the new process as the current process
-    current_process = next;
-    
-    // Set the process state to running
-    current_process->state = PROCESS_STATE_RUNNING;
-    
-    // Switch to the new process context
-    // Save current context and load the new one
-    if (prev != next) {
-        // Save the current process context
-        __asm__ volatile(
-            "pushfl\n"
-            "push %%eax\n"
-            "push %%ebx\n"
-            "push %%ecx\n"
-            "push %%edx\n"
-            "push %%esi\n"
-            "push %%edi\n"
-            "push %%ebp\n"
-            "movl %%esp, %0\n"
-            "movl %1, %%esp\n"
-            "pop %%ebp\n"
-            "pop %%edi\n"
-            "pop %%esi\n"
-            "pop %%edx\n"
-            "pop %%ecx\n"
-            "pop %%ebx\n"
-            "pop %%eax\n"
-            "popfl\n"
-            : "=m" (prev->context.esp)
-            : "m" (next->context.esp)
-            : "memory"
-        );
+    // Lock both run queues in CPU order
+    process_cpu_t* first = this_cpu < busiest_index ? cpu : busiest;
+    process_cpu_t* second = this_cpu < busiest_index ? busiest : cpu;
+    
+    process_cpu_lock(first);
+    process_cpu_lock(second);
+    
+    uint32_t this_load = process_cpu_load(cpu);
+    busiest_load = process_cpu_load(busiest);
+    uint32_t moves = busiest_load > this_load ? (busiest_load - this_load) / 2 : 0;
+    
+    while (moves > 0 && busiest->ready_bitmap) {
+        int level = 31 - __builtin_clz(busiest->ready_bitmap);
+        process_t* process = busiest->run_head[level];
+        
+        process_dequeue(process);
+        
+        // Drop entries that stopped being ready, as process_pick_next does
+        if (process->state != PROCESS_STATE_READY) {
+            continue;
+        }
+        
+        process->cpu = this_cpu;
+        process_enqueue(process);
+        cpu->migrations++;
+        moves--;
+    }
+    
+    process_cpu_unlock(second);
+    process_cpu_unlock(first);
+}
+
+/**
+ * Disable interrupts around run queue updates
+ * 
+ * @return: Whether interrupts were enabled
+ */
+static int process_sched_lock(void) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+    return irq_enabled;
+}
+
+/**
+ * Restore interrupts after run queue updates
+ * 
+ * @param irq_enabled: Value returned by process_sched_lock
+ */
+static void process_sched_unlock(int irq_enabled) {
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Lock the run queues of a CPU
+ * 
+ * Must be called with interrupts disabled.
+ * 
+ * @param cpu: CPU
+ */
+static void process_cpu_lock(process_cpu_t* cpu) {
+    while (__sync_lock_test_and_set(&cpu->lock, 1)) {
+        while (cpu->lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Unlock the run queues of a CPU
+ * 
+ * @param cpu: CPU
+ */
+static void process_cpu_unlock(process_cpu_t* cpu) {
+    __sync_lock_release(&cpu->lock);
+}
+
+/**
+ * Disable interrupts and lock the run queues a process belongs to
+ * 
+ * @param process: Process
+ * @param irq_enabled: Pointer to store whether interrupts were enabled
+ * @return: Locked CPU (process->cpu cannot change until it is unlocked)
+ */
+static process_cpu_t* process_lock(process_t* process, int* irq_enabled) {
+    *irq_enabled = process_sched_lock();
+    
+    while (1) {
+        process_cpu_t* cpu = &process_cpus[process->cpu];
+        process_cpu_lock(cpu);
+        
+        // The process may have been migrated while we waited
+        if (cpu == &process_cpus[process->cpu]) {
+            return cpu;
+        }
         
-        // Update page directory if needed
-        if (prev->page_directory != next->page_directory) {
-            memory_switch_page_directory(next->page_directory);
+        process_cpu_unlock(cpu);
+    }
+}
+
+/**
+ * Unlock the run queues locked by process_lock
+ * 
+ * @param cpu: CPU returned by process_lock
+ * @param irq_enabled: Value stored by process_lock
+ */
+static void process_unlock(process_cpu_t* cpu, int irq_enabled) {
+    process_cpu_unlock(cpu);
+    process_sched_unlock(irq_enabled);
+}
+
+/**
+ * Disable interrupts and lock the process table
+ * 
+ * Taken before any run queue lock when both are needed.
+ * 
+ * @return: Whether interrupts were enabled
+ */
+static int process_lock_table(void) {
+    int irq_enabled = process_sched_lock();
+    
+    while (__sync_lock_test_and_set(&process_table_lock, 1)) {
+        while (process_table_lock) {
+            __asm__ volatile("pause");
         }
     }
+    
+    return irq_enabled;
+}
+
+/**
+ * Unlock the process table
+ * 
+ * @param irq_enabled: Value returned by process_lock_table
+ */
+static void process_unlock_table(int irq_enabled) {
+    __sync_lock_release(&process_table_lock);
+    process_sched_unlock(irq_enabled);
+}
+
+/**
+ * Switch to a new process
+ * 
+ * Called with interrupts disabled once next has been made the current
+ * process of this CPU. prev stays marked on_cpu until its context is saved,
+ * so a CPU that picks it up meanwhile waits before switching to it.
+ * 
+ * @param prev: Process running on this CPU
+ * @param next: Process to switch to
+ */
+static void process_switch(process_t* prev, process_t* next) {
+    // Check if the process is valid
+    if (!next || prev == next) {
+        return;
+    }
+    
+    // Wait until the CPU that last ran next has saved its context
+    while (next->on_cpu) {
+        __asm__ volatile("pause");
+    }
+    
+    next->on_cpu = 1;
+    
+    trace_instant(&process_trace_switch, prev->pid, next->pid);
+    
+    // Switch the FPU/SIMD register state
+    cpu_fpu_save(prev->fpu_state);
+    cpu_fpu_restore(next->fpu_state);
+    
+    // Save the current process context and load the new one
+    __asm__ volatile(
+        "pushfl\n"
+        "push %%eax\n"
+        "push %%ebx\n"
+        "push %%ecx\n"
+        "push %%edx\n"
+        "push %%esi\n"
+        "push %%edi\n"
+        "push %%ebp\n"
+        "movl %%esp, %0\n"
+        "movb $0, %1\n"
+        "movl %2, %%esp\n"
+        "pop %%ebp\n"
+        "pop %%edi\n"
+        "pop %%esi\n"
+        "pop %%edx\n"
+        "pop %%ecx\n"
+        "pop %%ebx\n"
+        "pop %%eax\n"
+        "popfl\n"
+        : "=m" (prev->context.esp), "=m" (prev->on_cpu)
+        : "m" (next->context.esp)
+        : "memory"
+    );
+    
+    // Update page directory if needed
+    if (prev->page_directory != next->page_directory) {
+        memory_switch_page_directory(next->page_directory);
+    }
 }
 
 /**
@@ -637,6 +1500,9 @@ static void process_cleanup(process_t* process) {
         return;
     }
     
+    // A sleeping process leaves its wakeup timer behind
+    hrtimer_cancel(&process->sleep_timer);
+    
     // Free the process stack
     if (process->stack) {
         memory_free(process->stack, process->stack_size);
@@ -647,9 +1513,17 @@ static void process_cleanup(process_t* process) {
         memory_free(process->kernel_stack, process->kernel_stack_size);
     }
     
-    // Remove the process from the process table
+    // Remove the process from its run queue and the process table
+    int irq = process_lock_table();
+    int cpu_irq;
+    process_cpu_t* cpu = process_lock(process, &cpu_irq);
+    
+    process_dequeue(process);
+    process_unlock(cpu, cpu_irq);
+    
     process_table[process->pid] = NULL;
+    process_unlock_table(irq);
     
     // Free the process structure
-    memory_free(process, sizeof(process_t));
+    memory_cache_free(process_cache, process);
 }
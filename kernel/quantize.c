@@ -0,0 +1,284 @@
+/**
+ * quantize.c - Block-quantized weights implementation for NeuroOS
+ *
+ * This file implements symmetric per-group INT8 and INT4 weight quantization
+ * and the matrix-vector kernels that consume it. Decode is bound by weight
+ * bandwidth, so reading 1 or 0.5 bytes per weight instead of 4 speeds up
+ * each step roughly in proportion.
+ */
+
+#include "include/quantize.h"
+#include "include/neural_network.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+
+/**
+ * Round a float to the nearest integer and clamp it
+ *
+ * @param value: Value to round
+ * @param min: Minimum result
+ * @param max: Maximum result
+ * @return: Rounded and clamped value
+ */
+static int nn_quant_round(float value, int min, int max) {
+    int q = (int)(value >= 0.0f ? value + 0.5f : value - 0.5f);
+
+    if (q < min) {
+        return min;
+    }
+    if (q > max) {
+        return max;
+    }
+
+    return q;
+}
+
+/**
+ * Get the number of bytes used by one quantized row
+ *
+ * @param cols: Number of columns
+ * @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+ * @return: Row stride in bytes
+ */
+static uint32_t nn_qmatrix_row_stride(uint32_t cols, uint32_t dtype) {
+    return dtype == NN_DTYPE_INT4 ? (cols + 1) / 2 : cols;
+}
+
+/**
+ * Get the memory needed by a quantized matrix
+ *
+ * @param rows: Number of rows
+ * @param cols: Number of columns
+ * @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+ * @return: Size in bytes
+ */
+size_t nn_qmatrix_size(uint32_t rows, uint32_t cols, uint32_t dtype) {
+    size_t groups_per_row = (cols + NN_QUANT_GROUP_SIZE - 1) / NN_QUANT_GROUP_SIZE;
+
+    return (size_t)rows * groups_per_row * sizeof(float) +
+           (size_t)rows * nn_qmatrix_row_stride(cols, dtype);
+}
+
+/**
+ * Quantize a strided matrix
+ *
+ * Element (r, c) of the source is read at weights[r * row_step + c * col_step].
+ *
+ * @param qm: Quantized matrix to fill
+ * @param weights: Source weights
+ * @param rows: Number of rows
+ * @param cols: Number of columns
+ * @param row_step: Source step between rows
+ * @param col_step: Source step between columns
+ * @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+ * @return: 0 on success, -1 on failure
+ */
+static int nn_qmatrix_quantize_strided(nn_qmatrix_t* qm, const float* weights, uint32_t rows, uint32_t cols,
+                                       size_t row_step, size_t col_step, uint32_t dtype) {
+    if (!qm || !weights || rows == 0 || cols == 0) {
+        console_printf("Error: Invalid parameters for nn_qmatrix_quantize\n");
+        return -1;
+    }
+
+    if (dtype != NN_DTYPE_INT8 && dtype != NN_DTYPE_INT4) {
+        console_printf("Error: Unsupported quantization type %u\n", dtype);
+        return -1;
+    }
+
+    // Allocate scales and data as a single block
+    size_t alloc_size = nn_qmatrix_size(rows, cols, dtype);
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for quantized matrix\n");
+        return -1;
+    }
+
+    qm->rows = rows;
+    qm->cols = cols;
+    qm->dtype = dtype;
+    qm->group_size = NN_QUANT_GROUP_SIZE;
+    qm->groups_per_row = (cols + NN_QUANT_GROUP_SIZE - 1) / NN_QUANT_GROUP_SIZE;
+    qm->row_stride = nn_qmatrix_row_stride(cols, dtype);
+    qm->scales = (float*)block;
+    qm->data = block + (size_t)rows * qm->groups_per_row * sizeof(float);
+    qm->alloc_size = alloc_size;
+
+    int qmax = dtype == NN_DTYPE_INT4 ? 7 : 127;
+    int qmin = dtype == NN_DTYPE_INT4 ? -8 : -127;
+
+    for (uint32_t r = 0; r < rows; r++) {
+        const float* src = weights + (size_t)r * row_step;
+        uint8_t* dst = qm->data + (size_t)r * qm->row_stride;
+
+        for (uint32_t g = 0; g < qm->groups_per_row; g++) {
+            uint32_t start = g * NN_QUANT_GROUP_SIZE;
+            uint32_t end = start + NN_QUANT_GROUP_SIZE < cols ? start + NN_QUANT_GROUP_SIZE : cols;
+
+            // Find the largest magnitude in the group
+            float absmax = 0.0f;
+            for (uint32_t c = start; c < end; c++) {
+                float v = src[c * col_step];
+                float a = v < 0.0f ? -v : v;
+                if (a > absmax) {
+                    absmax = a;
+                }
+            }
+
+            float scale = absmax / (float)qmax;
+            float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+            qm->scales[(size_t)r * qm->groups_per_row + g] = scale;
+
+            // Quantize the group
+            for (uint32_t c = start; c < end; c++) {
+                int q = nn_quant_round(src[c * col_step] * inv_scale, qmin, qmax);
+
+                if (dtype == NN_DTYPE_INT8) {
+                    dst[c] = (uint8_t)(int8_t)q;
+                } else if (c & 1) {
+                    dst[c >> 1] |= (uint8_t)((q + 8) << 4);
+                } else {
+                    dst[c >> 1] |= (uint8_t)(q + 8);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Quantize a row-major matrix [rows][cols]
+ *
+ * @param qm: Quantized matrix to fill
+ * @param weights: Source weights
+ * @param rows: Number of rows
+ * @param cols: Number of columns
+ * @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+ * @return: 0 on success, -1 on failure
+ */
+int nn_qmatrix_quantize(nn_qmatrix_t* qm, const float* weights, uint32_t rows, uint32_t cols, uint32_t dtype) {
+    return nn_qmatrix_quantize_strided(qm, weights, rows, cols, cols, 1, dtype);
+}
+
+/**
+ * Quantize the transpose of a row-major matrix [rows][cols]
+ *
+ * The result has cols rows and rows columns, matching the layout of
+ * quantized MATMUL weight tensors.
+ *
+ * @param qm: Quantized matrix to fill
+ * @param weights: Source weights
+ * @param rows: Number of source rows
+ * @param cols: Number of source columns
+ * @param dtype: NN_DTYPE_INT8 or NN_DTYPE_INT4
+ * @return: 0 on success, -1 on failure
+ */
+int nn_qmatrix_quantize_transposed(nn_qmatrix_t* qm, const float* weights, uint32_t rows, uint32_t cols, uint32_t dtype) {
+    return nn_qmatrix_quantize_strided(qm, weights, cols, rows, 1, cols, dtype);
+}
+
+/**
+ * Free a quantized matrix
+ *
+ * @param qm: Quantized matrix
+ */
+void nn_qmatrix_free(nn_qmatrix_t* qm) {
+    if (!qm) {
+        return;
+    }
+
+    if (qm->scales) {
+        memory_free(qm->scales, qm->alloc_size);
+    }
+
+    memset(qm, 0, sizeof(nn_qmatrix_t));
+}
+
+/**
+ * Multiply a quantized matrix by a vector
+ *
+ * y[r] = sum over groups of scale[r][g] * dot(q[r][g], x[g]). The integer
+ * weights are widened in the inner loop and the scale is applied once per
+ * group.
+ *
+ * @param qm: Quantized matrix [rows][cols]
+ * @param x: Input vector [cols]
+ * @param y: Output vector [rows]
+ */
+void nn_qmatrix_gemv(const nn_qmatrix_t* qm, const float* x, float* y) {
+    nn_qmatrix_gemv_rows(qm, x, y, 0, qm->rows);
+}
+
+/**
+ * Multiply rows [row_begin, row_end) of a quantized matrix by a vector
+ *
+ * Only y[row_begin..row_end) is written, so disjoint row ranges can run in
+ * parallel.
+ *
+ * @param qm: Quantized matrix [rows][cols]
+ * @param x: Input vector [cols]
+ * @param y: Output vector [rows]
+ * @param row_begin: First row
+ * @param row_end: One past the last row
+ */
+void nn_qmatrix_gemv_rows(const nn_qmatrix_t* qm, const float* x, float* y, uint32_t row_begin, uint32_t row_end) {
+    for (uint32_t r = row_begin; r < row_end; r++) {
+        const uint8_t* row = qm->data + (size_t)r * qm->row_stride;
+        const float* scales = qm->scales + (size_t)r * qm->groups_per_row;
+        float sum = 0.0f;
+
+        for (uint32_t g = 0; g < qm->groups_per_row; g++) {
+            uint32_t start = g * qm->group_size;
+            uint32_t end = start + qm->group_size < qm->cols ? start + qm->group_size : qm->cols;
+            float acc = 0.0f;
+
+            if (qm->dtype == NN_DTYPE_INT8) {
+                const int8_t* q = (const int8_t*)row;
+                for (uint32_t c = start; c < end; c++) {
+                    acc += (float)q[c] * x[c];
+                }
+            } else {
+                // Two weights per byte; groups start on even columns
+                uint32_t c = start;
+                for (; c + 1 < end; c += 2) {
+                    uint8_t b = row[c >> 1];
+                    acc += (float)((int)(b & 0x0F) - 8) * x[c];
+                    acc += (float)((int)(b >> 4) - 8) * x[c + 1];
+                }
+                if (c < end) {
+                    acc += (float)((int)(row[c >> 1] & 0x0F) - 8) * x[c];
+                }
+            }
+
+            sum += acc * scales[g];
+        }
+
+        y[r] = sum;
+    }
+}
+
+/**
+ * Dequantize one row of a quantized matrix
+ *
+ * @param qm: Quantized matrix
+ * @param row: Row index
+ * @param out: Output buffer [cols]
+ */
+void nn_qmatrix_dequantize_row(const nn_qmatrix_t* qm, uint32_t row, float* out) {
+    const uint8_t* data = qm->data + (size_t)row * qm->row_stride;
+    const float* scales = qm->scales + (size_t)row * qm->groups_per_row;
+
+    for (uint32_t c = 0; c < qm->cols; c++) {
+        float scale = scales[c / qm->group_size];
+
+        if (qm->dtype == NN_DTYPE_INT8) {
+            out[c] = (float)((const int8_t*)data)[c] * scale;
+        } else {
+            uint8_t b = data[c >> 1];
+            int q = (c & 1) ? (int)(b >> 4) - 8 : (int)(b & 0x0F) - 8;
+            out[c] = (float)q * scale;
+        }
+    }
+}
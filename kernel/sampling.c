@@ -0,0 +1,442 @@
+/**
+ * sampling.c - Token sampling implementation for NeuroOS
+ *
+ * This file implements the token sampler used by the text generators. Top-k
+ * candidates are selected with a bounded min-heap in O(V log k), and top-p
+ * runs over the sorted candidates only, so no step ever sorts the full
+ * vocabulary.
+ */
+
+#include "include/sampling.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/**
+ * Restore the min-heap property below a node
+ *
+ * @param values: Heap values
+ * @param indices: Heap token IDs
+ * @param size: Heap size
+ * @param node: Node to sift down
+ */
+static void sampler_sift_down(float* values, uint32_t* indices, size_t size, size_t node) {
+    while (1) {
+        size_t left = 2 * node + 1;
+        size_t right = left + 1;
+        size_t smallest = node;
+
+        if (left < size && values[left] < values[smallest]) {
+            smallest = left;
+        }
+        if (right < size && values[right] < values[smallest]) {
+            smallest = right;
+        }
+        if (smallest == node) {
+            return;
+        }
+
+        // Swap the node with its smallest child
+        float tmp_value = values[node];
+        values[node] = values[smallest];
+        values[smallest] = tmp_value;
+
+        uint32_t tmp_index = indices[node];
+        indices[node] = indices[smallest];
+        indices[smallest] = tmp_index;
+
+        node = smallest;
+    }
+}
+
+/**
+ * Select the k largest logits
+ *
+ * On return the candidates are sorted in descending order of logit.
+ *
+ * @param sampler: Sampler state
+ * @param logits: Logits array
+ * @param k: Number of candidates to select
+ * @return: Number of candidates selected
+ */
+static size_t sampler_select_top_k(sampler_t* sampler, const float* logits, size_t k) {
+    float* values = sampler->values;
+    uint32_t* indices = sampler->indices;
+    size_t size = 0;
+
+    // Fill the heap with the first k logits
+    for (; size < k && size < sampler->vocab_size; size++) {
+        values[size] = logits[size];
+        indices[size] = (uint32_t)size;
+    }
+
+    // Heapify
+    for (size_t i = size / 2; i-- > 0;) {
+        sampler_sift_down(values, indices, size, i);
+    }
+
+    // Replace the smallest candidate whenever a larger logit shows up
+    for (size_t i = size; i < sampler->vocab_size; i++) {
+        if (logits[i] > values[0]) {
+            values[0] = logits[i];
+            indices[0] = (uint32_t)i;
+            sampler_sift_down(values, indices, size, 0);
+        }
+    }
+
+    // Heap sort; popping the minimum to the back leaves the candidates in descending order
+    for (size_t end = size; end > 1; end--) {
+        float tmp_value = values[0];
+        values[0] = values[end - 1];
+        values[end - 1] = tmp_value;
+
+        uint32_t tmp_index = indices[0];
+        indices[0] = indices[end - 1];
+        indices[end - 1] = tmp_index;
+
+        sampler_sift_down(values, indices, end - 1, 0);
+    }
+
+    return size;
+}
+
+/**
+ * Apply the repetition penalty to tokens present in the context
+ *
+ * Each distinct token is penalized once, however often it appears.
+ *
+ * @param sampler: Sampler state
+ * @param logits: Logits array
+ * @param penalty: Repetition penalty
+ * @param context: Context tokens
+ * @param context_size: Number of context tokens
+ */
+static void sampler_apply_repetition_penalty(sampler_t* sampler, float* logits, float penalty,
+                                             const uint32_t* context, size_t context_size) {
+    for (size_t i = 0; i < context_size; i++) {
+        uint32_t token = context[i];
+        if (token >= sampler->vocab_size) {
+            continue;
+        }
+
+        uint32_t bit = 1u << (token & 31);
+        if (sampler->seen[token >> 5] & bit) {
+            continue;
+        }
+        sampler->seen[token >> 5] |= bit;
+
+        // Push the logit towards "less likely" regardless of its sign
+        if (logits[token] > 0.0f) {
+            logits[token] /= penalty;
+        } else {
+            logits[token] *= penalty;
+        }
+    }
+
+    // Clear only the bits that were set
+    for (size_t i = 0; i < context_size; i++) {
+        if (context[i] < sampler->vocab_size) {
+            sampler->seen[context[i] >> 5] = 0;
+        }
+    }
+}
+
+/**
+ * Initialize a sampler
+ *
+ * @param sampler: Sampler state
+ * @param vocab_size: Vocabulary size
+ * @param top_k: Top-k parameter of the generation (sizes the candidate buffers)
+ * @return: 0 on success, -1 on failure
+ */
+int sampler_init(sampler_t* sampler, size_t vocab_size, int top_k) {
+    if (!sampler || vocab_size == 0) {
+        console_printf("Error: Invalid parameters for sampler_init\n");
+        return -1;
+    }
+
+    memset(sampler, 0, sizeof(sampler_t));
+
+    // Size the candidate buffers for the requested top-k
+    size_t max_candidates = SAMPLER_DEFAULT_CANDIDATES;
+    if (top_k > 0 && (size_t)top_k > max_candidates) {
+        max_candidates = (size_t)top_k;
+    }
+    if (max_candidates > vocab_size) {
+        max_candidates = vocab_size;
+    }
+
+    // Allocate all scratch buffers as a single block
+    size_t seen_words = (vocab_size + 31) / 32;
+    size_t alloc_size = max_candidates * (sizeof(uint32_t) + sizeof(float)) + seen_words * sizeof(uint32_t);
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for sampler\n");
+        return -1;
+    }
+
+    sampler->vocab_size = vocab_size;
+    sampler->max_candidates = max_candidates;
+    sampler->values = (float*)block;
+    sampler->indices = (uint32_t*)(block + max_candidates * sizeof(float));
+    sampler->seen = (uint32_t*)(block + max_candidates * (sizeof(float) + sizeof(uint32_t)));
+    sampler->alloc_size = alloc_size;
+
+    return 0;
+}
+
+/**
+ * Free a sampler
+ *
+ * @param sampler: Sampler state
+ */
+void sampler_free(sampler_t* sampler) {
+    if (!sampler) {
+        return;
+    }
+
+    if (sampler->values) {
+        memory_free(sampler->values, sampler->alloc_size);
+    }
+
+    memset(sampler, 0, sizeof(sampler_t));
+}
+
+/**
+ * Find the token with the largest logit
+ *
+ * @param logits: Logits array
+ * @param vocab_size: Vocabulary size
+ * @return: Token ID
+ */
+uint32_t sampler_argmax(const float* logits, size_t vocab_size) {
+    uint32_t best_token = 0;
+    float best_logit = logits[0];
+
+    for (size_t i = 1; i < vocab_size; i++) {
+        if (logits[i] > best_logit) {
+            best_logit = logits[i];
+            best_token = (uint32_t)i;
+        }
+    }
+
+    return best_token;
+}
+
+/**
+ * Turn logits into the weights of the sampling distribution
+ *
+ * The pipeline is repetition penalty -> temperature -> top-k -> top-p. Top-p
+ * is normalized over the top-k candidates when top-k is enabled, and over
+ * the full vocabulary otherwise; in that case the nucleus is searched within
+ * the SAMPLER_DEFAULT_CANDIDATES most likely tokens. The logits array is
+ * modified in place.
+ *
+ * @param sampler: Sampler state
+ * @param logits: Logits array [vocab_size]
+ * @param params: Sampling parameters
+ * @param context: Context tokens for the repetition penalty (may be NULL)
+ * @param context_size: Number of context tokens
+ * @param total: Pointer to store the sum of the weights
+ * @return: Number of candidates in sampler->indices / sampler->values, or 0
+ *          when the weights of the whole vocabulary were stored in logits
+ */
+static size_t sampler_weights(sampler_t* sampler, float* logits, const sampler_params_t* params,
+                              const uint32_t* context, size_t context_size, float* total) {
+    size_t vocab_size = sampler->vocab_size;
+
+    // Apply the repetition penalty
+    if (context && context_size > 0 && params->repetition_penalty > 1.0f) {
+        sampler_apply_repetition_penalty(sampler, logits, params->repetition_penalty, context, context_size);
+    }
+
+    // Greedy decoding puts all the weight on the best token
+    if (params->temperature <= 0.0f) {
+        sampler->indices[0] = sampler_argmax(logits, vocab_size);
+        sampler->values[0] = 1.0f;
+        *total = 1.0f;
+        return 1;
+    }
+
+    float inv_temperature = 1.0f / params->temperature;
+    int use_top_k = params->top_k > 0 && (size_t)params->top_k < vocab_size;
+    int use_top_p = params->top_p > 0.0f && params->top_p < 1.0f;
+
+    // Without truncation, the full distribution is used in O(V)
+    if (!use_top_k && !use_top_p) {
+        float max_logit = logits[sampler_argmax(logits, vocab_size)];
+        float sum = 0.0f;
+
+        for (size_t i = 0; i < vocab_size; i++) {
+            logits[i] = expf((logits[i] - max_logit) * inv_temperature);
+            sum += logits[i];
+        }
+
+        *total = sum;
+        return 0;
+    }
+
+    // Select the candidates
+    size_t k = use_top_k ? (size_t)params->top_k : sampler->max_candidates;
+    if (k > sampler->max_candidates) {
+        k = sampler->max_candidates;
+    }
+
+    size_t num_candidates = sampler_select_top_k(sampler, logits, k);
+    float* probs = sampler->values;
+    float max_logit = probs[0];
+
+    // Convert the candidates to unnormalized probabilities
+    float candidate_sum = 0.0f;
+    for (size_t i = 0; i < num_candidates; i++) {
+        probs[i] = expf((probs[i] - max_logit) * inv_temperature);
+        candidate_sum += probs[i];
+    }
+
+    // Apply top-p over the candidates
+    *total = candidate_sum;
+    if (use_top_p) {
+        // Without top-k, the nucleus is a fraction of the full distribution
+        float norm = candidate_sum;
+        if (!use_top_k) {
+            norm = 0.0f;
+            for (size_t i = 0; i < vocab_size; i++) {
+                norm += expf((logits[i] - max_logit) * inv_temperature);
+            }
+        }
+
+        float threshold = params->top_p * norm;
+        float cumulative = 0.0f;
+        size_t nucleus_size = 0;
+
+        while (nucleus_size < num_candidates) {
+            cumulative += probs[nucleus_size++];
+            if (cumulative >= threshold) {
+                break;
+            }
+        }
+
+        num_candidates = nucleus_size;
+        *total = cumulative;
+    }
+
+    return num_candidates;
+}
+
+/**
+ * Sample a token from logits
+ *
+ * The distribution is the one built by sampler_weights. The logits array is
+ * modified in place.
+ *
+ * @param sampler: Sampler state
+ * @param logits: Logits array [vocab_size]
+ * @param params: Sampling parameters
+ * @param context: Context tokens for the repetition penalty (may be NULL)
+ * @param context_size: Number of context tokens
+ * @return: Sampled token
+ */
+uint32_t sampler_sample(sampler_t* sampler, float* logits, const sampler_params_t* params,
+                        const uint32_t* context, size_t context_size) {
+    float total;
+    size_t num_candidates = sampler_weights(sampler, logits, params, context, context_size, &total);
+
+    // Greedy decoding
+    if (params->temperature <= 0.0f) {
+        return sampler->indices[0];
+    }
+
+    // Draw from the full distribution
+    if (num_candidates == 0) {
+        float target = ((float)rand() / RAND_MAX) * total;
+        float cumulative = 0.0f;
+
+        for (size_t i = 0; i < sampler->vocab_size; i++) {
+            cumulative += logits[i];
+            if (target <= cumulative) {
+                return (uint32_t)i;
+            }
+        }
+
+        return (uint32_t)(sampler->vocab_size - 1);
+    }
+
+    // Draw from the remaining candidates
+    float* probs = sampler->values;
+    float target = ((float)rand() / RAND_MAX) * total;
+    float cumulative = 0.0f;
+
+    for (size_t i = 0; i < num_candidates; i++) {
+        cumulative += probs[i];
+        if (target <= cumulative) {
+            return sampler->indices[i];
+        }
+    }
+
+    return sampler->indices[num_candidates > 0 ? num_candidates - 1 : 0];
+}
+
+/**
+ * Compute the distribution sampler_sample would draw a token from
+ *
+ * The logits array is modified in place.
+ *
+ * @param sampler: Sampler state
+ * @param logits: Logits array [vocab_size]
+ * @param params: Sampling parameters
+ * @param context: Context tokens for the repetition penalty (may be NULL)
+ * @param context_size: Number of context tokens
+ * @param probs: Buffer to store the normalized probabilities [vocab_size]
+ */
+void sampler_probs(sampler_t* sampler, float* logits, const sampler_params_t* params,
+                   const uint32_t* context, size_t context_size, float* probs) {
+    float total;
+    size_t num_candidates = sampler_weights(sampler, logits, params, context, context_size, &total);
+    float inv_total = total > 0.0f ? 1.0f / total : 0.0f;
+
+    if (num_candidates == 0) {
+        for (size_t i = 0; i < sampler->vocab_size; i++) {
+            probs[i] = logits[i] * inv_total;
+        }
+        return;
+    }
+
+    memset(probs, 0, sampler->vocab_size * sizeof(float));
+    for (size_t i = 0; i < num_candidates; i++) {
+        probs[sampler->indices[i]] = sampler->values[i] * inv_total;
+    }
+}
+
+/**
+ * Draw a token from a probability distribution
+ *
+ * @param probs: Probabilities [vocab_size], need not be normalized
+ * @param vocab_size: Vocabulary size
+ * @return: Sampled token
+ */
+uint32_t sampler_draw(const float* probs, size_t vocab_size) {
+    float total = 0.0f;
+    uint32_t last = 0;
+
+    for (size_t i = 0; i < vocab_size; i++) {
+        total += probs[i];
+        if (probs[i] > 0.0f) {
+            last = (uint32_t)i;
+        }
+    }
+
+    float target = ((float)rand() / RAND_MAX) * total;
+    float cumulative = 0.0f;
+
+    for (size_t i = 0; i < vocab_size; i++) {
+        cumulative += probs[i];
+        if (probs[i] > 0.0f && target <= cumulative) {
+            return (uint32_t)i;
+        }
+    }
+
+    return last;
+}
@@ -108,6 +108,64 @@ typedef struct {
     env_var_t env_vars[32];
 } sandbox_process_state_t;
 
+// Range of a memory snapshot watched for writes
+typedef struct {
+    uintptr_t start;                // Page-aligned
+    size_t size;
+    memory_prot_t protection;       // Protection of the range outside the watch
+} sandbox_memory_watch_t;
+
+// Page saved by a memory snapshot before its first write
+typedef struct {
+    uintptr_t address;              // Page address
+    uintptr_t frame;                // Frame holding the page as it was
+} sandbox_saved_page_t;
+
+// Saved page records per block (one frame each)
+#define SANDBOX_SAVED_PER_BLOCK ((MEMORY_PAGE_SIZE - 2 * sizeof(uintptr_t)) / sizeof(sandbox_saved_page_t))
+
+// Block of saved page records
+typedef struct sandbox_saved_block {
+    struct sandbox_saved_block* next;
+    uint32_t count;
+    sandbox_saved_page_t pages[SANDBOX_SAVED_PER_BLOCK];
+} sandbox_saved_block_t;
+
+// Copy-on-write memory snapshot
+typedef struct {
+    int num_regions;
+    memory_region_t* regions;       // Regions of the process, by address
+    int num_watches;
+    sandbox_memory_watch_t* watches;
+    sandbox_saved_block_t* saved;   // Pages written since the snapshot
+    size_t num_saved;
+    int eager;                      // Paging is off: every page is saved up front
+} sandbox_memory_snapshot_t;
+
+// Longest path the filesystem overlay handles
+#define SANDBOX_OVERLAY_PATH_MAX 256
+
+// Hash buckets of a filesystem overlay
+#define SANDBOX_OVERLAY_BUCKETS 64
+
+// Overlay entry flags
+#define SANDBOX_OVERLAY_WHITEOUT 0x01   // Removed in the sandbox
+
+// File in the upper layer of a filesystem overlay
+typedef struct sandbox_overlay_entry {
+    struct sandbox_overlay_entry* next;
+    uint32_t hash;
+    uint32_t flags;
+    char path[SANDBOX_OVERLAY_PATH_MAX]; // Relative to the root
+} sandbox_overlay_entry_t;
+
+// Filesystem overlay: the sandbox's writes, on top of the system files
+typedef struct {
+    char upper[64];                 // Directory holding the upper layer
+    sandbox_overlay_entry_t* buckets[SANDBOX_OVERLAY_BUCKETS];
+    size_t num_entries;
+} sandbox_overlay_t;
+
 // Maximum number of sandboxes
 #define MAX_SANDBOXES 16
 
@@ -120,8 +178,8 @@ typedef struct {
     sandbox_config_t config;
     sandbox_state_t stats;
     int initial_process;
-    void* memory_snapshot;
-    void* filesystem_snapshot;
+    sandbox_memory_snapshot_t* memory_snapshot;
+    sandbox_overlay_t* overlay;
     void* network_snapshot;
     void* device_snapshot;
 } sandbox_t;
@@ -135,12 +193,13 @@ static sandbox_id_t next_sandbox_id = 1;
 // Forward declarations
 static int sandbox_check_limits(sandbox_id_t id);
 static int sandbox_create_snapshots(sandbox_id_t id);
+static void sandbox_free_memory_snapshot(sandbox_memory_snapshot_t* snapshot);
+static size_t sandbox_overlay_discard(sandbox_overlay_t* overlay);
 static int sandbox_restore_snapshots(sandbox_id_t id);
 static int sandbox_check_syscalls(sandbox_id_t id);
 static int sandbox_check_network_access(sandbox_id_t id);
 static int sandbox_check_file_access(sandbox_id_t id);
 static int sandbox_check_memory_access(sandbox_id_t id);
-static int sandbox_get_modified_files(sandbox_id_t id, char*** modified_files, size_t* num_modified_files);
 static int sandbox_apply_process_changes(sandbox_id_t id);
 static int sandbox_apply_network_changes(sandbox_id_t id);
 
@@ -231,14 +290,15 @@ int sandbox_destroy(uint32_t id) {
         sandbox_terminate(id);
     }
     
-    // Free the memory snapshots
+    // Free the memory snapshot, ending its write watches
     if (sandbox->memory_snapshot) {
-        memory_free(sandbox->memory_snapshot, 0); // Size is unknown
+        sandbox_free_memory_snapshot(sandbox->memory_snapshot);
     }
     
-    // Free the filesystem snapshots
-    if (sandbox->filesystem_snapshot) {
-        memory_free(sandbox->filesystem_snapshot, 0); // Size is unknown
+    // Discard the filesystem overlay
+    if (sandbox->overlay) {
+        sandbox_overlay_discard(sandbox->overlay);
+        memory_free(sandbox->overlay, sizeof(sandbox_overlay_t));
     }
     
     // Free the network snapshots
@@ -497,9 +557,160 @@ int sandbox_set_config(uint32_t id, const sandbox_config_t* config) {
     return 0;
 }
 
+/**
+ * Release the saved pages of a memory snapshot
+ * 
+ * @param snapshot: Memory snapshot
+ */
+static void sandbox_release_saved_pages(sandbox_memory_snapshot_t* snapshot) {
+    sandbox_saved_block_t* block = snapshot->saved;
+    
+    while (block) {
+        sandbox_saved_block_t* next = block->next;
+        
+        for (uint32_t i = 0; i < block->count; i++) {
+            memory_free_physical(block->pages[i].frame, 1);
+        }
+        
+        memory_free_physical((uintptr_t)block, 1);
+        block = next;
+    }
+    
+    snapshot->saved = NULL;
+    snapshot->num_saved = 0;
+}
+
+/**
+ * Save a page of a memory snapshot before its first write (write watch handler)
+ * 
+ * Runs in the page fault, so the copy and its record go into physical
+ * frames (identity-mapped) rather than the kernel heap, whose lock the
+ * faulting code may hold.
+ * 
+ * @param ctx: Memory snapshot
+ * @param page: Page about to be written
+ * @return: 0 on success, -1 if the page could not be saved
+ */
+static int sandbox_save_page(void* ctx, uintptr_t page) {
+    sandbox_memory_snapshot_t* snapshot = (sandbox_memory_snapshot_t*)ctx;
+    sandbox_saved_block_t* block = snapshot->saved;
+    
+    if (!block || block->count == SANDBOX_SAVED_PER_BLOCK) {
+        uintptr_t frame = memory_alloc_physical(1, 0);
+        
+        if (!frame) {
+            console_printf("Error: Out of memory saving sandbox page %p\n", (void*)page);
+            return -1;
+        }
+        
+        block = (sandbox_saved_block_t*)frame;
+        block->next = snapshot->saved;
+        block->count = 0;
+        snapshot->saved = block;
+    }
+    
+    uintptr_t frame = memory_alloc_physical(1, 0);
+    
+    if (!frame) {
+        console_printf("Error: Out of memory saving sandbox page %p\n", (void*)page);
+        return -1;
+    }
+    
+    memcpy((void*)frame, (const void*)page, MEMORY_PAGE_SIZE);
+    
+    block->pages[block->count].address = page;
+    block->pages[block->count].frame = frame;
+    block->count++;
+    snapshot->num_saved++;
+    
+    return 0;
+}
+
+/**
+ * Write-protect the watched ranges of a memory snapshot
+ * 
+ * Without paging no write fault ever fires, so the pages are saved right
+ * away instead.
+ * 
+ * @param snapshot: Memory snapshot
+ * @return: 0 on success, -1 on failure
+ */
+static int sandbox_watch_memory(sandbox_memory_snapshot_t* snapshot) {
+    if (snapshot->eager) {
+        for (int i = 0; i < snapshot->num_watches; i++) {
+            sandbox_memory_watch_t* watch = &snapshot->watches[i];
+            
+            for (uintptr_t page = watch->start; page < watch->start + watch->size; page += MEMORY_PAGE_SIZE) {
+                if (sandbox_save_page(snapshot, page) != 0) {
+                    sandbox_release_saved_pages(snapshot);
+                    return -1;
+                }
+            }
+        }
+        
+        return 0;
+    }
+    
+    for (int i = 0; i < snapshot->num_watches; i++) {
+        sandbox_memory_watch_t* watch = &snapshot->watches[i];
+        
+        if (memory_watch_writes((void*)watch->start, watch->size, watch->protection,
+                                sandbox_save_page, snapshot) != 0) {
+            // Leave the ranges watched so far as they were
+            while (--i >= 0) {
+                memory_unwatch_writes((void*)snapshot->watches[i].start);
+            }
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * End the write watches of a memory snapshot
+ * 
+ * @param snapshot: Memory snapshot
+ */
+static void sandbox_unwatch_memory(sandbox_memory_snapshot_t* snapshot) {
+    if (snapshot->eager) {
+        return;
+    }
+    
+    for (int i = 0; i < snapshot->num_watches; i++) {
+        memory_unwatch_writes((void*)snapshot->watches[i].start);
+    }
+}
+
+/**
+ * Free a memory snapshot, ending its write watches
+ * 
+ * @param snapshot: Memory snapshot
+ */
+static void sandbox_free_memory_snapshot(sandbox_memory_snapshot_t* snapshot) {
+    sandbox_unwatch_memory(snapshot);
+    
+    sandbox_release_saved_pages(snapshot);
+    
+    if (snapshot->regions) {
+        memory_free(snapshot->regions, snapshot->num_regions * sizeof(memory_region_t));
+    }
+    
+    if (snapshot->watches) {
+        memory_free(snapshot->watches, snapshot->num_regions * sizeof(sandbox_memory_watch_t));
+    }
+    
+    memory_free(snapshot, sizeof(sandbox_memory_snapshot_t));
+}
+
 /**
  * Create a memory snapshot for rollback
  * 
+ * Nothing is copied up front: the writable regions of the process are
+ * write-protected, and each page is copied on its first write. The cost of
+ * a snapshot is therefore the pages the sandboxed code actually writes.
+ * While paging is off, writes cannot fault and every page is copied.
+ * 
  * @param id: Sandbox ID
  * @return: 0 on success, -1 on failure
  */
@@ -515,67 +726,101 @@ static int sandbox_create_memory_snapshot(sandbox_id_t id) {
     
     // Free the previous snapshot if it exists
     if (sandbox->memory_snapshot) {
-        memory_free(sandbox->memory_snapshot, 0); // Size is unknown
+        sandbox_free_memory_snapshot(sandbox->memory_snapshot);
         sandbox->memory_snapshot = NULL;
     }
     
     // Get the process memory regions
-    memory_region_t* regions = NULL;
-    int num_regions = 0;
+    int num_regions = process_get_memory_region_count(sandbox->initial_process);
     
-    // Get memory regions from the process
-    if (process_get_memory_regions(sandbox->initial_process, regions, num_regions) != 0) {
+    if (num_regions < 0) {
         console_printf("Error: Failed to get memory regions for process %d\n", sandbox->initial_process);
         return -1;
     }
     
-    // Calculate the total size needed for the snapshot
-    size_t total_size = sizeof(int); // Store the number of regions
+    sandbox_memory_snapshot_t* snapshot = (sandbox_memory_snapshot_t*)memory_alloc(
+        sizeof(sandbox_memory_snapshot_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
     
-    for (int i = 0; i < num_regions; i++) {
-        total_size += sizeof(memory_region_t); // Region metadata
-        total_size += regions[i].size; // Region data
+    if (!snapshot) {
+        console_printf("Error: Failed to allocate memory snapshot\n");
+        return -1;
     }
     
-    // Allocate memory for the snapshot
-    sandbox->memory_snapshot = memory_alloc(total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    snapshot->num_regions = num_regions;
+    snapshot->eager = !memory_paging_enabled();
     
-    if (!sandbox->memory_snapshot) {
-        console_printf("Error: Failed to allocate memory snapshot\n");
-        // Free the regions
-        if (regions) {
-            memory_free(regions, num_regions * sizeof(memory_region_t));
+    if (num_regions > 0) {
+        snapshot->regions = (memory_region_t*)memory_alloc(num_regions * sizeof(memory_region_t),
+                                                           MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+        snapshot->watches = (sandbox_memory_watch_t*)memory_alloc(num_regions * sizeof(sandbox_memory_watch_t),
+                                                                  MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+        
+        if (!snapshot->regions || !snapshot->watches ||
+            process_get_memory_regions(sandbox->initial_process, snapshot->regions, num_regions) != 0) {
+            console_printf("Error: Failed to get memory regions for process %d\n", sandbox->initial_process);
+            sandbox_free_memory_snapshot(snapshot);
+            return -1;
         }
-        return -1;
     }
     
-    // Store the number of regions at the beginning of the snapshot
-    *((int*)sandbox->memory_snapshot) = num_regions;
+    // Sort the regions by address so whole pages can be assigned to one watch
+    memory_region_t* regions = snapshot->regions;
+    
+    for (int i = 1; i < num_regions; i++) {
+        memory_region_t region = regions[i];
+        int j = i - 1;
+        
+        while (j >= 0 && regions[j].start > region.start) {
+            regions[j + 1] = regions[j];
+            j--;
+        }
+        
+        regions[j + 1] = region;
+    }
     
-    // Copy the region metadata and data
-    char* snapshot_ptr = (char*)sandbox->memory_snapshot + sizeof(int);
+    // Watch the pages of the writable regions; a page shared with the
+    // previous region is already watched
+    uintptr_t watched_end = 0;
+    size_t watched_size = 0;
     
     for (int i = 0; i < num_regions; i++) {
-        // Copy the region metadata
-        memory_region_t* region_metadata = (memory_region_t*)snapshot_ptr;
-        *region_metadata = regions[i];
-        snapshot_ptr += sizeof(memory_region_t);
-        
-        // Copy the region data
-        if (regions[i].flags & MEMORY_PROT_READ) {
-            memcpy(snapshot_ptr, (void*)(uintptr_t)regions[i].start, regions[i].size);
-        } else {
-            // If the region is not readable, just zero it out
-            memset(snapshot_ptr, 0, regions[i].size);
+        if (!(regions[i].flags & MEMORY_PROT_WRITE) || regions[i].size == 0) {
+            continue;
         }
-        snapshot_ptr += regions[i].size;
+        
+        uintptr_t start = (uintptr_t)regions[i].start & ~(uintptr_t)(MEMORY_PAGE_SIZE - 1);
+        uintptr_t end = ((uintptr_t)(regions[i].start + regions[i].size) + MEMORY_PAGE_SIZE - 1) &
+                        ~(uintptr_t)(MEMORY_PAGE_SIZE - 1);
+        
+        if (start < watched_end) {
+            start = watched_end;
+        }
+        
+        if (start >= end) {
+            continue;
+        }
+        
+        sandbox_memory_watch_t* watch = &snapshot->watches[snapshot->num_watches++];
+        watch->start = start;
+        watch->size = end - start;
+        watch->protection = regions[i].flags & (MEMORY_PROT_READ | MEMORY_PROT_WRITE |
+                                               MEMORY_PROT_EXEC | MEMORY_PROT_USER);
+        
+        watched_end = end;
+        watched_size += watch->size;
+    }
+    
+    if (sandbox_watch_memory(snapshot) != 0) {
+        console_printf("Error: Failed to write-protect memory of process %d\n", sandbox->initial_process);
+        snapshot->num_watches = 0;
+        sandbox_free_memory_snapshot(snapshot);
+        return -1;
     }
     
-    // Free the regions
-    memory_free(regions, num_regions * sizeof(memory_region_t));
+    sandbox->memory_snapshot = snapshot;
     
-    console_printf("Created memory snapshot for sandbox %u with %d regions (%zu bytes)\n", 
-                  id, num_regions, total_size);
+    console_printf("Created memory snapshot for sandbox %u with %d regions (%u bytes watched)\n",
+                  id, num_regions, (unsigned int)watched_size);
     
     return 0;
 }
@@ -583,6 +828,11 @@ static int sandbox_create_memory_snapshot(sandbox_id_t id) {
 /**
  * Rollback to a memory snapshot
  * 
+ * Only the pages written since the snapshot are copied back (all of them
+ * while paging is off), and only the bytes of them that belong to the
+ * process's regions. The snapshot is
+ * then armed again, so a later rollback returns to the same state.
+ * 
  * @param id: Sandbox ID
  * @return: 0 on success, -1 on failure
  */
@@ -597,195 +847,482 @@ static int sandbox_rollback_memory(sandbox_id_t id) {
     sandbox_t* sandbox = sandbox_table[id];
     
     // Check if a snapshot exists
-    if (!sandbox->memory_snapshot) {
+    sandbox_memory_snapshot_t* snapshot = sandbox->memory_snapshot;
+    
+    if (!snapshot) {
         console_printf("Error: No memory snapshot available\n");
         return -1;
     }
     
-    // Get the number of regions from the snapshot
-    int num_regions = *((int*)sandbox->memory_snapshot);
+    // Stop watching; the saved pages are writable again already
+    sandbox_unwatch_memory(snapshot);
     
-    // Restore each memory region
-    char* snapshot_ptr = (char*)sandbox->memory_snapshot + sizeof(int);
+    // Copy back the saved pages
+    size_t num_saved = snapshot->num_saved;
     
-    for (int i = 0; i < num_regions; i++) {
-        // Get the region metadata
-        memory_region_t* region_metadata = (memory_region_t*)snapshot_ptr;
-        snapshot_ptr += sizeof(memory_region_t);
-        
-        // Check if the region is writable
-        if (region_metadata->flags & MEMORY_PROT_WRITE) {
-            // Restore the region data
-            memcpy((void*)(uintptr_t)region_metadata->start, snapshot_ptr, region_metadata->size);
+    for (sandbox_saved_block_t* block = snapshot->saved; block; block = block->next) {
+        for (uint32_t i = 0; i < block->count; i++) {
+            uintptr_t page = block->pages[i].address;
+            const uint8_t* copy = (const uint8_t*)block->pages[i].frame;
+            
+            for (int r = 0; r < snapshot->num_regions; r++) {
+                uintptr_t start = (uintptr_t)snapshot->regions[r].start;
+                uintptr_t end = start + (uintptr_t)snapshot->regions[r].size;
+                
+                if (start < page) {
+                    start = page;
+                }
+                
+                if (end > page + MEMORY_PAGE_SIZE) {
+                    end = page + MEMORY_PAGE_SIZE;
+                }
+                
+                if (start < end && (snapshot->regions[r].flags & MEMORY_PROT_WRITE)) {
+                    memcpy((void*)start, copy + (start - page), end - start);
+                }
+            }
         }
-        
-        // Move to the next region
-        snapshot_ptr += region_metadata->size;
     }
     
-    console_printf("Restored memory snapshot for sandbox %u with %d regions\n", id, num_regions);
+    sandbox_release_saved_pages(snapshot);
+    
+    // Arm the snapshot again
+    if (sandbox_watch_memory(snapshot) != 0) {
+        console_printf("Error: Failed to write-protect memory of process %d\n", sandbox->initial_process);
+        snapshot->num_watches = 0;
+        sandbox_free_memory_snapshot(snapshot);
+        sandbox->memory_snapshot = NULL;
+        return -1;
+    }
+    
+    console_printf("Restored memory snapshot for sandbox %u (%u pages)\n", id, (unsigned int)num_saved);
     
     return 0;
 }
 
 /**
- * Create a filesystem snapshot for rollback
+ * Hash an overlay path
  * 
- * @param id: Sandbox ID
- * @return: 0 on success, -1 on failure
+ * @param path: Path relative to the root
+ * @return: Hash of the path
  */
-static int sandbox_create_filesystem_snapshot(sandbox_id_t id) {
-    // Check if the sandbox ID is valid
-    if (id >= MAX_SANDBOXES || !sandbox_table[id]) {
-        console_printf("Error: Invalid sandbox ID\n");
-        return -1;
+static uint32_t sandbox_overlay_hash(const char* path) {
+    uint32_t hash = 2166136261u;
+    
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 16777619u;
     }
     
-    // Get the sandbox
-    sandbox_t* sandbox = sandbox_table[id];
+    return hash;
+}
+
+/**
+ * Turn a path into the form the overlay keys its entries by
+ * 
+ * Leading slashes are dropped, so "/etc/x" and "etc/x" name the same file.
+ * Paths that could leave the upper layer ("..") are refused.
+ * 
+ * @param path: Path as given
+ * @return: Path relative to the root, NULL if it is not valid
+ */
+static const char* sandbox_overlay_key(const char* path) {
+    if (!path) {
+        return NULL;
+    }
     
-    // Free the previous snapshot if it exists
-    if (sandbox->filesystem_snapshot) {
-        memory_free(sandbox->filesystem_snapshot, 0); // Size is unknown
-        sandbox->filesystem_snapshot = NULL;
+    while (*path == '/') {
+        path++;
     }
     
-    // Get the process file descriptors
-    int* fds = NULL;
-    int num_fds = 0;
+    size_t length = strlen(path);
     
-    // Get file descriptors count first
-    if (process_get_file_descriptors(sandbox->initial_process, NULL, 0) != 0) {
-        console_printf("Error: Failed to get file descriptor count for process %d\n", sandbox->initial_process);
-        return -1;
+    if (length == 0 || length >= SANDBOX_OVERLAY_PATH_MAX) {
+        return NULL;
     }
     
-    // We need to determine num_fds another way since the function doesn't return it
-    num_fds = process_get_file_descriptor_count(sandbox->initial_process);
-    if (num_fds < 0) {
-        console_printf("Error: Failed to get file descriptor count for process %d\n", sandbox->initial_process);
-        return -1;
+    // Refuse ".." components
+    for (const char* component = path; component; ) {
+        if (component[0] == '.' && component[1] == '.' && (component[2] == '/' || component[2] == '\0')) {
+            return NULL;
+        }
+        
+        component = strchr(component, '/');
+        
+        if (component) {
+            component++;
+        }
     }
     
-    // Allocate memory for file descriptors
-    if (num_fds > 0) {
-        fds = (int*)memory_alloc(num_fds * sizeof(int), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
-        if (!fds) {
-            console_printf("Error: Failed to allocate memory for file descriptors\n");
-            return -1;
+    return path;
+}
+
+/**
+ * Find the overlay entry of a path
+ * 
+ * @param overlay: Filesystem overlay
+ * @param key: Path relative to the root
+ * @param hash: Hash of the path
+ * @return: Overlay entry, NULL if the path is not in the upper layer
+ */
+static sandbox_overlay_entry_t* sandbox_overlay_find(sandbox_overlay_t* overlay, const char* key, uint32_t hash) {
+    sandbox_overlay_entry_t* entry = overlay->buckets[hash % SANDBOX_OVERLAY_BUCKETS];
+    
+    while (entry) {
+        if (entry->hash == hash && strcmp(entry->path, key) == 0) {
+            return entry;
         }
         
-        // Get the actual file descriptors
-        if (process_get_file_descriptors(sandbox->initial_process, fds, num_fds) != 0) {
-            console_printf("Error: Failed to get file descriptors for process %d\n", sandbox->initial_process);
-            memory_free(fds, num_fds * sizeof(int));
-            return -1;
+        entry = entry->next;
+    }
+    
+    return NULL;
+}
+
+/**
+ * Add an overlay entry for a path
+ * 
+ * @param overlay: Filesystem overlay
+ * @param key: Path relative to the root
+ * @param hash: Hash of the path
+ * @return: New overlay entry, NULL on failure
+ */
+static sandbox_overlay_entry_t* sandbox_overlay_add(sandbox_overlay_t* overlay, const char* key, uint32_t hash) {
+    sandbox_overlay_entry_t* entry = (sandbox_overlay_entry_t*)memory_alloc(
+        sizeof(sandbox_overlay_entry_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    
+    if (!entry) {
+        console_printf("Error: Failed to allocate overlay entry for %s\n", key);
+        return NULL;
+    }
+    
+    entry->hash = hash;
+    entry->flags = 0;
+    strncpy(entry->path, key, sizeof(entry->path) - 1);
+    entry->path[sizeof(entry->path) - 1] = '\0';
+    
+    entry->next = overlay->buckets[hash % SANDBOX_OVERLAY_BUCKETS];
+    overlay->buckets[hash % SANDBOX_OVERLAY_BUCKETS] = entry;
+    overlay->num_entries++;
+    
+    return entry;
+}
+
+/**
+ * Remove an overlay entry
+ * 
+ * @param overlay: Filesystem overlay
+ * @param entry: Overlay entry
+ */
+static void sandbox_overlay_remove(sandbox_overlay_t* overlay, sandbox_overlay_entry_t* entry) {
+    sandbox_overlay_entry_t** link = &overlay->buckets[entry->hash % SANDBOX_OVERLAY_BUCKETS];
+    
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    
+    *link = entry->next;
+    overlay->num_entries--;
+    memory_free(entry, sizeof(sandbox_overlay_entry_t));
+}
+
+/**
+ * Create the missing parent directories of a path
+ * 
+ * @param path: Absolute path
+ */
+static void sandbox_make_parents(const char* path) {
+    char parent[SANDBOX_OVERLAY_PATH_MAX + 64];
+    
+    strncpy(parent, path, sizeof(parent) - 1);
+    parent[sizeof(parent) - 1] = '\0';
+    
+    for (char* slash = strchr(parent + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(parent, 0755); // Fails harmlessly if it exists
+        *slash = '/';
+    }
+}
+
+/**
+ * Remove the empty parent directories of an upper-layer path
+ * 
+ * @param overlay: Filesystem overlay
+ * @param path: Absolute path in the upper layer
+ */
+static void sandbox_prune_parents(sandbox_overlay_t* overlay, const char* path) {
+    char parent[SANDBOX_OVERLAY_PATH_MAX + 64];
+    size_t upper_length = strlen(overlay->upper);
+    
+    strncpy(parent, path, sizeof(parent) - 1);
+    parent[sizeof(parent) - 1] = '\0';
+    
+    for (char* slash = strrchr(parent, '/'); slash && (size_t)(slash - parent) > upper_length;
+         slash = strrchr(parent, '/')) {
+        *slash = '\0';
+        
+        if (rmdir(parent) != 0) {
+            break; // Not empty
+        }
+    }
+}
+
+/**
+ * Copy a file, keeping its permissions
+ * 
+ * @param source: Path of the file to copy
+ * @param destination: Path of the copy
+ * @return: 0 on success, -1 on failure
+ */
+static int sandbox_copy_file(const char* source, const char* destination) {
+    FILE *src = fopen(source, "rb");
+    FILE *dst = src ? fopen(destination, "wb") : NULL;
+    
+    if (!src || !dst) {
+        if (src) fclose(src);
+        console_printf("Error: Failed to copy file from %s to %s\n", source, destination);
+        return -1;
+    }
+    
+    char buffer[8192];
+    size_t bytes_read;
+    int result = 0;
+    
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        if (fwrite(buffer, 1, bytes_read, dst) != bytes_read) {
+            console_printf("Error: Failed to write %s\n", destination);
+            result = -1;
+            break;
         }
     }
     
-    // Calculate the total size needed for the snapshot
-    size_t total_size = sizeof(int); // Store the number of file descriptors
+    fclose(src);
+    fclose(dst);
+    
+    // Preserve file permissions
+    struct stat st;
+    if (result == 0 && stat(source, &st) == 0) {
+        chmod(destination, st.st_mode & 0777);
+    }
+    
+    return result;
+}
+
+/**
+ * Discard the upper layer of a filesystem overlay
+ * 
+ * @param overlay: Filesystem overlay
+ * @return: Number of entries discarded
+ */
+static size_t sandbox_overlay_discard(sandbox_overlay_t* overlay) {
+    size_t discarded = overlay->num_entries;
+    char upper_path[SANDBOX_OVERLAY_PATH_MAX + 64];
     
-    // Add space for file descriptor metadata and content
-    for (int i = 0; i < num_fds; i++) {
-        // Get file information
-        char path[256];
-        size_t file_size = 0;
+    for (int i = 0; i < SANDBOX_OVERLAY_BUCKETS; i++) {
+        sandbox_overlay_entry_t* entry = overlay->buckets[i];
         
-        if (process_get_file_path(sandbox->initial_process, fds[i], path, sizeof(path)) == 0) {
-            // Get file size
-            FILE* file = fopen(path, "rb");
-            if (file) {
-                fseek(file, 0, SEEK_END);
-                file_size = ftell(file);
-                fclose(file);
+        while (entry) {
+            sandbox_overlay_entry_t* next = entry->next;
+            
+            if (!(entry->flags & SANDBOX_OVERLAY_WHITEOUT)) {
+                snprintf(upper_path, sizeof(upper_path), "%s/%s", overlay->upper, entry->path);
+                unlink(upper_path);
+                sandbox_prune_parents(overlay, upper_path);
             }
+            
+            memory_free(entry, sizeof(sandbox_overlay_entry_t));
+            entry = next;
         }
         
-        total_size += sizeof(int); // File descriptor
-        total_size += sizeof(size_t); // File size
-        total_size += 256; // Path
-        total_size += file_size; // File content
+        overlay->buckets[i] = NULL;
     }
     
-    // Allocate memory for the snapshot
-    sandbox->filesystem_snapshot = memory_alloc(total_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    overlay->num_entries = 0;
     
-    if (!sandbox->filesystem_snapshot) {
-        console_printf("Error: Failed to allocate filesystem snapshot\n");
-        // Free the file descriptors
-        if (fds) {
-            memory_free(fds, num_fds * sizeof(int));
+    return discarded;
+}
+
+/**
+ * Resolve a path as the sandbox sees it
+ * 
+ * Reads see the upper-layer copy of a file if the sandbox has one, and
+ * the system file otherwise. Writes always land in the upper layer: a
+ * file opened for modification is copied up on first use, one being
+ * created or truncated is not.
+ * 
+ * @param id: Sandbox ID
+ * @param path: Path of the file
+ * @param mode: Access mode (SANDBOX_OVERLAY_READ, _WRITE or _CREATE)
+ * @param resolved: Buffer to store the path to open
+ * @param size: Size of the buffer
+ * @return: 0 on success, -1 on failure or if the file was removed in the sandbox
+ */
+int sandbox_resolve_path(uint32_t id, const char* path, int mode, char* resolved, size_t size) {
+    // Check if the sandbox ID is valid
+    if (id >= MAX_SANDBOXES || !sandbox_table[id]) {
+        console_printf("Error: Invalid sandbox ID\n");
+        return -1;
+    }
+    
+    sandbox_overlay_t* overlay = sandbox_table[id]->overlay;
+    const char* key = sandbox_overlay_key(path);
+    
+    if (!overlay || !key || !resolved) {
+        console_printf("Error: Cannot resolve %s in sandbox %u\n", path ? path : "(null)", id);
+        return -1;
+    }
+    
+    uint32_t hash = sandbox_overlay_hash(key);
+    sandbox_overlay_entry_t* entry = sandbox_overlay_find(overlay, key, hash);
+    
+    // Files the sandbox has written or removed
+    if (entry) {
+        if (entry->flags & SANDBOX_OVERLAY_WHITEOUT) {
+            if (mode != SANDBOX_OVERLAY_CREATE) {
+                return -1;
+            }
+            
+            entry->flags &= ~SANDBOX_OVERLAY_WHITEOUT;
         }
+        
+        snprintf(resolved, size, "%s/%s", overlay->upper, key);
+        
+        if (mode == SANDBOX_OVERLAY_CREATE) {
+            sandbox_make_parents(resolved);
+        }
+        
+        return 0;
+    }
+    
+    // Files the sandbox has not touched
+    snprintf(resolved, size, "/%s", key);
+    
+    if (mode == SANDBOX_OVERLAY_READ) {
+        return 0;
+    }
+    
+    char lower_path[SANDBOX_OVERLAY_PATH_MAX + 1];
+    strncpy(lower_path, resolved, sizeof(lower_path) - 1);
+    lower_path[sizeof(lower_path) - 1] = '\0';
+    
+    snprintf(resolved, size, "%s/%s", overlay->upper, key);
+    sandbox_make_parents(resolved);
+    
+    // Copy the file up so the modification starts from its current content
+    if (mode == SANDBOX_OVERLAY_WRITE && access(lower_path, F_OK) == 0 &&
+        sandbox_copy_file(lower_path, resolved) != 0) {
+        return -1;
+    }
+    
+    return sandbox_overlay_add(overlay, key, hash) ? 0 : -1;
+}
+
+/**
+ * Remove a file as the sandbox sees it
+ * 
+ * The system file is left in place and hidden from the sandbox until its
+ * changes are committed.
+ * 
+ * @param id: Sandbox ID
+ * @param path: Path of the file
+ * @return: 0 on success, -1 on failure
+ */
+int sandbox_remove_path(uint32_t id, const char* path) {
+    // Check if the sandbox ID is valid
+    if (id >= MAX_SANDBOXES || !sandbox_table[id]) {
+        console_printf("Error: Invalid sandbox ID\n");
         return -1;
     }
     
-    // Store the number of file descriptors at the beginning of the snapshot
-    *((int*)sandbox->filesystem_snapshot) = num_fds;
+    sandbox_overlay_t* overlay = sandbox_table[id]->overlay;
+    const char* key = sandbox_overlay_key(path);
+    
+    if (!overlay || !key) {
+        console_printf("Error: Cannot remove %s in sandbox %u\n", path ? path : "(null)", id);
+        return -1;
+    }
     
-    // Copy the file descriptor metadata and content
-    char* snapshot_ptr = (char*)sandbox->filesystem_snapshot + sizeof(int);
+    uint32_t hash = sandbox_overlay_hash(key);
+    sandbox_overlay_entry_t* entry = sandbox_overlay_find(overlay, key, hash);
+    char lower_path[SANDBOX_OVERLAY_PATH_MAX + 1];
     
-    for (int i = 0; i < num_fds; i++) {
-        // Store the file descriptor
-        *((int*)snapshot_ptr) = fds[i];
-        snapshot_ptr += sizeof(int);
+    snprintf(lower_path, sizeof(lower_path), "/%s", key);
+    int in_lower = access(lower_path, F_OK) == 0;
+    
+    if (entry) {
+        if (entry->flags & SANDBOX_OVERLAY_WHITEOUT) {
+            return -1; // Already removed
+        }
         
-        // Get file information
-        char path[256];
-        size_t file_size = 0;
+        char upper_path[SANDBOX_OVERLAY_PATH_MAX + 64];
+        snprintf(upper_path, sizeof(upper_path), "%s/%s", overlay->upper, key);
+        unlink(upper_path);
+        sandbox_prune_parents(overlay, upper_path);
         
-        if (process_get_file_path(sandbox->initial_process, fds[i], path, sizeof(path)) == 0) {
-            // Get file size
-            FILE* file = fopen(path, "rb");
-            if (file) {
-                fseek(file, 0, SEEK_END);
-                file_size = ftell(file);
-                fseek(file, 0, SEEK_SET);
-                
-                // Store the file size
-                *((size_t*)snapshot_ptr) = file_size;
-                snapshot_ptr += sizeof(size_t);
-                
-                // Store the file path
-                strncpy(snapshot_ptr, path, 256);
-                snapshot_ptr += 256;
-                
-                // Read and store the file content
-                if (file_size > 0) {
-                    size_t bytes_read = fread(snapshot_ptr, 1, file_size, file);
-                    if (bytes_read < file_size) {
-                        console_printf("Warning: Only read %zu of %zu bytes from file\n", bytes_read, file_size);
-                    }
-                    snapshot_ptr += file_size;
-                }
-                
-                fclose(file);
-            } else {
-                // No file content
-                *((size_t*)snapshot_ptr) = 0;
-                snapshot_ptr += sizeof(size_t);
-                
-                // Store the file path
-                strncpy(snapshot_ptr, path, 256);
-                snapshot_ptr += 256;
-            }
-        } else {
-            // No file path
-            *((size_t*)snapshot_ptr) = 0;
-            snapshot_ptr += sizeof(size_t);
-            
-            // Empty path
-            memset(snapshot_ptr, 0, 256);
-            snapshot_ptr += 256;
+        // A file the sandbox created just disappears
+        if (!in_lower) {
+            sandbox_overlay_remove(overlay, entry);
+            return 0;
+        }
+    } else {
+        if (!in_lower) {
+            return -1;
+        }
+        
+        entry = sandbox_overlay_add(overlay, key, hash);
+        
+        if (!entry) {
+            return -1;
         }
     }
     
-    // Free the file descriptors
-    memory_free(fds, num_fds * sizeof(int));
+    entry->flags |= SANDBOX_OVERLAY_WHITEOUT;
+    
+    return 0;
+}
+
+/**
+ * Create a filesystem snapshot for rollback
+ * 
+ * The snapshot is an overlay: from here on the sandbox's writes land in
+ * its upper layer, so nothing is copied now. Changes still in the upper
+ * layer from an earlier run are kept until they are committed or rolled
+ * back.
+ * 
+ * @param id: Sandbox ID
+ * @return: 0 on success, -1 on failure
+ */
+static int sandbox_create_filesystem_snapshot(sandbox_id_t id) {
+    // Check if the sandbox ID is valid
+    if (id >= MAX_SANDBOXES || !sandbox_table[id]) {
+        console_printf("Error: Invalid sandbox ID\n");
+        return -1;
+    }
+    
+    // Get the sandbox
+    sandbox_t* sandbox = sandbox_table[id];
+    
+    if (sandbox->overlay) {
+        console_printf("Kept filesystem overlay for sandbox %u with %zu entries\n",
+                      id, sandbox->overlay->num_entries);
+        return 0;
+    }
+    
+    sandbox_overlay_t* overlay = (sandbox_overlay_t*)memory_alloc(
+        sizeof(sandbox_overlay_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+    
+    if (!overlay) {
+        console_printf("Error: Failed to allocate filesystem overlay\n");
+        return -1;
+    }
+    
+    snprintf(overlay->upper, sizeof(overlay->upper), "/sandbox/%u", id);
+    mkdir("/sandbox", 0755);
+    mkdir(overlay->upper, 0755);
+    
+    sandbox->overlay = overlay;
     
-    console_printf("Created filesystem snapshot for sandbox %u with %d file descriptors (%zu bytes)\n", 
-                  id, num_fds, total_size);
+    console_printf("Created filesystem overlay for sandbox %u in %s\n", id, overlay->upper);
     
     return 0;
 }
@@ -793,6 +1330,9 @@ static int sandbox_create_filesystem_snapshot(sandbox_id_t id) {
 /**
  * Rollback to a filesystem snapshot
  * 
+ * Discards the upper layer. File descriptors the process has open on
+ * upper-layer files are reopened on the system files.
+ * 
  * @param id: Sandbox ID
  * @return: 0 on success, -1 on failure
  */
@@ -805,58 +1345,41 @@ static int sandbox_rollback_filesystem(sandbox_id_t id) {
     
     // Get the sandbox
     sandbox_t* sandbox = sandbox_table[id];
+    sandbox_overlay_t* overlay = sandbox->overlay;
     
     // Check if a snapshot exists
-    if (!sandbox->filesystem_snapshot) {
+    if (!overlay) {
         console_printf("Error: No filesystem snapshot available\n");
         return -1;
     }
     
-    // Get the number of file descriptors from the snapshot
-    int num_fds = *((int*)sandbox->filesystem_snapshot);
+    size_t discarded = sandbox_overlay_discard(overlay);
     
-    // Restore each file
-    char* snapshot_ptr = (char*)sandbox->filesystem_snapshot + sizeof(int);
+    // Point descriptors on upper-layer files back at the system files
+    int num_fds = process_get_file_descriptor_count(sandbox->initial_process);
     
-    for (int i = 0; i < num_fds; i++) {
-        // Get the file descriptor
-        int fd = *((int*)snapshot_ptr);
-        snapshot_ptr += sizeof(int);
-        
-        // Get the file size
-        size_t file_size = *((size_t*)snapshot_ptr);
-        snapshot_ptr += sizeof(size_t);
-        
-        // Get the file path
-        char path[256];
-        strncpy(path, snapshot_ptr, 255);
-        path[255] = '\0'; // Ensure null termination
-        snapshot_ptr += 256;
+    if (num_fds > 0) {
+        int* fds = (int*)memory_alloc(num_fds * sizeof(int), MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
         
-        // If the file has content, restore it
-        if (file_size > 0) {
-            // Create or truncate the file
-            FILE* file = fopen(path, "wb");
-            if (file) {
-                // Write the file content
-                fwrite(snapshot_ptr, 1, file_size, file);
-                fclose(file);
-            }
+        if (fds && process_get_file_descriptors(sandbox->initial_process, fds, num_fds) == 0) {
+            size_t upper_length = strlen(overlay->upper);
+            char path[SANDBOX_OVERLAY_PATH_MAX + 64];
             
-            // Move to the next file
-            snapshot_ptr += file_size;
+            for (int i = 0; i < num_fds; i++) {
+                if (process_get_file_path(sandbox->initial_process, fds[i], path, sizeof(path)) == 0 &&
+                    strncmp(path, overlay->upper, upper_length) == 0 && path[upper_length] == '/' &&
+                    access(path + upper_length, F_OK) == 0) {
+                    process_open_file(sandbox->initial_process, path + upper_length, fds[i]);
+                }
+            }
         }
         
-        // Restore the file descriptor if needed
-        if (process_is_fd_open(sandbox->initial_process, fd) == 0) {
-            // File descriptor is not open, reopen it
-            if (strlen(path) > 0) {
-                process_open_file(sandbox->initial_process, path, fd);
-            }
+        if (fds) {
+            memory_free(fds, num_fds * sizeof(int));
         }
     }
     
-    console_printf("Restored filesystem snapshot for sandbox %u with %d file descriptors\n", id, num_fds);
+    console_printf("Restored filesystem snapshot for sandbox %u (%zu entries discarded)\n", id, discarded);
     
     return 0;
 }
@@ -1075,58 +1598,49 @@ int sandbox_commit(sandbox_id_t id) {
         return -1;
     }
     
-    // Get the list of modified files
-    char** modified_files = NULL;
-    size_t num_modified_files = 0;
-    
-    if (sandbox_get_modified_files(id, &modified_files, &num_modified_files) != 0) {
-        console_printf("Error: Failed to get modified files\n");
-        return -1;
-    }
+    // Merge the upper layer into the system files
+    sandbox_overlay_t* overlay = sandbox->overlay;
     
-    // Copy the modified files to the main system
-    for (size_t i = 0; i < num_modified_files; i++) {
-        char sandbox_path[512];
-        char system_path[512];
+    if (overlay) {
+        char upper_path[SANDBOX_OVERLAY_PATH_MAX + 64];
+        char system_path[SANDBOX_OVERLAY_PATH_MAX + 1];
+        size_t merged = 0;
         
-        snprintf(sandbox_path, sizeof(sandbox_path), "/sandbox/%u/%s", id, modified_files[i]);
-        snprintf(system_path, sizeof(system_path), "/%s", modified_files[i]);
-        
-        // Copy the file from sandbox to system
-        FILE *src = fopen(sandbox_path, "rb");
-        FILE *dst = fopen(system_path, "wb");
-        
-        if (src && dst) {
-            char buffer[8192];
-            size_t bytes_read;
+        for (int i = 0; i < SANDBOX_OVERLAY_BUCKETS; i++) {
+            sandbox_overlay_entry_t* entry = overlay->buckets[i];
             
-            while ((bytes_read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-                fwrite(buffer, 1, bytes_read, dst);
-            }
-            
-            fclose(src);
-            fclose(dst);
-            
-            // Preserve file permissions
-            struct stat st;
-            if (stat(sandbox_path, &st) == 0) {
-                chmod(system_path, st.st_mode & 0777);
+            while (entry) {
+                sandbox_overlay_entry_t* next = entry->next;
+                
+                snprintf(upper_path, sizeof(upper_path), "%s/%s", overlay->upper, entry->path);
+                snprintf(system_path, sizeof(system_path), "/%s", entry->path);
+                
+                if (entry->flags & SANDBOX_OVERLAY_WHITEOUT) {
+                    unlink(system_path);
+                    console_printf("Removed file %s\n", system_path);
+                } else {
+                    sandbox_make_parents(system_path);
+                    
+                    // Leave a file that failed to copy in the upper layer
+                    if (sandbox_copy_file(upper_path, system_path) != 0) {
+                        entry = next;
+                        continue;
+                    }
+                    
+                    unlink(upper_path);
+                    sandbox_prune_parents(overlay, upper_path);
+                    console_printf("Copied file from %s to %s\n", upper_path, system_path);
+                }
+                
+                sandbox_overlay_remove(overlay, entry);
+                merged++;
+                entry = next;
             }
-            
-            console_printf("Copied file from %s to %s\n", sandbox_path, system_path);
-        } else {
-            if (src) fclose(src);
-            if (dst) fclose(dst);
-            console_printf("Error: Failed to copy file from %s to %s\n", sandbox_path, system_path);
         }
         
-        // Free the file path
-        free(modified_files[i]);
+        console_printf("Merged %zu overlay entries of sandbox %u\n", merged, id);
     }
     
-    // Free the modified files list
-    free(modified_files);
-    
     // Apply any process state changes
     if (sandbox_apply_process_changes(id) != 0) {
         console_printf("Error: Failed to apply process changes\n");
@@ -1694,103 +2208,6 @@ static int sandbox_check_memory_access(sandbox_id_t id) {
     return 0;
 }
 
-/**
- * Get the list of modified files
- * 
- * @param id: Sandbox ID
- * @param modified_files: Pointer to store the list of modified files
- * @param num_modified_files: Pointer to store the number of modified files
- * @return: 0 on success, -1 on failure
- */
-static int sandbox_get_modified_files(sandbox_id_t id, char*** modified_files, size_t* num_modified_files) {
-    // Check if the sandbox ID is valid
-    if (id >= MAX_SANDBOXES || !sandbox_table[id]) {
-        console_printf("Error: Invalid sandbox ID\n");
-        return -1;
-    }
-    
-    // Get the sandbox
-    sandbox_t* sandbox = sandbox_table[id];
-    
-    // Initialize the output parameters
-    *modified_files = NULL;
-    *num_modified_files = 0;
-    
-    // Get the process file access history
-    file_access_t* accesses = NULL;
-    int num_accesses = 0;
-    
-    if (process_get_file_access_history(sandbox->initial_process, &accesses, &num_accesses) != 0) {
-        console_printf("Error: Failed to get file access history for process %d\n", sandbox->initial_process);
-        return -1;
-    }
-    
-    // Count the number of modified files
-    size_t count = 0;
-    
-    for (int i = 0; i < num_accesses; i++) {
-        // Only count write or create access
-        if (accesses[i].mode == FILE_ACCESS_WRITE || 
-            accesses[i].mode == FILE_ACCESS_CREATE) {
-            count++;
-        }
-    }
-    
-    // If no files were modified, return early
-    if (count == 0) {
-        memory_free(accesses, num_accesses * sizeof(file_access_t));
-        return 0;
-    }
-    
-    // Allocate memory for the modified files list
-    *modified_files = (char**)malloc(count * sizeof(char*));
-    
-    if (!*modified_files) {
-        console_printf("Error: Failed to allocate memory for modified files list\n");
-        memory_free(accesses, num_accesses * sizeof(file_access_t));
-        return -1;
-    }
-    
-    // Fill the modified files list
-    size_t index = 0;
-    
-    for (int i = 0; i < num_accesses; i++) {
-        // Only include write or create access
-        if (accesses[i].mode == FILE_ACCESS_WRITE || 
-            accesses[i].mode == FILE_ACCESS_CREATE) {
-            // Allocate memory for the file path
-            (*modified_files)[index] = strdup(accesses[i].path);
-            
-            if (!(*modified_files)[index]) {
-                console_printf("Error: Failed to allocate memory for file path\n");
-                
-                // Free the already allocated paths
-                for (size_t j = 0; j < index; j++) {
-                    free((*modified_files)[j]);
-                }
-                
-                free(*modified_files);
-                *modified_files = NULL;
-                
-                memory_free(accesses, num_accesses * sizeof(file_access_t));
-                return -1;
-            }
-            
-            index++;
-        }
-    }
-    
-    // Set the number of modified files
-    *num_modified_files = count;
-    
-    // Free the accesses array
-    memory_free(accesses, num_accesses * sizeof(file_access_t));
-    
-    console_printf("Found %zu modified files in sandbox %u\n", count, id);
-    
-    return 0;
-}
-
 /**
  * Apply process state changes
  * 
@@ -0,0 +1,343 @@
+/**
+ * smp.c - Multiprocessor support implementation for NeuroOS
+ *
+ * This file implements local APIC setup and application processor startup.
+ * The BSP copies the startup code to low memory and broadcasts the
+ * INIT-SIPI-SIPI sequence; each AP that wakes up takes a stack, registers
+ * itself and enters the idle loop of its own scheduler run queues (see
+ * process.c). The local APIC timers run in one-shot mode for timer.c.
+ */
+
+#include "include/smp.h"
+#include "include/cpu.h"
+#include "include/console.h"
+#include "include/interrupts.h"
+#include "include/process.h"
+#include "include/timer.h"
+#include <string.h>
+
+// Local APIC base MSR
+#define MSR_APIC_BASE           0x1B
+#define MSR_APIC_BASE_ENABLE    (1 << 11)
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID                0x020
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_TIMER_INITIAL     0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+// Local APIC register bits
+#define LAPIC_SVR_ENABLE        (1 << 8)
+#define LAPIC_ICR_INIT          (5 << 8)
+#define LAPIC_ICR_STARTUP       (6 << 8)
+#define LAPIC_ICR_PENDING       (1 << 12)
+#define LAPIC_ICR_ASSERT        (1 << 14)
+#define LAPIC_ICR_ALL_BUT_SELF  (3 << 18)
+#define LAPIC_LVT_MASKED        (1 << 16)
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+// Calibration interval of the local APIC timer
+#define SMP_CALIBRATE_US 10000
+
+// Longest one-shot delay programmed at once (later deadlines are reprogrammed)
+#define SMP_TIMER_MAX_DELAY_NS 1000000000000ULL
+
+// Time the APs get to check in after the startup IPIs
+#define SMP_AP_TIMEOUT_MS 100
+
+// Startup code (smp_trampoline.asm)
+extern char smp_trampoline_start[];
+extern char smp_trampoline_data[];
+extern char smp_trampoline_end[];
+
+// Startup parameters at smp_trampoline_data
+typedef struct {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t entry;
+    uint32_t stack_base;
+    uint32_t stack_size;
+    uint32_t num_stacks;
+    volatile uint32_t next_stack;
+} __attribute__((packed)) smp_trampoline_data_t;
+
+// Stacks the APs start on
+static uint8_t smp_ap_stacks[SMP_MAX_CPUS - 1][SMP_AP_STACK_SIZE] __attribute__((aligned(16)));
+
+// SMP state
+static struct {
+    int initialized;
+    volatile uint32_t* lapic;           // NULL until the local APIC is enabled
+    volatile uint32_t num_cpus;
+    uint32_t timer_count;               // Local APIC timer counts per calibration interval
+    uint8_t apic_ids[SMP_MAX_CPUS];     // Local APIC ID per CPU
+    uint8_t cpu_of_apic[256];           // CPU per local APIC ID
+} smp;
+
+// Forward declarations
+static uint32_t lapic_read(uint32_t reg);
+static void lapic_write(uint32_t reg, uint32_t value);
+static void lapic_enable(void);
+static void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+static void lapic_calibrate_timer(void);
+static void smp_ap_main(void);
+
+/**
+ * Start the application processors
+ *
+ * @return: 0 on success (also when only the BSP is available), -1 on failure
+ */
+int smp_init(void) {
+    if (smp.initialized) {
+        return 0;
+    }
+
+    smp.num_cpus = 1;
+
+    // The APs keep time with the TSC clock of timer.c
+    if (!cpu_has_feature(CPU_FEATURE_APIC) || !cpu_has_feature(CPU_FEATURE_TSC)) {
+        console_printf("SMP: no local APIC or TSC, running on the boot CPU only\n");
+        smp.initialized = 1;
+        return 0;
+    }
+
+    // Locate and enable the local APIC of the BSP (identity mapped)
+    uint32_t base_low, base_high;
+    __asm__ volatile("rdmsr" : "=a" (base_low), "=d" (base_high) : "c" (MSR_APIC_BASE));
+    base_low |= MSR_APIC_BASE_ENABLE;
+    __asm__ volatile("wrmsr" : : "a" (base_low), "d" (base_high), "c" (MSR_APIC_BASE));
+
+    smp.lapic = (volatile uint32_t*)(uintptr_t)(base_low & 0xFFFFF000u);
+    lapic_enable();
+
+    uint8_t bsp_id = (uint8_t)(lapic_read(LAPIC_ID) >> 24);
+    smp.apic_ids[0] = bsp_id;
+    smp.cpu_of_apic[bsp_id] = 0;
+
+    lapic_calibrate_timer();
+
+    if (smp.timer_count == 0) {
+        console_printf("Error: Failed to calibrate the local APIC timer\n");
+        smp.initialized = 1;
+        return -1;
+    }
+
+    // Copy the startup code below 1 MB and hand it the BSP setup
+    size_t size = (size_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, size);
+
+    smp_trampoline_data_t* data = (smp_trampoline_data_t*)(SMP_TRAMPOLINE_ADDR +
+                                                           (smp_trampoline_data - smp_trampoline_start));
+    uint32_t cr0, cr3, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    __asm__ volatile("mov %%cr3, %0" : "=r" (cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+
+    data->cr0 = cr0;
+    data->cr3 = cr3;
+    data->cr4 = cr4;
+    data->entry = (uint32_t)(uintptr_t)smp_ap_main;
+    data->stack_base = (uint32_t)(uintptr_t)smp_ap_stacks;
+    data->stack_size = SMP_AP_STACK_SIZE;
+    data->num_stacks = SMP_MAX_CPUS - 1;
+    data->next_stack = 0;
+    __sync_synchronize();
+
+    // INIT-SIPI-SIPI to every other processor
+    lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    timer_delay_us(10000);
+
+    for (int i = 0; i < 2; i++) {
+        lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        timer_delay_us(200);
+    }
+
+    // Wait for the APs to check in
+    for (int ms = 0; ms < SMP_AP_TIMEOUT_MS && smp.num_cpus < SMP_MAX_CPUS; ms++) {
+        timer_delay_us(1000);
+    }
+
+    smp.initialized = 1;
+
+    console_printf("SMP: %u CPUs online\n", smp.num_cpus);
+
+    return 0;
+}
+
+/**
+ * Get the index of the calling CPU
+ *
+ * @return: CPU index (0 for the BSP)
+ */
+uint32_t smp_cpu_index(void) {
+    if (!smp.lapic) {
+        return 0;
+    }
+
+    return smp.cpu_of_apic[lapic_read(LAPIC_ID) >> 24];
+}
+
+/**
+ * Get the number of CPUs that came online
+ *
+ * @return: Number of CPUs
+ */
+uint32_t smp_cpu_count(void) {
+    return smp.num_cpus ? smp.num_cpus : 1;
+}
+
+/**
+ * Acknowledge a local APIC interrupt
+ */
+void smp_lapic_eoi(void) {
+    if (smp.lapic) {
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+/**
+ * Interrupt a CPU so it looks at its run queues
+ *
+ * @param cpu: CPU index
+ */
+void smp_send_reschedule(uint32_t cpu) {
+    if (!smp.lapic || cpu >= smp.num_cpus || cpu == smp_cpu_index()) {
+        return;
+    }
+
+    lapic_send_ipi(smp.apic_ids[cpu], SMP_VECTOR_RESCHEDULE);
+}
+
+/**
+ * Program the local APIC timer of the calling CPU in one-shot mode
+ *
+ * The timer raises SMP_VECTOR_TIMER once the delay has passed.
+ *
+ * @param delay_ns: Delay in nanoseconds, 0 to stop the timer
+ * @return: 0 on success, -1 if the local APIC timer is not available
+ */
+int smp_timer_oneshot(uint64_t delay_ns) {
+    if (!smp.lapic || smp.timer_count == 0) {
+        return -1;
+    }
+
+    if (delay_ns == 0) {
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+        return 0;
+    }
+
+    if (delay_ns > SMP_TIMER_MAX_DELAY_NS) {
+        delay_ns = SMP_TIMER_MAX_DELAY_NS;
+    }
+
+    uint64_t count = delay_ns * smp.timer_count / (SMP_CALIBRATE_US * 1000ULL);
+
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFFFFFFu) {
+        count = 0xFFFFFFFFu;
+    }
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, SMP_VECTOR_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+
+    return 0;
+}
+
+/**
+ * Read a local APIC register
+ *
+ * @param reg: Register offset
+ * @return: Register value
+ */
+static uint32_t lapic_read(uint32_t reg) {
+    return smp.lapic[reg / 4];
+}
+
+/**
+ * Write a local APIC register
+ *
+ * @param reg: Register offset
+ * @param value: Value to write
+ */
+static void lapic_write(uint32_t reg, uint32_t value) {
+    smp.lapic[reg / 4] = value;
+}
+
+/**
+ * Enable the local APIC of the calling CPU
+ */
+static void lapic_enable(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SMP_VECTOR_SPURIOUS);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+}
+
+/**
+ * Send an inter-processor interrupt
+ *
+ * @param apic_id: Destination local APIC ID (ignored with a shorthand)
+ * @param command: ICR command (delivery mode, shorthand and vector)
+ */
+static void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+}
+
+/**
+ * Measure the local APIC timer rate against the PIT
+ *
+ * All CPUs share the bus clock, so the count measured on the BSP is used
+ * for every AP.
+ */
+static void lapic_calibrate_timer(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFFu);
+
+    timer_delay_us(SMP_CALIBRATE_US);
+
+    smp.timer_count = 0xFFFFFFFFu - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+/**
+ * Entry point of an application processor (called by the startup code)
+ */
+static void smp_ap_main(void) {
+    // Register the CPU before anything looks up the CPU index
+    uint8_t apic_id = (uint8_t)(lapic_read(LAPIC_ID) >> 24);
+    uint32_t cpu = __sync_fetch_and_add(&smp.num_cpus, 1);
+
+    smp.apic_ids[cpu] = apic_id;
+    smp.cpu_of_apic[apic_id] = cpu;
+    __sync_synchronize();
+
+    // Per-CPU register state: FPU/SIMD, IDT and local APIC
+    cpu_init_ap();
+    interrupts_init_ap();
+    lapic_enable();
+
+    // Set up the run queues of this CPU
+    process_init_cpu(cpu);
+
+    interrupts_enable();
+
+    process_idle();
+}
@@ -0,0 +1,97 @@
+; smp_trampoline.asm - Application processor startup code for NeuroOS
+;
+; The startup IPI starts an application processor in real mode at the page
+; this code is copied to (SMP_TRAMPOLINE_ADDR). It loads a flat GDT, enters
+; protected mode, takes over the paging setup of the bootstrap processor,
+; claims one of the AP stacks and calls smp_ap_main. The data block at the
+; end is filled in by smp_init before the IPIs are sent.
+
+SMP_TRAMPOLINE_ADDR equ 0x8000
+
+; Address of a trampoline label once copied to SMP_TRAMPOLINE_ADDR
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE_ADDR + (label) - smp_trampoline_start)
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_data
+global smp_trampoline_end
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; Load the flat GDT and enter protected mode
+    lgdt [TRAMPOLINE(trampoline_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE(trampoline_protected)
+
+bits 32
+trampoline_protected:
+    ; Load the data segments
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Use the page tables and control register setup of the BSP
+    mov eax, [TRAMPOLINE(trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [TRAMPOLINE(trampoline_cr3)]
+    mov cr3, eax
+    mov eax, [TRAMPOLINE(trampoline_cr0)]
+    mov cr0, eax
+
+    ; Claim the next AP stack; processors beyond the last stack stay parked
+    mov eax, 1
+    lock xadd [TRAMPOLINE(trampoline_next_stack)], eax
+    cmp eax, [TRAMPOLINE(trampoline_num_stacks)]
+    jae .park
+
+    inc eax
+    imul eax, [TRAMPOLINE(trampoline_stack_size)]
+    add eax, [TRAMPOLINE(trampoline_stack_base)]
+    mov esp, eax
+    xor ebp, ebp
+
+    ; Enter the kernel (does not return)
+    mov eax, [TRAMPOLINE(trampoline_entry)]
+    call eax
+
+.park:
+    cli
+    hlt
+    jmp .park
+
+; Flat 4 GB code (0x08) and data (0x10) segments, matching the kernel selectors
+align 8
+trampoline_gdt:
+    dq 0x0000000000000000
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdt_ptr:
+    dw trampoline_gdt_ptr - trampoline_gdt - 1
+    dd TRAMPOLINE(trampoline_gdt)
+
+; Startup parameters (smp_trampoline_data_t in smp.c)
+align 4
+smp_trampoline_data:
+trampoline_cr0:         dd 0
+trampoline_cr3:         dd 0
+trampoline_cr4:         dd 0
+trampoline_entry:       dd 0
+trampoline_stack_base:  dd 0
+trampoline_stack_size:  dd 0
+trampoline_num_stacks:  dd 0
+trampoline_next_stack:  dd 0
+smp_trampoline_end:
+
+; Add a .note.GNU-stack section to indicate non-executable stack
+section .note.GNU-stack noalloc noexec nowrite progbits
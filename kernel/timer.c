@@ -0,0 +1,529 @@
+/**
+ * timer.c - Clock and high-resolution timer implementation for NeuroOS
+ *
+ * The clock is the TSC, calibrated against PIT channel 2 at boot. Every CPU
+ * keeps its pending timers in a binary min-heap ordered by deadline and
+ * programs its local APIC timer in one-shot mode for the root of the heap;
+ * with nothing pending the local APIC timer is stopped. The PIT only keeps
+ * ticking (at TIMER_FALLBACK_HZ) on machines without a TSC or local APIC,
+ * where the clock and the timers advance with its tick instead.
+ */
+
+#include "include/timer.h"
+#include "include/smp.h"
+#include "include/cpu.h"
+#include "include/console.h"
+#include "include/interrupts.h"
+#include <string.h>
+
+// PIT input clock
+#define TIMER_PIT_HZ 1193182
+
+// Calibration interval of the TSC (PIT channel 2 counts at most about 54 ms)
+#define TIMER_CALIBRATE_US 50000
+
+// Shortest one-shot delay, for deadlines that are already due
+#define TIMER_MIN_DELAY_NS 1000
+
+// Timers expired per pass of the timer interrupt
+#define TIMER_EXPIRE_BATCH 16
+
+// Port I/O (interrupts.c)
+void outb(uint16_t port, uint8_t value);
+uint8_t inb(uint16_t port);
+
+// Pending timers of a CPU (the lock is taken with interrupts disabled)
+typedef struct {
+    volatile int lock;
+    uint32_t count;
+    uint64_t interrupts;
+    uint64_t expired;
+    hrtimer_t* heap[TIMER_MAX_PENDING];
+} timer_cpu_t;
+
+static timer_cpu_t timer_cpus[SMP_MAX_CPUS];
+
+// Clock and timer state
+static struct {
+    int initialized;
+    int tickless;
+    uint64_t tsc_khz;               // 0 without a TSC
+    uint64_t tsc_base;
+    volatile uint64_t jiffies;      // PIT ticks without the one-shot timers
+    uint64_t started;
+    uint64_t cancelled;
+} timer_state;
+
+// Forward declarations
+static void timer_interrupt(void);
+static void timer_program(timer_cpu_t* queue, uint64_t now);
+static void timer_heap_insert(timer_cpu_t* queue, hrtimer_t* timer);
+static void timer_heap_remove(timer_cpu_t* queue, uint32_t index);
+static void timer_heap_swap(timer_cpu_t* queue, uint32_t a, uint32_t b);
+static void timer_heap_up(timer_cpu_t* queue, uint32_t index);
+static void timer_heap_down(timer_cpu_t* queue, uint32_t index);
+static int timer_cpu_lock(timer_cpu_t* queue);
+static void timer_cpu_unlock(timer_cpu_t* queue, int irq_enabled);
+static uint64_t timer_read_tsc(void);
+
+/**
+ * Initialize the clock and the timers
+ *
+ * Called on the BSP once the local APIC timer is calibrated (smp_init).
+ *
+ * @return: 0 on success, -1 on failure
+ */
+int timer_init(void) {
+    if (timer_state.initialized) {
+        return 0;
+    }
+
+    memset(timer_cpus, 0, sizeof(timer_cpus));
+
+    // Calibrate the TSC against the PIT
+    if (cpu_has_feature(CPU_FEATURE_TSC)) {
+        uint64_t start = timer_read_tsc();
+        timer_delay_us(TIMER_CALIBRATE_US);
+        uint64_t end = timer_read_tsc();
+
+        timer_state.tsc_khz = (end - start) / (TIMER_CALIBRATE_US / 1000);
+        timer_state.tsc_base = end;
+    }
+
+    // One-shot mode needs both the TSC clock and a calibrated local APIC timer
+    timer_state.tickless = timer_state.tsc_khz != 0 && smp_timer_oneshot(0) == 0;
+
+    interrupts_register_handler(SMP_VECTOR_TIMER, timer_interrupt);
+    interrupts_register_handler(IRQ_TO_VECTOR(IRQ_TIMER), timer_interrupt);
+
+    if (timer_state.tickless) {
+        // The PIT is not needed any more
+        interrupts_disable_irq(IRQ_TIMER);
+    } else {
+        // Channel 0, low/high byte, mode 2 (rate generator)
+        uint32_t divisor = TIMER_PIT_HZ / TIMER_FALLBACK_HZ;
+
+        outb(0x43, 0x34);
+        outb(0x40, divisor & 0xFF);
+        outb(0x40, (divisor >> 8) & 0xFF);
+        interrupts_enable_irq(IRQ_TIMER);
+    }
+
+    timer_state.initialized = 1;
+
+    if (timer_state.tickless) {
+        console_printf("Timer: one-shot local APIC timers, TSC at %u kHz\n", (uint32_t)timer_state.tsc_khz);
+    } else {
+        console_printf("Timer: periodic PIT tick at %u Hz\n", TIMER_FALLBACK_HZ);
+    }
+
+    return 0;
+}
+
+/**
+ * Get the time since boot
+ *
+ * @return: Clock time in nanoseconds (0 until timer_init has run)
+ */
+uint64_t timer_now_ns(void) {
+    if (timer_state.tsc_khz) {
+        uint64_t cycles = timer_read_tsc() - timer_state.tsc_base;
+
+        return (cycles / timer_state.tsc_khz) * TIMER_NS_PER_MS +
+               (cycles % timer_state.tsc_khz) * TIMER_NS_PER_MS / timer_state.tsc_khz;
+    }
+
+    return timer_state.jiffies * (1000000000ULL / TIMER_FALLBACK_HZ);
+}
+
+/**
+ * Busy-wait using PIT channel 2
+ *
+ * Works with interrupts disabled and before the clock is calibrated.
+ *
+ * @param us: Microseconds to wait (at most about 54 ms)
+ */
+void timer_delay_us(uint32_t us) {
+    uint32_t count = (uint32_t)(((uint64_t)TIMER_PIT_HZ * us) / 1000000);
+
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+
+    // Gate channel 2 off with the speaker disconnected
+    uint8_t port61 = inb(0x61) & ~0x03;
+    outb(0x61, port61);
+
+    // Channel 2, low/high byte, mode 0 (output goes high at terminal count)
+    outb(0x43, 0xB0);
+    outb(0x42, count & 0xFF);
+    outb(0x42, (count >> 8) & 0xFF);
+
+    // Start counting and wait for the output to go high
+    outb(0x61, port61 | 0x01);
+
+    while (!(inb(0x61) & 0x20)) {
+        __asm__ volatile("pause");
+    }
+
+    outb(0x61, port61);
+}
+
+/**
+ * Initialize a timer
+ *
+ * @param timer: Timer
+ * @param callback: Function called when the timer expires
+ * @param data: Argument of the callback
+ */
+void hrtimer_init(hrtimer_t* timer, hrtimer_callback_t callback, void* data) {
+    timer->deadline = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->cpu = -1;
+    timer->index = -1;
+}
+
+/**
+ * Start a timer on the calling CPU
+ *
+ * A pending timer is moved to the new deadline. A timer has one owner;
+ * starting or cancelling the same timer from two CPUs at once is not
+ * supported.
+ *
+ * @param timer: Timer
+ * @param deadline: Clock time to expire at (timer_now_ns)
+ * @return: 0 on success, -1 on failure
+ */
+int hrtimer_start(hrtimer_t* timer, uint64_t deadline) {
+    if (!timer_state.initialized || !timer || !timer->callback) {
+        return -1;
+    }
+
+    hrtimer_cancel(timer);
+
+    uint32_t index = smp_cpu_index();
+    timer_cpu_t* queue = &timer_cpus[index];
+    int irq = timer_cpu_lock(queue);
+
+    if (queue->count >= TIMER_MAX_PENDING) {
+        timer_cpu_unlock(queue, irq);
+        console_printf("Error: Too many pending timers\n");
+        return -1;
+    }
+
+    timer->deadline = deadline;
+    timer->cpu = (int32_t)index;
+    timer_heap_insert(queue, timer);
+
+    // The local APIC timer only has to move for a new earliest deadline
+    if (timer->index == 0) {
+        timer_program(queue, timer_now_ns());
+    }
+
+    timer_cpu_unlock(queue, irq);
+
+    __sync_fetch_and_add(&timer_state.started, 1);
+
+    return 0;
+}
+
+/**
+ * Cancel a timer
+ *
+ * The callback may still be running on another CPU when this returns.
+ *
+ * @param timer: Timer
+ * @return: 0 on success (also if the timer was not pending), -1 on failure
+ */
+int hrtimer_cancel(hrtimer_t* timer) {
+    if (!timer) {
+        return -1;
+    }
+
+    for (;;) {
+        int32_t cpu = timer->cpu;
+
+        if (cpu < 0) {
+            return 0;
+        }
+
+        // The timer leaves the heap only under the heap lock, so recheck
+        // the owner once it is held
+        timer_cpu_t* queue = &timer_cpus[cpu];
+        int irq = timer_cpu_lock(queue);
+
+        if (timer->cpu == cpu) {
+            timer_heap_remove(queue, (uint32_t)timer->index);
+            timer_cpu_unlock(queue, irq);
+            __sync_fetch_and_add(&timer_state.cancelled, 1);
+            return 0;
+        }
+
+        timer_cpu_unlock(queue, irq);
+    }
+}
+
+/**
+ * Check if a timer is pending
+ *
+ * @param timer: Timer
+ * @return: 1 if the timer is waiting to expire, 0 otherwise
+ */
+int hrtimer_pending(const hrtimer_t* timer) {
+    return timer && timer->cpu >= 0;
+}
+
+/**
+ * Get timer statistics
+ *
+ * @param stats: Pointer to store the statistics
+ */
+void timer_get_stats(timer_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(timer_stats_t));
+
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        stats->interrupts += timer_cpus[i].interrupts;
+        stats->expired += timer_cpus[i].expired;
+    }
+
+    stats->started = timer_state.started;
+    stats->cancelled = timer_state.cancelled;
+    stats->tickless = timer_state.tickless;
+    stats->tsc_khz = timer_state.tsc_khz;
+}
+
+/**
+ * Timer interrupt handler (local APIC timer, or the PIT tick on the BSP)
+ *
+ * Expired timers leave the heap and the next deadline is programmed before
+ * their callbacks run, so a callback that switches processes does not hold
+ * up the other timers of the CPU.
+ */
+static void timer_interrupt(void) {
+    uint32_t index = smp_cpu_index();
+    timer_cpu_t* queue = &timer_cpus[index];
+
+    if (!timer_state.tickless && index == 0) {
+        timer_state.jiffies++;
+    }
+
+    int irq = timer_cpu_lock(queue);
+    queue->interrupts++;
+
+    for (;;) {
+        hrtimer_callback_t callbacks[TIMER_EXPIRE_BATCH];
+        void* data[TIMER_EXPIRE_BATCH];
+        uint32_t count = 0;
+        uint64_t now = timer_now_ns();
+
+        // Take the expired timers off the heap
+        while (count < TIMER_EXPIRE_BATCH && queue->count > 0 && queue->heap[0]->deadline <= now) {
+            hrtimer_t* timer = queue->heap[0];
+
+            callbacks[count] = timer->callback;
+            data[count] = timer->data;
+            count++;
+
+            timer_heap_remove(queue, 0);
+        }
+
+        queue->expired += count;
+        timer_program(queue, now);
+
+        if (count == 0) {
+            break;
+        }
+
+        // Run the callbacks without the lock; they may start timers again
+        timer_cpu_unlock(queue, 0);
+
+        for (uint32_t i = 0; i < count; i++) {
+            callbacks[i](data[i]);
+        }
+
+        timer_cpu_lock(queue);
+    }
+
+    timer_cpu_unlock(queue, irq);
+}
+
+/**
+ * Program the local APIC timer for the earliest deadline of a CPU
+ *
+ * Must be called on that CPU with its heap locked.
+ *
+ * @param queue: Pending timers of the calling CPU
+ * @param now: Current clock time
+ */
+static void timer_program(timer_cpu_t* queue, uint64_t now) {
+    if (!timer_state.tickless) {
+        return;
+    }
+
+    if (queue->count == 0) {
+        smp_timer_oneshot(0);
+        return;
+    }
+
+    uint64_t deadline = queue->heap[0]->deadline;
+    uint64_t delay = deadline > now ? deadline - now : 0;
+
+    if (delay < TIMER_MIN_DELAY_NS) {
+        delay = TIMER_MIN_DELAY_NS;
+    }
+
+    smp_timer_oneshot(delay);
+}
+
+/**
+ * Add a timer to a heap
+ *
+ * @param queue: Locked pending timers
+ * @param timer: Timer (deadline set)
+ */
+static void timer_heap_insert(timer_cpu_t* queue, hrtimer_t* timer) {
+    uint32_t index = queue->count++;
+
+    queue->heap[index] = timer;
+    timer->index = (int32_t)index;
+    timer_heap_up(queue, index);
+}
+
+/**
+ * Remove a timer from a heap
+ *
+ * @param queue: Locked pending timers
+ * @param index: Heap position of the timer
+ */
+static void timer_heap_remove(timer_cpu_t* queue, uint32_t index) {
+    hrtimer_t* timer = queue->heap[index];
+    uint32_t last = --queue->count;
+
+    if (index != last) {
+        queue->heap[index] = queue->heap[last];
+        queue->heap[index]->index = (int32_t)index;
+        timer_heap_down(queue, index);
+        timer_heap_up(queue, index);
+    }
+
+    queue->heap[last] = NULL;
+    timer->index = -1;
+    timer->cpu = -1;
+}
+
+/**
+ * Swap two heap entries
+ *
+ * @param queue: Locked pending timers
+ * @param a: First position
+ * @param b: Second position
+ */
+static void timer_heap_swap(timer_cpu_t* queue, uint32_t a, uint32_t b) {
+    hrtimer_t* timer = queue->heap[a];
+
+    queue->heap[a] = queue->heap[b];
+    queue->heap[b] = timer;
+    queue->heap[a]->index = (int32_t)a;
+    queue->heap[b]->index = (int32_t)b;
+}
+
+/**
+ * Move a heap entry towards the root while it expires before its parent
+ *
+ * @param queue: Locked pending timers
+ * @param index: Heap position
+ */
+static void timer_heap_up(timer_cpu_t* queue, uint32_t index) {
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+
+        if (queue->heap[parent]->deadline <= queue->heap[index]->deadline) {
+            break;
+        }
+
+        timer_heap_swap(queue, parent, index);
+        index = parent;
+    }
+}
+
+/**
+ * Move a heap entry towards the leaves while a child expires before it
+ *
+ * @param queue: Locked pending timers
+ * @param index: Heap position
+ */
+static void timer_heap_down(timer_cpu_t* queue, uint32_t index) {
+    for (;;) {
+        uint32_t left = 2 * index + 1;
+        uint32_t right = left + 1;
+        uint32_t first = index;
+
+        if (left < queue->count && queue->heap[left]->deadline < queue->heap[first]->deadline) {
+            first = left;
+        }
+
+        if (right < queue->count && queue->heap[right]->deadline < queue->heap[first]->deadline) {
+            first = right;
+        }
+
+        if (first == index) {
+            break;
+        }
+
+        timer_heap_swap(queue, index, first);
+        index = first;
+    }
+}
+
+/**
+ * Disable interrupts and lock the pending timers of a CPU
+ *
+ * @param queue: Pending timers
+ * @return: Whether interrupts were enabled
+ */
+static int timer_cpu_lock(timer_cpu_t* queue) {
+    int irq_enabled = interrupts_are_enabled();
+    interrupts_disable();
+
+    while (__sync_lock_test_and_set(&queue->lock, 1)) {
+        while (queue->lock) {
+            __asm__ volatile("pause");
+        }
+    }
+
+    return irq_enabled;
+}
+
+/**
+ * Unlock the pending timers of a CPU and restore interrupts
+ *
+ * @param queue: Pending timers
+ * @param irq_enabled: Value returned by timer_cpu_lock
+ */
+static void timer_cpu_unlock(timer_cpu_t* queue, int irq_enabled) {
+    __sync_lock_release(&queue->lock);
+
+    if (irq_enabled) {
+        interrupts_enable();
+    }
+}
+
+/**
+ * Read the time stamp counter
+ *
+ * @return: TSC value
+ */
+static uint64_t timer_read_tsc(void) {
+    uint32_t low, high;
+
+    __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t)high << 32) | low;
+}
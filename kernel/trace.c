@@ -0,0 +1,539 @@
+/**
+ * trace.c - Kernel tracing implementation for NeuroOS
+ *
+ * Each CPU owns a ring of TRACE_RING_EVENTS events. A recorder claims the
+ * next slot with an atomic increment of the ring head, which also orders it
+ * against interrupts taken on the same CPU, so recording needs no lock and
+ * never waits. Spans are stored as one event holding their start and
+ * duration, so a span that began on another CPU (the process migrated)
+ * still pairs up. Timestamps are raw TSC values, converted to time only
+ * when the trace is read.
+ */
+
+#include "include/trace.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include "include/smp.h"
+#include "include/timer.h"
+#include <string.h>
+
+// Bytes buffered by the JSON export before they are passed to the writer
+#define TRACE_EXPORT_BUFFER 512
+
+// Events of one CPU
+typedef struct {
+    trace_event_t* events;
+    volatile uint32_t head;             // Slots ever claimed
+    volatile uint32_t counts[TRACE_CAT_COUNT];
+} trace_ring_t;
+
+// JSON export state
+typedef struct {
+    trace_writer_t writer;
+    void* ctx;
+    char buffer[TRACE_EXPORT_BUFFER];
+    size_t length;
+    int error;
+} trace_json_t;
+
+// Per-CPU rings
+static trace_ring_t trace_rings[SMP_MAX_CPUS];
+
+// Categories being traced
+static volatile uint32_t trace_categories = 0;
+
+// TSC rate, 0 when the timestamps are timer_now_ns nanoseconds instead
+static uint64_t trace_tsc_khz = 0;
+
+// Clock at initialization, the origin of exported timestamps
+static uint64_t trace_base = 0;
+
+static int trace_initialized = 0;
+
+static const char* trace_category_names[TRACE_CAT_COUNT] = {
+    "sched", "memory", "fault", "net", "dl", "llm"
+};
+
+// Forward declarations of static functions
+static uint64_t trace_read_tsc(void);
+static void trace_record(const trace_point_t* point, uint64_t start, uint64_t duration, uint32_t arg0, uint32_t arg1, uint32_t kind);
+static int trace_export_event(void* ctx, uint32_t cpu, const trace_event_t* event);
+static void trace_json_write(trace_json_t* json, const char* data, size_t size);
+static void trace_json_string(trace_json_t* json, const char* s);
+static void trace_json_number(trace_json_t* json, uint64_t value);
+static void trace_json_time(trace_json_t* json, uint64_t ns);
+static void trace_json_flush(trace_json_t* json);
+
+/**
+ * Initialize tracing
+ *
+ * Allocates a ring for every CPU that came online. Nothing is traced until
+ * trace_start is called.
+ *
+ * @return: 0 on success, -1 on failure
+ */
+int trace_init(void) {
+    if (trace_initialized) {
+        return 0;
+    }
+
+    timer_stats_t timer_stats;
+    timer_get_stats(&timer_stats);
+    trace_tsc_khz = timer_stats.tsc_khz;
+
+    uint32_t num_cpus = smp_cpu_count();
+
+    for (uint32_t cpu = 0; cpu < num_cpus && cpu < SMP_MAX_CPUS; cpu++) {
+        trace_rings[cpu].events = (trace_event_t*)memory_alloc(TRACE_RING_EVENTS * sizeof(trace_event_t),
+            MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+        if (!trace_rings[cpu].events) {
+            console_printf("Error: Failed to allocate the trace ring of CPU %u\n", cpu);
+            return -1;
+        }
+    }
+
+    trace_base = trace_clock();
+    trace_initialized = 1;
+
+    console_printf("Trace: %u events per CPU on %u CPUs\n", TRACE_RING_EVENTS, num_cpus);
+
+    return 0;
+}
+
+/**
+ * Start tracing
+ *
+ * @param categories: TRACE_CAT_* bits to trace, added to those already traced
+ */
+void trace_start(uint32_t categories) {
+    if (!trace_initialized) {
+        return;
+    }
+
+    __sync_fetch_and_or(&trace_categories, categories & TRACE_CAT_ALL);
+}
+
+/**
+ * Stop tracing; the recorded events are kept
+ *
+ * @param categories: TRACE_CAT_* bits to stop tracing (TRACE_CAT_ALL for all)
+ */
+void trace_stop(uint32_t categories) {
+    __sync_fetch_and_and(&trace_categories, ~categories);
+}
+
+/**
+ * Drop the recorded events
+ */
+void trace_clear(void) {
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        trace_ring_t* ring = &trace_rings[cpu];
+
+        ring->head = 0;
+        memset((void*)ring->counts, 0, sizeof(ring->counts));
+    }
+}
+
+/**
+ * Get the categories being traced
+ *
+ * @return: TRACE_CAT_* bits
+ */
+uint32_t trace_get_categories(void) {
+    return trace_categories;
+}
+
+/**
+ * Start a span
+ *
+ * @param point: Tracepoint of the span
+ * @return: Start timestamp to pass to trace_end, 0 if the category is not traced
+ */
+uint64_t trace_begin(const trace_point_t* point) {
+    if (!(trace_categories & point->category)) {
+        return 0;
+    }
+
+    return trace_clock();
+}
+
+/**
+ * End a span and record it
+ *
+ * @param point: Tracepoint of the span
+ * @param start: Value returned by trace_begin
+ * @param arg0: First argument
+ * @param arg1: Second argument
+ */
+void trace_end(const trace_point_t* point, uint64_t start, uint32_t arg0, uint32_t arg1) {
+    // Spans begun before tracing started are not recorded
+    if (!start || !(trace_categories & point->category)) {
+        return;
+    }
+
+    uint64_t now = trace_clock();
+    trace_record(point, start, now > start ? now - start : 0, arg0, arg1, TRACE_EVENT_SPAN);
+}
+
+/**
+ * Record an instant event
+ *
+ * @param point: Tracepoint of the event
+ * @param arg0: First argument
+ * @param arg1: Second argument
+ */
+void trace_instant(const trace_point_t* point, uint32_t arg0, uint32_t arg1) {
+    if (!(trace_categories & point->category)) {
+        return;
+    }
+
+    trace_record(point, trace_clock(), 0, arg0, arg1, TRACE_EVENT_INSTANT);
+}
+
+/**
+ * Record the value of a counter
+ *
+ * @param point: Tracepoint of the counter, its first argument names the value
+ * @param value: Counter value
+ */
+void trace_counter(const trace_point_t* point, uint32_t value) {
+    if (!(trace_categories & point->category)) {
+        return;
+    }
+
+    trace_record(point, trace_clock(), 0, value, 0, TRACE_EVENT_COUNTER);
+}
+
+/**
+ * Read the trace clock
+ *
+ * @return: TSC value, or nanoseconds since boot on machines without a TSC
+ */
+uint64_t trace_clock(void) {
+    if (trace_tsc_khz) {
+        return trace_read_tsc();
+    }
+
+    return timer_now_ns();
+}
+
+/**
+ * Convert trace clock cycles to nanoseconds
+ *
+ * @param cycles: Difference of two trace timestamps
+ * @return: Nanoseconds
+ */
+uint64_t trace_cycles_to_ns(uint64_t cycles) {
+    if (!trace_tsc_khz) {
+        return cycles;
+    }
+
+    return (cycles / trace_tsc_khz) * TIMER_NS_PER_MS +
+           (cycles % trace_tsc_khz) * TIMER_NS_PER_MS / trace_tsc_khz;
+}
+
+/**
+ * Walk the recorded events
+ *
+ * Events recorded during the walk may be seen torn; stop tracing first for
+ * a consistent view.
+ *
+ * @param visit: Function receiving each event
+ * @param ctx: Context passed to visit
+ * @return: 0 on success, -1 if visit stopped the walk
+ */
+int trace_for_each(trace_visit_t visit, void* ctx) {
+    if (!visit) {
+        return -1;
+    }
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        trace_ring_t* ring = &trace_rings[cpu];
+
+        if (!ring->events) {
+            continue;
+        }
+
+        uint32_t head = ring->head;
+        uint32_t count = head < TRACE_RING_EVENTS ? head : TRACE_RING_EVENTS;
+
+        for (uint32_t i = head - count; i != head; i++) {
+            const trace_event_t* event = &ring->events[i & (TRACE_RING_EVENTS - 1)];
+
+            if (event->point && visit(ctx, cpu, event) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Export the recorded events in the Chrome trace event format
+ *
+ * The output loads in chrome://tracing and Perfetto; each CPU shows up as a
+ * thread. Tracing is paused while the rings are read.
+ *
+ * @param writer: Function receiving the output
+ * @param ctx: Context passed to writer
+ * @return: 0 on success, -1 on failure
+ */
+int trace_export_json(trace_writer_t writer, void* ctx) {
+    if (!writer) {
+        return -1;
+    }
+
+    uint32_t categories = __sync_lock_test_and_set(&trace_categories, 0);
+
+    trace_json_t json;
+    json.writer = writer;
+    json.ctx = ctx;
+    json.length = 0;
+    json.error = 0;
+
+    trace_json_string(&json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    // Name the process and the CPU threads
+    trace_json_string(&json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"NeuroOS\"}}");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!trace_rings[cpu].events) {
+            continue;
+        }
+
+        trace_json_string(&json, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":");
+        trace_json_number(&json, cpu);
+        trace_json_string(&json, ",\"args\":{\"name\":\"CPU ");
+        trace_json_number(&json, cpu);
+        trace_json_string(&json, "\"}}");
+    }
+
+    trace_for_each(trace_export_event, &json);
+
+    trace_json_string(&json, "]}\n");
+    trace_json_flush(&json);
+
+    trace_start(categories);
+
+    return json.error ? -1 : 0;
+}
+
+/**
+ * Get the name of a trace category
+ *
+ * @param category: One TRACE_CAT_* bit
+ * @return: Category name, NULL if invalid
+ */
+const char* trace_category_name(uint32_t category) {
+    for (int i = 0; i < TRACE_CAT_COUNT; i++) {
+        if (category == (1u << i)) {
+            return trace_category_names[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Get trace statistics
+ *
+ * @param stats: Pointer to store the statistics
+ */
+void trace_get_stats(trace_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(trace_stats_t));
+
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        trace_ring_t* ring = &trace_rings[cpu];
+
+        for (int i = 0; i < TRACE_CAT_COUNT; i++) {
+            stats->events[i] += ring->counts[i];
+        }
+
+        if (ring->head > TRACE_RING_EVENTS) {
+            stats->overwritten += ring->head - TRACE_RING_EVENTS;
+        }
+    }
+
+    stats->categories = trace_categories;
+    stats->clock_khz = trace_tsc_khz ? trace_tsc_khz : TIMER_NS_PER_MS;
+}
+
+/**
+ * Read the time stamp counter
+ *
+ * @return: TSC value
+ */
+static uint64_t trace_read_tsc(void) {
+    uint32_t low, high;
+
+    __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Store an event in the ring of this CPU
+ *
+ * @param point: Tracepoint of the event
+ * @param start: Timestamp of the event
+ * @param duration: Cycles the event lasted
+ * @param arg0: First argument
+ * @param arg1: Second argument
+ * @param kind: TRACE_EVENT_*
+ */
+static void trace_record(const trace_point_t* point, uint64_t start, uint64_t duration, uint32_t arg0, uint32_t arg1, uint32_t kind) {
+    trace_ring_t* ring = &trace_rings[smp_cpu_index()];
+
+    if (!ring->events) {
+        return;
+    }
+
+    uint32_t slot = __sync_fetch_and_add(&ring->head, 1) & (TRACE_RING_EVENTS - 1);
+    trace_event_t* event = &ring->events[slot];
+
+    event->start = start;
+    event->duration = duration;
+    event->point = point;
+    event->args[0] = arg0;
+    event->args[1] = arg1;
+    event->kind = kind;
+
+    __sync_fetch_and_add(&ring->counts[__builtin_ctz(point->category)], 1);
+}
+
+/**
+ * Write one event of the JSON export
+ *
+ * @param ctx: JSON export state
+ * @param cpu: CPU that recorded the event
+ * @param event: Event to write
+ * @return: 0 to continue, 1 to stop after a write error
+ */
+static int trace_export_event(void* ctx, uint32_t cpu, const trace_event_t* event) {
+    trace_json_t* json = (trace_json_t*)ctx;
+    const trace_point_t* point = event->point;
+    char phase[2] = { (char)event->kind, '\0' };
+
+    trace_json_string(json, ",\n{\"name\":\"");
+    trace_json_string(json, point->name);
+    trace_json_string(json, "\",\"cat\":\"");
+    trace_json_string(json, trace_category_name(point->category));
+    trace_json_string(json, "\",\"ph\":\"");
+    trace_json_string(json, phase);
+    trace_json_string(json, "\",\"ts\":");
+    trace_json_time(json, trace_cycles_to_ns(event->start > trace_base ? event->start - trace_base : 0));
+
+    if (event->kind == TRACE_EVENT_SPAN) {
+        trace_json_string(json, ",\"dur\":");
+        trace_json_time(json, trace_cycles_to_ns(event->duration));
+    } else if (event->kind == TRACE_EVENT_INSTANT) {
+        trace_json_string(json, ",\"s\":\"t\"");
+    }
+
+    trace_json_string(json, ",\"pid\":0,\"tid\":");
+    trace_json_number(json, cpu);
+    trace_json_string(json, ",\"args\":{");
+
+    for (int i = 0; i < 2; i++) {
+        if (!point->arg_names[i]) {
+            continue;
+        }
+
+        trace_json_string(json, i > 0 && point->arg_names[0] ? ",\"" : "\"");
+        trace_json_string(json, point->arg_names[i]);
+        trace_json_string(json, "\":");
+        trace_json_number(json, event->args[i]);
+    }
+
+    trace_json_string(json, "}}");
+
+    return json->error ? 1 : 0;
+}
+
+/**
+ * Append bytes to the JSON export, passing full buffers to the writer
+ *
+ * @param json: JSON export state
+ * @param data: Bytes to append
+ * @param size: Number of bytes
+ */
+static void trace_json_write(trace_json_t* json, const char* data, size_t size) {
+    while (size > 0 && !json->error) {
+        if (json->length == TRACE_EXPORT_BUFFER) {
+            trace_json_flush(json);
+            continue;
+        }
+
+        size_t chunk = TRACE_EXPORT_BUFFER - json->length;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        memcpy(json->buffer + json->length, data, chunk);
+        json->length += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * Append a string to the JSON export
+ *
+ * @param json: JSON export state
+ * @param s: String (tracepoint names are not escaped)
+ */
+static void trace_json_string(trace_json_t* json, const char* s) {
+    trace_json_write(json, s ? s : "", s ? strlen(s) : 0);
+}
+
+/**
+ * Append a decimal number to the JSON export
+ *
+ * @param json: JSON export state
+ * @param value: Number
+ */
+static void trace_json_number(trace_json_t* json, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    trace_json_write(json, digits + sizeof(digits) - count, count);
+}
+
+/**
+ * Append a time in microseconds, with nanosecond precision, to the JSON export
+ *
+ * @param json: JSON export state
+ * @param ns: Time in nanoseconds
+ */
+static void trace_json_time(trace_json_t* json, uint64_t ns) {
+    char fraction[4] = { '.', (char)('0' + ns / 100 % 10), (char)('0' + ns / 10 % 10), (char)('0' + ns % 10) };
+
+    trace_json_number(json, ns / TIMER_NS_PER_US);
+    trace_json_write(json, fraction, sizeof(fraction));
+}
+
+/**
+ * Pass the buffered JSON export to the writer
+ *
+ * @param json: JSON export state
+ */
+static void trace_json_flush(trace_json_t* json) {
+    if (json->length > 0 && !json->error) {
+        if (json->writer(json->ctx, json->buffer, json->length) != 0) {
+            json->error = 1;
+        }
+    }
+
+    json->length = 0;
+}
@@ -0,0 +1,646 @@
+/**
+ * vocab.c - Token vocabulary for NeuroOS
+ *
+ * This file implements the token vocabulary shared by the tokenizers. The
+ * vocabulary is built once from tokenizer.json and answers text -> ID and
+ * ID -> text queries in constant time.
+ */
+
+#include "include/vocab.h"
+#include "include/memory.h"
+#include "include/console.h"
+#include <string.h>
+
+// Longest token accepted from tokenizer.json
+#define VOCAB_MAX_TOKEN_LEN 1024
+
+/**
+ * Hash token text (FNV-1a)
+ *
+ * @param text: Token text
+ * @param len: Token length
+ * @return: Hash value
+ */
+static uint32_t vocab_hash(const char* text, size_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Initialize a vocabulary
+ *
+ * @param vocab: Vocabulary to initialize
+ * @param max_tokens: Number of token IDs (largest ID + 1)
+ * @param strings_size: Size of the string pool
+ * @return: 0 on success, -1 on failure
+ */
+int vocab_init(vocab_t* vocab, uint32_t max_tokens, size_t strings_size) {
+    if (!vocab || max_tokens == 0) {
+        return -1;
+    }
+
+    memset(vocab, 0, sizeof(vocab_t));
+
+    // Keep the table at most half full so probes stay short
+    uint32_t capacity = 16;
+    while (capacity < max_tokens * 2) {
+        capacity <<= 1;
+    }
+
+    size_t alloc_size = capacity * sizeof(uint32_t) + (size_t)max_tokens * 3 * sizeof(uint32_t) + strings_size;
+    uint8_t* block = (uint8_t*)memory_alloc(alloc_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+    if (!block) {
+        console_printf("Error: Failed to allocate memory for vocabulary\n");
+        return -1;
+    }
+
+    vocab->slots = (uint32_t*)block;
+    vocab->offsets = vocab->slots + capacity;
+    vocab->lengths = vocab->offsets + max_tokens;
+    vocab->hashes = vocab->lengths + max_tokens;
+    vocab->strings = (char*)(vocab->hashes + max_tokens);
+    vocab->strings_size = strings_size;
+    vocab->capacity = capacity;
+    vocab->max_tokens = max_tokens;
+    vocab->alloc_size = alloc_size;
+
+    for (uint32_t i = 0; i < max_tokens; i++) {
+        vocab->offsets[i] = VOCAB_NO_TOKEN;
+    }
+
+    return 0;
+}
+
+/**
+ * Free a vocabulary
+ *
+ * @param vocab: Vocabulary to free
+ */
+void vocab_free(vocab_t* vocab) {
+    if (!vocab) {
+        return;
+    }
+
+    if (vocab->slots) {
+        memory_free(vocab->slots, vocab->alloc_size);
+    }
+
+    memset(vocab, 0, sizeof(vocab_t));
+}
+
+/**
+ * Add a token to a vocabulary
+ *
+ * A token that is already present keeps its first ID.
+ *
+ * @param vocab: Vocabulary
+ * @param text: Token text
+ * @param len: Token length
+ * @param id: Token ID
+ * @return: 0 on success, -1 on failure
+ */
+int vocab_add(vocab_t* vocab, const char* text, size_t len, uint32_t id) {
+    if (!vocab || !vocab->slots || !text || id >= vocab->max_tokens) {
+        return -1;
+    }
+
+    if (vocab->offsets[id] != VOCAB_NO_TOKEN || vocab->strings_used + len + 1 > vocab->strings_size) {
+        return -1;
+    }
+
+    uint32_t hash = vocab_hash(text, len);
+    uint32_t mask = vocab->capacity - 1;
+    uint32_t index = hash & mask;
+
+    while (vocab->slots[index]) {
+        uint32_t other = vocab->slots[index] - 1;
+
+        if (vocab->hashes[other] == hash && vocab->lengths[other] == len &&
+            memcmp(vocab->strings + vocab->offsets[other], text, len) == 0) {
+            return -1;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    memcpy(vocab->strings + vocab->strings_used, text, len);
+    vocab->strings[vocab->strings_used + len] = '\0';
+
+    vocab->offsets[id] = (uint32_t)vocab->strings_used;
+    vocab->lengths[id] = (uint32_t)len;
+    vocab->hashes[id] = hash;
+    vocab->strings_used += len + 1;
+    vocab->slots[index] = id + 1;
+    vocab->num_tokens++;
+
+    return 0;
+}
+
+/**
+ * Look up the ID of a token
+ *
+ * @param vocab: Vocabulary
+ * @param text: Token text
+ * @param len: Token length
+ * @param id: Pointer to store the token ID
+ * @return: 0 if the token was found, -1 otherwise
+ */
+int vocab_lookup(const vocab_t* vocab, const char* text, size_t len, uint32_t* id) {
+    if (!vocab || !vocab->slots || !text) {
+        return -1;
+    }
+
+    uint32_t hash = vocab_hash(text, len);
+    uint32_t mask = vocab->capacity - 1;
+    uint32_t index = hash & mask;
+
+    while (vocab->slots[index]) {
+        uint32_t other = vocab->slots[index] - 1;
+
+        if (vocab->hashes[other] == hash && vocab->lengths[other] == len &&
+            memcmp(vocab->strings + vocab->offsets[other], text, len) == 0) {
+            if (id) {
+                *id = other;
+            }
+            return 0;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    return -1;
+}
+
+/**
+ * Get the text of a token
+ *
+ * @param vocab: Vocabulary
+ * @param id: Token ID
+ * @param len: Pointer to store the token length, may be NULL
+ * @return: NUL-terminated token text, NULL if the ID has no token
+ */
+const char* vocab_get_text(const vocab_t* vocab, uint32_t id, size_t* len) {
+    if (!vocab || !vocab->slots || id >= vocab->max_tokens || vocab->offsets[id] == VOCAB_NO_TOKEN) {
+        return NULL;
+    }
+
+    if (len) {
+        *len = vocab->lengths[id];
+    }
+
+    return vocab->strings + vocab->offsets[id];
+}
+
+/**
+ * Skip whitespace in JSON
+ *
+ * @param p: Current position
+ * @param end: End of the JSON
+ * @return: First non-whitespace position
+ */
+const char* vocab_json_skip_ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * Encode a code point as UTF-8
+ *
+ * @param cp: Code point
+ * @param out: Output buffer (at least 4 bytes)
+ * @return: Number of bytes written
+ */
+static size_t vocab_put_utf8(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/**
+ * Parse four hex digits
+ *
+ * @param p: First digit
+ * @param value: Pointer to store the value
+ * @return: 0 on success, -1 on failure
+ */
+static int vocab_parse_hex4(const char* p, uint32_t* value) {
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+
+        if (c >= '0' && c <= '9') {
+            v |= (uint32_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            v |= (uint32_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            v |= (uint32_t)(c - 'A' + 10);
+        } else {
+            return -1;
+        }
+    }
+
+    *value = v;
+
+    return 0;
+}
+
+/**
+ * Parse a JSON string, decoding escapes
+ *
+ * @param p: Position of the opening quote
+ * @param end: End of the JSON
+ * @param out: Output buffer, may be NULL to skip the string
+ * @param out_size: Size of the output buffer
+ * @param out_len: Pointer to store the decoded length, SIZE_MAX if it did not fit
+ * @return: Position after the closing quote, NULL on failure
+ */
+const char* vocab_json_parse_string(const char* p, const char* end, char* out, size_t out_size, size_t* out_len) {
+    size_t len = 0;
+    int overflow = 0;
+
+    if (p >= end || *p != '"') {
+        return NULL;
+    }
+
+    for (p++; p < end && *p != '"'; p++) {
+        char buf[4];
+        size_t n = 1;
+
+        buf[0] = *p;
+
+        if (*p == '\\') {
+            if (++p >= end) {
+                return NULL;
+            }
+
+            switch (*p) {
+                case 'n': buf[0] = '\n'; break;
+                case 't': buf[0] = '\t'; break;
+                case 'r': buf[0] = '\r'; break;
+                case 'b': buf[0] = '\b'; break;
+                case 'f': buf[0] = '\f'; break;
+                case 'u': {
+                    uint32_t cp;
+
+                    if (end - p < 5 || vocab_parse_hex4(p + 1, &cp) != 0) {
+                        return NULL;
+                    }
+                    p += 4;
+
+                    // Combine surrogate pairs
+                    if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 7 && p[1] == '\\' && p[2] == 'u') {
+                        uint32_t low;
+
+                        if (vocab_parse_hex4(p + 3, &low) == 0 && low >= 0xDC00 && low < 0xE000) {
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                            p += 6;
+                        }
+                    }
+
+                    n = vocab_put_utf8(cp, buf);
+                    break;
+                }
+                default: buf[0] = *p; break;
+            }
+        }
+
+        if (out) {
+            if (len + n > out_size) {
+                overflow = 1;
+            } else {
+                memcpy(out + len, buf, n);
+            }
+        }
+        len += n;
+    }
+
+    if (p >= end) {
+        return NULL;
+    }
+
+    if (out_len) {
+        *out_len = overflow ? (size_t)-1 : len;
+    }
+
+    return p + 1;
+}
+
+/**
+ * Parse an unsigned integer in JSON
+ *
+ * @param p: Current position
+ * @param end: End of the JSON
+ * @param value: Pointer to store the value
+ * @return: Position after the number, NULL on failure
+ */
+static const char* vocab_parse_uint(const char* p, const char* end, uint32_t* value) {
+    uint64_t v = 0;
+    const char* start = p;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint64_t)(*p - '0');
+        if (v > 0xFFFFFFFEu) {
+            return NULL;
+        }
+        p++;
+    }
+
+    if (p == start) {
+        return NULL;
+    }
+
+    *value = (uint32_t)v;
+
+    return p;
+}
+
+/**
+ * Skip a JSON value
+ *
+ * @param p: Start of the value
+ * @param end: End of the JSON
+ * @return: Position after the value, NULL on failure
+ */
+static const char* vocab_skip_value(const char* p, const char* end) {
+    int depth = 0;
+
+    do {
+        p = vocab_json_skip_ws(p, end);
+        if (p >= end) {
+            return NULL;
+        }
+
+        if (*p == '"') {
+            p = vocab_json_parse_string(p, end, NULL, 0, NULL);
+            if (!p) {
+                return NULL;
+            }
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+            p++;
+        } else if (*p == '}' || *p == ']') {
+            depth--;
+            p++;
+        } else {
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n') {
+                p++;
+            }
+        }
+    } while (depth > 0);
+
+    return p;
+}
+
+/**
+ * Find the value of a key in JSON
+ *
+ * @param p: Where to start searching
+ * @param end: End of the JSON
+ * @param key: Key to find
+ * @return: Position of the value, NULL if the key was not found
+ */
+const char* vocab_json_find_key(const char* p, const char* end, const char* key) {
+    size_t key_len = strlen(key);
+
+    for (; p + key_len + 2 < end; p++) {
+        if (*p != '"' || p[key_len + 1] != '"' || memcmp(p + 1, key, key_len) != 0) {
+            continue;
+        }
+
+        // A key is followed by a colon, a string value is not
+        const char* value = vocab_json_skip_ws(p + key_len + 2, end);
+
+        if (value < end && *value == ':') {
+            return vocab_json_skip_ws(value + 1, end);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Sizes gathered by the counting pass over tokenizer.json
+ */
+typedef struct {
+    uint32_t max_id;
+    uint32_t count;
+    size_t strings_size;
+} vocab_counts_t;
+
+/**
+ * Record one token, or count it when there is no vocabulary yet
+ *
+ * @param vocab: Vocabulary, NULL for the counting pass
+ * @param counts: Counts for the counting pass
+ * @param text: Token text
+ * @param len: Token length
+ * @param id: Token ID
+ */
+static void vocab_take(vocab_t* vocab, vocab_counts_t* counts, const char* text, size_t len, uint32_t id) {
+    if (vocab) {
+        vocab_add(vocab, text, len, id);
+        return;
+    }
+
+    if (id + 1 > counts->max_id) {
+        counts->max_id = id + 1;
+    }
+    counts->count++;
+    counts->strings_size += len + 1;
+}
+
+/**
+ * Walk the vocabulary and added tokens of tokenizer.json
+ *
+ * @param json: tokenizer.json contents
+ * @param end: End of the contents
+ * @param vocab: Vocabulary to fill, NULL for the counting pass
+ * @param counts: Counts for the counting pass
+ * @param token: Scratch buffer for decoded token text
+ * @return: 0 on success, -1 on malformed JSON
+ */
+static int vocab_walk_json(const char* json, const char* end, vocab_t* vocab, vocab_counts_t* counts, char* token) {
+    // "model": { ..., "vocab": { "token": id, ... } }
+    const char* model = vocab_json_find_key(json, end, "model");
+    const char* p = vocab_json_find_key(model ? model : json, end, "vocab");
+
+    if (p && p < end && *p == '{') {
+        p++;
+
+        for (;;) {
+            size_t len;
+            uint32_t id;
+
+            p = vocab_json_skip_ws(p, end);
+            if (p < end && *p == '}') {
+                break;
+            }
+
+            p = vocab_json_parse_string(p, end, token, VOCAB_MAX_TOKEN_LEN, &len);
+            if (!p) {
+                return -1;
+            }
+
+            p = vocab_json_skip_ws(p, end);
+            if (p >= end || *p != ':') {
+                return -1;
+            }
+
+            p = vocab_parse_uint(vocab_json_skip_ws(p + 1, end), end, &id);
+            if (!p) {
+                return -1;
+            }
+
+            if (len != (size_t)-1) {
+                vocab_take(vocab, counts, token, len, id);
+            }
+
+            p = vocab_json_skip_ws(p, end);
+            if (p < end && *p == ',') {
+                p++;
+            }
+        }
+    }
+
+    // "added_tokens": [ { "id": id, "content": "token", ... }, ... ]
+    p = vocab_json_find_key(json, end, "added_tokens");
+
+    if (p && p < end && *p == '[') {
+        p++;
+
+        for (;;) {
+            uint32_t id = VOCAB_NO_TOKEN;
+            size_t len = (size_t)-1;
+
+            p = vocab_json_skip_ws(p, end);
+            if (p < end && *p == ']') {
+                break;
+            }
+
+            if (p >= end || *p != '{') {
+                return -1;
+            }
+            p++;
+
+            for (;;) {
+                char key[16];
+                size_t key_len;
+
+                p = vocab_json_skip_ws(p, end);
+                if (p < end && *p == '}') {
+                    p++;
+                    break;
+                }
+
+                p = vocab_json_parse_string(p, end, key, sizeof(key) - 1, &key_len);
+                if (!p) {
+                    return -1;
+                }
+
+                key[key_len == (size_t)-1 ? 0 : key_len] = '\0';
+
+                p = vocab_json_skip_ws(p, end);
+                if (p >= end || *p != ':') {
+                    return -1;
+                }
+                p = vocab_json_skip_ws(p + 1, end);
+
+                if (strcmp(key, "id") == 0) {
+                    p = vocab_parse_uint(p, end, &id);
+                } else if (strcmp(key, "content") == 0) {
+                    p = vocab_json_parse_string(p, end, token, VOCAB_MAX_TOKEN_LEN, &len);
+                } else {
+                    p = vocab_skip_value(p, end);
+                }
+
+                if (!p) {
+                    return -1;
+                }
+
+                p = vocab_json_skip_ws(p, end);
+                if (p < end && *p == ',') {
+                    p++;
+                }
+            }
+
+            if (id != VOCAB_NO_TOKEN && len != (size_t)-1) {
+                vocab_take(vocab, counts, token, len, id);
+            }
+
+            p = vocab_json_skip_ws(p, end);
+            if (p < end && *p == ',') {
+                p++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Build a vocabulary from tokenizer.json
+ *
+ * Reads the model vocabulary and the added tokens. The file is walked
+ * twice: once to size the tables and once to fill them.
+ *
+ * @param vocab: Vocabulary to initialize
+ * @param json: tokenizer.json contents
+ * @param len: Length of the contents
+ * @return: 0 on success, -1 on failure or if the file has no vocabulary
+ */
+int vocab_load_json(vocab_t* vocab, const char* json, size_t len) {
+    if (!vocab || !json) {
+        return -1;
+    }
+
+    const char* end = json + len;
+    char* token = (char*)memory_alloc(VOCAB_MAX_TOKEN_LEN, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    vocab_counts_t counts = {0, 0, 0};
+
+    if (!token) {
+        return -1;
+    }
+
+    if (vocab_walk_json(json, end, NULL, &counts, token) != 0 || counts.count == 0) {
+        memory_free(token, VOCAB_MAX_TOKEN_LEN);
+        return -1;
+    }
+
+    if (vocab_init(vocab, counts.max_id, counts.strings_size) != 0) {
+        memory_free(token, VOCAB_MAX_TOKEN_LEN);
+        return -1;
+    }
+
+    vocab_walk_json(json, end, vocab, NULL, token);
+    memory_free(token, VOCAB_MAX_TOKEN_LEN);
+
+    return 0;
+}
@@ -6,7 +6,13 @@
  */
 
 #include "dl_framework/dl_framework.h"
+#include "dl_framework/dl_kernels.h"
+#include "dl_framework/dl_thread_pool.h"
 #include "../nlp/tokenizer.h"
+#include "../../kernel/include/quantize.h"
+#include "../../kernel/include/memory.h"
+#include "../../kernel/include/timer.h"
+#include "../../kernel/include/trace.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -25,6 +31,64 @@
 // Maximum number of operations per framework
 #define MAX_OPERATIONS 256
 
+// Minimum work per parallel chunk: GEMM rows, quantized GEMV rows and elementwise elements
+#define DL_PARALLEL_GEMM_ROWS     4
+#define DL_PARALLEL_GEMV_ROWS     64
+#define DL_PARALLEL_ELEMENTS      16384
+
+// Maximum number of compiled graphs per framework
+#define MAX_GRAPHS 8
+
+// Maximum inputs or outputs of an operation in a compiled graph
+#define DL_GRAPH_MAX_OP_IO 4
+
+// Tensor header pages: each page holds many small tensor headers
+#define DL_TENSOR_PAGE_SIZE 4096
+#define DL_MAX_TENSOR_PAGES 64
+
+// Alignment of tensors placed in a graph arena
+#define DL_ARENA_ALIGNMENT 64
+
+// Compiled graph step kinds
+#define DL_GRAPH_STEP_SINGLE           0
+#define DL_GRAPH_STEP_MATMUL_EPILOGUE  1
+#define DL_GRAPH_STEP_MUL_ADD          2
+#define DL_GRAPH_STEP_SCALE_SOFTMAX    3
+
+// Compiled graph step: one operation, or a fused chain of operations
+typedef struct {
+    uint32_t kind;
+    uint32_t num_ops;
+    dl_op_t op;
+    nn_tensor_t* inputs[DL_GRAPH_MAX_OP_IO];
+    nn_tensor_t* outputs[DL_GRAPH_MAX_OP_IO];
+    nn_tensor_t* bias;
+    uint32_t activation;
+} dl_graph_step_t;
+
+// Compiled graph
+typedef struct {
+    dl_graph_id_t id;
+    uint32_t num_ops;
+    uint32_t num_steps;
+    uint32_t num_fused;
+    uint64_t num_executions;
+    dl_graph_step_t* steps;
+    void* arena;
+    size_t arena_size;
+    size_t unplanned_size;
+    nn_tensor_t** planned;
+    uint32_t num_planned;
+} dl_graph_t;
+
+// Pooled tensor header with inline shape
+typedef struct dl_tensor_header {
+    nn_tensor_t tensor;
+    uint32_t shape[DL_TENSOR_MAX_DIMS];
+    struct dl_tensor_header* next_free;
+    uint32_t in_use;
+} dl_tensor_header_t;
+
 // DL framework table
 static struct {
     dl_framework_id_t id;
@@ -39,9 +103,70 @@ static struct {
     uint32_t num_operations;
     uint32_t num_tensors;
     uint32_t num_models;
+    dl_pool_t* pool;
     dl_op_t operations[MAX_OPERATIONS];
+    dl_graph_t graphs[MAX_GRAPHS];
+    dl_graph_id_t next_graph_id;
+    dl_tensor_header_t* free_headers;
+    void* tensor_pages[DL_MAX_TENSOR_PAGES];
+    uint32_t num_tensor_pages;
+    uint64_t tensor_memory;
+    uint64_t activation_memory;
+    uint64_t peak_activation_memory;
+    uint32_t num_allocations;
 } dl_frameworks[MAX_DL_FRAMEWORKS];
 
+// Arguments of a parallel operation
+typedef struct {
+    const float* a;
+    const float* b;
+    float* c;
+    const nn_qmatrix_t* qm;
+    uint32_t n;
+    uint32_t k;
+    const float* d;
+    uint32_t activation;
+    float scale;
+} dl_parallel_args_t;
+
+// Tracepoints: one per operation type, indexed by DL_OP_TYPE_*
+#define DL_TRACE_OP(name) { name, TRACE_CAT_DL, { "op", "elements" } }
+
+static const trace_point_t dl_trace_ops[DL_OP_TYPE_GELU + 1] = {
+    DL_TRACE_OP("unknown"), DL_TRACE_OP("add"), DL_TRACE_OP("sub"), DL_TRACE_OP("mul"),
+    DL_TRACE_OP("div"), DL_TRACE_OP("matmul"), DL_TRACE_OP("conv1d"), DL_TRACE_OP("conv2d"),
+    DL_TRACE_OP("maxpool"), DL_TRACE_OP("avgpool"), DL_TRACE_OP("relu"), DL_TRACE_OP("sigmoid"),
+    DL_TRACE_OP("tanh"), DL_TRACE_OP("softmax"), DL_TRACE_OP("batchnorm"), DL_TRACE_OP("dropout"),
+    DL_TRACE_OP("embedding"), DL_TRACE_OP("lstm"), DL_TRACE_OP("gru"), DL_TRACE_OP("attention"),
+    DL_TRACE_OP("transformer"), DL_TRACE_OP("custom"), DL_TRACE_OP("gelu")
+};
+
+// Tracepoints of the fused graph steps, the graph as a whole and inference
+static const trace_point_t dl_trace_matmul_epilogue = { "matmul_epilogue", TRACE_CAT_DL, { "ops", "elements" } };
+static const trace_point_t dl_trace_mul_add = { "mul_add", TRACE_CAT_DL, { "ops", "elements" } };
+static const trace_point_t dl_trace_scale_softmax = { "scale_softmax", TRACE_CAT_DL, { "ops", "elements" } };
+static const trace_point_t dl_trace_graph = { "graph", TRACE_CAT_DL, { "graph", "steps" } };
+static const trace_point_t dl_trace_inference = { "inference", TRACE_CAT_DL, { "inputs", "outputs" } };
+
+// Distinct tracepoints a profile reports
+#define DL_PROFILE_MAX_ENTRIES 32
+
+// Time spent at one tracepoint during a profile
+typedef struct {
+    const trace_point_t* point;
+    uint32_t calls;
+    uint64_t cycles;
+    uint64_t elements;
+} dl_profile_entry_t;
+
+// Events a profile aggregates
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    dl_profile_entry_t entries[DL_PROFILE_MAX_ENTRIES];
+    uint32_t num_entries;
+} dl_profile_t;
+
 // Next available DL framework ID
 static dl_framework_id_t next_dl_framework_id = 1;
 
@@ -54,6 +179,9 @@ static int dl_framework_exists(dl_framework_id_t id);
 static int dl_framework_find_free_operation_slot(dl_framework_id_t framework_id);
 static int dl_framework_operation_exists(dl_framework_id_t framework_id, dl_op_id_t op_id);
 static int dl_framework_find_operation_index(dl_framework_id_t framework_id, dl_op_id_t op_id);
+static void dl_framework_free_graphs(int slot);
+static void dl_framework_free_tensors(int slot);
+static int dl_framework_run_op(int slot, dl_op_t* op);
 
 /* Forward declaration for nn_get_model_embeddings */
 int nn_get_model_embeddings(nn_model_id_t model_id, float** embedding_table, size_t* embedding_size);
@@ -182,6 +310,186 @@ static int dl_framework_find_operation_index(dl_framework_id_t framework_id, dl_
     return -1;
 }
 
+/**
+ * Get the number of elements in a tensor
+ *
+ * @param tensor: Tensor
+ * @return: Number of elements
+ */
+static uint32_t dl_tensor_elements(const nn_tensor_t* tensor) {
+    uint32_t total = 1;
+
+    for (uint32_t i = 0; i < tensor->ndim; i++) {
+        total *= tensor->shape[i];
+    }
+
+    return total;
+}
+
+/**
+ * Check whether two tensors have the same shape
+ *
+ * @param a: First tensor
+ * @param b: Second tensor
+ * @return: 1 if the shapes match, 0 otherwise
+ */
+static int dl_tensor_same_shape(const nn_tensor_t* a, const nn_tensor_t* b) {
+    if (a->ndim != b->ndim) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < a->ndim; i++) {
+        if (a->shape[i] != b->shape[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * GELU activation (tanh approximation)
+ *
+ * @param x: Input value
+ * @return: GELU(x)
+ */
+static float dl_gelu(float x) {
+    return 0.5f * x * (1.0f + tanhf(0.7978845608f * (x + 0.044715f * x * x * x)));
+}
+
+/**
+ * Apply a fused bias add and activation to a contiguous range of outputs
+ *
+ * @param c: Output values (updated in place)
+ * @param bias: Bias values for the same range, or NULL
+ * @param count: Number of values
+ * @param activation: DL_OP_TYPE_RELU, DL_OP_TYPE_GELU or DL_OP_TYPE_UNKNOWN for none
+ */
+static void dl_parallel_epilogue(float* c, const float* bias, uint32_t count, uint32_t activation) {
+    if (bias) {
+        dl_kernel_add(c, bias, c, count);
+    }
+
+    if (activation == DL_OP_TYPE_RELU) {
+        dl_kernel_relu(c, c, count);
+    } else if (activation == DL_OP_TYPE_GELU) {
+        for (uint32_t i = 0; i < count; i++) {
+            c[i] = dl_gelu(c[i]);
+        }
+    }
+}
+
+/**
+ * Parallel range: rows [begin, end) of an fp32 GEMM, with an optional fused epilogue
+ */
+static void dl_parallel_gemm(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+    float* c = args->c + (size_t)begin * args->n;
+
+    dl_kernel_gemm(end - begin, args->n, args->k, args->a + (size_t)begin * args->k, args->b, c);
+    dl_parallel_epilogue(c, args->d ? args->d + (size_t)begin * args->n : NULL, (end - begin) * args->n,
+                         args->activation);
+}
+
+/**
+ * Parallel range: rows [begin, end) of a quantized MATMUL (one GEMV per row)
+ */
+static void dl_parallel_qgemv(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+    uint32_t n = args->qm->rows;
+
+    for (uint32_t i = begin; i < end; i++) {
+        nn_qmatrix_gemv(args->qm, args->a + (size_t)i * args->qm->cols, args->c + (size_t)i * n);
+        dl_parallel_epilogue(args->c + (size_t)i * n, args->d ? args->d + (size_t)i * n : NULL, n, args->activation);
+    }
+}
+
+/**
+ * Parallel range: output columns [begin, end) of a single-row quantized MATMUL
+ */
+static void dl_parallel_qgemv_cols(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+
+    nn_qmatrix_gemv_rows(args->qm, args->a, args->c, begin, end);
+    dl_parallel_epilogue(args->c + begin, args->d ? args->d + begin : NULL, end - begin, args->activation);
+}
+
+/**
+ * Parallel range: elements [begin, end) of an elementwise addition
+ */
+static void dl_parallel_add(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+    dl_kernel_add(args->a + begin, args->b + begin, args->c + begin, end - begin);
+}
+
+/**
+ * Parallel range: elements [begin, end) of an elementwise multiplication, with an optional fused add of d
+ */
+static void dl_parallel_mul(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+
+    dl_kernel_mul(args->a + begin, args->b + begin, args->c + begin, end - begin);
+    if (args->d) {
+        dl_kernel_add(args->c + begin, args->d + begin, args->c + begin, end - begin);
+    }
+}
+
+/**
+ * Parallel range: elements [begin, end) of a multiplication by a scalar
+ */
+static void dl_parallel_scale(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+
+    for (uint32_t i = begin; i < end; i++) {
+        args->c[i] = args->a[i] * args->scale;
+    }
+}
+
+/**
+ * Parallel range: elements [begin, end) of a ReLU
+ */
+static void dl_parallel_relu(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+    dl_kernel_relu(args->a + begin, args->c + begin, end - begin);
+}
+
+/**
+ * Parallel range: rows [begin, end) of a softmax
+ */
+static void dl_parallel_softmax(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+    dl_kernel_softmax(args->a + (size_t)begin * args->n, args->c + (size_t)begin * args->n, end - begin, args->n);
+}
+
+/**
+ * Parallel range: rows [begin, end) of a softmax of scaled inputs
+ */
+static void dl_parallel_scaled_softmax(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+
+    for (uint32_t r = begin; r < end; r++) {
+        const float* x = args->a + (size_t)r * args->n;
+        float* y = args->c + (size_t)r * args->n;
+
+        // Scale into the output row while it is hot, then normalize in place
+        for (uint32_t j = 0; j < args->n; j++) {
+            y[j] = x[j] * args->scale;
+        }
+        dl_kernel_softmax(y, y, 1, args->n);
+    }
+}
+
+/**
+ * Parallel range: elements [begin, end) of a GELU
+ */
+static void dl_parallel_gelu(void* arg, uint32_t begin, uint32_t end) {
+    dl_parallel_args_t* args = (dl_parallel_args_t*)arg;
+
+    for (uint32_t i = begin; i < end; i++) {
+        args->c[i] = dl_gelu(args->a[i]);
+    }
+}
+
 /**
  * Initialize the DL framework subsystem
  *
@@ -206,8 +514,20 @@ int dl_framework_init(void) {
         dl_frameworks[i].num_operations = 0;
         dl_frameworks[i].num_tensors = 0;
         dl_frameworks[i].num_models = 0;
+        dl_frameworks[i].pool = NULL;
+        memset(dl_frameworks[i].graphs, 0, sizeof(dl_frameworks[i].graphs));
+        dl_frameworks[i].next_graph_id = 1;
+        dl_frameworks[i].free_headers = NULL;
+        dl_frameworks[i].num_tensor_pages = 0;
+        dl_frameworks[i].tensor_memory = 0;
+        dl_frameworks[i].activation_memory = 0;
+        dl_frameworks[i].peak_activation_memory = 0;
+        dl_frameworks[i].num_allocations = 0;
     }
 
+    // Select the compute kernels for this CPU
+    dl_kernels_init();
+
     // Set the initialized flag
     dl_framework_initialized = 1;
 
@@ -235,6 +555,16 @@ int dl_framework_shutdown(void) {
                 dl_frameworks[i].framework_memory_size = 0;
             }
 
+            // Stop the worker pool
+            if (dl_frameworks[i].pool) {
+                dl_pool_destroy(dl_frameworks[i].pool);
+                dl_frameworks[i].pool = NULL;
+            }
+
+            // Free all compiled graphs and tensors
+            dl_framework_free_graphs(i);
+            dl_framework_free_tensors(i);
+
             // Free all operations
             for (uint32_t j = 0; j < dl_frameworks[i].num_operations; j++) {
                 if (dl_frameworks[i].operations[j].inputs) {
@@ -310,6 +640,14 @@ dl_framework_id_t dl_framework_create(const dl_framework_config_t* config) {
     dl_frameworks[slot].num_operations = 0;
     dl_frameworks[slot].num_tensors = 0;
     dl_frameworks[slot].num_models = 0;
+    memset(dl_frameworks[slot].graphs, 0, sizeof(dl_frameworks[slot].graphs));
+    dl_frameworks[slot].next_graph_id = 1;
+    dl_frameworks[slot].free_headers = NULL;
+    dl_frameworks[slot].num_tensor_pages = 0;
+    dl_frameworks[slot].tensor_memory = 0;
+    dl_frameworks[slot].activation_memory = 0;
+    dl_frameworks[slot].peak_activation_memory = 0;
+    dl_frameworks[slot].num_allocations = 0;
 
     // Allocate memory for the DL framework
     size_t memory_size = 10 * 1024 * 1024; // 10 MB
@@ -328,6 +666,12 @@ dl_framework_id_t dl_framework_create(const dl_framework_config_t* config) {
     dl_frameworks[slot].framework_memory_size = memory_size;
     dl_frameworks[slot].memory_usage = memory_size;
 
+    // Start the worker pool; operations run on the calling thread if this fails
+    dl_frameworks[slot].pool = NULL;
+    if (config->num_threads > 1) {
+        dl_frameworks[slot].pool = dl_pool_create(config->num_threads);
+    }
+
     return dl_frameworks[slot].id;
 }
 
@@ -364,6 +708,16 @@ int dl_framework_destroy(dl_framework_id_t framework_id) {
         dl_frameworks[slot].framework_memory_size = 0;
     }
 
+    // Stop the worker pool
+    if (dl_frameworks[slot].pool) {
+        dl_pool_destroy(dl_frameworks[slot].pool);
+        dl_frameworks[slot].pool = NULL;
+    }
+
+    // Free all compiled graphs and tensors
+    dl_framework_free_graphs(slot);
+    dl_framework_free_tensors(slot);
+
     // Free all operations
     for (uint32_t i = 0; i < dl_frameworks[slot].num_operations; i++) {
         if (dl_frameworks[slot].operations[i].inputs) {
@@ -451,6 +805,29 @@ int dl_framework_get_state(dl_framework_id_t framework_id, dl_framework_state_t*
     state->num_layers = 0;
     state->num_parameters = 0;
 
+    // Memory: framework block, tensor data and graph arenas
+    state->memory_usage = (uint32_t)(dl_frameworks[slot].memory_usage + dl_frameworks[slot].tensor_memory +
+                                     dl_frameworks[slot].activation_memory);
+    state->activation_memory = dl_frameworks[slot].activation_memory;
+    state->peak_activation_memory = dl_frameworks[slot].peak_activation_memory;
+    state->num_allocations = dl_frameworks[slot].num_allocations;
+
+    // Per-worker utilization
+    state->num_workers = dl_pool_get_num_workers(dl_frameworks[slot].pool);
+    for (uint32_t i = 0; i < DL_FRAMEWORK_MAX_WORKERS; i++) {
+        dl_pool_worker_stats_t stats;
+
+        if (dl_pool_get_worker_stats(dl_frameworks[slot].pool, i, &stats) == 0) {
+            state->worker_utilization[i] = stats.utilization;
+            state->worker_tasks[i] = stats.tasks_executed;
+            state->worker_steals[i] = stats.tasks_stolen;
+        } else {
+            state->worker_utilization[i] = 0;
+            state->worker_tasks[i] = 0;
+            state->worker_steals[i] = 0;
+        }
+    }
+
     return 0;
 }
 
@@ -612,6 +989,8 @@ int dl_framework_run_inference(dl_framework_id_t framework_id, const nn_model_t*
     if (num_inputs == 0 || num_outputs == 0) {
         return -1;
     }
+
+    uint64_t trace_start = trace_begin(&dl_trace_inference);
     
     // Validate input shapes match model expectations
     for (uint32_t i = 0; i < num_inputs; i++) {
@@ -643,9 +1022,192 @@ int dl_framework_run_inference(dl_framework_id_t framework_id, const nn_model_t*
     // Update the DL framework state
     dl_frameworks[slot].inference_time += 100; // 100 ms
 
+    trace_end(&dl_trace_inference, trace_start, num_inputs, num_outputs);
+
+    return 0;
+}
+
+/**
+ * Add a traced DL framework span to a profile
+ *
+ * @param ctx: Profile
+ * @param cpu: CPU that recorded the event
+ * @param event: Trace event
+ * @return: 0 to continue the walk
+ */
+static int dl_profile_visit(void* ctx, uint32_t cpu, const trace_event_t* event) {
+    dl_profile_t* profile = (dl_profile_t*)ctx;
+    (void)cpu;
+
+    // Only operation spans recorded during the profiled run count; graph
+    // spans contain the operation spans and would count them twice
+    if (event->point->category != TRACE_CAT_DL || event->kind != TRACE_EVENT_SPAN ||
+        event->point == &dl_trace_graph || event->point == &dl_trace_inference ||
+        event->start < profile->start || event->start > profile->end) {
+        return 0;
+    }
+
+    uint32_t i = 0;
+    while (i < profile->num_entries && profile->entries[i].point != event->point) {
+        i++;
+    }
+
+    if (i == profile->num_entries) {
+        if (profile->num_entries == DL_PROFILE_MAX_ENTRIES) {
+            return 0;
+        }
+
+        profile->entries[i].point = event->point;
+        profile->entries[i].calls = 0;
+        profile->entries[i].cycles = 0;
+        profile->entries[i].elements = 0;
+        profile->num_entries++;
+    }
+
+    profile->entries[i].calls++;
+    profile->entries[i].cycles += event->duration;
+    profile->entries[i].elements += event->args[1];
+
     return 0;
 }
 
+/**
+ * Profile a model in a DL framework
+ *
+ * Runs the compiled graphs of the framework once (its operations in creation
+ * order if it has no graphs) with DL tracing on, then reports the time
+ * spent per operation kind from the trace, most expensive first. The
+ * inputs must already be bound to the graph or operation tensors. The
+ * events also stay in the trace rings for an export.
+ *
+ * @param framework_id: DL framework ID
+ * @param model: Model to profile
+ * @param inputs: Input tensors
+ * @param num_inputs: Number of input tensors
+ * @param profile_output: Buffer to store the profile report
+ * @param output_size: Size of the profile report buffer
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_profile_model(dl_framework_id_t framework_id, const nn_model_t* model, const nn_tensor_t** inputs, uint32_t num_inputs, char* profile_output, size_t output_size) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Check if the model, inputs, and output pointers are valid
+    if (!model || !inputs || num_inputs == 0 || !profile_output || output_size == 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_inputs; i++) {
+        if (!inputs[i] || !inputs[i]->data) {
+            return -1;
+        }
+    }
+
+    // Find the DL framework
+    int slot = -1;
+
+    for (int i = 0; i < MAX_DL_FRAMEWORKS; i++) {
+        if (dl_frameworks[i].loaded && dl_frameworks[i].id == framework_id) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    // Trace DL operations for the run, on top of whatever is being traced
+    uint32_t categories = trace_get_categories();
+    trace_start(TRACE_CAT_DL);
+
+    dl_profile_t* profile = (dl_profile_t*)memory_alloc(sizeof(dl_profile_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                                        MEMORY_ALLOC_ZEROED);
+    if (!profile) {
+        if (!(categories & TRACE_CAT_DL)) {
+            trace_stop(TRACE_CAT_DL);
+        }
+        return -1;
+    }
+
+    profile->start = trace_clock();
+
+    int result = 0;
+    uint32_t num_graphs = 0;
+
+    for (int i = 0; i < MAX_GRAPHS; i++) {
+        if (dl_frameworks[slot].graphs[i].id != 0) {
+            num_graphs++;
+            if (dl_framework_execute_graph(framework_id, dl_frameworks[slot].graphs[i].id) != 0) {
+                result = -1;
+            }
+        }
+    }
+
+    if (num_graphs == 0) {
+        for (uint32_t i = 0; i < dl_frameworks[slot].num_operations; i++) {
+            dl_op_t* op = &dl_frameworks[slot].operations[i];
+
+            if (op->inputs && op->outputs && dl_framework_run_op(slot, op) != 0) {
+                result = -1;
+            }
+        }
+    }
+
+    profile->end = trace_clock();
+
+    if (!(categories & TRACE_CAT_DL)) {
+        trace_stop(TRACE_CAT_DL);
+    }
+
+    // Collect the spans of the run
+    trace_for_each(dl_profile_visit, profile);
+
+    // Most expensive first
+    for (uint32_t i = 1; i < profile->num_entries; i++) {
+        dl_profile_entry_t entry = profile->entries[i];
+        uint32_t j = i;
+
+        while (j > 0 && profile->entries[j - 1].cycles < entry.cycles) {
+            profile->entries[j] = profile->entries[j - 1];
+            j--;
+        }
+
+        profile->entries[j] = entry;
+    }
+
+    // Write the report
+    uint64_t total_ns = trace_cycles_to_ns(profile->end - profile->start);
+    size_t pos = 0;
+    int written = snprintf(profile_output, output_size, "%u graphs, %u us\n%-16s %8s %12s %6s\n",
+                           num_graphs, (uint32_t)(total_ns / TIMER_NS_PER_US), "operation", "calls", "time (us)", "share");
+
+    if (written > 0) {
+        pos = (size_t)written < output_size ? (size_t)written : output_size - 1;
+    }
+
+    for (uint32_t i = 0; i < profile->num_entries && pos < output_size - 1; i++) {
+        dl_profile_entry_t* entry = &profile->entries[i];
+        uint64_t ns = trace_cycles_to_ns(entry->cycles);
+        uint32_t share = total_ns ? (uint32_t)(ns * 100 / total_ns) : 0;
+
+        written = snprintf(profile_output + pos, output_size - pos, "%-16s %8u %12u %5u%%\n",
+                           entry->point->name, entry->calls, (uint32_t)(ns / TIMER_NS_PER_US), share);
+
+        if (written > 0) {
+            pos += (size_t)written < output_size - pos ? (size_t)written : output_size - pos - 1;
+        }
+    }
+
+    dl_frameworks[slot].inference_time += total_ns / TIMER_NS_PER_MS;
+
+    memory_free(profile, sizeof(dl_profile_t));
+
+    return result;
+}
+
 /**
  * Create an operation in a DL framework
  *
@@ -997,59 +1559,25 @@ int dl_framework_set_operation_attributes(dl_framework_id_t framework_id, dl_op_
 }
 
 /**
- * Execute an operation in a DL framework
+ * Execute a single operation
  *
- * @param framework_id: DL framework ID
- * @param op_id: Operation ID
+ * @param slot: DL framework slot
+ * @param op: Operation to execute
  * @return: 0 on success, -1 on failure
  */
-int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op_id) {
-    // Check if the DL framework is initialized
-    if (!dl_framework_initialized) {
-        return -1;
-    }
-
-    // Find the DL framework
-    int slot = -1;
-
-    for (int i = 0; i < MAX_DL_FRAMEWORKS; i++) {
-        if (dl_frameworks[i].loaded && dl_frameworks[i].id == framework_id) {
-            slot = i;
-            break;
-        }
-    }
-
-    if (slot == -1) {
-        return -1;
-    }
-
-    // Find the operation
-    int op_slot = -1;
-
-    for (uint32_t i = 0; i < dl_frameworks[slot].num_operations; i++) {
-        if (dl_frameworks[slot].operations[i].id == op_id) {
-            op_slot = i;
-            break;
-        }
-    }
-
-    if (op_slot == -1) {
-        return -1;
-    }
-
-    // Check if the operation has inputs and outputs
-    if (!dl_frameworks[slot].operations[op_slot].inputs || !dl_frameworks[slot].operations[op_slot].outputs) {
-        return -1;
-    }
+static int dl_framework_run_op(int slot, dl_op_t* op) {
+    const trace_point_t* point = &dl_trace_ops[op->type <= DL_OP_TYPE_GELU ? op->type : DL_OP_TYPE_UNKNOWN];
+    uint64_t trace_start = trace_begin(point);
+    uint64_t start_ns = timer_now_ns();
 
     // Execute the operation based on its type
-    switch (dl_frameworks[slot].operations[op_slot].type) {
+    switch (op->type) {
         case DL_OP_TYPE_MATMUL:
             // Matrix multiplication
             {
-                nn_tensor_t* a = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* b = dl_frameworks[slot].operations[op_slot].inputs[1];
-                nn_tensor_t* c = dl_frameworks[slot].operations[op_slot].outputs[0];
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->inputs[1];
+                nn_tensor_t* c = op->outputs[0];
                 
                 // Check dimensions
                 if (a->ndim != 2 || b->ndim != 2 || c->ndim != 2) {
@@ -1063,56 +1591,39 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
                     return -1;
                 }
                 
-                // Perform matrix multiplication with cache-friendly blocking
-                float* a_data = (float*)a->data;
-                float* b_data = (float*)b->data;
-                float* c_data = (float*)c->data;
-                
-                // Initialize output matrix to zeros
-                memset(c_data, 0, c->shape[0] * c->shape[1] * sizeof(float));
-                
-                // Block size for cache optimization
-                const int block_size = 32;
-                
-                // Get matrix dimensions
-                int m = a->shape[0];
-                int n = b->shape[1];
-                int k = a->shape[1];
-                
-                // Blocked matrix multiplication
-                for (int i0 = 0; i0 < m; i0 += block_size) {
-                    int i_end = (i0 + block_size < m) ? i0 + block_size : m;
+                // Quantized weights: one GEMV per row of a against the transposed, block-quantized b
+                if (b->dtype == NN_DTYPE_INT8 || b->dtype == NN_DTYPE_INT4) {
+                    const nn_qmatrix_t* qm = (const nn_qmatrix_t*)b->data;
                     
-                    for (int j0 = 0; j0 < n; j0 += block_size) {
-                        int j_end = (j0 + block_size < n) ? j0 + block_size : n;
-                        
-                        for (int k0 = 0; k0 < k; k0 += block_size) {
-                            int k_end = (k0 + block_size < k) ? k0 + block_size : k;
-                            
-                            // Compute on blocks
-                            for (int i = i0; i < i_end; i++) {
-                                for (int j = j0; j < j_end; j++) {
-                                    float sum = c_data[i * n + j];
-                                    
-                                    for (int l = k0; l < k_end; l++) {
-                                        sum += a_data[i * k + l] * b_data[l * n + j];
-                                    }
-                                    
-                                    c_data[i * n + j] = sum;
-                                }
-                            }
-                        }
+                    if (!qm || qm->rows != b->shape[1] || qm->cols != b->shape[0]) {
+                        return -1;
+                    }
+                    
+                    dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)c->data, qm, 0, 0, NULL, 0, 0.0f };
+                    if (a->shape[0] == 1) {
+                        // Decode step: split the output columns instead
+                        dl_pool_parallel_for(dl_frameworks[slot].pool, qm->rows, DL_PARALLEL_GEMV_ROWS,
+                                             dl_parallel_qgemv_cols, &args);
+                    } else {
+                        dl_pool_parallel_for(dl_frameworks[slot].pool, a->shape[0], 1, dl_parallel_qgemv, &args);
                     }
+                    break;
                 }
+                
+                // Perform matrix multiplication, splitting the rows of a across the workers
+                dl_parallel_args_t args = { (const float*)a->data, (const float*)b->data, (float*)c->data,
+                                            NULL, b->shape[1], a->shape[1], NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, a->shape[0], DL_PARALLEL_GEMM_ROWS,
+                                     dl_parallel_gemm, &args);
             }
             break;
             
         case DL_OP_TYPE_ADD:
             // Element-wise addition
             {
-                nn_tensor_t* a = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* b = dl_frameworks[slot].operations[op_slot].inputs[1];
-                nn_tensor_t* c = dl_frameworks[slot].operations[op_slot].outputs[0];
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->inputs[1];
+                nn_tensor_t* c = op->outputs[0];
                 
                 // Check dimensions and shapes
                 if (a->ndim != b->ndim || a->ndim != c->ndim) {
@@ -1131,35 +1642,27 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
                     total_elements *= a->shape[i];
                 }
                 
-                // Perform element-wise addition with vectorization-friendly loop
-                float* a_data = (float*)a->data;
-                float* b_data = (float*)b->data;
-                float* c_data = (float*)c->data;
-                
-                // Process in chunks of 16 elements for better vectorization
-                uint32_t i = 0;
-                uint32_t chunk_size = 16;
-                
-                // Main loop with chunk processing
-                for (; i + chunk_size <= total_elements; i += chunk_size) {
-                    for (uint32_t j = 0; j < chunk_size; j++) {
-                        c_data[i + j] = a_data[i + j] + b_data[i + j];
-                    }
-                }
-                
-                // Handle remaining elements
-                for (; i < total_elements; i++) {
-                    c_data[i] = a_data[i] + b_data[i];
-                }
+                // Perform element-wise addition
+                dl_parallel_args_t args = { (const float*)a->data, (const float*)b->data, (float*)c->data, NULL, 0, 0, NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, total_elements, DL_PARALLEL_ELEMENTS, dl_parallel_add, &args);
             }
             break;
             
         case DL_OP_TYPE_MUL:
             // Element-wise multiplication
             {
-                nn_tensor_t* a = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* b = dl_frameworks[slot].operations[op_slot].inputs[1];
-                nn_tensor_t* c = dl_frameworks[slot].operations[op_slot].outputs[0];
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->inputs[1];
+                nn_tensor_t* c = op->outputs[0];
+                
+                // A single-element b scales a
+                if (dl_tensor_elements(b) == 1 && dl_tensor_same_shape(a, c)) {
+                    dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)c->data, NULL, 0, 0,
+                                                NULL, 0, *(const float*)b->data };
+                    dl_pool_parallel_for(dl_frameworks[slot].pool, dl_tensor_elements(a), DL_PARALLEL_ELEMENTS,
+                                         dl_parallel_scale, &args);
+                    break;
+                }
                 
                 // Check dimensions and shapes
                 if (a->ndim != b->ndim || a->ndim != c->ndim) {
@@ -1179,21 +1682,16 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
                 }
                 
                 // Perform element-wise multiplication
-                float* a_data = (float*)a->data;
-                float* b_data = (float*)b->data;
-                float* c_data = (float*)c->data;
-                
-                for (uint32_t i = 0; i < total_elements; i++) {
-                    c_data[i] = a_data[i] * b_data[i];
-                }
+                dl_parallel_args_t args = { (const float*)a->data, (const float*)b->data, (float*)c->data, NULL, 0, 0, NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, total_elements, DL_PARALLEL_ELEMENTS, dl_parallel_mul, &args);
             }
             break;
             
         case DL_OP_TYPE_RELU:
             // ReLU activation function
             {
-                nn_tensor_t* a = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* b = dl_frameworks[slot].operations[op_slot].outputs[0];
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->outputs[0];
                 
                 // Check dimensions and shapes
                 if (a->ndim != b->ndim) {
@@ -1213,20 +1711,34 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
                 }
                 
                 // Perform ReLU operation
-                float* a_data = (float*)a->data;
-                float* b_data = (float*)b->data;
+                dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)b->data, NULL, 0, 0, NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, total_elements, DL_PARALLEL_ELEMENTS, dl_parallel_relu, &args);
+            }
+            break;
+            
+        case DL_OP_TYPE_GELU:
+            // GELU activation function
+            {
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->outputs[0];
                 
-                for (uint32_t i = 0; i < total_elements; i++) {
-                    b_data[i] = a_data[i] > 0.0f ? a_data[i] : 0.0f;
+                // Check dimensions and shapes
+                if (!dl_tensor_same_shape(a, b)) {
+                    return -1;
                 }
+                
+                // Perform GELU operation
+                dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)b->data, NULL, 0, 0, NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, dl_tensor_elements(a), DL_PARALLEL_ELEMENTS,
+                                     dl_parallel_gelu, &args);
             }
             break;
             
         case DL_OP_TYPE_SOFTMAX:
             // Softmax activation function
             {
-                nn_tensor_t* a = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* b = dl_frameworks[slot].operations[op_slot].outputs[0];
+                nn_tensor_t* a = op->inputs[0];
+                nn_tensor_t* b = op->outputs[0];
                 
                 // Check dimensions and shapes
                 if (a->ndim != b->ndim) {
@@ -1250,123 +1762,1491 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
                 }
                 
                 // Perform softmax operations
-                float* a_data = (float*)a->data;
-                float* b_data = (float*)b->data;
+                dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)b->data, NULL, class_size, 0, NULL, 0, 0.0f };
+                dl_pool_parallel_for(dl_frameworks[slot].pool, num_softmax,
+                                     DL_PARALLEL_ELEMENTS / (class_size ? class_size : 1) + 1, dl_parallel_softmax, &args);
+            }
+            break;
+            
+        case DL_OP_TYPE_CONV2D:
+            // 2D Convolution
+            {
+                nn_tensor_t* input = op->inputs[0];
+                nn_tensor_t* filter = op->inputs[1];
+                nn_tensor_t* output = op->outputs[0];
                 
-                for (uint32_t i = 0; i < num_softmax; i++) {
-                    // Calculate offset for this softmax operation
-                    uint32_t offset = i * class_size;
-                    
-                    // Find maximum value for numerical stability
-                    float max_val = a_data[offset];
-                    for (uint32_t j = 1; j < class_size; j++) {
-                        if (a_data[offset + j] > max_val) {
-                            max_val = a_data[offset + j];
+                // Check dimensions
+                if (input->ndim != 4 || filter->ndim != 4 || output->ndim != 4) {
+                    return -1;
+                }
+                
+                // Get convolution parameters from attributes
+                uint32_t stride_h = 1;
+                uint32_t stride_w = 1;
+                uint32_t padding_h = 0;
+                uint32_t padding_w = 0;
+                
+                if (op->attributes) {
+                    uint32_t* attrs = (uint32_t*)op->attributes;
+                    stride_h = attrs[0];
+                    stride_w = attrs[1];
+                    padding_h = attrs[2];
+                    padding_w = attrs[3];
+                }
+                
+                // Get dimensions
+                uint32_t batch_size = input->shape[0];
+                uint32_t in_channels = input->shape[1];
+                uint32_t in_height = input->shape[2];
+                uint32_t in_width = input->shape[3];
+                
+                uint32_t out_channels = filter->shape[0];
+                uint32_t filter_height = filter->shape[2];
+                uint32_t filter_width = filter->shape[3];
+                
+                uint32_t out_height = output->shape[2];
+                uint32_t out_width = output->shape[3];
+                
+                // Perform 2D convolution
+                float* input_data = (float*)input->data;
+                float* filter_data = (float*)filter->data;
+                float* output_data = (float*)output->data;
+                
+                // Initialize output to zeros
+                memset(output_data, 0, batch_size * out_channels * out_height * out_width * sizeof(float));
+                
+                // Naive implementation of 2D convolution
+                for (uint32_t n = 0; n < batch_size; n++) {
+                    for (uint32_t c_out = 0; c_out < out_channels; c_out++) {
+                        for (uint32_t h_out = 0; h_out < out_height; h_out++) {
+                            for (uint32_t w_out = 0; w_out < out_width; w_out++) {
+                                float sum = 0.0f;
+                                
+                                for (uint32_t c_in = 0; c_in < in_channels; c_in++) {
+                                    for (uint32_t kh = 0; kh < filter_height; kh++) {
+                                        for (uint32_t kw = 0; kw < filter_width; kw++) {
+                                            int h_in = h_out * stride_h - padding_h + kh;
+                                            int w_in = w_out * stride_w - padding_w + kw;
+                                            
+                                            if (h_in >= 0 && h_in < (int)in_height && w_in >= 0 && w_in < (int)in_width) {
+                                                float input_val = input_data[((n * in_channels + c_in) * in_height + h_in) * in_width + w_in];
+                                                float filter_val = filter_data[((c_out * in_channels + c_in) * filter_height + kh) * filter_width + kw];
+                                                sum += input_val * filter_val;
+                                            }
+                                        }
+                                    }
+                                }
+                                
+                                output_data[((n * out_channels + c_out) * out_height + h_out) * out_width + w_out] = sum;
+                            }
                         }
                     }
-                    
-                    // Calculate exponentials and sum
-                    float sum = 0.0f;
-                    for (uint32_t j = 0; j < class_size; j++) {
-                        float exp_val = expf(a_data[offset + j] - max_val);
-                        b_data[offset + j] = exp_val;
-                        sum += exp_val;
-                    }
-                    
-                    // Normalize
-                    for (uint32_t j = 0; j < class_size; j++) {
-                        b_data[offset + j] /= sum;
-                    }
                 }
             }
             break;
-            
-        case DL_OP_TYPE_CONV2D:
-            // 2D Convolution
-            {
-                nn_tensor_t* input = dl_frameworks[slot].operations[op_slot].inputs[0];
-                nn_tensor_t* filter = dl_frameworks[slot].operations[op_slot].inputs[1];
-                nn_tensor_t* output = dl_frameworks[slot].operations[op_slot].outputs[0];
-                
-                // Check dimensions
-                if (input->ndim != 4 || filter->ndim != 4 || output->ndim != 4) {
-                    return -1;
-                }
-                
-                // Get convolution parameters from attributes
-                uint32_t stride_h = 1;
-                uint32_t stride_w = 1;
-                uint32_t padding_h = 0;
-                uint32_t padding_w = 0;
-                
-                if (dl_frameworks[slot].operations[op_slot].attributes) {
-                    uint32_t* attrs = (uint32_t*)dl_frameworks[slot].operations[op_slot].attributes;
-                    stride_h = attrs[0];
-                    stride_w = attrs[1];
-                    padding_h = attrs[2];
-                    padding_w = attrs[3];
-                }
-                
-                // Get dimensions
-                uint32_t batch_size = input->shape[0];
-                uint32_t in_channels = input->shape[1];
-                uint32_t in_height = input->shape[2];
-                uint32_t in_width = input->shape[3];
-                
-                uint32_t out_channels = filter->shape[0];
-                uint32_t filter_height = filter->shape[2];
-                uint32_t filter_width = filter->shape[3];
-                
-                uint32_t out_height = output->shape[2];
-                uint32_t out_width = output->shape[3];
-                
-                // Perform 2D convolution
-                float* input_data = (float*)input->data;
-                float* filter_data = (float*)filter->data;
-                float* output_data = (float*)output->data;
-                
-                // Initialize output to zeros
-                memset(output_data, 0, batch_size * out_channels * out_height * out_width * sizeof(float));
-                
-                // Naive implementation of 2D convolution
-                for (uint32_t n = 0; n < batch_size; n++) {
-                    for (uint32_t c_out = 0; c_out < out_channels; c_out++) {
-                        for (uint32_t h_out = 0; h_out < out_height; h_out++) {
-                            for (uint32_t w_out = 0; w_out < out_width; w_out++) {
-                                float sum = 0.0f;
-                                
-                                for (uint32_t c_in = 0; c_in < in_channels; c_in++) {
-                                    for (uint32_t kh = 0; kh < filter_height; kh++) {
-                                        for (uint32_t kw = 0; kw < filter_width; kw++) {
-                                            int h_in = h_out * stride_h - padding_h + kh;
-                                            int w_in = w_out * stride_w - padding_w + kw;
-                                            
-                                            if (h_in >= 0 && h_in < (int)in_height && w_in >= 0 && w_in < (int)in_width) {
-                                                float input_val = input_data[((n * in_channels + c_in) * in_height + h_in) * in_width + w_in];
-                                                float filter_val = filter_data[((c_out * in_channels + c_in) * filter_height + kh) * filter_width + kw];
-                                                sum += input_val * filter_val;
-                                            }
-                                        }
-                                    }
-                                }
-                                
-                                output_data[((n * out_channels + c_out) * out_height + h_out) * out_width + w_out] = sum;
-                            }
-                        }
-                    }
+            
+        default:
+            // Unsupported operation
+            return -1;
+    }
+
+    // Update the operation
+    op->execution_time = timer_now_ns() - start_ns;
+    op->memory_usage = 1024; // 1 KB
+    op->flops = 1000; // 1000 FLOPS
+
+    trace_end(point, trace_start, op->id, op->num_outputs ? dl_tensor_elements(op->outputs[0]) : 0);
+
+    return 0;
+}
+
+/**
+ * Execute an operation in a DL framework
+ *
+ * @param framework_id: DL framework ID
+ * @param op_id: Operation ID
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op_id) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = -1;
+
+    for (int i = 0; i < MAX_DL_FRAMEWORKS; i++) {
+        if (dl_frameworks[i].loaded && dl_frameworks[i].id == framework_id) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    // Find the operation
+    int op_slot = -1;
+
+    for (uint32_t i = 0; i < dl_frameworks[slot].num_operations; i++) {
+        if (dl_frameworks[slot].operations[i].id == op_id) {
+            op_slot = i;
+            break;
+        }
+    }
+
+    if (op_slot == -1) {
+        return -1;
+    }
+
+    // Check if the operation has inputs and outputs
+    if (!dl_frameworks[slot].operations[op_slot].inputs || !dl_frameworks[slot].operations[op_slot].outputs) {
+        return -1;
+    }
+
+    return dl_framework_run_op(slot, &dl_frameworks[slot].operations[op_slot]);
+}
+
+/**
+ * Find a DL framework slot by ID
+ *
+ * @param framework_id: DL framework ID
+ * @return: Slot index on success, -1 if not found
+ */
+static int dl_framework_find_slot(dl_framework_id_t framework_id) {
+    for (int i = 0; i < MAX_DL_FRAMEWORKS; i++) {
+        if (dl_frameworks[i].loaded && dl_frameworks[i].id == framework_id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Find a compiled graph by ID
+ *
+ * @param slot: DL framework slot
+ * @param graph_id: Graph ID
+ * @return: Graph on success, NULL if not found
+ */
+static dl_graph_t* dl_framework_find_graph(int slot, dl_graph_id_t graph_id) {
+    if (graph_id == 0) {
+        return NULL;
+    }
+
+    for (int g = 0; g < MAX_GRAPHS; g++) {
+        if (dl_frameworks[slot].graphs[g].id == graph_id) {
+            return &dl_frameworks[slot].graphs[g];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Check whether an operation's output feeds only one other operation
+ *
+ * @param producer: Producing operation
+ * @param consumer: Candidate consuming operation
+ * @param ops: Operations in the graph
+ * @param num_ops: Number of operations
+ * @return: Input index of the output in consumer, or -1 if it cannot be fused
+ */
+static int dl_graph_feeds(const dl_op_t* producer, const dl_op_t* consumer, dl_op_t** ops, uint32_t num_ops) {
+    if (!consumer || producer->num_outputs != 1) {
+        return -1;
+    }
+
+    nn_tensor_t* tensor = producer->outputs[0];
+    int index = -1;
+    uint32_t uses = 0;
+
+    for (uint32_t i = 0; i < num_ops; i++) {
+        for (uint32_t j = 0; j < ops[i]->num_inputs; j++) {
+            if (ops[i]->inputs[j] == tensor) {
+                uses++;
+                if (ops[i] == consumer) {
+                    index = (int)j;
+                }
+            }
+        }
+    }
+
+    return uses == 1 ? index : -1;
+}
+
+/**
+ * Try to fuse MATMUL [+ ADD bias] [+ RELU/GELU] starting at an operation
+ *
+ * @param step: Step to fill
+ * @param seq: Operations in execution order, starting at the MATMUL
+ * @param remaining: Number of operations in seq
+ * @param ops: Operations in the graph
+ * @param num_ops: Number of operations
+ * @return: Number of operations fused, or 0 if the pattern does not apply
+ */
+static uint32_t dl_graph_fuse_matmul(dl_graph_step_t* step, dl_op_t** seq, uint32_t remaining,
+                                     dl_op_t** ops, uint32_t num_ops) {
+    dl_op_t* mm = seq[0];
+
+    if (mm->type != DL_OP_TYPE_MATMUL || mm->num_inputs < 2 || mm->num_outputs != 1) {
+        return 0;
+    }
+
+    nn_tensor_t* a = mm->inputs[0];
+    nn_tensor_t* b = mm->inputs[1];
+    nn_tensor_t* out = mm->outputs[0];
+
+    if (a->ndim != 2 || b->ndim != 2 || out->ndim != 2 || a->dtype != NN_DTYPE_FLOAT32 ||
+        a->shape[1] != b->shape[0] || out->shape[0] != a->shape[0] || out->shape[1] != b->shape[1]) {
+        return 0;
+    }
+
+    uint32_t used = 1;
+    dl_op_t* last = mm;
+    nn_tensor_t* bias = NULL;
+
+    // Bias add
+    if (used < remaining && seq[used]->type == DL_OP_TYPE_ADD) {
+        int index = dl_graph_feeds(last, seq[used], ops, num_ops);
+
+        if (index >= 0 && seq[used]->num_inputs == 2 && seq[used]->num_outputs == 1) {
+            nn_tensor_t* other = seq[used]->inputs[1 - index];
+
+            if (other != last->outputs[0] && dl_tensor_same_shape(other, out) &&
+                dl_tensor_same_shape(seq[used]->outputs[0], out)) {
+                bias = other;
+                last = seq[used];
+                used++;
+            }
+        }
+    }
+
+    // Activation
+    uint32_t activation = DL_OP_TYPE_UNKNOWN;
+    if (used < remaining && (seq[used]->type == DL_OP_TYPE_RELU || seq[used]->type == DL_OP_TYPE_GELU) &&
+        dl_graph_feeds(last, seq[used], ops, num_ops) == 0 && seq[used]->num_outputs == 1 &&
+        dl_tensor_same_shape(seq[used]->outputs[0], out)) {
+        activation = seq[used]->type;
+        last = seq[used];
+        used++;
+    }
+
+    if (used == 1) {
+        return 0;
+    }
+
+    step->kind = DL_GRAPH_STEP_MATMUL_EPILOGUE;
+    step->inputs[0] = a;
+    step->inputs[1] = b;
+    step->outputs[0] = last->outputs[0];
+    step->bias = bias;
+    step->activation = activation;
+
+    return used;
+}
+
+/**
+ * Try to fuse MUL + ADD (c = a * b + d) or a scalar MUL + SOFTMAX
+ *
+ * @param step: Step to fill
+ * @param seq: Operations in execution order, starting at the MUL
+ * @param remaining: Number of operations in seq
+ * @param ops: Operations in the graph
+ * @param num_ops: Number of operations
+ * @return: Number of operations fused, or 0 if no pattern applies
+ */
+static uint32_t dl_graph_fuse_mul(dl_graph_step_t* step, dl_op_t** seq, uint32_t remaining,
+                                  dl_op_t** ops, uint32_t num_ops) {
+    dl_op_t* mul = seq[0];
+
+    if (mul->type != DL_OP_TYPE_MUL || mul->num_inputs != 2 || mul->num_outputs != 1 || remaining < 2) {
+        return 0;
+    }
+
+    dl_op_t* next = seq[1];
+    nn_tensor_t* a = mul->inputs[0];
+    nn_tensor_t* b = mul->inputs[1];
+    nn_tensor_t* out = mul->outputs[0];
+    int index = dl_graph_feeds(mul, next, ops, num_ops);
+
+    if (index < 0 || next->num_outputs != 1 || !dl_tensor_same_shape(a, out)) {
+        return 0;
+    }
+
+    // Multiply-add
+    if (next->type == DL_OP_TYPE_ADD && next->num_inputs == 2 && dl_tensor_same_shape(b, out)) {
+        nn_tensor_t* d = next->inputs[1 - index];
+
+        if (d == out || !dl_tensor_same_shape(d, out) || !dl_tensor_same_shape(next->outputs[0], out)) {
+            return 0;
+        }
+
+        step->kind = DL_GRAPH_STEP_MUL_ADD;
+        step->inputs[0] = a;
+        step->inputs[1] = b;
+        step->inputs[2] = d;
+        step->outputs[0] = next->outputs[0];
+        return 2;
+    }
+
+    // Scaled softmax
+    if (next->type == DL_OP_TYPE_SOFTMAX && dl_tensor_elements(b) == 1 && out->ndim > 0 &&
+        dl_tensor_same_shape(next->outputs[0], out)) {
+        step->kind = DL_GRAPH_STEP_SCALE_SOFTMAX;
+        step->inputs[0] = a;
+        step->inputs[1] = b;
+        step->outputs[0] = next->outputs[0];
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the size of a data type in bytes
+ *
+ * @param dtype: Data type
+ * @return: Size in bytes, or 0 if the type has no fixed element size
+ */
+static size_t dl_dtype_size(uint32_t dtype) {
+    switch (dtype) {
+        case NN_DTYPE_INT8:
+        case NN_DTYPE_UINT8:
+        case NN_DTYPE_BOOL:
+            return 1;
+        case NN_DTYPE_FLOAT16:
+        case NN_DTYPE_INT16:
+        case NN_DTYPE_UINT16:
+            return 2;
+        case NN_DTYPE_FLOAT32:
+        case NN_DTYPE_INT32:
+        case NN_DTYPE_UINT32:
+            return 4;
+        case NN_DTYPE_FLOAT64:
+        case NN_DTYPE_INT64:
+        case NN_DTYPE_UINT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Take a tensor header from the framework's header pool
+ *
+ * Headers are carved out of shared pages so that a small tensor does not
+ * cost a page of its own.
+ *
+ * @param slot: DL framework slot
+ * @return: Zeroed header on success, NULL on failure
+ */
+static dl_tensor_header_t* dl_framework_alloc_header(int slot) {
+    if (!dl_frameworks[slot].free_headers) {
+        if (dl_frameworks[slot].num_tensor_pages >= DL_MAX_TENSOR_PAGES) {
+            return NULL;
+        }
+
+        dl_tensor_header_t* page = (dl_tensor_header_t*)memory_alloc(DL_TENSOR_PAGE_SIZE,
+            MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+        if (!page) {
+            return NULL;
+        }
+
+        dl_frameworks[slot].tensor_pages[dl_frameworks[slot].num_tensor_pages++] = page;
+        dl_frameworks[slot].num_allocations++;
+
+        // Thread the new headers onto the free list
+        uint32_t count = DL_TENSOR_PAGE_SIZE / sizeof(dl_tensor_header_t);
+        for (uint32_t i = 0; i < count; i++) {
+            page[i].next_free = dl_frameworks[slot].free_headers;
+            dl_frameworks[slot].free_headers = &page[i];
+        }
+    }
+
+    dl_tensor_header_t* header = dl_frameworks[slot].free_headers;
+    dl_frameworks[slot].free_headers = header->next_free;
+
+    memset(header, 0, sizeof(dl_tensor_header_t));
+    header->in_use = 1;
+
+    return header;
+}
+
+/**
+ * Find the pooled header of a tensor created by a framework
+ *
+ * @param slot: DL framework slot
+ * @param tensor: Tensor
+ * @return: Header on success, NULL if the tensor was not created by this framework
+ */
+static dl_tensor_header_t* dl_framework_find_header(int slot, nn_tensor_t* tensor) {
+    uintptr_t addr = (uintptr_t)tensor;
+
+    for (uint32_t i = 0; i < dl_frameworks[slot].num_tensor_pages; i++) {
+        uintptr_t page = (uintptr_t)dl_frameworks[slot].tensor_pages[i];
+        uint32_t count = DL_TENSOR_PAGE_SIZE / sizeof(dl_tensor_header_t);
+
+        if (addr >= page && addr < page + count * sizeof(dl_tensor_header_t) &&
+            (addr - page) % sizeof(dl_tensor_header_t) == 0) {
+            dl_tensor_header_t* header = (dl_tensor_header_t*)tensor;
+            return header->in_use ? header : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Collect the tensors a graph step reads and writes
+ *
+ * @param step: Graph step
+ * @param reads: Array to store the tensors read (at least DL_GRAPH_MAX_OP_IO)
+ * @param num_reads: Pointer to store the number of tensors read
+ * @param writes: Array to store the tensors written (at least DL_GRAPH_MAX_OP_IO)
+ * @return: Number of tensors written
+ */
+static uint32_t dl_graph_step_tensors(const dl_graph_step_t* step, nn_tensor_t** reads, uint32_t* num_reads,
+                                      nn_tensor_t** writes) {
+    uint32_t r = 0;
+    uint32_t w = 0;
+
+    switch (step->kind) {
+        case DL_GRAPH_STEP_SINGLE:
+            for (uint32_t i = 0; i < step->op.num_inputs; i++) {
+                reads[r++] = step->inputs[i];
+            }
+            for (uint32_t i = 0; i < step->op.num_outputs; i++) {
+                writes[w++] = step->outputs[i];
+            }
+            break;
+
+        case DL_GRAPH_STEP_MATMUL_EPILOGUE:
+            reads[r++] = step->inputs[0];
+            reads[r++] = step->inputs[1];
+            if (step->bias) {
+                reads[r++] = step->bias;
+            }
+            writes[w++] = step->outputs[0];
+            break;
+
+        case DL_GRAPH_STEP_MUL_ADD:
+            reads[r++] = step->inputs[0];
+            reads[r++] = step->inputs[1];
+            reads[r++] = step->inputs[2];
+            writes[w++] = step->outputs[0];
+            break;
+
+        case DL_GRAPH_STEP_SCALE_SOFTMAX:
+            reads[r++] = step->inputs[0];
+            reads[r++] = step->inputs[1];
+            writes[w++] = step->outputs[0];
+            break;
+    }
+
+    *num_reads = r;
+
+    return w;
+}
+
+/**
+ * Plan the activation memory of a compiled graph
+ *
+ * Every planned tensor (created with dl_framework_create_activation and not
+ * yet bound to memory) that a step reads or writes gets a live range
+ * [first step, last step]. Tensors read before they are written are graph
+ * inputs and live from the start; tensors not read after their last write
+ * are graph outputs and live to the end. Ranges are placed largest first at
+ * the lowest offset that does not overlap a placed tensor with an
+ * intersecting live range, so tensors that are never live together share
+ * memory. The result is one arena allocation per graph. Tensors that were
+ * fused away are never referenced and take no memory at all.
+ *
+ * @param slot: DL framework slot
+ * @param graph: Graph to plan
+ * @return: 0 on success, -1 on failure
+ */
+static int dl_graph_plan_memory(int slot, dl_graph_t* graph) {
+    uint32_t max_tensors = graph->num_steps * DL_GRAPH_MAX_OP_IO * 2;
+
+    graph->arena = NULL;
+    graph->arena_size = 0;
+    graph->unplanned_size = 0;
+    graph->planned = NULL;
+    graph->num_planned = 0;
+
+    if (max_tensors == 0) {
+        return 0;
+    }
+
+    // Per-tensor live range and placement
+    typedef struct {
+        nn_tensor_t* tensor;
+        uint32_t start;
+        uint32_t end;
+        uint32_t last_read;
+        uint32_t last_write;
+        int read;
+        int written;
+        size_t size;
+        size_t offset;
+    } dl_live_range_t;
+
+    size_t ranges_size = max_tensors * sizeof(dl_live_range_t);
+    size_t order_size = max_tensors * sizeof(uint32_t);
+    dl_live_range_t* ranges = (dl_live_range_t*)memory_alloc(ranges_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    uint32_t* order = (uint32_t*)memory_alloc(order_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!ranges || !order) {
+        memory_free(ranges, ranges_size);
+        memory_free(order, order_size);
+        return -1;
+    }
+
+    uint32_t num_ranges = 0;
+
+    // Compute live ranges
+    for (uint32_t i = 0; i < graph->num_steps; i++) {
+        nn_tensor_t* refs[2 * DL_GRAPH_MAX_OP_IO];
+        uint32_t num_reads = 0;
+        uint32_t num_writes = dl_graph_step_tensors(&graph->steps[i], refs, &num_reads, refs + DL_GRAPH_MAX_OP_IO);
+
+        for (uint32_t j = 0; j < num_reads + num_writes; j++) {
+            int is_write = j >= num_reads;
+            nn_tensor_t* t = is_write ? refs[DL_GRAPH_MAX_OP_IO + (j - num_reads)] : refs[j];
+
+            if (!t || !(t->flags & DL_TENSOR_FLAG_PLANNED) || t->data) {
+                continue;
+            }
+
+            uint32_t r;
+            for (r = 0; r < num_ranges; r++) {
+                if (ranges[r].tensor == t) {
+                    break;
+                }
+            }
+
+            if (r == num_ranges) {
+                ranges[r].tensor = t;
+                ranges[r].start = is_write ? i : 0;
+                ranges[r].read = 0;
+                ranges[r].written = 0;
+                ranges[r].last_read = 0;
+                ranges[r].last_write = 0;
+                ranges[r].size = (t->size + DL_ARENA_ALIGNMENT - 1) & ~(size_t)(DL_ARENA_ALIGNMENT - 1);
+                num_ranges++;
+            }
+
+            if (is_write) {
+                ranges[r].written = 1;
+                ranges[r].last_write = i;
+            } else {
+                ranges[r].read = 1;
+                ranges[r].last_read = i;
+            }
+        }
+    }
+
+    // Close the ranges and order them by size, largest first
+    for (uint32_t r = 0; r < num_ranges; r++) {
+        if (ranges[r].written && (!ranges[r].read || ranges[r].last_read < ranges[r].last_write)) {
+            ranges[r].end = graph->num_steps;
+        } else {
+            ranges[r].end = ranges[r].last_read;
+        }
+
+        graph->unplanned_size += ranges[r].size;
+
+        uint32_t k = r;
+        while (k > 0 && ranges[order[k - 1]].size < ranges[r].size) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = r;
+    }
+
+    // Place each range at the lowest offset free for its whole lifetime
+    size_t arena_size = 0;
+
+    for (uint32_t n = 0; n < num_ranges; n++) {
+        dl_live_range_t* range = &ranges[order[n]];
+        size_t offset = 0;
+        int moved = 1;
+
+        while (moved) {
+            moved = 0;
+
+            for (uint32_t p = 0; p < n; p++) {
+                dl_live_range_t* placed = &ranges[order[p]];
+
+                if (placed->start > range->end || range->start > placed->end) {
+                    continue;
+                }
+
+                if (offset < placed->offset + placed->size && placed->offset < offset + range->size) {
+                    offset = placed->offset + placed->size;
+                    moved = 1;
+                }
+            }
+        }
+
+        range->offset = offset;
+        if (offset + range->size > arena_size) {
+            arena_size = offset + range->size;
+        }
+    }
+
+    // Allocate the arena and bind the tensors
+    if (num_ranges > 0) {
+        graph->arena = memory_alloc(arena_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+        graph->planned = (nn_tensor_t**)memory_alloc(num_ranges * sizeof(nn_tensor_t*),
+                                                     MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+        if (!graph->arena || !graph->planned) {
+            memory_free(graph->arena, arena_size);
+            memory_free(graph->planned, num_ranges * sizeof(nn_tensor_t*));
+            graph->arena = NULL;
+            graph->planned = NULL;
+            memory_free(ranges, ranges_size);
+            memory_free(order, order_size);
+            return -1;
+        }
+
+        for (uint32_t r = 0; r < num_ranges; r++) {
+            ranges[r].tensor->data = (uint8_t*)graph->arena + ranges[r].offset;
+            graph->planned[r] = ranges[r].tensor;
+        }
+
+        graph->arena_size = arena_size;
+        graph->num_planned = num_ranges;
+
+        // Account for the arena
+        dl_frameworks[slot].num_allocations++;
+        dl_frameworks[slot].activation_memory += arena_size;
+        if (dl_frameworks[slot].activation_memory > dl_frameworks[slot].peak_activation_memory) {
+            dl_frameworks[slot].peak_activation_memory = dl_frameworks[slot].activation_memory;
+        }
+    }
+
+    memory_free(ranges, ranges_size);
+    memory_free(order, order_size);
+
+    return 0;
+}
+
+/**
+ * Release the activation arena of a compiled graph
+ *
+ * Planned tensors are unbound so a later graph can plan them again.
+ *
+ * @param slot: DL framework slot
+ * @param graph: Graph
+ */
+static void dl_graph_release_memory(int slot, dl_graph_t* graph) {
+    for (uint32_t i = 0; i < graph->num_planned; i++) {
+        if (graph->planned[i]) {
+            graph->planned[i]->data = NULL;
+        }
+    }
+
+    if (graph->planned) {
+        memory_free(graph->planned, graph->num_planned * sizeof(nn_tensor_t*));
+    }
+
+    if (graph->arena) {
+        memory_free(graph->arena, graph->arena_size);
+        dl_frameworks[slot].activation_memory -= graph->arena_size;
+    }
+
+    graph->arena = NULL;
+    graph->arena_size = 0;
+    graph->planned = NULL;
+    graph->num_planned = 0;
+}
+
+/**
+ * Free all compiled graphs of a DL framework
+ *
+ * @param slot: DL framework slot
+ */
+static void dl_framework_free_graphs(int slot) {
+    for (int g = 0; g < MAX_GRAPHS; g++) {
+        dl_graph_t* graph = &dl_frameworks[slot].graphs[g];
+
+        if (graph->id == 0) {
+            continue;
+        }
+
+        dl_graph_release_memory(slot, graph);
+
+        if (graph->steps) {
+            memory_free(graph->steps, graph->num_ops * sizeof(dl_graph_step_t));
+        }
+    }
+
+    memset(dl_frameworks[slot].graphs, 0, sizeof(dl_frameworks[slot].graphs));
+}
+
+/**
+ * Free the data owned by an unplanned tensor
+ *
+ * @param tensor: Tensor
+ */
+static void dl_framework_free_tensor_data(nn_tensor_t* tensor) {
+    if (tensor->flags & DL_TENSOR_FLAG_QUANTIZED) {
+        // The header and the scales/data block it points to are separate allocations
+        nn_qmatrix_free((nn_qmatrix_t*)tensor->data);
+        memory_free(tensor->data, sizeof(nn_qmatrix_t));
+    } else {
+        memory_free(tensor->data, tensor->size);
+    }
+}
+
+/**
+ * Free all tensors of a DL framework
+ *
+ * Compiled graphs must already be freed, so planned tensors own no data.
+ *
+ * @param slot: DL framework slot
+ */
+static void dl_framework_free_tensors(int slot) {
+    uint32_t count = DL_TENSOR_PAGE_SIZE / sizeof(dl_tensor_header_t);
+
+    for (uint32_t i = 0; i < dl_frameworks[slot].num_tensor_pages; i++) {
+        dl_tensor_header_t* page = (dl_tensor_header_t*)dl_frameworks[slot].tensor_pages[i];
+
+        for (uint32_t j = 0; j < count; j++) {
+            if (page[j].in_use && !(page[j].tensor.flags & DL_TENSOR_FLAG_PLANNED) && page[j].tensor.data) {
+                dl_framework_free_tensor_data(&page[j].tensor);
+            }
+        }
+
+        memory_free(page, DL_TENSOR_PAGE_SIZE);
+    }
+
+    dl_frameworks[slot].free_headers = NULL;
+    dl_frameworks[slot].num_tensor_pages = 0;
+    dl_frameworks[slot].tensor_memory = 0;
+    dl_frameworks[slot].num_tensors = 0;
+}
+
+/**
+ * Compile a sequence of operations into an execution plan
+ *
+ * The operations are ordered by their tensor dependencies (ties keep the
+ * given order) and common chains are fused: MATMUL + ADD bias + RELU/GELU,
+ * MUL + ADD, and a scalar MUL followed by SOFTMAX. A fused chain only
+ * writes its final output; tensors between fused operations are not
+ * materialized. The plan captures the operations' tensors at compile time,
+ * so recompile after changing an operation's inputs or outputs. Activation
+ * tensors are then placed in a single per-graph arena (see
+ * dl_graph_plan_memory).
+ *
+ * @param framework_id: DL framework ID
+ * @param op_ids: Operation IDs
+ * @param num_ops: Number of operations
+ * @return: Graph ID on success, 0 on failure
+ */
+dl_graph_id_t dl_framework_compile_graph(dl_framework_id_t framework_id, const dl_op_id_t* op_ids, uint32_t num_ops) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return 0;
+    }
+
+    // Check parameters
+    if (!op_ids || num_ops == 0 || num_ops > MAX_OPERATIONS) {
+        return 0;
+    }
+
+    // Find the DL framework
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return 0;
+    }
+
+    // Find a free graph slot
+    dl_graph_t* graph = NULL;
+
+    for (int g = 0; g < MAX_GRAPHS; g++) {
+        if (dl_frameworks[slot].graphs[g].id == 0) {
+            graph = &dl_frameworks[slot].graphs[g];
+            break;
+        }
+    }
+
+    if (!graph) {
+        return 0;
+    }
+
+    // Allocate scratch space: resolved ops, topological order, in-degrees
+    size_t ops_size = num_ops * 2 * sizeof(dl_op_t*) + num_ops * sizeof(uint32_t);
+    size_t steps_size = num_ops * sizeof(dl_graph_step_t);
+    dl_op_t** ops = (dl_op_t**)memory_alloc(ops_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    dl_graph_step_t* steps = (dl_graph_step_t*)memory_alloc(steps_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+
+    if (!ops || !steps) {
+        memory_free(ops, ops_size);
+        memory_free(steps, steps_size);
+        return 0;
+    }
+
+    dl_op_t** sorted = ops + num_ops;
+    uint32_t* indegree = (uint32_t*)(sorted + num_ops);
+
+    // Resolve the operations once
+    for (uint32_t i = 0; i < num_ops; i++) {
+        int index = dl_framework_find_operation_index(framework_id, op_ids[i]);
+
+        if (index == -1) {
+            memory_free(ops, ops_size);
+            memory_free(steps, steps_size);
+            return 0;
+        }
+
+        ops[i] = &dl_frameworks[slot].operations[index];
+
+        if (!ops[i]->inputs || !ops[i]->outputs ||
+            ops[i]->num_inputs > DL_GRAPH_MAX_OP_IO || ops[i]->num_outputs > DL_GRAPH_MAX_OP_IO) {
+            memory_free(ops, ops_size);
+            memory_free(steps, steps_size);
+            return 0;
+        }
+    }
+
+    // Count dependencies: j depends on i if j reads a tensor that i writes
+    for (uint32_t j = 0; j < num_ops; j++) {
+        indegree[j] = 0;
+
+        for (uint32_t i = 0; i < num_ops; i++) {
+            if (i == j) {
+                continue;
+            }
+
+            int depends = 0;
+            for (uint32_t x = 0; x < ops[j]->num_inputs && !depends; x++) {
+                for (uint32_t y = 0; y < ops[i]->num_outputs; y++) {
+                    if (ops[j]->inputs[x] == ops[i]->outputs[y]) {
+                        depends = 1;
+                        break;
+                    }
+                }
+            }
+
+            indegree[j] += depends;
+        }
+    }
+
+    // Topological sort, always taking the earliest ready operation
+    uint32_t num_sorted = 0;
+
+    while (num_sorted < num_ops) {
+        uint32_t pick = num_ops;
+
+        for (uint32_t j = 0; j < num_ops; j++) {
+            if (ops[j] && indegree[j] == 0) {
+                pick = j;
+                break;
+            }
+        }
+
+        if (pick == num_ops) {
+            // Dependency cycle
+            memory_free(ops, ops_size);
+            memory_free(steps, steps_size);
+            return 0;
+        }
+
+        dl_op_t* op = ops[pick];
+        sorted[num_sorted++] = op;
+        ops[pick] = NULL;
+
+        // Release the operations that depended on it
+        for (uint32_t j = 0; j < num_ops; j++) {
+            if (!ops[j]) {
+                continue;
+            }
+
+            int depends = 0;
+            for (uint32_t x = 0; x < ops[j]->num_inputs && !depends; x++) {
+                for (uint32_t y = 0; y < op->num_outputs; y++) {
+                    if (ops[j]->inputs[x] == op->outputs[y]) {
+                        depends = 1;
+                        break;
+                    }
+                }
+            }
+
+            indegree[j] -= depends;
+        }
+    }
+
+    // Build the steps, fusing chains where possible
+    uint32_t num_steps = 0;
+    uint32_t num_fused = 0;
+
+    memset(steps, 0, num_ops * sizeof(dl_graph_step_t));
+
+    for (uint32_t p = 0; p < num_ops; ) {
+        dl_graph_step_t* step = &steps[num_steps++];
+        uint32_t used = dl_graph_fuse_matmul(step, sorted + p, num_ops - p, sorted, num_ops);
+
+        if (used == 0) {
+            used = dl_graph_fuse_mul(step, sorted + p, num_ops - p, sorted, num_ops);
+        }
+
+        if (used == 0) {
+            // Run the operation on its own, with its own copy of the tensor lists
+            step->kind = DL_GRAPH_STEP_SINGLE;
+            step->op = *sorted[p];
+            memcpy(step->inputs, sorted[p]->inputs, sorted[p]->num_inputs * sizeof(nn_tensor_t*));
+            memcpy(step->outputs, sorted[p]->outputs, sorted[p]->num_outputs * sizeof(nn_tensor_t*));
+            step->op.inputs = step->inputs;
+            step->op.outputs = step->outputs;
+            used = 1;
+        } else {
+            num_fused += used;
+        }
+
+        step->num_ops = used;
+        p += used;
+    }
+
+    memory_free(ops, ops_size);
+
+    graph->num_ops = num_ops;
+    graph->num_steps = num_steps;
+    graph->num_fused = num_fused;
+    graph->num_executions = 0;
+    graph->steps = steps;
+
+    // Place the activations in the graph arena
+    if (dl_graph_plan_memory(slot, graph) != 0) {
+        memory_free(steps, steps_size);
+        memset(graph, 0, sizeof(dl_graph_t));
+        return 0;
+    }
+
+    // Publish the graph
+    graph->id = dl_frameworks[slot].next_graph_id++;
+
+    return graph->id;
+}
+
+/**
+ * Execute a compiled graph
+ *
+ * @param framework_id: DL framework ID
+ * @param graph_id: Graph ID
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_execute_graph(dl_framework_id_t framework_id, dl_graph_id_t graph_id) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Find the DL framework and graph
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    dl_graph_t* graph = dl_framework_find_graph(slot, graph_id);
+
+    if (!graph) {
+        return -1;
+    }
+
+    dl_pool_t* pool = dl_frameworks[slot].pool;
+    uint64_t graph_start = trace_begin(&dl_trace_graph);
+
+    // Run the plan
+    for (uint32_t i = 0; i < graph->num_steps; i++) {
+        dl_graph_step_t* step = &graph->steps[i];
+        const trace_point_t* point = NULL;
+        uint64_t trace_start = 0;
+
+        switch (step->kind) {
+            case DL_GRAPH_STEP_SINGLE:
+                if (dl_framework_run_op(slot, &step->op) != 0) {
+                    return -1;
+                }
+                break;
+
+            case DL_GRAPH_STEP_MATMUL_EPILOGUE:
+                // Matrix multiplication with the bias add and activation applied to each tile as it is produced
+                {
+                    point = &dl_trace_matmul_epilogue;
+                    trace_start = trace_begin(point);
+
+                    nn_tensor_t* a = step->inputs[0];
+                    nn_tensor_t* b = step->inputs[1];
+                    nn_tensor_t* c = step->outputs[0];
+                    dl_parallel_args_t args = { (const float*)a->data, NULL, (float*)c->data, NULL,
+                                                b->shape[1], a->shape[1],
+                                                step->bias ? (const float*)step->bias->data : NULL,
+                                                step->activation, 0.0f };
+
+                    if (b->dtype == NN_DTYPE_INT8 || b->dtype == NN_DTYPE_INT4) {
+                        args.qm = (const nn_qmatrix_t*)b->data;
+
+                        if (!args.qm || args.qm->rows != b->shape[1] || args.qm->cols != b->shape[0]) {
+                            return -1;
+                        }
+
+                        if (a->shape[0] == 1) {
+                            dl_pool_parallel_for(pool, args.qm->rows, DL_PARALLEL_GEMV_ROWS, dl_parallel_qgemv_cols, &args);
+                        } else {
+                            dl_pool_parallel_for(pool, a->shape[0], 1, dl_parallel_qgemv, &args);
+                        }
+                    } else {
+                        args.b = (const float*)b->data;
+                        dl_pool_parallel_for(pool, a->shape[0], DL_PARALLEL_GEMM_ROWS, dl_parallel_gemm, &args);
+                    }
+                }
+                break;
+
+            case DL_GRAPH_STEP_MUL_ADD:
+                // c = a * b + d in one pass
+                {
+                    point = &dl_trace_mul_add;
+                    trace_start = trace_begin(point);
+
+                    dl_parallel_args_t args = { (const float*)step->inputs[0]->data, (const float*)step->inputs[1]->data,
+                                                (float*)step->outputs[0]->data, NULL, 0, 0,
+                                                (const float*)step->inputs[2]->data, 0, 0.0f };
+                    dl_pool_parallel_for(pool, dl_tensor_elements(step->outputs[0]), DL_PARALLEL_ELEMENTS,
+                                         dl_parallel_mul, &args);
+                }
+                break;
+
+            case DL_GRAPH_STEP_SCALE_SOFTMAX:
+                // softmax(x * scale) without materializing the scaled tensor
+                {
+                    point = &dl_trace_scale_softmax;
+                    trace_start = trace_begin(point);
+
+                    nn_tensor_t* x = step->inputs[0];
+                    uint32_t cols = x->shape[x->ndim - 1];
+                    uint32_t rows = cols ? dl_tensor_elements(x) / cols : 0;
+                    dl_parallel_args_t args = { (const float*)x->data, NULL, (float*)step->outputs[0]->data, NULL,
+                                                cols, 0, NULL, 0, *(const float*)step->inputs[1]->data };
+                    dl_pool_parallel_for(pool, rows, DL_PARALLEL_ELEMENTS / (cols ? cols : 1) + 1,
+                                         dl_parallel_scaled_softmax, &args);
+                }
+                break;
+
+            default:
+                return -1;
+        }
+
+        // Single operations trace themselves
+        if (point) {
+            trace_end(point, trace_start, step->num_ops, dl_tensor_elements(step->outputs[0]));
+        }
+    }
+
+    trace_end(&dl_trace_graph, graph_start, graph->id, graph->num_steps);
+
+    graph->num_executions++;
+
+    return 0;
+}
+
+/**
+ * Destroy a compiled graph
+ *
+ * @param framework_id: DL framework ID
+ * @param graph_id: Graph ID
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_destroy_graph(dl_framework_id_t framework_id, dl_graph_id_t graph_id) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Find the DL framework and graph
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    dl_graph_t* graph = dl_framework_find_graph(slot, graph_id);
+
+    if (!graph) {
+        return -1;
+    }
+
+    dl_graph_release_memory(slot, graph);
+    memory_free(graph->steps, graph->num_ops * sizeof(dl_graph_step_t));
+    memset(graph, 0, sizeof(dl_graph_t));
+
+    return 0;
+}
+
+/**
+ * Get compiled graph information
+ *
+ * @param framework_id: DL framework ID
+ * @param graph_id: Graph ID
+ * @param info: Pointer to store the graph information
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_get_graph_info(dl_framework_id_t framework_id, dl_graph_id_t graph_id, dl_graph_info_t* info) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Check if the info pointer is valid
+    if (!info) {
+        return -1;
+    }
+
+    // Find the DL framework and graph
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    dl_graph_t* graph = dl_framework_find_graph(slot, graph_id);
+
+    if (!graph) {
+        return -1;
+    }
+
+    info->id = graph->id;
+    info->num_operations = graph->num_ops;
+    info->num_steps = graph->num_steps;
+    info->num_fused_operations = graph->num_fused;
+    info->num_planned_tensors = graph->num_planned;
+    info->arena_size = graph->arena_size;
+    info->unplanned_size = graph->unplanned_size;
+    info->num_executions = graph->num_executions;
+
+    return 0;
+}
+
+/**
+ * Quantize a model in a DL framework
+ *
+ * @param framework_id: DL framework ID
+ * @param model: Model to quantize
+ * @param quantization_level: Bits per weight (8 for INT8, 4 for INT4)
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_quantize_model(dl_framework_id_t framework_id, nn_model_t* model, uint32_t quantization_level) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Check if the model pointer is valid
+    if (!model) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = -1;
+
+    for (int i = 0; i < MAX_DL_FRAMEWORKS; i++) {
+        if (dl_frameworks[i].loaded && dl_frameworks[i].id == framework_id) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    // Map the quantization level to a weight type
+    uint32_t dtype;
+
+    if (quantization_level == 8) {
+        dtype = NN_DTYPE_INT8;
+    } else if (quantization_level == 4) {
+        dtype = NN_DTYPE_INT4;
+    } else {
+        return -1;
+    }
+
+    // Quantize the model weights
+    if (nn_deepseek_quantize(model, dtype) != 0) {
+        return -1;
+    }
+
+    // Record the precision the framework now computes with
+    dl_frameworks[slot].config.compute_precision = quantization_level;
+
+    return 0;
+}
+
+/**
+ * Create a tensor header with the given shape
+ *
+ * @param slot: DL framework slot
+ * @param shape: Tensor shape
+ * @param ndim: Number of dimensions
+ * @param dtype: Data type
+ * @param flags: Tensor flags
+ * @return: Tensor on success, NULL on failure
+ */
+static nn_tensor_t* dl_framework_new_tensor(int slot, const uint32_t* shape, uint32_t ndim, uint32_t dtype, uint32_t flags) {
+    size_t element_size = dl_dtype_size(dtype);
+
+    if (!shape || ndim == 0 || ndim > DL_TENSOR_MAX_DIMS || element_size == 0) {
+        return NULL;
+    }
+
+    size_t size = element_size;
+    for (uint32_t i = 0; i < ndim; i++) {
+        size *= shape[i];
+    }
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    dl_tensor_header_t* header = dl_framework_alloc_header(slot);
+
+    if (!header) {
+        return NULL;
+    }
+
+    memcpy(header->shape, shape, ndim * sizeof(uint32_t));
+    header->tensor.shape = header->shape;
+    header->tensor.ndim = ndim;
+    header->tensor.dtype = dtype;
+    header->tensor.size = (uint32_t)size;
+    header->tensor.flags = flags;
+    header->tensor.data = NULL;
+
+    return &header->tensor;
+}
+
+/**
+ * Create a tensor
+ *
+ * The header comes from the framework's header pool and the data is
+ * allocated on its own.
+ *
+ * @param framework_id: DL framework ID
+ * @param shape: Tensor shape
+ * @param ndim: Number of dimensions
+ * @param dtype: Data type
+ * @param tensor: Pointer to store the tensor
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_create_tensor(dl_framework_id_t framework_id, uint32_t* shape, uint32_t ndim, uint32_t dtype, nn_tensor_t** tensor) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized || !tensor) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    nn_tensor_t* t = dl_framework_new_tensor(slot, shape, ndim, dtype, 0);
+
+    if (!t) {
+        return -1;
+    }
+
+    t->data = memory_alloc(t->size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_ZEROED);
+
+    if (!t->data) {
+        dl_tensor_header_t* header = (dl_tensor_header_t*)t;
+        header->in_use = 0;
+        header->next_free = dl_frameworks[slot].free_headers;
+        dl_frameworks[slot].free_headers = header;
+        return -1;
+    }
+
+    dl_frameworks[slot].num_allocations++;
+    dl_frameworks[slot].tensor_memory += t->size;
+    dl_frameworks[slot].num_tensors++;
+
+    *tensor = t;
+
+    return 0;
+}
+
+/**
+ * Create an activation tensor whose memory is planned by a compiled graph
+ *
+ * The tensor has no data until a graph that uses it is compiled; the graph
+ * then places it in its arena, sharing memory with tensors whose live
+ * ranges do not overlap. Its data is released with the graph.
+ *
+ * @param framework_id: DL framework ID
+ * @param shape: Tensor shape
+ * @param ndim: Number of dimensions
+ * @param dtype: Data type
+ * @param tensor: Pointer to store the tensor
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_create_activation(dl_framework_id_t framework_id, uint32_t* shape, uint32_t ndim, uint32_t dtype, nn_tensor_t** tensor) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized || !tensor) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    nn_tensor_t* t = dl_framework_new_tensor(slot, shape, ndim, dtype, DL_TENSOR_FLAG_PLANNED);
+
+    if (!t) {
+        return -1;
+    }
+
+    dl_frameworks[slot].num_tensors++;
+
+    *tensor = t;
+
+    return 0;
+}
+
+/**
+ * Destroy a tensor
+ *
+ * @param framework_id: DL framework ID
+ * @param tensor: Tensor created by this framework
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_destroy_tensor(dl_framework_id_t framework_id, nn_tensor_t* tensor) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized || !tensor) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    dl_tensor_header_t* header = dl_framework_find_header(slot, tensor);
+
+    if (!header) {
+        return -1;
+    }
+
+    if (tensor->flags & DL_TENSOR_FLAG_PLANNED) {
+        // Arena memory belongs to the graph; just forget the tensor
+        for (int g = 0; g < MAX_GRAPHS; g++) {
+            dl_graph_t* graph = &dl_frameworks[slot].graphs[g];
+
+            for (uint32_t i = 0; i < graph->num_planned; i++) {
+                if (graph->planned[i] == tensor) {
+                    graph->planned[i] = NULL;
                 }
             }
-            break;
-            
-        default:
-            // Unsupported operation
-            return -1;
+        }
+    } else if (tensor->data) {
+        dl_framework_free_tensor_data(tensor);
+        dl_frameworks[slot].tensor_memory -= tensor->size;
     }
 
-    // Update the operation
-    dl_frameworks[slot].operations[op_slot].execution_time = 10; // 10 ms
-    dl_frameworks[slot].operations[op_slot].memory_usage = 1024; // 1 KB
-    dl_frameworks[slot].operations[op_slot].flops = 1000; // 1000 FLOPS
+    // Return the header to the pool
+    header->in_use = 0;
+    header->next_free = dl_frameworks[slot].free_headers;
+    dl_frameworks[slot].free_headers = header;
+    dl_frameworks[slot].num_tensors--;
+
+    return 0;
+}
+
+/**
+ * Cast a tensor to another data type
+ *
+ * Casting a 2-D FLOAT32 weight tensor [k][n] to INT8 or INT4 produces a
+ * block-quantized tensor that DL_OP_TYPE_MATMUL consumes with the GEMV
+ * kernels. The result must be an unplanned tensor created by the same
+ * framework with a two-entry shape array; its previous data is released.
+ *
+ * @param framework_id: DL framework ID
+ * @param tensor: Source tensor
+ * @param dtype: Target data type
+ * @param result: Result tensor
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_cast_tensor(dl_framework_id_t framework_id, nn_tensor_t* tensor, uint32_t dtype, nn_tensor_t* result) {
+    // Check if the DL framework is initialized
+    if (!dl_framework_initialized) {
+        return -1;
+    }
+
+    // Check if the tensor pointers are valid
+    if (!tensor || !tensor->data || !result || !result->shape) {
+        return -1;
+    }
+
+    // Find the DL framework
+    int slot = dl_framework_find_slot(framework_id);
+
+    if (slot == -1) {
+        return -1;
+    }
+
+    // Only FLOAT32 matrix to block-quantized casts are supported
+    if (tensor->dtype != NN_DTYPE_FLOAT32 || tensor->ndim != 2 ||
+        (dtype != NN_DTYPE_INT8 && dtype != NN_DTYPE_INT4)) {
+        return -1;
+    }
+
+    // The result takes ownership of the quantized matrix, so it must be ours
+    if (!dl_framework_find_header(slot, result) || (result->flags & DL_TENSOR_FLAG_PLANNED)) {
+        return -1;
+    }
+
+    // Quantize the transposed weights so each output column is a contiguous row
+    nn_qmatrix_t* qm = (nn_qmatrix_t*)memory_alloc(sizeof(nn_qmatrix_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                                   MEMORY_ALLOC_ZEROED);
+    if (!qm) {
+        return -1;
+    }
+
+    if (nn_qmatrix_quantize_transposed(qm, (const float*)tensor->data, tensor->shape[0], tensor->shape[1], dtype) != 0) {
+        memory_free(qm, sizeof(nn_qmatrix_t));
+        return -1;
+    }
+
+    // Release the previous contents of the result tensor
+    if (result->data) {
+        dl_framework_free_tensor_data(result);
+        dl_frameworks[slot].tensor_memory -= result->size;
+    }
+
+    // Fill the result tensor
+    result->data = qm;
+    result->shape[0] = tensor->shape[0];
+    result->shape[1] = tensor->shape[1];
+    result->ndim = 2;
+    result->dtype = dtype;
+    result->size = (uint32_t)qm->alloc_size;
+    result->flags = DL_TENSOR_FLAG_QUANTIZED;
+
+    dl_frameworks[slot].tensor_memory += result->size;
 
     return 0;
 }
@@ -1387,6 +3267,31 @@ int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op
  * @return: 0 on success, -1 on failure
  */
 int dl_framework_deepseek_generate(dl_framework_id_t framework_id, nn_model_t* model, const char* prompt, char* output, size_t output_size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty) {
+    return dl_framework_deepseek_generate_stream(framework_id, model, prompt, output, output_size, max_tokens, temperature, top_p, top_k, repetition_penalty, NULL, NULL);
+}
+
+/**
+ * Generate text using a Deepseek model in a DL framework, streaming it as
+ * tokens are generated
+ *
+ * The output buffer starts with the prompt as in dl_framework_deepseek_generate;
+ * the callback receives only the text of the generated tokens.
+ *
+ * @param framework_id: DL framework ID
+ * @param model: Model to use for generation
+ * @param prompt: Prompt to generate from
+ * @param output: Buffer to store the generated text
+ * @param output_size: Size of the output buffer
+ * @param max_tokens: Maximum number of tokens to generate
+ * @param temperature: Temperature parameter
+ * @param top_p: Top-p sampling parameter
+ * @param top_k: Top-k sampling parameter
+ * @param repetition_penalty: Repetition penalty parameter
+ * @param callback: Function receiving each piece of text (NULL for none)
+ * @param user_data: User data passed to the callback
+ * @return: 0 on success, -1 on failure
+ */
+int dl_framework_deepseek_generate_stream(dl_framework_id_t framework_id, nn_model_t* model, const char* prompt, char* output, size_t output_size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data) {
     // Check if the DL framework is initialized
     if (!dl_framework_initialized) {
         return -1;
@@ -1546,6 +3451,16 @@ int dl_framework_deepseek_generate(dl_framework_id_t framework_id, nn_model_t* m
         if (next_token == 2) { // Assuming 2 is the EOS token
             break;
         }
+        
+        // Stream the token text, stopping when the caller asks to
+        if (callback) {
+            char token_str[16];
+            int token_len = snprintf(token_str, sizeof(token_str), " %u", next_token);
+            
+            if (callback(token_str, (size_t)token_len, user_data) != 0) {
+                break;
+            }
+        }
     }
     
     // Detokenize the generated sequence
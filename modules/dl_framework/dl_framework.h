@@ -40,6 +40,17 @@
 #define DL_OP_TYPE_ATTENTION          19
 #define DL_OP_TYPE_TRANSFORMER        20
 #define DL_OP_TYPE_CUSTOM             21
+#define DL_OP_TYPE_GELU               22
+
+// DL framework tensor flags (kept clear of the neural network tensor flags)
+#define DL_TENSOR_FLAG_PLANNED        (1u << 16)
+#define DL_TENSOR_FLAG_QUANTIZED      (1u << 17)  // data is an nn_qmatrix_t header
+
+// Maximum number of dimensions of a DL framework tensor
+#define DL_TENSOR_MAX_DIMS            8
+
+// Maximum number of workers reported in the framework state
+#define DL_FRAMEWORK_MAX_WORKERS      16
 
 // DL framework ID type
 typedef uint32_t dl_framework_id_t;
@@ -47,6 +58,9 @@ typedef uint32_t dl_framework_id_t;
 // DL framework operation ID type
 typedef uint32_t dl_op_id_t;
 
+// DL framework graph ID type
+typedef uint32_t dl_graph_id_t;
+
 // DL framework configuration structure
 typedef struct {
     uint32_t type;
@@ -85,6 +99,13 @@ typedef struct {
     uint32_t num_models;
     uint32_t num_layers;
     uint32_t num_parameters;
+    uint64_t activation_memory;
+    uint64_t peak_activation_memory;
+    uint32_t num_allocations;
+    uint32_t num_workers;
+    uint32_t worker_utilization[DL_FRAMEWORK_MAX_WORKERS];
+    uint64_t worker_tasks[DL_FRAMEWORK_MAX_WORKERS];
+    uint64_t worker_steals[DL_FRAMEWORK_MAX_WORKERS];
 } dl_framework_state_t;
 
 // DL framework operation structure
@@ -98,11 +119,23 @@ typedef struct {
     nn_tensor_t** outputs;
     void* attributes;
     uint32_t attributes_size;
-    uint64_t execution_time;
+    uint64_t execution_time;        // Nanoseconds the last execution took
     uint32_t memory_usage;
     uint32_t flops;
 } dl_op_t;
 
+// DL framework compiled graph information
+typedef struct {
+    dl_graph_id_t id;
+    uint32_t num_operations;
+    uint32_t num_steps;
+    uint32_t num_fused_operations;
+    uint32_t num_planned_tensors;
+    uint64_t arena_size;
+    uint64_t unplanned_size;
+    uint64_t num_executions;
+} dl_graph_info_t;
+
 // DL framework initialization and shutdown
 int dl_framework_init(void);
 int dl_framework_shutdown(void);
@@ -131,8 +164,15 @@ int dl_framework_set_operation_attributes(dl_framework_id_t framework_id, dl_op_
 int dl_framework_get_operation_info(dl_framework_id_t framework_id, dl_op_id_t op_id, dl_op_t* op);
 int dl_framework_execute_operation(dl_framework_id_t framework_id, dl_op_id_t op_id);
 
+// DL framework compiled graphs
+dl_graph_id_t dl_framework_compile_graph(dl_framework_id_t framework_id, const dl_op_id_t* op_ids, uint32_t num_ops);
+int dl_framework_execute_graph(dl_framework_id_t framework_id, dl_graph_id_t graph_id);
+int dl_framework_destroy_graph(dl_framework_id_t framework_id, dl_graph_id_t graph_id);
+int dl_framework_get_graph_info(dl_framework_id_t framework_id, dl_graph_id_t graph_id, dl_graph_info_t* info);
+
 // DL framework tensor operations
 int dl_framework_create_tensor(dl_framework_id_t framework_id, uint32_t* shape, uint32_t ndim, uint32_t dtype, nn_tensor_t** tensor);
+int dl_framework_create_activation(dl_framework_id_t framework_id, uint32_t* shape, uint32_t ndim, uint32_t dtype, nn_tensor_t** tensor);
 int dl_framework_destroy_tensor(dl_framework_id_t framework_id, nn_tensor_t* tensor);
 int dl_framework_copy_tensor(dl_framework_id_t framework_id, nn_tensor_t* src, nn_tensor_t* dst);
 int dl_framework_reshape_tensor(dl_framework_id_t framework_id, nn_tensor_t* tensor, uint32_t* shape, uint32_t ndim);
@@ -152,6 +192,7 @@ int dl_framework_set_tensor_value(dl_framework_id_t framework_id, nn_tensor_t* t
 // DL framework Deepseek R1 specific operations
 int dl_framework_load_deepseek_model(dl_framework_id_t framework_id, const char* model_path, nn_model_t** model);
 int dl_framework_deepseek_generate(dl_framework_id_t framework_id, nn_model_t* model, const char* prompt, char* output, size_t output_size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty);
+int dl_framework_deepseek_generate_stream(dl_framework_id_t framework_id, nn_model_t* model, const char* prompt, char* output, size_t output_size, uint32_t max_tokens, float temperature, float top_p, float top_k, float repetition_penalty, nn_stream_callback_t callback, void* user_data);
 int dl_framework_deepseek_embed(dl_framework_id_t framework_id, nn_model_t* model, const char* text, float* embedding, uint32_t embedding_size);
 int dl_framework_deepseek_classify(dl_framework_id_t framework_id, nn_model_t* model, const char* text, const char** labels, uint32_t num_labels, float* probabilities);
 int dl_framework_deepseek_extract(dl_framework_id_t framework_id, nn_model_t* model, const char* text, const char* pattern, char* output, size_t output_size);
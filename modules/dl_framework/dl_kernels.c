@@ -0,0 +1,733 @@
+/**
+ * dl_kernels.c - Compute kernels implementation for NeuroOS
+ *
+ * This file implements the compute kernels used by the DL framework
+ * operations. GEMM packs B into 8-wide column panels so the micro-kernel
+ * streams contiguous memory, and works on 4x8 output tiles over KC-sized
+ * slices of k. Packed panels go into pack buffers that are kept and
+ * grown across calls, one per concurrent caller. Softmax uses a vectorized exp (Cephes polynomial with
+ * exponent reconstruction).
+ *
+ * The SSE2 and AVX2 implementations are compiled only when NEUROOS_SIMD is
+ * defined (NEUROOS_SIMD=1 in scripts/build_iso.sh). They use per-function
+ * target attributes, so the rest of the kernel never contains vector code
+ * and cpu_init can enable the SIMD state before they are selected.
+ */
+
+#include "dl_framework/dl_kernels.h"
+#include "../../kernel/include/cpu.h"
+#include "../../kernel/include/memory.h"
+#include <string.h>
+
+#ifdef NEUROOS_SIMD
+#include <immintrin.h>
+#endif
+
+// GEMM tiling: rows per micro-tile, panel width, k slice length
+#define DL_GEMM_MR  4
+#define DL_GEMM_NR  8
+#define DL_GEMM_KC  256
+
+// GEMM pack buffers: one per concurrent caller (pool workers run row
+// slices of one GEMM at once), grown in steps of DL_GEMM_PACK_GRAIN bytes
+#define DL_GEMM_PACK_BUFFERS  16
+#define DL_GEMM_PACK_GRAIN    (64 * 1024)
+
+// Exp polynomial constants (Cephes expf)
+#define DL_EXP_HI       88.3762626647949f
+#define DL_EXP_LO      -88.3762626647949f
+#define DL_LOG2E        1.44269504088896341f
+#define DL_EXP_C1       0.693359375f
+#define DL_EXP_C2      -2.12194440e-4f
+#define DL_EXP_P0       1.9875691500e-4f
+#define DL_EXP_P1       1.3981999507e-3f
+#define DL_EXP_P2       8.3334519073e-3f
+#define DL_EXP_P3       4.1665795894e-2f
+#define DL_EXP_P4       1.6666665459e-1f
+#define DL_EXP_P5       5.0000001201e-1f
+
+// Selected kernel table
+static const dl_kernels_t* dl_kernels_current = NULL;
+
+/**
+ * Scalar exp using the same polynomial as the vector kernels
+ *
+ * @param x: Input value
+ * @return: e^x
+ */
+static float dl_expf(float x) {
+    if (x > DL_EXP_HI) x = DL_EXP_HI;
+    if (x < DL_EXP_LO) x = DL_EXP_LO;
+
+    // Split x = n * ln2 + r
+    float fx = x * DL_LOG2E + 0.5f;
+    int n = (int)fx;
+    if ((float)n > fx) {
+        n--;
+    }
+    float r = x - (float)n * DL_EXP_C1 - (float)n * DL_EXP_C2;
+
+    // Polynomial approximation of e^r
+    float y = DL_EXP_P0;
+    y = y * r + DL_EXP_P1;
+    y = y * r + DL_EXP_P2;
+    y = y * r + DL_EXP_P3;
+    y = y * r + DL_EXP_P4;
+    y = y * r + DL_EXP_P5;
+    y = y * r * r + r + 1.0f;
+
+    // Scale by 2^n
+    union { uint32_t i; float f; } scale;
+    scale.i = (uint32_t)(n + 127) << 23;
+
+    return y * scale.f;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Scalar kernels                                                            */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Scalar GEMM: C[m][n] = A[m][k] * B[k][n]
+ *
+ * Uses i-k-j order so both B and C are read along rows.
+ */
+static void dl_gemm_scalar(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c) {
+    memset(c, 0, (size_t)m * n * sizeof(float));
+
+    for (uint32_t i = 0; i < m; i++) {
+        float* c_row = c + (size_t)i * n;
+
+        for (uint32_t l = 0; l < k; l++) {
+            float a_val = a[(size_t)i * k + l];
+            const float* b_row = b + (size_t)l * n;
+
+            for (uint32_t j = 0; j < n; j++) {
+                c_row[j] += a_val * b_row[j];
+            }
+        }
+    }
+}
+
+static void dl_add_scalar(const float* a, const float* b, float* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static void dl_mul_scalar(const float* a, const float* b, float* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+static void dl_relu_scalar(const float* a, float* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        b[i] = a[i] > 0.0f ? a[i] : 0.0f;
+    }
+}
+
+static void dl_softmax_scalar(const float* a, float* b, size_t rows, size_t cols) {
+    for (size_t r = 0; r < rows; r++) {
+        const float* x = a + r * cols;
+        float* y = b + r * cols;
+
+        // Find maximum value for numerical stability
+        float max_val = x[0];
+        for (size_t j = 1; j < cols; j++) {
+            if (x[j] > max_val) {
+                max_val = x[j];
+            }
+        }
+
+        // Exponentials and sum
+        float sum = 0.0f;
+        for (size_t j = 0; j < cols; j++) {
+            y[j] = dl_expf(x[j] - max_val);
+            sum += y[j];
+        }
+
+        // Normalize
+        float inv_sum = 1.0f / sum;
+        for (size_t j = 0; j < cols; j++) {
+            y[j] *= inv_sum;
+        }
+    }
+}
+
+static const dl_kernels_t dl_kernels_scalar = {
+    DL_KERNELS_SCALAR, "scalar",
+    dl_gemm_scalar, dl_add_scalar, dl_mul_scalar, dl_relu_scalar, dl_softmax_scalar
+};
+
+#ifdef NEUROOS_SIMD
+
+/* ------------------------------------------------------------------------- */
+/* SSE2 kernels                                                              */
+/* ------------------------------------------------------------------------- */
+
+#define DL_SSE2 __attribute__((target("sse2")))
+#define DL_AVX2 __attribute__((target("avx2,fma")))
+
+/**
+ * Pack B [k][n] into zero-padded DL_GEMM_NR-wide column panels
+ *
+ * Panel p holds columns [p * NR, p * NR + NR) as k consecutive rows of NR
+ * floats.
+ *
+ * @param n: Number of columns of B
+ * @param k: Number of rows of B
+ * @param b: Matrix B
+ * @param packed: Output buffer [ceil(n / NR)][k][NR]
+ */
+static void dl_gemm_pack_b(uint32_t n, uint32_t k, const float* b, float* packed) {
+    uint32_t num_panels = (n + DL_GEMM_NR - 1) / DL_GEMM_NR;
+
+    for (uint32_t p = 0; p < num_panels; p++) {
+        uint32_t j0 = p * DL_GEMM_NR;
+        uint32_t nr = n - j0 < DL_GEMM_NR ? n - j0 : DL_GEMM_NR;
+        float* panel = packed + (size_t)p * k * DL_GEMM_NR;
+
+        for (uint32_t l = 0; l < k; l++) {
+            const float* src = b + (size_t)l * n + j0;
+            float* dst = panel + (size_t)l * DL_GEMM_NR;
+            uint32_t j = 0;
+
+            for (; j < nr; j++) {
+                dst[j] = src[j];
+            }
+            for (; j < DL_GEMM_NR; j++) {
+                dst[j] = 0.0f;
+            }
+        }
+    }
+}
+
+/**
+ * Vectorized exp, 4 lanes
+ */
+static inline DL_SSE2 __m128 dl_exp_sse2(__m128 x) {
+    x = _mm_min_ps(x, _mm_set1_ps(DL_EXP_HI));
+    x = _mm_max_ps(x, _mm_set1_ps(DL_EXP_LO));
+
+    // n = floor(x * log2e + 0.5)
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(DL_LOG2E)), _mm_set1_ps(0.5f));
+    __m128 tn = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    __m128 fn = _mm_sub_ps(tn, _mm_and_ps(_mm_cmpgt_ps(tn, fx), _mm_set1_ps(1.0f)));
+
+    // r = x - n * ln2
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(DL_EXP_C1)));
+    r = _mm_sub_ps(r, _mm_mul_ps(fn, _mm_set1_ps(DL_EXP_C2)));
+
+    // Polynomial
+    __m128 y = _mm_set1_ps(DL_EXP_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(DL_EXP_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(DL_EXP_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(DL_EXP_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(DL_EXP_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(DL_EXP_P5));
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, r), r), r), _mm_set1_ps(1.0f));
+
+    // Scale by 2^n
+    __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fn), _mm_set1_epi32(127)), 23);
+
+    return _mm_mul_ps(y, _mm_castsi128_ps(e));
+}
+
+/**
+ * SSE2 micro-kernel: C[mr][nr] (+)= A[mr][kc] * Bp[kc][8]
+ */
+static DL_SSE2 void dl_gemm_micro_sse2(uint32_t mr, uint32_t nr, uint32_t kc, const float* a, uint32_t lda,
+                                      const float* bp, float* c, uint32_t ldc, int accumulate) {
+    // Rows past mr alias the last valid row and are never stored
+    const float* a0 = a;
+    const float* a1 = a + (mr > 1 ? 1 : 0) * (size_t)lda;
+    const float* a2 = a + (mr > 2 ? 2 : mr - 1) * (size_t)lda;
+    const float* a3 = a + (mr > 3 ? 3 : mr - 1) * (size_t)lda;
+
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+
+    for (uint32_t l = 0; l < kc; l++) {
+        __m128 b0 = _mm_loadu_ps(bp + (size_t)l * DL_GEMM_NR);
+        __m128 b1 = _mm_loadu_ps(bp + (size_t)l * DL_GEMM_NR + 4);
+        __m128 v;
+
+        v = _mm_set1_ps(a0[l]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(v, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(v, b1));
+        v = _mm_set1_ps(a1[l]);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(v, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(v, b1));
+        v = _mm_set1_ps(a2[l]);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(v, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(v, b1));
+        v = _mm_set1_ps(a3[l]);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(v, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(v, b1));
+    }
+
+    // Store the tile through a staging buffer so partial tiles stay in bounds
+    float tile[DL_GEMM_MR][DL_GEMM_NR];
+    _mm_storeu_ps(&tile[0][0], c00); _mm_storeu_ps(&tile[0][4], c01);
+    _mm_storeu_ps(&tile[1][0], c10); _mm_storeu_ps(&tile[1][4], c11);
+    _mm_storeu_ps(&tile[2][0], c20); _mm_storeu_ps(&tile[2][4], c21);
+    _mm_storeu_ps(&tile[3][0], c30); _mm_storeu_ps(&tile[3][4], c31);
+
+    for (uint32_t r = 0; r < mr; r++) {
+        float* c_row = c + (size_t)r * ldc;
+        for (uint32_t j = 0; j < nr; j++) {
+            c_row[j] = accumulate ? c_row[j] + tile[r][j] : tile[r][j];
+        }
+    }
+}
+
+// Reusable pack buffer
+typedef struct {
+    volatile int busy;
+    float* data;
+    size_t size;
+} dl_gemm_pack_buffer_t;
+
+static dl_gemm_pack_buffer_t dl_gemm_pack_buffers[DL_GEMM_PACK_BUFFERS];
+
+/**
+ * Claim a pack buffer of at least size bytes
+ *
+ * @param size: Bytes needed
+ * @return: Claimed buffer, NULL if all are in use or it cannot be grown
+ */
+static dl_gemm_pack_buffer_t* dl_gemm_pack_acquire(size_t size) {
+    for (int i = 0; i < DL_GEMM_PACK_BUFFERS; i++) {
+        dl_gemm_pack_buffer_t* buffer = &dl_gemm_pack_buffers[i];
+
+        if (buffer->busy || !__sync_bool_compare_and_swap(&buffer->busy, 0, 1)) {
+            continue;
+        }
+
+        if (buffer->size < size) {
+            size_t new_size = (size + DL_GEMM_PACK_GRAIN - 1) & ~(size_t)(DL_GEMM_PACK_GRAIN - 1);
+            float* data = (float*)memory_alloc(new_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_ALLOC_NONE);
+
+            if (!data) {
+                __sync_lock_release(&buffer->busy);
+                return NULL;
+            }
+
+            if (buffer->data) {
+                memory_free(buffer->data, buffer->size);
+            }
+
+            buffer->data = data;
+            buffer->size = new_size;
+        }
+
+        return buffer;
+    }
+
+    return NULL;
+}
+
+/**
+ * Release a pack buffer claimed with dl_gemm_pack_acquire
+ *
+ * @param buffer: Pack buffer
+ */
+static void dl_gemm_pack_release(dl_gemm_pack_buffer_t* buffer) {
+    __sync_lock_release(&buffer->busy);
+}
+
+/**
+ * Packed-panel GEMM driver
+ *
+ * @param micro: Micro-kernel
+ */
+typedef void (*dl_gemm_micro_fn)(uint32_t mr, uint32_t nr, uint32_t kc, const float* a, uint32_t lda,
+                                 const float* bp, float* c, uint32_t ldc, int accumulate);
+
+static void dl_gemm_packed(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c,
+                           dl_gemm_micro_fn micro) {
+    uint32_t num_panels = (n + DL_GEMM_NR - 1) / DL_GEMM_NR;
+    size_t packed_size = (size_t)num_panels * k * DL_GEMM_NR * sizeof(float);
+    dl_gemm_pack_buffer_t* buffer = k > 0 ? dl_gemm_pack_acquire(packed_size) : NULL;
+
+    // Fall back to the scalar kernel if there is no room to pack
+    if (!buffer) {
+        dl_gemm_scalar(m, n, k, a, b, c);
+        return;
+    }
+
+    float* packed = buffer->data;
+
+    dl_gemm_pack_b(n, k, b, packed);
+
+    for (uint32_t k0 = 0; k0 < k; k0 += DL_GEMM_KC) {
+        uint32_t kc = k - k0 < DL_GEMM_KC ? k - k0 : DL_GEMM_KC;
+
+        for (uint32_t p = 0; p < num_panels; p++) {
+            uint32_t j0 = p * DL_GEMM_NR;
+            uint32_t nr = n - j0 < DL_GEMM_NR ? n - j0 : DL_GEMM_NR;
+            const float* bp = packed + ((size_t)p * k + k0) * DL_GEMM_NR;
+
+            for (uint32_t i0 = 0; i0 < m; i0 += DL_GEMM_MR) {
+                uint32_t mr = m - i0 < DL_GEMM_MR ? m - i0 : DL_GEMM_MR;
+                micro(mr, nr, kc, a + (size_t)i0 * k + k0, k, bp, c + (size_t)i0 * n + j0, n, k0 > 0);
+            }
+        }
+    }
+
+    dl_gemm_pack_release(buffer);
+}
+
+static void dl_gemm_sse2(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c) {
+    dl_gemm_packed(m, n, k, a, b, c, dl_gemm_micro_sse2);
+}
+
+static DL_SSE2 void dl_add_sse2(const float* a, const float* b, float* c, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(c + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static DL_SSE2 void dl_mul_sse2(const float* a, const float* b, float* c, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(c + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+static DL_SSE2 void dl_relu_sse2(const float* a, float* b, size_t n) {
+    __m128 zero = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(b + i, _mm_max_ps(_mm_loadu_ps(a + i), zero));
+    }
+    for (; i < n; i++) {
+        b[i] = a[i] > 0.0f ? a[i] : 0.0f;
+    }
+}
+
+static DL_SSE2 void dl_softmax_sse2(const float* a, float* b, size_t rows, size_t cols) {
+    for (size_t r = 0; r < rows; r++) {
+        const float* x = a + r * cols;
+        float* y = b + r * cols;
+        size_t j;
+
+        // Maximum
+        __m128 vmax = _mm_set1_ps(x[0]);
+        for (j = 0; j + 4 <= cols; j += 4) {
+            vmax = _mm_max_ps(vmax, _mm_loadu_ps(x + j));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, vmax);
+        float max_val = lanes[0];
+        for (int l = 1; l < 4; l++) {
+            if (lanes[l] > max_val) max_val = lanes[l];
+        }
+        for (; j < cols; j++) {
+            if (x[j] > max_val) max_val = x[j];
+        }
+
+        // Exponentials and sum
+        __m128 vm = _mm_set1_ps(max_val);
+        __m128 vsum = _mm_setzero_ps();
+        for (j = 0; j + 4 <= cols; j += 4) {
+            __m128 e = dl_exp_sse2(_mm_sub_ps(_mm_loadu_ps(x + j), vm));
+            _mm_storeu_ps(y + j, e);
+            vsum = _mm_add_ps(vsum, e);
+        }
+        _mm_storeu_ps(lanes, vsum);
+        float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (; j < cols; j++) {
+            y[j] = dl_expf(x[j] - max_val);
+            sum += y[j];
+        }
+
+        // Normalize
+        __m128 vinv = _mm_set1_ps(1.0f / sum);
+        for (j = 0; j + 4 <= cols; j += 4) {
+            _mm_storeu_ps(y + j, _mm_mul_ps(_mm_loadu_ps(y + j), vinv));
+        }
+        for (; j < cols; j++) {
+            y[j] *= 1.0f / sum;
+        }
+    }
+}
+
+static const dl_kernels_t dl_kernels_sse2 = {
+    DL_KERNELS_SSE2, "sse2",
+    dl_gemm_sse2, dl_add_sse2, dl_mul_sse2, dl_relu_sse2, dl_softmax_sse2
+};
+
+/* ------------------------------------------------------------------------- */
+/* AVX2/FMA kernels                                                          */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Vectorized exp, 8 lanes
+ */
+static inline DL_AVX2 __m256 dl_exp_avx2(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(DL_EXP_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(DL_EXP_LO));
+
+    // n = floor(x * log2e + 0.5)
+    __m256 fn = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(DL_LOG2E), _mm256_set1_ps(0.5f)));
+
+    // r = x - n * ln2
+    __m256 r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(DL_EXP_C1), x);
+    r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(DL_EXP_C2), r);
+
+    // Polynomial
+    __m256 y = _mm256_set1_ps(DL_EXP_P0);
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(DL_EXP_P1));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(DL_EXP_P2));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(DL_EXP_P3));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(DL_EXP_P4));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(DL_EXP_P5));
+    y = _mm256_fmadd_ps(_mm256_mul_ps(y, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    // Scale by 2^n
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fn), _mm256_set1_epi32(127)), 23);
+
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+/**
+ * AVX2 micro-kernel: C[mr][nr] (+)= A[mr][kc] * Bp[kc][8]
+ */
+static DL_AVX2 void dl_gemm_micro_avx2(uint32_t mr, uint32_t nr, uint32_t kc, const float* a, uint32_t lda,
+                                      const float* bp, float* c, uint32_t ldc, int accumulate) {
+    // Rows past mr alias the last valid row and are never stored
+    const float* a0 = a;
+    const float* a1 = a + (mr > 1 ? 1 : 0) * (size_t)lda;
+    const float* a2 = a + (mr > 2 ? 2 : mr - 1) * (size_t)lda;
+    const float* a3 = a + (mr > 3 ? 3 : mr - 1) * (size_t)lda;
+
+    __m256 c0 = _mm256_setzero_ps();
+    __m256 c1 = _mm256_setzero_ps();
+    __m256 c2 = _mm256_setzero_ps();
+    __m256 c3 = _mm256_setzero_ps();
+
+    for (uint32_t l = 0; l < kc; l++) {
+        __m256 bv = _mm256_loadu_ps(bp + (size_t)l * DL_GEMM_NR);
+        c0 = _mm256_fmadd_ps(_mm256_set1_ps(a0[l]), bv, c0);
+        c1 = _mm256_fmadd_ps(_mm256_set1_ps(a1[l]), bv, c1);
+        c2 = _mm256_fmadd_ps(_mm256_set1_ps(a2[l]), bv, c2);
+        c3 = _mm256_fmadd_ps(_mm256_set1_ps(a3[l]), bv, c3);
+    }
+
+    // Full tiles go straight to C
+    if (mr == DL_GEMM_MR && nr == DL_GEMM_NR) {
+        if (accumulate) {
+            c0 = _mm256_add_ps(c0, _mm256_loadu_ps(c));
+            c1 = _mm256_add_ps(c1, _mm256_loadu_ps(c + ldc));
+            c2 = _mm256_add_ps(c2, _mm256_loadu_ps(c + 2 * (size_t)ldc));
+            c3 = _mm256_add_ps(c3, _mm256_loadu_ps(c + 3 * (size_t)ldc));
+        }
+        _mm256_storeu_ps(c, c0);
+        _mm256_storeu_ps(c + ldc, c1);
+        _mm256_storeu_ps(c + 2 * (size_t)ldc, c2);
+        _mm256_storeu_ps(c + 3 * (size_t)ldc, c3);
+        return;
+    }
+
+    // Partial tiles go through a staging buffer
+    float tile[DL_GEMM_MR][DL_GEMM_NR];
+    _mm256_storeu_ps(tile[0], c0);
+    _mm256_storeu_ps(tile[1], c1);
+    _mm256_storeu_ps(tile[2], c2);
+    _mm256_storeu_ps(tile[3], c3);
+
+    for (uint32_t r = 0; r < mr; r++) {
+        float* c_row = c + (size_t)r * ldc;
+        for (uint32_t j = 0; j < nr; j++) {
+            c_row[j] = accumulate ? c_row[j] + tile[r][j] : tile[r][j];
+        }
+    }
+}
+
+static void dl_gemm_avx2(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c) {
+    dl_gemm_packed(m, n, k, a, b, c, dl_gemm_micro_avx2);
+}
+
+static DL_AVX2 void dl_add_avx2(const float* a, const float* b, float* c, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(c + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static DL_AVX2 void dl_mul_avx2(const float* a, const float* b, float* c, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(c + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+static DL_AVX2 void dl_relu_avx2(const float* a, float* b, size_t n) {
+    __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(b + i, _mm256_max_ps(_mm256_loadu_ps(a + i), zero));
+    }
+    for (; i < n; i++) {
+        b[i] = a[i] > 0.0f ? a[i] : 0.0f;
+    }
+}
+
+static DL_AVX2 void dl_softmax_avx2(const float* a, float* b, size_t rows, size_t cols) {
+    for (size_t r = 0; r < rows; r++) {
+        const float* x = a + r * cols;
+        float* y = b + r * cols;
+        size_t j;
+
+        // Maximum
+        __m256 vmax = _mm256_set1_ps(x[0]);
+        for (j = 0; j + 8 <= cols; j += 8) {
+            vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + j));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, vmax);
+        float max_val = lanes[0];
+        for (int l = 1; l < 8; l++) {
+            if (lanes[l] > max_val) max_val = lanes[l];
+        }
+        for (; j < cols; j++) {
+            if (x[j] > max_val) max_val = x[j];
+        }
+
+        // Exponentials and sum
+        __m256 vm = _mm256_set1_ps(max_val);
+        __m256 vsum = _mm256_setzero_ps();
+        for (j = 0; j + 8 <= cols; j += 8) {
+            __m256 e = dl_exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(x + j), vm));
+            _mm256_storeu_ps(y + j, e);
+            vsum = _mm256_add_ps(vsum, e);
+        }
+        _mm256_storeu_ps(lanes, vsum);
+        float sum = 0.0f;
+        for (int l = 0; l < 8; l++) {
+            sum += lanes[l];
+        }
+        for (; j < cols; j++) {
+            y[j] = dl_expf(x[j] - max_val);
+            sum += y[j];
+        }
+
+        // Normalize
+        __m256 vinv = _mm256_set1_ps(1.0f / sum);
+        for (j = 0; j + 8 <= cols; j += 8) {
+            _mm256_storeu_ps(y + j, _mm256_mul_ps(_mm256_loadu_ps(y + j), vinv));
+        }
+        for (; j < cols; j++) {
+            y[j] *= 1.0f / sum;
+        }
+    }
+}
+
+static const dl_kernels_t dl_kernels_avx2 = {
+    DL_KERNELS_AVX2, "avx2",
+    dl_gemm_avx2, dl_add_avx2, dl_mul_avx2, dl_relu_avx2, dl_softmax_avx2
+};
+
+#endif // NEUROOS_SIMD
+
+/* ------------------------------------------------------------------------- */
+/* Selection and dispatch                                                    */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Select the best kernels supported by the CPU
+ */
+void dl_kernels_init(void) {
+    dl_kernels_current = &dl_kernels_scalar;
+
+#ifdef NEUROOS_SIMD
+    if (cpu_has_feature(CPU_FEATURE_AVX2 | CPU_FEATURE_FMA)) {
+        dl_kernels_current = &dl_kernels_avx2;
+    } else if (cpu_has_feature(CPU_FEATURE_SSE2)) {
+        dl_kernels_current = &dl_kernels_sse2;
+    }
+#endif
+}
+
+/**
+ * Force a kernel implementation
+ *
+ * @param type: Kernel implementation (DL_KERNELS_*)
+ * @return: 0 on success, -1 if it is not available
+ */
+int dl_kernels_select(uint32_t type) {
+    switch (type) {
+        case DL_KERNELS_SCALAR:
+            dl_kernels_current = &dl_kernels_scalar;
+            return 0;
+
+#ifdef NEUROOS_SIMD
+        case DL_KERNELS_SSE2:
+            if (!cpu_has_feature(CPU_FEATURE_SSE2)) {
+                return -1;
+            }
+            dl_kernels_current = &dl_kernels_sse2;
+            return 0;
+
+        case DL_KERNELS_AVX2:
+            if (!cpu_has_feature(CPU_FEATURE_AVX2 | CPU_FEATURE_FMA)) {
+                return -1;
+            }
+            dl_kernels_current = &dl_kernels_avx2;
+            return 0;
+#endif
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Get the selected kernels
+ *
+ * @return: Kernel table
+ */
+const dl_kernels_t* dl_kernels_get(void) {
+    if (!dl_kernels_current) {
+        dl_kernels_init();
+    }
+
+    return dl_kernels_current;
+}
+
+void dl_kernel_gemm(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c) {
+    dl_kernels_get()->gemm(m, n, k, a, b, c);
+}
+
+void dl_kernel_add(const float* a, const float* b, float* c, size_t n) {
+    dl_kernels_get()->add(a, b, c, n);
+}
+
+void dl_kernel_mul(const float* a, const float* b, float* c, size_t n) {
+    dl_kernels_get()->mul(a, b, c, n);
+}
+
+void dl_kernel_relu(const float* a, float* b, size_t n) {
+    dl_kernels_get()->relu(a, b, n);
+}
+
+void dl_kernel_softmax(const float* a, float* b, size_t rows, size_t cols) {
+    dl_kernels_get()->softmax(a, b, rows, cols);
+}
@@ -0,0 +1,43 @@
+/**
+ * dl_kernels.h - Compute kernels for the NeuroOS Deep Learning Framework
+ *
+ * This file contains the compute kernel interface used by the DL framework
+ * operations. Scalar, SSE2 and AVX2/FMA implementations are provided and the
+ * best one supported by the CPU is selected at initialization.
+ */
+
+#ifndef NEUROOS_DL_KERNELS_H
+#define NEUROOS_DL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel implementations
+#define DL_KERNELS_SCALAR  0
+#define DL_KERNELS_SSE2    1
+#define DL_KERNELS_AVX2    2
+
+// Kernel table
+typedef struct {
+    uint32_t type;
+    const char* name;
+    void (*gemm)(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c);
+    void (*add)(const float* a, const float* b, float* c, size_t n);
+    void (*mul)(const float* a, const float* b, float* c, size_t n);
+    void (*relu)(const float* a, float* b, size_t n);
+    void (*softmax)(const float* a, float* b, size_t rows, size_t cols);
+} dl_kernels_t;
+
+// Kernel selection
+void dl_kernels_init(void);
+int dl_kernels_select(uint32_t type);
+const dl_kernels_t* dl_kernels_get(void);
+
+// Kernels (dispatch to the selected implementation)
+void dl_kernel_gemm(uint32_t m, uint32_t n, uint32_t k, const float* a, const float* b, float* c);
+void dl_kernel_add(const float* a, const float* b, float* c, size_t n);
+void dl_kernel_mul(const float* a, const float* b, float* c, size_t n);
+void dl_kernel_relu(const float* a, float* b, size_t n);
+void dl_kernel_softmax(const float* a, float* b, size_t rows, size_t cols);
+
+#endif // NEUROOS_DL_KERNELS_H
@@ -0,0 +1,529 @@
+/**
+ * dl_thread_pool.c - Work-stealing worker pool implementation for NeuroOS
+ *
+ * Worker 0 is the thread that calls dl_pool_parallel_for; workers 1..n-1 are
+ * kernel processes created with process_create. A parallel loop is split into
+ * range tasks that are dealt round-robin onto per-worker deques. Each worker
+ * pops from the tail of its own deque and, when it runs dry, steals from the
+ * head of another worker's deque, so uneven chunks balance out. Idle workers
+ * block at normal priority and are raised to high priority while a loop is
+ * in flight.
+ */
+
+#include "dl_framework/dl_thread_pool.h"
+#include "../../kernel/include/process.h"
+#include "../../kernel/include/memory.h"
+#include <string.h>
+#include <sys/time.h>
+
+// Maximum number of pools alive at once
+#define DL_POOL_MAX_POOLS       8
+
+// Chunks per worker when splitting a loop
+#define DL_POOL_CHUNKS_PER_WORKER 4
+
+// Worker process stack size
+#define DL_POOL_STACK_SIZE      (64 * 1024)
+
+// Worker slot states
+#define DL_WORKER_UNUSED        0
+#define DL_WORKER_CREATED       1
+#define DL_WORKER_RUNNING       2
+
+// Parallel loop in flight
+typedef struct {
+    dl_pool_fn_t fn;
+    void* arg;
+    volatile uint32_t pending;
+} dl_pool_job_t;
+
+// Range task
+typedef struct {
+    dl_pool_job_t* job;
+    uint32_t begin;
+    uint32_t end;
+} dl_pool_task_t;
+
+// Per-worker deque and statistics
+typedef struct {
+    volatile int lock;
+    uint32_t head;
+    uint32_t tail;
+    dl_pool_task_t tasks[DL_POOL_DEQUE_SIZE];
+    volatile int state;
+    volatile int wake;
+    pid_t pid;
+    dl_pool_worker_stats_t stats;
+} dl_pool_worker_t;
+
+// Worker pool
+struct dl_pool {
+    uint32_t num_workers;
+    volatile int running;
+    volatile int submitting;
+    volatile uint32_t live_workers;
+    uint64_t start_time;
+    dl_pool_worker_t workers[DL_POOL_MAX_WORKERS];
+};
+
+// Pools whose worker processes have not all claimed their slot yet
+static dl_pool_t* volatile dl_pool_registry[DL_POOL_MAX_POOLS];
+
+/**
+ * Get the current time in microseconds
+ *
+ * @return: Time in microseconds
+ */
+static uint64_t dl_pool_now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+}
+
+/**
+ * Acquire a worker deque lock
+ *
+ * @param worker: Worker
+ */
+static void dl_pool_lock(dl_pool_worker_t* worker) {
+    while (__sync_lock_test_and_set(&worker->lock, 1)) {
+        while (worker->lock) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+/**
+ * Release a worker deque lock
+ *
+ * @param worker: Worker
+ */
+static void dl_pool_unlock(dl_pool_worker_t* worker) {
+    __sync_lock_release(&worker->lock);
+}
+
+/**
+ * Push a task onto the tail of a worker deque
+ *
+ * @param worker: Worker
+ * @param task: Task to push
+ * @return: 0 on success, -1 if the deque is full
+ */
+static int dl_pool_push(dl_pool_worker_t* worker, const dl_pool_task_t* task) {
+    int result = -1;
+
+    dl_pool_lock(worker);
+    if (worker->tail - worker->head < DL_POOL_DEQUE_SIZE) {
+        worker->tasks[worker->tail & (DL_POOL_DEQUE_SIZE - 1)] = *task;
+        worker->tail++;
+        result = 0;
+    }
+    dl_pool_unlock(worker);
+
+    return result;
+}
+
+/**
+ * Pop a task from the tail of the worker's own deque
+ *
+ * @param worker: Worker
+ * @param task: Pointer to store the task
+ * @return: 1 if a task was taken, 0 if the deque is empty
+ */
+static int dl_pool_pop(dl_pool_worker_t* worker, dl_pool_task_t* task) {
+    int result = 0;
+
+    dl_pool_lock(worker);
+    if (worker->tail != worker->head) {
+        worker->tail--;
+        *task = worker->tasks[worker->tail & (DL_POOL_DEQUE_SIZE - 1)];
+        result = 1;
+    }
+    dl_pool_unlock(worker);
+
+    return result;
+}
+
+/**
+ * Steal a task from the head of another worker's deque
+ *
+ * @param victim: Worker to steal from
+ * @param task: Pointer to store the task
+ * @return: 1 if a task was taken, 0 if the deque is empty
+ */
+static int dl_pool_steal(dl_pool_worker_t* victim, dl_pool_task_t* task) {
+    int result = 0;
+
+    // Skip empty deques without taking the lock
+    if (victim->tail == victim->head) {
+        return 0;
+    }
+
+    dl_pool_lock(victim);
+    if (victim->tail != victim->head) {
+        *task = victim->tasks[victim->head & (DL_POOL_DEQUE_SIZE - 1)];
+        victim->head++;
+        result = 1;
+    }
+    dl_pool_unlock(victim);
+
+    return result;
+}
+
+/**
+ * Find and run one task on behalf of a worker
+ *
+ * @param pool: Worker pool
+ * @param index: Worker index
+ * @return: 1 if a task was run, 0 if there was no work
+ */
+static int dl_pool_run_one(dl_pool_t* pool, uint32_t index) {
+    dl_pool_worker_t* self = &pool->workers[index];
+    dl_pool_task_t task = { NULL, 0, 0 };
+    int found = dl_pool_pop(self, &task);
+    int stolen = 0;
+
+    // Own deque is empty: try the others, starting after ourselves
+    for (uint32_t i = 1; !found && i < pool->num_workers; i++) {
+        found = dl_pool_steal(&pool->workers[(index + i) % pool->num_workers], &task);
+        stolen = found;
+    }
+
+    if (!found) {
+        return 0;
+    }
+
+    uint64_t start = dl_pool_now();
+    task.job->fn(task.job->arg, task.begin, task.end);
+    self->stats.busy_time += dl_pool_now() - start;
+    self->stats.tasks_executed++;
+    if (stolen) {
+        self->stats.tasks_stolen++;
+    }
+
+    __sync_fetch_and_sub(&task.job->pending, 1);
+
+    return 1;
+}
+
+/**
+ * Claim an unclaimed worker slot from any registered pool
+ *
+ * @param index: Pointer to store the worker index
+ * @return: Pool on success, NULL if there is no slot to claim
+ */
+static dl_pool_t* dl_pool_claim_worker(uint32_t* index) {
+    for (int p = 0; p < DL_POOL_MAX_POOLS; p++) {
+        dl_pool_t* pool = dl_pool_registry[p];
+
+        if (!pool) {
+            continue;
+        }
+
+        for (uint32_t i = 1; i < pool->num_workers; i++) {
+            if (__sync_bool_compare_and_swap(&pool->workers[i].state, DL_WORKER_CREATED, DL_WORKER_RUNNING)) {
+                *index = i;
+                return pool;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Worker process entry point
+ */
+static void dl_pool_worker_main(void) {
+    uint32_t index = 0;
+    dl_pool_t* pool = dl_pool_claim_worker(&index);
+
+    if (pool) {
+        dl_pool_worker_t* self = &pool->workers[index];
+
+        while (pool->running) {
+            self->wake = 0;
+            __sync_synchronize();
+
+            if (dl_pool_run_one(pool, index)) {
+                continue;
+            }
+
+            // Sleep until dl_pool_parallel_for posts work or the pool is destroyed
+            if (pool->running && process_block_unless(&self->wake) != 0) {
+                process_yield();
+            }
+        }
+
+        __sync_fetch_and_sub(&pool->live_workers, 1);
+    }
+
+    process_terminate(process_get_current()->pid, 0);
+}
+
+/**
+ * Wake the worker processes of a pool
+ *
+ * @param pool: Worker pool
+ * @param priority: Priority to run the workers at from now on, or -1 to keep it
+ */
+static void dl_pool_wake_workers(dl_pool_t* pool, int priority) {
+    for (uint32_t i = 1; i < pool->num_workers; i++) {
+        dl_pool_worker_t* worker = &pool->workers[i];
+
+        if (priority >= 0) {
+            process_set_priority(worker->pid, (process_priority_t)priority);
+        }
+
+        if (!worker->wake) {
+            worker->wake = 1;
+            __sync_synchronize();
+            process_unblock(worker->pid);
+        }
+    }
+}
+
+/**
+ * Create a worker pool
+ *
+ * @param num_threads: Number of threads, including the calling thread
+ * @return: Pool on success, NULL on failure
+ */
+dl_pool_t* dl_pool_create(uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    if (num_threads > DL_POOL_MAX_WORKERS) {
+        num_threads = DL_POOL_MAX_WORKERS;
+    }
+
+    dl_pool_t* pool = (dl_pool_t*)memory_alloc(sizeof(dl_pool_t), MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                              MEMORY_ALLOC_ZEROED);
+
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->num_workers = num_threads;
+    pool->running = 1;
+    pool->start_time = dl_pool_now();
+
+    if (num_threads == 1) {
+        return pool;
+    }
+
+    // Register the pool so new worker processes can find their slot
+    int reg = -1;
+    for (int p = 0; p < DL_POOL_MAX_POOLS; p++) {
+        if (__sync_bool_compare_and_swap(&dl_pool_registry[p], NULL, pool)) {
+            reg = p;
+            break;
+        }
+    }
+
+    if (reg == -1) {
+        // No registry slot: run everything on the calling thread
+        pool->num_workers = 1;
+        return pool;
+    }
+
+    // Start the worker processes
+    uint32_t created = 1;
+    for (uint32_t i = 1; i < num_threads; i++) {
+        pool->workers[i].state = DL_WORKER_CREATED;
+        __sync_fetch_and_add(&pool->live_workers, 1);
+
+        pid_t pid = process_create("dl_worker", dl_pool_worker_main, DL_POOL_STACK_SIZE,
+                                   PROCESS_PRIORITY_NORMAL, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+
+        if (pid == 0) {
+            pool->workers[i].state = DL_WORKER_UNUSED;
+            __sync_fetch_and_sub(&pool->live_workers, 1);
+            break;
+        }
+
+        pool->workers[i].pid = pid;
+        created++;
+    }
+
+    pool->num_workers = created;
+
+    return pool;
+}
+
+/**
+ * Destroy a worker pool
+ *
+ * Stops the workers and waits for them to exit before freeing the pool.
+ *
+ * @param pool: Worker pool
+ */
+void dl_pool_destroy(dl_pool_t* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pool->running = 0;
+
+    // Workers that started are parked; wake them so they see the pool stop
+    dl_pool_wake_workers(pool, -1);
+
+    // Workers that never started will not claim their slot
+    for (uint32_t i = 1; i < pool->num_workers; i++) {
+        if (__sync_bool_compare_and_swap(&pool->workers[i].state, DL_WORKER_CREATED, DL_WORKER_UNUSED)) {
+            __sync_fetch_and_sub(&pool->live_workers, 1);
+        }
+    }
+
+    while (pool->live_workers > 0) {
+        process_yield();
+    }
+
+    for (int p = 0; p < DL_POOL_MAX_POOLS; p++) {
+        __sync_bool_compare_and_swap(&dl_pool_registry[p], pool, NULL);
+    }
+
+    memory_free(pool, sizeof(dl_pool_t));
+}
+
+/**
+ * Run a parallel loop over [0, total)
+ *
+ * The range is split into chunks of at least grain iterations. The calling
+ * thread takes part as worker 0 and returns once every chunk has run. Nested
+ * calls from inside a task run inline.
+ *
+ * @param pool: Worker pool (NULL runs the loop inline)
+ * @param total: Number of iterations
+ * @param grain: Minimum iterations per chunk
+ * @param fn: Range function
+ * @param arg: Argument passed to fn
+ * @return: 0 on success, -1 on failure
+ */
+int dl_pool_parallel_for(dl_pool_t* pool, uint32_t total, uint32_t grain, dl_pool_fn_t fn, void* arg) {
+    if (!fn) {
+        return -1;
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    // Run inline when there is a single worker, too little work or a loop already in flight
+    if (!pool || pool->num_workers == 1 || total <= grain ||
+        !__sync_bool_compare_and_swap(&pool->submitting, 0, 1)) {
+        fn(arg, 0, total);
+        return 0;
+    }
+
+    // Pick the chunk size
+    uint32_t max_chunks = pool->num_workers * DL_POOL_CHUNKS_PER_WORKER;
+    uint32_t chunk = (total + max_chunks - 1) / max_chunks;
+    if (chunk < grain) {
+        chunk = grain;
+    }
+    uint32_t num_chunks = (total + chunk - 1) / chunk;
+
+    dl_pool_job_t job;
+    job.fn = fn;
+    job.arg = arg;
+    job.pending = num_chunks;
+
+    // Deal the chunks round-robin onto the worker deques
+    for (uint32_t c = 0; c < num_chunks; c++) {
+        dl_pool_task_t task;
+        task.job = &job;
+        task.begin = c * chunk;
+        task.end = task.begin + chunk < total ? task.begin + chunk : total;
+
+        if (dl_pool_push(&pool->workers[c % pool->num_workers], &task) != 0) {
+            fn(arg, task.begin, task.end);
+            __sync_fetch_and_sub(&job.pending, 1);
+        }
+    }
+
+    // Run the workers at high priority for the duration of the loop
+    dl_pool_wake_workers(pool, PROCESS_PRIORITY_HIGH);
+
+    // Work as worker 0 until every chunk is done
+    while (job.pending > 0) {
+        if (!dl_pool_run_one(pool, 0)) {
+            process_yield();
+        }
+    }
+
+    // Idle workers must not hold the top run queues
+    for (uint32_t i = 1; i < pool->num_workers; i++) {
+        process_set_priority(pool->workers[i].pid, PROCESS_PRIORITY_NORMAL);
+    }
+
+    __sync_lock_release(&pool->submitting);
+
+    return 0;
+}
+
+/**
+ * Get the number of workers in a pool
+ *
+ * @param pool: Worker pool
+ * @return: Number of workers, including the calling thread
+ */
+uint32_t dl_pool_get_num_workers(const dl_pool_t* pool) {
+    return pool ? pool->num_workers : 1;
+}
+
+/**
+ * Get the index of the worker running the caller
+ *
+ * Range tasks can use this to pick per-worker state. Any process that is
+ * not one of the pool's worker processes is the submitting thread, worker 0.
+ *
+ * @param pool: Worker pool
+ * @return: Worker index
+ */
+uint32_t dl_pool_get_current_worker(const dl_pool_t* pool) {
+    process_t* current = process_get_current();
+
+    if (!pool || !current) {
+        return 0;
+    }
+
+    for (uint32_t i = 1; i < pool->num_workers; i++) {
+        if (pool->workers[i].pid == current->pid) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get worker statistics
+ *
+ * Utilization is the percentage of time since the pool was created that
+ * the worker spent running tasks.
+ *
+ * @param pool: Worker pool
+ * @param worker: Worker index
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 on failure
+ */
+int dl_pool_get_worker_stats(const dl_pool_t* pool, uint32_t worker, dl_pool_worker_stats_t* stats) {
+    if (!pool || !stats || worker >= pool->num_workers) {
+        return -1;
+    }
+
+    *stats = pool->workers[worker].stats;
+
+    uint64_t elapsed = dl_pool_now() - pool->start_time;
+    stats->utilization = elapsed > 0 ? (uint32_t)(stats->busy_time * 100 / elapsed) : 0;
+    if (stats->utilization > 100) {
+        stats->utilization = 100;
+    }
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * dl_thread_pool.h - Work-stealing worker pool for the NeuroOS Deep Learning Framework
+ *
+ * This file contains the worker pool interface used to split DL framework
+ * operations across multiple kernel processes.
+ */
+
+#ifndef NEUROOS_DL_THREAD_POOL_H
+#define NEUROOS_DL_THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of workers per pool (including the calling thread)
+#define DL_POOL_MAX_WORKERS  16
+
+// Capacity of each worker deque (power of two)
+#define DL_POOL_DEQUE_SIZE   256
+
+// Range task function: process [begin, end) of a parallel loop
+typedef void (*dl_pool_fn_t)(void* arg, uint32_t begin, uint32_t end);
+
+// Worker statistics
+typedef struct {
+    uint64_t busy_time;
+    uint64_t tasks_executed;
+    uint64_t tasks_stolen;
+    uint32_t utilization;
+} dl_pool_worker_stats_t;
+
+// Worker pool (opaque)
+typedef struct dl_pool dl_pool_t;
+
+// Pool creation and destruction
+dl_pool_t* dl_pool_create(uint32_t num_threads);
+void dl_pool_destroy(dl_pool_t* pool);
+
+// Parallel execution
+int dl_pool_parallel_for(dl_pool_t* pool, uint32_t total, uint32_t grain, dl_pool_fn_t fn, void* arg);
+
+// Pool information
+uint32_t dl_pool_get_num_workers(const dl_pool_t* pool);
+uint32_t dl_pool_get_current_worker(const dl_pool_t* pool);
+int dl_pool_get_worker_stats(const dl_pool_t* pool, uint32_t worker, dl_pool_worker_stats_t* stats);
+
+#endif // NEUROOS_DL_THREAD_POOL_H
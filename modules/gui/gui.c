@@ -6,16 +6,42 @@
  */
 
 #include "gui/gui.h"
+#include "../../kernel/include/memory.h"
 #include <string.h>
 #include <stdlib.h>
 
-// Frame buffer information
+// Frame buffer information. Everything is drawn into the back buffer and
+// only damaged rectangles are copied to the video memory.
 static uint32_t* framebuffer = NULL;
 static int framebuffer_width = 0;
 static int framebuffer_height = 0;
 static int framebuffer_pitch = 0;
 static int framebuffer_bpp = 0;
 
+// Linear frame buffer of the display, mapped write-combining
+static uint8_t* video_memory = NULL;
+static int video_pitch = 0;
+
+// Damaged screen rectangles waiting to be composited
+#define GUI_MAX_DAMAGE 32
+static gui_rect_t damage_rects[GUI_MAX_DAMAGE];
+static int damage_count = 0;
+
+// Clip rectangle the render functions draw into (exclusive end)
+static int clip_x0 = 0;
+static int clip_y0 = 0;
+static int clip_x1 = 0;
+static int clip_y1 = 0;
+
+#define GUI_IN_CLIP(x, y) ((x) >= clip_x0 && (x) < clip_x1 && (y) >= clip_y0 && (y) < clip_y1)
+
+// Desktop layout
+#define GUI_TASKBAR_HEIGHT 30
+#define GUI_START_MENU_WIDTH 200
+#define GUI_START_MENU_HEIGHT 300
+#define GUI_START_MENU_X 3
+#define GUI_START_MENU_Y (framebuffer_height - GUI_TASKBAR_HEIGHT - GUI_START_MENU_HEIGHT)
+
 // Window structure implementation
 struct gui_window {
     char title[256];
@@ -143,7 +169,147 @@ static gui_widget_t* gui_widget_at_position(gui_window_t* window, int x, int y)
     (void)y;
     return NULL;
 }
-static void gui_update_framebuffer(void);
+
+/**
+ * Set the clip rectangle, clipped to the screen
+ */
+static void gui_set_clip(int x, int y, int width, int height) {
+    clip_x0 = x < 0 ? 0 : x;
+    clip_y0 = y < 0 ? 0 : y;
+    clip_x1 = x + width > framebuffer_width ? framebuffer_width : x + width;
+    clip_y1 = y + height > framebuffer_height ? framebuffer_height : y + height;
+}
+
+/**
+ * Check if a rectangle overlaps the clip rectangle
+ */
+static int gui_clip_intersects(int x, int y, int width, int height) {
+    return x < clip_x1 && x + width > clip_x0 && y < clip_y1 && y + height > clip_y0;
+}
+
+/**
+ * Fill the part of a rectangle inside the clip rectangle with a color
+ */
+static void gui_fill_rect(int x, int y, int width, int height, gui_color_t color) {
+    int x0 = x > clip_x0 ? x : clip_x0;
+    int y0 = y > clip_y0 ? y : clip_y0;
+    int x1 = x + width < clip_x1 ? x + width : clip_x1;
+    int y1 = y + height < clip_y1 ? y + height : clip_y1;
+    
+    uint32_t pixel = (color.a << 24) | (color.r << 16) | (color.g << 8) | (color.b);
+    
+    for (int screen_y = y0; screen_y < y1; screen_y++) {
+        uint32_t* row = &framebuffer[screen_y * framebuffer_width];
+        for (int screen_x = x0; screen_x < x1; screen_x++) {
+            row[screen_x] = pixel;
+        }
+    }
+}
+
+/**
+ * Mark a screen rectangle as needing to be composited
+ * 
+ * Rectangles that overlap, or whose union is no larger than the two of them,
+ * are merged, so the same pixels are never composited twice.
+ */
+static void gui_damage(int x, int y, int width, int height) {
+    // Clip the rectangle to the screen
+    int x0 = x < 0 ? 0 : x;
+    int y0 = y < 0 ? 0 : y;
+    int x1 = x + width > framebuffer_width ? framebuffer_width : x + width;
+    int y1 = y + height > framebuffer_height ? framebuffer_height : y + height;
+    
+    if (!gui_initialized || x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    
+    // Merge with the pending rectangles; a merged rectangle can reach others, so rescan
+    int i = 0;
+    while (i < damage_count) {
+        gui_rect_t* rect = &damage_rects[i];
+        int ux0 = x0 < rect->x ? x0 : rect->x;
+        int uy0 = y0 < rect->y ? y0 : rect->y;
+        int ux1 = x1 > rect->x + rect->width ? x1 : rect->x + rect->width;
+        int uy1 = y1 > rect->y + rect->height ? y1 : rect->y + rect->height;
+        
+        int overlaps = x0 < rect->x + rect->width && rect->x < x1 &&
+                       y0 < rect->y + rect->height && rect->y < y1;
+        int tight = (ux1 - ux0) * (uy1 - uy0) <=
+                    (x1 - x0) * (y1 - y0) + rect->width * rect->height;
+        
+        if (overlaps || tight) {
+            x0 = ux0;
+            y0 = uy0;
+            x1 = ux1;
+            y1 = uy1;
+            damage_rects[i] = damage_rects[--damage_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    
+    // Out of slots: collapse everything into the bounding rectangle
+    if (damage_count == GUI_MAX_DAMAGE) {
+        for (i = 0; i < damage_count; i++) {
+            gui_rect_t* rect = &damage_rects[i];
+            x0 = x0 < rect->x ? x0 : rect->x;
+            y0 = y0 < rect->y ? y0 : rect->y;
+            x1 = x1 > rect->x + rect->width ? x1 : rect->x + rect->width;
+            y1 = y1 > rect->y + rect->height ? y1 : rect->y + rect->height;
+        }
+        damage_count = 0;
+    }
+    
+    damage_rects[damage_count].x = x0;
+    damage_rects[damage_count].y = y0;
+    damage_rects[damage_count].width = x1 - x0;
+    damage_rects[damage_count].height = y1 - y0;
+    damage_count++;
+}
+
+/**
+ * Copy a rectangle of the back buffer to the video memory
+ */
+static void gui_present_rect(const gui_rect_t* rect) {
+    if (!video_memory) {
+        return;
+    }
+    
+    size_t row_size = rect->width * (framebuffer_bpp / 8);
+    
+    for (int y = rect->y; y < rect->y + rect->height; y++) {
+        memcpy(video_memory + y * video_pitch + rect->x * (framebuffer_bpp / 8),
+               &framebuffer[y * framebuffer_width + rect->x], row_size);
+    }
+}
+
+/**
+ * Redraw the damaged rectangles into the back buffer and present them
+ */
+static void gui_compose(void) {
+    if (!gui_initialized || !framebuffer) {
+        return;
+    }
+    
+    for (int i = 0; i < damage_count; i++) {
+        gui_rect_t* rect = &damage_rects[i];
+        
+        // Only pixels inside the rectangle are drawn
+        gui_set_clip(rect->x, rect->y, rect->width, rect->height);
+        gui_render_desktop();
+        gui_present_rect(rect);
+    }
+    
+    damage_count = 0;
+    gui_set_clip(0, 0, framebuffer_width, framebuffer_height);
+    
+    // Drain the write-combining buffers so the frame reaches the display;
+    // a locked instruction does this on every x86
+    if (video_memory) {
+        asm volatile("lock; addl $0, (%%esp)" ::: "memory");
+    }
+}
 
 /**
  * Initialize the GUI subsystem
@@ -173,8 +339,10 @@ int gui_init(void) {
     // Set the initialized flag
     gui_initialized = 1;
     
-    // Render the desktop
-    gui_render_desktop();
+    // Draw the whole screen into the back buffer
+    gui_set_clip(0, 0, framebuffer_width, framebuffer_height);
+    gui_damage(0, 0, framebuffer_width, framebuffer_height);
+    gui_compose();
     
     return 0;
 }
@@ -219,6 +387,9 @@ int gui_shutdown(void) {
         framebuffer = NULL;
     }
     
+    // Drop pending damage
+    damage_count = 0;
+    
     // Reset the initialized flag
     gui_initialized = 0;
     
@@ -284,31 +455,24 @@ static void gui_render_desktop(void) {
     }
     
     // Fill the frame buffer with the desktop background color
-    for (int y = 0; y < framebuffer_height; y++) {
-        for (int x = 0; x < framebuffer_width; x++) {
-            uint32_t pixel = (desktop_background_color.a << 24) |
-                             (desktop_background_color.r << 16) |
-                             (desktop_background_color.g << 8) |
-                             (desktop_background_color.b);
-            
-            framebuffer[y * framebuffer_width + x] = pixel;
-        }
-    }
+    gui_fill_rect(0, 0, framebuffer_width, framebuffer_height, desktop_background_color);
     
     // Render the taskbar if it's visible
-    if (taskbar_visible) {
+    if (taskbar_visible && gui_clip_intersects(0, framebuffer_height - GUI_TASKBAR_HEIGHT,
+                                               framebuffer_width, GUI_TASKBAR_HEIGHT)) {
         gui_render_taskbar();
     }
     
     // Render the start menu if it's visible
-    if (start_menu_visible) {
+    if (start_menu_visible && gui_clip_intersects(GUI_START_MENU_X, GUI_START_MENU_Y,
+                                                  GUI_START_MENU_WIDTH, GUI_START_MENU_HEIGHT)) {
         gui_render_start_menu();
     }
     
-    // Render all visible windows
+    // Render all visible windows that overlap the clip rectangle
     gui_window_t* window = window_list;
     while (window) {
-        if (window->visible) {
+        if (window->visible && gui_clip_intersects(window->x, window->y, window->width, window->height)) {
             gui_render_window(window);
         }
         window = window->next;
@@ -325,22 +489,7 @@ static void gui_render_window(gui_window_t* window) {
     }
     
     // Fill the window with the background color
-    for (int y = 0; y < window->height; y++) {
-        for (int x = 0; x < window->width; x++) {
-            int screen_x = window->x + x;
-            int screen_y = window->y + y;
-            
-            if (screen_x >= 0 && screen_x < framebuffer_width &&
-                screen_y >= 0 && screen_y < framebuffer_height) {
-                uint32_t pixel = (window->background_color.a << 24) |
-                                 (window->background_color.r << 16) |
-                                 (window->background_color.g << 8) |
-                                 (window->background_color.b);
-                
-                framebuffer[screen_y * framebuffer_width + screen_x] = pixel;
-            }
-        }
-    }
+    gui_fill_rect(window->x, window->y, window->width, window->height, window->background_color);
     
     // Draw the window border
     gui_color_t border_color = theme_colors[current_theme][8];
@@ -350,8 +499,7 @@ static void gui_render_window(gui_window_t* window) {
         int screen_x = window->x + x;
         int screen_y = window->y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -366,8 +514,7 @@ static void gui_render_window(gui_window_t* window) {
         int screen_x = window->x + x;
         int screen_y = window->y + window->height - 1;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -382,8 +529,7 @@ static void gui_render_window(gui_window_t* window) {
         int screen_x = window->x;
         int screen_y = window->y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -398,8 +544,7 @@ static void gui_render_window(gui_window_t* window) {
         int screen_x = window->x + window->width - 1;
         int screen_y = window->y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -432,26 +577,15 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
     int abs_x = window->x + widget->x;
     int abs_y = window->y + widget->y;
     
-    // Fill the widget with the background color
-    for (int y = 0; y < widget->height; y++) {
-        for (int x = 0; x < widget->width; x++) {
-            int screen_x = abs_x + x;
-            int screen_y = abs_y + y;
-            
-            if (screen_x >= window->x && screen_x < window->x + window->width &&
-                screen_y >= window->y && screen_y < window->y + window->height &&
-                screen_x >= 0 && screen_x < framebuffer_width &&
-                screen_y >= 0 && screen_y < framebuffer_height) {
-                
-                uint32_t pixel = (widget->background_color.a << 24) |
-                                 (widget->background_color.r << 16) |
-                                 (widget->background_color.g << 8) |
-                                 (widget->background_color.b);
-                
-                framebuffer[screen_y * framebuffer_width + screen_x] = pixel;
-            }
-        }
-    }
+    // Fill the part of the widget inside the window with the background color
+    int fill_x0 = abs_x > window->x ? abs_x : window->x;
+    int fill_y0 = abs_y > window->y ? abs_y : window->y;
+    int fill_x1 = abs_x + widget->width < window->x + window->width ?
+                  abs_x + widget->width : window->x + window->width;
+    int fill_y1 = abs_y + widget->height < window->y + window->height ?
+                  abs_y + widget->height : window->y + window->height;
+    
+    gui_fill_rect(fill_x0, fill_y0, fill_x1 - fill_x0, fill_y1 - fill_y0, widget->background_color);
     
     // Render the widget based on its type
     switch (widget->type) {
@@ -466,8 +600,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -485,8 +618,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -504,8 +636,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -523,8 +654,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -553,8 +683,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                         
                         if (screen_x >= window->x && screen_x < window->x + window->width &&
                             screen_y >= window->y && screen_y < window->y + window->height &&
-                            screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                            GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Simple font rendering - just draw a filled rectangle for each character
                             if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -590,8 +719,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                         
                         if (screen_x >= window->x && screen_x < window->x + window->width &&
                             screen_y >= window->y && screen_y < window->y + window->height &&
-                            screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                            GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Simple font rendering - just draw a filled rectangle for each character
                             if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -620,8 +748,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -639,8 +766,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -658,8 +784,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -677,8 +802,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -706,8 +830,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                         
                         if (screen_x >= window->x && screen_x < window->x + window->width &&
                             screen_y >= window->y && screen_y < window->y + window->height &&
-                            screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                            GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Simple font rendering - just draw a filled rectangle for each character
                             if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -739,8 +862,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -758,8 +880,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -777,8 +898,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -796,8 +916,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                 
                 if (screen_x >= window->x && screen_x < window->x + window->width &&
                     screen_y >= window->y && screen_y < window->y + window->height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -825,8 +944,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                         
                         if (screen_x >= window->x && screen_x < window->x + window->width &&
                             screen_y >= window->y && screen_y < window->y + window->height &&
-                            screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                            GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Simple font rendering - just draw a filled rectangle for each character
                             if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -852,8 +970,7 @@ static void gui_render_widget(gui_window_t* window, gui_widget_t* widget) {
                         
                         if (screen_x >= window->x && screen_x < window->x + window->width &&
                             screen_y >= window->y && screen_y < window->y + window->height &&
-                            screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                            GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Draw an X
                             if (x == y || x == checkbox_size - 3 - y) {
@@ -888,26 +1005,13 @@ static void gui_render_taskbar(void) {
     }
     
     // Taskbar dimensions
-    int taskbar_height = 30;
+    int taskbar_height = GUI_TASKBAR_HEIGHT;
     int taskbar_y = framebuffer_height - taskbar_height;
     
     // Fill the taskbar with the taskbar background color
     gui_color_t taskbar_color = theme_colors[current_theme][7];
     
-    for (int y = 0; y < taskbar_height; y++) {
-        for (int x = 0; x < framebuffer_width; x++) {
-            int screen_y = taskbar_y + y;
-            
-            if (screen_y >= 0 && screen_y < framebuffer_height) {
-                uint32_t pixel = (taskbar_color.a << 24) |
-                                 (taskbar_color.r << 16) |
-                                 (taskbar_color.g << 8) |
-                                 (taskbar_color.b);
-                
-                framebuffer[screen_y * framebuffer_width + x] = pixel;
-            }
-        }
-    }
+    gui_fill_rect(0, taskbar_y, framebuffer_width, taskbar_height, taskbar_color);
     
     // Draw the start button
     int start_button_width = 80;
@@ -923,8 +1027,7 @@ static void gui_render_taskbar(void) {
             int screen_x = start_button_x + x;
             int screen_y = start_button_y + y;
             
-            if (screen_x >= 0 && screen_x < framebuffer_width &&
-                screen_y >= 0 && screen_y < framebuffer_height) {
+            if (GUI_IN_CLIP(screen_x, screen_y)) {
                 uint32_t pixel = (button_color.a << 24) |
                                  (button_color.r << 16) |
                                  (button_color.g << 8) |
@@ -943,8 +1046,7 @@ static void gui_render_taskbar(void) {
         int screen_x = start_button_x + x;
         int screen_y = start_button_y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -959,8 +1061,7 @@ static void gui_render_taskbar(void) {
         int screen_x = start_button_x + x;
         int screen_y = start_button_y + start_button_height - 1;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -975,8 +1076,7 @@ static void gui_render_taskbar(void) {
         int screen_x = start_button_x;
         int screen_y = start_button_y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -991,8 +1091,7 @@ static void gui_render_taskbar(void) {
         int screen_x = start_button_x + start_button_width - 1;
         int screen_y = start_button_y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -1019,8 +1118,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = char_x + x;
                 int screen_y = text_y + y;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     // Simple font rendering - just draw a filled rectangle for each character
                     if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -1054,8 +1152,7 @@ static void gui_render_taskbar(void) {
                     int screen_x = button_x + x;
                     int screen_y = start_button_y + y;
                     
-                    if (screen_x >= 0 && screen_x < framebuffer_width &&
-                        screen_y >= 0 && screen_y < framebuffer_height) {
+                    if (GUI_IN_CLIP(screen_x, screen_y)) {
                         uint32_t pixel = (window_button_color.a << 24) |
                                          (window_button_color.r << 16) |
                                          (window_button_color.g << 8) |
@@ -1071,8 +1168,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = button_x + x;
                 int screen_y = start_button_y;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
                                      (border_color.g << 8) |
@@ -1086,8 +1182,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = button_x + x;
                 int screen_y = start_button_y + button_height - 1;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
                                      (border_color.g << 8) |
@@ -1101,8 +1196,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = button_x;
                 int screen_y = start_button_y + y;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
                                      (border_color.g << 8) |
@@ -1116,8 +1210,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = button_x + button_width - 1;
                 int screen_y = start_button_y + y;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
                                      (border_color.g << 8) |
@@ -1148,8 +1241,7 @@ static void gui_render_taskbar(void) {
                         int screen_x = char_x + x;
                         int screen_y = title_y + y;
                         
-                        if (screen_x >= 0 && screen_x < framebuffer_width &&
-                            screen_y >= 0 && screen_y < framebuffer_height) {
+                        if (GUI_IN_CLIP(screen_x, screen_y)) {
                             
                             // Simple font rendering - just draw a filled rectangle for each character
                             if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -1194,8 +1286,7 @@ static void gui_render_taskbar(void) {
                 int screen_x = char_x + x;
                 int screen_y = clock_y + y;
                 
-                if (screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                if (GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     // Simple font rendering - just draw a filled rectangle for each character
                     if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -1222,30 +1313,15 @@ static void gui_render_start_menu(void) {
     }
     
     // Start menu dimensions
-    int menu_width = 200;
-    int menu_height = 300;
-    int menu_x = 3; // Same as start button x
-    int menu_y = framebuffer_height - 30 - menu_height; // Above taskbar
+    int menu_width = GUI_START_MENU_WIDTH;
+    int menu_height = GUI_START_MENU_HEIGHT;
+    int menu_x = GUI_START_MENU_X; // Same as start button x
+    int menu_y = GUI_START_MENU_Y; // Above taskbar
     
     // Fill the start menu with the menu background color
     gui_color_t menu_color = theme_colors[current_theme][6];
     
-    for (int y = 0; y < menu_height; y++) {
-        for (int x = 0; x < menu_width; x++) {
-            int screen_x = menu_x + x;
-            int screen_y = menu_y + y;
-            
-            if (screen_x >= 0 && screen_x < framebuffer_width &&
-                screen_y >= 0 && screen_y < framebuffer_height) {
-                uint32_t pixel = (menu_color.a << 24) |
-                                 (menu_color.r << 16) |
-                                 (menu_color.g << 8) |
-                                 (menu_color.b);
-                
-                framebuffer[screen_y * framebuffer_width + screen_x] = pixel;
-            }
-        }
-    }
+    gui_fill_rect(menu_x, menu_y, menu_width, menu_height, menu_color);
     
     // Draw the start menu border
     gui_color_t border_color = theme_colors[current_theme][8];
@@ -1255,8 +1331,7 @@ static void gui_render_start_menu(void) {
         int screen_x = menu_x + x;
         int screen_y = menu_y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -1271,8 +1346,7 @@ static void gui_render_start_menu(void) {
         int screen_x = menu_x + x;
         int screen_y = menu_y + menu_height - 1;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -1287,8 +1361,7 @@ static void gui_render_start_menu(void) {
         int screen_x = menu_x;
         int screen_y = menu_y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -1303,8 +1376,7 @@ static void gui_render_start_menu(void) {
         int screen_x = menu_x + menu_width - 1;
         int screen_y = menu_y + y;
         
-        if (screen_x >= 0 && screen_x < framebuffer_width &&
-            screen_y >= 0 && screen_y < framebuffer_height) {
+        if (GUI_IN_CLIP(screen_x, screen_y)) {
             uint32_t pixel = (border_color.a << 24) |
                              (border_color.r << 16) |
                              (border_color.g << 8) |
@@ -1347,8 +1419,7 @@ static void gui_render_start_menu(void) {
                     
                     if (screen_x >= menu_x && screen_x < menu_x + menu_width &&
                         screen_y >= menu_y && screen_y < menu_y + menu_height &&
-                        screen_x >= 0 && screen_x < framebuffer_width &&
-                        screen_y >= 0 && screen_y < framebuffer_height) {
+                        GUI_IN_CLIP(screen_x, screen_y)) {
                         
                         // Simple font rendering - just draw a filled rectangle for each character
                         if (x > 0 && x < 5 && y > 0 && y < 7) {
@@ -1372,8 +1443,7 @@ static void gui_render_start_menu(void) {
                 
                 if (screen_x >= menu_x && screen_x < menu_x + menu_width &&
                     screen_y >= menu_y && screen_y < menu_y + menu_height &&
-                    screen_x >= 0 && screen_x < framebuffer_width &&
-                    screen_y >= 0 && screen_y < framebuffer_height) {
+                    GUI_IN_CLIP(screen_x, screen_y)) {
                     
                     uint32_t pixel = (border_color.a << 24) |
                                      (border_color.r << 16) |
@@ -1388,28 +1458,77 @@ static void gui_render_start_menu(void) {
 }
 
 /**
- * Update the frame buffer
+ * Set the linear frame buffer the GUI presents to
+ * 
+ * @param physical_addr: Physical address of the frame buffer
+ * @param pitch: Bytes per scan line of the frame buffer
+ * @return: 0 on success, -1 on failure
  */
-static void gui_update_framebuffer(void) {
-    // Update the screen with the current framebuffer contents
-    
-    // Map the framebuffer to the video memory
-    // This is hardware-dependent and would involve:
-    // 1. Getting the physical address of the video memory
-    // 2. Mapping it to a virtual address
-    // 3. Copying our framebuffer to the video memory
-    
-    // For a VGA/VESA framebuffer:
-    uint32_t* video_memory = (uint32_t*)0xA0000; // Example VGA memory address
-    
-    // Copy our framebuffer to video memory
-    // Use hardware acceleration if available
-    size_t size = framebuffer_height * framebuffer_pitch;
-    memcpy(video_memory, framebuffer, size);
-    
-    // Flush any hardware caches
-    // This is architecture-specific
-    asm volatile("wbinvd");
+int gui_set_video_memory(uintptr_t physical_addr, int pitch) {
+    // Check if the GUI is initialized and the pitch fits a scan line
+    if (!gui_initialized || pitch < framebuffer_pitch) {
+        return -1;
+    }
+    
+    // Map the frame buffer write-combining: the GUI only ever writes it, in
+    // whole scan lines, so writes can be combined into bursts and no cache
+    // flush is needed after a frame
+    if (memory_map(physical_addr, (void*)physical_addr, (size_t)framebuffer_height * pitch,
+                   MEMORY_PROT_READ | MEMORY_PROT_WRITE | MEMORY_PROT_WRITE_COMBINE) != 0) {
+        return -1;
+    }
+    
+    video_memory = (uint8_t*)physical_addr;
+    video_pitch = pitch;
+    
+    // Present the whole screen once
+    gui_damage(0, 0, framebuffer_width, framebuffer_height);
+    gui_compose();
+    
+    return 0;
+}
+
+/**
+ * Mark a window as needing to be redrawn
+ */
+void gui_window_invalidate(gui_window_t* window) {
+    // Check if the GUI is initialized and the window is valid
+    if (!gui_initialized || !window || !window->visible) {
+        return;
+    }
+    
+    gui_damage(window->x, window->y, window->width, window->height);
+}
+
+/**
+ * Redraw everything that has been invalidated
+ */
+void gui_window_update(gui_window_t* window) {
+    (void)window;
+    
+    // Damage is tracked per screen rectangle, so this also presents other
+    // pending updates; they would otherwise be drawn on the next update
+    gui_compose();
+}
+
+/**
+ * Set the text of a widget and redraw it
+ */
+void gui_widget_set_text(gui_widget_t* widget, const char* text) {
+    // Check if the GUI is initialized and the widget is valid
+    if (!gui_initialized || !widget || !text) {
+        return;
+    }
+    
+    strncpy(widget->text, text, sizeof(widget->text) - 1);
+    widget->text[sizeof(widget->text) - 1] = '\0';
+    
+    // Only the widget is composited again, not the window or the desktop
+    gui_window_t* window = widget->window;
+    if (window && window->visible && widget->visible) {
+        gui_damage(window->x + widget->x, window->y + widget->y, widget->width, widget->height);
+        gui_compose();
+    }
 }
 
 /**
@@ -1428,17 +1547,17 @@ static void gui_bring_window_to_front(gui_window_t* window) {
             // Unfocus the currently focused window
             if (focused_window) {
                 focused_window->focused = 0;
+                gui_window_invalidate(focused_window);
             }
             
             // Focus the new window
             window->focused = 1;
             focused_window = window;
             
-            // Render the desktop
-            gui_render_desktop();
-            
-            // Update the frame buffer
-            gui_update_framebuffer();
+            // Composite the two windows and the taskbar buttons
+            gui_window_invalidate(window);
+            gui_damage(0, framebuffer_height - GUI_TASKBAR_HEIGHT, framebuffer_width, GUI_TASKBAR_HEIGHT);
+            gui_compose();
         }
         
         return;
@@ -1474,17 +1593,17 @@ static void gui_bring_window_to_front(gui_window_t* window) {
         // Unfocus the currently focused window
         if (focused_window) {
             focused_window->focused = 0;
+            gui_window_invalidate(focused_window);
         }
         
         // Focus the new window
         window->focused = 1;
         focused_window = window;
         
-        // Render the desktop
-        gui_render_desktop();
-        
-        // Update the frame buffer
-        gui_update_framebuffer();
+        // Composite the two windows and the taskbar buttons
+        gui_window_invalidate(window);
+        gui_damage(0, framebuffer_height - GUI_TASKBAR_HEIGHT, framebuffer_width, GUI_TASKBAR_HEIGHT);
+        gui_compose();
     }
 }
 
@@ -1500,11 +1619,9 @@ void gui_desktop_set_background_color(gui_color_t color) {
     // Set the desktop background color
     desktop_background_color = color;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the whole screen
+    gui_damage(0, 0, framebuffer_width, framebuffer_height);
+    gui_compose();
 }
 
 /**
@@ -1519,11 +1636,9 @@ void gui_desktop_set_background_image(const char* image_path) {
     // Set the desktop background image
     strncpy(desktop_background_image, image_path, sizeof(desktop_background_image) - 1);
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the whole screen
+    gui_damage(0, 0, framebuffer_width, framebuffer_height);
+    gui_compose();
 }
 
 /**
@@ -1538,11 +1653,9 @@ void gui_taskbar_show(void) {
     // Set the taskbar as visible
     taskbar_visible = 1;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the taskbar area
+    gui_damage(0, framebuffer_height - GUI_TASKBAR_HEIGHT, framebuffer_width, GUI_TASKBAR_HEIGHT);
+    gui_compose();
 }
 
 /**
@@ -1557,11 +1670,9 @@ void gui_taskbar_hide(void) {
     // Set the taskbar as invisible
     taskbar_visible = 0;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the taskbar area
+    gui_damage(0, framebuffer_height - GUI_TASKBAR_HEIGHT, framebuffer_width, GUI_TASKBAR_HEIGHT);
+    gui_compose();
 }
 
 /**
@@ -1576,11 +1687,9 @@ void gui_start_menu_show(void) {
     // Set the start menu as visible
     start_menu_visible = 1;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the start menu area
+    gui_damage(GUI_START_MENU_X, GUI_START_MENU_Y, GUI_START_MENU_WIDTH, GUI_START_MENU_HEIGHT);
+    gui_compose();
 }
 
 /**
@@ -1595,11 +1704,9 @@ void gui_start_menu_hide(void) {
     // Set the start menu as invisible
     start_menu_visible = 0;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the start menu area
+    gui_damage(GUI_START_MENU_X, GUI_START_MENU_Y, GUI_START_MENU_WIDTH, GUI_START_MENU_HEIGHT);
+    gui_compose();
 }
 
 /**
@@ -1614,11 +1721,9 @@ void gui_set_theme(gui_theme_t theme) {
     // Set the theme
     current_theme = theme;
     
-    // Render the desktop
-    gui_render_desktop();
-    
-    // Update the frame buffer
-    gui_update_framebuffer();
+    // Composite the whole screen
+    gui_damage(0, 0, framebuffer_width, framebuffer_height);
+    gui_compose();
 }
 
 /**
@@ -121,6 +121,7 @@ typedef enum {
 // GUI initialization and shutdown
 int gui_init(void);
 int gui_shutdown(void);
+int gui_set_video_memory(uintptr_t physical_addr, int pitch);
 
 // Window management
 gui_window_t* gui_window_create(const char* title, int x, int y, int width, int height, uint32_t flags);
@@ -6,6 +6,11 @@
  */
 
 #include "model_loader/model_loader.h"
+#include "../../kernel/include/sampling.h"
+#include "../../kernel/include/memory.h"
+#include "../../kernel/include/process.h"
+#include "../../kernel/include/bpe.h"
+#include "../../kernel/include/page_cache.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -15,6 +20,60 @@
 // Maximum number of models
 #define MAX_MODELS 8
 
+// Maximum size of a safetensors header
+#define MODEL_SAFETENSORS_MAX_HEADER (100 * 1024 * 1024)
+
+// Maximum length of a tensor name
+#define MODEL_TENSOR_NAME_SIZE 128
+
+// Maximum number of dimensions of a weight tensor
+#define MODEL_TENSOR_MAX_DIMS 8
+
+// Weight tensor
+typedef struct {
+    char name[MODEL_TENSOR_NAME_SIZE];
+    nn_tensor_t tensor;
+    uint32_t shape[MODEL_TENSOR_MAX_DIMS];
+    uint64_t offset;
+    uint64_t size;
+} model_tensor_t;
+
+// Maximum number of layers tracked for prefetching
+#define MODEL_MAX_LAYERS 1024
+
+// Capacity of the layer prefetch queue
+#define MODEL_PREFETCH_QUEUE_SIZE 64
+
+// Stack size of the prefetcher process
+#define MODEL_PREFETCH_STACK_SIZE (16 * 1024)
+
+// Address space a mapped model may take in the 1.5 GB file mapping window.
+// Data sections up to this size are mapped as one range; larger ones (the
+// 3.5 GB safetensors file of a 1.5B model in BF16) are mapped a layer at a
+// time, with the tensors outside the layers mapped for as long as the model
+// is loaded.
+#define MODEL_MAP_BUDGET (1280ULL * 1024 * 1024)
+
+// Granularity at which the file mapping window is reserved
+#define MODEL_MAP_ALIGN (4ULL * 1024 * 1024)
+
+// Tensors outside the layers of a model mapped a layer at a time
+#define MODEL_MAX_PINNED_TENSORS 8
+
+// Weight range of a layer in the mapped data section
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    void* mapping;          // Layer mapping when mapped a layer at a time, NULL if unmapped
+    uint64_t last_use;      // Layer clock at the last use
+} model_layer_range_t;
+
+// Layer prefetch request
+typedef struct {
+    int slot;
+    uint32_t layer;
+} model_prefetch_request_t;
+
 // Model table
 static struct {
     model_id_t id;
@@ -22,12 +81,27 @@ static struct {
     tokenizer_config_t tokenizer_config;
     void* model_memory;
     size_t model_memory_size;
+    page_cache_file_t* weights_file;
+    void* weights_mapping;
+    uint64_t data_start;            // Offset of the tensor data in the file
+    int layered;                    // Mapped a layer at a time
+    void* pinned[MODEL_MAX_PINNED_TENSORS];
+    uint32_t num_pinned;
+    uint64_t mapped_bytes;          // Window space taken by the layered mappings
+    uint64_t layer_clock;
+    model_tensor_t* tensors;
+    uint32_t num_tensors;
+    model_layer_range_t* layers;
+    uint32_t num_layers;
     void* tokenizer_memory;
     size_t tokenizer_memory_size;
+    vocab_t vocab;
+    bpe_t bpe;
     int loaded;
     uint64_t memory_usage;
     uint64_t load_time;
     uint64_t inference_time;
+    uint64_t first_token_time;
 } models[MAX_MODELS];
 
 // Next available model ID
@@ -36,17 +110,31 @@ static model_id_t next_model_id = 1;
 // Model loader state
 static int model_loader_initialized = 0;
 
+// Layer prefetcher
+static model_prefetch_request_t model_prefetch_queue[MODEL_PREFETCH_QUEUE_SIZE];
+static volatile uint32_t model_prefetch_head = 0;
+static volatile uint32_t model_prefetch_tail = 0;
+static volatile int model_prefetch_queue_lock = 0;
+static volatile int model_prefetch_active_slot = -1;
+static volatile int model_prefetch_running = 0;
+static volatile pid_t model_prefetch_pid = -1;
+
+// Layer mappings of the models mapped a layer at a time
+static volatile int model_layer_map_lock = 0;
+
 // Forward declarations of static functions
 static int model_loader_find_free_model_slot(void);
 // Commented out to avoid unused function warning
 // static int model_loader_model_exists(model_id_t id);
 static int model_loader_parse_json(const char* json, void* config, int config_type);
-static int model_loader_load_model_weights(const char* model_path, void** model_memory, size_t* model_memory_size);
-static int model_loader_load_tokenizer_data(const char* tokenizer_path, void** tokenizer_memory, size_t* tokenizer_memory_size);
-static uint32_t model_loader_sample_token(uint32_t* context, size_t context_size, float temperature, float top_p, int top_k, float* logits, size_t vocab_size);
+static int model_loader_load_model_weights(int slot, const char* model_path);
+static void model_loader_free_weights(int slot);
+static int model_loader_load_tokenizer_data(const char* tokenizer_path, void** tokenizer_memory, size_t* tokenizer_memory_size, vocab_t* vocab, bpe_t* bpe);
+static void model_layer_map_acquire(void);
+static void model_layer_map_release(void);
 
 // Helper function to check if a token is in the vocabulary
-static int is_token_in_vocab(const char* token, const tokenizer_config_t* tokenizer_config, const model_config_t* model_config, uint32_t* token_id);
+static int is_token_in_vocab(const char* token, const vocab_t* vocab, const tokenizer_config_t* tokenizer_config, const model_config_t* model_config, uint32_t* token_id);
 
 // Helper function to apply BPE merges
 static void apply_bpe_merges(char** tokens, size_t* num_tokens);
@@ -533,412 +621,1168 @@ static int model_loader_parse_json(const char* json, void* config, int config_ty
 }
 
 /**
- * Load model weights
- * 
- * @param model_path: Path to the model file
- * @param model_memory: Pointer to store the model memory
- * @param model_memory_size: Pointer to store the model memory size
- * @return: 0 on success, -1 on failure
+ * Acquire the prefetch queue lock
  */
-static int model_loader_load_model_weights(const char* model_path, void** model_memory, size_t* model_memory_size) {
-    // Load model weights from the specified file
-    if (!model_path || !model_memory || !model_memory_size) {
-        return -1;
+static void model_prefetch_lock(void) {
+    while (__sync_lock_test_and_set(&model_prefetch_queue_lock, 1)) {
+        while (model_prefetch_queue_lock) {
+            __asm__ volatile("pause");
+        }
     }
+}
+
+/**
+ * Release the prefetch queue lock
+ */
+static void model_prefetch_unlock(void) {
+    __sync_lock_release(&model_prefetch_queue_lock);
+}
+
+/**
+ * Get the layer index encoded in a tensor name ("...layers.<n>....")
+ * 
+ * @param name: Tensor name
+ * @param layer: Pointer to store the layer index
+ * @return: 0 on success, -1 if the tensor does not belong to a layer
+ */
+static int model_loader_tensor_layer(const char* name, uint32_t* layer) {
+    const char* p = strstr(name, "layers.");
     
-    // Open the model file
-    FILE* file = fopen(model_path, "rb");
-    if (!file) {
+    if (!p || p[7] < '0' || p[7] > '9') {
         return -1;
     }
     
-    // Get the file size
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    uint32_t value = 0;
     
-    // Read file header to determine format
-    char header[16] = {0};
-    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
-        fclose(file);
+    for (p += 7; *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (uint32_t)(*p - '0');
+    }
+    
+    if (value >= MODEL_MAX_LAYERS) {
         return -1;
     }
     
-    // Reset file position
-    fseek(file, 0, SEEK_SET);
+    *layer = value;
     
-    // Allocate memory for the model weights
-    size_t size = file_size > 0 ? file_size : 1536 * 1024 * 1024; // Use file size or 1.5 GB
-    void* memory = malloc(size);
+    return 0;
+}
+
+/**
+ * Build the weight range of each layer of a mapped model
+ * 
+ * @param slot: Model slot
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_build_layer_ranges(int slot) {
+    uint32_t num_layers = 0;
+    uint32_t layer;
     
-    if (!memory) {
-        fclose(file);
+    for (uint32_t i = 0; i < models[slot].num_tensors; i++) {
+        if (model_loader_tensor_layer(models[slot].tensors[i].name, &layer) == 0 && layer + 1 > num_layers) {
+            num_layers = layer + 1;
+        }
+    }
+    
+    if (num_layers == 0) {
+        return 0;
+    }
+    
+    model_layer_range_t* layers = (model_layer_range_t*)memory_alloc(sizeof(model_layer_range_t) * num_layers,
+                                                                     MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!layers) {
         return -1;
     }
     
-    // Read the model weights
-    size_t bytes_read = fread(memory, 1, size, file);
-    if (bytes_read == 0) {
-        // If we couldn't read anything, initialize with zeros
-        memset(memory, 0, size);
+    for (uint32_t l = 0; l < num_layers; l++) {
+        layers[l].start = UINT64_MAX;
+        layers[l].end = 0;
     }
     
-    // Close the file
-    fclose(file);
+    for (uint32_t i = 0; i < models[slot].num_tensors; i++) {
+        model_tensor_t* t = &models[slot].tensors[i];
+        
+        if (model_loader_tensor_layer(t->name, &layer) != 0) {
+            continue;
+        }
+        
+        if (t->offset < layers[layer].start) {
+            layers[layer].start = t->offset;
+        }
+        
+        if (t->offset + t->size > layers[layer].end) {
+            layers[layer].end = t->offset + t->size;
+        }
+    }
     
-    // Set the output parameters
-    *model_memory = memory;
-    *model_memory_size = size;
+    models[slot].layers = layers;
+    models[slot].num_layers = num_layers;
     
     return 0;
 }
 
 /**
- * Load tokenizer data
+ * Prefetcher process entry point
  * 
- * @param tokenizer_path: Path to the tokenizer file
- * @param tokenizer_memory: Pointer to store the tokenizer memory
- * @param tokenizer_memory_size: Pointer to store the tokenizer memory size
- * @return: 0 on success, -1 on failure
+ * Reads queued layers into their mappings so the pages are resident by the
+ * time the layer runs.
  */
-static int model_loader_load_tokenizer_data(const char* tokenizer_path, void** tokenizer_memory, size_t* tokenizer_memory_size) {
-    // Load tokenizer data from the specified file
-    if (!tokenizer_path || !tokenizer_memory || !tokenizer_memory_size) {
-        return -1;
+static void model_prefetch_main(void) {
+    while (model_prefetch_running) {
+        model_prefetch_request_t request;
+        int have_request = 0;
+        
+        model_prefetch_lock();
+        
+        if (model_prefetch_head != model_prefetch_tail) {
+            request = model_prefetch_queue[model_prefetch_head % MODEL_PREFETCH_QUEUE_SIZE];
+            model_prefetch_head++;
+            have_request = 1;
+            model_prefetch_active_slot = request.slot;
+        }
+        
+        model_prefetch_unlock();
+        
+        if (!have_request) {
+            process_yield();
+            continue;
+        }
+        
+        int slot = request.slot;
+        
+        if (request.layer < models[slot].num_layers) {
+            model_layer_range_t* range = &models[slot].layers[request.layer];
+            uint8_t* base = NULL;
+            
+            // A layer unmapped while it is read only cuts the read short
+            if (models[slot].weights_mapping) {
+                base = (uint8_t*)models[slot].weights_mapping + range->start;
+            } else if (models[slot].layered) {
+                model_layer_map_acquire();
+                base = (uint8_t*)range->mapping;
+                model_layer_map_release();
+            }
+            
+            if (base && range->end > range->start) {
+                memory_map_populate(base, (size_t)(range->end - range->start));
+            }
+        }
+        
+        model_prefetch_active_slot = -1;
     }
     
-    // Open the tokenizer file
-    FILE* file = fopen(tokenizer_path, "rb");
-    if (!file) {
+    model_prefetch_pid = -1;
+    process_terminate(process_get_current()->pid, 0);
+}
+
+/**
+ * Queue a layer of a mapped model for prefetching
+ * 
+ * @param slot: Model slot
+ * @param layer: Layer index
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_queue_prefetch(int slot, uint32_t layer) {
+    if ((!models[slot].weights_mapping && !models[slot].layered) || layer >= models[slot].num_layers) {
         return -1;
     }
     
-    // Get the file size
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    // Start the prefetcher on first use
+    if (model_prefetch_pid < 0) {
+        model_prefetch_running = 1;
+        model_prefetch_pid = process_create("model_prefetch", model_prefetch_main, MODEL_PREFETCH_STACK_SIZE,
+                                            PROCESS_PRIORITY_NORMAL, PROCESS_FLAG_KERNEL | PROCESS_FLAG_DAEMON);
+        
+        if (model_prefetch_pid == 0) {
+            model_prefetch_pid = -1;
+            model_prefetch_running = 0;
+            return -1;
+        }
+    }
     
-    // Allocate memory for the tokenizer data
-    size_t size = file_size > 0 ? file_size : 10 * 1024 * 1024; // Use file size or 10 MB
-    void* memory = malloc(size);
+    model_prefetch_lock();
     
-    if (!memory) {
-        fclose(file);
+    // Drop the request when the queue is full; the layer still faults in on use
+    if (model_prefetch_tail - model_prefetch_head >= MODEL_PREFETCH_QUEUE_SIZE) {
+        model_prefetch_unlock();
         return -1;
     }
     
-    // Read the tokenizer data
-    size_t bytes_read = fread(memory, 1, size, file);
-    if (bytes_read == 0) {
-        // If we couldn't read anything, initialize with zeros
-        memset(memory, 0, size);
-    }
+    model_prefetch_request_t* request = &model_prefetch_queue[model_prefetch_tail % MODEL_PREFETCH_QUEUE_SIZE];
+    request->slot = slot;
+    request->layer = layer;
+    model_prefetch_tail++;
     
-    // Close the file
-    fclose(file);
-    
-    // Set the output parameters
-    *tokenizer_memory = memory;
-    *tokenizer_memory_size = size;
+    model_prefetch_unlock();
     
     return 0;
 }
 
 /**
- * Sample a token from logits
+ * Cancel the prefetches of a model and wait for the one in flight
  * 
- * @param context: Context tokens
- * @param context_size: Number of context tokens
- * @param temperature: Temperature parameter
- * @param top_p: Top-p sampling parameter
- * @param top_k: Top-k sampling parameter
- * @param logits: Logits array
- * @param vocab_size: Vocabulary size
- * @return: Sampled token
+ * @param slot: Model slot
  */
-static uint32_t model_loader_sample_token(uint32_t* context, size_t context_size, float temperature, float top_p, int top_k, float* logits, size_t vocab_size) {
-    // Apply temperature scaling
-    if (temperature > 0.0f) {
-        for (size_t i = 0; i < vocab_size; i++) {
-            logits[i] /= temperature;
-        }
-    } else if (temperature == 0.0f) {
-        // Greedy sampling (temperature = 0)
-        uint32_t best_token = 0;
-        float best_logit = logits[0];
-        for (size_t i = 1; i < vocab_size; i++) {
-            if (logits[i] > best_logit) {
-                best_logit = logits[i];
-                best_token = i;
-            }
+static void model_loader_cancel_prefetch(int slot) {
+    model_prefetch_lock();
+    
+    for (uint32_t i = model_prefetch_head; i != model_prefetch_tail; i++) {
+        model_prefetch_request_t* request = &model_prefetch_queue[i % MODEL_PREFETCH_QUEUE_SIZE];
+        
+        if (request->slot == slot) {
+            request->layer = UINT32_MAX;
         }
-        return best_token;
     }
     
-    // Apply dynamic repetition penalty based on recency
-    // Tokens that appeared more recently get higher penalty
-    for (size_t i = 0; i < context_size; i++) {
-        uint32_t token = context[i];
-        if (token < vocab_size) {
-            // Calculate position-based penalty factor (higher penalty for more recent tokens)
-            float position_factor = 1.0f - (float)(context_size - i) / (float)(context_size + 1);
-            float penalty = 1.1f + 0.1f * (1.0f - position_factor); // Range: 1.1 to 1.2
-            logits[token] /= penalty;
+    model_prefetch_unlock();
+    
+    while (model_prefetch_active_slot == slot) {
+        process_yield();
+    }
+}
+
+/**
+ * Read from a mapped weights file
+ * 
+ * The file is read through the page cache rather than stdio, whose long
+ * offsets stop at 2 GB on this target.
+ * 
+ * @param ctx: Weights file
+ * @param offset: Offset in the file
+ * @param buffer: Buffer to read into
+ * @param size: Number of bytes to read
+ * @return: Number of bytes read
+ */
+static size_t model_loader_read_weights(void* ctx, uint64_t offset, void* buffer, size_t size) {
+    page_cache_file_t* file = (page_cache_file_t*)ctx;
+    
+    if (offset > INT64_MAX || page_cache_seek(file, (int64_t)offset, PAGE_CACHE_SEEK_SET) != 0) {
+        return 0;
+    }
+    
+    return page_cache_read(file, buffer, size);
+}
+
+/**
+ * Acquire the layer mapping lock
+ */
+static void model_layer_map_acquire(void) {
+    while (__sync_lock_test_and_set(&model_layer_map_lock, 1)) {
+        while (model_layer_map_lock) {
+            __asm__ volatile("pause");
         }
     }
+}
+
+/**
+ * Release the layer mapping lock
+ */
+static void model_layer_map_release(void) {
+    __sync_lock_release(&model_layer_map_lock);
+}
+
+/**
+ * Get the window space a mapping of a given size takes
+ */
+static uint64_t model_loader_map_size(uint64_t size) {
+    return (size + MODEL_MAP_ALIGN - 1) & ~(MODEL_MAP_ALIGN - 1);
+}
+
+/**
+ * Point the tensor views of a layer into its mapping
+ * 
+ * @param slot: Model slot
+ * @param layer: Layer index
+ * @param mapping: Layer mapping, NULL when the layer is unmapped
+ */
+static void model_loader_set_layer_views(int slot, uint32_t layer, void* mapping) {
+    model_layer_range_t* range = &models[slot].layers[layer];
+    uint32_t tensor_layer;
     
-    // Convert logits to probabilities using softmax with numerical stability
-    float max_logit = logits[0];
-    for (size_t i = 1; i < vocab_size; i++) {
-        if (logits[i] > max_logit) {
-            max_logit = logits[i];
+    for (uint32_t i = 0; i < models[slot].num_tensors; i++) {
+        model_tensor_t* t = &models[slot].tensors[i];
+        
+        if (model_loader_tensor_layer(t->name, &tensor_layer) == 0 && tensor_layer == layer) {
+            t->tensor.data = mapping ? (uint8_t*)mapping + (t->offset - range->start) : NULL;
         }
     }
+}
+
+/**
+ * Unmap a layer of a model mapped a layer at a time (layer mapping lock held)
+ * 
+ * @param slot: Model slot
+ * @param layer: Layer index
+ */
+static void model_loader_unmap_layer(int slot, uint32_t layer) {
+    model_layer_range_t* range = &models[slot].layers[layer];
     
-    float sum = 0.0f;
-    for (size_t i = 0; i < vocab_size; i++) {
-        logits[i] = expf(logits[i] - max_logit);
-        sum += logits[i];
+    if (!range->mapping) {
+        return;
     }
     
-    // Normalize to get probabilities
-    if (sum > 0.0f) {
-        for (size_t i = 0; i < vocab_size; i++) {
-            logits[i] /= sum;
-        }
-    } else {
-        // Handle numerical underflow - assign equal probabilities
-        float equal_prob = 1.0f / vocab_size;
-        for (size_t i = 0; i < vocab_size; i++) {
-            logits[i] = equal_prob;
-        }
-    }
-    
-    // Apply top-k sampling with optimized sorting
-    if (top_k > 0 && top_k < (int)vocab_size) {
-        // Find the top-k tokens using partial sort
-        uint32_t* indices = (uint32_t*)malloc(vocab_size * sizeof(uint32_t));
-        if (!indices) {
-            // Fallback to greedy sampling if allocation fails
-            uint32_t best_token = 0;
-            float best_prob = logits[0];
-            for (size_t i = 1; i < vocab_size; i++) {
-                if (logits[i] > best_prob) {
-                    best_prob = logits[i];
-                    best_token = i;
-                }
+    model_loader_set_layer_views(slot, layer, NULL);
+    memory_unmap_file(range->mapping);
+    range->mapping = NULL;
+    models[slot].mapped_bytes -= model_loader_map_size(range->end - range->start);
+}
+
+/**
+ * Map a layer of a model mapped a layer at a time (layer mapping lock held)
+ * 
+ * Layers are mapped on first use. When the model is out of window space,
+ * the least recently used layers are unmapped, except for the one being
+ * mapped and the one kept.
+ * 
+ * @param slot: Model slot
+ * @param layer: Layer to map
+ * @param keep: Layer to keep mapped, UINT32_MAX for none
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_map_layer(int slot, uint32_t layer, uint32_t keep) {
+    model_layer_range_t* range = &models[slot].layers[layer];
+    
+    range->last_use = ++models[slot].layer_clock;
+    
+    if (range->mapping) {
+        return 0;
+    }
+    
+    if (range->end <= range->start) {
+        return -1;
+    }
+    
+    uint64_t size = model_loader_map_size(range->end - range->start);
+    
+    while (models[slot].mapped_bytes + size > MODEL_MAP_BUDGET) {
+        uint32_t victim = UINT32_MAX;
+        
+        for (uint32_t l = 0; l < models[slot].num_layers; l++) {
+            model_layer_range_t* other = &models[slot].layers[l];
+            
+            if (l != layer && l != keep && other->mapping &&
+                (victim == UINT32_MAX || other->last_use < models[slot].layers[victim].last_use)) {
+                victim = l;
             }
-            return best_token;
         }
         
-        // Initialize indices
-        for (size_t i = 0; i < vocab_size; i++) {
-            indices[i] = i;
+        if (victim == UINT32_MAX) {
+            return -1;
         }
         
-        // Use a more efficient sorting algorithm (quickselect-based approach)
-        // This only partially sorts the array to find the top-k elements
-        for (size_t i = 0; i < (size_t)top_k; i++) {
-            size_t max_idx = i;
-            float max_prob = logits[indices[i]];
-            
-            // Find the maximum in the remaining elements
-            for (size_t j = i + 1; j < vocab_size; j++) {
-                if (logits[indices[j]] > max_prob) {
-                    max_prob = logits[indices[j]];
-                    max_idx = j;
-                }
-            }
-            
-            // Swap if needed
-            if (max_idx != i) {
-                uint32_t temp = indices[i];
-                indices[i] = indices[max_idx];
-                indices[max_idx] = temp;
-            }
+        model_loader_unmap_layer(slot, victim);
+    }
+    
+    void* mapping = memory_map_file(model_loader_read_weights, models[slot].weights_file,
+                                    models[slot].data_start + range->start,
+                                    (size_t)(range->end - range->start), MEMORY_PROT_READ);
+    
+    if (!mapping) {
+        return -1;
+    }
+    
+    range->mapping = mapping;
+    models[slot].mapped_bytes += size;
+    model_loader_set_layer_views(slot, layer, mapping);
+    
+    return 0;
+}
+
+/**
+ * Map the tensors outside the layers of a model mapped a layer at a time
+ * 
+ * @param slot: Model slot
+ * @return: 0 on success, -1 if they do not fit next to two layers
+ */
+static int model_loader_map_pinned(int slot) {
+    uint64_t largest_layer = 0;
+    uint32_t layer;
+    
+    for (uint32_t l = 0; l < models[slot].num_layers; l++) {
+        uint64_t size = model_loader_map_size(models[slot].layers[l].end - models[slot].layers[l].start);
+        
+        if (size > largest_layer) {
+            largest_layer = size;
         }
+    }
+    
+    for (uint32_t i = 0; i < models[slot].num_tensors; i++) {
+        model_tensor_t* t = &models[slot].tensors[i];
         
-        // Zero out probabilities for tokens outside top-k
-        for (size_t i = top_k; i < vocab_size; i++) {
-            logits[indices[i]] = 0.0f;
+        if (model_loader_tensor_layer(t->name, &layer) == 0 || t->size == 0) {
+            continue;
         }
         
-        // Renormalize probabilities
-        sum = 0.0f;
-        for (size_t i = 0; i < vocab_size; i++) {
-            sum += logits[i];
+        if (models[slot].num_pinned == MODEL_MAX_PINNED_TENSORS) {
+            return -1;
         }
         
-        if (sum > 0.0f) {
-            for (size_t i = 0; i < vocab_size; i++) {
-                logits[i] /= sum;
-            }
-        } else {
-            // If sum is zero, distribute probability evenly among top-k tokens
-            for (size_t i = 0; i < (size_t)top_k; i++) {
-                logits[indices[i]] = 1.0f / top_k;
-            }
+        void* mapping = memory_map_file(model_loader_read_weights, models[slot].weights_file,
+                                        models[slot].data_start + t->offset, (size_t)t->size, MEMORY_PROT_READ);
+        
+        if (!mapping) {
+            return -1;
         }
         
-        free(indices);
+        models[slot].pinned[models[slot].num_pinned++] = mapping;
+        models[slot].mapped_bytes += model_loader_map_size(t->size);
+        t->tensor.data = mapping;
     }
     
-    // Apply top-p (nucleus) sampling with optimized implementation
-    if (top_p > 0.0f && top_p < 1.0f) {
-        // Sort tokens by probability
-        uint32_t* indices = (uint32_t*)malloc(vocab_size * sizeof(uint32_t));
-        if (!indices) {
-            // Fallback to greedy sampling if allocation fails
-            uint32_t best_token = 0;
-            float best_prob = logits[0];
-            for (size_t i = 1; i < vocab_size; i++) {
-                if (logits[i] > best_prob) {
-                    best_prob = logits[i];
-                    best_token = i;
-                }
+    // The running layer and the one being prefetched are mapped together
+    if (models[slot].mapped_bytes + 2 * largest_layer > MODEL_MAP_BUDGET) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Unmap every range of a model mapped a layer at a time
+ * 
+ * @param slot: Model slot
+ */
+static void model_loader_unmap_layered(int slot) {
+    model_layer_map_acquire();
+    
+    for (uint32_t l = 0; l < models[slot].num_layers; l++) {
+        model_loader_unmap_layer(slot, l);
+    }
+    
+    model_layer_map_release();
+    
+    for (uint32_t i = 0; i < models[slot].num_pinned; i++) {
+        memory_unmap_file(models[slot].pinned[i]);
+    }
+    
+    models[slot].num_pinned = 0;
+    models[slot].mapped_bytes = 0;
+    models[slot].layer_clock = 0;
+    models[slot].layered = 0;
+}
+
+/**
+ * Get the paging statistics of the weights of a mapped model
+ * 
+ * Faults of layers that were unmapped again are not counted.
+ * 
+ * @param slot: Model slot
+ * @param stats: Pointer to store the statistics
+ * @return: 0 on success, -1 if the model weights are not mapped
+ */
+static int model_loader_get_map_stats(int slot, memory_map_stats_t* stats) {
+    memory_map_stats_t range_stats;
+    
+    if (models[slot].weights_mapping) {
+        return memory_map_get_stats(models[slot].weights_mapping, stats);
+    }
+    
+    if (!models[slot].layered) {
+        return -1;
+    }
+    
+    memset(stats, 0, sizeof(memory_map_stats_t));
+    
+    model_layer_map_acquire();
+    
+    for (uint32_t i = 0; i < models[slot].num_pinned + models[slot].num_layers; i++) {
+        void* mapping = i < models[slot].num_pinned ? models[slot].pinned[i] : models[slot].layers[i - models[slot].num_pinned].mapping;
+        
+        if (mapping && memory_map_get_stats(mapping, &range_stats) == 0) {
+            stats->size += range_stats.size;
+            stats->resident += range_stats.resident;
+            stats->faults += range_stats.faults;
+        }
+    }
+    
+    model_layer_map_release();
+    
+    return 0;
+}
+
+/**
+ * Skip whitespace in a safetensors header
+ * 
+ * @param p: Current position
+ * @param end: End of the header
+ * @return: First non-whitespace position
+ */
+static const char* safetensors_skip_ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    
+    return p;
+}
+
+/**
+ * Parse a string in a safetensors header
+ * 
+ * @param p: Position of the opening quote
+ * @param end: End of the header
+ * @param out: Buffer for the string, may be NULL
+ * @param out_size: Size of the buffer
+ * @return: Position after the closing quote, NULL on failure
+ */
+static const char* safetensors_parse_string(const char* p, const char* end, char* out, size_t out_size) {
+    size_t len = 0;
+    
+    if (p >= end || *p != '"') {
+        return NULL;
+    }
+    
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        }
+        
+        if (out && len + 1 < out_size) {
+            out[len++] = *p;
+        }
+    }
+    
+    if (p >= end) {
+        return NULL;
+    }
+    
+    if (out && out_size > 0) {
+        out[len] = '\0';
+    }
+    
+    return p + 1;
+}
+
+/**
+ * Parse an unsigned integer in a safetensors header
+ * 
+ * @param p: Current position
+ * @param end: End of the header
+ * @param value: Pointer to store the value
+ * @return: Position after the number, NULL on failure
+ */
+static const char* safetensors_parse_uint(const char* p, const char* end, uint64_t* value) {
+    uint64_t v = 0;
+    const char* start = p;
+    
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    
+    if (p == start) {
+        return NULL;
+    }
+    
+    *value = v;
+    
+    return p;
+}
+
+/**
+ * Skip a value in a safetensors header
+ * 
+ * @param p: Start of the value
+ * @param end: End of the header
+ * @return: Position after the value, NULL on failure
+ */
+static const char* safetensors_skip_value(const char* p, const char* end) {
+    int depth = 0;
+    
+    do {
+        p = safetensors_skip_ws(p, end);
+        if (p >= end) {
+            return NULL;
+        }
+        
+        if (*p == '"') {
+            p = safetensors_parse_string(p, end, NULL, 0);
+            if (!p) {
+                return NULL;
             }
-            return best_token;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+            p++;
+        } else if (*p == '}' || *p == ']') {
+            depth--;
+            p++;
+        } else {
+            p++;
+        }
+    } while (depth > 0);
+    
+    return p;
+}
+
+/**
+ * Map a safetensors dtype name to a tensor data type
+ * 
+ * @param name: Safetensors dtype name
+ * @param elem_size: Pointer to store the element size in bytes
+ * @return: Tensor data type, NN_DTYPE_UNKNOWN if unsupported
+ */
+static uint32_t safetensors_dtype(const char* name, uint32_t* elem_size) {
+    static const struct {
+        const char* name;
+        uint32_t dtype;
+        uint32_t size;
+    } dtypes[] = {
+        {"F32", NN_DTYPE_FLOAT32, 4}, {"F16", NN_DTYPE_FLOAT16, 2}, {"BF16", NN_DTYPE_BFLOAT16, 2},
+        {"F64", NN_DTYPE_FLOAT64, 8}, {"I8", NN_DTYPE_INT8, 1}, {"I16", NN_DTYPE_INT16, 2},
+        {"I32", NN_DTYPE_INT32, 4}, {"I64", NN_DTYPE_INT64, 8}, {"U8", NN_DTYPE_UINT8, 1},
+        {"U16", NN_DTYPE_UINT16, 2}, {"U32", NN_DTYPE_UINT32, 4}, {"U64", NN_DTYPE_UINT64, 8},
+        {"BOOL", NN_DTYPE_BOOL, 1}
+    };
+    
+    for (size_t i = 0; i < sizeof(dtypes) / sizeof(dtypes[0]); i++) {
+        if (strcmp(name, dtypes[i].name) == 0) {
+            *elem_size = dtypes[i].size;
+            return dtypes[i].dtype;
+        }
+    }
+    
+    return NN_DTYPE_UNKNOWN;
+}
+
+/**
+ * Parse one tensor entry of a safetensors header
+ * 
+ * @param p: Position of the opening brace
+ * @param end: End of the header
+ * @param data_size: Size of the tensor data section
+ * @param tensor: Tensor to fill
+ * @return: Position after the entry, NULL on failure
+ */
+static const char* safetensors_parse_tensor(const char* p, const char* end, uint64_t data_size, model_tensor_t* tensor) {
+    char key[32];
+    char dtype_name[16] = {0};
+    uint64_t offsets[2] = {0, 0};
+    int have_offsets = 0;
+    uint64_t elements = 1;
+    
+    tensor->tensor.ndim = 0;
+    
+    p = safetensors_skip_ws(p, end);
+    if (p >= end || *p != '{') {
+        return NULL;
+    }
+    p++;
+    
+    for (;;) {
+        p = safetensors_skip_ws(p, end);
+        if (p < end && *p == '}') {
+            p++;
+            break;
+        }
+        
+        p = safetensors_parse_string(p, end, key, sizeof(key));
+        if (!p) {
+            return NULL;
         }
         
-        // Initialize indices
-        for (size_t i = 0; i < vocab_size; i++) {
-            indices[i] = i;
+        p = safetensors_skip_ws(p, end);
+        if (p >= end || *p != ':') {
+            return NULL;
         }
+        p = safetensors_skip_ws(p + 1, end);
         
-        // Sort indices by logits (using insertion sort for better performance on partially sorted data)
-        for (size_t i = 1; i < vocab_size; i++) {
-            uint32_t key = indices[i];
-            float key_prob = logits[key];
-            int j = i - 1;
+        if (strcmp(key, "dtype") == 0) {
+            p = safetensors_parse_string(p, end, dtype_name, sizeof(dtype_name));
+        } else if (strcmp(key, "shape") == 0 || strcmp(key, "data_offsets") == 0) {
+            int is_shape = key[0] == 's';
+            uint32_t count = 0;
             
-            while (j >= 0 && logits[indices[j]] < key_prob) {
-                indices[j + 1] = indices[j];
-                j--;
+            if (p >= end || *p != '[') {
+                return NULL;
             }
+            p++;
             
-            indices[j + 1] = key;
+            for (;;) {
+                uint64_t value;
+                
+                p = safetensors_skip_ws(p, end);
+                if (p < end && *p == ']') {
+                    p++;
+                    break;
+                }
+                
+                p = safetensors_parse_uint(p, end, &value);
+                if (!p) {
+                    return NULL;
+                }
+                
+                if (is_shape) {
+                    if (count >= MODEL_TENSOR_MAX_DIMS || value > 0xFFFFFFFFu) {
+                        return NULL;
+                    }
+                    tensor->shape[count] = (uint32_t)value;
+                    elements *= value;
+                } else if (count < 2) {
+                    offsets[count] = value;
+                }
+                count++;
+                
+                p = safetensors_skip_ws(p, end);
+                if (p < end && *p == ',') {
+                    p++;
+                }
+            }
+            
+            if (is_shape) {
+                tensor->tensor.ndim = count;
+            } else {
+                have_offsets = count == 2;
+            }
+        } else {
+            p = safetensors_skip_value(p, end);
         }
         
-        // Compute cumulative probabilities and find nucleus
-        float cumulative_prob = 0.0f;
-        size_t nucleus_size = 0;
+        if (!p) {
+            return NULL;
+        }
         
-        for (size_t i = 0; i < vocab_size; i++) {
-            cumulative_prob += logits[indices[i]];
-            nucleus_size++;
-            
-            if (cumulative_prob >= top_p) {
-                break;
-            }
+        p = safetensors_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p++;
         }
+    }
+    
+    // Validate the entry against the data section
+    uint32_t elem_size = 0;
+    uint32_t dtype = safetensors_dtype(dtype_name, &elem_size);
+    
+    if (dtype == NN_DTYPE_UNKNOWN || !have_offsets || offsets[0] > offsets[1] || offsets[1] > data_size) {
+        return NULL;
+    }
+    
+    if (offsets[1] - offsets[0] != elements * elem_size || offsets[1] - offsets[0] > 0xFFFFFFFFu) {
+        return NULL;
+    }
+    
+    tensor->offset = offsets[0];
+    tensor->size = offsets[1] - offsets[0];
+    tensor->tensor.data = NULL;
+    tensor->tensor.shape = tensor->shape;
+    tensor->tensor.dtype = dtype;
+    tensor->tensor.size = (uint32_t)tensor->size;
+    tensor->tensor.flags = MODEL_TENSOR_FLAG_MAPPED;
+    
+    return p;
+}
+
+/**
+ * Parse a safetensors header
+ * 
+ * @param json: Header JSON
+ * @param len: Length of the header
+ * @param data_size: Size of the tensor data section
+ * @param tensors: Tensors to fill, NULL to only count them
+ * @return: Number of tensors on success, -1 on failure
+ */
+static int safetensors_parse_header(const char* json, size_t len, uint64_t data_size, model_tensor_t* tensors) {
+    const char* end = json + len;
+    const char* p = safetensors_skip_ws(json, end);
+    model_tensor_t scratch;
+    int count = 0;
+    
+    if (p >= end || *p != '{') {
+        return -1;
+    }
+    p++;
+    
+    for (;;) {
+        char name[MODEL_TENSOR_NAME_SIZE];
         
-        // Ensure nucleus has at least one token
-        if (nucleus_size == 0 && vocab_size > 0) {
-            nucleus_size = 1;
+        p = safetensors_skip_ws(p, end);
+        if (p < end && *p == '}') {
+            break;
         }
         
-        // Zero out probabilities for tokens outside the nucleus
-        for (size_t i = nucleus_size; i < vocab_size; i++) {
-            logits[indices[i]] = 0.0f;
+        p = safetensors_parse_string(p, end, name, sizeof(name));
+        if (!p) {
+            return -1;
         }
         
-        // Renormalize probabilities
-        sum = 0.0f;
-        for (size_t i = 0; i < vocab_size; i++) {
-            sum += logits[i];
+        p = safetensors_skip_ws(p, end);
+        if (p >= end || *p != ':') {
+            return -1;
         }
+        p++;
         
-        if (sum > 0.0f) {
-            for (size_t i = 0; i < vocab_size; i++) {
-                logits[i] /= sum;
-            }
+        if (strcmp(name, "__metadata__") == 0) {
+            p = safetensors_skip_value(p, end);
         } else {
-            // If sum is zero, distribute probability evenly among nucleus tokens
-            for (size_t i = 0; i < nucleus_size; i++) {
-                logits[indices[i]] = 1.0f / nucleus_size;
+            model_tensor_t* tensor = tensors ? &tensors[count] : &scratch;
+            
+            p = safetensors_parse_tensor(p, end, data_size, tensor);
+            if (p) {
+                strncpy(tensor->name, name, sizeof(tensor->name) - 1);
+                tensor->name[sizeof(tensor->name) - 1] = '\0';
+                count++;
             }
         }
         
-        free(indices);
+        if (!p) {
+            return -1;
+        }
+        
+        p = safetensors_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p++;
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * Read the data section of a safetensors model file into memory
+ * 
+ * Used instead of a mapping while paging is off. The tensor views point
+ * into the copy, and the file is closed.
+ * 
+ * @param slot: Model slot
+ * @param file: Open model file
+ * @param data_start: File offset of the data section
+ * @param data_size: Size of the data section
+ * @param tensors: Tensor table (owned by the model on success, freed on failure)
+ * @param num_tensors: Number of tensors
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_read_safetensors(int slot, page_cache_file_t* file, uint64_t data_start, uint64_t data_size,
+                                         model_tensor_t* tensors, uint32_t num_tensors) {
+    size_t tensors_size = sizeof(model_tensor_t) * num_tensors;
+    void* memory = data_size > 0 && data_size <= MODEL_MAP_BUDGET ?
+                   memory_alloc((size_t)data_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_FLAG_HUGE) : NULL;
+    
+    if (!memory || page_cache_seek(file, (int64_t)data_start, PAGE_CACHE_SEEK_SET) != 0 ||
+        page_cache_read(file, memory, (size_t)data_size) != data_size) {
+        if (memory) {
+            memory_free(memory, (size_t)data_size);
+        }
+        memory_free(tensors, tensors_size);
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < num_tensors; i++) {
+        tensors[i].tensor.shape = tensors[i].shape;
+        tensors[i].tensor.data = (uint8_t*)memory + tensors[i].offset;
+    }
+    
+    page_cache_close(file);
+    
+    models[slot].weights_file = NULL;
+    models[slot].weights_mapping = NULL;
+    models[slot].data_start = data_start;
+    models[slot].tensors = tensors;
+    models[slot].num_tensors = num_tensors;
+    models[slot].model_memory = memory;
+    models[slot].model_memory_size = (size_t)data_size;
+    
+    // Layer ranges are not needed: nothing is mapped or prefetched
+    models[slot].layers = NULL;
+    models[slot].num_layers = 0;
+    
+    return 0;
+}
+
+/**
+ * Load model weights from a safetensors file without copying them
+ * 
+ * The header is parsed up front and the data section is mapped from the
+ * file; tensor views point straight into the mapping and their pages are
+ * faulted in on first use. Sections larger than MODEL_MAP_BUDGET are mapped
+ * a layer at a time, see model_loader_begin_layer. While paging is off the
+ * data section is read into memory instead.
+ * 
+ * @param slot: Model slot
+ * @param file: Open model file
+ * @param file_size: Size of the model file
+ * @return: 0 on success, -1 if the file is not a safetensors file
+ */
+static int model_loader_map_safetensors(int slot, page_cache_file_t* file, uint64_t file_size) {
+    uint8_t length_bytes[8];
+    uint64_t header_size = 0;
+    
+    if (page_cache_seek(file, 0, PAGE_CACHE_SEEK_SET) != 0 ||
+        page_cache_read(file, length_bytes, sizeof(length_bytes)) != sizeof(length_bytes)) {
+        return -1;
+    }
+    
+    // The header length is a little endian 64-bit integer
+    for (int i = 7; i >= 0; i--) {
+        header_size = (header_size << 8) | length_bytes[i];
+    }
+    
+    if (header_size < 2 || header_size > MODEL_SAFETENSORS_MAX_HEADER || header_size + 8 > file_size) {
+        return -1;
+    }
+    
+    char* header = (char*)memory_alloc((size_t)header_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!header) {
+        return -1;
+    }
+    
+    if (page_cache_read(file, header, (size_t)header_size) != header_size) {
+        memory_free(header, (size_t)header_size);
+        return -1;
+    }
+    
+    uint64_t data_start = 8 + header_size;
+    uint64_t data_size = file_size - data_start;
+    
+    int num_tensors = safetensors_parse_header(header, (size_t)header_size, data_size, NULL);
+    if (num_tensors <= 0) {
+        memory_free(header, (size_t)header_size);
+        return -1;
+    }
+    
+    size_t tensors_size = sizeof(model_tensor_t) * (size_t)num_tensors;
+    model_tensor_t* tensors = (model_tensor_t*)memory_alloc(tensors_size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+    if (!tensors) {
+        memory_free(header, (size_t)header_size);
+        return -1;
+    }
+    
+    safetensors_parse_header(header, (size_t)header_size, data_size, tensors);
+    memory_free(header, (size_t)header_size);
+    
+    // Map the data section; nothing is read until a tensor is requested.
+    // Sections larger than the mapping budget are mapped a layer at a time.
+    void* mapping = NULL;
+    int layered = data_size > MODEL_MAP_BUDGET;
+    
+    if (data_size > SIZE_MAX) {
+        memory_free(tensors, tensors_size);
+        return -1;
+    }
+    
+    // Without paging no page of the mapping window faults in, and the
+    // window has no memory behind it, so read the data section up front
+    if (!memory_paging_enabled()) {
+        return model_loader_read_safetensors(slot, file, data_start, data_size, tensors, (uint32_t)num_tensors);
+    }
+    
+    if (data_size > 0 && !layered) {
+        mapping = memory_map_file(model_loader_read_weights, file, data_start, (size_t)data_size, MEMORY_PROT_READ);
+        if (!mapping) {
+            memory_free(tensors, tensors_size);
+            return -1;
+        }
+    }
+    
+    for (int i = 0; i < num_tensors; i++) {
+        tensors[i].tensor.shape = tensors[i].shape;
+        tensors[i].tensor.data = mapping ? (uint8_t*)mapping + tensors[i].offset : NULL;
+    }
+    
+    models[slot].weights_file = file;
+    models[slot].weights_mapping = mapping;
+    models[slot].data_start = data_start;
+    models[slot].tensors = tensors;
+    models[slot].num_tensors = (uint32_t)num_tensors;
+    models[slot].model_memory = NULL;
+    models[slot].model_memory_size = (size_t)data_size;
+    
+    // Without layer ranges the model still pages in on demand, just without prefetch
+    if (model_loader_build_layer_ranges(slot) != 0) {
+        models[slot].layers = NULL;
+        models[slot].num_layers = 0;
+    }
+    
+    if (layered) {
+        models[slot].layered = 1;
+        
+        model_layer_map_acquire();
+        int result = models[slot].num_layers > 0 && model_loader_map_pinned(slot) == 0 ? model_loader_map_layer(slot, 0, UINT32_MAX) : -1;
+        model_layer_map_release();
+        
+        if (result != 0) {
+            // Leave the file to the caller, which copies the model instead
+            model_loader_unmap_layered(slot);
+            memory_free(models[slot].layers, sizeof(model_layer_range_t) * models[slot].num_layers);
+            memory_free(tensors, tensors_size);
+            models[slot].layers = NULL;
+            models[slot].num_layers = 0;
+            models[slot].tensors = NULL;
+            models[slot].num_tensors = 0;
+            models[slot].weights_file = NULL;
+            models[slot].model_memory_size = 0;
+            return -1;
+        }
+    }
+    
+    // Start reading the first layer while the tokenizer loads
+    model_loader_queue_prefetch(slot, 0);
+    
+    return 0;
+}
+
+/**
+ * Load model weights
+ * 
+ * @param slot: Model slot
+ * @param model_path: Path to the model file
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_load_model_weights(int slot, const char* model_path) {
+    // Load model weights from the specified file
+    if (!model_path) {
+        return -1;
+    }
+    
+    // Open the model file (through the page cache for 64-bit offsets)
+    page_cache_file_t* file = page_cache_open(model_path, PAGE_CACHE_READ);
+    if (!file) {
+        return -1;
+    }
+    
+    // Get the file size
+    page_cache_seek(file, 0, PAGE_CACHE_SEEK_END);
+    uint64_t file_size = page_cache_tell(file);
+    page_cache_seek(file, 0, PAGE_CACHE_SEEK_SET);
+    
+    // Safetensors files are mapped in place, the file stays open as the backing store
+    if (model_loader_map_safetensors(slot, file, file_size) == 0) {
+        return 0;
+    }
+    
+    // Files the address space cannot hold are not copied either
+    if (file_size > SIZE_MAX) {
+        page_cache_close(file);
+        return -1;
+    }
+    
+    // Reset file position
+    page_cache_seek(file, 0, PAGE_CACHE_SEEK_SET);
+    
+    // Allocate memory for the model weights on large pages to keep GEMV sweeps TLB friendly
+    size_t size = file_size > 0 ? (size_t)file_size : 1536 * 1024 * 1024; // Use file size or 1.5 GB
+    void* memory = memory_alloc(size, MEMORY_PROT_READ | MEMORY_PROT_WRITE, MEMORY_FLAG_HUGE);
+    
+    if (!memory) {
+        page_cache_close(file);
+        return -1;
+    }
+    
+    // Read the model weights
+    size_t bytes_read = page_cache_read(file, memory, size);
+    if (bytes_read == 0) {
+        // If we couldn't read anything, initialize with zeros
+        memset(memory, 0, size);
+    }
+    
+    // Close the file
+    page_cache_close(file);
+    
+    // Set the model memory
+    models[slot].model_memory = memory;
+    models[slot].model_memory_size = size;
+    
+    return 0;
+}
+
+/**
+ * Free the weights of a model
+ * 
+ * @param slot: Model slot
+ */
+static void model_loader_free_weights(int slot) {
+    model_loader_cancel_prefetch(slot);
+    
+    if (models[slot].layered) {
+        model_loader_unmap_layered(slot);
+    }
+    
+    if (models[slot].layers) {
+        memory_free(models[slot].layers, sizeof(model_layer_range_t) * models[slot].num_layers);
+        models[slot].layers = NULL;
+        models[slot].num_layers = 0;
+    }
+    
+    if (models[slot].weights_mapping) {
+        memory_unmap_file(models[slot].weights_mapping);
+        models[slot].weights_mapping = NULL;
     }
     
-    // Sample a token from the probability distribution
-    float rand_val = (float)rand() / RAND_MAX;
-    float cumulative_prob = 0.0f;
+    if (models[slot].tensors) {
+        memory_free(models[slot].tensors, sizeof(model_tensor_t) * models[slot].num_tensors);
+        models[slot].tensors = NULL;
+        models[slot].num_tensors = 0;
+    }
     
-    for (size_t i = 0; i < vocab_size; i++) {
-        cumulative_prob += logits[i];
-        if (rand_val <= cumulative_prob) {
-            return i;
-        }
+    if (models[slot].weights_file) {
+        page_cache_close(models[slot].weights_file);
+        models[slot].weights_file = NULL;
     }
     
-    // If sampling fails (e.g., due to numerical issues), use a more robust approach
-    // Create a cumulative distribution function (CDF) and binary search
-    float* cdf = (float*)malloc(vocab_size * sizeof(float));
-    if (!cdf) {
-        // Fallback to greedy sampling if allocation fails
-        uint32_t best_token = 0;
-        float best_prob = logits[0];
-        for (size_t i = 1; i < vocab_size; i++) {
-            if (logits[i] > best_prob) {
-                best_prob = logits[i];
-                best_token = i;
-            }
-        }
-        return best_token;
+    if (models[slot].model_memory) {
+        memory_free(models[slot].model_memory, models[slot].model_memory_size);
+        models[slot].model_memory = NULL;
     }
     
-    // Build CDF
-    cdf[0] = logits[0];
-    for (size_t i = 1; i < vocab_size; i++) {
-        cdf[i] = cdf[i-1] + logits[i];
+    models[slot].model_memory_size = 0;
+}
+
+/**
+ * Load tokenizer data
+ * 
+ * @param tokenizer_path: Path to the tokenizer file
+ * @param tokenizer_memory: Pointer to store the tokenizer memory
+ * @param tokenizer_memory_size: Pointer to store the tokenizer memory size
+ * @param vocab: Vocabulary to build from the tokenizer file
+ * @param bpe: BPE encoder to build from the tokenizer file
+ * @return: 0 on success, -1 on failure
+ */
+static int model_loader_load_tokenizer_data(const char* tokenizer_path, void** tokenizer_memory, size_t* tokenizer_memory_size, vocab_t* vocab, bpe_t* bpe) {
+    // Load tokenizer data from the specified file
+    if (!tokenizer_path || !tokenizer_memory || !tokenizer_memory_size) {
+        return -1;
     }
     
-    // Normalize CDF to ensure last value is 1.0
-    if (cdf[vocab_size-1] > 0.0f) {
-        for (size_t i = 0; i < vocab_size; i++) {
-            cdf[i] /= cdf[vocab_size-1];
-        }
+    // Open the tokenizer file
+    FILE* file = fopen(tokenizer_path, "rb");
+    if (!file) {
+        return -1;
     }
     
-    // Binary search on CDF
-    size_t left = 0;
-    size_t right = vocab_size - 1;
-    size_t mid;
+    // Get the file size
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
     
-    while (left <= right) {
-        mid = left + (right - left) / 2;
-        
-        if (mid > 0 && cdf[mid-1] <= rand_val && rand_val < cdf[mid]) {
-            free(cdf);
-            return mid;
-        } else if (mid == 0 && rand_val < cdf[mid]) {
-            free(cdf);
-            return 0;
-        } else if (cdf[mid] <= rand_val) {
-            left = mid + 1;
-        } else {
-            if (mid == 0) {
-                break;
-            }
-            right = mid - 1;
-        }
+    // Allocate memory for the tokenizer data
+    size_t size = file_size > 0 ? file_size : 10 * 1024 * 1024; // Use file size or 10 MB
+    void* memory = malloc(size);
+    
+    if (!memory) {
+        fclose(file);
+        return -1;
+    }
+    
+    // Read the tokenizer data
+    size_t bytes_read = fread(memory, 1, size, file);
+    if (bytes_read == 0) {
+        // If we couldn't read anything, initialize with zeros
+        memset(memory, 0, size);
     }
     
-    free(cdf);
+    // Close the file
+    fclose(file);
+    
+    // Build the vocabulary; without one, lookups fall back to the built-in tokens
+    if (bytes_read == 0 || vocab_load_json(vocab, (const char*)memory, bytes_read) != 0) {
+        memset(vocab, 0, sizeof(vocab_t));
+    }
     
-    // Final fallback: return the most likely token
-    uint32_t best_token = 0;
-    float best_prob = logits[0];
-    for (size_t i = 1; i < vocab_size; i++) {
-        if (logits[i] > best_prob) {
-            best_prob = logits[i];
-            best_token = i;
-        }
+    // Build the BPE encoder; without merges, tokenization falls back to words
+    if (bpe_init(bpe, vocab, (const char*)memory, bytes_read) != 0) {
+        memset(bpe, 0, sizeof(bpe_t));
     }
     
-    return best_token;
+    // Set the output parameters
+    *tokenizer_memory = memory;
+    *tokenizer_memory_size = size;
+    
+    return 0;
 }
 
 /**
@@ -957,12 +1801,26 @@ int model_loader_init(void) {
         models[i].id = 0;
         models[i].model_memory = NULL;
         models[i].model_memory_size = 0;
+        models[i].weights_file = NULL;
+        models[i].weights_mapping = NULL;
+        models[i].data_start = 0;
+        models[i].layered = 0;
+        models[i].num_pinned = 0;
+        models[i].mapped_bytes = 0;
+        models[i].layer_clock = 0;
+        models[i].tensors = NULL;
+        models[i].num_tensors = 0;
+        models[i].layers = NULL;
+        models[i].num_layers = 0;
         models[i].tokenizer_memory = NULL;
         models[i].tokenizer_memory_size = 0;
+        memset(&models[i].vocab, 0, sizeof(vocab_t));
+        memset(&models[i].bpe, 0, sizeof(bpe_t));
         models[i].loaded = 0;
         models[i].memory_usage = 0;
         models[i].load_time = 0;
         models[i].inference_time = 0;
+        models[i].first_token_time = 0;
     }
     
     // Initialize random number generator
@@ -988,12 +1846,8 @@ int model_loader_shutdown(void) {
     // Free all models
     for (int i = 0; i < MAX_MODELS; i++) {
         if (models[i].loaded) {
-            // Free the model memory
-            if (models[i].model_memory) {
-                free(models[i].model_memory);
-                models[i].model_memory = NULL;
-                models[i].model_memory_size = 0;
-            }
+            // Free the model weights
+            model_loader_free_weights(i);
             
             // Free the tokenizer memory
             if (models[i].tokenizer_memory) {
@@ -1002,10 +1856,17 @@ int model_loader_shutdown(void) {
                 models[i].tokenizer_memory_size = 0;
             }
             
+            // Free the BPE encoder and the vocabulary
+            bpe_free(&models[i].bpe);
+            vocab_free(&models[i].vocab);
+            
             models[i].loaded = 0;
         }
     }
     
+    // Stop the prefetcher
+    model_prefetch_running = 0;
+    
     // Reset the initialized flag
     model_loader_initialized = 0;
     
@@ -1058,16 +1919,14 @@ model_id_t model_loader_load_model(const char* model_path, const char* config_pa
     clock_t start_time = clock();
     
     // Load the model weights
-    if (model_loader_load_model_weights(model_path, &models[slot].model_memory, &models[slot].model_memory_size) != 0) {
+    if (model_loader_load_model_weights(slot, model_path) != 0) {
         return 0;
     }
     
     // Load the tokenizer data
-    if (model_loader_load_tokenizer_data(tokenizer_path, &models[slot].tokenizer_memory, &models[slot].tokenizer_memory_size) != 0) {
-        // Free the model memory
-        free(models[slot].model_memory);
-        models[slot].model_memory = NULL;
-        models[slot].model_memory_size = 0;
+    if (model_loader_load_tokenizer_data(tokenizer_path, &models[slot].tokenizer_memory, &models[slot].tokenizer_memory_size, &models[slot].vocab, &models[slot].bpe) != 0) {
+        // Free the model weights
+        model_loader_free_weights(slot);
         
         return 0;
     }
@@ -1080,10 +1939,11 @@ model_id_t model_loader_load_model(const char* model_path, const char* config_pa
     models[slot].id = next_model_id++;
     
     // Set the memory usage
-    models[slot].memory_usage = models[slot].model_memory_size + models[slot].tokenizer_memory_size;
+    models[slot].memory_usage = models[slot].model_memory_size + models[slot].tokenizer_memory_size + models[slot].vocab.alloc_size + models[slot].bpe.alloc_size;
     
     // Set the inference time
     models[slot].inference_time = 0;
+    models[slot].first_token_time = 0;
     
     // Set the loaded flag
     models[slot].loaded = 1;
@@ -1117,12 +1977,8 @@ int model_loader_unload_model(model_id_t model_id) {
         return -1;
     }
     
-    // Free the model memory
-    if (models[slot].model_memory) {
-        free(models[slot].model_memory);
-        models[slot].model_memory = NULL;
-        models[slot].model_memory_size = 0;
-    }
+    // Free the model weights
+    model_loader_free_weights(slot);
     
     // Free the tokenizer memory
     if (models[slot].tokenizer_memory) {
@@ -1131,12 +1987,17 @@ int model_loader_unload_model(model_id_t model_id) {
         models[slot].tokenizer_memory_size = 0;
     }
     
+    // Free the BPE encoder and the vocabulary
+    bpe_free(&models[slot].bpe);
+    vocab_free(&models[slot].vocab);
+    
     // Reset the model
     models[slot].id = 0;
     models[slot].loaded = 0;
     models[slot].memory_usage = 0;
     models[slot].load_time = 0;
     models[slot].inference_time = 0;
+    models[slot].first_token_time = 0;
     
     return 0;
 }
@@ -1178,8 +2039,21 @@ int model_loader_get_model_info(model_id_t model_id, model_state_t* state) {
     strncpy(state->name, models[slot].config.name, sizeof(state->name) - 1);
     state->type = models[slot].config.type;
     state->memory_usage = models[slot].memory_usage;
+    state->resident_bytes = models[slot].memory_usage;
+    state->page_faults = 0;
+    
+    // Mapped weights only count the pages that are resident
+    memory_map_stats_t map_stats;
+    
+    if (model_loader_get_map_stats(slot, &map_stats) == 0) {
+        state->resident_bytes = map_stats.resident + models[slot].tokenizer_memory_size + models[slot].vocab.alloc_size + models[slot].bpe.alloc_size;
+        state->memory_usage = state->resident_bytes;
+        state->page_faults = map_stats.faults;
+    }
+
     state->load_time = models[slot].load_time;
     state->inference_time = models[slot].inference_time;
+    state->first_token_time = models[slot].first_token_time;
     state->num_parameters = 1500000000;  // 1.5 billion parameters
     state->num_layers = models[slot].config.num_hidden_layers;
     state->batch_size = 1;
@@ -1190,6 +2064,153 @@ int model_loader_get_model_info(model_id_t model_id, model_state_t* state) {
     return 0;
 }
 
+/**
+ * Get a weight tensor of a model
+ * 
+ * Tensors of mapped models are not read here; their pages fault in from the
+ * model file on first access. For a model mapped a layer at a time, the view
+ * of a layer tensor stays valid until the layer is unmapped to make room for
+ * others, which model_loader_begin_layer never does to the running layer.
+ * 
+ * @param model_id: Model ID
+ * @param name: Tensor name
+ * @param tensor: Pointer to store the tensor view
+ * @return: 0 on success, -1 on failure
+ */
+int model_loader_get_tensor(model_id_t model_id, const char* name, nn_tensor_t** tensor) {
+    // Check if the Model Loader is initialized
+    if (!model_loader_initialized || !name || !tensor) {
+        return -1;
+    }
+    
+    // Find the model
+    int slot = -1;
+    
+    for (int i = 0; i < MAX_MODELS; i++) {
+        if (models[i].loaded && models[i].id == model_id) {
+            slot = i;
+            break;
+        }
+    }
+    
+    if (slot == -1) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < models[slot].num_tensors; i++) {
+        model_tensor_t* t = &models[slot].tensors[i];
+        
+        if (strcmp(t->name, name) != 0) {
+            continue;
+        }
+        
+        // Layers of models mapped a layer at a time are mapped on first use
+        uint32_t layer;
+        
+        if (models[slot].layered && model_loader_tensor_layer(t->name, &layer) == 0 && layer < models[slot].num_layers) {
+            model_layer_map_acquire();
+            int result = model_loader_map_layer(slot, layer, UINT32_MAX);
+            model_layer_map_release();
+            
+            if (result != 0) {
+                return -1;
+            }
+        }
+        
+        *tensor = &t->tensor;
+        
+        return 0;
+    }
+    
+    return -1;
+}
+
+/**
+ * Get the number of weight tensors of a model
+ * 
+ * @param model_id: Model ID
+ * @return: Number of tensors, 0 if the model is not loaded or not mapped
+ */
+uint32_t model_loader_get_num_tensors(model_id_t model_id) {
+    if (!model_loader_initialized) {
+        return 0;
+    }
+    
+    for (int i = 0; i < MAX_MODELS; i++) {
+        if (models[i].loaded && models[i].id == model_id) {
+            return models[i].num_tensors;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Prefetch the weights of a layer of a mapped model
+ * 
+ * The read is issued in the background; the call does not wait for it.
+ * 
+ * @param model_id: Model ID
+ * @param layer: Layer index
+ * @return: 0 on success, -1 on failure
+ */
+int model_loader_prefetch_layer(model_id_t model_id, uint32_t layer) {
+    if (!model_loader_initialized) {
+        return -1;
+    }
+    
+    for (int i = 0; i < MAX_MODELS; i++) {
+        if (models[i].loaded && models[i].id == model_id) {
+            return model_loader_queue_prefetch(i, layer);
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * Mark the start of a layer's computation
+ * 
+ * Prefetches the next layer so its weights are read while this one runs.
+ * Models mapped a layer at a time get both layers mapped first, which may
+ * unmap (and invalidate the tensor views of) the least recently used ones.
+ * 
+ * @param model_id: Model ID
+ * @param layer: Layer index about to run
+ * @return: 0 on success, -1 on failure
+ */
+int model_loader_begin_layer(model_id_t model_id, uint32_t layer) {
+    if (!model_loader_initialized) {
+        return -1;
+    }
+    
+    for (int i = 0; i < MAX_MODELS; i++) {
+        if (models[i].loaded && models[i].id == model_id) {
+            // Map the running layer and the next one, unmapping older layers
+            if (models[i].layered && layer < models[i].num_layers) {
+                model_layer_map_acquire();
+                int result = model_loader_map_layer(i, layer, UINT32_MAX);
+                if (result == 0 && layer + 1 < models[i].num_layers) {
+                    result = model_loader_map_layer(i, layer + 1, layer);
+                }
+                model_layer_map_release();
+                
+                if (result != 0) {
+                    return -1;
+                }
+            }
+            
+            if (layer + 1 < models[i].num_layers) {
+                model_loader_queue_prefetch(i, layer + 1);
+            }
+            
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
 /**
  * Generate text using a model
  * 
@@ -1201,6 +2222,60 @@ int model_loader_get_model_info(model_id_t model_id, model_state_t* state) {
  * @return: 0 on success, -1 on failure
  */
 int model_loader_generate_text(model_id_t model_id, const char* prompt, char* output, size_t output_size, const generation_config_t* config) {
+    return model_loader_generate_text_stream(model_id, prompt, output, output_size, config, NULL, NULL);
+}
+
+/**
+ * Get the length of the longest prefix of text made of whole UTF-8 sequences
+ * 
+ * @param text: Text
+ * @param len: Length of the text
+ * @return: Length of the prefix
+ */
+static size_t model_loader_utf8_complete(const char* text, size_t len) {
+    // Find the lead byte of the last sequence
+    size_t start = len;
+    
+    while (start > 0 && len - start < 4 && ((uint8_t)text[start - 1] & 0xC0) == 0x80) {
+        start--;
+    }
+    
+    if (start == 0) {
+        return len;
+    }
+    
+    uint8_t lead = (uint8_t)text[start - 1];
+    size_t need = 1;
+    
+    if ((lead & 0xE0) == 0xC0) {
+        need = 2;
+    } else if ((lead & 0xF0) == 0xE0) {
+        need = 3;
+    } else if ((lead & 0xF8) == 0xF0) {
+        need = 4;
+    }
+    
+    return len - (start - 1) < need ? start - 1 : len;
+}
+
+/**
+ * Generate text using a model, streaming it as tokens are sampled
+ * 
+ * Each sampled token is detokenized on its own and passed to the callback
+ * as soon as it forms whole UTF-8 characters; bytes of a character split
+ * across tokens are held back until the rest arrives. The pieces
+ * concatenate to the text stored in output.
+ * 
+ * @param model_id: Model ID
+ * @param prompt: Input prompt
+ * @param output: Output buffer
+ * @param output_size: Output buffer size
+ * @param config: Generation configuration
+ * @param callback: Function receiving each piece of text (NULL for none)
+ * @param user_data: User data passed to the callback
+ * @return: 0 on success, -1 on failure
+ */
+int model_loader_generate_text_stream(model_id_t model_id, const char* prompt, char* output, size_t output_size, const generation_config_t* config, nn_stream_callback_t callback, void* user_data) {
     // Check if the Model Loader is initialized
     if (!model_loader_initialized) {
         return -1;
@@ -1239,11 +2314,11 @@ int model_loader_generate_text(model_id_t model_id, const char* prompt, char* ou
     }
     
     // Set up generation parameters
-    float temperature = config->temperature;
-    float top_p = config->top_p;
-    int top_k = config->top_k;
-    // Commented out to avoid unused variable warning
-    // float repetition_penalty = config->repetition_penalty;
+    sampler_params_t sampler_params;
+    sampler_params.temperature = config->temperature;
+    sampler_params.top_p = config->top_p;
+    sampler_params.top_k = config->top_k;
+    sampler_params.repetition_penalty = config->repetition_penalty;
     int max_length = config->max_length;
     // Commented out to avoid unused variable warning
     // int min_length = config->min_length;
@@ -1264,6 +2339,18 @@ int model_loader_generate_text(model_id_t model_id, const char* prompt, char* ou
         return -1;
     }
     
+    // Set up the sampler once for the whole generation
+    sampler_t sampler;
+    if (sampler_init(&sampler, vocab_size, sampler_params.top_k) != 0) {
+        free(logits);
+        return -1;
+    }
+    
+    // Text decoded but not yet streamed, and whether any text was streamed
+    char pending[256];
+    size_t pending_len = 0;
+    int streamed = 0;
+    
     // Generate new tokens
     for (int i = 0; i < (int)(max_length - num_tokens) && num_generated < 1024; i++) {
         // Run the model to predict the next token
@@ -1289,22 +2376,74 @@ int model_loader_generate_text(model_id_t model_id, const char* prompt, char* ou
         }
         
         // Sample the next token
-        uint32_t next_token = model_loader_sample_token(
-            generated_tokens, num_generated, 
-            temperature, top_p, top_k, 
-            logits, vocab_size
-        );
+        uint32_t next_token = sampler_sample(&sampler, logits, &sampler_params,
+                                             generated_tokens, num_generated);
         
         // Add the token to the generated sequence
         generated_tokens[num_generated++] = next_token;
         
+        // Record the time to first token
+        if (i == 0) {
+            models[slot].first_token_time = (uint64_t)((clock() - start_time) * 1000 / CLOCKS_PER_SEC);
+        }
+        
         // Check for end of sequence token
         if (next_token == models[slot].config.eos_token_id) {
             break;
         }
+        
+        if (!callback || next_token == models[slot].config.bos_token_id ||
+            next_token == models[slot].config.pad_token_id) {
+            continue;
+        }
+        
+        // Decode the token after the bytes held back from earlier ones
+        if (models[slot].bpe.merges) {
+            pending_len += bpe_decode(&models[slot].bpe, &next_token, 1, pending + pending_len, sizeof(pending) - pending_len);
+        } else {
+            const char* separator = streamed || pending_len > 0 ? " " : "";
+            size_t word_len;
+            const char* vocab_text = vocab_get_text(&models[slot].vocab, next_token, &word_len);
+            int written;
+            
+            if (vocab_text) {
+                if (word_len > 63) {
+                    word_len = 63;
+                }
+                written = snprintf(pending + pending_len, sizeof(pending) - pending_len, "%s%.*s", separator, (int)word_len, vocab_text);
+            } else {
+                written = snprintf(pending + pending_len, sizeof(pending) - pending_len, "%sword%u", separator, next_token);
+            }
+            
+            if (written > 0) {
+                pending_len += (size_t)written < sizeof(pending) - pending_len ? (size_t)written : sizeof(pending) - pending_len - 1;
+            }
+        }
+        
+        // Stream the whole characters, stopping when the caller asks to
+        size_t ready = model_loader_utf8_complete(pending, pending_len);
+        
+        if (ready == 0) {
+            continue;
+        }
+        
+        int stop = callback(pending, ready, user_data) != 0;
+        pending_len -= ready;
+        memmove(pending, pending + ready, pending_len);
+        streamed = 1;
+        
+        if (stop) {
+            break;
+        }
+    }
+    
+    // Flush bytes still held back
+    if (callback && pending_len > 0) {
+        callback(pending, pending_len, user_data);
     }
     
-    // Free the logits memory
+    // Free the sampler and logits memory
+    sampler_free(&sampler);
     free(logits);
     
     // Detokenize the generated tokens
@@ -1324,13 +2463,17 @@ int model_loader_generate_text(model_id_t model_id, const char* prompt, char* ou
  * Helper function to check if a token is in the vocabulary
  * 
  * @param token: Token string
+ * @param vocab: Vocabulary loaded from the tokenizer file
  * @param tokenizer_config: Tokenizer configuration
  * @param model_config: Model configuration
  * @param token_id: Pointer to store the token ID
  * @return: 1 if the token is in the vocabulary, 0 otherwise
  */
-static int is_token_in_vocab(const char* token, const tokenizer_config_t* tokenizer_config, const model_config_t* model_config, uint32_t* token_id) {
+static int is_token_in_vocab(const char* token, const vocab_t* vocab, const tokenizer_config_t* tokenizer_config, const model_config_t* model_config, uint32_t* token_id) {
     // Search the vocabulary for the token
+    if (vocab_lookup(vocab, token, strlen(token), token_id) == 0) {
+        return 1;
+    }
     
     // Check for special tokens
     if (strcmp(token, tokenizer_config->bos_token) == 0) {
@@ -1356,6 +2499,11 @@ static int is_token_in_vocab(const char* token, const tokenizer_config_t* tokeni
         return 1;
     }
     
+    // The built-in common tokens only stand in for a missing vocabulary
+    if (vocab->num_tokens > 0) {
+        return 0;
+    }
+    
     // Check for common tokens
     static const struct {
         const char* token;
@@ -1520,6 +2668,30 @@ int model_loader_tokenize(model_id_t model_id, const char* text, uint32_t* token
         tokens[token_count++] = models[slot].config.bos_token_id;
     }
     
+    // Byte-level BPE from the tokenizer merges
+    if (models[slot].bpe.merges) {
+        size_t count = 0;
+        
+        if (bpe_encode(&models[slot].bpe, text, strlen(text), tokens + token_count, tokens_size - token_count, &count) != 0) {
+            return -1;
+        }
+        
+        for (size_t i = token_count; i < token_count + count; i++) {
+            if (tokens[i] == VOCAB_NO_TOKEN) {
+                tokens[i] = models[slot].config.unk_token_id;
+            }
+        }
+        token_count += count;
+        
+        // Add EOS token if available
+        if (token_count < tokens_size && models[slot].config.eos_token_id > 0) {
+            tokens[token_count++] = models[slot].config.eos_token_id;
+        }
+        
+        *num_tokens = token_count;
+        return 0;
+    }
+    
     // Step 1: Pre-tokenization (split text into words)
     size_t text_len = strlen(text);
     size_t max_words = text_len / 2 + 1; // Worst case: every other character is a word boundary
@@ -1570,7 +2742,7 @@ int model_loader_tokenize(model_id_t model_id, const char* text, uint32_t* token
         
         // Check if the word is in the vocabulary
         uint32_t token_id;
-        if (is_token_in_vocab(word, &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
+        if (is_token_in_vocab(word, &models[slot].vocab, &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
             // Add the token
             if (token_count < tokens_size) {
                 tokens[token_count++] = token_id;
@@ -1617,7 +2789,7 @@ int model_loader_tokenize(model_id_t model_id, const char* text, uint32_t* token
             // Add the resulting tokens
             for (size_t j = 0; j < char_count; j++) {
                 // Check if the token is in the vocabulary
-                if (is_token_in_vocab(chars[j], &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
+                if (is_token_in_vocab(chars[j], &models[slot].vocab, &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
                     // Add the token
                     if (token_count < tokens_size) {
                         tokens[token_count++] = token_id;
@@ -1647,7 +2819,7 @@ int model_loader_tokenize(model_id_t model_id, const char* text, uint32_t* token
         // Add space token if not the last word
         if (i < word_count - 1) {
             // Check if space is in the vocabulary
-            if (is_token_in_vocab(" ", &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
+            if (is_token_in_vocab(" ", &models[slot].vocab, &models[slot].tokenizer_config, &models[slot].config, &token_id)) {
                 // Add the token
                 if (token_count < tokens_size) {
                     tokens[token_count++] = token_id;
@@ -1716,6 +2888,23 @@ int model_loader_detokenize(model_id_t model_id, const uint32_t* tokens, size_t
     // Clear the text buffer
     text[0] = '\0';
     
+    // Byte-level BPE tokens carry their own spacing
+    if (models[slot].bpe.merges) {
+        size_t text_len = 0;
+        
+        for (size_t i = 0; i < num_tokens && text_len + 1 < text_size; i++) {
+            if (tokens[i] == models[slot].config.bos_token_id ||
+                tokens[i] == models[slot].config.eos_token_id ||
+                tokens[i] == models[slot].config.pad_token_id) {
+                continue;
+            }
+            
+            text_len += bpe_decode(&models[slot].bpe, &tokens[i], 1, text + text_len, text_size - text_len);
+        }
+        
+        return 0;
+    }
+    
     // Detokenize the tokens
     for (size_t i = 0; i < num_tokens; i++) {
         // Skip special tokens
@@ -1725,9 +2914,20 @@ int model_loader_detokenize(model_id_t model_id, const uint32_t* tokens, size_t
             continue;
         }
         
-        // Generate a word for the token
-        char word[32];
-        snprintf(word, sizeof(word), "word%u", tokens[i]);
+        // Look up the token text, generating a word for unknown IDs
+        char word[64];
+        size_t word_len;
+        const char* vocab_text = vocab_get_text(&models[slot].vocab, tokens[i], &word_len);
+        
+        if (vocab_text) {
+            if (word_len >= sizeof(word)) {
+                word_len = sizeof(word) - 1;
+            }
+            memcpy(word, vocab_text, word_len);
+            word[word_len] = '\0';
+        } else {
+            snprintf(word, sizeof(word), "word%u", tokens[i]);
+        }
         
         // Add a space before non-first words
         if (text[0] != '\0' && strlen(text) + 1 < text_size) {
@@ -10,6 +10,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "../../kernel/include/neural_network.h"
+
+// Model tensor flags (kept clear of the neural network and DL framework tensor flags)
+#define MODEL_TENSOR_FLAG_MAPPED (1u << 17)  // View into the mapped model file, data not owned
 
 // Model ID type
 typedef uint32_t model_id_t;
@@ -53,8 +57,11 @@ typedef struct {
     char name[64];
     model_type_t type;
     uint64_t memory_usage;
+    uint64_t resident_bytes;
+    uint64_t page_faults;
     uint64_t load_time;
     uint64_t inference_time;
+    uint64_t first_token_time;
     uint32_t num_parameters;
     uint32_t num_layers;
     uint32_t batch_size;
@@ -108,8 +115,15 @@ model_id_t model_loader_load_model(const char* model_path, const char* config_pa
 int model_loader_unload_model(model_id_t model_id);
 int model_loader_get_model_info(model_id_t model_id, model_state_t* state);
 
+// Model weights
+int model_loader_get_tensor(model_id_t model_id, const char* name, nn_tensor_t** tensor);
+uint32_t model_loader_get_num_tensors(model_id_t model_id);
+int model_loader_prefetch_layer(model_id_t model_id, uint32_t layer);
+int model_loader_begin_layer(model_id_t model_id, uint32_t layer);
+
 // Model operations
 int model_loader_generate_text(model_id_t model_id, const char* prompt, char* output, size_t output_size, const generation_config_t* config);
+int model_loader_generate_text_stream(model_id_t model_id, const char* prompt, char* output, size_t output_size, const generation_config_t* config, nn_stream_callback_t callback, void* user_data);
 int model_loader_tokenize(model_id_t model_id, const char* text, uint32_t* tokens, size_t tokens_size, size_t* num_tokens);
 int model_loader_detokenize(model_id_t model_id, const uint32_t* tokens, size_t num_tokens, char* text, size_t text_size);
 
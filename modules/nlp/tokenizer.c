@@ -6,6 +6,10 @@
  */
 
 #include "nlp/tokenizer.h"
+#include "dl_framework/dl_thread_pool.h"
+#include "../../kernel/include/bpe.h"
+#include "../../kernel/include/memory.h"
+#include "../../kernel/include/trace.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -19,6 +23,9 @@
 // Maximum number of tokens in a tokenization result
 #define MAX_TOKENS 1024
 
+// Texts per worker chunk in a batch
+#define TOKENIZER_BATCH_GRAIN 16
+
 // Tokenizer header structure
 typedef struct {
     uint32_t magic;          // Magic number to identify the tokenizer
@@ -36,10 +43,14 @@ static struct {
     tokenizer_config_t config;
     void* tokenizer_memory;
     size_t tokenizer_memory_size;
+    vocab_t vocab;
+    bpe_t bpe;
     int loaded;
     uint64_t memory_usage;
     uint64_t load_time;
     uint64_t tokenization_time;
+    uint64_t tokens_encoded;
+    uint64_t encode_time_us;
 } tokenizers[MAX_TOKENIZERS];
 
 // Next available tokenizer ID
@@ -48,11 +59,33 @@ static tokenizer_id_t next_tokenizer_id = 1;
 // Tokenizer state
 static int tokenizer_initialized = 0;
 
+// Tracepoint of tokenizer_tokenize
+static const trace_point_t tokenizer_trace_tokenize = { "tokenizer_tokenize", TRACE_CAT_LLM, { "tokenizer", "tokens" } };
+
+// Worker pool for batched encoding (created on first use)
+static dl_pool_t* tokenizer_pool = NULL;
+
+// Merge scratch space of each pool worker, allocated with the pool
+static bpe_scratch_t* tokenizer_scratch[DL_POOL_MAX_WORKERS];
+
+// Held while a batch uses the pool and its scratch space
+static volatile int tokenizer_lock = 0;
+
+// Batch encoding arguments shared by the workers
+typedef struct {
+    bpe_t* bpe;
+    const char** texts;
+    uint32_t* tokens;
+    size_t* offsets;
+    uint32_t unk_token_id;
+    volatile int failed;
+} tokenizer_batch_args_t;
+
 // Forward declarations of static functions
 static int tokenizer_find_free_slot(void);
 static int tokenizer_exists(tokenizer_id_t id) __attribute__((unused));
 static int tokenizer_parse_json(const char* json, tokenizer_config_t* config);
-static int tokenizer_load_data(const char* path, void** tokenizer_memory, size_t* tokenizer_memory_size);
+static int tokenizer_load_data(const char* path, void** tokenizer_memory, size_t* tokenizer_memory_size, vocab_t* vocab, bpe_t* bpe);
 
 /**
  * Find a free tokenizer slot
@@ -242,9 +275,11 @@ static int tokenizer_parse_json(const char* json, tokenizer_config_t* config) {
  * @param path: Path to the tokenizer file
  * @param tokenizer_memory: Pointer to store the tokenizer memory
  * @param tokenizer_memory_size: Pointer to store the tokenizer memory size
+ * @param vocab: Vocabulary to build from the tokenizer file
+ * @param bpe: BPE encoder to build from the tokenizer file
  * @return: 0 on success, -1 on failure
  */
-static int tokenizer_load_data(const char* path, void** tokenizer_memory, size_t* tokenizer_memory_size) {
+static int tokenizer_load_data(const char* path, void** tokenizer_memory, size_t* tokenizer_memory_size, vocab_t* vocab, bpe_t* bpe) {
     // Load tokenizer data from the specified file
     if (!path || !tokenizer_memory || !tokenizer_memory_size) {
         return -1;
@@ -285,6 +320,17 @@ static int tokenizer_load_data(const char* path, void** tokenizer_memory, size_t
     // Close the file
     fclose(file);
     
+    // Build the vocabulary and merges before the header overwrites the start of
+    // the file; without them, lookups fall back to the special tokens and
+    // encoding to whitespace splitting
+    if (vocab_load_json(vocab, (const char*)memory, file_size) != 0) {
+        memset(vocab, 0, sizeof(vocab_t));
+    }
+    
+    if (bpe_init(bpe, vocab, (const char*)memory, file_size) != 0) {
+        memset(bpe, 0, sizeof(bpe_t));
+    }
+    
     // Create a header structure at the beginning of the memory
     tokenizer_header_t* header = (tokenizer_header_t*)memory;
     header->magic = 0x544F4B4E;  // "TOKN" in ASCII
@@ -318,6 +364,10 @@ int tokenizer_init(void) {
         tokenizers[i].id = 0;
         tokenizers[i].tokenizer_memory = NULL;
         tokenizers[i].tokenizer_memory_size = 0;
+        memset(&tokenizers[i].vocab, 0, sizeof(vocab_t));
+        memset(&tokenizers[i].bpe, 0, sizeof(bpe_t));
+        tokenizers[i].tokens_encoded = 0;
+        tokenizers[i].encode_time_us = 0;
         tokenizers[i].loaded = 0;
         tokenizers[i].memory_usage = 0;
         tokenizers[i].load_time = 0;
@@ -351,10 +401,31 @@ int tokenizer_shutdown(void) {
                 tokenizers[i].tokenizer_memory_size = 0;
             }
             
+            // Free the encoder and vocabulary
+            bpe_free(&tokenizers[i].bpe);
+            vocab_free(&tokenizers[i].vocab);
+            
             tokenizers[i].loaded = 0;
         }
     }
     
+    // Stop the batch worker pool
+    while (__sync_lock_test_and_set(&tokenizer_lock, 1)) {
+        __asm__ volatile("pause");
+    }
+    
+    if (tokenizer_pool) {
+        dl_pool_destroy(tokenizer_pool);
+        tokenizer_pool = NULL;
+    }
+    
+    for (int i = 0; i < DL_POOL_MAX_WORKERS; i++) {
+        memory_free(tokenizer_scratch[i], sizeof(bpe_scratch_t));
+        tokenizer_scratch[i] = NULL;
+    }
+    
+    __sync_lock_release(&tokenizer_lock);
+    
     // Reset the initialized flag
     tokenizer_initialized = 0;
     
@@ -390,6 +461,10 @@ tokenizer_id_t tokenizer_create(const tokenizer_config_t* config) {
     tokenizers[slot].config = *config;
     tokenizers[slot].tokenizer_memory = NULL;
     tokenizers[slot].tokenizer_memory_size = 0;
+    memset(&tokenizers[slot].vocab, 0, sizeof(vocab_t));
+    memset(&tokenizers[slot].bpe, 0, sizeof(bpe_t));
+    tokenizers[slot].tokens_encoded = 0;
+    tokenizers[slot].encode_time_us = 0;
     tokenizers[slot].loaded = 1;
     tokenizers[slot].memory_usage = 0;
     tokenizers[slot].load_time = 0;
@@ -431,7 +506,7 @@ tokenizer_id_t tokenizer_load(const char* path) {
     strncpy(tokenizers[slot].config.path, path, sizeof(tokenizers[slot].config.path) - 1);
     
     // Load the tokenizer data
-    if (tokenizer_load_data(path, &tokenizers[slot].tokenizer_memory, &tokenizers[slot].tokenizer_memory_size) != 0) {
+    if (tokenizer_load_data(path, &tokenizers[slot].tokenizer_memory, &tokenizers[slot].tokenizer_memory_size, &tokenizers[slot].vocab, &tokenizers[slot].bpe) != 0) {
         return 0;
     }
     
@@ -439,13 +514,16 @@ tokenizer_id_t tokenizer_load(const char* path) {
     tokenizers[slot].id = next_tokenizer_id++;
     
     // Set the memory usage
-    tokenizers[slot].memory_usage = tokenizers[slot].tokenizer_memory_size;
+    tokenizers[slot].memory_usage = tokenizers[slot].tokenizer_memory_size + tokenizers[slot].vocab.alloc_size +
+                                    tokenizers[slot].bpe.alloc_size;
     
     // Set the load time
     tokenizers[slot].load_time = 100;  // 100 ms
     
     // Set the tokenization time
     tokenizers[slot].tokenization_time = 0;
+    tokenizers[slot].tokens_encoded = 0;
+    tokenizers[slot].encode_time_us = 0;
     
     // Set the loaded flag
     tokenizers[slot].loaded = 1;
@@ -486,6 +564,10 @@ int tokenizer_delete(tokenizer_id_t tokenizer_id) {
         tokenizers[slot].tokenizer_memory_size = 0;
     }
     
+    // Free the encoder and vocabulary
+    bpe_free(&tokenizers[slot].bpe);
+    vocab_free(&tokenizers[slot].vocab);
+    
     // Reset the tokenizer
     tokenizers[slot].id = 0;
     tokenizers[slot].loaded = 0;
@@ -537,6 +619,14 @@ int tokenizer_get_info(tokenizer_id_t tokenizer_id, tokenizer_state_t* state) {
     state->tokenization_time = tokenizers[slot].tokenization_time;
     state->vocab_size = tokenizers[slot].config.vocab_size;
     state->max_length = tokenizers[slot].config.max_length;
+    state->tokens_encoded = tokenizers[slot].tokens_encoded;
+    state->tokens_per_second = tokenizers[slot].encode_time_us > 0 ?
+        tokenizers[slot].tokens_encoded * 1000000 / tokenizers[slot].encode_time_us : 0;
+    
+    bpe_stats_t bpe_stats = {0, 0, 0, 0};
+    bpe_get_stats(&tokenizers[slot].bpe, &bpe_stats);
+    state->cache_hits = bpe_stats.cache_hits;
+    state->cache_misses = bpe_stats.cache_misses;
     
     return 0;
 }
@@ -664,8 +754,13 @@ int tokenizer_get_token_id(tokenizer_id_t tokenizer_id, const char* token) {
     }
     
     // Look up the token ID in the tokenizer's vocabulary
+    uint32_t token_id;
+    
+    if (vocab_lookup(&tokenizers[slot].vocab, token, strlen(token), &token_id) == 0) {
+        return (int)token_id;
+    }
     
-    // First check for special tokens
+    // Then check for special tokens
     if (strcmp(token, tokenizers[slot].config.bos_token) == 0) {
         return tokenizers[slot].config.bos_token_id;
     } else if (strcmp(token, tokenizers[slot].config.eos_token) == 0) {
@@ -721,8 +816,21 @@ int tokenizer_get_token_text(tokenizer_id_t tokenizer_id, uint32_t token_id, cha
     }
     
     // Look up the token text in the tokenizer's vocabulary
+    size_t text_len;
+    const char* text = vocab_get_text(&tokenizers[slot].vocab, token_id, &text_len);
+    
+    if (text) {
+        if (text_len >= token_size) {
+            text_len = token_size - 1;
+        }
+        
+        memcpy(token, text, text_len);
+        token[text_len] = '\0';
+        
+        return 0;
+    }
     
-    // First check for special tokens
+    // Then check for special tokens
     if (token_id == tokenizers[slot].config.bos_token_id) {
         strncpy(token, tokenizers[slot].config.bos_token, token_size - 1);
         token[token_size - 1] = '\0';
@@ -788,8 +896,8 @@ int tokenizer_tokenize(tokenizer_id_t tokenizer_id, const char* text, tokenizati
     // Record start time for performance measurement
     struct timeval start_time, end_time;
     gettimeofday(&start_time, NULL);
+    uint64_t trace_start = trace_begin(&tokenizer_trace_tokenize);
     
-    // Simple tokenization: split by whitespace
     size_t max_tokens = MAX_TOKENS;
     result->tokens = (token_t*)malloc(max_tokens * sizeof(token_t));
     
@@ -800,6 +908,41 @@ int tokenizer_tokenize(tokenizer_id_t tokenizer_id, const char* text, tokenizati
     size_t token_count = 0;
     const char* p = text;
     
+    // Byte-level BPE when the tokenizer file has merges
+    if (tokenizers[slot].bpe.merges) {
+        uint32_t* ids = (uint32_t*)malloc(max_tokens * sizeof(uint32_t));
+        
+        if (!ids || bpe_encode(&tokenizers[slot].bpe, text, strlen(text), ids, max_tokens, &token_count) != 0) {
+            free(ids);
+            free(result->tokens);
+            result->tokens = NULL;
+            return -1;
+        }
+        
+        for (size_t i = 0; i < token_count; i++) {
+            token_t* token = &result->tokens[i];
+            size_t len = 0;
+            const char* token_text = vocab_get_text(&tokenizers[slot].vocab, ids[i], &len);
+            
+            token->id = ids[i] != VOCAB_NO_TOKEN ? ids[i] : tokenizers[slot].config.unk_token_id;
+            token->score = 1.0f;
+            
+            if (len >= sizeof(token->text)) {
+                len = sizeof(token->text) - 1;
+            }
+            
+            if (token_text) {
+                memcpy(token->text, token_text, len);
+            }
+            token->text[token_text ? len : 0] = '\0';
+        }
+        
+        free(ids);
+        p = text + strlen(text);
+    }
+    
+    // Otherwise split by whitespace
+    
     // Skip leading whitespace
     while (*p && isspace(*p)) {
         p++;
@@ -849,6 +992,8 @@ int tokenizer_tokenize(tokenizer_id_t tokenizer_id, const char* text, tokenizati
     // Update the tokenizer's tokenization time
     tokenizers[slot].tokenization_time = tokenization_time;
     
+    trace_end(&tokenizer_trace_tokenize, trace_start, tokenizer_id, (uint32_t)token_count);
+    
     return 0;
 }
 
@@ -891,6 +1036,17 @@ int tokenizer_detokenize(tokenizer_id_t tokenizer_id, const uint32_t* tokens, si
     text[0] = '\0';
     size_t current_len = 0;
     
+    // Byte-level BPE tokens carry their own spacing
+    if (tokenizers[slot].bpe.merges) {
+        for (size_t i = 0; i < num_tokens && current_len + 1 < text_size; i++) {
+            if (tokens[i] != tokenizers[slot].config.pad_token_id) {
+                current_len += bpe_decode(&tokenizers[slot].bpe, &tokens[i], 1, text + current_len, text_size - current_len);
+            }
+        }
+        
+        return 0;
+    }
+    
     // Convert token IDs to text
     for (size_t i = 0; i < num_tokens; i++) {
         // Skip special tokens
@@ -967,6 +1123,32 @@ int tokenizer_encode(tokenizer_id_t tokenizer_id, const char* text, uint32_t* to
         return -1;
     }
     
+    // Byte-level BPE encodes straight into the output buffer
+    if (tokenizers[slot].bpe.merges) {
+        struct timeval start_time, end_time;
+        gettimeofday(&start_time, NULL);
+        
+        if (bpe_encode(&tokenizers[slot].bpe, text, strlen(text), tokens, tokens_size, num_tokens) != 0) {
+            return -1;
+        }
+        
+        for (size_t i = 0; i < *num_tokens; i++) {
+            if (tokens[i] == VOCAB_NO_TOKEN) {
+                tokens[i] = tokenizers[slot].config.unk_token_id;
+            }
+        }
+        
+        // Track the encoding throughput
+        gettimeofday(&end_time, NULL);
+        uint64_t elapsed_us = (uint64_t)(end_time.tv_sec - start_time.tv_sec) * 1000000 +
+                              (uint64_t)(end_time.tv_usec - start_time.tv_usec);
+        
+        tokenizers[slot].tokens_encoded += *num_tokens;
+        tokenizers[slot].encode_time_us += elapsed_us;
+        
+        return 0;
+    }
+    
     // Tokenize the text
     tokenization_result_t result;
     if (tokenizer_tokenize(tokenizer_id, text, &result) != 0) {
@@ -992,6 +1174,222 @@ int tokenizer_encode(tokenizer_id_t tokenizer_id, const char* text, uint32_t* to
     return 0;
 }
 
+/**
+ * Encode a range of batch texts into their reserved regions
+ * 
+ * offsets[i] holds the start of the region of text i on entry and its
+ * token count on return; no other entry is touched.
+ * 
+ * @param arg: Batch arguments
+ * @param begin: First text
+ * @param end: One past the last text
+ */
+static void tokenizer_encode_batch_range(void* arg, uint32_t begin, uint32_t end) {
+    tokenizer_batch_args_t* args = (tokenizer_batch_args_t*)arg;
+    
+    // Each worker merges with its own scratch space
+    bpe_scratch_t* scratch = tokenizer_scratch[dl_pool_get_current_worker(tokenizer_pool)];
+    
+    for (uint32_t i = begin; i < end; i++) {
+        size_t len = strlen(args->texts[i]);
+        uint32_t* ids = args->tokens + args->offsets[i];
+        size_t count = 0;
+        
+        if (bpe_encode_scratch(args->bpe, scratch, args->texts[i], len, ids, len, &count) != 0) {
+            args->offsets[i] = 0;
+            args->failed = 1;
+            continue;
+        }
+        
+        for (size_t j = 0; j < count; j++) {
+            if (ids[j] == VOCAB_NO_TOKEN) {
+                ids[j] = args->unk_token_id;
+            }
+        }
+        
+        args->offsets[i] = count;
+    }
+}
+
+/**
+ * Create the batch worker pool and the scratch space of its workers
+ * 
+ * Must be called with tokenizer_lock held.
+ * 
+ * @param num_threads: Number of threads, including the calling thread
+ * @return: 0 on success, -1 on failure
+ */
+static int tokenizer_pool_start(uint32_t num_threads) {
+    if (!tokenizer_pool) {
+        tokenizer_pool = dl_pool_create(num_threads);
+        
+        if (!tokenizer_pool) {
+            return -1;
+        }
+    }
+    
+    uint32_t num_workers = dl_pool_get_num_workers(tokenizer_pool);
+    
+    for (uint32_t i = 0; i < num_workers; i++) {
+        if (!tokenizer_scratch[i]) {
+            tokenizer_scratch[i] = (bpe_scratch_t*)memory_alloc(sizeof(bpe_scratch_t),
+                                                                MEMORY_PROT_READ | MEMORY_PROT_WRITE, 0);
+            if (!tokenizer_scratch[i]) {
+                return -1;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Encode a batch of texts into one flat token buffer
+ * 
+ * The tokens of text i are tokens[offsets[i]] up to tokens[offsets[i + 1]].
+ * With more than one thread, each text reserves one token per byte (the
+ * most byte-level BPE can produce) and the regions are compacted after
+ * the workers finish; batches that do not fit that way, or that arrive
+ * while another batch has the pool, are encoded on the calling thread.
+ * 
+ * @param tokenizer_id: Tokenizer ID
+ * @param texts: Input texts
+ * @param num_texts: Number of texts
+ * @param tokens: Output tokens buffer
+ * @param tokens_size: Output tokens buffer size
+ * @param offsets: Output offsets buffer (num_texts + 1 entries)
+ * @param num_threads: Number of threads to use (0 or 1 for the calling thread only)
+ * @return: 0 on success, -1 on failure or if the tokens buffer fills up
+ */
+int tokenizer_encode_batch(tokenizer_id_t tokenizer_id, const char** texts, size_t num_texts, uint32_t* tokens, size_t tokens_size, size_t* offsets, uint32_t num_threads) {
+    // Check if the Tokenizer is initialized
+    if (!tokenizer_initialized) {
+        return -1;
+    }
+    
+    // Check if the texts, tokens, and offsets pointers are valid
+    if (!texts || !tokens || !offsets) {
+        return -1;
+    }
+    
+    // Find the tokenizer
+    int slot = -1;
+    
+    for (int i = 0; i < MAX_TOKENIZERS; i++) {
+        if (tokenizers[i].loaded && tokenizers[i].id == tokenizer_id) {
+            slot = i;
+            break;
+        }
+    }
+    
+    if (slot == -1) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < num_texts; i++) {
+        if (!texts[i]) {
+            return -1;
+        }
+    }
+    
+    struct timeval start_time, end_time;
+    gettimeofday(&start_time, NULL);
+    
+    int result = 0;
+    int encoded = 0;
+    
+    // Split the batch across the worker pool
+    if (tokenizers[slot].bpe.merges && num_threads > 1 && num_texts > TOKENIZER_BATCH_GRAIN && num_texts <= UINT32_MAX) {
+        // Reserve one region per text, using offsets for the region starts
+        size_t total = 0;
+        
+        for (size_t i = 0; i < num_texts; i++) {
+            offsets[i] = total;
+            total += strlen(texts[i]);
+        }
+        offsets[num_texts] = total;
+        
+        if (total <= tokens_size && !__sync_lock_test_and_set(&tokenizer_lock, 1)) {
+            if (tokenizer_pool_start(num_threads) == 0) {
+                tokenizer_batch_args_t args = {
+                    &tokenizers[slot].bpe, texts, tokens, offsets,
+                    tokenizers[slot].config.unk_token_id, 0
+                };
+                
+                if (dl_pool_parallel_for(tokenizer_pool, (uint32_t)num_texts, TOKENIZER_BATCH_GRAIN, tokenizer_encode_batch_range, &args) != 0) {
+                    args.failed = 1;
+                }
+                
+                // Compact the regions; each one only moves towards the front
+                size_t used = 0;
+                size_t region = 0;
+                
+                for (size_t i = 0; i < num_texts; i++) {
+                    size_t count = offsets[i];
+                    
+                    memmove(tokens + used, tokens + region, count * sizeof(uint32_t));
+                    offsets[i] = used;
+                    used += count;
+                    region += strlen(texts[i]);
+                }
+                offsets[num_texts] = used;
+                
+                result = args.failed ? -1 : 0;
+                encoded = 1;
+            }
+            
+            __sync_lock_release(&tokenizer_lock);
+        }
+    }
+    
+    // Encode the texts one after another on the calling thread
+    if (!encoded) {
+        size_t used = 0;
+        
+        for (size_t i = 0; i < num_texts; i++) {
+            size_t count = 0;
+            
+            offsets[i] = used;
+            
+            if (used == tokens_size) {
+                result = -1;
+                continue;
+            }
+            
+            if (tokenizers[slot].bpe.merges) {
+                if (bpe_encode(&tokenizers[slot].bpe, texts[i], strlen(texts[i]), tokens + used, tokens_size - used, &count) != 0) {
+                    result = -1;
+                    continue;
+                }
+                
+                for (size_t j = used; j < used + count; j++) {
+                    if (tokens[j] == VOCAB_NO_TOKEN) {
+                        tokens[j] = tokenizers[slot].config.unk_token_id;
+                    }
+                }
+            } else if (tokenizer_encode(tokenizer_id, texts[i], tokens + used, tokens_size - used, &count) != 0) {
+                result = -1;
+                continue;
+            }
+            
+            used += count;
+        }
+        offsets[num_texts] = used;
+    }
+    
+    // Track the encoding throughput
+    gettimeofday(&end_time, NULL);
+    uint64_t elapsed_us = (uint64_t)(end_time.tv_sec - start_time.tv_sec) * 1000000 +
+                          (uint64_t)(end_time.tv_usec - start_time.tv_usec);
+    
+    if (tokenizers[slot].bpe.merges) {
+        tokenizers[slot].tokens_encoded += offsets[num_texts];
+        tokenizers[slot].encode_time_us += elapsed_us;
+    }
+    
+    return result;
+}
+
 /**
  * Decode tokens into text
  * 
@@ -71,6 +71,10 @@ typedef struct {
     uint64_t tokenization_time;
     uint32_t vocab_size;
     uint32_t max_length;
+    uint64_t tokens_encoded;
+    uint64_t tokens_per_second;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
 } tokenizer_state_t;
 
 // Tokenizer initialization and shutdown
@@ -85,6 +89,7 @@ int tokenizer_get_info(tokenizer_id_t tokenizer_id, tokenizer_state_t* state);
 int tokenizer_tokenize(tokenizer_id_t tokenizer_id, const char* text, tokenization_result_t* result);
 int tokenizer_detokenize(tokenizer_id_t tokenizer_id, const uint32_t* tokens, size_t num_tokens, char* text, size_t text_size);
 int tokenizer_encode(tokenizer_id_t tokenizer_id, const char* text, uint32_t* tokens, size_t tokens_size, size_t* num_tokens);
+int tokenizer_encode_batch(tokenizer_id_t tokenizer_id, const char** texts, size_t num_texts, uint32_t* tokens, size_t tokens_size, size_t* offsets, uint32_t num_threads);
 int tokenizer_decode(tokenizer_id_t tokenizer_id, const uint32_t* tokens, size_t num_tokens, char* text, size_t text_size);
 void tokenizer_free_tokenization_result(tokenization_result_t* result);
 int tokenizer_load_config(const char* path, tokenizer_config_t* config);
@@ -6,6 +6,9 @@
  */
 
 #include "shell/shell.h"
+#include "../../kernel/include/console.h"
+#include "../../kernel/include/memory.h"
+#include "../../kernel/include/trace.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -76,6 +79,8 @@ int shell_init(void) {
     shell_register_command("ps", "Report process status", shell_cmd_ps);
     shell_register_command("kill", "Send a signal to a process", shell_cmd_kill);
     shell_register_command("exec", "Execute a command", shell_cmd_exec);
+    shell_register_command("dmesg", "Print the kernel console log", shell_cmd_dmesg);
+    shell_register_command("trace", "Record and export kernel trace events", shell_cmd_trace);
     
     return 0;
 }
@@ -1730,3 +1735,150 @@ int shell_cmd_exec(int argc, char** argv) {
     shell_printf("Error: Failed to execute command: %s\n", argv[1]);
     return -1;
 }
+
+/**
+ * Print the kernel console log command
+ * 
+ * @param argc: Argument count
+ * @param argv: Argument array (-c clears the log after printing it)
+ * @return: Command exit code
+ */
+int shell_cmd_dmesg(int argc, char** argv) {
+    // Check if the Shell is initialized
+    if (!shell_initialized) {
+        return -1;
+    }
+    
+    // Parse the arguments
+    int clear = 0;
+    
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") != 0) {
+            shell_printf("Usage: dmesg [-c]\n");
+            return -1;
+        }
+        
+        clear = 1;
+    }
+    
+    // Read the log
+    char* buffer = (char*)memory_alloc(CONSOLE_LOG_HISTORY_SIZE + 1, MEMORY_PROT_READ | MEMORY_PROT_WRITE,
+                                       MEMORY_ALLOC_NONE);
+    
+    if (!buffer) {
+        shell_printf("Error: Failed to allocate memory\n");
+        return -1;
+    }
+    
+    size_t length = console_log_read(buffer, CONSOLE_LOG_HISTORY_SIZE + 1);
+    
+    // Print the log
+    shell_printf("%s", buffer);
+    
+    if (length > 0 && buffer[length - 1] != '\n') {
+        shell_printf("\n");
+    }
+    
+    if (clear) {
+        console_log_clear();
+    }
+    
+    memory_free(buffer, CONSOLE_LOG_HISTORY_SIZE + 1);
+    
+    return 0;
+}
+
+/**
+ * Write part of an exported trace to a file
+ * 
+ * @param ctx: File to write to
+ * @param data: Trace data
+ * @param size: Size of the data
+ * @return: 0 on success, -1 on failure
+ */
+static int shell_trace_write(void* ctx, const void* data, size_t size) {
+    return fwrite(data, 1, size, (FILE*)ctx) == size ? 0 : -1;
+}
+
+/**
+ * Kernel tracing command
+ * 
+ * @param argc: Argument count
+ * @param argv: Argument array (start [category...], stop, clear, stats or
+ *              dump <file>; dump writes a Chrome trace / Perfetto file)
+ * @return: Command exit code
+ */
+int shell_cmd_trace(int argc, char** argv) {
+    // Check if the Shell is initialized
+    if (!shell_initialized) {
+        return -1;
+    }
+    
+    if (argc < 2) {
+        shell_printf("Usage: trace start [category...] | stop | clear | stats | dump <file>\n");
+        return -1;
+    }
+    
+    if (strcmp(argv[1], "start") == 0) {
+        // Trace every category unless some are named
+        uint32_t categories = argc > 2 ? 0 : TRACE_CAT_ALL;
+        
+        for (int i = 2; i < argc; i++) {
+            uint32_t category = 0;
+            
+            for (int bit = 0; bit < TRACE_CAT_COUNT; bit++) {
+                if (strcmp(argv[i], trace_category_name(1u << bit)) == 0) {
+                    category = 1u << bit;
+                }
+            }
+            
+            if (strcmp(argv[i], "all") == 0) {
+                category = TRACE_CAT_ALL;
+            }
+            
+            if (!category) {
+                shell_printf("Error: Unknown trace category '%s'\n", argv[i]);
+                return -1;
+            }
+            
+            categories |= category;
+        }
+        
+        trace_start(categories);
+    } else if (strcmp(argv[1], "stop") == 0) {
+        trace_stop(TRACE_CAT_ALL);
+    } else if (strcmp(argv[1], "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(argv[1], "stats") == 0) {
+        trace_stats_t stats;
+        trace_get_stats(&stats);
+        
+        for (int bit = 0; bit < TRACE_CAT_COUNT; bit++) {
+            shell_printf("%-8s %-3s %u events\n", trace_category_name(1u << bit),
+                         (stats.categories & (1u << bit)) ? "on" : "off", (uint32_t)stats.events[bit]);
+        }
+        
+        shell_printf("%u events overwritten\n", (uint32_t)stats.overwritten);
+    } else if (strcmp(argv[1], "dump") == 0 && argc == 3) {
+        FILE* file = fopen(argv[2], "wb");
+        
+        if (!file) {
+            shell_printf("Error: Failed to open '%s'\n", argv[2]);
+            return -1;
+        }
+        
+        int result = trace_export_json(shell_trace_write, file);
+        
+        fclose(file);
+        
+        if (result != 0) {
+            shell_printf("Error: Failed to write the trace to '%s'\n", argv[2]);
+            return -1;
+        }
+    } else {
+        shell_printf("Usage: trace start [category...] | stop | clear | stats | dump <file>\n");
+        return -1;
+    }
+    
+    return 0;
+}
@@ -75,5 +75,7 @@ int shell_cmd_date(int argc, char** argv);
 int shell_cmd_ps(int argc, char** argv);
 int shell_cmd_kill(int argc, char** argv);
 int shell_cmd_exec(int argc, char** argv);
+int shell_cmd_dmesg(int argc, char** argv);
+int shell_cmd_trace(int argc, char** argv);
 
 #endif // NEUROOS_SHELL_H
@@ -51,6 +51,21 @@ GRUB_DIR="$BOOT_DIR/grub"
 KERNEL_DIR="kernel"
 MODULES_DIR="modules"
 
+# Compiler flags
+# Set NEUROOS_SIMD=1 to build the SSE2/AVX2 compute kernels (selected at boot via CPUID)
+# Set NEUROOS_LIBC_BENCH=1 to run the libc microbenchmark at the end of boot
+# Set NEUROOS_INFERENCE_BENCH=1 to run the inference benchmark at the end of boot
+CFLAGS="-m32 -ffreestanding -fno-builtin -fno-stack-protector -O2 -Wall -Wextra"
+if [ "${NEUROOS_SIMD:-0}" = "1" ]; then
+    CFLAGS="$CFLAGS -DNEUROOS_SIMD"
+fi
+if [ "${NEUROOS_LIBC_BENCH:-0}" = "1" ]; then
+    CFLAGS="$CFLAGS -DNEUROOS_LIBC_BENCH"
+fi
+if [ "${NEUROOS_INFERENCE_BENCH:-0}" = "1" ]; then
+    CFLAGS="$CFLAGS -DNEUROOS_INFERENCE_BENCH"
+fi
+
 # Create build directories
 echo -e "${BLUE}Creating build directories...${NC}"
 mkdir -p $BUILD_DIR
@@ -79,7 +94,10 @@ int process_get_file_descriptor_count(void) { return 0; }
 char* process_get_file_path(int fd) { (void)fd; return NULL; }
 int process_is_fd_open(int fd) { (void)fd; return 0; }
 int process_open_file(const char* path, int flags) { (void)path; (void)flags; return -1; }
-void* process_get_memory_regions(void) { return NULL; }
+// No per-process memory regions are tracked yet, so sandbox memory
+// snapshots have nothing to watch for copy-on-write
+int process_get_memory_regions(int pid, void* regions, int count) { (void)pid; (void)regions; (void)count; return 0; }
+int process_get_memory_region_count(int pid) { (void)pid; return 0; }
 void* process_get_network_connections(void) { return NULL; }
 void* process_get_open_devices(void) { return NULL; }
 int process_suspend(int pid) { (void)pid; return 0; }
@@ -212,7 +230,7 @@ STUBSC
 
 # Compile stubs
 echo "Compiling stubs.c..."
-gcc -m32 -ffreestanding -fno-builtin -fno-stack-protector -O2 -Wall -Wextra -c $BUILD_DIR/stubs.c -o $BUILD_DIR/stubs.o
+gcc $CFLAGS -c $BUILD_DIR/stubs.c -o $BUILD_DIR/stubs.o
 
 # Compile kernel
 echo -e "${BLUE}Compiling kernel...${NC}"
@@ -222,7 +240,7 @@ KERNEL_OBJECTS=""
 for source in $KERNEL_SOURCES; do
     object="$BUILD_DIR/$(basename ${source%.c}.o)"
     echo "Compiling $source..."
-    gcc -m32 -ffreestanding -fno-builtin -fno-stack-protector -O2 -Wall -Wextra -I$KERNEL_DIR/include -c $source -o $object
+    gcc $CFLAGS -I$KERNEL_DIR/include -c $source -o $object
     KERNEL_OBJECTS="$KERNEL_OBJECTS $object"
 done
 
@@ -246,7 +264,7 @@ MODULE_OBJECTS=""
 for source in $MODULE_SOURCES; do
     object="$BUILD_DIR/$(basename ${source%.c}.o)"
     echo "Compiling $source..."
-    gcc -m32 -ffreestanding -fno-builtin -fno-stack-protector -O2 -Wall -Wextra -I$KERNEL_DIR/include -I$MODULES_DIR -c $source -o $object
+    gcc $CFLAGS -I$KERNEL_DIR/include -I$MODULES_DIR -c $source -o $object
     MODULE_OBJECTS="$MODULE_OBJECTS $object"
 done
 